@@ -1,20 +1,24 @@
 #include "etc/sokol/shaders/atmosphere.glsl"
 
-uniform mat4 u_mat_v;
-uniform vec3 u_eye_pos;
-uniform vec3 u_light_pos;
-uniform vec3 u_night_color;
-uniform float u_aspect;
-uniform float u_offset;
+SOKOL_UNIFORM_BLOCK(atmos_fs_params)
+SOKOL_UNIFORM mat4 u_mat_v;
+SOKOL_UNIFORM vec3 u_eye_pos;
+SOKOL_UNIFORM float u_aspect;
+SOKOL_UNIFORM vec3 u_light_pos;
+SOKOL_UNIFORM float u_offset;
+SOKOL_UNIFORM vec3 u_night_color;
+SOKOL_UNIFORM_BLOCK_END
 
-uniform float intensity;
-uniform float planet_radius;
-uniform float atmosphere_radius;
-uniform vec3 rayleigh_coef;
-uniform float mie_coef;
-uniform float rayleigh_scale_height;
-uniform float mie_scale_height;
-uniform float mie_scatter_dir;
+SOKOL_UNIFORM_BLOCK(atmos_fs_coefs)
+SOKOL_UNIFORM vec3 rayleigh_coef;
+SOKOL_UNIFORM float intensity;
+SOKOL_UNIFORM float planet_radius;
+SOKOL_UNIFORM float atmosphere_radius;
+SOKOL_UNIFORM float mie_coef;
+SOKOL_UNIFORM float rayleigh_scale_height;
+SOKOL_UNIFORM float mie_scale_height;
+SOKOL_UNIFORM float mie_scatter_dir;
+SOKOL_UNIFORM_BLOCK_END
 
 in vec2 uv;
 out vec4 frag_color;
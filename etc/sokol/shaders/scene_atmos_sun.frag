@@ -1,8 +1,11 @@
 uniform sampler2D atmos;
-uniform vec3 u_sun_screen_pos;
-uniform vec3 u_sun_color;
-uniform float u_aspect;
-uniform float u_sun_intensity;
+SOKOL_UNIFORM_BLOCK(scene_sun_params)
+SOKOL_UNIFORM vec3 u_sun_screen_pos;
+SOKOL_UNIFORM float u_aspect;
+SOKOL_UNIFORM vec3 u_sun_color;
+SOKOL_UNIFORM float u_sun_intensity;
+SOKOL_UNIFORM vec2 u_target_size;
+SOKOL_UNIFORM_BLOCK_END
 
 in vec2 uv;
 out vec4 frag_color;
@@ -1,23 +1,39 @@
 #include "etc/sokol/shaders/common.glsl"
 
-uniform vec3 u_light_ambient;
-uniform vec3 u_light_ambient_ground;
-uniform vec3 u_light_direction;
-uniform vec3 u_light_color;
-uniform vec3 u_eye_pos;
-uniform float u_light_ambient_ground_falloff;
-uniform float u_light_ambient_ground_offset;
-uniform float u_light_ambient_ground_intensity;
-uniform float u_shadow_map_size;
-uniform sampler2D shadow_map;
-uniform float u_shadow_far;
-
-#define MAX_LIGHT_COUNT 64
-uniform vec3 u_point_light_color[MAX_LIGHT_COUNT];
-uniform vec3 u_point_light_position[MAX_LIGHT_COUNT];
-uniform float u_point_light_distance[MAX_LIGHT_COUNT];
+SOKOL_UNIFORM_BLOCK(scene_fs_params)
+SOKOL_UNIFORM vec3 u_light_ambient;
+SOKOL_UNIFORM float u_light_ambient_ground_falloff;
+SOKOL_UNIFORM vec3 u_light_ambient_ground;
+SOKOL_UNIFORM float u_light_ambient_ground_offset;
+SOKOL_UNIFORM vec3 u_light_direction;
+SOKOL_UNIFORM float u_light_ambient_ground_intensity;
+SOKOL_UNIFORM vec3 u_light_color;
+SOKOL_UNIFORM float u_shadow_map_size;
+SOKOL_UNIFORM vec3 u_eye_pos;
+SOKOL_UNIFORM float u_shadow_far;
+SOKOL_UNIFORM int u_light_count;
+SOKOL_UNIFORM float u_cluster_depth_scale;
+SOKOL_UNIFORM vec2 u_cluster_tile_scale;
+SOKOL_UNIFORM float u_cluster_depth_bias;
+SOKOL_UNIFORM_BLOCK_END
+
+#ifdef CLUSTERED_LIGHTS
+// Lights (position relative to eye & distance, color), offset & count of the
+// light indices per cluster, and light indices.
+uniform highp sampler2D u_light_data;
+uniform highp usampler2D u_light_clusters;
+uniform highp usampler2D u_light_indices;
+in float view_depth;
+#else
+// Light distance is stored in the w component of the position
+#define MAX_LIGHT_COUNT 32
+SOKOL_UNIFORM_BLOCK(scene_fs_lights)
+SOKOL_UNIFORM vec4 u_point_light_color[MAX_LIGHT_COUNT];
+SOKOL_UNIFORM vec4 u_point_light_position[MAX_LIGHT_COUNT];
+SOKOL_UNIFORM_BLOCK_END
+#endif
 
-uniform int u_light_count;
+uniform sampler2D shadow_map;
 
 in vec4 position;
 in vec4 light_position;
@@ -106,19 +122,55 @@ vec3 applyLight(vec3 n, vec3 v, float shininess, vec3 pos, vec3 color, float max
   }
 }
 
+#ifdef CLUSTERED_LIGHTS
+ivec2 clusterTexel(int i) {
+  return ivec2(i % CLUSTER_TEXTURE_WIDTH, i / CLUSTER_TEXTURE_WIDTH);
+}
+
+vec3 applyLights(vec3 n, vec3 v, float shininess) {
+  ivec2 tile = ivec2(gl_FragCoord.xy * u_cluster_tile_scale);
+  tile = clamp(tile, ivec2(0, 0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+  int slice = int(log(max(view_depth, 0.0001)) * u_cluster_depth_scale + 
+    u_cluster_depth_bias);
+  slice = clamp(slice, 0, CLUSTER_Z - 1);
+
+  uvec2 cluster = texelFetch(u_light_clusters, 
+    ivec2(tile.y * CLUSTER_X + tile.x, slice), 0).xy;
+  int offset = int(cluster.x);
+  int count = int(cluster.y);
+
+  vec3 result = vec3(0.0, 0.0, 0.0);
+  for (int i = 0; i < count; i ++) {
+    int light = int(texelFetch(u_light_indices, clusterTexel(offset + i), 0).r);
+    vec4 pos = texelFetch(u_light_data, clusterTexel(light * 2), 0);
+    vec4 col = texelFetch(u_light_data, clusterTexel(light * 2 + 1), 0);
+
+    // Fade out lights at the edge of their range, which is the radius used
+    // for binning lights into clusters.
+    float range = pos.w * LIGHT_RANGE;
+    float d = length(position.xyz - (pos.xyz + u_eye_pos));
+    float fade = 1.0 - smoothstep(0.75 * range, range, d);
+
+    result += fade * applyLight(n, v, shininess, pos.xyz, col.rgb, pos.w);
+  }
+
+  return result;
+}
+#else
 vec3 applyLights(vec3 n, vec3 v, float shininess) {
   int i;
 
   vec3 result = vec3(0.0, 0.0, 0.0);
   for (i = 0; i < u_light_count; i ++) {
     result += applyLight(n, v, shininess,
-      u_point_light_position[i], 
-      u_point_light_color[i],
-      u_point_light_distance[i]);
+      u_point_light_position[i].xyz, 
+      u_point_light_color[i].rgb,
+      u_point_light_position[i].w);
   }
 
   return result;
 }
+#endif
 
 void main() {
   float specular_power = material.x;
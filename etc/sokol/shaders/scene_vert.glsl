@@ -3,13 +3,20 @@ out vec4 light_position;
 out vec3 normal;
 out vec4 color;
 out vec3 material;
+#ifdef CLUSTERED_LIGHTS
+out float view_depth;
+#endif
 
 void main() {
+  mat4 mat_m = instance_transform();
   vec4 pos4 = vec4(v_position, 1.0);
-  gl_Position = u_mat_vp * i_mat_m * pos4;
-  light_position = u_light_vp * i_mat_m * pos4;
-  position = (i_mat_m * pos4);
-  normal = (i_mat_m * vec4(v_normal, 0.0)).xyz;
-  color = vec4(i_color, 0.0);
-  material = i_material;
+  gl_Position = u_mat_vp * mat_m * pos4;
+  light_position = u_light_vp * mat_m * pos4;
+  position = (mat_m * pos4);
+  normal = (mat_m * vec4(v_normal, 0.0)).xyz;
+  color = vec4(instance_color(), 0.0);
+  material = instance_material();
+#ifdef CLUSTERED_LIGHTS
+  view_depth = -(u_mat_v * position).z;
+#endif
 }
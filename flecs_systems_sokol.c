@@ -27,11 +27,11 @@
 #endif
 
 #ifndef __EMSCRIPTEN__
-#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION
+#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION SOKOL_SHADER_UNIFORMS
 #define SOKOL_SHADER_VERSION "#version 330\n"
 #define SOKOL_SHADER_PRECISION "precision highp float;\n"
 #else
-#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION
+#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION SOKOL_SHADER_UNIFORMS
 #define SOKOL_SHADER_VERSION  "#version 300 es\n"
 #define SOKOL_SHADER_PRECISION "precision highp float;\n"
 #endif
@@ -273,6 +273,18 @@
         operation only references the valid (updated) data in the
         buffer or image.
 
+    --- to overwrite a sub-range of a buffer resource at a byte offset, call:
+
+            sg_update_buffer_range(sg_buffer buf, int offset, const sg_range* data)
+
+        Unlike sg_update_buffer(), sg_update_buffer_range() does not cycle
+        to the next internal buffer slot, so data outside the updated range
+        is preserved across frames. It can be called multiple times per
+        frame on the same buffer (but not in the same frame as
+        sg_append_buffer()). This is intended for buffers that are
+        persistently mapped to application data of which only small parts
+        change each frame. Currently only implemented for the GL backends.
+
     --- to append a chunk of data to a buffer resource, call:
 
             int sg_append_buffer(sg_buffer buf, const sg_range* data)
@@ -541,6 +553,23 @@
     to use the sokol-shdc shader cross-compiler tool!
 
 
+    GL UNIFORM BUFFERS
+    ==================
+    On GL backends other than GLES2, a std140 uniform block can be declared
+    as a GLSL uniform block, and its name can be passed in
+    sg_shader_uniform_block_desc.block_name:
+
+        layout(std140) uniform vs_params { mat4 mvp; vec2 offset0; };
+
+    If the linked program contains a uniform block with that name, the data
+    passed to sg_apply_uniforms() is copied into a ring-allocated uniform
+    buffer with a single glBufferSubData() call and bound with
+    glBindBufferRange(), instead of being uploaded with a glUniformXXX() call
+    per member. Otherwise the block members are uploaded as regular uniforms.
+    The size of the ring buffer is SOKOL_GL_UNIFORM_BUFFER_SIZE (default: 1 MB),
+    and must be larger than the uniform data applied in a frame.
+
+
     BACKEND-SPECIFIC TOPICS:
     ========================
     --- The GL backends need to know about the internal structure of uniform
@@ -2267,6 +2296,7 @@ typedef struct sg_shader_uniform_desc {
 typedef struct sg_shader_uniform_block_desc {
     size_t size;
     sg_uniform_layout layout;
+    const char* block_name;     // GLSL uniform block name (optional, GL only)
     sg_shader_uniform_desc uniforms[SG_MAX_UB_MEMBERS];
 } sg_shader_uniform_block_desc;
 
@@ -2631,6 +2661,7 @@ typedef struct sg_pass_info {
     _SG_LOGITEM_XMACRO(GL_VERTEX_ATTRIBUTE_NOT_FOUND_IN_SHADER, "vertex attribute not found in shader (gl)") \
     _SG_LOGITEM_XMACRO(GL_FRAMEBUFFER_INCOMPLETE, "framebuffer completeness check failed (gl)") \
     _SG_LOGITEM_XMACRO(GL_MSAA_FRAMEBUFFER_INCOMPLETE, "completeness check failed for msaa resolve framebuffer (gl)") \
+    _SG_LOGITEM_XMACRO(UPDATEBUFRANGE_NOT_SUPPORTED, "sg_update_buffer_range: not supported by backend") \
     _SG_LOGITEM_XMACRO(D3D11_CREATE_BUFFER_FAILED, "CreateBuffer() failed (d3d11)") \
     _SG_LOGITEM_XMACRO(D3D11_CREATE_DEPTH_TEXTURE_UNSUPPORTED_PIXEL_FORMAT, "pixel format not supported for depth-stencil texture (d3d11)") \
     _SG_LOGITEM_XMACRO(D3D11_CREATE_DEPTH_TEXTURE_FAILED, "CreateTexture2D() failed for depth-stencil texture (d3d11)") \
@@ -2793,6 +2824,9 @@ typedef struct sg_pass_info {
     _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUF_SIZE, "sg_update_buffer: update size is bigger than buffer size") \
     _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUF_ONCE, "sg_update_buffer: only one update allowed per buffer and frame") \
     _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUF_APPEND, "sg_update_buffer: cannot call sg_update_buffer and sg_append_buffer in same frame") \
+    _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUFRANGE_USAGE, "sg_update_buffer_range: cannot update immutable buffer") \
+    _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUFRANGE_SIZE, "sg_update_buffer_range: offset plus update size is bigger than buffer size") \
+    _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUFRANGE_APPEND, "sg_update_buffer_range: cannot call sg_update_buffer_range and sg_append_buffer in same frame") \
     _SG_LOGITEM_XMACRO(VALIDATE_APPENDBUF_USAGE, "sg_append_buffer: cannot append to immutable buffer") \
     _SG_LOGITEM_XMACRO(VALIDATE_APPENDBUF_SIZE, "sg_append_buffer: overall appended size is bigger than buffer size") \
     _SG_LOGITEM_XMACRO(VALIDATE_APPENDBUF_UPDATE, "sg_append_buffer: cannot call sg_append_buffer and sg_update_buffer in same frame") \
@@ -3059,6 +3093,7 @@ SOKOL_GFX_API_DECL void sg_destroy_shader(sg_shader shd);
 SOKOL_GFX_API_DECL void sg_destroy_pipeline(sg_pipeline pip);
 SOKOL_GFX_API_DECL void sg_destroy_pass(sg_pass pass);
 SOKOL_GFX_API_DECL void sg_update_buffer(sg_buffer buf, const sg_range* data);
+SOKOL_GFX_API_DECL void sg_update_buffer_range(sg_buffer buf, int offset, const sg_range* data);
 SOKOL_GFX_API_DECL void sg_update_image(sg_image img, const sg_image_data* data);
 SOKOL_GFX_API_DECL int sg_append_buffer(sg_buffer buf, const sg_range* data);
 SOKOL_GFX_API_DECL bool sg_query_buffer_overflow(sg_buffer buf);
@@ -3189,6 +3224,7 @@ inline void sg_init_pipeline(sg_pipeline pip_id, const sg_pipeline_desc& desc) {
 inline void sg_init_pass(sg_pass pass_id, const sg_pass_desc& desc) { return sg_init_pass(pass_id, &desc); }
 
 inline void sg_update_buffer(sg_buffer buf_id, const sg_range& data) { return sg_update_buffer(buf_id, &data); }
+inline void sg_update_buffer_range(sg_buffer buf_id, int offset, const sg_range& data) { return sg_update_buffer_range(buf_id, offset, &data); }
 inline int sg_append_buffer(sg_buffer buf_id, const sg_range& data) { return sg_append_buffer(buf_id, &data); }
 #endif
 #endif // SOKOL_GFX_INCLUDED
@@ -3228,6 +3264,9 @@ inline int sg_append_buffer(sg_buffer buf_id, const sg_range& data) { return sg_
 #ifndef SOKOL_UNREACHABLE
     #define SOKOL_UNREACHABLE SOKOL_ASSERT(false)
 #endif
+#ifndef SOKOL_GL_UNIFORM_BUFFER_SIZE
+    #define SOKOL_GL_UNIFORM_BUFFER_SIZE (1024 * 1024)
+#endif
 
 #ifndef _SOKOL_PRIVATE
     #if defined(__GNUC__) || defined(__clang__)
@@ -3423,6 +3462,10 @@ inline int sg_append_buffer(sg_buffer buf_id, const sg_range& data) { return sg_
         #define GL_TEXTURE_CUBE_MAP 0x8513
         #define GL_FUNC_SUBTRACT 0x800A
         #define GL_FUNC_REVERSE_SUBTRACT 0x800B
+        #define GL_UNIFORM_BUFFER 0x8A11
+        #define GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 0x8A34
+        #define GL_UNIFORM_BLOCK_DATA_SIZE 0x8A40
+        #define GL_INVALID_INDEX 0xFFFFFFFFu
         #define GL_CONSTANT_COLOR 0x8001
         #define GL_DECR_WRAP 0x8508
         #define GL_R8 0x8229
@@ -4056,6 +4099,7 @@ typedef struct {
 typedef struct {
     int num_uniforms;
     _sg_gl_uniform_t uniforms[SG_MAX_UB_MEMBERS];
+    bool gl_buffer;     /* block is bound from the uniform buffer */
 } _sg_gl_uniform_block_t;
 
 typedef struct {
@@ -4188,6 +4232,9 @@ typedef struct {
     _sg_gl_state_cache_t cache;
     bool ext_anisotropic;
     GLint max_anisotropy;
+    GLuint ubo;             /* ring buffer for uniform blocks */
+    GLint ubo_align;
+    int ubo_offset;
     #if _SOKOL_USE_WIN32_GL_LOADER
     HINSTANCE opengl32_dll;
     #endif
@@ -5516,6 +5563,13 @@ _SOKOL_PRIVATE void _sg_dummy_update_buffer(_sg_buffer_t* buf, const sg_range* d
     }
 }
 
+_SOKOL_PRIVATE void _sg_dummy_update_buffer_range(_sg_buffer_t* buf, int offset, const sg_range* data) {
+    SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
+    _SOKOL_UNUSED(buf);
+    _SOKOL_UNUSED(offset);
+    _SOKOL_UNUSED(data);
+}
+
 _SOKOL_PRIVATE int _sg_dummy_append_buffer(_sg_buffer_t* buf, const sg_range* data, bool new_frame) {
     SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
     _SOKOL_UNUSED(data);
@@ -5585,6 +5639,10 @@ _SOKOL_PRIVATE void _sg_dummy_update_image(_sg_image_t* img, const sg_image_data
     _SG_XMACRO(glDrawBuffers,                     void, (GLsizei n, const GLenum * bufs)) \
     _SG_XMACRO(glVertexAttribDivisor,             void, (GLuint index, GLuint divisor)) \
     _SG_XMACRO(glBufferSubData,                   void, (GLenum target, GLintptr offset, GLsizeiptr size, const void * data)) \
+    _SG_XMACRO(glBindBufferRange,                 void, (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)) \
+    _SG_XMACRO(glGetUniformBlockIndex,            GLuint, (GLuint program, const GLchar * uniformBlockName)) \
+    _SG_XMACRO(glUniformBlockBinding,             void, (GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding)) \
+    _SG_XMACRO(glGetActiveUniformBlockiv,         void, (GLuint program, GLuint uniformBlockIndex, GLenum pname, GLint * params)) \
     _SG_XMACRO(glGenBuffers,                      void, (GLsizei n, GLuint * buffers)) \
     _SG_XMACRO(glCheckFramebufferStatus,          GLenum, (GLenum target)) \
     _SG_XMACRO(glFramebufferRenderbuffer,         void, (GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer)) \
@@ -7006,6 +7064,12 @@ _SOKOL_PRIVATE void _sg_gl_setup_backend(const sg_desc* desc) {
 
 _SOKOL_PRIVATE void _sg_gl_discard_backend(void) {
     SOKOL_ASSERT(_sg.gl.valid);
+    #if !defined(SOKOL_GLES2)
+    if (_sg.gl.ubo) {
+        glDeleteBuffers(1, &_sg.gl.ubo);
+        _sg.gl.ubo = 0;
+    }
+    #endif
     _sg.gl.valid = false;
     #if defined(_SOKOL_USE_WIN32_GL_LOADER)
     _sg_gl_unload_opengl();
@@ -7419,6 +7483,20 @@ _SOKOL_PRIVATE sg_resource_state _sg_gl_create_shader(_sg_shader_t* shd, const s
             }
             SOKOL_ASSERT(ub_desc->size == (size_t)cur_uniform_offset);
             _SOKOL_UNUSED(cur_uniform_offset);
+            #if !defined(SOKOL_GLES2)
+            /* bind uniform block to a binding point per stage & block slot */
+            if (ub_desc->block_name && !_sg.gl.gles2) {
+                GLuint gl_block = glGetUniformBlockIndex(gl_prog, ub_desc->block_name);
+                if (gl_block != GL_INVALID_INDEX) {
+                    GLint gl_block_size = 0;
+                    glGetActiveUniformBlockiv(gl_prog, gl_block, GL_UNIFORM_BLOCK_DATA_SIZE, &gl_block_size);
+                    SOKOL_ASSERT((size_t)gl_block_size <= (size_t)_sg_roundup((int)ub_desc->size, 16));
+                    _SOKOL_UNUSED(gl_block_size);
+                    glUniformBlockBinding(gl_prog, gl_block, (GLuint)(stage_index * SG_MAX_SHADERSTAGE_UBS + ub_index));
+                    ub->gl_buffer = true;
+                }
+            }
+            #endif
         }
     }
 
@@ -8246,6 +8324,38 @@ _SOKOL_PRIVATE void _sg_gl_apply_bindings(
     _SG_GL_CHECK_ERROR();
 }
 
+#if !defined(SOKOL_GLES2)
+/* copy uniform block into the ring buffer, and bind it to the binding point
+   of the block. Writing to a range that is still used by earlier draw calls
+   is synchronized by the GL driver.
+*/
+_SOKOL_PRIVATE void _sg_gl_apply_uniform_buffer(GLuint binding, const sg_range* data) {
+    const int size = _sg_roundup((int)data->size, 16);
+    SOKOL_ASSERT(size <= SOKOL_GL_UNIFORM_BUFFER_SIZE);
+    if (0 == _sg.gl.ubo) {
+        glGenBuffers(1, &_sg.gl.ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, _sg.gl.ubo);
+        glBufferData(GL_UNIFORM_BUFFER, SOKOL_GL_UNIFORM_BUFFER_SIZE, 0, GL_STREAM_DRAW);
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &_sg.gl.ubo_align);
+        if (_sg.gl.ubo_align < 16) {
+            _sg.gl.ubo_align = 16;
+        }
+    }
+    else {
+        glBindBuffer(GL_UNIFORM_BUFFER, _sg.gl.ubo);
+    }
+    /* offset alignment is not necessarily a power of two */
+    int offset = ((_sg.gl.ubo_offset + _sg.gl.ubo_align - 1) / _sg.gl.ubo_align) * _sg.gl.ubo_align;
+    if ((offset + size) > SOKOL_GL_UNIFORM_BUFFER_SIZE) {
+        offset = 0;
+    }
+    glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)offset, (GLsizeiptr)data->size, data->ptr);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, _sg.gl.ubo, (GLintptr)offset, (GLsizeiptr)size);
+    _sg.gl.ubo_offset = offset + size;
+    _SG_GL_CHECK_ERROR();
+}
+#endif
+
 _SOKOL_PRIVATE void _sg_gl_apply_uniforms(sg_shader_stage stage_index, int ub_index, const sg_range* data) {
     SOKOL_ASSERT(_sg.gl.cache.cur_pipeline);
     SOKOL_ASSERT(_sg.gl.cache.cur_pipeline->slot.id == _sg.gl.cache.cur_pipeline_id.id);
@@ -8254,6 +8364,12 @@ _SOKOL_PRIVATE void _sg_gl_apply_uniforms(sg_shader_stage stage_index, int ub_in
     SOKOL_ASSERT(_sg.gl.cache.cur_pipeline->shader->cmn.stage[stage_index].uniform_blocks[ub_index].size == data->size);
     const _sg_gl_shader_stage_t* gl_stage = &_sg.gl.cache.cur_pipeline->shader->gl.stage[stage_index];
     const _sg_gl_uniform_block_t* gl_ub = &gl_stage->uniform_blocks[ub_index];
+    #if !defined(SOKOL_GLES2)
+    if (gl_ub->gl_buffer) {
+        _sg_gl_apply_uniform_buffer((GLuint)(stage_index * SG_MAX_SHADERSTAGE_UBS + ub_index), data);
+        return;
+    }
+    #endif
     for (int u_index = 0; u_index < gl_ub->num_uniforms; u_index++) {
         const _sg_gl_uniform_t* u = &gl_ub->uniforms[u_index];
         SOKOL_ASSERT(u->type != SG_UNIFORMTYPE_INVALID);
@@ -8355,6 +8471,23 @@ _SOKOL_PRIVATE void _sg_gl_update_buffer(_sg_buffer_t* buf, const sg_range* data
     _SG_GL_CHECK_ERROR();
 }
 
+_SOKOL_PRIVATE void _sg_gl_update_buffer_range(_sg_buffer_t* buf, int offset, const sg_range* data) {
+    SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
+    SOKOL_ASSERT((offset >= 0) && ((offset + (int)data->size) <= buf->cmn.size));
+    /* range updates write to the current slot, so that the rest of the
+       buffer keeps the content of previous updates */
+    GLenum gl_tgt = _sg_gl_buffer_target(buf->cmn.type);
+    SOKOL_ASSERT(buf->cmn.active_slot < SG_NUM_INFLIGHT_FRAMES);
+    GLuint gl_buf = buf->gl.buf[buf->cmn.active_slot];
+    SOKOL_ASSERT(gl_buf);
+    _SG_GL_CHECK_ERROR();
+    _sg_gl_cache_store_buffer_binding(gl_tgt);
+    _sg_gl_cache_bind_buffer(gl_tgt, gl_buf);
+    glBufferSubData(gl_tgt, (GLintptr)offset, (GLsizeiptr)data->size, data->ptr);
+    _sg_gl_cache_restore_buffer_binding(gl_tgt);
+    _SG_GL_CHECK_ERROR();
+}
+
 _SOKOL_PRIVATE int _sg_gl_append_buffer(_sg_buffer_t* buf, const sg_range* data, bool new_frame) {
     SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
     if (new_frame) {
@@ -14268,6 +14401,19 @@ static inline void _sg_update_buffer(_sg_buffer_t* buf, const sg_range* data) {
     #endif
 }
 
+static inline void _sg_update_buffer_range(_sg_buffer_t* buf, int offset, const sg_range* data) {
+    #if defined(_SOKOL_ANY_GL)
+    _sg_gl_update_buffer_range(buf, offset, data);
+    #elif defined(SOKOL_DUMMY_BACKEND)
+    _sg_dummy_update_buffer_range(buf, offset, data);
+    #else
+    _SOKOL_UNUSED(buf);
+    _SOKOL_UNUSED(offset);
+    _SOKOL_UNUSED(data);
+    _SG_ERROR(UPDATEBUFRANGE_NOT_SUPPORTED);
+    #endif
+}
+
 static inline int _sg_append_buffer(_sg_buffer_t* buf, const sg_range* data, bool new_frame) {
     #if defined(_SOKOL_ANY_GL)
     return _sg_gl_append_buffer(buf, data, new_frame);
@@ -15260,6 +15406,25 @@ _SOKOL_PRIVATE bool _sg_validate_update_buffer(const _sg_buffer_t* buf, const sg
     #endif
 }
 
+_SOKOL_PRIVATE bool _sg_validate_update_buffer_range(const _sg_buffer_t* buf, int offset, const sg_range* data) {
+    #if !defined(SOKOL_DEBUG)
+        _SOKOL_UNUSED(buf);
+        _SOKOL_UNUSED(offset);
+        _SOKOL_UNUSED(data);
+        return true;
+    #else
+        if (_sg.desc.disable_validation) {
+            return true;
+        }
+        SOKOL_ASSERT(buf && data && data->ptr);
+        _sg_validate_begin();
+        _SG_VALIDATE(buf->cmn.usage != SG_USAGE_IMMUTABLE, VALIDATE_UPDATEBUFRANGE_USAGE);
+        _SG_VALIDATE((offset >= 0) && (buf->cmn.size >= (offset + (int)data->size)), VALIDATE_UPDATEBUFRANGE_SIZE);
+        _SG_VALIDATE(buf->cmn.append_frame_index != _sg.frame_index, VALIDATE_UPDATEBUFRANGE_APPEND);
+        return _sg_validate_end();
+    #endif
+}
+
 _SOKOL_PRIVATE bool _sg_validate_append_buffer(const _sg_buffer_t* buf, const sg_range* data) {
     #if !defined(SOKOL_DEBUG)
         _SOKOL_UNUSED(buf);
@@ -16751,6 +16916,20 @@ SOKOL_API_IMPL void sg_update_buffer(sg_buffer buf_id, const sg_range* data) {
     _SG_TRACE_ARGS(update_buffer, buf_id, data);
 }
 
+SOKOL_API_IMPL void sg_update_buffer_range(sg_buffer buf_id, int offset, const sg_range* data) {
+    SOKOL_ASSERT(_sg.valid);
+    SOKOL_ASSERT(data && data->ptr && (data->size > 0));
+    _sg_buffer_t* buf = _sg_lookup_buffer(&_sg.pools, buf_id.id);
+    if ((data->size > 0) && buf && (buf->slot.state == SG_RESOURCESTATE_VALID)) {
+        if (_sg_validate_update_buffer_range(buf, offset, data)) {
+            SOKOL_ASSERT((offset + (int)data->size) <= buf->cmn.size);
+            /* update and append on same buffer in same frame not allowed */
+            SOKOL_ASSERT(buf->cmn.append_frame_index != _sg.frame_index);
+            _sg_update_buffer_range(buf, offset, data);
+        }
+    }
+}
+
 SOKOL_API_IMPL int sg_append_buffer(sg_buffer buf_id, const sg_range* data) {
     SOKOL_ASSERT(_sg.valid);
     SOKOL_ASSERT(data && data->ptr);
@@ -29129,6 +29308,292 @@ SOKOL_API_IMPL sg_context_desc sapp_sgcontext(void) {
 #define SOKOL_DEFAULT_DEPTH_NEAR (2.0)
 #define SOKOL_DEFAULT_DEPTH_FAR (2500.0)
 #define SOKOL_MAX_LIGHTS (32)
+#define SOKOL_INSTANCE_RANGE_MERGE_GAP (64)
+#define SOKOL_INSTANCE_MIN_CAPACITY (64)
+#define SOKOL_INSTANCE_SHRINK_FRAMES (120)
+
+/* When enabled, instance transforms are sent to the GPU as a 3x4 affine
+ * matrix (48 bytes) instead of a mat4 (64 bytes). The bottom row of instance
+ * transforms is always (0, 0, 0, 1), and is restored by the vertex shader. */
+#ifndef SOKOL_COMPACT_TRANSFORMS
+#define SOKOL_COMPACT_TRANSFORMS (0)
+#endif
+
+/* When enabled, instance colors are sent to the GPU as RGBA8 and materials 
+ * as 8 bit specular power & shininess and 16 bit emissive, interleaved in a
+ * single 8 byte stream (vs. 24 bytes for float colors & materials). Colors
+ * are clamped to [0, 1], material values to the SOKOL_PACKED_*_MAX ranges. */
+#ifndef SOKOL_PACKED_INSTANCE_DATA
+#define SOKOL_PACKED_INSTANCE_DATA (0)
+#endif
+
+#define SOKOL_PACKED_SPECULAR_MAX 4.0
+#define SOKOL_PACKED_SHININESS_MAX 255.0
+#define SOKOL_PACKED_EMISSIVE_MAX 64.0
+
+/* When enabled, all instance data is interleaved in a single vertex buffer
+ * (one struct per instance). When disabled, transforms, colors and materials
+ * are stored in separate vertex buffers. */
+#ifndef SOKOL_INTERLEAVED_INSTANCES
+#define SOKOL_INTERLEAVED_INSTANCES (0)
+#endif
+
+/* When enabled, geometry-specific scaling (e.g. box dimensions) is passed as
+ * a separate per-instance attribute and applied by the vertex shader. This
+ * allows for uploading transforms of dynamic entities directly from the
+ * EcsTransform3 table columns, without copying them to a staging buffer.
+ * Requires the full mat4 transform in a separate stream. With culling, runs
+ * of at least SOKOL_INSTANCE_COLUMN_RUN visible instances that are stored
+ * consecutively in a table are uploaded directly from the table column. */
+#ifndef SOKOL_ZERO_COPY_TRANSFORMS
+#define SOKOL_ZERO_COPY_TRANSFORMS (0)
+#endif
+
+#define SOKOL_INSTANCE_COLUMN_RUN (32)
+
+#if SOKOL_ZERO_COPY_TRANSFORMS && SOKOL_COMPACT_TRANSFORMS
+#error "SOKOL_ZERO_COPY_TRANSFORMS is not supported with SOKOL_COMPACT_TRANSFORMS"
+#endif
+#if SOKOL_ZERO_COPY_TRANSFORMS && SOKOL_INTERLEAVED_INSTANCES
+#error "SOKOL_ZERO_COPY_TRANSFORMS is not supported with SOKOL_INTERLEAVED_INSTANCES"
+#endif
+
+/* When enabled, instance data of dynamic entities is appended each frame to
+ * a single stream buffer that is shared by all geometry kinds, instead of
+ * being kept in per-geometry buffers that are updated in place. Draws bind
+ * the offsets at which the data was appended. */
+#ifndef SOKOL_INSTANCE_RING
+#define SOKOL_INSTANCE_RING (0)
+#endif
+
+/* When enabled, instances are culled against the camera and light frusta 
+ * before rendering. Visible instances are copied to per-view buffers, which
+ * are the only instance buffers that are uploaded to the GPU. With the
+ * instance ring, visible instances are appended to the ring instead. */
+#ifndef SOKOL_CULL_INSTANCES
+#define SOKOL_CULL_INSTANCES (0)
+#endif
+
+
+/* When enabled, culled instances are stored in a loose grid that is updated
+ * when instances change. The grid is used for culling, and for the spatial
+ * queries in the public API. */
+#ifndef SOKOL_SPATIAL_INDEX
+#define SOKOL_SPATIAL_INDEX (0)
+#endif
+
+/* Size of a spatial index cell in world units */
+#ifndef SOKOL_SPATIAL_CELL_SIZE
+#define SOKOL_SPATIAL_CELL_SIZE (32.0f)
+#endif
+
+#if SOKOL_SPATIAL_INDEX && !SOKOL_CULL_INSTANCES
+#error "SOKOL_SPATIAL_INDEX requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* When enabled, static instances are grouped by their SokolCluster target and
+ * culled per cluster. Visible clusters are drawn directly from the static
+ * instance buffers. Each cluster has its own slot range, and only the ranges
+ * of clusters that changed are gathered & uploaded again. */
+#ifndef SOKOL_CLUSTER_INSTANCES
+#define SOKOL_CLUSTER_INSTANCES (0)
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES && !SOKOL_CULL_INSTANCES
+#error "SOKOL_CLUSTER_INSTANCES requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* When enabled, large boxes are rasterized to a low resolution depth buffer on
+ * the CPU, and instances that are hidden behind them are not drawn. */
+#ifndef SOKOL_OCCLUSION_CULLING
+#define SOKOL_OCCLUSION_CULLING (0)
+#endif
+
+/* Resolution of the occlusion depth buffer, and its tile size in pixels */
+#ifndef SOKOL_OCCLUSION_WIDTH
+#define SOKOL_OCCLUSION_WIDTH (256)
+#endif
+#ifndef SOKOL_OCCLUSION_HEIGHT
+#define SOKOL_OCCLUSION_HEIGHT (128)
+#endif
+#define SOKOL_OCCLUSION_TILE_SIZE (8)
+
+#if SOKOL_OCCLUSION_CULLING && !SOKOL_CULL_INSTANCES
+#error "SOKOL_OCCLUSION_CULLING requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* When enabled, geometries with multiple levels of detail select a level per
+ * visible instance from the projected size of its bounding sphere. Instances
+ * that are smaller than SOKOL_LOD_MIN_SIZE pixels are not drawn. */
+#ifndef SOKOL_LOD
+#define SOKOL_LOD (0)
+#endif
+
+/* Projected diameter in pixels below which instances are culled */
+#ifndef SOKOL_LOD_MIN_SIZE
+#define SOKOL_LOD_MIN_SIZE (1.0f)
+#endif
+
+#if SOKOL_LOD && !SOKOL_CULL_INSTANCES
+#error "SOKOL_LOD requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* Maximum number of levels of detail per geometry */
+#define SOKOL_MAX_LODS (3)
+
+/* When enabled, instances that are further away from the camera than the
+ * impostor distance of their geometry (see sokol_geometry_impostor_distance)
+ * are drawn as camera facing quads that cover the extents of the instance. */
+#ifndef SOKOL_IMPOSTORS
+#define SOKOL_IMPOSTORS (0)
+#endif
+
+#if SOKOL_IMPOSTORS && !SOKOL_CULL_INSTANCES
+#error "SOKOL_IMPOSTORS requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* Point lights contribute exp(-d / distance) to a surface at distance d. The
+ * range of a light is the multiple of its distance beyond which light is
+ * ignored, where its contribution is less than 5%. */
+#define SOKOL_LIGHT_RANGE (3.0f)
+
+/* Score multiplier of lights that were selected in the last frame, so that
+ * lights with a similar contribution don't swap from frame to frame. */
+#define SOKOL_LIGHT_HYSTERESIS (1.25f)
+
+/* When enabled, point lights are binned each frame into clusters that divide
+ * the camera frustum in screen tiles and depth slices. The scene shader only
+ * evaluates the lights of the cluster of a fragment, instead of the selected
+ * SOKOL_MAX_LIGHTS lights. Binning is divided over worker threads. */
+#ifndef SOKOL_CLUSTERED_LIGHTS
+#define SOKOL_CLUSTERED_LIGHTS (0)
+#endif
+
+/* Number of clusters along screen x, screen y and depth */
+#define SOKOL_CLUSTER_X (16)
+#define SOKOL_CLUSTER_Y (8)
+#define SOKOL_CLUSTER_Z (24)
+#define SOKOL_CLUSTER_COUNT (SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y * SOKOL_CLUSTER_Z)
+
+/* Maximum number of clustered lights, and of light indices in all clusters */
+#ifndef SOKOL_CLUSTER_MAX_LIGHTS
+#define SOKOL_CLUSTER_MAX_LIGHTS (4096)
+#endif
+#ifndef SOKOL_CLUSTER_MAX_INDICES
+#define SOKOL_CLUSTER_MAX_INDICES (64 * 1024)
+#endif
+
+/* Width of light & light index textures. Must be even. */
+#define SOKOL_CLUSTER_TEXTURE_WIDTH (1024)
+
+/* When enabled, the uniforms of the scene, atmosphere and fx shaders are
+ * declared as std140 uniform blocks, which are uploaded with a single copy to
+ * a uniform buffer instead of a glUniform call per uniform. Uniform structs
+ * use the std140 layout either way. */
+#ifndef SOKOL_UNIFORM_BUFFERS
+#define SOKOL_UNIFORM_BUFFERS (0)
+#endif
+
+/* Shader macros for declaring uniforms that are part of a uniform block:
+ *   SOKOL_UNIFORM_BLOCK(name)
+ *   SOKOL_UNIFORM vec3 u_foo;
+ *   SOKOL_UNIFORM_BLOCK_END
+ * The block name must match the block_name of the uniform block desc. */
+#if SOKOL_UNIFORM_BUFFERS
+#define SOKOL_SHADER_UNIFORMS \
+    "#define SOKOL_UNIFORM_BLOCK(name) layout(std140) uniform name {\n" \
+    "#define SOKOL_UNIFORM\n" \
+    "#define SOKOL_UNIFORM_BLOCK_END };\n"
+#else
+#define SOKOL_SHADER_UNIFORMS \
+    "#define SOKOL_UNIFORM_BLOCK(name)\n" \
+    "#define SOKOL_UNIFORM uniform\n" \
+    "#define SOKOL_UNIFORM_BLOCK_END\n"
+#endif
+
+/* Compile time checks for uniform structs, which are copied as is to uniform
+ * blocks. Offsets must match the layout of the block (std140, or packed for
+ * blocks with the native layout), which is computed from the uniform descs in
+ * the order the uniforms are declared in the shader. */
+#define SOKOL_UNIFORM_OFFSET(T, member, offset)\
+    typedef char T##_##member##_offset_check[\
+        (offsetof(T, member) == (offset)) ? 1 : -1]
+
+#define SOKOL_UNIFORM_SIZE(T, size)\
+    typedef char T##_size_check[(sizeof(T) == (size)) ? 1 : -1]
+
+#define SOKOL_STR_(x) #x
+#define SOKOL_STR(x) SOKOL_STR_(x)
+
+/* Shader code that defines instance_transform(). The scale location is only
+ * used when SOKOL_ZERO_COPY_TRANSFORMS is enabled, and must be the location
+ * that follows the transform attributes. */
+#if SOKOL_COMPACT_TRANSFORMS
+/* Rows of a 3x4 affine matrix */
+typedef vec4 sokol_transform_t[3];
+
+/* Rows are passed as the columns of a mat3x4 vertex attribute */
+#define SOKOL_SHADER_INSTANCE_TRANSFORM(loc, scale_loc) \
+    "layout(location=" SOKOL_STR(loc) ") in mat3x4 i_mat_m;\n" \
+    "mat4 instance_transform() {\n" \
+    "  return transpose(mat4(i_mat_m[0], i_mat_m[1], i_mat_m[2], \n" \
+    "    vec4(0.0, 0.0, 0.0, 1.0)));\n" \
+    "}\n"
+#elif SOKOL_ZERO_COPY_TRANSFORMS
+typedef mat4 sokol_transform_t;
+
+/* Scales the x, y and z axes, which is the same as glm_scale */
+#define SOKOL_SHADER_INSTANCE_TRANSFORM(loc, scale_loc) \
+    "layout(location=" SOKOL_STR(loc) ") in mat4 i_mat_m;\n" \
+    "layout(location=" SOKOL_STR(scale_loc) ") in vec3 i_scale;\n" \
+    "mat4 instance_transform() {\n" \
+    "  return mat4(i_mat_m[0] * i_scale.x, i_mat_m[1] * i_scale.y, \n" \
+    "    i_mat_m[2] * i_scale.z, i_mat_m[3]);\n" \
+    "}\n"
+#else
+typedef mat4 sokol_transform_t;
+
+#define SOKOL_SHADER_INSTANCE_TRANSFORM(loc, scale_loc) \
+    "layout(location=" SOKOL_STR(loc) ") in mat4 i_mat_m;\n" \
+    "mat4 instance_transform() {\n" \
+    "  return i_mat_m;\n" \
+    "}\n"
+#endif
+
+#if SOKOL_PACKED_INSTANCE_DATA
+/* Color (r, g, b, unused) and material (specular power, shininess, emissive
+ * low byte, emissive high byte) */
+typedef struct sokol_instance_color_t {
+    uint8_t color[4];
+    uint8_t material[4];
+} sokol_instance_color_t;
+
+#define SOKOL_SHADER_INSTANCE_COLOR(color_loc, material_loc) \
+    "layout(location=" SOKOL_STR(color_loc) ") in vec4 i_color;\n" \
+    "layout(location=" SOKOL_STR(material_loc) ") in vec4 i_material;\n" \
+    "vec3 instance_color() {\n" \
+    "  return i_color.rgb;\n" \
+    "}\n" \
+    "vec3 instance_material() {\n" \
+    "  return vec3(\n" \
+    "    i_material.x * " SOKOL_STR(SOKOL_PACKED_SPECULAR_MAX) ",\n" \
+    "    i_material.y * " SOKOL_STR(SOKOL_PACKED_SHININESS_MAX) ",\n" \
+    "    dot(i_material.zw, vec2(255.0, 65280.0)) / 65535.0 * " \
+            SOKOL_STR(SOKOL_PACKED_EMISSIVE_MAX) ");\n" \
+    "}\n"
+#else
+typedef ecs_rgb_t sokol_instance_color_t;
+
+#define SOKOL_SHADER_INSTANCE_COLOR(color_loc, material_loc) \
+    "layout(location=" SOKOL_STR(color_loc) ") in vec3 i_color;\n" \
+    "layout(location=" SOKOL_STR(material_loc) ") in vec3 i_material;\n" \
+    "vec3 instance_color() {\n" \
+    "  return i_color;\n" \
+    "}\n" \
+    "vec3 instance_material() {\n" \
+    "  return i_material;\n" \
+    "}\n"
+#endif
 
 typedef struct SokolQuery {
     ecs_query_t *query;
@@ -29136,6 +29601,14 @@ typedef struct SokolQuery {
 
 extern ECS_COMPONENT_DECLARE(SokolQuery);
 
+/* Vertex, normal and index buffers of a mesh */
+typedef struct sokol_mesh_t {
+    sg_buffer vertices;
+    sg_buffer normals;
+    sg_buffer indices;
+    int32_t index_count;
+} sokol_mesh_t;
+
 /* Immutable resources used by different components to avoid duplication */
 typedef struct sokol_resources_t {
     sg_buffer quad;
@@ -29143,11 +29616,17 @@ typedef struct sokol_resources_t {
     sg_buffer rect;
     sg_buffer rect_indices;
     sg_buffer rect_normals;
+    sg_buffer rect_impostor_indices; /* Both sides of the rectangle */
 
     sg_buffer box;
     sg_buffer box_indices;
     sg_buffer box_normals;
 
+    /* Procedural primitives, from the highest to the lowest tessellation */
+    sokol_mesh_t sphere[SOKOL_MAX_LODS];
+    sokol_mesh_t cylinder[SOKOL_MAX_LODS];
+    sokol_mesh_t cone[SOKOL_MAX_LODS];
+
     sg_image noise_texture;
     sg_image bg_texture;
 } sokol_resources_t;
@@ -29205,9 +29684,14 @@ typedef struct sokol_render_state_t {
     ecs_world_t *world;
     ecs_query_t *q_scene;
     
-    const EcsDirectionalLight *light;
-    const EcsCamera *camera;
-    const EcsAtmosphere *atmosphere;
+    /* Component values are copied, as storage can move between preparing and
+     * rendering the frame */
+    EcsDirectionalLight light;
+    EcsCamera camera;
+    EcsAtmosphere atmosphere;
+    bool has_light;
+    bool has_camera;
+    bool has_atmosphere;
 
     ecs_rgb_t ambient_light;
     ecs_rgb_t ambient_light_ground;
@@ -29223,6 +29707,14 @@ typedef struct sokol_render_state_t {
     sg_image shadow_map;
 
     ecs_vec_t lights;
+#if SOKOL_CLUSTERED_LIGHTS
+    sg_image light_data;        /* Light, cluster & light index textures */
+    sg_image light_clusters;
+    sg_image light_indices;
+    float cluster_depth_scale;  /* Depth slice = log(depth) * scale + bias */
+    float cluster_depth_bias;
+#endif
+    ecs_vec_t draw_list; /* vec<sokol_draw_batch_t> */
 } sokol_render_state_t;
 
 typedef struct sokol_offscreen_pass_t {
@@ -29230,6 +29722,7 @@ typedef struct sokol_offscreen_pass_t {
     sg_pass pass;
     sg_pipeline pip;
     sg_pipeline pip_2;
+    sg_pipeline pip_3;
     sg_image depth_target;
     sg_image color_target;
     int32_t sample_count;
@@ -29291,8 +29784,24 @@ sg_buffer sokol_buffer_rectangle_indices(void);
 
 int32_t sokol_rectangle_index_count(void);
 
+sg_buffer sokol_buffer_rectangle_impostor_indices(void);
+
+int32_t sokol_rectangle_impostor_index_count(void);
+
 sg_buffer sokol_buffer_rectangle_normals(void);
 
+/* Procedural primitives with a diameter and height of 1, centered on the 
+ * origin. Cylinders and cones are aligned with the y axis, and the tip of a 
+ * cone points up. Segments is the number of subdivisions around the y axis. */
+sokol_mesh_t sokol_mesh_sphere(
+    int32_t segments);
+
+sokol_mesh_t sokol_mesh_cylinder(
+    int32_t segments);
+
+sokol_mesh_t sokol_mesh_cone(
+    int32_t segments);
+
 sg_pass_action sokol_clear_action(
     ecs_rgb_t color,
     bool clear_color,
@@ -29306,6 +29815,40 @@ const char* sokol_fs_depth(void);
 
 #endif
 
+#ifndef SOKOL_SUBMIT_H
+#define SOKOL_SUBMIT_H
+
+/* Submission layer between the passes and sokol_gfx. Calls that apply the
+ * same pipeline, bindings or uniforms as the previous call are skipped.
+ *
+ * The applied pipeline and bindings are reset at the end of a pass, so passes
+ * must be ended with sokol_end_pass. Uniforms are stored in the GL program of
+ * a pipeline, and are remembered per pipeline across passes. This requires
+ * that pipelines don't share shaders. With SOKOL_UNIFORM_BUFFERS, uniform
+ * blocks are bound to binding points that are shared by all pipelines, and
+ * are only skipped if no other pipeline has used the binding point since. */
+
+void sokol_apply_pipeline(
+    sg_pipeline pip);
+
+void sokol_apply_bindings(
+    const sg_bindings *bind);
+
+void sokol_apply_uniforms(
+    sg_shader_stage stage,
+    int ub_index,
+    const sg_range *data);
+
+void sokol_end_pass(void);
+
+/* Store statistics of the frame and reset counters. Called once per frame. */
+void sokol_submit_frame(void);
+
+/* Free submission state */
+void sokol_submit_fini(void);
+
+#endif
+
 #ifndef SOKOL_EFFECT_H
 #define SOKOL_EFFECT_H
 
@@ -29552,6 +30095,12 @@ void sokol_run_depth_pass(
     sokol_offscreen_pass_t *pass,
     sokol_render_state_t *state);
 
+/* Draw instances that are not in the depth prepass to the depth pass targets.
+ * Must run after the scene pass, which writes their depth. */
+void sokol_run_late_depth_pass(
+    sokol_offscreen_pass_t *pass,
+    sokol_render_state_t *state);
+
 /* Scene pass */
 sokol_offscreen_pass_t sokol_init_scene_pass(
     ecs_rgb_t background_color,
@@ -29597,6 +30146,92 @@ void sokol_run_atmos_to_screen_pass(
 #ifndef SOKOL_MODULES_RENDERER_H
 #define SOKOL_MODULES_RENDERER_H
 
+#ifndef SOKOL_MODULES_RENDERER_CLUSTERS_H
+#define SOKOL_MODULES_RENDERER_CLUSTERS_H
+
+
+#if SOKOL_CLUSTERED_LIGHTS
+
+/* Light indices binned by a stage. Each stage bins a range of depth slices
+ * into its own index list, which are concatenated before uploading. */
+typedef struct sokol_cluster_stage_t {
+    ecs_vec_t indices;          /* Light indices of clusters (vec<uint32_t>) */
+    ecs_vec_t slice_lights;     /* Lights that intersect slice (vec<int32_t>) */
+    ecs_vec_t slice_spheres;    /* Spheres of slice lights (vec<vec4>) */
+    ecs_vec_t row_lights;       /* Lights that intersect row (vec<int32_t>) */
+    ecs_vec_t row_spheres;      /* Spheres of row lights (vec<vec4>) */
+    ecs_vec_t tile_lights;      /* Lights that intersect tile (vec<int32_t>) */
+} sokol_cluster_stage_t;
+
+/* Point lights binned in clusters. Clusters are stored in textures that are
+ * read by the scene shader:
+ *  - lights: two RGBA32F texels per light, with the position relative to the
+ *    eye & distance, and the color.
+ *  - clusters: a RG32UI texel per cluster, with the offset & count of its
+ *    light indices. The texel of cluster (x, y, z) is (y * X + x, z).
+ *  - indices: a R32UI texel per light index.
+ * Cluster planes and light spheres are in world space. Depth slices are
+ * distributed exponentially between the near and far plane. */
+typedef struct sokol_light_clusters_t {
+    sg_image lights;
+    sg_image clusters;
+    sg_image indices;
+
+    float *light_data;          /* Texel data of images */
+    uint32_t *cluster_data;
+    uint32_t *index_data;
+
+    vec4 *spheres;              /* Center & range per light */
+    int32_t light_count;
+
+    vec4 frustum[4];            /* Left, right, bottom & top frustum planes */
+    vec4 x_planes[SOKOL_CLUSTER_X][2];
+    vec4 y_planes[SOKOL_CLUSTER_Y][2];
+    vec4 z_planes[SOKOL_CLUSTER_Z][2];
+
+    float depth_scale;          /* slice = log(depth) * scale + bias */
+    float depth_bias;
+
+    sokol_cluster_stage_t *stages;
+    int32_t stage_count;        /* Stages that bin lights in current frame */
+    int32_t stage_size;         /* Allocated stages */
+
+    int32_t index_count;        /* Light indices uploaded in last frame */
+    int32_t indices_dropped;    /* Light indices that didn't fit */
+} sokol_light_clusters_t;
+
+void sokol_clusters_init(
+    sokol_light_clusters_t *c);
+
+void sokol_clusters_fini(
+    sokol_light_clusters_t *c);
+
+/* Store lights & compute cluster planes for frame. Light positions are
+ * relative to the eye. Must be called on the main thread before binning. */
+void sokol_clusters_prepare(
+    sokol_light_clusters_t *c,
+    const ecs_vec_t *lights,
+    const vec3 eye_pos,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float near_,
+    float far_,
+    int32_t stage_count);
+
+/* Bin lights into the depth slices assigned to a stage. Stages write to
+ * separate data, and can run in parallel. */
+void sokol_clusters_bin(
+    sokol_light_clusters_t *c,
+    int32_t stage_id);
+
+/* Merge light indices of stages and upload textures */
+void sokol_clusters_upload(
+    sokol_light_clusters_t *c);
+
+#endif
+
+#endif
+
 
 typedef struct SokolRenderer {
     sokol_resources_t resources;
@@ -29614,6 +30249,21 @@ typedef struct SokolRenderer {
 
     ecs_query_t *lights_query;
     ecs_vec_t lights;
+#if SOKOL_CLUSTERED_LIGHTS
+    sokol_light_clusters_t clusters;
+#endif
+    ecs_vec_t light_candidates; /* Lights before culling & selection */
+    ecs_vec_t light_spheres;    /* Range of candidates (vec<vec4>) */
+    ecs_vec_t light_visible;    /* Candidates that are in view (vec<int32_t>) */
+    ecs_map_t lights_selected;  /* Entities of lights in last selection */
+    int32_t lights_dropped;     /* Visible lights that didn't fit */
+    mat4 lights_mat_vp;         /* Camera of last light selection */
+    vec3 lights_eye_pos;
+    bool lights_valid;
+
+    ecs_vec_t draw_list;
+
+    sokol_render_state_t state; /* State of frame that is being rendered */
 } SokolRenderer;
 
 extern ECS_COMPONENT_DECLARE(SokolRenderer);
@@ -29628,26 +30278,446 @@ void FlecsSystemsSokolRendererImport(
 #ifndef SOKOL_MODULES_GEOMETRY_H
 #define SOKOL_MODULES_GEOMETRY_H
 
+#ifndef SOKOL_MODULES_GEOMETRY_SPATIAL_H
+#define SOKOL_MODULES_GEOMETRY_SPATIAL_H
+
+
+#if SOKOL_SPATIAL_INDEX
+
+/* Cell of the loose grid. Instances are stored in the cell that contains the
+ * center of their bounding sphere, and may extend outside of the cell. */
+typedef struct sokol_spatial_cell_t {
+    vec4 bounds;                /* Sphere that encloses cell & its instances */
+    ecs_vec_t spheres;          /* Bounding sphere per instance (vec<vec4>) */
+    ecs_vec_t slots;            /* Instance slot per instance (vec<int32_t>) */
+    ecs_vec_t entities;         /* Entity per instance (vec<ecs_entity_t>) */
+} sokol_spatial_cell_t;
+
+/* Location of an instance slot in the grid */
+typedef struct sokol_spatial_loc_t {
+    ecs_map_key_t cell;
+    int32_t index;              /* Index in cell, -1 if slot is not stored */
+} sokol_spatial_loc_t;
+
+/* Loose grid over the instance slots of a geometry buffer */
+typedef struct sokol_spatial_index_t {
+    ecs_allocator_t *allocator;
+    ecs_map_t cells;            /* map<cell key, sokol_spatial_cell_t*> */
+    ecs_vec_t locations;        /* Location per slot (vec<sokol_spatial_loc_t>) */
+    int32_t count;              /* Number of instances in index */
+
+    /* Conservative extents of the index, used to limit queries to the cells
+     * they overlap with. Extents don't shrink until the index is empty. */
+    int32_t cell_min[3];        /* Min coordinates of occupied cells */
+    int32_t cell_max[3];        /* Max coordinates of occupied cells */
+    float max_radius;           /* Largest radius of an instance */
+} sokol_spatial_index_t;
+
+void sokol_spatial_init(
+    sokol_spatial_index_t *index,
+    ecs_allocator_t *a);
+
+void sokol_spatial_fini(
+    sokol_spatial_index_t *index);
+
+/* Set number of instance slots. Slots that are removed must not be stored. */
+void sokol_spatial_resize(
+    sokol_spatial_index_t *index,
+    int32_t slot_count);
+
+/* Store or move instance slot. A sphere with a radius of zero or less removes
+ * the slot from the index. */
+void sokol_spatial_set(
+    sokol_spatial_index_t *index,
+    int32_t slot,
+    ecs_entity_t entity,
+    const vec4 sphere);
+
+/* Remove range of instance slots */
+void sokol_spatial_remove(
+    sokol_spatial_index_t *index,
+    int32_t offset,
+    int32_t count);
+
+/* Write slots of instances that intersect with the frustum to visible, which
+ * must be large enough to hold all instances. Returns number of visible slots.
+ * The number of cells outside of the frustum is added to culled_cells. */
+int32_t sokol_spatial_cull(
+    const sokol_spatial_index_t *index,
+    int32_t *visible,
+    const vec4 *planes,
+    int32_t *culled_cells);
+
+/* Find instances with bounding spheres that overlap with sphere. Returns false
+ * if the callback stopped the query. */
+bool sokol_spatial_overlap_sphere(
+    const sokol_spatial_index_t *index,
+    const vec3 center,
+    float radius,
+    sokol_spatial_callback_t callback,
+    void *ctx);
+
+/* Find instances with bounding spheres that overlap with box. Returns false
+ * if the callback stopped the query. */
+bool sokol_spatial_overlap_box(
+    const sokol_spatial_index_t *index,
+    const vec3 min,
+    const vec3 max,
+    sokol_spatial_callback_t callback,
+    void *ctx);
+
+/* Find nearest instance with a bounding sphere that is hit by the ray. The
+ * direction must be normalized. Returns 0 if no instance closer than distance
+ * is hit, otherwise distance is set to the distance of the hit. */
+ecs_entity_t sokol_spatial_raycast(
+    const sokol_spatial_index_t *index,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance);
+
+#endif
+
+#endif
+
+#ifndef SOKOL_MODULES_GEOMETRY_OCCLUSION_H
+#define SOKOL_MODULES_GEOMETRY_OCCLUSION_H
 
+
+#if SOKOL_OCCLUSION_CULLING
+
+/* Low resolution depth buffer with occluders, rasterized on the CPU. Depth is
+ * stored in [0, 1], where pixels without occluders have depth 1. Occluders
+ * only write pixels that they fully cover, with the depth of their farthest
+ * visible vertex, and the depth of a tile is the farthest depth of its pixels,
+ * so tests are conservative. */
+typedef struct sokol_occlusion_buffer_t {
+    float *depth;               /* Depth per pixel */
+    float *tiles;               /* Farthest depth per tile */
+    int32_t width;
+    int32_t height;
+    int32_t tile_cols;
+    int32_t tile_rows;
+    mat4 mat_vp;                /* View projection matrix of frame */
+} sokol_occlusion_buffer_t;
+
+/* Width and height must be multiples of SOKOL_OCCLUSION_TILE_SIZE */
+void sokol_occlusion_init(
+    sokol_occlusion_buffer_t *buf,
+    int32_t width,
+    int32_t height);
+
+void sokol_occlusion_fini(
+    sokol_occlusion_buffer_t *buf);
+
+/* Clear depth, and set view projection matrix for occluders & tests */
+void sokol_occlusion_clear(
+    sokol_occlusion_buffer_t *buf,
+    mat4 mat_vp);
+
+/* Draw unit box centered on the origin, transformed by transform. The
+ * silhouette of the box is drawn with the farthest depth of the faces that face
+ * the camera. Boxes that cross the near plane are not drawn. */
+void sokol_occlusion_draw_box(
+    sokol_occlusion_buffer_t *buf,
+    mat4 transform);
+
+/* Draw triangle with the depth of its farthest vertex. Vertices are in clip
+ * space. Triangles that cross the near plane are not drawn. */
+void sokol_occlusion_draw_triangle(
+    sokol_occlusion_buffer_t *buf,
+    const vec4 v0,
+    const vec4 v1,
+    const vec4 v2);
+
+/* Compute tile depths. Must be called after drawing and before testing. */
+void sokol_occlusion_finish(
+    sokol_occlusion_buffer_t *buf);
+
+/* Test whether an axis aligned box may be visible. Returns false only if the
+ * box is fully behind occluders. Boxes that are partially visible, cross the
+ * near plane or are outside of the view are reported as visible. */
+bool sokol_occlusion_test_box(
+    const sokol_occlusion_buffer_t *buf,
+    const vec3 min,
+    const vec3 max);
+
+/* Test whether a bounding sphere may be visible, by testing its enclosing box.
+ * Returns false only if the sphere is fully behind occluders. */
+bool sokol_occlusion_test_sphere(
+    const sokol_occlusion_buffer_t *buf,
+    const vec4 sphere);
+
+#endif
+
+#endif
+
+
+/* Copies transforms to dst while applying geometry-specific scaling. The
+ * transform of instance i is written to dst + i * dst_stride. */
 typedef void (*sokol_geometry_action_t)(
-    mat4 *transforms,
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    void *data,
+    int32_t count,
+    bool self);
+
+/* Writes geometry-specific scaling as a vec3 per instance, which is applied
+ * by the shader when SOKOL_ZERO_COPY_TRANSFORMS is enabled. The scale of
+ * instance i is written to dst + i * dst_stride. */
+typedef void (*sokol_geometry_scale_action_t)(
+    void *dst,
+    ecs_size_t dst_stride,
+    void *data,
+    int32_t count,
+    bool self);
+
+/* Computes a bounding sphere per instance, used for culling */
+typedef void (*sokol_geometry_bounds_action_t)(
+    vec4 *dst,
+    const mat4 *transforms,
     void *data,
     int32_t count,
     bool self);
 
+/* Element with material parameters */
+typedef struct {
+    float specular_power;
+    float shininess;
+    float emissive;
+} SokolMaterial;
+
+#if SOKOL_INTERLEAVED_INSTANCES
+/* Interleaved instance data. The transform is stored as a float array so that
+ * the struct isn't padded to the alignment of cglm types. */
+typedef struct sokol_instance_t {
+    float transform[sizeof(sokol_transform_t) / sizeof(float)];
+    sokol_instance_color_t color;
+#if !SOKOL_PACKED_INSTANCE_DATA
+    SokolMaterial material;
+#endif
+} sokol_instance_t;
+#endif
+
+/* Maximum number of vertex buffers with instance data */
+#define SOKOL_MAX_INSTANCE_STREAMS (4)
+
+/* Instance attributes, used to select the attributes used by a pipeline */
+#define SOKOL_INSTANCE_TRANSFORM (1 << 0)
+#define SOKOL_INSTANCE_COLOR     (1 << 1)
+#define SOKOL_INSTANCE_MATERIAL  (1 << 2)
+#define SOKOL_INSTANCE_ALL \
+    (SOKOL_INSTANCE_TRANSFORM | SOKOL_INSTANCE_COLOR | SOKOL_INSTANCE_MATERIAL)
+
+/* Location of instance attribute */
+typedef struct sokol_instance_attr_t {
+    int32_t stream;             /* Stream that contains the attribute */
+    int32_t offset;             /* Offset of attribute in stream element */
+} sokol_instance_attr_t;
+
+/* Describes how instance attributes are stored in streams. Each stream is a
+ * separate vertex buffer. */
+typedef struct sokol_instance_layout_t {
+    int32_t stream_count;
+    ecs_size_t stream_size[SOKOL_MAX_INSTANCE_STREAMS];
+    sokol_instance_attr_t transform;
+    sokol_instance_attr_t color;
+    sokol_instance_attr_t material;
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    sokol_instance_attr_t scale;  /* Used together with transform */
+#endif
+} sokol_instance_layout_t;
+
+/* Instance data stream */
+typedef struct sokol_instance_stream_t {
+    ecs_vec_t data;             /* CPU copy of instance data */
+    sg_buffer buffer;           /* Sokol buffer with instance data */
+    int32_t offset;             /* Offset of instance data in buffer */
+} sokol_instance_stream_t;
+
+/* Passes that draw instances. Entities can be excluded from a pass with the
+ * SokolNoDepthPrepass and SokolNoShadow tags. The scene pass draws instances
+ * that are excluded from the depth prepass with depth writes enabled, after
+ * which their depth is written to the depth prepass target. */
+#define SOKOL_PASS_SCENE (0)
+#define SOKOL_PASS_DEPTH (1)
+#define SOKOL_PASS_SHADOW (2)
+#define SOKOL_MAX_PASSES (3)
+
+/* Views that instances are culled for */
+#define SOKOL_VIEW_CAMERA (0)
+#define SOKOL_VIEW_SHADOW (1)
+#define SOKOL_MAX_VIEWS (2)
+
+/* Visible instances are drawn per level of detail, followed by impostors */
+#define SOKOL_LOD_IMPOSTOR (SOKOL_MAX_LODS)
+#define SOKOL_MAX_VIEW_LODS (SOKOL_MAX_LODS + 1)
+
+/* Range of visible instances or clusters with the same level of detail */
+typedef struct sokol_instance_lod_t {
+    int32_t offset;
+    int32_t count;
+    int32_t depth_count;        /* Number of instances in depth pass. Instances
+                                 * excluded from the depth pass are stored after
+                                 * the other instances of the range. */
+} sokol_instance_lod_t;
+
+/* Instances that are visible in a view */
+typedef struct sokol_instance_view_t {
+    sokol_instance_stream_t streams[SOKOL_MAX_INSTANCE_STREAMS];
+    ecs_vec_t visible;          /* Slots of visible instances, or indices of 
+                                 * visible clusters (vec<int32_t>) */
+    ecs_vec_t bins;             /* Bin per visible element while sorting visible
+                                 * by level of detail (vec<int8_t>) */
+    ecs_vec_t sorted;           /* Sorted visible elements (vec<int32_t>) */
+    sokol_instance_lod_t lods[SOKOL_MAX_VIEW_LODS];
+    float depth;                /* Distance to nearest visible element */
+    int32_t count;              /* Number of visible instances or clusters */
+    int32_t buffer_size;        /* Number of instances that fit in sokol buffers */
+} sokol_instance_view_t;
+
+/* Contiguous range of instances that is culled & drawn as a whole */
+typedef struct sokol_instance_cluster_t {
+    uint64_t group;             /* Query group (SokolCluster target) */
+    ecs_flags32_t exclude;      /* Passes that cluster is excluded from */
+    int32_t offset;
+    int32_t count;
+    bool dirty;                 /* Whether bounds must be recomputed */
+} sokol_instance_cluster_t;
+
+/* Instance slots reserved for a query group (SokolCluster target). The tables
+ * of a group are stored consecutively in the range of the group, so that only
+ * groups with tables that changed are laid out, gathered & uploaded again. */
+typedef struct sokol_cluster_group_t {
+    int32_t offset;             /* First slot in the instance buffers */
+    int32_t capacity;           /* Number of slots reserved for group */
+    int32_t count;              /* Number of slots in use */
+    int32_t frame;              /* Last populate in which group was matched */
+    bool dirty;                 /* Whether tables of group must be laid out */
+} sokol_cluster_group_t;
+
+/* Range of instance slots */
+typedef struct sokol_instance_range_t {
+    int32_t offset;
+    int32_t count;
+} sokol_instance_range_t;
+
+/* Instance slots reserved for a table matched by a geometry query. The slots
+ * of a table stay at the same offset across frames, so that only data of
+ * tables that changed has to be copied & uploaded. */
+typedef struct sokol_table_instances_t {
+    int32_t offset;             /* First slot in the instance buffers */
+    int32_t capacity;           /* Number of slots reserved for table */
+    int32_t count;              /* Number of slots in use */
+    int32_t frame;              /* Last populate in which table was matched */
+    ecs_flags32_t exclude;      /* Passes that table is excluded from */
+    bool gather;                /* Whether table data must be copied */
+#if SOKOL_CLUSTER_INSTANCES
+    uint64_t group;             /* Query group, if stored in a group range */
+#endif
+#if SOKOL_CULL_INSTANCES
+    bool bounds_dirty;          /* Whether bounds must be recomputed */
+    vec4 bounds;                /* Sphere that encloses all table instances */
+#endif
+} sokol_table_instances_t;
+
+#if SOKOL_CULL_INSTANCES && SOKOL_ZERO_COPY_TRANSFORMS
+/* Instance slots of a table, used to find the table column with the transform
+ * of a slot when transforms are not stored in the instance buffers. */
+typedef struct sokol_table_slots_t {
+    int32_t offset;             /* First slot of table */
+    int32_t count;              /* Number of slots in use */
+    ecs_table_t *table;
+    int32_t column;             /* Column index of EcsTransform3 */
+} sokol_table_slots_t;
+#endif
+
 typedef struct sokol_geometry_buffers_t {
-    /* Temporary buffers for storing data gathered from ECS. This allows data to
-     * be copied in one call to the graphics API. */
-    ecs_vec_t colors_data;
-    ecs_vec_t transforms_data;
-    ecs_vec_t materials_data;
-
-    /* Sokol buffers with instanced data */
-    sg_buffer colors;
-    sg_buffer transforms;
-    sg_buffer materials;
-
-    /* Number of instances */
+    /* Instance data gathered from ECS, stored as described by the instance 
+     * layout. Data is stored at persistent per-table offsets. Slots that are
+     * not in use are zero, which produces a degenerate transform that is 
+     * culled by the GPU. */
+    sokol_instance_stream_t streams[SOKOL_MAX_INSTANCE_STREAMS];
+
+#if SOKOL_CULL_INSTANCES
+    /* Bounding sphere per instance slot (vec<vec4>). Slots that are not in use
+     * have a radius of zero. */
+    ecs_vec_t bounds;
+
+    /* Visible instances per view */
+    sokol_instance_view_t views[SOKOL_MAX_VIEWS];
+
+    /* Passes that instance slot is excluded from (vec<uint8_t>) */
+    ecs_vec_t exclude;
+#else
+    /* Slot ranges that are not drawn, per pass (vec<sokol_instance_range_t>).
+     * Ranges are sorted by offset. */
+    ecs_vec_t excluded[SOKOL_MAX_PASSES];
+#endif
+
+#if SOKOL_CULL_INSTANCES && SOKOL_ZERO_COPY_TRANSFORMS
+    /* Slots of tables sorted by offset, rebuilt when buffers are populated
+     * (vec<sokol_table_slots_t>). Only used when transforms are uploaded from
+     * table columns. */
+    ecs_vec_t table_slots;
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    /* Grid with bounding spheres of instance slots */
+    sokol_spatial_index_t index;
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+    /* Instance clusters, in slot order (vec<sokol_instance_cluster_t>). Only
+     * used for static instances. */
+    ecs_vec_t clusters;
+    ecs_vec_t cluster_bounds;   /* Bounding sphere per cluster (vec<vec4>) */
+
+    /* Slot ranges per query group (map<uint64_t, sokol_cluster_group_t*>).
+     * Tables without a SokolCluster pair (group 0) have their own range. */
+    ecs_map_t groups;
+#endif
+
+    /* Number of instance slots in CPU buffers. Sokol buffers are resized to
+     * the same capacity when data is uploaded. */
+    int32_t capacity;
+
+    /* Number of instances that fit in sokol buffers */
+    int32_t buffer_size;
+
+    /* Number of consecutive frames in which the buffers were underused */
+    int32_t low_frames;
+
+    /* Minimum capacity of buffers, view buffers and the space reserved in
+     * the instance ring (see sokol_geometry_capacity_hint) */
+    int32_t capacity_hint;
+
+    /* Usage of sokol buffers. Immutable buffers are recreated when modified,
+     * stream buffers are appended to the instance ring each frame. Clustered
+     * buffers are marked immutable, but use dynamic sokol buffers. */
+    sg_usage usage;
+
+    /* Slot ranges per table (map<ecs_table_t*, sokol_table_instances_t*>) */
+    ecs_map_t tables;
+
+    /* Number of instances excluded from each pass, updated when tables are
+     * populated or released */
+    int32_t exclude_count[SOKOL_MAX_PASSES];
+
+    /* Unused slot ranges, sorted by offset (vec<sokol_instance_range_t>) */
+    ecs_vec_t free_ranges;
+    int32_t free_count;
+
+    /* Ranges written this frame that need uploading (vec<sokol_instance_range_t>) */
+    ecs_vec_t dirty_ranges;
+
+    /* Incremented each time buffers are populated */
+    int32_t frame;
+
+    /* Number of tables that need to be copied to buffers */
+    int32_t gather_count;
+
+    /* Number of instances to draw (includes unused slots) */
     int32_t instance_count;
 } sokol_geometry_buffers_t;
 
@@ -29660,32 +30730,185 @@ typedef struct SokolGeometry {
     /* Number of indices */
     int32_t index_count;
 
+    /* Levels of detail, from highest to lowest. The first level has the same
+     * buffers as vertices, normals and indices. A level is used for instances
+     * with a projected diameter of at least lod_sizes[level] pixels. */
+    sokol_mesh_t lods[SOKOL_MAX_LODS];
+    float lod_sizes[SOKOL_MAX_LODS];
+    int32_t lod_count;
+
+    /* Camera facing quad used for impostors */
+    sokol_mesh_t impostor;
+
+    /* Distance from camera beyond which instances are drawn as impostors. 
+     * Impostors are disabled if zero. */
+    float impostor_distance;
+
     /* Buffers with instanced data */
     sokol_geometry_buffers_t solid;
-    sokol_geometry_buffers_t emissive;
+    sokol_geometry_buffers_t statics; /* Entities with the SokolStatic tag */
 
     /* Function that copies geometry-specific data to GPU buffer */
     sokol_geometry_action_t populate;
 
+    /* Function that writes geometry-specific scaling to GPU buffer */
+    sokol_geometry_scale_action_t scale;
+
+    /* Function that computes bounding spheres for instances */
+    sokol_geometry_bounds_action_t bounds;
+
+#if SOKOL_OCCLUSION_CULLING
+    /* Whether instances can be used as occluders */
+    bool occluder;
+#endif
+
+    /* Statistics for the last frame */
+    sokol_geometry_stats_t stats;
+
     /* Allocator */
     ecs_allocator_t *allocator;
 } SokolGeometry;
 
+#if SOKOL_INSTANCE_RING
+/* Stream buffer that instance data of all geometry kinds is appended to. 
+ * Sokol rotates the underlying buffers between frames in flight, so data can
+ * be appended while the GPU reads the data of the previous frame. */
+typedef struct SokolInstanceRing {
+    sg_buffer buffer;
+    int32_t size;               /* Size of buffer in bytes */
+} SokolInstanceRing;
+#endif
+
+#if SOKOL_OCCLUSION_CULLING
+/* Instance that is drawn as occluder */
+typedef struct sokol_occluder_t {
+    sokol_geometry_buffers_t *buffers;
+    int32_t slot;
+    float size;                 /* Screen size used to select occluders */
+} sokol_occluder_t;
+
+/* Singleton with occlusion culling state */
+typedef struct SokolOcclusion {
+    sokol_occlusion_buffer_t buffer;
+    sokol_occlusion_desc_t desc;
+    sokol_occlusion_stats_t stats;
+    ecs_vec_t occluders;        /* Occluder candidates (vec<sokol_occluder_t>) */
+} SokolOcclusion;
+#endif
+
+/* Singleton with the camera facing quad that all geometries use to draw
+ * impostors. Set when the renderer creates its resources, and assigned to
+ * geometries that are created after that by CreateGeometryQueries. */
+typedef struct SokolImpostorMesh {
+    sokol_mesh_t mesh;
+} SokolImpostorMesh;
+
 typedef struct SokolGeometryQuery {
     ecs_entity_t component;
     ecs_query_t *parent_query;
     ecs_query_t *solid;
+    ecs_query_t *statics;
+    ecs_query_t *gather;
 } SokolGeometryQuery;
 
-/* Element with material parameters */
-typedef struct {
-    float specular_power;
-    float shininess;
-    float emissive;
-} SokolMaterial;
-
 extern ECS_COMPONENT_DECLARE(SokolGeometry);
 extern ECS_COMPONENT_DECLARE(SokolGeometryQuery);
+extern ECS_COMPONENT_DECLARE(SokolImpostorMesh);
+#if SOKOL_INSTANCE_RING
+extern ECS_COMPONENT_DECLARE(SokolInstanceRing);
+#endif
+#if SOKOL_OCCLUSION_CULLING
+extern ECS_COMPONENT_DECLARE(SokolOcclusion);
+#endif
+
+/* Instance layout, selected by SOKOL_INTERLEAVED_INSTANCES */
+extern const sokol_instance_layout_t sokol_instance_layout;
+
+/* Add instance attributes to pipeline layout. Streams that contain one of the
+ * attributes in the attrs mask are assigned to consecutive vertex buffers,
+ * starting from first_buffer. With SOKOL_ZERO_COPY_TRANSFORMS the scale
+ * attribute is added after the transform attributes. */
+void sokol_instance_pipeline_layout(
+    sg_layout_desc *layout,
+    ecs_flags32_t attrs,
+    int32_t first_buffer,
+    int32_t transform_attr,
+    int32_t color_attr,
+    int32_t material_attr);
+
+/* Bind instance streams, using the same assignment of streams to vertex 
+ * buffers as sokol_instance_pipeline_layout. */
+void sokol_instance_bindings(
+    sg_bindings *bind,
+    const sokol_instance_stream_t *streams,
+    ecs_flags32_t attrs,
+    int32_t first_buffer);
+
+/* Bind instance streams and draw the instances of buffers that are visible in
+ * view, skipping instances that are excluded from pass. Bindings must contain
+ * the geometry buffers of the pass. */
+void sokol_draw_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer);
+
+/* Same as sokol_draw_instances, but only draws the instances that are
+ * excluded from pass. */
+void sokol_draw_excluded_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer);
+
+/* Instance buffers of a geometry that are drawn in a frame */
+typedef struct sokol_draw_batch_t {
+    const SokolGeometry *geometry;
+    const sokol_geometry_buffers_t *buffers;
+    sokol_mesh_t mesh;          /* Geometry buffers to bind */
+    int32_t instance_count;     /* Instances visible to the camera */
+    ecs_flags32_t passes;       /* Passes to draw batch in (1 << SOKOL_PASS_*) */
+    ecs_flags32_t exclude;      /* Passes that some instances are excluded from */
+    uint64_t sort_key;          /* Geometry, depth, buffer kind */
+} sokol_draw_batch_t;
+
+/* Collect instance buffers of geometries matched by query with instances to
+ * draw into the draw list (vec<sokol_draw_batch_t>). The draw list is built
+ * once per frame after culling, and is drawn by all passes. */
+void sokol_build_draw_list(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    ecs_vec_t *draw_list);
+
+#if SOKOL_CULL_INSTANCES
+/* Cull instances of geometries matched by query against the frustum of the
+ * view projection matrix, and upload visible instances to view buffers. The
+ * screen height (in pixels) is used to select levels of detail, and the view
+ * matrix to orient impostors. */
+void sokol_cull_instances(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    int32_t view,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float screen_height);
+
+/* Find shadow casters for the shadow view. Casters are culled against the
+ * light volume, extended toward the light, and are dropped if their shadow
+ * (swept along the light direction) can't reach the camera frustum. */
+void sokol_cull_shadow_casters(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    mat4 light_mat_vp,
+    mat4 camera_mat_vp,
+    vec3 light_dir);
+#endif
 
 /* Initialize static resources for geometry rendering */
 void sokol_init_geometry(
@@ -30018,16 +31241,27 @@ void FlecsSystemsSokolImport(
 }
 
 
+/* Uniform structs have the std140 layout */
 typedef struct atmos_fs_uniforms_t {
     mat4 inv_mat_vp;
     vec3 eye_pos;
-    vec3 light_pos;
-    vec3 night_color;
     float aspect;
+    vec3 light_pos;
     float offset;
+    vec3 night_color;
+    float padding;
 } atmos_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, inv_mat_vp, 0);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, eye_pos, 64);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, aspect, 76);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, light_pos, 80);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, offset, 92);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, night_color, 96);
+SOKOL_UNIFORM_SIZE(atmos_fs_uniforms_t, 112);
+
 typedef struct atmos_param_fs_uniforms_t {
+    vec3 rayleigh_coef;
     float intensity;
     float planet_radius;
     float atmosphere_radius;
@@ -30035,9 +31269,19 @@ typedef struct atmos_param_fs_uniforms_t {
     float rayleigh_scale_height;
     float mie_scale_height;
     float mie_scatter_dir;
-    vec3 rayleigh_coef;
+    float padding[2];
 } atmos_param_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, rayleigh_coef, 0);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, intensity, 12);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, planet_radius, 16);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, atmosphere_radius, 20);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, mie_coef, 24);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, rayleigh_scale_height, 28);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, mie_scale_height, 32);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, mie_scatter_dir, 36);
+SOKOL_UNIFORM_SIZE(atmos_param_fs_uniforms_t, 48);
+
 static const char *atmosphere_f =
     SOKOL_SHADER_HEADER
     "#include \"etc/sokol/shaders/atmosphere_frag.glsl\"\n";
@@ -30067,27 +31311,30 @@ sokol_offscreen_pass_t sokol_init_atmos_pass(void)
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(atmos_fs_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "atmos_fs_params",
                     .uniforms = {
                         [0] = { .name="u_mat_v", .type=SG_UNIFORMTYPE_MAT4 },
                         [1] = { .name="u_eye_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [2] = { .name="u_light_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [3] = { .name="u_night_color", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [4] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
-                        [5] = { .name="u_offset", .type=SG_UNIFORMTYPE_FLOAT },
-                        [6] = { .name="padding", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
+                        [3] = { .name="u_light_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [4] = { .name="u_offset", .type=SG_UNIFORMTYPE_FLOAT },
+                        [5] = { .name="u_night_color", .type=SG_UNIFORMTYPE_FLOAT3 }
                     }
                 },
                 [1] = {
                     .size = sizeof(atmos_param_fs_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "atmos_fs_coefs",
                     .uniforms = {
-                        [0] = { .name="intensity", .type=SG_UNIFORMTYPE_FLOAT },
-                        [1] = { .name="planet_radius", .type=SG_UNIFORMTYPE_FLOAT },
-                        [2] = { .name="atmosphere_radius", .type=SG_UNIFORMTYPE_FLOAT },
-                        [3] = { .name="mie_coef", .type=SG_UNIFORMTYPE_FLOAT },
-                        [4] = { .name="rayleigh_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
-                        [5] = { .name="mie_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
-                        [6] = { .name="mie_scatter_dir", .type=SG_UNIFORMTYPE_FLOAT },
-                        [7] = { .name="rayleigh_coef", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [0] = { .name="rayleigh_coef", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [1] = { .name="intensity", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="planet_radius", .type=SG_UNIFORMTYPE_FLOAT },
+                        [3] = { .name="atmosphere_radius", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="mie_coef", .type=SG_UNIFORMTYPE_FLOAT },
+                        [5] = { .name="rayleigh_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
+                        [6] = { .name="mie_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
+                        [7] = { .name="mie_scatter_dir", .type=SG_UNIFORMTYPE_FLOAT }
                     }
                 }
             }
@@ -30120,42 +31367,42 @@ void sokol_run_atmos_pass(
     sokol_offscreen_pass_t *pass,
     sokol_render_state_t *state) 
 {
-    if (!state->atmosphere) {
+    if (!state->has_atmosphere) {
         ecs_err("atmosphere pass called without atmosphere parameters");
         return;
     }
 
-    atmos_fs_uniforms_t fs_u;
+    atmos_fs_uniforms_t fs_u = {0};
     glm_mat4_copy(state->uniforms.inv_mat_v, fs_u.inv_mat_vp);
     glm_vec3_copy(state->uniforms.eye_pos, fs_u.eye_pos);
     glm_vec3_copy(state->uniforms.sun_direction, fs_u.light_pos);
-    glm_vec3_copy((float*)&state->atmosphere->night_color, fs_u.night_color);
+    glm_vec3_copy((float*)&state->atmosphere.night_color, fs_u.night_color);
     // fs_u.night_color[0] = 0.001 / 8.0;
     // fs_u.night_color[1] = 0.008 / 8.0;
     // fs_u.night_color[2] = 0.016 / 8.0;
     fs_u.aspect = state->uniforms.aspect;
     fs_u.offset = 0.05;
 
-    atmos_param_fs_uniforms_t fs_p_u;
-    fs_p_u.intensity = state->atmosphere->intensity;
-    fs_p_u.planet_radius = state->atmosphere->planet_radius;
-    fs_p_u.atmosphere_radius = state->atmosphere->atmosphere_radius;
-    fs_p_u.mie_coef = state->atmosphere->mie_coef;
-    fs_p_u.rayleigh_scale_height = state->atmosphere->rayleigh_scale_height;
-    fs_p_u.mie_scale_height = state->atmosphere->mie_scale_height;
-    fs_p_u.mie_scatter_dir = state->atmosphere->mie_scatter_dir;
-    glm_vec3_copy((float*)state->atmosphere->rayleigh_coef, fs_p_u.rayleigh_coef);
+    atmos_param_fs_uniforms_t fs_p_u = {0};
+    fs_p_u.intensity = state->atmosphere.intensity;
+    fs_p_u.planet_radius = state->atmosphere.planet_radius;
+    fs_p_u.atmosphere_radius = state->atmosphere.atmosphere_radius;
+    fs_p_u.mie_coef = state->atmosphere.mie_coef;
+    fs_p_u.rayleigh_scale_height = state->atmosphere.rayleigh_scale_height;
+    fs_p_u.mie_scale_height = state->atmosphere.mie_scale_height;
+    fs_p_u.mie_scatter_dir = state->atmosphere.mie_scatter_dir;
+    glm_vec3_copy(state->atmosphere.rayleigh_coef, fs_p_u.rayleigh_coef);
 
     sg_begin_pass(pass->pass, &pass->pass_action);
-    sg_apply_pipeline(pass->pip);
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(atmos_fs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&fs_p_u, sizeof(atmos_param_fs_uniforms_t)});
+    sokol_apply_pipeline(pass->pip);
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(atmos_fs_uniforms_t)});
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&fs_p_u, sizeof(atmos_param_fs_uniforms_t)});
 
     sg_bindings bind = { .vertex_buffers = { state->resources->quad } };
-    sg_apply_bindings(&bind);
+    sokol_apply_bindings(&bind);
     sg_draw(0, 6, 1);
 
-    sg_end_pass();
+    sokol_end_pass();
 }
 
 
@@ -30163,6 +31410,9 @@ typedef struct depth_vs_uniforms_t {
     mat4 mat_vp;
 } depth_vs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(depth_vs_uniforms_t, mat_vp, 0);
+SOKOL_UNIFORM_SIZE(depth_vs_uniforms_t, 64);
+
 typedef struct depth_fs_uniforms_t {
     vec3 eye_pos;
     float near_;
@@ -30171,16 +31421,23 @@ typedef struct depth_fs_uniforms_t {
     float inv_log_far;
 } depth_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, eye_pos, 0);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, near_, 12);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, far_, 16);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, depth_c, 20);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, inv_log_far, 24);
+SOKOL_UNIFORM_SIZE(depth_fs_uniforms_t, 28);
+
 const char* sokol_vs_depth(void) 
 {
     return SOKOL_SHADER_HEADER
         "uniform mat4 u_mat_vp;\n"
         "uniform vec3 u_eye_pos;\n"
         "layout(location=0) in vec4 v_position;\n"
-        "layout(location=1) in mat4 i_mat_m;\n"
+        SOKOL_SHADER_INSTANCE_TRANSFORM(1, 5)
         "out vec3 position;\n"
         "void main() {\n"
-        "  gl_Position = u_mat_vp * i_mat_m * v_position;\n"
+        "  gl_Position = u_mat_vp * instance_transform() * v_position;\n"
         "  position = gl_Position.xyz;\n"
         "}\n";
 }
@@ -30249,23 +31506,13 @@ sg_pipeline init_depth_pipeline(int32_t sample_count) {
         .fs.source = sokol_fs_depth()
     });
 
-    return sg_make_pipeline(&(sg_pipeline_desc){
+    sg_pipeline_desc desc = {
         .shader = shd,
         .index_type = SG_INDEXTYPE_UINT16,
         .layout = {
-            .buffers = {
-                [1] = { .stride = 64, .step_func=SG_VERTEXSTEP_PER_INSTANCE }
-            },
-
             .attrs = {
                 /* Static geometry */
-                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-         
-                /* Matrix (per instance) */
-                [1] = { .buffer_index=1, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT4 },
-                [2] = { .buffer_index=1, .offset=16, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [3] = { .buffer_index=1, .offset=32, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [4] = { .buffer_index=1, .offset=48, .format=SG_VERTEXFORMAT_FLOAT4 }
+                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 }
             }
         },
         .depth = {
@@ -30278,7 +31525,13 @@ sg_pipeline init_depth_pipeline(int32_t sample_count) {
         }},
         .cull_mode = SG_CULLMODE_BACK,
         .sample_count = sample_count
-    });
+    };
+
+    /* Matrix (per instance) */
+    sokol_instance_pipeline_layout(&desc.layout, SOKOL_INSTANCE_TRANSFORM, 
+        1, 1, -1, -1);
+
+    return sg_make_pipeline(&desc);
 }
 
 sokol_offscreen_pass_t sokol_init_depth_pass(
@@ -30329,27 +31582,29 @@ void sokol_update_depth_pass(
 
 static
 void depth_draw_instances(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers)
+    const sokol_draw_batch_t *batch,
+    bool no_prepass)
 {
-    if (!buffers->instance_count) {
-        return;
-    }
-
     sg_bindings bind = {
         .vertex_buffers = {
-            [0] = geometry->vertices,
-            [1] = buffers->transforms
+            [0] = batch->mesh.vertices
         },
-        .index_buffer = geometry->indices
+        .index_buffer = batch->mesh.indices
     };
 
-    sg_apply_bindings(&bind);
-    sg_draw(0, geometry->index_count, buffers->instance_count);
+    if (no_prepass) {
+        sokol_draw_excluded_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, 
+            SOKOL_INSTANCE_TRANSFORM, 1);
+    } else {
+        sokol_draw_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, 
+            SOKOL_INSTANCE_TRANSFORM, 1);
+    }
 }
 
-void sokol_run_depth_pass(
-    sokol_offscreen_pass_t *pass,
+static
+void depth_apply_uniforms(
     sokol_render_state_t *state)
 {
     depth_vs_uniforms_t vs_u;
@@ -30362,43 +31617,103 @@ void sokol_run_depth_pass(
     fs_u.depth_c = SOKOL_DEPTH_C;
     fs_u.inv_log_far = 1.0 / log(SOKOL_DEPTH_C * fs_u.far_ + 1.0);
 
+    sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(depth_vs_uniforms_t)});
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(depth_fs_uniforms_t)});
+}
+
+void sokol_run_depth_pass(
+    sokol_offscreen_pass_t *pass,
+    sokol_render_state_t *state)
+{
     /* Render to offscreen texture so screen-space effects can be applied */
     sg_begin_pass(pass->pass, &pass->pass_action);
-    sg_apply_pipeline(pass->pip);
+    sokol_apply_pipeline(pass->pip);
+    depth_apply_uniforms(state);
 
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(depth_vs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(depth_fs_uniforms_t)});
+    /* Loop draw list, render scene */
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    for (b = 0; b < count; b ++) {
+        if (batches[b].passes & (1u << SOKOL_PASS_DEPTH)) {
+            depth_draw_instances(&batches[b], false);
+        }
+    }
 
-    /* Loop geometry, render scene */
-    ecs_iter_t qit = ecs_query_iter(state->world, state->q_scene);
-    while (ecs_query_next(&qit)) {
-        SokolGeometry *geometry = ecs_field(&qit, SokolGeometry, 0);
+    sokol_end_pass();
+}
 
-        int b;
-        for (b = 0; b < qit.count; b ++) {
-            depth_draw_instances(&geometry[b], &geometry[b].solid);
-            depth_draw_instances(&geometry[b], &geometry[b].emissive);
+void sokol_run_late_depth_pass(
+    sokol_offscreen_pass_t *pass,
+    sokol_render_state_t *state)
+{
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    for (b = 0; b < count; b ++) {
+        if (batches[b].exclude & (1u << SOKOL_PASS_DEPTH)) {
+            break;
         }
     }
 
-    sg_end_pass();
+    /* Skip pass if all instances were drawn by the depth prepass */
+    if (b == count) {
+        return;
+    }
+
+    /* The scene pass wrote the depth of instances that are not in the depth
+     * prepass to the depth buffer. Draw them on top of the depth texture, so
+     * that screen-space effects see them. */
+    sg_pass_action action = {
+        .colors[0].action = SG_ACTION_LOAD,
+        .depth.action = SG_ACTION_LOAD,
+        .stencil.action = SG_ACTION_LOAD
+    };
+
+    sg_begin_pass(pass->pass, &action);
+    sokol_apply_pipeline(pass->pip);
+    depth_apply_uniforms(state);
+
+    for (; b < count; b ++) {
+        if ((batches[b].passes & (1u << SOKOL_PASS_SCENE)) &&
+            (batches[b].exclude & (1u << SOKOL_PASS_DEPTH))) 
+        {
+            depth_draw_instances(&batches[b], true);
+        }
+    }
+
+    sokol_end_pass();
 }
 
 
+/* Uniform structs have the std140 layout */
 typedef struct fx_uniforms_t {
+    float target_size[2];
     float t;
     float dt;
     float aspect;
     float near_;
     float far_;
-    float target_size[2];
+    float padding;
 } fx_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, target_size, 0);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, t, 8);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, dt, 12);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, aspect, 16);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, near_, 20);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, far_, 24);
+SOKOL_UNIFORM_SIZE(fx_uniforms_t, 32);
+
 typedef struct fx_mat_uniforms_t {
     mat4 mat_p;
     mat4 inv_mat_p;
 } fx_mat_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(fx_mat_uniforms_t, mat_p, 0);
+SOKOL_UNIFORM_OFFSET(fx_mat_uniforms_t, inv_mat_p, 64);
+SOKOL_UNIFORM_SIZE(fx_mat_uniforms_t, 128);
+
 static
 char* fx_build_shader(
     sokol_fx_pass_desc_t *pass)
@@ -30412,14 +31727,18 @@ char* fx_build_shader(
         "#define FX\n"
         "out vec4 frag_color;\n"
         "in vec2 uv;\n"
-        "uniform float u_t;\n"
-        "uniform float u_dt;\n"
-        "uniform float u_aspect;\n"
-        "uniform float u_near;\n"
-        "uniform float u_far;\n"
-        "uniform vec2 u_target_size;\n"
-        "uniform mat4 u_mat_p;\n"
-        "uniform mat4 u_inv_mat_p;\n"
+        "SOKOL_UNIFORM_BLOCK(fx_params)\n"
+        "SOKOL_UNIFORM vec2 u_target_size;\n"
+        "SOKOL_UNIFORM float u_t;\n"
+        "SOKOL_UNIFORM float u_dt;\n"
+        "SOKOL_UNIFORM float u_aspect;\n"
+        "SOKOL_UNIFORM float u_near;\n"
+        "SOKOL_UNIFORM float u_far;\n"
+        "SOKOL_UNIFORM_BLOCK_END\n"
+        "SOKOL_UNIFORM_BLOCK(fx_mat_params)\n"
+        "SOKOL_UNIFORM mat4 u_mat_p;\n"
+        "SOKOL_UNIFORM mat4 u_inv_mat_p;\n"
+        "SOKOL_UNIFORM_BLOCK_END\n"
         "uniform sampler2D u_noise;\n");
 
     /* Add inputs */
@@ -30433,13 +31752,21 @@ char* fx_build_shader(
     }
 
     /* Add uniform params */
+    if (pass->params[0]) {
+        ecs_strbuf_appendstr(&shad, "SOKOL_UNIFORM_BLOCK(fx_pass_params)\n");
+    }
+
     for (int32_t i = 0; i < SOKOL_MAX_FX_INPUTS; i ++) {
         const char *param = pass->params[i];
         if (!param) {
             break;
         }
 
-        ecs_strbuf_append(&shad, "uniform float %s;\n", param);
+        ecs_strbuf_append(&shad, "SOKOL_UNIFORM float %s;\n", param);
+    }
+
+    if (pass->params[0]) {
+        ecs_strbuf_appendstr(&shad, "SOKOL_UNIFORM_BLOCK_END\n");
     }
 
     /* Add shader header */
@@ -30480,14 +31807,16 @@ int sokol_fx_add_pass(
     char *fs_prog = fx_build_shader(pass_desc);
 
     /* Populate list of shader specific uniforms */
-    sg_shader_uniform_block_desc prog_ub = { 0 };
+    sg_shader_uniform_block_desc prog_ub = { 
+        .layout = SG_UNIFORMLAYOUT_STD140,
+        .block_name = "fx_pass_params"
+    };
 
-    for (int32_t i = 0; i < SOKOL_MAX_FX_PARAMS; i ++) {
+    for (int32_t i = 0; i < SOKOL_MAX_FX_INPUTS; i ++) {
         const char *param = pass_desc->params[i];
         if (!param) {
             break;
         }
-        prog_ub.size += sizeof(float);
         prog_ub.uniforms[i] = (sg_shader_uniform_desc){
             .name = param, 
             .type = SG_UNIFORMTYPE_FLOAT 
@@ -30495,6 +31824,11 @@ int sokol_fx_add_pass(
         pass->param_count ++;
     }
 
+    /* Float params are tightly packed, std140 blocks are padded to 16 bytes */
+    if (pass->param_count) {
+        prog_ub.size = (size_t)ECS_ALIGN(pass->param_count * ECS_SIZEOF(float), 16);
+    }
+
     /* Shader program */
     sg_shader_desc prog = {
         .vs = {
@@ -30505,17 +31839,21 @@ int sokol_fx_add_pass(
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(fx_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "fx_params",
                     .uniforms = {
-                        [0] = { .name="u_t", .type=SG_UNIFORMTYPE_FLOAT },
-                        [1] = { .name="u_dt", .type=SG_UNIFORMTYPE_FLOAT },
-                        [2] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
-                        [3] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
-                        [4] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT },
-                        [5] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 }
+                        [0] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 },
+                        [1] = { .name="u_t", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_dt", .type=SG_UNIFORMTYPE_FLOAT },
+                        [3] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
+                        [5] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT }
                     }
                 },
                 [1] = {
                     .size = sizeof(fx_mat_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "fx_mat_params",
                     .uniforms = {
                         [0] = { .name = "u_mat_p", .type = SG_UNIFORMTYPE_MAT4 },
                         [1] = { .name = "u_inv_mat_p", .type = SG_UNIFORMTYPE_MAT4 }
@@ -30728,21 +32066,22 @@ void fx_draw(
             sg_begin_default_pass(&screen_pass->pass_action, width, height);
         }
 
-        sg_apply_pipeline(pass->pip);
+        sokol_apply_pipeline(pass->pip);
 
         f_u.target_size[0] = output->width;
         f_u.target_size[1] = output->height;
-        sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){
             &f_u, sizeof(fx_uniforms_t) 
         });
 
-        sg_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){
             &fs_mat_u, sizeof(fx_mat_uniforms_t)
         });
 
         if (pass->param_count) {
-            sg_apply_uniforms(SG_SHADERSTAGE_FS, 2, &(sg_range){
-                step->params, pass->param_count * sizeof(float)
+            sokol_apply_uniforms(SG_SHADERSTAGE_FS, 2, &(sg_range){
+                step->params, (size_t)ECS_ALIGN(
+                    pass->param_count * ECS_SIZEOF(float), 16)
             });
         }
 
@@ -30770,11 +32109,11 @@ void fx_draw(
             }
         }
 
-        sg_apply_bindings(&bind);
+        sokol_apply_bindings(&bind);
 
         sg_draw(0, 6, 1);
 
-        sg_end_pass();
+        sokol_end_pass();
 
         output->toggle = !toggle;
     }
@@ -30875,6 +32214,16 @@ uint16_t rectangle_indices[] = {
     0, 2, 3
 };
 
+/* Front & back side of rectangle, so that impostors are visible regardless of
+ * how they are oriented */
+static
+uint16_t rectangle_impostor_indices[] = {
+    0, 1, 2,
+    0, 2, 3,
+    2, 1, 0,
+    3, 2, 0
+};
+
 static
 vec3 box_vertices[] = {
     {-0.5f,  0.5f, -0.5f},  
@@ -31104,6 +32453,20 @@ int32_t sokol_rectangle_index_count(void)
     return 6;
 }
 
+sg_buffer sokol_buffer_rectangle_impostor_indices(void)
+{
+    return sg_make_buffer(&(sg_buffer_desc){
+        .data = { rectangle_impostor_indices, sizeof(rectangle_impostor_indices) },
+        .type = SG_BUFFERTYPE_INDEXBUFFER,
+        .usage = SG_USAGE_IMMUTABLE
+    });
+}
+
+int32_t sokol_rectangle_impostor_index_count(void)
+{
+    return 12;
+}
+
 sg_buffer sokol_buffer_rectangle_normals(void)
 {
     vec3 normals[4];
@@ -31116,6 +32479,203 @@ sg_buffer sokol_buffer_rectangle_normals(void)
     });
 }
 
+// Same as compute_flat_normals, but accumulates the (area weighted) normals 
+// of the triangles that share a vertex. Degenerate triangles don't contribute.
+static
+void compute_smooth_normals(
+    vec3 *vertices,
+    int32_t vertex_count,
+    uint16_t *indices,
+    int32_t count,
+    vec3 *normals_out)
+{
+    int32_t v;
+    for (v = 0; v < vertex_count; v ++) {
+        glm_vec3_zero(normals_out[v]);
+    }
+
+    for (v = 0; v < count; v += 3) {
+        vec3 v1, v2, normal;
+        glm_vec3_sub(vertices[indices[v + 0]], vertices[indices[v + 1]], v1);
+        glm_vec3_sub(vertices[indices[v + 0]], vertices[indices[v + 2]], v2);
+        glm_vec3_cross(v2, v1, normal);
+
+        glm_vec3_add(normals_out[indices[v + 0]], normal, normals_out[indices[v + 0]]);
+        glm_vec3_add(normals_out[indices[v + 1]], normal, normals_out[indices[v + 1]]);
+        glm_vec3_add(normals_out[indices[v + 2]], normal, normals_out[indices[v + 2]]);
+    }
+
+    for (v = 0; v < vertex_count; v ++) {
+        glm_vec3_normalize(normals_out[v]);
+    }
+}
+
+/* Vertices and indices of a procedural mesh while it is generated */
+typedef struct mesh_builder_t {
+    ecs_vec_t vertices;         /* vec<vec3> */
+    ecs_vec_t indices;          /* vec<uint16_t> */
+} mesh_builder_t;
+
+static
+uint16_t mesh_vertex(
+    mesh_builder_t *b,
+    float x,
+    float y,
+    float z)
+{
+    int32_t index = ecs_vec_count(&b->vertices);
+    ecs_assert(index <= UINT16_MAX, ECS_OUT_OF_RANGE, NULL);
+    float *v = *ecs_vec_append_t(NULL, &b->vertices, vec3);
+    v[0] = x;
+    v[1] = y;
+    v[2] = z;
+    return (uint16_t)index;
+}
+
+static
+void mesh_triangle(
+    mesh_builder_t *b,
+    int32_t i0,
+    int32_t i1,
+    int32_t i2)
+{
+    uint16_t *t = ecs_vec_grow_t(NULL, &b->indices, uint16_t, 3);
+    t[0] = (uint16_t)i0;
+    t[1] = (uint16_t)i1;
+    t[2] = (uint16_t)i2;
+}
+
+// Flat disk at height y. The disk faces up if up is true.
+static
+void mesh_disk(
+    mesh_builder_t *b,
+    int32_t segments,
+    float y,
+    bool up)
+{
+    int32_t s, center = mesh_vertex(b, 0, y, 0);
+    for (s = 0; s <= segments; s ++) {
+        float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+        mesh_vertex(b, 0.5f * cosf(a), y, 0.5f * sinf(a));
+    }
+    for (s = 0; s < segments; s ++) {
+        if (up) {
+            mesh_triangle(b, center, center + s + 2, center + s + 1);
+        } else {
+            mesh_triangle(b, center, center + s + 1, center + s + 2);
+        }
+    }
+}
+
+// Upload mesh to sokol buffers, and free the builder
+static
+sokol_mesh_t mesh_make(
+    mesh_builder_t *b)
+{
+    int32_t vertex_count = ecs_vec_count(&b->vertices);
+    int32_t index_count = ecs_vec_count(&b->indices);
+    vec3 *vertices = ecs_vec_first_t(&b->vertices, vec3);
+    uint16_t *indices = ecs_vec_first_t(&b->indices, uint16_t);
+    vec3 *normals = ecs_os_malloc_n(vec3, vertex_count);
+    compute_smooth_normals(vertices, vertex_count, indices, index_count, normals);
+
+    sokol_mesh_t result = {
+        .vertices = sg_make_buffer(&(sg_buffer_desc){
+            .data = { vertices, vertex_count * sizeof(vec3) },
+            .usage = SG_USAGE_IMMUTABLE
+        }),
+        .normals = sg_make_buffer(&(sg_buffer_desc){
+            .data = { normals, vertex_count * sizeof(vec3) },
+            .usage = SG_USAGE_IMMUTABLE
+        }),
+        .indices = sg_make_buffer(&(sg_buffer_desc){
+            .data = { indices, index_count * sizeof(uint16_t) },
+            .type = SG_BUFFERTYPE_INDEXBUFFER,
+            .usage = SG_USAGE_IMMUTABLE
+        }),
+        .index_count = index_count
+    };
+
+    ecs_os_free(normals);
+    ecs_vec_fini_t(NULL, &b->vertices, vec3);
+    ecs_vec_fini_t(NULL, &b->indices, uint16_t);
+    return result;
+}
+
+sokol_mesh_t sokol_mesh_sphere(
+    int32_t segments)
+{
+    mesh_builder_t b = {0};
+    int32_t rings = glm_imax(segments / 2, 2), r, s;
+
+    for (r = 0; r <= rings; r ++) {
+        float t = (float)r / (float)rings * GLM_PIf;
+        for (s = 0; s <= segments; s ++) {
+            float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+            mesh_vertex(&b, 0.5f * sinf(t) * cosf(a), 0.5f * cosf(t), 
+                0.5f * sinf(t) * sinf(a));
+        }
+    }
+
+    for (r = 0; r < rings; r ++) {
+        for (s = 0; s < segments; s ++) {
+            int32_t i0 = r * (segments + 1) + s, i1 = i0 + segments + 1;
+            mesh_triangle(&b, i0, i0 + 1, i1);
+            mesh_triangle(&b, i0 + 1, i1 + 1, i1);
+        }
+    }
+
+    return mesh_make(&b);
+}
+
+sokol_mesh_t sokol_mesh_cylinder(
+    int32_t segments)
+{
+    mesh_builder_t b = {0};
+    int32_t s;
+
+    for (s = 0; s <= segments; s ++) {
+        float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+        mesh_vertex(&b, 0.5f * cosf(a),  0.5f, 0.5f * sinf(a));
+        mesh_vertex(&b, 0.5f * cosf(a), -0.5f, 0.5f * sinf(a));
+    }
+
+    for (s = 0; s < segments; s ++) {
+        int32_t i0 = s * 2, i1 = i0 + 1;
+        mesh_triangle(&b, i0, i0 + 2, i1);
+        mesh_triangle(&b, i0 + 2, i1 + 2, i1);
+    }
+
+    mesh_disk(&b, segments,  0.5f, true);
+    mesh_disk(&b, segments, -0.5f, false);
+
+    return mesh_make(&b);
+}
+
+sokol_mesh_t sokol_mesh_cone(
+    int32_t segments)
+{
+    mesh_builder_t b = {0};
+    int32_t s;
+
+    // Each side triangle has its own apex, so that normals at the apex aren't
+    // averaged to point straight up.
+    for (s = 0; s <= segments; s ++) {
+        float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+        mesh_vertex(&b, 0, 0.5f, 0);
+        mesh_vertex(&b, 0.5f * cosf(a), -0.5f, 0.5f * sinf(a));
+    }
+
+    for (s = 0; s < segments; s ++) {
+        int32_t i0 = s * 2, i1 = i0 + 1;
+        mesh_triangle(&b, i0, i1 + 2, i1);
+    }
+
+    mesh_disk(&b, segments, -0.5f, false);
+
+    return mesh_make(&b);
+}
+
 sg_pass_action sokol_clear_action(
     ecs_rgb_t color,
     bool clear_color,
@@ -31215,66 +32775,128 @@ sg_image sokol_bg_texture(ecs_rgb_t color, int32_t width, int32_t height)
 }
 
 
+/* Uniform structs have the std140 layout, so they can be copied as is to a
+ * uniform block. A vec3 is followed by a float member or padding. */
 typedef struct scene_vs_uniforms_t {
     mat4 mat_v;
     mat4 mat_vp;
     mat4 light_mat_vp;
     float near_;
     float far_;
+    float padding[2];
 } scene_vs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, mat_v, 0);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, mat_vp, 64);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, light_mat_vp, 128);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, near_, 192);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, far_, 196);
+SOKOL_UNIFORM_SIZE(scene_vs_uniforms_t, 208);
+
 typedef struct scene_fs_uniforms_t {
     vec3 light_ambient;
-    vec3 light_ambient_ground;
-    vec3 light_direction;
-    vec3 light_color;
-    vec3 eye_pos;
     float light_ambient_ground_falloff;
+    vec3 light_ambient_ground;
     float light_ambient_ground_offset;
+    vec3 light_direction;
     float light_ambient_ground_intensity;
+    vec3 light_color;
     float shadow_map_size;
+    vec3 eye_pos;
     float shadow_far;
     int light_count;
+    float cluster_depth_scale;
+    float cluster_tile_scale[2];
+    float cluster_depth_bias;
+    float padding[3];
 } scene_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient, 0);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground_falloff, 12);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground, 16);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground_offset, 28);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_direction, 32);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground_intensity, 44);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_color, 48);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, shadow_map_size, 60);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, eye_pos, 64);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, shadow_far, 76);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_count, 80);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, cluster_depth_scale, 84);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, cluster_tile_scale, 88);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, cluster_depth_bias, 96);
+SOKOL_UNIFORM_SIZE(scene_fs_uniforms_t, 112);
+
+/* std140 arrays have a 16 byte stride, so the light distance is stored in the
+ * w component of the position */
 typedef struct scene_fs_lights_t {
-    vec3 light_colors[SOKOL_MAX_LIGHTS];
-    vec3 light_positions[SOKOL_MAX_LIGHTS];
-    float light_distance[SOKOL_MAX_LIGHTS];
+    vec4 light_colors[SOKOL_MAX_LIGHTS];
+    vec4 light_positions[SOKOL_MAX_LIGHTS];
 } scene_fs_lights_t;
 
+SOKOL_UNIFORM_OFFSET(scene_fs_lights_t, light_colors, 0);
+SOKOL_UNIFORM_OFFSET(scene_fs_lights_t, light_positions, 16 * SOKOL_MAX_LIGHTS);
+SOKOL_UNIFORM_SIZE(scene_fs_lights_t, 32 * SOKOL_MAX_LIGHTS);
+
 typedef struct scene_fs_sun_atmos_uniforms_t {
     vec3 sun_screen_pos;
-    vec3 sun_color;
-    vec2 target_size;
     float aspect;
+    vec3 sun_color;
     float sun_intensity;
+    vec2 target_size;
+    float padding[2];
 } scene_fs_sun_atmos_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, sun_screen_pos, 0);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, aspect, 12);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, sun_color, 16);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, sun_intensity, 28);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, target_size, 32);
+SOKOL_UNIFORM_SIZE(scene_fs_sun_atmos_uniforms_t, 48);
+
 #define POSITION_I 0
 #define NORMAL_I 1
 #define COLOR_I 2
 #define MATERIAL_I 3
 #define TRANSFORM_I 4
+#define SCALE_I 8
+#define INSTANCE_I 2
 #define LAYOUT_I_STR(i) #i
 #define LAYOUT(loc) "layout(location=" LAYOUT_I_STR(loc) ") "
 
-sg_pipeline init_scene_pipeline(int32_t sample_count) {
+#if SOKOL_CLUSTERED_LIGHTS
+#define SCENE_SHADER_DEFINES \
+    "#define CLUSTERED_LIGHTS\n" \
+    "#define CLUSTER_X " SOKOL_STR(SOKOL_CLUSTER_X) "\n" \
+    "#define CLUSTER_Y " SOKOL_STR(SOKOL_CLUSTER_Y) "\n" \
+    "#define CLUSTER_Z " SOKOL_STR(SOKOL_CLUSTER_Z) "\n" \
+    "#define CLUSTER_TEXTURE_WIDTH " SOKOL_STR(SOKOL_CLUSTER_TEXTURE_WIDTH) "\n" \
+    "#define LIGHT_RANGE " SOKOL_STR(SOKOL_LIGHT_RANGE) "\n"
+#else
+#define SCENE_SHADER_DEFINES ""
+#endif
+
+sg_pipeline init_scene_pipeline(int32_t sample_count, bool write_depth) {
     char *vs = sokol_shader_from_str(
         SOKOL_SHADER_HEADER
-        "uniform mat4 u_mat_vp;\n"
-        "uniform mat4 u_mat_v;\n"
-        "uniform mat4 u_light_vp;\n"
+        SCENE_SHADER_DEFINES
+        "SOKOL_UNIFORM_BLOCK(scene_vs_params)\n"
+        "SOKOL_UNIFORM mat4 u_mat_v;\n"
+        "SOKOL_UNIFORM mat4 u_mat_vp;\n"
+        "SOKOL_UNIFORM mat4 u_light_vp;\n"
+        "SOKOL_UNIFORM float u_near;\n"
+        "SOKOL_UNIFORM float u_far;\n"
+        "SOKOL_UNIFORM_BLOCK_END\n"
         LAYOUT(POSITION_I)  "in vec3 v_position;\n"
         LAYOUT(NORMAL_I)    "in vec3 v_normal;\n"
-        LAYOUT(COLOR_I)     "in vec3 i_color;\n"
-        LAYOUT(MATERIAL_I)  "in vec3 i_material;\n"
-        LAYOUT(TRANSFORM_I) "in mat4 i_mat_m;\n"
+        SOKOL_SHADER_INSTANCE_COLOR(COLOR_I, MATERIAL_I)
+        SOKOL_SHADER_INSTANCE_TRANSFORM(TRANSFORM_I, SCALE_I)
         "#include \"etc/sokol/shaders/scene_vert.glsl\"\n"
     );
 
     char *fs = sokol_shader_from_str(
         SOKOL_SHADER_HEADER
+        SCENE_SHADER_DEFINES
         "#include \"etc/sokol/shaders/scene_frag.glsl\"\n"
     );
 
@@ -31283,13 +32905,14 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
         .vs.uniform_blocks = {
             [0] = {
                 .size = sizeof(scene_vs_uniforms_t),
+                .layout = SG_UNIFORMLAYOUT_STD140,
+                .block_name = "scene_vs_params",
                 .uniforms = {
                     [0] = { .name="u_mat_v", .type=SG_UNIFORMTYPE_MAT4 },
                     [1] = { .name="u_mat_vp", .type=SG_UNIFORMTYPE_MAT4 },
                     [2] = { .name="u_light_vp", .type=SG_UNIFORMTYPE_MAT4 },
-                    [3] = { .name="padding", .type=SG_UNIFORMTYPE_FLOAT2 },
-                    [4] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
-                    [5] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT }
+                    [3] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
+                    [4] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT }
                 },
             }
         },
@@ -31298,33 +32921,57 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
                 [0] = {
                     .name = "shadow_map",
                     .image_type = SG_IMAGETYPE_2D
+                },
+#if SOKOL_CLUSTERED_LIGHTS
+                [1] = {
+                    .name = "u_light_data",
+                    .image_type = SG_IMAGETYPE_2D
+                },
+                [2] = {
+                    .name = "u_light_clusters",
+                    .image_type = SG_IMAGETYPE_2D,
+                    .sampler_type = SG_SAMPLERTYPE_UINT
+                },
+                [3] = {
+                    .name = "u_light_indices",
+                    .image_type = SG_IMAGETYPE_2D,
+                    .sampler_type = SG_SAMPLERTYPE_UINT
                 }
+#endif
             },
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(scene_fs_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "scene_fs_params",
                     .uniforms = {
                         [0] = { .name="u_light_ambient", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [1] = { .name="u_light_ambient_ground", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [2] = { .name="u_light_direction", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [3] = { .name="u_light_color", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [4] = { .name="u_eye_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [5] = { .name="u_light_ambient_ground_falloff", .type=SG_UNIFORMTYPE_FLOAT },
-                        [6] = { .name="u_light_ambient_ground_offset", .type=SG_UNIFORMTYPE_FLOAT },
-                        [7] = { .name="u_light_ambient_ground_intensity", .type=SG_UNIFORMTYPE_FLOAT },
-                        [8] = { .name="u_shadow_map_size", .type=SG_UNIFORMTYPE_FLOAT },
+                        [1] = { .name="u_light_ambient_ground_falloff", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_light_ambient_ground", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [3] = { .name="u_light_ambient_ground_offset", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="u_light_direction", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [5] = { .name="u_light_ambient_ground_intensity", .type=SG_UNIFORMTYPE_FLOAT },
+                        [6] = { .name="u_light_color", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [7] = { .name="u_shadow_map_size", .type=SG_UNIFORMTYPE_FLOAT },
+                        [8] = { .name="u_eye_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
                         [9] = { .name="u_shadow_far", .type=SG_UNIFORMTYPE_FLOAT },
-                        [10] = { .name="u_light_count", .type=SG_UNIFORMTYPE_INT }
+                        [10] = { .name="u_light_count", .type=SG_UNIFORMTYPE_INT },
+                        [11] = { .name="u_cluster_depth_scale", .type=SG_UNIFORMTYPE_FLOAT },
+                        [12] = { .name="u_cluster_tile_scale", .type=SG_UNIFORMTYPE_FLOAT2 },
+                        [13] = { .name="u_cluster_depth_bias", .type=SG_UNIFORMTYPE_FLOAT }
                     }
                 },
+#if !SOKOL_CLUSTERED_LIGHTS
                 [1] = {
                     .size = sizeof(scene_fs_lights_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "scene_fs_lights",
                     .uniforms = {
-                        [0] = { .name="u_point_light_color",    .type=SG_UNIFORMTYPE_FLOAT3, .array_count = SOKOL_MAX_LIGHTS },
-                        [1] = { .name="u_point_light_position", .type=SG_UNIFORMTYPE_FLOAT3, .array_count = SOKOL_MAX_LIGHTS  },
-                        [2] = { .name="u_point_light_distance", .type=SG_UNIFORMTYPE_FLOAT, .array_count = SOKOL_MAX_LIGHTS  },
+                        [0] = { .name="u_point_light_color",    .type=SG_UNIFORMTYPE_FLOAT4, .array_count = SOKOL_MAX_LIGHTS },
+                        [1] = { .name="u_point_light_position", .type=SG_UNIFORMTYPE_FLOAT4, .array_count = SOKOL_MAX_LIGHTS }
                     }
                 }
+#endif
             }
         },
 
@@ -31335,39 +32982,23 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
     ecs_os_free(vs);
     ecs_os_free(fs);
 
-    return sg_make_pipeline(&(sg_pipeline_desc){
+    sg_pipeline_desc desc = {
         .shader = shd,
         .index_type = SG_INDEXTYPE_UINT16,
         .layout = {
-            .buffers = {
-                [COLOR_I] =     { .stride = 0,  .step_func=SG_VERTEXSTEP_PER_INSTANCE },
-                [MATERIAL_I] =  { .stride = 12, .step_func=SG_VERTEXSTEP_PER_INSTANCE },
-                [TRANSFORM_I] = { .stride = 64, .step_func=SG_VERTEXSTEP_PER_INSTANCE } 
-            },
-
             .attrs = {
                 /* Static geometry */
                 [POSITION_I] =      { .buffer_index=POSITION_I, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-                [NORMAL_I] =        { .buffer_index=NORMAL_I,   .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Color buffer (per instance) */
-                [COLOR_I] =         { .buffer_index=COLOR_I,    .offset=0, .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Material buffer (per instance) */
-                [MATERIAL_I] =      { .buffer_index=MATERIAL_I, .offset=0, .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Matrix (per instance) */
-                [TRANSFORM_I] =     { .buffer_index=TRANSFORM_I, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT4 },
-                [TRANSFORM_I + 1] = { .buffer_index=TRANSFORM_I, .offset=16, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [TRANSFORM_I + 2] = { .buffer_index=TRANSFORM_I, .offset=32, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [TRANSFORM_I + 3] = { .buffer_index=TRANSFORM_I, .offset=48, .format=SG_VERTEXFORMAT_FLOAT4 }
+                [NORMAL_I] =        { .buffer_index=NORMAL_I,   .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 }
             }
         },
 
+        /* Instances that are not in the depth prepass write their own depth */
         .depth = {
             .pixel_format = SG_PIXELFORMAT_DEPTH,
-            .compare = SG_COMPAREFUNC_LESS_EQUAL,
-            .write_enabled = false
+            .compare = write_depth ? 
+                SG_COMPAREFUNC_LESS : SG_COMPAREFUNC_LESS_EQUAL,
+            .write_enabled = write_depth
         },
 
         .colors = {{
@@ -31376,7 +33007,13 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
 
         .cull_mode = SG_CULLMODE_BACK,
         .sample_count = sample_count
-    });
+    };
+
+    /* Color, material & matrix (per instance) */
+    sokol_instance_pipeline_layout(&desc.layout, SOKOL_INSTANCE_ALL, 
+        INSTANCE_I, TRANSFORM_I, COLOR_I, MATERIAL_I);
+
+    return sg_make_pipeline(&desc);
 }
 
 sg_pipeline init_scene_atmos_sun_pipeline(int32_t sample_count) {
@@ -31402,12 +33039,14 @@ sg_pipeline init_scene_atmos_sun_pipeline(int32_t sample_count) {
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(scene_fs_sun_atmos_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "scene_sun_params",
                     .uniforms = {
                         [0] = { .name="u_sun_screen_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [1] = { .name="u_sun_color", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [2] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 },
-                        [3] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
-                        [4] = { .name="u_sun_intensity", .type=SG_UNIFORMTYPE_FLOAT }
+                        [1] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_sun_color", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [3] = { .name="u_sun_intensity", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 }
                     }
                 }
             },
@@ -31478,8 +33117,9 @@ sokol_offscreen_pass_t sokol_init_scene_pass(
     pass.pass_action = sokol_clear_action(background_color, false, false);
 
     ecs_trace("sokol: initialize scene pipeline");
-    pass.pip = init_scene_pipeline(sample_count);
+    pass.pip = init_scene_pipeline(sample_count, false);
     pass.pip_2 = init_scene_atmos_sun_pipeline(sample_count);
+    pass.pip_3 = init_scene_pipeline(sample_count, true);
     pass.sample_count = sample_count;
 
     ecs_trace("sokol: initialized scene pass");
@@ -31513,48 +33153,53 @@ void scene_draw_atmos(
         .fs_images[0] = state->atmos
     };
 
-    sg_apply_bindings(&bind);
+    sokol_apply_bindings(&bind);
     sg_draw(0, 6, 1);
 }
 
 static
 void scene_draw_instances(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers,
-    sg_image shadow_map)
+    const sokol_draw_batch_t *batch,
+    const sokol_render_state_t *state,
+    bool no_prepass)
 {
-    if (!buffers->instance_count) {
-        return;
-    }
-
     sg_bindings bind = {
         .vertex_buffers = {
-            [POSITION_I] =  geometry->vertices,
-            [NORMAL_I] =    geometry->normals,
-            [COLOR_I] =     buffers->colors,
-            [MATERIAL_I] =  buffers->materials,
-            [TRANSFORM_I] = buffers->transforms
+            [POSITION_I] =  batch->mesh.vertices,
+            [NORMAL_I] =    batch->mesh.normals
         },
-        .index_buffer = geometry->indices,
-        .fs_images[0] = shadow_map
+        .index_buffer = batch->mesh.indices,
+        .fs_images[0] = state->shadow_map
     };
+#if SOKOL_CLUSTERED_LIGHTS
+    bind.fs_images[1] = state->light_data;
+    bind.fs_images[2] = state->light_clusters;
+    bind.fs_images[3] = state->light_indices;
+#endif
 
-    sg_apply_bindings(&bind);
-    sg_draw(0, geometry->index_count, buffers->instance_count);
+    if (no_prepass) {
+        sokol_draw_excluded_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, SOKOL_INSTANCE_ALL, 
+            INSTANCE_I);
+    } else {
+        sokol_draw_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, SOKOL_INSTANCE_ALL, 
+            INSTANCE_I);
+    }
 }
 
 void sokol_run_scene_pass(
     sokol_offscreen_pass_t *pass,
     sokol_render_state_t *state)
 {
-    scene_vs_uniforms_t vs_u;
+    scene_vs_uniforms_t vs_u = {0};
     glm_mat4_copy(state->uniforms.mat_v, vs_u.mat_v);
     glm_mat4_copy(state->uniforms.mat_vp, vs_u.mat_vp);
     glm_mat4_copy(state->uniforms.light_mat_vp, vs_u.light_mat_vp);
     vs_u.near_ = state->uniforms.near_;
     vs_u.far_ = state->uniforms.far_;
 
-    scene_fs_uniforms_t fs_u;
+    scene_fs_uniforms_t fs_u = {0};
     glm_vec3_copy(state->uniforms.light_ambient, fs_u.light_ambient);
     glm_vec3_copy(state->uniforms.light_ambient_ground, fs_u.light_ambient_ground);
     fs_u.light_ambient_ground_falloff = state->uniforms.light_ambient_ground_falloff;
@@ -31569,7 +33214,7 @@ void sokol_run_scene_pass(
     fs_u.shadow_far = state->uniforms.shadow_far;
     fs_u.eye_pos[0] *= -1;
 
-    scene_fs_sun_atmos_uniforms_t fs_sun_atmos_u;
+    scene_fs_sun_atmos_uniforms_t fs_sun_atmos_u = {0};
     glm_vec3_copy(state->uniforms.sun_screen_pos, fs_sun_atmos_u.sun_screen_pos);
     glm_vec3_copy(state->uniforms.sun_color, fs_sun_atmos_u.sun_color);
     fs_sun_atmos_u.target_size[0] = state->width;
@@ -31577,42 +33222,69 @@ void sokol_run_scene_pass(
     fs_sun_atmos_u.aspect = state->uniforms.aspect;
     fs_sun_atmos_u.sun_intensity = 1.0 + state->uniforms.sun_intensity * 6;
 
-    scene_fs_lights_t lights_u;
+#if SOKOL_CLUSTERED_LIGHTS
+    fs_u.cluster_depth_scale = state->cluster_depth_scale;
+    fs_u.cluster_depth_bias = state->cluster_depth_bias;
+    fs_u.cluster_tile_scale[0] = (float)SOKOL_CLUSTER_X / (float)state->width;
+    fs_u.cluster_tile_scale[1] = (float)SOKOL_CLUSTER_Y / (float)state->height;
+#else
+    scene_fs_lights_t lights_u = {0};
     sokol_light_t *lights = ecs_vec_first(&state->lights);
     for (int i = 0; i < ecs_vec_count(&state->lights); i ++) {
         glm_vec3_copy(lights[i].color, lights_u.light_colors[i]);
         glm_vec3_copy(lights[i].position, lights_u.light_positions[i]);
-        lights_u.light_distance[i] = lights[i].distance;
+        lights_u.light_positions[i][3] = lights[i].distance;
     }
+#endif
     fs_u.light_count = ecs_vec_count(&state->lights);
 
     /* Render to offscreen texture so screen-space effects can be applied */
     sg_begin_pass(pass->pass, &pass->pass_action);
 
     /* Step 2: render scene */
-    sg_apply_pipeline(pass->pip);
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(scene_vs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(scene_fs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&lights_u, sizeof(scene_fs_lights_t)});
-
-    /* Loop geometry, render scene */
-    ecs_iter_t qit = ecs_query_iter(state->world, state->q_scene);
-    while (ecs_query_next(&qit)) {
-        SokolGeometry *geometry = ecs_field(&qit, SokolGeometry, 0);
+    sokol_apply_pipeline(pass->pip);
+    sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(scene_vs_uniforms_t)});
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(scene_fs_uniforms_t)});
+#if !SOKOL_CLUSTERED_LIGHTS
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&lights_u, sizeof(scene_fs_lights_t)});
+#endif
 
-        int b;
-        for (b = 0; b < qit.count; b ++) {
-            scene_draw_instances(&geometry[b], &geometry[b].solid, state->shadow_map);
-            scene_draw_instances(&geometry[b], &geometry[b].emissive, state->shadow_map);
+    /* Loop draw list, render scene */
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    bool no_prepass = false;
+    for (b = 0; b < count; b ++) {
+        if (batches[b].passes & (1u << SOKOL_PASS_SCENE)) {
+            scene_draw_instances(&batches[b], state, false);
+            no_prepass |= (batches[b].exclude & (1u << SOKOL_PASS_DEPTH)) != 0;
+        }
+    }
+
+    /* Render instances that are not in the depth prepass, which have to write
+     * depth so they occlude each other and aren't covered by the background */
+    if (no_prepass) {
+        sokol_apply_pipeline(pass->pip_3);
+        sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(scene_vs_uniforms_t)});
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(scene_fs_uniforms_t)});
+#if !SOKOL_CLUSTERED_LIGHTS
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&lights_u, sizeof(scene_fs_lights_t)});
+#endif
+        for (b = 0; b < count; b ++) {
+            if ((batches[b].passes & (1u << SOKOL_PASS_SCENE)) &&
+                (batches[b].exclude & (1u << SOKOL_PASS_DEPTH))) 
+            {
+                scene_draw_instances(&batches[b], state, true);
+            }
         }
     }
 
     /* Step 1: render atmosphere background */
-    sg_apply_pipeline(pass->pip_2);
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_sun_atmos_u, sizeof(scene_fs_sun_atmos_uniforms_t)});
+    sokol_apply_pipeline(pass->pip_2);
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_sun_atmos_u, sizeof(scene_fs_sun_atmos_uniforms_t)});
     scene_draw_atmos(state);
 
-    sg_end_pass();
+    sokol_end_pass();
 }
 
 #undef POSITION_I
@@ -31620,6 +33292,8 @@ void sokol_run_scene_pass(
 #undef COLOR_I
 #undef MATERIAL_I
 #undef TRANSFORM_I
+#undef SCALE_I
+#undef INSTANCE_I
 #undef LAYOUT
 
 
@@ -31674,7 +33348,7 @@ void sokol_run_screen_pass(
     sg_image img)
 {
     sg_begin_default_pass(&pass->pass_action, state->width, state->height);
-    sg_apply_pipeline(pass->pip);
+    sokol_apply_pipeline(pass->pip);
 
     sg_bindings bind = {
         .vertex_buffers = { 
@@ -31683,10 +33357,10 @@ void sokol_run_screen_pass(
         .fs_images[0] = img
     };
 
-    sg_apply_bindings(&bind);
+    sokol_apply_bindings(&bind);
 
     sg_draw(0, 6, 1);
-    sg_end_pass();
+    sokol_end_pass();
 }
 
 #include <stdio.h>
@@ -31844,14 +33518,17 @@ typedef struct shadow_vs_uniforms_t {
     mat4 mat_vp;
 } shadow_vs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(shadow_vs_uniforms_t, mat_vp, 0);
+SOKOL_UNIFORM_SIZE(shadow_vs_uniforms_t, 64);
+
 static const char *shd_v = 
     SOKOL_SHADER_HEADER
     "uniform mat4 u_mat_vp;\n"
     "layout(location=0) in vec3 v_position;\n"
-    "layout(location=1) in mat4 i_mat_m;\n"
+    SOKOL_SHADER_INSTANCE_TRANSFORM(1, 5)
     "out vec2 proj_zw;\n"
     "void main() {\n"
-    "  gl_Position = u_mat_vp * i_mat_m * vec4(v_position, 1.0);\n"
+    "  gl_Position = u_mat_vp * instance_transform() * vec4(v_position, 1.0);\n"
     "  proj_zw = gl_Position.zw;\n"
     "}\n";
 
@@ -31910,23 +33587,13 @@ sokol_offscreen_pass_t sokol_init_shadow_pass(
 
     /* Create pipeline that mimics the normal pipeline, but without the material
      * normals and color, and with front culling instead of back culling */
-    result.pip = sg_make_pipeline(&(sg_pipeline_desc){
+    sg_pipeline_desc desc = {
         .shader = shd,
         .index_type = SG_INDEXTYPE_UINT16,
         .layout = {
-            .buffers = {
-                [1] = { .stride = 64, .step_func=SG_VERTEXSTEP_PER_INSTANCE }
-            },
-
             .attrs = {
                 /* Static geometry */
-                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Matrix (per instance) */
-                [1] = { .buffer_index=1, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT4 },
-                [2] = { .buffer_index=1, .offset=16, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [3] = { .buffer_index=1, .offset=32, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [4] = { .buffer_index=1, .offset=48, .format=SG_VERTEXFORMAT_FLOAT4 }
+                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 }
             }
         },
         .depth = {
@@ -31938,30 +33605,30 @@ sokol_offscreen_pass_t sokol_init_shadow_pass(
             .pixel_format = SG_PIXELFORMAT_RGBA8
         }},
         .cull_mode = SG_CULLMODE_FRONT
-    });
+    };
+
+    /* Matrix (per instance) */
+    sokol_instance_pipeline_layout(&desc.layout, SOKOL_INSTANCE_TRANSFORM, 
+        1, 1, -1, -1);
+
+    result.pip = sg_make_pipeline(&desc);
 
     return result;
 }
 
 static
 void shadow_draw_instances(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers)
+    const sokol_draw_batch_t *batch)
 {
-    if (!buffers->instance_count) {
-        return;
-    }
-
     sg_bindings bind = {
         .vertex_buffers = {
-            [0] = geometry->vertices,
-            [1] = buffers->transforms
+            [0] = batch->mesh.vertices
         },
-        .index_buffer = geometry->indices
+        .index_buffer = batch->mesh.indices
     };
 
-    sg_apply_bindings(&bind);
-    sg_draw(0, geometry->index_count, buffers->instance_count);
+    sokol_draw_instances(batch->geometry, batch->buffers, SOKOL_VIEW_SHADOW, 
+        SOKOL_PASS_SHADOW, &bind, SOKOL_INSTANCE_TRANSFORM, 1);
 }
 
 void sokol_run_shadow_pass(
@@ -31970,26 +33637,158 @@ void sokol_run_shadow_pass(
 {
     /* Render to offscreen texture so screen-space effects can be applied */
     sg_begin_pass(pass->pass, &pass->pass_action);
-    sg_apply_pipeline(pass->pip);
+    sokol_apply_pipeline(pass->pip);
 
     shadow_vs_uniforms_t vs_u;
     glm_mat4_copy(state->uniforms.light_mat_vp, vs_u.mat_vp);
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){ 
+    sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){ 
         &vs_u, sizeof(shadow_vs_uniforms_t) 
     });
 
-    /* Loop buffers, render scene */
-    ecs_iter_t qit = ecs_query_iter(state->world, state->q_scene);
-    while (ecs_query_next(&qit)) {
-        SokolGeometry *geometry = ecs_field(&qit, SokolGeometry, 0);
-        
-        int b;
-        for (b = 0; b < qit.count; b ++) {
-            shadow_draw_instances(&geometry[b], &geometry[b].solid);
+    /* Loop draw list, render scene */
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    for (b = 0; b < count; b ++) {
+        if (batches[b].passes & (1u << SOKOL_PASS_SHADOW)) {
+            shadow_draw_instances(&batches[b]);
         }
     }
 
+    sokol_end_pass();
+}
+
+
+/* Last uniforms applied to a pipeline, per shader stage and uniform block */
+typedef struct sokol_submit_uniforms_t {
+    ecs_vec_t blocks[SG_NUM_SHADER_STAGES][SG_MAX_SHADERSTAGE_UBS];
+} sokol_submit_uniforms_t;
+
+static struct {
+    sg_pipeline pipeline;       /* Pipeline applied in current pass */
+    sg_bindings bindings;       /* Bindings applied to current pipeline */
+    bool bindings_valid;
+    ecs_map_t uniforms;         /* map<pipeline id, sokol_submit_uniforms_t*> */
+    bool uniforms_init;
+#if SOKOL_UNIFORM_BUFFERS
+    /* Pipeline that last applied uniforms to a uniform buffer binding point */
+    uint32_t bound[SG_NUM_SHADER_STAGES][SG_MAX_SHADERSTAGE_UBS];
+#endif
+    sokol_submit_stats_t frame; /* Counters of current frame */
+    sokol_submit_stats_t last;  /* Counters of last frame */
+} sokol_submit;
+
+void sokol_apply_pipeline(
+    sg_pipeline pip)
+{
+    if (pip.id == sokol_submit.pipeline.id) {
+        sokol_submit.frame.pipelines_elided ++;
+        return;
+    }
+
+    sg_apply_pipeline(pip);
+    sokol_submit.pipeline = pip;
+    sokol_submit.bindings_valid = false;
+    sokol_submit.frame.pipelines ++;
+}
+
+void sokol_apply_bindings(
+    const sg_bindings *bind)
+{
+    if (sokol_submit.bindings_valid &&
+        !ecs_os_memcmp(bind, &sokol_submit.bindings, ECS_SIZEOF(sg_bindings)))
+    {
+        sokol_submit.frame.bindings_elided ++;
+        return;
+    }
+
+    sg_apply_bindings(bind);
+    sokol_submit.bindings = *bind;
+    sokol_submit.bindings_valid = true;
+    sokol_submit.frame.bindings ++;
+}
+
+void sokol_apply_uniforms(
+    sg_shader_stage stage,
+    int ub_index,
+    const sg_range *data)
+{
+    ecs_assert(sokol_submit.pipeline.id != SG_INVALID_ID,
+        ECS_INVALID_OPERATION, "uniforms applied without pipeline");
+
+    if (!sokol_submit.uniforms_init) {
+        ecs_map_init(&sokol_submit.uniforms, NULL);
+        sokol_submit.uniforms_init = true;
+    }
+
+    sokol_submit_uniforms_t *u = ecs_map_ensure_alloc_t(&sokol_submit.uniforms,
+        sokol_submit_uniforms_t, sokol_submit.pipeline.id);
+    ecs_vec_t *block = &u->blocks[stage][ub_index];
+    ecs_size_t size = (ecs_size_t)data->size;
+
+    bool same = ecs_vec_count(block) == size &&
+        !ecs_os_memcmp(ecs_vec_first(block), data->ptr, size);
+
+#if SOKOL_UNIFORM_BUFFERS
+    /* Binding points are shared by all programs, so uniforms can only be
+     * skipped if no other pipeline has applied uniforms since. */
+    uint32_t *bound = &sokol_submit.bound[stage][ub_index];
+    same &= *bound == sokol_submit.pipeline.id;
+    *bound = sokol_submit.pipeline.id;
+#endif
+
+    if (same) {
+        sokol_submit.frame.uniforms_elided ++;
+        return;
+    }
+
+    sg_apply_uniforms(stage, ub_index, data);
+    ecs_vec_set_count_t(NULL, block, uint8_t, size);
+    ecs_os_memcpy(ecs_vec_first(block), data->ptr, size);
+    sokol_submit.frame.uniforms ++;
+}
+
+void sokol_end_pass(void) {
     sg_end_pass();
+    sokol_submit.pipeline.id = SG_INVALID_ID;
+    sokol_submit.bindings_valid = false;
+}
+
+void sokol_submit_frame(void) {
+    sokol_submit.last = sokol_submit.frame;
+    ecs_os_zeromem(&sokol_submit.frame);
+#if SOKOL_UNIFORM_BUFFERS
+    /* The uniform buffer is a ring, so ranges of a previous frame may have
+     * been overwritten. */
+    ecs_os_zeromem(&sokol_submit.bound);
+#endif
+}
+
+void sokol_submit_fini(void) {
+    if (!sokol_submit.uniforms_init) {
+        return;
+    }
+
+    ecs_map_iter_t mit = ecs_map_iter(&sokol_submit.uniforms);
+    while (ecs_map_next(&mit)) {
+        sokol_submit_uniforms_t *u = ecs_map_ptr(&mit);
+        int32_t s, b;
+        for (s = 0; s < SG_NUM_SHADER_STAGES; s ++) {
+            for (b = 0; b < SG_MAX_SHADERSTAGE_UBS; b ++) {
+                ecs_vec_fini_t(NULL, &u->blocks[s][b], uint8_t);
+            }
+        }
+        ecs_os_free(u);
+    }
+
+    ecs_map_fini(&sokol_submit.uniforms);
+    sokol_submit.uniforms_init = false;
+}
+
+void sokol_submit_get_stats(
+    sokol_submit_stats_t *stats)
+{
+    *stats = sokol_submit.last;
 }
 
 
@@ -32262,411 +34061,6267 @@ SokolFx sokol_init_ssao(
     return fx;
 }
 
+#ifndef SOKOL_MODULES_GEOMETRY_KERNELS_H
+#define SOKOL_MODULES_GEOMETRY_KERNELS_H
+
+
+/* Copy transform matrices to dst while scaling their x, y and z axes. This
+ * does the same as a memcpy followed by a glm_scale for each matrix, in a
+ * single pass over memory. Matrix i is stored at dst + i * dst_stride (in 
+ * bytes), which allows for writing to interleaved instance data.
+ *
+ * The scale vector for matrix i is read from scale + i * scale_stride (in
+ * bytes). A scale_stride of 0 applies the same scale to all matrices. The
+ * dim parameter specifies whether scale vectors have 2 (x, y) or 3 (x, y, z)
+ * elements. For 2 elements, the z axis is not scaled.
+ *
+ * dst and src may point to the same matrices. Kernels use SIMD instructions
+ * when supported by the CPU, which is detected by sokol_init_kernels. */
+void sokol_copy_scale_transforms(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Same as sokol_copy_scale_transforms, but stores the first three rows of
+ * each matrix in dst, which is the compact 3x4 affine instance layout. */
+void sokol_copy_scale_transforms_3x4(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Copy & scale transforms to instance buffer, using the instance layout that
+ * is selected by SOKOL_COMPACT_TRANSFORMS. */
+void sokol_copy_scale_instances(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Scale transform matrices in place */
+void sokol_scale_transforms(
+    mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+#if SOKOL_PACKED_INSTANCE_DATA
+/* Convert float colors and materials to the packed instance format. Each
+ * input is read from its pointer + i * stride (in bytes), where a stride of 0
+ * uses the same value for all instances. The specular pointer points to the
+ * specular power, which must be followed by the shininess. */
+void sokol_pack_instance_colors(
+    void *dst,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride);
+#endif
+
+/* Compute a bounding sphere (center, radius) for each transform. Scale is 
+ * passed in the same way as for sokol_copy_scale_transforms, and is applied to
+ * a unit sized geometry centered on the origin. For 2 dimensional geometry
+ * the z axis has no extent. */
+void sokol_compute_bounds(
+    vec4 *dst,
+    const mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Compute a bounding sphere that encloses all spheres with a radius larger than
+ * zero. If there are no such spheres, the radius of dst is set to zero. */
+void sokol_merge_bounds(
+    vec4 dst,
+    const vec4 *spheres,
+    int32_t count);
+
+/* Test bounding spheres against 6 frustum planes, and write the indices of
+ * spheres that intersect with the frustum to visible. Planes must be 
+ * normalized and point inwards. Spheres with a radius of zero or less are 
+ * never visible. Returns the number of visible spheres. */
+int32_t sokol_cull_spheres(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes);
+
+/* Select kernels for CPU. Must be called before kernels are used. */
+void sokol_init_kernels(void);
+
+#endif
+
+#include <float.h>
+
+ECS_COMPONENT_DECLARE(SokolGeometry);
+ECS_COMPONENT_DECLARE(SokolGeometryQuery);
+ECS_COMPONENT_DECLARE(SokolImpostorMesh);
+#if SOKOL_INSTANCE_RING
+ECS_COMPONENT_DECLARE(SokolInstanceRing);
+#endif
+#if SOKOL_OCCLUSION_CULLING
+ECS_COMPONENT_DECLARE(SokolOcclusion);
+#endif
+
+ECS_DECLARE(SokolRectangleGeometry);
+ECS_DECLARE(SokolBoxGeometry);
+ECS_DECLARE(SokolSphereGeometry);
+ECS_DECLARE(SokolCylinderGeometry);
+ECS_DECLARE(SokolConeGeometry);
+ECS_COMPONENT_DECLARE(SokolSphere);
+ECS_COMPONENT_DECLARE(SokolCylinder);
+ECS_COMPONENT_DECLARE(SokolCone);
+ECS_TAG_DECLARE(SokolStatic);
+ECS_TAG_DECLARE(SokolCluster);
+ECS_TAG_DECLARE(SokolNoShadow);
+ECS_TAG_DECLARE(SokolNoDepthPrepass);
+
+#if SOKOL_INTERLEAVED_INSTANCES
+// All instance data in a single stream
+const sokol_instance_layout_t sokol_instance_layout = {
+    .stream_count = 1,
+    .stream_size = { ECS_SIZEOF(sokol_instance_t) },
+    .transform = { 0, offsetof(sokol_instance_t, transform) },
+    .color = { 0, offsetof(sokol_instance_t, color) },
+#if SOKOL_PACKED_INSTANCE_DATA
+    .material = { 0, offsetof(sokol_instance_t, color) + 4 }
+#else
+    .material = { 0, offsetof(sokol_instance_t, material) }
+#endif
+};
+#elif SOKOL_PACKED_INSTANCE_DATA
+// Transforms, and packed colors & materials in separate streams
+const sokol_instance_layout_t sokol_instance_layout = {
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    .stream_count = 3,
+    .scale = { 2, 0 },
+#else
+    .stream_count = 2,
+#endif
+    .stream_size = { 
+        ECS_SIZEOF(sokol_transform_t), 
+        ECS_SIZEOF(sokol_instance_color_t),
+        ECS_SIZEOF(vec3)
+    },
+    .transform = { 0, 0 },
+    .color = { 1, 0 },
+    .material = { 1, 4 }
+};
+#else
+// Transforms, colors and materials in separate streams
+const sokol_instance_layout_t sokol_instance_layout = {
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    .stream_count = 4,
+    .scale = { 3, 0 },
+#else
+    .stream_count = 3,
+#endif
+    .stream_size = { 
+        ECS_SIZEOF(sokol_transform_t), 
+        ECS_SIZEOF(sokol_instance_color_t), 
+        ECS_SIZEOF(SokolMaterial),
+        ECS_SIZEOF(vec3)
+    },
+    .transform = { 0, 0 },
+    .color = { 1, 0 },
+    .material = { 2, 0 }
+};
+#endif
+
+// Whether stream is stored in CPU buffers. With zero-copy transforms, the 
+// transforms of dynamic entities are uploaded directly from table columns,
+// unless they are appended to the instance ring. With culling, the transforms
+// of visible instances are uploaded from the table columns to the views.
+static
+bool sokol_instance_stream_staged(
+    const sokol_geometry_buffers_t *buffers,
+    int32_t stream)
+{
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    return (buffers->usage != SG_USAGE_DYNAMIC) || 
+        (stream != sokol_instance_layout.transform.stream);
+#else
+    (void)buffers;
+    (void)stream;
+    return true;
+#endif
+}
+
+#if SOKOL_CULL_INSTANCES
+// Whether instances are stored, culled & drawn per cluster
+static
+bool sokol_instance_clustered(
+    const sokol_geometry_buffers_t *buffers)
+{
+#if SOKOL_CLUSTER_INSTANCES
+    return buffers->usage == SG_USAGE_IMMUTABLE;
+#else
+    (void)buffers;
+    return false;
+#endif
+}
+#endif
+
+// Get pointer to instance attribute in CPU buffers
+static
+void* sokol_instance_ptr(
+    sokol_geometry_buffers_t *buffers,
+    const sokol_instance_attr_t *attr,
+    int32_t offset)
+{
+    ecs_size_t size = sokol_instance_layout.stream_size[attr->stream];
+    return ECS_OFFSET(ecs_vec_get(
+        &buffers->streams[attr->stream].data, size, offset), attr->offset);
+}
+
+// Find vertex buffer for each stream that contains one of the attributes
+static
+void sokol_instance_stream_buffers(
+    ecs_flags32_t attrs,
+    int32_t first_buffer,
+    int32_t *stream_buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t i, buffer = first_buffer;
+    for (i = 0; i < l->stream_count; i ++) {
+        ecs_flags32_t stream_attrs = 0;
+        if (l->transform.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_TRANSFORM;
+        }
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        if (l->scale.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_TRANSFORM;
+        }
+#endif
+        if (l->color.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_COLOR;
+        }
+        if (l->material.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_MATERIAL;
+        }
+
+        if (stream_attrs & attrs) {
+            stream_buffers[i] = buffer ++;
+        } else {
+            stream_buffers[i] = -1;
+        }
+    }
+}
+
+void sokol_instance_pipeline_layout(
+    sg_layout_desc *layout,
+    ecs_flags32_t attrs,
+    int32_t first_buffer,
+    int32_t transform_attr,
+    int32_t color_attr,
+    int32_t material_attr)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t i, stream_buffers[SOKOL_MAX_INSTANCE_STREAMS];
+    sokol_instance_stream_buffers(attrs, first_buffer, stream_buffers);
+
+    for (i = 0; i < l->stream_count; i ++) {
+        int32_t buffer = stream_buffers[i];
+        if (buffer != -1) {
+            layout->buffers[buffer] = (sg_buffer_layout_desc){
+                .stride = l->stream_size[i],
+                .step_func = SG_VERTEXSTEP_PER_INSTANCE
+            };
+        }
+    }
+
+    // Transform is passed as a matrix of vec4 attributes
+    if (attrs & SOKOL_INSTANCE_TRANSFORM) {
+        int32_t count = ECS_SIZEOF(sokol_transform_t) / ECS_SIZEOF(vec4);
+        for (i = 0; i < count; i ++) {
+            layout->attrs[transform_attr + i] = (sg_vertex_attr_desc){
+                .buffer_index = stream_buffers[l->transform.stream],
+                .offset = l->transform.offset + i * ECS_SIZEOF(vec4),
+                .format = SG_VERTEXFORMAT_FLOAT4
+            };
+        }
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        layout->attrs[transform_attr + count] = (sg_vertex_attr_desc){
+            .buffer_index = stream_buffers[l->scale.stream],
+            .offset = l->scale.offset,
+            .format = SG_VERTEXFORMAT_FLOAT3
+        };
+#endif
+    }
+
+#if SOKOL_PACKED_INSTANCE_DATA
+    sg_vertex_format color_format = SG_VERTEXFORMAT_UBYTE4N;
+#else
+    sg_vertex_format color_format = SG_VERTEXFORMAT_FLOAT3;
+#endif
+
+    if (attrs & SOKOL_INSTANCE_COLOR) {
+        layout->attrs[color_attr] = (sg_vertex_attr_desc){
+            .buffer_index = stream_buffers[l->color.stream],
+            .offset = l->color.offset,
+            .format = color_format
+        };
+    }
+
+    if (attrs & SOKOL_INSTANCE_MATERIAL) {
+        layout->attrs[material_attr] = (sg_vertex_attr_desc){
+            .buffer_index = stream_buffers[l->material.stream],
+            .offset = l->material.offset,
+            .format = color_format
+        };
+    }
+}
+
+void sokol_instance_bindings(
+    sg_bindings *bind,
+    const sokol_instance_stream_t *streams,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    int32_t i, stream_buffers[SOKOL_MAX_INSTANCE_STREAMS];
+    sokol_instance_stream_buffers(attrs, first_buffer, stream_buffers);
+
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        if (stream_buffers[i] != -1) {
+            bind->vertex_buffers[stream_buffers[i]] = streams[i].buffer;
+            bind->vertex_buffer_offsets[stream_buffers[i]] = streams[i].offset;
+        }
+    }
+}
+
+// Draw range of instance slots. Instances are selected with vertex buffer
+// offsets, as there is no base instance parameter.
+static
+void sokol_draw_range(
+    int32_t index_count,
+    const sokol_instance_stream_t *streams,
+    int32_t offset,
+    int32_t count,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    sokol_instance_stream_t range_streams[SOKOL_MAX_INSTANCE_STREAMS];
+    int32_t s;
+
+    if (!count) {
+        return;
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        range_streams[s] = streams[s];
+        range_streams[s].offset += offset * l->stream_size[s];
+    }
+
+    sokol_instance_bindings(bind, range_streams, attrs, first_buffer);
+    sokol_apply_bindings(bind);
+    sg_draw(0, index_count, count);
+}
+
+#if SOKOL_CULL_INSTANCES
+// Get mesh of a level of detail in a view, which can be the impostor level
+static
+const sokol_mesh_t* sokol_view_lod_mesh(
+    const SokolGeometry *geometry,
+    int32_t lod)
+{
+    if (lod == SOKOL_LOD_IMPOSTOR) {
+        return &geometry->impostor;
+    }
+    return &geometry->lods[lod];
+}
+
+// Replace the buffers of the bound level of detail in the bindings with the
+// buffers of another level. Returns the number of indices of the level.
+static
+int32_t sokol_bind_lod(
+    const SokolGeometry *geometry,
+    int32_t bound,
+    int32_t lod,
+    sg_bindings *bind)
+{
+    const sokol_mesh_t *from = sokol_view_lod_mesh(geometry, bound);
+    const sokol_mesh_t *to = sokol_view_lod_mesh(geometry, lod);
+    int32_t i;
+
+    if (bound != lod) {
+        for (i = 0; i < SG_MAX_SHADERSTAGE_BUFFERS; i ++) {
+            uint32_t id = bind->vertex_buffers[i].id;
+            if (id == SG_INVALID_ID) {
+                continue;
+            }
+            if (id == from->vertices.id) {
+                bind->vertex_buffers[i] = to->vertices;
+            } else if (id == from->normals.id) {
+                bind->vertex_buffers[i] = to->normals;
+            }
+        }
+        bind->index_buffer = to->indices;
+    }
+
+    return to->index_count;
+}
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+// Draw visible clusters from the instance buffers. Adjacent visible clusters 
+// with the same level of detail are drawn with a single call.
+static
+void sokol_draw_clusters(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    const sokol_instance_view_t *view,
+    int32_t pass,
+    bool excluded,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    const sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    ecs_flags32_t pass_flag = 1u << pass;
+    int32_t l, bound = 0;
+
+    for (l = 0; l < SOKOL_MAX_VIEW_LODS; l ++) {
+        const sokol_instance_lod_t *lod = &view->lods[l];
+        int32_t i = lod->offset, end = lod->offset + lod->count;
+        if (!lod->count) {
+            continue;
+        }
+
+        int32_t index_count = sokol_bind_lod(geometry, bound, l, bind);
+        bound = l;
+
+        while (i < end) {
+            const sokol_instance_cluster_t *cluster = &clusters[visible[i]];
+            int32_t offset = cluster->offset;
+            int32_t count = cluster->count;
+
+            if (((cluster->exclude & pass_flag) != 0) != excluded) {
+                i ++;
+                continue;
+            }
+
+            for (i ++; i < end; i ++) {
+                cluster = &clusters[visible[i]];
+                if ((cluster->offset != (offset + count)) || 
+                    (((cluster->exclude & pass_flag) != 0) != excluded)) 
+                {
+                    break;
+                }
+                count += cluster->count;
+            }
+
+            sokol_draw_range(index_count, buffers->streams, offset, count, 
+                bind, attrs, first_buffer);
+        }
+    }
+}
+#endif
+
+// Draw the instances that are drawn by pass, or the instances that are
+// excluded from pass.
+static
+void sokol_draw_pass_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    bool excluded,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    ecs_assert(pass >= 0 && pass < SOKOL_MAX_PASSES, 
+        ECS_INVALID_PARAMETER, NULL);
+
+#if SOKOL_CULL_INSTANCES
+    ecs_assert(view >= 0 && view < SOKOL_MAX_VIEWS, ECS_INVALID_PARAMETER, NULL);
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        sokol_draw_clusters(geometry, buffers, &buffers->views[view], pass,
+            excluded, bind, attrs, first_buffer);
+        return;
+    }
+#endif
+
+    // Instances that are excluded from the shadow pass are not visible in the
+    // shadow view, and instances that are excluded from the depth pass are
+    // stored at the end of each level of detail. Impostors are drawn last.
+    const sokol_instance_view_t *v = &buffers->views[view];
+    int32_t l, bound = 0;
+    for (l = 0; l < SOKOL_MAX_VIEW_LODS; l ++) {
+        const sokol_instance_lod_t *lod = &v->lods[l];
+        int32_t offset = lod->offset, count = lod->count;
+        if (pass == SOKOL_PASS_DEPTH) {
+            if (excluded) {
+                offset += lod->depth_count;
+                count -= lod->depth_count;
+            } else {
+                count = lod->depth_count;
+            }
+        } else if (excluded) {
+            count = 0;
+        }
+
+        if (!count) {
+            continue;
+        }
+
+        int32_t index_count = sokol_bind_lod(geometry, bound, l, bind);
+        bound = l;
+        sokol_draw_range(index_count, v->streams, offset, count, 
+            bind, attrs, first_buffer);
+    }
+#else
+    (void)view;
+
+    const ecs_vec_t *ex = &buffers->excluded[pass];
+    const sokol_instance_range_t *ranges = ecs_vec_first_t(
+        ex, sokol_instance_range_t);
+    int32_t i, count = ecs_vec_count(ex), offset = 0;
+
+    if (excluded) {
+        for (i = 0; i < count; i ++) {
+            sokol_draw_range(geometry->index_count, buffers->streams, 
+                ranges[i].offset, ranges[i].count, bind, attrs, first_buffer);
+        }
+        return;
+    }
+
+    // Draw the slots between the ranges that are excluded from the pass
+    for (i = 0; i < count; i ++) {
+        sokol_draw_range(geometry->index_count, buffers->streams, offset, 
+            ranges[i].offset - offset, bind, attrs, first_buffer);
+        offset = ranges[i].offset + ranges[i].count;
+    }
+
+    sokol_draw_range(geometry->index_count, buffers->streams, offset, 
+        buffers->instance_count - offset, bind, attrs, first_buffer);
+#endif
+}
+
+void sokol_draw_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    sokol_draw_pass_instances(geometry, buffers, view, pass, false, 
+        bind, attrs, first_buffer);
+}
+
+void sokol_draw_excluded_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    sokol_draw_pass_instances(geometry, buffers, view, pass, true, 
+        bind, attrs, first_buffer);
+}
+
+// Add instance buffers to draw list if they have instances to draw in passes
+static
+void sokol_draw_list_add(
+    ecs_vec_t *draw_list,
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t kind,
+    ecs_flags32_t passes)
+{
+#if SOKOL_CULL_INSTANCES
+    int32_t count = buffers->views[SOKOL_VIEW_CAMERA].count;
+    if (!count) {
+        passes &= ~((1u << SOKOL_PASS_SCENE) | (1u << SOKOL_PASS_DEPTH));
+    }
+    if (!buffers->views[SOKOL_VIEW_SHADOW].count) {
+        passes &= ~(1u << SOKOL_PASS_SHADOW);
+    }
+#else
+    int32_t count = buffers->instance_count;
+    if (!count) {
+        passes = 0;
+    }
+#endif
+
+    if (!passes) {
+        return;
+    }
+
+    // Passes that some of the instances are excluded from
+    ecs_flags32_t exclude = 0;
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        if (buffers->exclude_count[p]) {
+            exclude |= 1u << p;
+        }
+    }
+
+    sokol_draw_batch_t *batch = ecs_vec_append_t(
+        NULL, draw_list, sokol_draw_batch_t);
+    batch->geometry = geometry;
+    batch->buffers = buffers;
+    batch->mesh = (sokol_mesh_t){
+        .vertices = geometry->vertices,
+        .normals = geometry->normals,
+        .indices = geometry->indices,
+        .index_count = geometry->index_count
+    };
+    batch->instance_count = count;
+    batch->passes = passes;
+    batch->exclude = exclude;
+
+    // Batches that share geometry buffers are drawn after each other, and
+    // batches of the same geometry are drawn front to back. Positive floats
+    // have the same order as their bits.
+#if SOKOL_CULL_INSTANCES
+    float depth = buffers->views[SOKOL_VIEW_CAMERA].depth;
+#else
+    float depth = 0;
+#endif
+    uint32_t depth_bits;
+    ecs_os_memcpy(&depth_bits, &depth, ECS_SIZEOF(float));
+    batch->sort_key = ((uint64_t)geometry->vertices.id << 32) | 
+        ((uint64_t)(depth_bits >> 8) << 8) | (uint64_t)kind;
+}
+
+static
+int sokol_compare_draw_batch(
+    const void *ptr_1,
+    const void *ptr_2)
+{
+    const sokol_draw_batch_t *b1 = ptr_1, *b2 = ptr_2;
+    return (b1->sort_key > b2->sort_key) - (b1->sort_key < b2->sort_key);
+}
+
+void sokol_build_draw_list(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    ecs_vec_t *draw_list)
+{
+    const ecs_flags32_t all = (1u << SOKOL_PASS_SCENE) | 
+        (1u << SOKOL_PASS_DEPTH) | (1u << SOKOL_PASS_SHADOW);
+
+    ecs_vec_clear(draw_list);
+
+    ecs_iter_t qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_draw_list_add(draw_list, &g[i], &g[i].solid, 0, all);
+            sokol_draw_list_add(draw_list, &g[i], &g[i].statics, 1, all);
+        }
+    }
+
+    qsort(ecs_vec_first(draw_list), (size_t)ecs_vec_count(draw_list), 
+        sizeof(sokol_draw_batch_t), sokol_compare_draw_batch);
+}
+
+static
+void sokol_geometry_buffers_init(
+    ecs_allocator_t *a, 
+    sokol_geometry_buffers_t *result, 
+    sg_usage usage) 
+{
+    int32_t i;
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        ecs_vec_init(a, &result->streams[i].data, 
+            sokol_instance_layout.stream_size[i], 0);
+    }
+    ecs_vec_init_t(a, &result->free_ranges, sokol_instance_range_t, 0);
+    ecs_vec_init_t(a, &result->dirty_ranges, sokol_instance_range_t, 0);
+    ecs_map_init(&result->tables, a);
+    result->usage = usage;
+
+#if SOKOL_CULL_INSTANCES
+    ecs_vec_init_t(a, &result->bounds, vec4, 0);
+    int32_t v;
+    for (v = 0; v < SOKOL_MAX_VIEWS; v ++) {
+        sokol_instance_view_t *view = &result->views[v];
+        for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+            ecs_vec_init(a, &view->streams[i].data, 
+                sokol_instance_layout.stream_size[i], 0);
+        }
+        ecs_vec_init_t(a, &view->visible, int32_t, 0);
+        ecs_vec_init_t(a, &view->bins, int8_t, 0);
+        ecs_vec_init_t(a, &view->sorted, int32_t, 0);
+    }
+    ecs_vec_init_t(a, &result->exclude, uint8_t, 0);
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    ecs_vec_init_t(a, &result->table_slots, sokol_table_slots_t, 0);
+#endif
+#else
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        ecs_vec_init_t(a, &result->excluded[p], sokol_instance_range_t, 0);
+    }
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_init(&result->index, a);
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+    ecs_vec_init_t(a, &result->clusters, sokol_instance_cluster_t, 0);
+    ecs_vec_init_t(a, &result->cluster_bounds, vec4, 0);
+    ecs_map_init(&result->groups, a);
+#endif
+}
+
+static
+void sokol_geometry_buffers_fini(ecs_allocator_t *a, sokol_geometry_buffers_t* result) {
+    int32_t i;
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        sokol_instance_stream_t *stream = &result->streams[i];
+        // Stream buffers are owned by the instance ring
+        if (stream->buffer.id && (result->usage != SG_USAGE_STREAM)) {
+            sg_destroy_buffer(stream->buffer);
+        }
+        ecs_vec_fini(a, &stream->data, sokol_instance_layout.stream_size[i]);
+    }
+
+    ecs_vec_fini_t(a, &result->free_ranges, sokol_instance_range_t);
+    ecs_vec_fini_t(a, &result->dirty_ranges, sokol_instance_range_t);
+
+#if SOKOL_CULL_INSTANCES
+    ecs_vec_fini_t(a, &result->bounds, vec4);
+    int32_t v;
+    for (v = 0; v < SOKOL_MAX_VIEWS; v ++) {
+        sokol_instance_view_t *view = &result->views[v];
+        for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+            sokol_instance_stream_t *stream = &view->streams[i];
+            // View data is appended to the instance ring, which owns the buffer
+            if (stream->buffer.id && !SOKOL_INSTANCE_RING) {
+                sg_destroy_buffer(stream->buffer);
+            }
+            ecs_vec_fini(a, &stream->data, sokol_instance_layout.stream_size[i]);
+        }
+        ecs_vec_fini_t(a, &view->visible, int32_t);
+        ecs_vec_fini_t(a, &view->bins, int8_t);
+        ecs_vec_fini_t(a, &view->sorted, int32_t);
+    }
+    ecs_vec_fini_t(a, &result->exclude, uint8_t);
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    ecs_vec_fini_t(a, &result->table_slots, sokol_table_slots_t);
+#endif
+#else
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        ecs_vec_fini_t(a, &result->excluded[p], sokol_instance_range_t);
+    }
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_fini(&result->index);
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+    ecs_vec_fini_t(a, &result->clusters, sokol_instance_cluster_t);
+    ecs_vec_fini_t(a, &result->cluster_bounds, vec4);
+
+    ecs_map_iter_t git = ecs_map_iter(&result->groups);
+    while (ecs_map_next(&git)) {
+        ecs_os_free(ecs_map_ptr(&git));
+    }
+    ecs_map_fini(&result->groups);
+#endif
+
+    ecs_map_iter_t mit = ecs_map_iter(&result->tables);
+    while (ecs_map_next(&mit)) {
+        ecs_os_free(ecs_map_ptr(&mit));
+    }
+    ecs_map_fini(&result->tables);
+}
+
+static
+void sokol_free_geometry(SokolGeometry *ptr) {
+    sokol_geometry_buffers_fini(ptr->allocator, &ptr->solid);
+    sokol_geometry_buffers_fini(ptr->allocator, &ptr->statics);
+    if (ptr->allocator) {
+        flecs_allocator_fini(ptr->allocator);
+        ecs_os_free(ptr->allocator);
+        ptr->allocator = NULL;
+    }
+}
+
+ECS_CTOR(SokolGeometry, ptr, {
+    ecs_os_memset_t(ptr, 0, SokolGeometry);
+    ptr->allocator = ecs_os_malloc_t(ecs_allocator_t);
+    
+    flecs_allocator_init(ptr->allocator);
+    flecs_allocator_fini(ptr->allocator);
+    flecs_allocator_init(ptr->allocator);
+
+
+#if SOKOL_INSTANCE_RING
+    sokol_geometry_buffers_init(ptr->allocator, &ptr->solid, SG_USAGE_STREAM);
+#else
+    sokol_geometry_buffers_init(ptr->allocator, &ptr->solid, SG_USAGE_DYNAMIC);
+#endif
+    sokol_geometry_buffers_init(ptr->allocator, &ptr->statics, 
+        SG_USAGE_IMMUTABLE);
+})
+
+ECS_MOVE(SokolGeometry, dst, src, {
+    sokol_free_geometry(dst);
+    ecs_os_memcpy_t(dst, src, SokolGeometry);
+    ecs_os_memset_t(src, 0, SokolGeometry);
+})
+
+ECS_DTOR(SokolGeometry, ptr, {
+    sokol_free_geometry(ptr);
+})
+
+#if SOKOL_OCCLUSION_CULLING
+ECS_CTOR(SokolOcclusion, ptr, {
+    ecs_os_memset_t(ptr, 0, SokolOcclusion);
+})
+
+static
+void sokol_free_occlusion(SokolOcclusion *ptr) {
+    if (ptr->buffer.depth) {
+        sokol_occlusion_fini(&ptr->buffer);
+    }
+    ecs_vec_fini_t(NULL, &ptr->occluders, sokol_occluder_t);
+}
+
+ECS_MOVE(SokolOcclusion, dst, src, {
+    sokol_free_occlusion(dst);
+    ecs_os_memcpy_t(dst, src, SokolOcclusion);
+    ecs_os_memset_t(src, 0, SokolOcclusion);
+})
+
+ECS_DTOR(SokolOcclusion, ptr, {
+    sokol_free_occlusion(ptr);
+})
+#endif
+
+// To ensure rectangles are of the right size, use the Rectangle component to
+// apply a scaling factor to the transform matrix that is sent to the GPU.
+static
+void sokol_populate_rectangle(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    EcsRectangle *data, 
+    int32_t count,
+    bool self) 
+{
+    sokol_copy_scale_instances(dst, dst_stride, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsRectangle) : 0, 2);
+}
+
+// To ensure boxes are of the right size, use the Box component to apply
+// a scaling factor to the transform matrix that is sent to the GPU.
+static
+void sokol_populate_box(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    EcsBox *data, 
+    int32_t count,
+    bool self)
+{
+    sokol_copy_scale_instances(dst, dst_stride, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsBox) : 0, 3);
+}
+
+// Scale for rectangles that is applied by the shader. Rectangles are not
+// scaled on the z axis.
+static
+void sokol_scale_rectangle(
+    void *dst,
+    ecs_size_t dst_stride,
+    EcsRectangle *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const EcsRectangle *r = self ? &data[i] : data;
+        float *scale = ECS_ELEM(dst, dst_stride, i);
+        scale[0] = r->width;
+        scale[1] = r->height;
+        scale[2] = 1.0;
+    }
+}
+
+// Scale for boxes that is applied by the shader
+static
+void sokol_scale_box(
+    void *dst,
+    ecs_size_t dst_stride,
+    EcsBox *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const EcsBox *b = self ? &data[i] : data;
+        float *scale = ECS_ELEM(dst, dst_stride, i);
+        scale[0] = b->width;
+        scale[1] = b->height;
+        scale[2] = b->depth;
+    }
+}
+
+// Bounding spheres for rectangles
+static
+void sokol_bounds_rectangle(
+    vec4 *dst,
+    const mat4 *transforms,
+    EcsRectangle *data,
+    int32_t count,
+    bool self)
+{
+    sokol_compute_bounds(dst, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsRectangle) : 0, 2);
+}
+
+// Bounding spheres for boxes
+static
+void sokol_bounds_box(
+    vec4 *dst,
+    const mat4 *transforms,
+    EcsBox *data,
+    int32_t count,
+    bool self)
+{
+    sokol_compute_bounds(dst, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsBox) : 0, 3);
+}
+
+/* Number of scale vectors of primitives that are computed at a time */
+#define SOKOL_PRIMITIVE_BATCH (256)
+
+// Scale vectors for primitives with a radius, and a height if not NULL. The
+// unit primitive meshes have a diameter and height of 1.
+static
+void sokol_primitive_scales(
+    vec3 *dst,
+    const float *radius,
+    const float *height,
+    ecs_size_t stride,
+    int32_t count)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        float r = *(const float*)ECS_ELEM(radius, stride, i);
+        dst[i][0] = r * 2.0f;
+        dst[i][1] = height ? 
+            *(const float*)ECS_ELEM(height, stride, i) : r * 2.0f;
+        dst[i][2] = r * 2.0f;
+    }
+}
+
+// Copy & scale transforms of primitives. Scale vectors are computed in 
+// batches, so that the transform kernels can be used.
+static
+void sokol_populate_primitive(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    const float *radius,
+    const float *height,
+    ecs_size_t stride,
+    int32_t count)
+{
+    vec3 scale[SOKOL_PRIMITIVE_BATCH];
+    int32_t i;
+
+    if (!stride) {
+        sokol_primitive_scales(scale, radius, height, 0, 1);
+        sokol_copy_scale_instances(dst, dst_stride, transforms, count, 
+            scale[0], 0, 3);
+        return;
+    }
+
+    for (i = 0; i < count; i += SOKOL_PRIMITIVE_BATCH) {
+        int32_t n = glm_imin(count - i, SOKOL_PRIMITIVE_BATCH);
+        sokol_primitive_scales(scale, ECS_ELEM(radius, stride, i), 
+            height ? ECS_ELEM(height, stride, i) : NULL, stride, n);
+        sokol_copy_scale_instances(ECS_ELEM(dst, dst_stride, i), dst_stride, 
+            &transforms[i], n, scale[0], ECS_SIZEOF(vec3), 3);
+    }
+}
+
+// Bounding spheres of primitives, computed in batches like transforms
+static
+void sokol_bounds_primitive(
+    vec4 *dst,
+    const mat4 *transforms,
+    const float *radius,
+    const float *height,
+    ecs_size_t stride,
+    int32_t count)
+{
+    vec3 scale[SOKOL_PRIMITIVE_BATCH];
+    int32_t i;
+
+    if (!stride) {
+        sokol_primitive_scales(scale, radius, height, 0, 1);
+        sokol_compute_bounds(dst, transforms, count, scale[0], 0, 3);
+        return;
+    }
+
+    for (i = 0; i < count; i += SOKOL_PRIMITIVE_BATCH) {
+        int32_t n = glm_imin(count - i, SOKOL_PRIMITIVE_BATCH);
+        sokol_primitive_scales(scale, ECS_ELEM(radius, stride, i), 
+            height ? ECS_ELEM(height, stride, i) : NULL, stride, n);
+        sokol_compute_bounds(&dst[i], &transforms[i], n, scale[0], 
+            ECS_SIZEOF(vec3), 3);
+    }
+}
+
+static
+void sokol_populate_sphere(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    SokolSphere *data,
+    int32_t count,
+    bool self)
+{
+    sokol_populate_primitive(dst, dst_stride, transforms, &data->radius, NULL,
+        self ? ECS_SIZEOF(SokolSphere) : 0, count);
+}
+
+static
+void sokol_populate_cylinder(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    SokolCylinder *data,
+    int32_t count,
+    bool self)
+{
+    sokol_populate_primitive(dst, dst_stride, transforms, &data->radius, 
+        &data->height, self ? ECS_SIZEOF(SokolCylinder) : 0, count);
+}
+
+static
+void sokol_populate_cone(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    SokolCone *data,
+    int32_t count,
+    bool self)
+{
+    sokol_populate_primitive(dst, dst_stride, transforms, &data->radius, 
+        &data->height, self ? ECS_SIZEOF(SokolCone) : 0, count);
+}
+
+static
+void sokol_scale_sphere(
+    void *dst,
+    ecs_size_t dst_stride,
+    SokolSphere *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const SokolSphere *p = self ? &data[i] : data;
+        sokol_primitive_scales(ECS_ELEM(dst, dst_stride, i), &p->radius, 
+            NULL, 0, 1);
+    }
+}
+
+static
+void sokol_scale_cylinder(
+    void *dst,
+    ecs_size_t dst_stride,
+    SokolCylinder *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const SokolCylinder *p = self ? &data[i] : data;
+        sokol_primitive_scales(ECS_ELEM(dst, dst_stride, i), &p->radius, 
+            &p->height, 0, 1);
+    }
+}
+
+static
+void sokol_scale_cone(
+    void *dst,
+    ecs_size_t dst_stride,
+    SokolCone *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const SokolCone *p = self ? &data[i] : data;
+        sokol_primitive_scales(ECS_ELEM(dst, dst_stride, i), &p->radius, 
+            &p->height, 0, 1);
+    }
+}
+
+static
+void sokol_bounds_sphere(
+    vec4 *dst,
+    const mat4 *transforms,
+    SokolSphere *data,
+    int32_t count,
+    bool self)
+{
+    sokol_bounds_primitive(dst, transforms, &data->radius, NULL, 
+        self ? ECS_SIZEOF(SokolSphere) : 0, count);
+}
+
+static
+void sokol_bounds_cylinder(
+    vec4 *dst,
+    const mat4 *transforms,
+    SokolCylinder *data,
+    int32_t count,
+    bool self)
+{
+    sokol_bounds_primitive(dst, transforms, &data->radius, &data->height, 
+        self ? ECS_SIZEOF(SokolCylinder) : 0, count);
+}
+
+static
+void sokol_bounds_cone(
+    vec4 *dst,
+    const mat4 *transforms,
+    SokolCone *data,
+    int32_t count,
+    bool self)
+{
+    sokol_bounds_primitive(dst, transforms, &data->radius, &data->height, 
+        self ? ECS_SIZEOF(SokolCone) : 0, count);
+}
+
+// Set levels of detail of geometry. The first level is also used when levels
+// of detail are disabled.
+static
+void sokol_geometry_set_lods(
+    SokolGeometry *g,
+    const sokol_mesh_t *lods,
+    const float *lod_sizes,
+    int32_t lod_count)
+{
+    ecs_assert(lod_count > 0 && lod_count <= SOKOL_MAX_LODS, 
+        ECS_INVALID_PARAMETER, NULL);
+
+    int32_t i;
+    for (i = 0; i < lod_count; i ++) {
+        g->lods[i] = lods[i];
+        g->lod_sizes[i] = lod_sizes ? lod_sizes[i] : 0;
+    }
+
+    g->lod_count = lod_count;
+    g->vertices = lods[0].vertices;
+    g->normals = lods[0].normals;
+    g->indices = lods[0].indices;
+    g->index_count = lods[0].index_count;
+}
+
+// Init static rectangle geometry data (vertices, indices)
+static
+void sokol_init_rectangle(
+    ecs_world_t *world,
+    sokol_resources_t *resources) 
+{
+    SokolGeometry *g = ecs_get_mut(
+        world, ecs_id(SokolRectangleGeometry), SokolGeometry);
+    ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    sokol_geometry_set_lods(g, &(sokol_mesh_t){
+        .vertices = resources->rect,
+        .normals = resources->rect_normals,
+        .indices = resources->rect_indices,
+        .index_count = sokol_rectangle_index_count()
+    }, NULL, 1);
+    g->populate = (sokol_geometry_action_t)sokol_populate_rectangle;
+    g->scale = (sokol_geometry_scale_action_t)sokol_scale_rectangle;
+    g->bounds = (sokol_geometry_bounds_action_t)sokol_bounds_rectangle;
+}
+
+// Init static box geometry data (vertices, indices)
+static
+void sokol_init_box(
+    ecs_world_t *world,
+    sokol_resources_t *resources) 
+{
+    if (SokolBoxGeometry) {
+        SokolGeometry *g = ecs_get_mut(
+            world, ecs_id(SokolBoxGeometry), SokolGeometry);
+        ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+
+        sokol_geometry_set_lods(g, &(sokol_mesh_t){
+            .vertices = resources->box,
+            .normals = resources->box_normals,
+            .indices = resources->box_indices,
+            .index_count = sokol_box_index_count()
+        }, NULL, 1);
+        g->populate = (sokol_geometry_action_t)sokol_populate_box;
+        g->scale = (sokol_geometry_scale_action_t)sokol_scale_box;
+        g->bounds = (sokol_geometry_bounds_action_t)sokol_bounds_box;
+#if SOKOL_OCCLUSION_CULLING
+        g->occluder = true;
+#endif
+    }
+}
+
+/* Minimum projected diameter in pixels per primitive level of detail */
+static const float sokol_primitive_lod_sizes[SOKOL_MAX_LODS] = { 128, 32, 0 };
+
+// Init procedural primitive geometry with levels of detail from resources
+static
+void sokol_init_primitive(
+    ecs_world_t *world,
+    ecs_entity_t geometry,
+    const sokol_mesh_t *lods,
+    sokol_geometry_action_t populate,
+    sokol_geometry_scale_action_t scale,
+    sokol_geometry_bounds_action_t bounds)
+{
+    SokolGeometry *g = ecs_get_mut(world, geometry, SokolGeometry);
+    ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    sokol_geometry_set_lods(g, lods, sokol_primitive_lod_sizes, 
+        SOKOL_MAX_LODS);
+    g->populate = populate;
+    g->scale = scale;
+    g->bounds = bounds;
+}
+
+void sokol_init_geometry(
+    ecs_world_t *world,
+    sokol_resources_t *resources) 
+{
+    sokol_init_rectangle(world, resources);
+    sokol_init_box(world, resources);
+
+    sokol_init_primitive(world, SokolSphereGeometry, resources->sphere,
+        (sokol_geometry_action_t)sokol_populate_sphere,
+        (sokol_geometry_scale_action_t)sokol_scale_sphere,
+        (sokol_geometry_bounds_action_t)sokol_bounds_sphere);
+    sokol_init_primitive(world, SokolCylinderGeometry, resources->cylinder,
+        (sokol_geometry_action_t)sokol_populate_cylinder,
+        (sokol_geometry_scale_action_t)sokol_scale_cylinder,
+        (sokol_geometry_bounds_action_t)sokol_bounds_cylinder);
+    sokol_init_primitive(world, SokolConeGeometry, resources->cone,
+        (sokol_geometry_action_t)sokol_populate_cone,
+        (sokol_geometry_scale_action_t)sokol_scale_cone,
+        (sokol_geometry_bounds_action_t)sokol_bounds_cone);
+
+    // All geometries use the same camera facing quad for impostors. Geometries
+    // that are created later get the quad from the singleton.
+    sokol_mesh_t impostor = {
+        .vertices = resources->rect,
+        .normals = resources->rect_normals,
+        .indices = resources->rect_impostor_indices,
+        .index_count = sokol_rectangle_impostor_index_count()
+    };
+    ecs_singleton_set(world, SokolImpostorMesh, { impostor });
+
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            g[i].impostor = impostor;
+        }
+    }
+
+#if SOKOL_INSTANCE_RING
+    // Ring buffer is created when instance data is first appended
+    ecs_singleton_set(world, SokolInstanceRing, {0});
+#endif
+}
+
+// Number of slots to reserve for a table with the specified number of
+// entities. Tables get some headroom so that adding a few entities doesn't
+// immediately require moving the table to a different range.
+static
+int32_t sokol_instance_capacity(
+    int32_t count)
+{
+    int32_t capacity = count + (count >> 3);
+    return (capacity + 3) & ~3;
+}
+
+// Compute capacity of instance buffers that can hold count instances. The 
+// capacity grows geometrically, so that spawning entities in waves doesn't
+// cause a reallocation each frame.
+static
+int32_t sokol_instance_buffer_capacity(
+    int32_t capacity,
+    int32_t count,
+    int32_t hint)
+{
+    if (capacity < SOKOL_INSTANCE_MIN_CAPACITY) {
+        capacity = SOKOL_INSTANCE_MIN_CAPACITY;
+    }
+    if (capacity < hint) {
+        capacity = hint;
+    }
+    while (capacity < count) {
+        capacity += capacity >> 1;
+    }
+    return capacity;
+}
+
+// Zero out instance slots. Unused slots are zero, which produces a degenerate
+// transform so that they don't render anything.
+static
+void sokol_clear_instances(
+    sokol_geometry_buffers_t *buffers,
+    int32_t offset,
+    int32_t count)
+{
+    if (!count) {
+        return;
+    }
+
+    int32_t i;
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        if (!sokol_instance_stream_staged(buffers, i)) {
+            continue;
+        }
+        ecs_size_t size = sokol_instance_layout.stream_size[i];
+        ecs_os_memset(ecs_vec_get(&buffers->streams[i].data, size, offset), 
+            0, size * count);
+    }
+
+#if SOKOL_CULL_INSTANCES
+    ecs_os_memset_n(ecs_vec_get_t(&buffers->bounds, vec4, offset), 0, 
+        vec4, count);
+    ecs_os_memset_n(ecs_vec_get_t(&buffers->exclude, uint8_t, offset), 0, 
+        uint8_t, count);
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_remove(&buffers->index, offset, count);
+#endif
+}
+
+// Resize CPU buffers. Sokol buffers are recreated with the new capacity the 
+// next time instances are uploaded.
+static
+void sokol_resize_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t capacity)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    int32_t i, old_capacity = buffers->capacity;
+    ecs_assert(capacity >= buffers->instance_count, ECS_INTERNAL_ERROR, NULL);
+
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        if (!sokol_instance_stream_staged(buffers, i)) {
+            continue;
+        }
+        ecs_vec_t *data = &buffers->streams[i].data;
+        ecs_size_t size = sokol_instance_layout.stream_size[i];
+        ecs_vec_set_count(a, data, size, capacity);
+        if (capacity < old_capacity) {
+            ecs_vec_reclaim(a, data, size);
+        }
+    }
+
+#if SOKOL_CULL_INSTANCES
+    ecs_vec_set_count_t(a, &buffers->bounds, vec4, capacity);
+    ecs_vec_set_count_t(a, &buffers->exclude, uint8_t, capacity);
+    if (capacity < old_capacity) {
+        ecs_vec_reclaim_t(a, &buffers->bounds, vec4);
+        ecs_vec_reclaim_t(a, &buffers->exclude, uint8_t);
+    }
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_resize(&buffers->index, capacity);
+#endif
+
+    // New slots are zero
+    if (capacity > old_capacity) {
+        sokol_clear_instances(buffers, old_capacity, capacity - old_capacity);
+    }
+
+    buffers->capacity = capacity;
+    buffers->low_frames = 0;
+    geometry->stats.reallocations ++;
+    ecs_dbg_2("sokol: resized instance buffers from %d to %d instances", 
+        old_capacity, capacity);
+}
+
+// Shrink buffers when they have been mostly unused for a number of frames, or 
+// grow them when the capacity hint increased.
+static
+void sokol_update_capacity(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    int32_t hint = buffers->capacity_hint;
+    if (buffers->capacity < hint) {
+        sokol_resize_instances(geometry, buffers, hint);
+        return;
+    }
+
+    // Low watermark is a quarter of the capacity. Buffers are shrunk to twice
+    // the number of instances, so that there is a wide margin before buffers
+    // need to grow or shrink again.
+    int32_t count = buffers->instance_count;
+    if (count >= (buffers->capacity >> 2)) {
+        buffers->low_frames = 0;
+        return;
+    }
+
+    if (++ buffers->low_frames < SOKOL_INSTANCE_SHRINK_FRAMES) {
+        return;
+    }
+
+    int32_t capacity = sokol_instance_buffer_capacity(0, count * 2, hint);
+    if (capacity < buffers->capacity) {
+        sokol_resize_instances(geometry, buffers, capacity);
+    } else {
+        buffers->low_frames = 0;
+    }
+}
+
+// Mark range of instances as modified so it gets uploaded to the GPU
+static
+void sokol_dirty_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    int32_t offset,
+    int32_t count)
+{
+    if (count) {
+        sokol_instance_range_t *r = ecs_vec_append_t(
+            a, &buffers->dirty_ranges, sokol_instance_range_t);
+        r->offset = offset;
+        r->count = count;
+    }
+}
+
+// Return range of instance slots to the free list. The free list is kept 
+// sorted by offset so that adjacent ranges can be merged.
+static
+void sokol_release_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    int32_t offset,
+    int32_t count)
+{
+    if (!count) {
+        return;
+    }
+
+    sokol_clear_instances(buffers, offset, count);
+
+    // If range is at the end of the buffer just stop drawing it
+    if ((offset + count) == buffers->instance_count) {
+        buffers->instance_count = offset;
+
+        // Previous free range may now also be at the end of the buffer
+        sokol_instance_range_t *last = ecs_vec_last_t(
+            &buffers->free_ranges, sokol_instance_range_t);
+        if (last && (last->offset + last->count) == buffers->instance_count) {
+            buffers->instance_count = last->offset;
+            buffers->free_count -= last->count;
+            ecs_vec_remove_last(&buffers->free_ranges);
+        }
+        return;
+    }
+
+    // Slots were cleared, so the GPU buffer needs to be updated
+    sokol_dirty_instances(a, buffers, offset, count);
+
+    int32_t i, free_count = ecs_vec_count(&buffers->free_ranges);
+    sokol_instance_range_t *ranges = ecs_vec_first_t(
+        &buffers->free_ranges, sokol_instance_range_t);
+    for (i = 0; i < free_count; i ++) {
+        if (ranges[i].offset > offset) {
+            break;
+        }
+    }
+
+    buffers->free_count += count;
+
+    // Merge with previous range
+    if (i && (ranges[i - 1].offset + ranges[i - 1].count) == offset) {
+        ranges[i - 1].count += count;
+        
+        // Merge with next range
+        if (i < free_count && (offset + count) == ranges[i].offset) {
+            ranges[i - 1].count += ranges[i].count;
+            ecs_os_memmove_n(&ranges[i], &ranges[i + 1], 
+                sokol_instance_range_t, free_count - i - 1);
+            ecs_vec_remove_last(&buffers->free_ranges);
+        }
+        return;
+    }
+
+    // Merge with next range
+    if (i < free_count && (offset + count) == ranges[i].offset) {
+        ranges[i].offset = offset;
+        ranges[i].count += count;
+        return;
+    }
+
+    // Insert new range
+    ecs_vec_append_t(a, &buffers->free_ranges, sokol_instance_range_t);
+    ranges = ecs_vec_first_t(&buffers->free_ranges, sokol_instance_range_t);
+    ecs_os_memmove_n(&ranges[i + 1], &ranges[i], 
+        sokol_instance_range_t, free_count - i);
+    ranges[i].offset = offset;
+    ranges[i].count = count;
+}
+
+// Find range of instance slots for table. Uses first range in the free list 
+// that's large enough, or adds slots to the end of the buffer.
+static
+int32_t sokol_alloc_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t count)
+{
+    int32_t i, free_count = ecs_vec_count(&buffers->free_ranges);
+    sokol_instance_range_t *ranges = ecs_vec_first_t(
+        &buffers->free_ranges, sokol_instance_range_t);
+    for (i = 0; i < free_count; i ++) {
+        sokol_instance_range_t *r = &ranges[i];
+        if (r->count >= count) {
+            int32_t offset = r->offset;
+            r->offset += count;
+            r->count -= count;
+            if (!r->count) {
+                ecs_os_memmove_n(&ranges[i], &ranges[i + 1], 
+                    sokol_instance_range_t, free_count - i - 1);
+                ecs_vec_remove_last(&buffers->free_ranges);
+            }
+            buffers->free_count -= count;
+            return offset;
+        }
+    }
+
+    int32_t offset = buffers->instance_count;
+    buffers->instance_count += count;
+
+    // Make sure CPU buffers are large enough
+    if (buffers->instance_count > buffers->capacity) {
+        sokol_resize_instances(geometry, buffers, sokol_instance_buffer_capacity(
+            buffers->capacity, buffers->instance_count, 
+                buffers->capacity_hint));
+    }
+
+    return offset;
+}
+
+// When a large part of the instance buffer consists of unused slots, release
+// all table ranges so they're packed again when the buffers are populated.
+static
+void sokol_compact_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    if (buffers->free_count <= (buffers->instance_count >> 2)) {
+        return;
+    }
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        ti->offset = 0;
+        ti->capacity = 0;
+        ti->count = 0;
+    }
+
+    sokol_clear_instances(buffers, 0, buffers->capacity);
+    ecs_vec_clear(&buffers->free_ranges);
+    ecs_vec_clear(&buffers->dirty_ranges);
+    ecs_os_memset_n(buffers->exclude_count, 0, int32_t, SOKOL_MAX_PASSES);
+    buffers->free_count = 0;
+    buffers->instance_count = 0;
+    geometry->stats.compactions ++;
+
+#if SOKOL_CLUSTER_INSTANCES
+    mit = ecs_map_iter(&buffers->groups);
+    while (ecs_map_next(&mit)) {
+        sokol_cluster_group_t *g = ecs_map_ptr(&mit);
+        g->offset = 0;
+        g->capacity = 0;
+        g->count = 0;
+        g->dirty = true;
+    }
+#endif
+}
+
+#if SOKOL_PACKED_INSTANCE_DATA
+// Convert colors & materials to packed instance format
+static
+void sokol_gather_colors(
+    sokol_geometry_buffers_t *buffers,
+    ecs_iter_t *qit,
+    int32_t offset)
+{
+    static const float zero[2] = {0};
+
+    EcsRgb *colors = ecs_field(qit, EcsRgb, 1);
+    EcsEmissive *emissive = ecs_field(qit, EcsEmissive, 2);
+    EcsSpecular *specular = ecs_field(qit, EcsSpecular, 3);
+
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    void *c = sokol_instance_ptr(buffers, &l->color, offset);
+    const float *specular_ptr = zero, *emissive_ptr = zero;
+    ecs_size_t specular_stride = 0, emissive_stride = 0;
+
+    if (specular) {
+        specular_ptr = &specular->specular_power;
+        if (ecs_field_is_self(qit, 3)) {
+            specular_stride = ECS_SIZEOF(EcsSpecular);
+        }
+    }
+    if (emissive) {
+        emissive_ptr = &emissive->value;
+        if (ecs_field_is_self(qit, 2)) {
+            emissive_stride = ECS_SIZEOF(EcsEmissive);
+        }
+    }
+
+    sokol_pack_instance_colors(c, l->stream_size[l->color.stream], qit->count,
+        &colors->r, ecs_field_is_self(qit, 1) ? ECS_SIZEOF(EcsRgb) : 0,
+        specular_ptr, specular_stride,
+        emissive_ptr, emissive_stride);
+}
+#else
+// Copy colors & materials to instance buffers
+static
+void sokol_gather_colors(
+    sokol_geometry_buffers_t *buffers,
+    ecs_iter_t *qit,
+    int32_t offset)
+{
+    EcsRgb *colors = ecs_field(qit, EcsRgb, 1);
+    EcsEmissive *emissive = ecs_field(qit, EcsEmissive, 2);
+    EcsSpecular *specular = ecs_field(qit, EcsSpecular, 3);
+
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    ecs_size_t c_stride = l->stream_size[l->color.stream];
+    ecs_size_t m_stride = l->stream_size[l->material.stream];
+    void *c = sokol_instance_ptr(buffers, &l->color, offset);
+    void *m = sokol_instance_ptr(buffers, &l->material, offset);
+    int32_t i, count = qit->count;
+
+    // Copy color data
+    if (ecs_field_is_self(qit, 1)) {
+        if (c_stride == ECS_SIZEOF(ecs_rgb_t)) {
+            ecs_os_memcpy_n(c, colors, ecs_rgb_t, count);
+        } else {
+            for (i = 0; i < count; i ++) {
+                *(ecs_rgb_t*)ECS_ELEM(c, c_stride, i) = colors[i];
+            }
+        }
+    } else {
+        for (i = 0; i < count; i ++) {
+            *(ecs_rgb_t*)ECS_ELEM(c, c_stride, i) = colors[0];
+        }
+    }
+
+    // Copy material data. Fields that are not owned by the entities use the
+    // same value for all instances.
+    const float zero[2] = {0};
+    const float *e = zero, *s = zero;
+    ecs_size_t e_stride = 0, s_stride = 0;
+    if (emissive) {
+        e = &emissive->value;
+        if (ecs_field_is_self(qit, 2)) {
+            e_stride = ECS_SIZEOF(EcsEmissive);
+        }
+    }
+    if (specular) {
+        s = &specular->specular_power;
+        if (ecs_field_is_self(qit, 3)) {
+            s_stride = ECS_SIZEOF(EcsSpecular);
+        }
+    }
+
+    for (i = 0; i < count; i ++) {
+        SokolMaterial *mi = ECS_ELEM(m, m_stride, i);
+        const float *ei = ECS_ELEM(e, e_stride, i);
+        const float *si = ECS_ELEM(s, s_stride, i);
+        mi->specular_power = si[0];
+        mi->shininess = si[1];
+        mi->emissive = ei[0];
+    }
+}
+#endif
+
+// Copy ECS data for a table into its instance slots
+static
+void sokol_gather_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    ecs_iter_t *qit,
+    int32_t offset)
+{
+    EcsTransform3 *transforms = ecs_field(qit, EcsTransform3, 0);
+    void *geometry_data = ecs_field_w_size(qit, qit->sizes[4], 4);
+    bool geometry_self = ecs_field_is_self(qit, 4);
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+
+    // Copy color & material data
+    sokol_gather_colors(buffers, qit, offset);
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    // Geometry-specific scaling is applied by the shader
+    void *scale = sokol_instance_ptr(buffers, &l->scale, offset);
+    geometry->scale(scale, l->stream_size[l->scale.stream], geometry_data, 
+        qit->count, geometry_self);
+
+    // Transforms of dynamic entities are uploaded from the table column
+    if (sokol_instance_stream_staged(buffers, l->transform.stream)) {
+        void *t = sokol_instance_ptr(buffers, &l->transform, offset);
+        ecs_os_memcpy_n(t, transforms, EcsTransform3, qit->count);
+    }
+#else
+    void *t = sokol_instance_ptr(buffers, &l->transform, offset);
+
+    // Copy transform data & apply geometry-specific scaling
+    geometry->populate(t, l->stream_size[l->transform.stream], 
+        (const mat4*)transforms, geometry_data, qit->count, geometry_self);
+#endif
+
+#if SOKOL_CULL_INSTANCES
+    geometry->bounds(ecs_vec_get_t(&buffers->bounds, vec4, offset), 
+        (const mat4*)transforms, geometry_data, qit->count, geometry_self);
+#endif
+}
+
+static
+int sokol_compare_instance_range(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const sokol_instance_range_t *r1 = ptr1;
+    const sokol_instance_range_t *r2 = ptr2;
+    return (r1->offset > r2->offset) - (r1->offset < r2->offset);
+}
+
+// Immutable buffers can't be updated, so recreate them when data changed. The
+// buffers are created with the number of instances in use, as there is no 
+// point in reserving space for new instances.
+static
+void sokol_upload_immutable_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, count = buffers->instance_count;
+    if (!ecs_vec_count(&buffers->dirty_ranges) && 
+        (buffers->buffer_size == count)) 
+    {
+        return;
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        sokol_instance_stream_t *stream = &buffers->streams[s];
+        ecs_size_t elem_size = l->stream_size[s];
+        if (stream->buffer.id) {
+            sg_destroy_buffer(stream->buffer);
+            stream->buffer.id = 0;
+        }
+        if (!count) {
+            continue;
+        }
+
+        stream->buffer = sg_make_buffer(&(sg_buffer_desc){
+            .size = count * elem_size,
+            .data = { ecs_vec_first(&stream->data), count * elem_size },
+            .usage = SG_USAGE_IMMUTABLE });
+    }
+
+    buffers->buffer_size = count;
+    geometry->stats.ranges_uploaded ++;
+    geometry->stats.instances_uploaded += count;
+    ecs_vec_clear(&buffers->dirty_ranges);
+}
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+// Upload transforms of modified tables directly from the EcsTransform3 table
+// columns. When all is true, the transforms of all tables are uploaded.
+static
+void sokol_upload_transform_columns(
+    const ecs_world_t *world,
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    bool all)
+{
+    int32_t stream = sokol_instance_layout.transform.stream;
+    if ((!all && !buffers->gather_count) || 
+        sokol_instance_stream_staged(buffers, stream)) 
+    {
+        return;
+    }
+
+    sg_buffer buffer = buffers->streams[stream].buffer;
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->count || (!all && !ti->gather)) {
+            continue;
+        }
+
+        // Skip tables that changed after slots were reserved, same as when
+        // gathering data.
+        ecs_table_t *table = (ecs_table_t*)(uintptr_t)ecs_map_key(&mit);
+        if (ecs_table_count(table) != ti->count) {
+            continue;
+        }
+
+        const EcsTransform3 *transforms = ecs_table_get_id(
+            world, table, ecs_id(EcsTransform3), 0);
+        sg_update_buffer_range(buffer, 
+            ti->offset * ECS_SIZEOF(EcsTransform3), &(sg_range) {
+                transforms, ti->count * sizeof(EcsTransform3) } );
+        geometry->stats.ranges_uploaded ++;
+    }
+}
+#endif
+
+// Upload modified instance data to GPU buffers
+#if SOKOL_CLUSTER_INSTANCES
+// Add table to the cluster of its query group. Tables are iterated in group
+// order, and tables without a SokolCluster pair (group 0) get their own cluster.
+// Tables of a group that are excluded from different passes are stored in
+// separate clusters.
+static
+void sokol_cluster_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    const sokol_table_instances_t *ti)
+{
+    uint64_t group = ti->group;
+    sokol_instance_cluster_t *cluster = ecs_vec_last_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    if (group && cluster && (cluster->group == group) && 
+        (cluster->exclude == ti->exclude)) 
+    {
+        cluster->count = ti->offset + ti->count - cluster->offset;
+        cluster->dirty |= ti->bounds_dirty;
+        return;
+    }
+
+    cluster = ecs_vec_append_t(a, &buffers->clusters, sokol_instance_cluster_t);
+    cluster->group = group;
+    cluster->exclude = ti->exclude;
+    cluster->offset = ti->offset;
+    cluster->count = ti->count;
+    cluster->dirty = ti->bounds_dirty;
+}
+
+static
+int sokol_compare_cluster(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const sokol_instance_cluster_t *c1 = ptr1;
+    const sokol_instance_cluster_t *c2 = ptr2;
+    return (c1->offset > c2->offset) - (c1->offset < c2->offset);
+}
+
+// Rebuild clusters from the tables of the buffers, which are in group order.
+// Clusters are sorted by slot so that adjacent visible clusters can be drawn
+// together. Clusters with tables that weren't gathered keep their bounds.
+static
+void sokol_build_clusters(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t **tables,
+    int32_t table_count)
+{
+    ecs_vec_t old = buffers->clusters, old_bounds = buffers->cluster_bounds;
+    ecs_vec_init_t(a, &buffers->clusters, sokol_instance_cluster_t, 0);
+    ecs_vec_init_t(a, &buffers->cluster_bounds, vec4, 0);
+
+    int32_t i;
+    for (i = 0; i < table_count; i ++) {
+        if (tables[i]->count) {
+            sokol_cluster_instances(a, buffers, tables[i]);
+        }
+    }
+
+    sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    int32_t count = ecs_vec_count(&buffers->clusters);
+    if (count) {
+        qsort(clusters, (size_t)count, sizeof(sokol_instance_cluster_t),
+            sokol_compare_cluster);
+    }
+
+    ecs_vec_set_count_t(a, &buffers->cluster_bounds, vec4, count);
+    vec4 *bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    const sokol_instance_cluster_t *old_clusters = ecs_vec_first_t(
+        &old, sokol_instance_cluster_t);
+    int32_t old_count = ecs_vec_count(&old);
+    for (i = 0; i < count; i ++) {
+        sokol_instance_cluster_t *c = &clusters[i];
+        if (c->dirty) {
+            continue;
+        }
+
+        const sokol_instance_cluster_t *o = old_count ? bsearch(c, old_clusters,
+            (size_t)old_count, sizeof(sokol_instance_cluster_t), 
+                sokol_compare_cluster) : NULL;
+        if (o && (o->count == c->count) && (o->exclude == c->exclude)) {
+            glm_vec4_copy(*ecs_vec_get_t(&old_bounds, vec4, o - old_clusters),
+                bounds[i]);
+        } else {
+            c->dirty = true;
+        }
+    }
+
+    ecs_vec_fini_t(a, &old, sokol_instance_cluster_t);
+    ecs_vec_fini_t(a, &old_bounds, vec4);
+}
+
+// Compute bounds of clusters after they were gathered
+static
+void sokol_update_cluster_bounds(
+    sokol_geometry_buffers_t *buffers)
+{
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+    sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    vec4 *cluster_bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    int32_t i, count = ecs_vec_count(&buffers->clusters);
+
+    for (i = 0; i < count; i ++) {
+        if (clusters[i].dirty) {
+            sokol_merge_bounds(cluster_bounds[i], 
+                &bounds[clusters[i].offset], clusters[i].count);
+            clusters[i].dirty = false;
+        }
+    }
+}
+#endif
+
+#if SOKOL_CULL_INSTANCES
+// Update bounds of tables that were gathered. This runs on the main thread
+// after gathering, so that culling only has to test bounds.
+static
+void sokol_update_bounds(
+    sokol_geometry_buffers_t *buffers)
+{
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->bounds_dirty) {
+            continue;
+        }
+
+        // Table changed after it was gathered, wait for next populate
+        ecs_table_t *table = (ecs_table_t*)(uintptr_t)ecs_map_key(&mit);
+        if (ecs_table_count(table) != ti->count) {
+            continue;
+        }
+
+#if SOKOL_SPATIAL_INDEX
+        const ecs_entity_t *entities = ecs_table_entities(table);
+        int32_t i;
+        for (i = 0; i < ti->count; i ++) {
+            sokol_spatial_set(&buffers->index, ti->offset + i, entities[i],
+                bounds[ti->offset + i]);
+        }
+#else
+        sokol_merge_bounds(ti->bounds, &bounds[ti->offset], ti->count);
+#endif
+        ti->bounds_dirty = false;
+    }
+}
+#endif
+
+// Upload modified ranges to dynamic sokol buffers, which have the same capacity
+// as the CPU buffers.
+static
+void sokol_upload_dynamic_instances(
+    const ecs_world_t *world,
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, size = buffers->capacity;
+
+    // If buffers were resized, create new buffers & upload everything
+    if (buffers->buffer_size != size) {
+        int32_t count = buffers->instance_count;
+        for (s = 0; s < l->stream_count; s ++) {
+            sokol_instance_stream_t *stream = &buffers->streams[s];
+            ecs_size_t elem_size = l->stream_size[s];
+            if (stream->buffer.id) {
+                sg_destroy_buffer(stream->buffer);
+                stream->buffer.id = 0;
+            }
+            if (!size) {
+                continue;
+            }
+
+            stream->buffer = sg_make_buffer(&(sg_buffer_desc){
+                .size = size * elem_size, .usage = SG_USAGE_DYNAMIC });
+            // sg_update_buffer doesn't accept empty data, which happens when
+            // the buffers of a geometry without instances are shrunk.
+            if (count && sokol_instance_stream_staged(buffers, s)) {
+                sg_update_buffer(stream->buffer, &(sg_range) {
+                    ecs_vec_first(&stream->data), count * elem_size } );
+            }
+        }
+        buffers->buffer_size = size;
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        sokol_upload_transform_columns(world, geometry, buffers, true);
+#endif
+
+        geometry->stats.ranges_uploaded ++;
+        geometry->stats.instances_uploaded += count;
+        ecs_vec_clear(&buffers->dirty_ranges);
+        return;
+    }
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    sokol_upload_transform_columns(world, geometry, buffers, false);
+#else
+    (void)world;
+#endif
+
+    int32_t i, dirty_count = ecs_vec_count(&buffers->dirty_ranges);
+    if (!dirty_count) {
+        return;
+    }
+
+    sokol_instance_range_t *ranges = ecs_vec_first_t(
+        &buffers->dirty_ranges, sokol_instance_range_t);
+    qsort(ranges, dirty_count, sizeof(sokol_instance_range_t), 
+        sokol_compare_instance_range);
+
+    for (i = 0; i < dirty_count; ) {
+        int32_t offset = ranges[i].offset;
+        int32_t end = offset + ranges[i].count;
+
+        // Merge ranges that overlap or are close together, as uploading a 
+        // few unmodified slots is cheaper than an extra buffer update.
+        for (i ++; i < dirty_count; i ++) {
+            if (ranges[i].offset > (end + SOKOL_INSTANCE_RANGE_MERGE_GAP)) {
+                break;
+            }
+            int32_t range_end = ranges[i].offset + ranges[i].count;
+            if (range_end > end) {
+                end = range_end;
+            }
+        }
+
+        // Ranges past the end of the buffer are no longer drawn
+        if (end > buffers->instance_count) {
+            end = buffers->instance_count;
+        }
+        if (end <= offset) {
+            continue;
+        }
+
+        int32_t count = end - offset;
+        for (s = 0; s < l->stream_count; s ++) {
+            if (!sokol_instance_stream_staged(buffers, s)) {
+                continue;
+            }
+            sokol_instance_stream_t *stream = &buffers->streams[s];
+            ecs_size_t elem_size = l->stream_size[s];
+            sg_update_buffer_range(stream->buffer, offset * elem_size, 
+                &(sg_range) { 
+                    ecs_vec_get(&stream->data, elem_size, offset), 
+                    count * elem_size } );
+        }
+
+        geometry->stats.ranges_uploaded ++;
+        geometry->stats.instances_uploaded += count;
+    }
+
+    ecs_vec_clear(&buffers->dirty_ranges);
+}
+
+static
+void sokol_upload_instances(
+    const ecs_world_t *world,
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+#if SOKOL_CULL_INSTANCES
+    sokol_update_bounds(buffers);
+
+#if SOKOL_CLUSTER_INSTANCES
+    // Clusters are drawn directly from the instance buffers. These are dynamic
+    // so that only the ranges of groups that changed have to be uploaded.
+    if (sokol_instance_clustered(buffers)) {
+        sokol_update_cluster_bounds(buffers);
+        sokol_upload_dynamic_instances(world, geometry, buffers);
+        return;
+    }
+#endif
+
+    // Only visible instances are uploaded, which happens after culling
+    ecs_vec_clear(&buffers->dirty_ranges);
+    return;
+#endif
+
+    if (buffers->usage == SG_USAGE_IMMUTABLE) {
+        sokol_upload_immutable_instances(geometry, buffers);
+        return;
+    }
+
+    // Data is appended to the instance ring, so all of it is uploaded
+    if (buffers->usage == SG_USAGE_STREAM) {
+        ecs_vec_clear(&buffers->dirty_ranges);
+        return;
+    }
+
+    sokol_upload_dynamic_instances(world, geometry, buffers);
+}
+
+// Passes that the entities of a table are excluded from
+static
+ecs_flags32_t sokol_table_exclude(
+    const ecs_world_t *world,
+    const ecs_table_t *table)
+{
+    ecs_flags32_t result = 0;
+    if (ecs_table_has_id(world, table, SokolNoShadow)) {
+        result |= 1u << SOKOL_PASS_SHADOW;
+    }
+    if (ecs_table_has_id(world, table, SokolNoDepthPrepass)) {
+        result |= 1u << SOKOL_PASS_DEPTH;
+    }
+    return result;
+}
+
+#if !SOKOL_CULL_INSTANCES
+// Collect the slot ranges of tables that are excluded from a pass. Adjacent
+// ranges are merged, so that a pass draws as few ranges as possible.
+static
+void sokol_exclude_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers)
+{
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        ecs_vec_t *excluded = &buffers->excluded[p];
+        ecs_vec_clear(excluded);
+
+        ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+        while (ecs_map_next(&mit)) {
+            sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+            if ((ti->exclude & (1u << p)) && ti->count) {
+                sokol_instance_range_t *r = ecs_vec_append_t(
+                    a, excluded, sokol_instance_range_t);
+                r->offset = ti->offset;
+                r->count = ti->count;
+            }
+        }
+
+        int32_t i, count = ecs_vec_count(excluded);
+        if (!count) {
+            continue;
+        }
+
+        sokol_instance_range_t *ranges = ecs_vec_first_t(
+            excluded, sokol_instance_range_t);
+        qsort(ranges, count, sizeof(sokol_instance_range_t), 
+            sokol_compare_instance_range);
+
+        int32_t merged = 0;
+        for (i = 1; i < count; i ++) {
+            sokol_instance_range_t *last = &ranges[merged];
+            if (ranges[i].offset == (last->offset + last->count)) {
+                last->count += ranges[i].count;
+            } else {
+                ranges[++ merged] = ranges[i];
+            }
+        }
+        ecs_vec_set_count_t(a, excluded, sokol_instance_range_t, merged + 1);
+    }
+}
+#endif
+
+#if SOKOL_CULL_INSTANCES && SOKOL_ZERO_COPY_TRANSFORMS
+static
+int sokol_compare_table_slots(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const sokol_table_slots_t *t1 = ptr1;
+    const sokol_table_slots_t *t2 = ptr2;
+    return (t1->offset > t2->offset) - (t1->offset < t2->offset);
+}
+
+// Collect the slot ranges of tables in slot order, so that views can find the
+// table column that the transform of a visible slot is stored in.
+static
+void sokol_index_table_slots(
+    const ecs_world_t *world,
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers)
+{
+    ecs_vec_clear(&buffers->table_slots);
+    if (sokol_instance_stream_staged(
+        buffers, sokol_instance_layout.transform.stream)) 
+    {
+        return;
+    }
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->count) {
+            continue;
+        }
+
+        ecs_table_t *table = (ecs_table_t*)(uintptr_t)ecs_map_key(&mit);
+        sokol_table_slots_t *ts = ecs_vec_append_t(
+            a, &buffers->table_slots, sokol_table_slots_t);
+        ts->offset = ti->offset;
+        ts->count = ti->count;
+        ts->table = table;
+        ts->column = ecs_table_get_column_index(
+            world, table, ecs_id(EcsTransform3));
+    }
+
+    int32_t count = ecs_vec_count(&buffers->table_slots);
+    if (count) {
+        qsort(ecs_vec_first(&buffers->table_slots), (size_t)count, 
+            sizeof(sokol_table_slots_t), sokol_compare_table_slots);
+    }
+}
+
+// Get transform of an instance slot from its table column, and the number of
+// slots from slot to the end of the table in run. Returns NULL if the slot is
+// not in use, or if the table changed after its slots were reserved.
+static
+const EcsTransform3* sokol_column_transform(
+    const sokol_geometry_buffers_t *buffers,
+    int32_t slot,
+    int32_t *run)
+{
+    const sokol_table_slots_t *ts = ecs_vec_first_t(
+        &buffers->table_slots, sokol_table_slots_t);
+    int32_t lo = 0, hi = ecs_vec_count(&buffers->table_slots);
+    while (lo < hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (ts[mid].offset > slot) {
+            hi = mid;
+        } else if ((ts[mid].offset + ts[mid].count) <= slot) {
+            lo = mid + 1;
+        } else {
+            ts = &ts[mid];
+            if (ecs_table_count(ts->table) != ts->count) {
+                return NULL;
+            }
+            if (run) {
+                *run = ts->offset + ts->count - slot;
+            }
+            const EcsTransform3 *column = ecs_table_get_column(
+                ts->table, ts->column, 0);
+            return &column[slot - ts->offset];
+        }
+    }
+    return NULL;
+}
+#endif
+
+// Set number of instances & passes that a table is excluded from, and keep
+// the number of excluded instances per pass in sync.
+static
+void sokol_set_table_instances(
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t *ti,
+    int32_t count,
+    ecs_flags32_t exclude)
+{
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        if (ti->exclude & (1u << p)) {
+            buffers->exclude_count[p] -= ti->count;
+        }
+        if (exclude & (1u << p)) {
+            buffers->exclude_count[p] += count;
+        }
+    }
+    ti->count = count;
+    ti->exclude = exclude;
+}
+
+// Mark table data to be copied to its slots by SokolGatherGeometry
+static
+void sokol_gather_table(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t *ti)
+{
+    ti->gather = true;
+    sokol_dirty_instances(a, buffers, ti->offset, ti->count);
+    buffers->gather_count ++;
+#if SOKOL_CULL_INSTANCES
+    ti->bounds_dirty = true;
+    ecs_os_memset_n(ecs_vec_get_t(&buffers->exclude, uint8_t, ti->offset), 
+        (uint8_t)ti->exclude, uint8_t, ti->count);
+#endif
+}
+
+#if SOKOL_CLUSTER_INSTANCES
+// Store tables of a group consecutively in the range of the group, in query 
+// order. The range only moves when the tables no longer fit.
+static
+void sokol_layout_cluster_group(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_cluster_group_t *group,
+    sokol_table_instances_t **tables,
+    int32_t table_count)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    int32_t i, count = 0;
+    for (i = 0; i < table_count; i ++) {
+        count += tables[i]->count;
+    }
+
+    if (count > group->capacity) {
+        sokol_release_instances(a, buffers, group->offset, group->capacity);
+        group->capacity = sokol_instance_capacity(count);
+        group->offset = sokol_alloc_instances(geometry, buffers, group->capacity);
+    } else if (count < group->count) {
+        // Clear slots of entities that are no longer in the group
+        sokol_clear_instances(buffers, group->offset + count, 
+            group->count - count);
+        sokol_dirty_instances(a, buffers, group->offset + count, 
+            group->count - count);
+    }
+
+    int32_t offset = group->offset;
+    for (i = 0; i < table_count; i ++) {
+        sokol_table_instances_t *ti = tables[i];
+        ti->offset = offset;
+        ti->capacity = ti->count;
+        offset += ti->count;
+        sokol_gather_table(a, buffers, ti);
+    }
+
+    group->count = count;
+    group->dirty = false;
+}
+
+// Lay out groups with tables that changed & rebuild clusters. Tables are in 
+// query order, which stores the tables of a group next to each other.
+static
+void sokol_layout_clusters(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t **tables,
+    int32_t table_count)
+{
+    int32_t i, last;
+    for (i = 0; i < table_count; i = last) {
+        uint64_t group = tables[i]->group;
+        for (last = i + 1; last < table_count; last ++) {
+            if (tables[last]->group != group) {
+                break;
+            }
+        }
+
+        sokol_cluster_group_t *g = group ? ecs_map_get_deref(
+            &buffers->groups, sokol_cluster_group_t, group) : NULL;
+        if (g && g->dirty) {
+            sokol_layout_cluster_group(
+                geometry, buffers, g, &tables[i], last - i);
+        }
+    }
+
+    sokol_build_clusters(geometry->allocator, buffers, tables, table_count);
+}
+#endif
+
+static
+void sokol_populate_buffers(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    ecs_query_t *query)
+{
+    const ecs_world_t *world = ecs_get_world(query);
+    ecs_allocator_t *a = geometry->allocator;
+
+    sokol_update_capacity(geometry, buffers);
+
+    // If none of the tables matched by the query changed since the last time
+    // the buffers were populated, the GPU buffers still contain valid data.
+    buffers->gather_count = 0;
+    if (!ecs_query_changed(query)) {
+        geometry->stats.uploads_skipped ++;
+        return;
+    }
+
+    buffers->frame ++;
+
+    sokol_compact_instances(geometry, buffers);
+
+#if SOKOL_CLUSTER_INSTANCES
+    // Tables of clustered buffers in query order (vec<sokol_table_instances_t*>)
+    bool clustered = sokol_instance_clustered(buffers);
+    ecs_vec_t clustered_tables;
+    ecs_vec_init_t(a, &clustered_tables, sokol_table_instances_t*, 0);
+#endif
+
+    ecs_iter_t qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        sokol_table_instances_t *ti = ecs_map_ensure_alloc_t(&buffers->tables, 
+            sokol_table_instances_t, (ecs_map_key_t)(uintptr_t)qit.table);
+        ecs_flags32_t exclude = sokol_table_exclude(world, qit.table);
+        int32_t count = qit.count;
+        bool moved = false;
+
+        ti->frame = buffers->frame;
+
+#if SOKOL_CLUSTER_INSTANCES
+        if (clustered) {
+            *ecs_vec_append_t(a, &clustered_tables, sokol_table_instances_t*) =
+                ti;
+
+            // Table moved between a group range and a range of its own
+            uint64_t group = qit.group_id;
+            if (group != ti->group) {
+                if (ti->group) {
+                    ecs_map_ensure_alloc_t(&buffers->groups, 
+                        sokol_cluster_group_t, ti->group)->dirty = true;
+                } else {
+                    sokol_release_instances(
+                        a, buffers, ti->offset, ti->capacity);
+                }
+                ti->offset = 0;
+                ti->capacity = 0;
+                ti->group = group;
+                sokol_set_table_instances(buffers, ti, 0, ti->exclude);
+            }
+
+            // Slots of grouped tables are reserved after all tables are 
+            // iterated, for the groups that changed.
+            if (group) {
+                sokol_cluster_group_t *g = ecs_map_ensure_alloc_t(
+                    &buffers->groups, sokol_cluster_group_t, group);
+                g->frame = buffers->frame;
+                if ((ti->count != count) || (ti->exclude != exclude) || 
+                    ecs_iter_changed(&qit)) 
+                {
+                    g->dirty = true;
+                }
+                sokol_set_table_instances(buffers, ti, count, exclude);
+                ti->gather = false;
+                continue;
+            }
+        }
+#endif
+
+        if (count > ti->capacity) {
+            // Table no longer fits in its range, move it to a new range
+            sokol_release_instances(a, buffers, ti->offset, ti->capacity);
+            ti->capacity = sokol_instance_capacity(count);
+            ti->offset = sokol_alloc_instances(geometry, buffers, ti->capacity);
+            moved = true;
+        } else if (count < ti->count) {
+            // Clear slots of entities that are no longer in the table
+            sokol_clear_instances(buffers, ti->offset + count, ti->count - count);
+            sokol_dirty_instances(a, buffers, ti->offset + count, ti->count - count);
+#if SOKOL_CULL_INSTANCES
+            ti->bounds_dirty = true;
+#endif
+        }
+
+        sokol_set_table_instances(buffers, ti, count, exclude);
+
+        // Only copy data for tables that were moved or modified. Data is
+        // copied by the SokolGatherGeometry system, which can run on
+        // multiple threads as each table writes to its own range.
+        if (moved || ecs_iter_changed(&qit)) {
+            sokol_gather_table(a, buffers, ti);
+        } else {
+            ti->gather = false;
+        }
+    }
+
+    // Release ranges of tables that are no longer matched
+    {
+        ecs_vec_t unmatched;
+        ecs_vec_init_t(a, &unmatched, ecs_map_key_t, 0);
+
+        ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+        while (ecs_map_next(&mit)) {
+            sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+            if (ti->frame == buffers->frame) {
+                continue;
+            }
+
+            sokol_set_table_instances(buffers, ti, 0, 0);
+#if SOKOL_CLUSTER_INSTANCES
+            // Slots of grouped tables are owned by the group
+            if (ti->group) {
+                sokol_cluster_group_t *g = ecs_map_get_deref(
+                    &buffers->groups, sokol_cluster_group_t, ti->group);
+                if (g) {
+                    g->dirty = true;
+                }
+            } else
+#endif
+            {
+                sokol_release_instances(a, buffers, ti->offset, ti->capacity);
+            }
+            *ecs_vec_append_t(a, &unmatched, ecs_map_key_t) = 
+                ecs_map_key(&mit);
+        }
+
+#if SOKOL_CLUSTER_INSTANCES
+        ecs_vec_t unmatched_groups;
+        ecs_vec_init_t(a, &unmatched_groups, ecs_map_key_t, 0);
+
+        mit = ecs_map_iter(&buffers->groups);
+        while (ecs_map_next(&mit)) {
+            sokol_cluster_group_t *g = ecs_map_ptr(&mit);
+            if (g->frame != buffers->frame) {
+                sokol_release_instances(a, buffers, g->offset, g->capacity);
+                *ecs_vec_append_t(a, &unmatched_groups, ecs_map_key_t) = 
+                    ecs_map_key(&mit);
+            }
+        }
+
+        int32_t g, group_count = ecs_vec_count(&unmatched_groups);
+        ecs_map_key_t *group_keys = ecs_vec_first_t(
+            &unmatched_groups, ecs_map_key_t);
+        for (g = 0; g < group_count; g ++) {
+            ecs_map_remove_free(&buffers->groups, group_keys[g]);
+        }
+
+        ecs_vec_fini_t(a, &unmatched_groups, ecs_map_key_t);
+#endif
+
+        int32_t i, count = ecs_vec_count(&unmatched);
+        ecs_map_key_t *keys = ecs_vec_first_t(&unmatched, ecs_map_key_t);
+        for (i = 0; i < count; i ++) {
+            ecs_map_remove_free(&buffers->tables, keys[i]);
+        }
+
+        ecs_vec_fini_t(a, &unmatched, ecs_map_key_t);
+    }
+
+#if SOKOL_CLUSTER_INSTANCES
+    if (clustered) {
+        sokol_layout_clusters(geometry, buffers, 
+            ecs_vec_first_t(&clustered_tables, sokol_table_instances_t*),
+            ecs_vec_count(&clustered_tables));
+    }
+    ecs_vec_fini_t(a, &clustered_tables, sokol_table_instances_t*);
+#endif
+
+#if !SOKOL_CULL_INSTANCES
+    sokol_exclude_instances(a, buffers);
+#elif SOKOL_ZERO_COPY_TRANSFORMS
+    sokol_index_table_slots(world, a, buffers);
+#endif
+
+    geometry->stats.uploads_performed ++;
+}
+
+// Copy data of modified tables to instance slots. Each worker gets a slice of
+// every table, and writes to the slots reserved for that slice.
+static
+void sokol_gather_buffers(
+    SokolGeometry *geometry,
+    ecs_world_t *stage,
+    ecs_query_t *query,
+    int32_t stage_id,
+    int32_t stage_count)
+{
+    if (!geometry->solid.gather_count && !geometry->statics.gather_count) {
+        return;
+    }
+
+    // The gather query matches tables of both static and dynamic entities. A
+    // table is stored in the buffers of the query that reserved its slots.
+    ecs_iter_t qit = ecs_query_iter(stage, query);
+    ecs_iter_t wit = ecs_worker_iter(&qit, stage_id, stage_count);
+    while (ecs_worker_next(&wit)) {
+        ecs_map_key_t key = (ecs_map_key_t)(uintptr_t)wit.table;
+        sokol_geometry_buffers_t *buffers = &geometry->solid;
+        sokol_table_instances_t *ti = ecs_map_get_deref(&buffers->tables, 
+            sokol_table_instances_t, key);
+        if (!ti) {
+            buffers = &geometry->statics;
+            ti = ecs_map_get_deref(&buffers->tables, 
+                sokol_table_instances_t, key);
+        }
+        if (!ti || !ti->gather) {
+            continue;
+        }
+
+        // Skip tables that changed after slots were reserved. The change is
+        // picked up the next time buffers are populated.
+        if (ecs_table_count(wit.table) != ti->count) {
+            continue;
+        }
+
+        sokol_gather_instances(geometry, buffers, &wit, ti->offset + wit.offset);
+    }
+}
+
+// System that matches all geometry kinds & reserves instance slots for the
+// tables that have to be copied to GPU buffers.
+static
+void SokolPopulateGeometry(
+    ecs_iter_t *it) 
+{
+    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
+    SokolGeometryQuery *q = ecs_field(it, SokolGeometryQuery, 1);
+
+    int i;
+    for (i = 0; i < it->count; i ++) {
+        ecs_os_zeromem(&g[i].stats);
+        sokol_populate_buffers(&g[i], &g[i].solid, q[i].solid);
+        sokol_populate_buffers(&g[i], &g[i].statics, q[i].statics);
+    }
+}
+
+// System that copies ECS data to instance buffers. Runs on all worker threads,
+// every worker iterates all geometry kinds.
+static
+void SokolGatherGeometry(
+    ecs_iter_t *it) 
+{
+    ecs_world_t *stage = it->world;
+    ecs_query_t *query = it->query;
+    int32_t stage_id = ecs_stage_get_id(stage);
+    int32_t stage_count = ecs_get_stage_count(stage);
+
+    // Work is not divided by geometry entity, so don't use system iterator
+    ecs_iter_fini(it);
+
+    ecs_iter_t qit = ecs_query_iter(stage, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        SokolGeometryQuery *q = ecs_field(&qit, SokolGeometryQuery, 1);
+
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_gather_buffers(&g[i], stage, q[i].gather, 
+                stage_id, stage_count);
+        }
+    }
+}
+
+// System that uploads modified instance data to GPU buffers
+static
+void SokolUploadGeometry(
+    ecs_iter_t *it) 
+{
+    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
+
+    int i;
+    for (i = 0; i < it->count; i ++) {
+        sokol_upload_instances(it->world, &g[i], &g[i].solid);
+        sokol_upload_instances(it->world, &g[i], &g[i].statics);
+        ecs_dbg_3("sokol: geometry %s: %d uploads, %d skipped, "
+            "%d ranges (%d instances) uploaded, %d reallocations", 
+            ecs_get_name(it->world, it->entities[i]),
+            g[i].stats.uploads_performed, g[i].stats.uploads_skipped,
+            g[i].stats.ranges_uploaded, g[i].stats.instances_uploaded,
+            g[i].stats.reallocations);
+    }
+}
+
+#if SOKOL_INSTANCE_RING
+// Number of bytes that buffers append to the instance ring. With culling, the
+// visible instances of each view are appended, which are at most all instances
+// of the buffers per view. Space is reserved for at least the capacity hint.
+static
+int32_t sokol_instance_ring_size(
+    const sokol_geometry_buffers_t *buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, size = 0, views = 1;
+    int32_t count = glm_imax(buffers->instance_count, buffers->capacity_hint);
+#if SOKOL_CULL_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        return 0;
+    }
+    views = SOKOL_MAX_VIEWS;
+#endif
+    for (s = 0; s < l->stream_count; s ++) {
+        // Sokol aligns appended data to 4 bytes
+        size += views * ((count * l->stream_size[s] + 3) & ~3);
+    }
+    return size;
+}
+
+#if !SOKOL_CULL_INSTANCES
+// Append instance data to the instance ring, and store the offsets that are
+// used when binding the streams.
+static
+void sokol_append_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sg_buffer ring)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, count = buffers->instance_count;
+    if (!count) {
+        return;
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        sokol_instance_stream_t *stream = &buffers->streams[s];
+        stream->buffer = ring;
+        stream->offset = sg_append_buffer(ring, &(sg_range) {
+            ecs_vec_first(&stream->data), count * l->stream_size[s] });
+    }
+
+    geometry->stats.ranges_uploaded ++;
+    geometry->stats.instances_uploaded += count;
+}
+#endif
+
+// System that appends the instance data of all geometry kinds to the instance
+// ring. The ring is grown before appending when it's too small for the data
+// of this frame, as the data of a frame must be in the same buffer. With 
+// culling, the ring is only grown here, and the visible instances of both
+// static and dynamic entities are appended when views are uploaded.
+static
+void SokolAppendInstanceRing(
+    ecs_iter_t *it)
+{
+    SokolInstanceRing *ring = ecs_field(it, SokolInstanceRing, 0);
+
+    int32_t size = 0;
+    ecs_iter_t git = ecs_each(it->world, SokolGeometry);
+    while (ecs_each_next(&git)) {
+        SokolGeometry *g = ecs_field(&git, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < git.count; i ++) {
+            size += sokol_instance_ring_size(&g[i].solid);
+#if SOKOL_CULL_INSTANCES
+            size += sokol_instance_ring_size(&g[i].statics);
+#endif
+        }
+    }
+
+    if (size > ring->size) {
+        if (ring->buffer.id) {
+            sg_destroy_buffer(ring->buffer);
+        }
+
+        ecs_dbg_2("sokol: resized instance ring from %d to %d bytes", 
+            ring->size, size + (size >> 1));
+        ring->size = size + (size >> 1);
+        ring->buffer = sg_make_buffer(&(sg_buffer_desc){
+            .size = ring->size, .usage = SG_USAGE_STREAM });
+    }
+
+#if !SOKOL_CULL_INSTANCES
+    if (!size) {
+        return;
+    }
+
+    git = ecs_each(it->world, SokolGeometry);
+    while (ecs_each_next(&git)) {
+        SokolGeometry *g = ecs_field(&git, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < git.count; i ++) {
+            sokol_append_instances(&g[i], &g[i].solid, ring->buffer);
+        }
+    }
+#endif
+}
+#endif
+
+#if SOKOL_CULL_INSTANCES
+// Remove visible instances or clusters with a bounding sphere that is outside
+// of one of the receiver planes.
+static
+void sokol_cull_receivers(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_instance_view_t *view,
+    const vec4 *receivers)
+{
+    int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+    int32_t i, p, count = 0;
+
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    }
+#endif
+
+    for (i = 0; i < view->count; i ++) {
+        const float *s = bounds[visible[i]];
+        for (p = 0; p < 6; p ++) {
+            const float *pl = receivers[p];
+            if ((pl[0] * s[0] + pl[1] * s[1] + pl[2] * s[2] + pl[3]) < -s[3]) {
+                break;
+            }
+        }
+        if (p == 6) {
+            visible[count ++] = visible[i];
+        }
+    }
+
+    geometry->stats.casters_culled += view->count - count;
+    view->count = count;
+}
+
+// Find instances that are visible in view
+static
+void sokol_cull_buffers(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_instance_view_t *view,
+    const vec4 *planes,
+    const vec4 *receivers)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    int32_t count = buffers->instance_count;
+
+#if SOKOL_CLUSTER_INSTANCES
+    // Clusters are tested as a whole, and don't need to be copied
+    if (sokol_instance_clustered(buffers)) {
+        int32_t cluster_count = ecs_vec_count(&buffers->cluster_bounds);
+        ecs_vec_set_count_t(a, &view->visible, int32_t, cluster_count);
+        view->count = 0;
+        if (cluster_count) {
+            view->count = sokol_cull_spheres(
+                ecs_vec_first_t(&view->visible, int32_t), 
+                ecs_vec_first_t(&buffers->cluster_bounds, vec4), 
+                cluster_count, planes);
+        }
+        geometry->stats.clusters_culled += cluster_count - view->count;
+        if (receivers) {
+            sokol_cull_receivers(geometry, buffers, view, receivers);
+        }
+        return;
+    }
+#endif
+
+    ecs_vec_set_count_t(a, &view->visible, int32_t, count);
+    int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    view->count = 0;
+
+#if SOKOL_SPATIAL_INDEX
+    // Only test instances in grid cells that intersect with the frustum
+    view->count = sokol_spatial_cull(&buffers->index, visible, planes, 
+        &geometry->stats.cells_culled);
+#else
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+
+    // Test table bounds first, so that instances of tables that are outside of
+    // the frustum don't have to be tested.
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->count) {
+            continue;
+        }
+
+        // Bounds of tables that changed after gathering are not up to date
+        int32_t table_visible;
+        if (!ti->bounds_dirty && !sokol_cull_spheres(&table_visible, 
+            (const vec4*)&ti->bounds, 1, planes)) 
+        {
+            geometry->stats.tables_culled ++;
+            continue;
+        }
+
+        int32_t *table_slots = &visible[view->count];
+        int32_t i, table_count = sokol_cull_spheres(table_slots, 
+            &bounds[ti->offset], ti->count, planes);
+        for (i = 0; i < table_count; i ++) {
+            table_slots[i] += ti->offset;
+        }
+
+        view->count += table_count;
+    }
+#endif
+
+    geometry->stats.instances_culled += count - view->count;
+
+    if (receivers) {
+        sokol_cull_receivers(geometry, buffers, view, receivers);
+    }
+}
+
+#if SOKOL_LOD
+// Select level of detail from the projected diameter of a bounding sphere.
+// Returns -1 if the sphere is too small to be drawn.
+static
+int32_t sokol_select_lod(
+    const SokolGeometry *geometry,
+    const vec4 sphere,
+    const vec4 w_row,
+    float size_scale)
+{
+    float w = glm_vec3_dot((float*)w_row, (float*)sphere) + w_row[3];
+    if (w <= sphere[3]) {
+        return 0; // Camera is inside or close to the sphere
+    }
+
+    float size = sphere[3] * size_scale / w;
+    if (size < SOKOL_LOD_MIN_SIZE) {
+        return -1;
+    }
+
+    int32_t l;
+    for (l = 0; l < geometry->lod_count - 1; l ++) {
+        if (size >= geometry->lod_sizes[l]) {
+            break;
+        }
+    }
+    return l;
+}
+#endif
+
+// Sort visible instances by level of detail, and within a level store the
+// instances that are excluded from the depth pass last. Instances excluded 
+// from the shadow pass are removed from the shadow view. Clusters are only
+// sorted by level of detail, as exclusion is applied per cluster when drawn.
+// Instances in the camera view that are beyond the impostor distance are 
+// stored after the last level of detail.
+static
+void sokol_bin_view(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t view_index,
+    mat4 mat_vp,
+    float screen_height)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    sokol_instance_view_t *view = &buffers->views[view_index];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    const uint8_t *exclude = ecs_vec_first_t(&buffers->exclude, uint8_t);
+    bool clustered = sokol_instance_clustered(buffers);
+    int32_t bins[SOKOL_MAX_VIEW_LODS * 2] = {0};
+    int32_t i, l, count = view->count;
+
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+#if SOKOL_CLUSTER_INSTANCES
+    if (clustered) {
+        bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    }
+#endif
+
+    // The distance from the camera is the w component in clip space
+    vec4 w_row = { mat_vp[0][3], mat_vp[1][3], mat_vp[2][3], mat_vp[3][3] };
+    float depth = FLT_MAX;
+
+#if SOKOL_LOD
+    // The projected diameter in pixels is radius * size_scale / w, where the
+    // length of the y row of the view projection matrix is the vertical scale
+    // of the projection.
+    vec3 y_row = { mat_vp[0][1], mat_vp[1][1], mat_vp[2][1] };
+    float size_scale = glm_vec3_norm(y_row) * screen_height;
+#else
+    (void)screen_height;
+#endif
+
+#if SOKOL_IMPOSTORS
+    // Clusters are drawn from the instance buffers, and shadows are cast by
+    // the instance geometry, so neither uses impostors.
+    float impostor_distance = 0;
+    if (!clustered && view_index == SOKOL_VIEW_CAMERA) {
+        impostor_distance = geometry->impostor_distance;
+    }
+#endif
+
+    ecs_vec_set_count_t(a, &view->bins, int8_t, count);
+    int8_t *elem_bins = ecs_vec_first_t(&view->bins, int8_t);
+
+    for (i = 0; i < count; i ++) {
+        int32_t elem = visible[i], bin = 0;
+
+#if SOKOL_LOD
+        bin = sokol_select_lod(geometry, bounds[elem], w_row, size_scale);
+        if (bin == -1) {
+            elem_bins[i] = -1;
+            geometry->stats.instances_small ++;
+            continue;
+        }
+#endif
+
+        float w = glm_vec3_dot((float*)w_row, (float*)bounds[elem]) + 
+            w_row[3];
+
+#if SOKOL_IMPOSTORS
+        if (impostor_distance > 0 && w > impostor_distance) {
+            bin = SOKOL_LOD_IMPOSTOR;
+            geometry->stats.impostors ++;
+        }
+#endif
+
+        bin *= 2;
+
+        if (!clustered) {
+            if (view_index == SOKOL_VIEW_SHADOW) {
+                if (exclude[elem] & (1u << SOKOL_PASS_SHADOW)) {
+                    elem_bins[i] = -1;
+                    continue;
+                }
+            } else if (exclude[elem] & (1u << SOKOL_PASS_DEPTH)) {
+                bin ++;
+            }
+        }
+
+        elem_bins[i] = (int8_t)bin;
+        bins[bin] ++;
+        depth = glm_min(depth, w - bounds[elem][3]);
+    }
+
+    // Convert bin counts to offsets, and store ranges per level of detail
+    int32_t offset = 0;
+    for (l = 0; l < SOKOL_MAX_VIEW_LODS; l ++) {
+        sokol_instance_lod_t *lod = &view->lods[l];
+        lod->offset = offset;
+        lod->depth_count = bins[l * 2];
+        lod->count = bins[l * 2] + bins[l * 2 + 1];
+        bins[l * 2] = offset;
+        bins[l * 2 + 1] = offset + lod->depth_count;
+        offset += lod->count;
+    }
+
+    ecs_vec_set_count_t(a, &view->sorted, int32_t, offset);
+    int32_t *sorted = ecs_vec_first_t(&view->sorted, int32_t);
+    for (i = 0; i < count; i ++) {
+        int32_t bin = elem_bins[i];
+        if (bin != -1) {
+            sorted[bins[bin] ++] = visible[i];
+        }
+    }
+
+    // Sorted elements become the visible elements
+    ecs_vec_t tmp = view->visible;
+    view->visible = view->sorted;
+    view->sorted = tmp;
+    view->count = offset;
+    view->depth = glm_max(depth, 0);
+}
+
+#if SOKOL_OCCLUSION_CULLING || SOKOL_IMPOSTORS
+// Get instance transform, including geometry scaling. Returns false if the
+// transform is read from a table that changed after it was populated.
+static
+bool sokol_instance_transform(
+    sokol_geometry_buffers_t *buffers,
+    int32_t slot,
+    mat4 dst)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    const float *src;
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    if (!sokol_instance_stream_staged(buffers, l->transform.stream)) {
+        src = (const float*)sokol_column_transform(buffers, slot, NULL);
+        if (!src) {
+            return false;
+        }
+    } else
+#endif
+    {
+        src = sokol_instance_ptr(buffers, &l->transform, slot);
+    }
+
+#if SOKOL_COMPACT_TRANSFORMS
+    int32_t r, c;
+    for (c = 0; c < 4; c ++) {
+        for (r = 0; r < 3; r ++) {
+            dst[c][r] = src[r * 4 + c];
+        }
+        dst[c][3] = c == 3 ? 1.0f : 0.0f;
+    }
+#else
+    glm_mat4_copy((vec4*)src, dst);
+#endif
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    // Geometry scaling is stored separately, and applied like the shader does
+    const float *scale = sokol_instance_ptr(buffers, &l->scale, slot);
+    glm_vec4_scale(dst[0], scale[0], dst[0]);
+    glm_vec4_scale(dst[1], scale[1], dst[1]);
+    glm_vec4_scale(dst[2], scale[2], dst[2]);
+#endif
+
+    return true;
+}
+#endif
+
+#if SOKOL_IMPOSTORS
+// Write transform in the instance layout
+static
+void sokol_write_transform(
+    float *dst,
+    mat4 src)
+{
+#if SOKOL_COMPACT_TRANSFORMS
+    int32_t r, c;
+    for (r = 0; r < 3; r ++) {
+        for (c = 0; c < 4; c ++) {
+            dst[r * 4 + c] = src[c][r];
+        }
+    }
+#else
+    ecs_os_memcpy(dst, src, sizeof(mat4));
+#endif
+}
+
+// Replace transforms of impostors in the view stream with transforms of quads
+// that face the camera. A quad covers the extents of its instance along the 
+// camera axes, and is moved to the front of the instance so that it isn't
+// hidden by instances it overlaps with. The normal of the quad points away
+// from the camera, so that it's lit like the instance face facing the camera.
+static
+void sokol_write_impostors(
+    sokol_geometry_buffers_t *buffers,
+    const sokol_instance_view_t *view,
+    void *dst,
+    mat4 mat_v)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    const sokol_instance_lod_t *range = &view->lods[SOKOL_LOD_IMPOSTOR];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    ecs_size_t size = l->stream_size[l->transform.stream];
+    vec3 eye, right, up;
+    int32_t i, k;
+
+    // Camera axes are the rows of the view matrix, and the camera position is
+    // the inverse rotation applied to the negated view translation.
+    for (k = 0; k < 3; k ++) {
+        right[k] = mat_v[k][0];
+        up[k] = mat_v[k][1];
+        eye[k] = -(mat_v[3][0] * mat_v[k][0] + mat_v[3][1] * mat_v[k][1] + 
+            mat_v[3][2] * mat_v[k][2]);
+    }
+
+    for (i = range->offset; i < range->offset + range->count; i ++) {
+        mat4 m, quad;
+        vec3 forward;
+        float ext[3];
+        if (!sokol_instance_transform(buffers, visible[i], m)) {
+            // Degenerate transform, which doesn't render anything
+            ecs_os_memset(ECS_OFFSET(ECS_ELEM(dst, size, i), 
+                l->transform.offset), 0, ECS_SIZEOF(sokol_transform_t));
+            continue;
+        }
+
+        glm_vec3_sub(m[3], eye, forward);
+        glm_vec3_normalize(forward);
+
+        // Half extents of the transformed unit geometry along camera axes
+        const float *axes[3] = { right, up, forward };
+        for (k = 0; k < 3; k ++) {
+            ext[k] = 0.5f * (fabsf(glm_vec3_dot(m[0], (float*)axes[k])) +
+                fabsf(glm_vec3_dot(m[1], (float*)axes[k])) + 
+                fabsf(glm_vec3_dot(m[2], (float*)axes[k])));
+        }
+
+        glm_vec3_scale(right, ext[0] * 2, quad[0]);
+        glm_vec3_scale(up, ext[1] * 2, quad[1]);
+        glm_vec3_copy(forward, quad[2]);
+        glm_vec3_scale(forward, -ext[2], quad[3]);
+        glm_vec3_add(quad[3], m[3], quad[3]);
+        quad[0][3] = quad[1][3] = quad[2][3] = 0;
+        quad[3][3] = 1;
+
+        sokol_write_transform(ECS_OFFSET(ECS_ELEM(dst, size, i), 
+            l->transform.offset), quad);
+    }
+}
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+// Impostor quads are written with their final size, so reset the geometry 
+// scaling of impostors in the view stream.
+static
+void sokol_write_impostor_scales(
+    const sokol_instance_view_t *view,
+    void *dst)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    const sokol_instance_lod_t *range = &view->lods[SOKOL_LOD_IMPOSTOR];
+    ecs_size_t size = l->stream_size[l->scale.stream];
+    int32_t i;
+
+    for (i = range->offset; i < range->offset + range->count; i ++) {
+        float *scale = ECS_OFFSET(ECS_ELEM(dst, size, i), l->scale.offset);
+        scale[0] = scale[1] = scale[2] = 1.0f;
+    }
+}
+#endif
+#endif
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+// Upload transforms of visible instances from the EcsTransform3 table columns.
+// Runs of visible instances that are stored consecutively in a table column 
+// are uploaded directly from the column, other transforms are copied to the 
+// view stream and uploaded in between runs. Impostors are always copied, as
+// their transforms are replaced with the transforms of camera facing quads.
+static
+void sokol_upload_view_columns(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_instance_view_t *view,
+    void *dst,
+    mat4 mat_v)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    sokol_instance_stream_t *stream = &view->streams[l->transform.stream];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    ecs_size_t size = l->stream_size[l->transform.stream];
+    int32_t i = 0, staged = 0, end = view->count;
+
+#if SOKOL_IMPOSTORS
+    if (mat_v && view->lods[SOKOL_LOD_IMPOSTOR].count) {
+        end = view->lods[SOKOL_LOD_IMPOSTOR].offset;
+    }
+#endif
+
+    while (i < view->count) {
+        int32_t slot = visible[i], run = 0, count = 1;
+        const EcsTransform3 *src = sokol_column_transform(buffers, slot, &run);
+        if (!src) {
+            ecs_os_memset(ECS_ELEM(dst, size, i), 0, size);
+            i ++;
+            continue;
+        }
+
+        while (count < run && (i + count) < view->count && 
+            visible[i + count] == (slot + count)) 
+        {
+            count ++;
+        }
+
+        if (count >= SOKOL_INSTANCE_COLUMN_RUN && (i + count) <= end) {
+            if (i > staged) {
+                sg_update_buffer_range(stream->buffer, staged * size, 
+                    &(sg_range) { ECS_ELEM(dst, size, staged), 
+                        (i - staged) * size });
+            }
+            sg_update_buffer_range(stream->buffer, i * size, 
+                &(sg_range) { src, count * size });
+            geometry->stats.ranges_uploaded ++;
+            staged = i + count;
+        } else {
+            ecs_os_memcpy(ECS_ELEM(dst, size, i), src, count * size);
+        }
+
+        i += count;
+    }
+
+#if SOKOL_IMPOSTORS
+    if (end != view->count) {
+        sokol_write_impostors(buffers, view, dst, mat_v);
+    }
+#else
+    (void)mat_v;
+#endif
+
+    if (view->count > staged) {
+        sg_update_buffer_range(stream->buffer, staged * size, &(sg_range) { 
+            ECS_ELEM(dst, size, staged), (view->count - staged) * size });
+    }
+}
+#endif
+
+// Copy visible instances to the view buffers and upload them to the GPU. The
+// view matrix is used to orient impostors, and may be NULL for views without
+// impostors. When the ring is set, visible instances are appended to the ring
+// instead of uploaded to buffers owned by the view.
+static
+void sokol_upload_view(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t view_index,
+    mat4 mat_v,
+    sg_buffer ring)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    ecs_allocator_t *a = geometry->allocator;
+    sokol_instance_view_t *view = &buffers->views[view_index];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    int32_t i, s;
+
+    // Clusters are drawn from the instance buffers
+    if (sokol_instance_clustered(buffers) || !view->count) {
+        return;
+    }
+
+    // Grow buffers if the visible set doesn't fit
+    bool realloc = !ring.id && view->count > view->buffer_size;
+    if (realloc) {
+        view->buffer_size = sokol_instance_buffer_capacity(
+            view->buffer_size, view->count, buffers->capacity_hint);
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        sokol_instance_stream_t *stream = &view->streams[s];
+        ecs_size_t size = l->stream_size[s];
+        ecs_vec_set_count(a, &stream->data, size, view->count);
+        void *dst = ecs_vec_first(&stream->data);
+
+        if (realloc) {
+            if (stream->buffer.id) {
+                sg_destroy_buffer(stream->buffer);
+            }
+            stream->buffer = sg_make_buffer(&(sg_buffer_desc){
+                .size = view->buffer_size * size, 
+                .usage = SG_USAGE_DYNAMIC });
+        }
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        if (!sokol_instance_stream_staged(buffers, s)) {
+            sokol_upload_view_columns(geometry, buffers, view, dst, mat_v);
+            continue;
+        }
+#endif
+
+        const void *src = ecs_vec_first(&buffers->streams[s].data);
+        for (i = 0; i < view->count; i ++) {
+            ecs_os_memcpy(ECS_ELEM(dst, size, i), 
+                ECS_ELEM(src, size, visible[i]), size);
+        }
+
+#if SOKOL_IMPOSTORS
+        if (s == l->transform.stream && mat_v && 
+            view->lods[SOKOL_LOD_IMPOSTOR].count) 
+        {
+            sokol_write_impostors(buffers, view, dst, mat_v);
+        }
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        if (s == l->scale.stream && mat_v && 
+            view->lods[SOKOL_LOD_IMPOSTOR].count) 
+        {
+            sokol_write_impostor_scales(view, dst);
+        }
+#endif
+#else
+        (void)mat_v;
+#endif
+
+        if (ring.id) {
+            stream->buffer = ring;
+            stream->offset = sg_append_buffer(ring, &(sg_range) { 
+                dst, view->count * size });
+            continue;
+        }
+
+        sg_update_buffer(stream->buffer, &(sg_range) { 
+            dst, view->count * size });
+    }
+
+    geometry->stats.instances_uploaded += view->count;
+}
+
+#if SOKOL_OCCLUSION_CULLING
+// Add visible instance to occluder candidates if it's large enough on screen
+static
+void sokol_select_occluder(
+    SokolOcclusion *occ,
+    sokol_geometry_buffers_t *buffers,
+    int32_t slot)
+{
+    const float *sphere = *ecs_vec_get_t(&buffers->bounds, vec4, slot);
+    if (sphere[3] < occ->desc.min_radius) {
+        return;
+    }
+
+    // Distance from camera is the w component of the clip space position
+    mat4 *mat_vp = &occ->buffer.mat_vp;
+    float w = (*mat_vp)[0][3] * sphere[0] + (*mat_vp)[1][3] * sphere[1] + 
+        (*mat_vp)[2][3] * sphere[2] + (*mat_vp)[3][3];
+    if (w <= 0) {
+        return;
+    }
+
+    float size = sphere[3] / w;
+    if (size < occ->desc.min_screen_size) {
+        return;
+    }
+
+    sokol_occluder_t *o = ecs_vec_append_t(NULL, &occ->occluders, 
+        sokol_occluder_t);
+    o->buffers = buffers;
+    o->slot = slot;
+    o->size = size;
+}
+
+static
+void sokol_select_occluders(
+    SokolOcclusion *occ,
+    sokol_geometry_buffers_t *buffers)
+{
+    const sokol_instance_view_t *view = &buffers->views[SOKOL_VIEW_CAMERA];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    int32_t i;
+
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        const sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+            &buffers->clusters, sokol_instance_cluster_t);
+        for (i = 0; i < view->count; i ++) {
+            const sokol_instance_cluster_t *cluster = &clusters[visible[i]];
+            int32_t slot;
+            for (slot = cluster->offset; 
+                slot < (cluster->offset + cluster->count); slot ++) 
+            {
+                sokol_select_occluder(occ, buffers, slot);
+            }
+        }
+        return;
+    }
+#endif
+
+    for (i = 0; i < view->count; i ++) {
+        sokol_select_occluder(occ, buffers, visible[i]);
+    }
+}
+
+static
+int sokol_compare_occluders(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const sokol_occluder_t *o1 = ptr1, *o2 = ptr2;
+    return (o1->size < o2->size) - (o1->size > o2->size);
+}
+
+// Remove visible instances (or clusters) that are hidden behind occluders
+static
+void sokol_occlude_buffers(
+    SokolOcclusion *occ,
+    sokol_geometry_buffers_t *buffers)
+{
+    sokol_instance_view_t *view = &buffers->views[SOKOL_VIEW_CAMERA];
+    int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+    int32_t i, count = 0;
+
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    }
+#endif
+
+    for (i = 0; i < view->count; i ++) {
+        if (sokol_occlusion_test_sphere(&occ->buffer, bounds[visible[i]])) {
+            visible[count ++] = visible[i];
+        }
+    }
+
+    occ->stats.tested += view->count;
+    occ->stats.occluded += view->count - count;
+    view->count = count;
+}
+
+// Draw occluders to the occlusion buffer and remove hidden instances from the
+// camera view. 
+static
+void sokol_occlude_instances(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    mat4 mat_vp)
+{
+    SokolOcclusion *occ = ecs_singleton_ensure(world, SokolOcclusion);
+    if (!occ->buffer.depth) {
+        sokol_occlusion_init(&occ->buffer, 
+            SOKOL_OCCLUSION_WIDTH, SOKOL_OCCLUSION_HEIGHT);
+    }
+
+    ecs_os_zeromem(&occ->stats);
+    ecs_vec_clear(&occ->occluders);
+    sokol_occlusion_clear(&occ->buffer, mat_vp);
+
+    ecs_iter_t qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            if (g[i].occluder) {
+                sokol_select_occluders(occ, &g[i].solid);
+                sokol_select_occluders(occ, &g[i].statics);
+            }
+        }
+    }
+
+    sokol_occluder_t *occluders = ecs_vec_first_t(
+        &occ->occluders, sokol_occluder_t);
+    int32_t i, count = ecs_vec_count(&occ->occluders);
+    if (!count) {
+        return;
+    }
+
+    qsort(occluders, (size_t)count, sizeof(sokol_occluder_t), 
+        sokol_compare_occluders);
+    if (count > occ->desc.max_occluders) {
+        count = occ->desc.max_occluders;
+    }
+
+    for (i = 0; i < count; i ++) {
+        mat4 transform;
+        if (sokol_instance_transform(occluders[i].buffers, occluders[i].slot, 
+            transform)) 
+        {
+            sokol_occlusion_draw_box(&occ->buffer, transform);
+        }
+    }
+
+    sokol_occlusion_finish(&occ->buffer);
+    occ->stats.occluders = count;
+
+    qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        for (i = 0; i < qit.count; i ++) {
+            sokol_occlude_buffers(occ, &g[i].solid);
+            sokol_occlude_buffers(occ, &g[i].statics);
+        }
+    }
+}
+#endif
+
+// Cull instances against planes, and optionally against receiver planes.
+// Visible instances are sorted by level of detail and uploaded to the view 
+// buffers.
+static
+void sokol_cull_view(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    int32_t view,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float screen_height,
+    const vec4 *planes,
+    const vec4 *receivers)
+{
+    sg_buffer ring = {0};
+#if SOKOL_INSTANCE_RING
+    ring = ecs_singleton_get(world, SokolInstanceRing)->buffer;
+#endif
+
+    ecs_iter_t qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_cull_buffers(&g[i], &g[i].solid, 
+                &g[i].solid.views[view], planes, receivers);
+            sokol_cull_buffers(&g[i], &g[i].statics, 
+                &g[i].statics.views[view], planes, receivers);
+        }
+    }
+
+#if SOKOL_OCCLUSION_CULLING
+    if (view == SOKOL_VIEW_CAMERA) {
+        sokol_occlude_instances(world, query, mat_vp);
+    }
+#endif
+
+    qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_bin_view(&g[i], &g[i].solid, view, mat_vp, screen_height);
+            sokol_bin_view(&g[i], &g[i].statics, view, mat_vp, screen_height);
+            sokol_upload_view(&g[i], &g[i].solid, view, mat_v, ring);
+            sokol_upload_view(&g[i], &g[i].statics, view, mat_v, ring);
+        }
+    }
+}
+
+void sokol_cull_instances(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    int32_t view,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float screen_height)
+{
+    ecs_assert(view >= 0 && view < SOKOL_MAX_VIEWS, ECS_INVALID_PARAMETER, NULL);
+
+    vec4 planes[6];
+    glm_frustum_planes(mat_vp, planes);
+    sokol_cull_view(world, query, view, mat_vp, mat_v, screen_height, 
+        (const vec4*)planes, NULL);
+}
+
+void sokol_cull_shadow_casters(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    mat4 light_mat_vp,
+    mat4 camera_mat_vp,
+    vec3 light_dir)
+{
+    vec4 planes[6], receivers[6];
+    int32_t p;
+
+    // Casters between the light and the light volume cast shadows into the
+    // volume, so the near plane of the light volume is not tested.
+    glm_frustum_planes(light_mat_vp, planes);
+    glm_vec4_copy((vec4){ 0, 0, 0, FLT_MAX }, planes[GLM_NEAR]);
+
+    // A shadow reaches the camera frustum only if the caster, swept along the
+    // light direction, is inside every camera plane. Planes that face the 
+    // light direction are always crossed by the sweep.
+    glm_frustum_planes(camera_mat_vp, receivers);
+    for (p = 0; p < 6; p ++) {
+        if (glm_vec3_dot(receivers[p], light_dir) > 0) {
+            glm_vec4_copy((vec4){ 0, 0, 0, FLT_MAX }, receivers[p]);
+        }
+    }
+
+    sokol_cull_view(world, query, SOKOL_VIEW_SHADOW, light_mat_vp, NULL,
+        SOKOL_SHADOW_MAP_SIZE, (const vec4*)planes, (const vec4*)receivers);
+}
+#endif
+
+static
+void CreateGeometryQueries(ecs_iter_t *it) {
+    ecs_world_t *world = it->world;
+    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
+    SokolGeometryQuery *gq = ecs_field(it, SokolGeometryQuery, 1);
+    const SokolImpostorMesh *impostor = ecs_singleton_get(
+        world, SokolImpostorMesh);
+
+    int i;
+    for (i = 0; i < it->count; i ++) {
+        // Geometries that are created before the renderer is initialized get
+        // the impostor quad from sokol_init_geometry.
+        if (impostor) {
+            g[i].impostor = impostor->mesh;
+        }
+
+        // Geometry query that includes all components that are copied (or used
+        // to find data to copy) to GPU buffers. All terms are marked [in] so
+        // that writes to them are picked up by query change detection.
+        ecs_query_desc_t desc = {
+            .terms = {{
+                .id        = ecs_id(EcsTransform3), 
+                .src.id    = EcsSelf,
+                .inout     = EcsIn
+            }, {
+                .id        = ecs_id(EcsRgb),
+                .inout     = EcsIn
+            }, {
+                .id        = ecs_id(EcsEmissive),
+                .inout     = EcsIn,
+                .oper      = EcsOptional
+            }, {
+                .id        = ecs_id(EcsSpecular),
+                .inout     = EcsIn,
+                .oper      = EcsOptional
+            }, {
+                .id        = gq[i].component, 
+                .inout     = EcsIn
+            }, {
+                .id        = SokolStatic,
+                .oper      = EcsNot
+            }},
+            .cache_kind = EcsQueryCacheAuto,
+            .flags = EcsQueryDetectChanges
+        };
+
+        /* Query for solid objects */
+        desc.entity = ecs_entity(world, {
+            .name = ecs_get_name(world, gq[i].component),
+            .parent = ecs_entity(world, {
+                .name = "#0.flecs.systems.sokol.geometry_queries.solid"
+            })
+        });
+
+        gq[i].solid = ecs_query_init(world, &desc);
+        if (!gq[i].solid) {
+            char *component_str = ecs_id_str(world, gq[i].component);
+            ecs_err("sokol: failed to create query for solid %s geometry", 
+                component_str);
+            ecs_os_free(component_str);
+        }
+
+        /* Query for static objects. Tables are grouped by cluster, so that
+         * instances of a cluster are stored in a contiguous range. */
+        desc.terms[5].oper = EcsAnd;
+#if SOKOL_CLUSTER_INSTANCES
+        desc.group_by = SokolCluster;
+#endif
+        desc.entity = ecs_entity(world, {
+            .name = ecs_get_name(world, gq[i].component),
+            .parent = ecs_entity(world, {
+                .name = "#0.flecs.systems.sokol.geometry_queries.static"
+            })
+        });
+
+        gq[i].statics = ecs_query_init(world, &desc);
+        if (!gq[i].statics) {
+            char *component_str = ecs_id_str(world, gq[i].component);
+            ecs_err("sokol: failed to create query for static %s geometry", 
+                component_str);
+            ecs_os_free(component_str);
+        }
+
+        /* Query used by worker threads to copy data to buffers. Does not
+         * detect changes, as that would reset change state of tables. Matches
+         * both static and dynamic objects. */
+        desc.terms[5] = (ecs_term_t){0};
+        desc.flags = 0;
+        desc.group_by = 0;
+        desc.entity = ecs_entity(world, {
+            .name = ecs_get_name(world, gq[i].component),
+            .parent = ecs_entity(world, {
+                .name = "#0.flecs.systems.sokol.geometry_queries.gather"
+            })
+        });
+
+        gq[i].gather = ecs_query_init(world, &desc);
+        if (!gq[i].gather) {
+            char *component_str = ecs_id_str(world, gq[i].component);
+            ecs_err("sokol: failed to create gather query for %s geometry", 
+                component_str);
+            ecs_os_free(component_str);
+        }
+    }
+}
+
+// Find geometry for a geometry component (like EcsBox)
+static
+SokolGeometry* sokol_find_geometry(
+    ecs_world_t *world,
+    ecs_entity_t component)
+{
+    ecs_iter_t it = ecs_each(world, SokolGeometryQuery);
+    while (ecs_each_next(&it)) {
+        SokolGeometryQuery *q = ecs_field(&it, SokolGeometryQuery, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (q[i].component == component) {
+                SokolGeometry *g = ecs_get_mut(
+                    world, it.entities[i], SokolGeometry);
+                ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+                ecs_iter_fini(&it);
+                return g;
+            }
+        }
+    }
+
+    char *component_str = ecs_id_str(world, component);
+    ecs_err("sokol: no geometry for component %s", component_str);
+    ecs_os_free(component_str);
+    return NULL;
+}
+
+void sokol_geometry_capacity_hint(
+    ecs_world_t *world,
+    ecs_entity_t component,
+    int32_t count,
+    int32_t static_count)
+{
+    SokolGeometry *g = sokol_find_geometry(world, component);
+    if (g) {
+        g->solid.capacity_hint = count;
+        g->statics.capacity_hint = static_count;
+    }
+}
+
+void sokol_geometry_impostor_distance(
+    ecs_world_t *world,
+    ecs_entity_t component,
+    float distance)
+{
+#if SOKOL_IMPOSTORS
+    ecs_assert(distance >= 0, ECS_INVALID_PARAMETER, NULL);
+    SokolGeometry *g = sokol_find_geometry(world, component);
+    if (g) {
+        g->impostor_distance = distance;
+    }
+#else
+    (void)world;
+    (void)component;
+    (void)distance;
+    ecs_err("sokol: impostors require SOKOL_IMPOSTORS");
+#endif
+}
+
+static
+void sokol_geometry_stats_add(
+    sokol_geometry_stats_t *dst,
+    const sokol_geometry_stats_t *src)
+{
+    dst->uploads_performed += src->uploads_performed;
+    dst->uploads_skipped += src->uploads_skipped;
+    dst->ranges_uploaded += src->ranges_uploaded;
+    dst->instances_uploaded += src->instances_uploaded;
+    dst->compactions += src->compactions;
+    dst->reallocations += src->reallocations;
+    dst->instances_culled += src->instances_culled;
+    dst->tables_culled += src->tables_culled;
+    dst->cells_culled += src->cells_culled;
+    dst->clusters_culled += src->clusters_culled;
+    dst->casters_culled += src->casters_culled;
+    dst->instances_small += src->instances_small;
+    dst->impostors += src->impostors;
+}
+
+void sokol_geometry_get_stats(
+    const ecs_world_t *world,
+    ecs_entity_t component,
+    sokol_geometry_stats_t *stats)
+{
+    ecs_os_zeromem(stats);
+
+    ecs_iter_t it = ecs_each(world, SokolGeometryQuery);
+    while (ecs_each_next(&it)) {
+        SokolGeometryQuery *q = ecs_field(&it, SokolGeometryQuery, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (component && q[i].component != component) {
+                continue;
+            }
+
+            const SokolGeometry *g = ecs_get(
+                world, it.entities[i], SokolGeometry);
+            if (g) {
+                sokol_geometry_stats_add(stats, &g->stats);
+            }
+        }
+    }
+}
+
+void sokol_query_sphere(
+    const ecs_world_t *world,
+    const float *center,
+    float radius,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+#if SOKOL_SPATIAL_INDEX
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (!sokol_spatial_overlap_sphere(&g[i].solid.index, center, 
+                    radius, callback, ctx) || 
+                !sokol_spatial_overlap_sphere(&g[i].statics.index, center, 
+                    radius, callback, ctx))
+            {
+                ecs_iter_fini(&it);
+                return;
+            }
+        }
+    }
+#else
+    (void)world; (void)center; (void)radius; (void)callback; (void)ctx;
+    ecs_err("sokol: spatial queries require SOKOL_SPATIAL_INDEX");
+#endif
+}
+
+void sokol_query_box(
+    const ecs_world_t *world,
+    const float *min,
+    const float *max,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+#if SOKOL_SPATIAL_INDEX
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (!sokol_spatial_overlap_box(&g[i].solid.index, min, max, 
+                    callback, ctx) || 
+                !sokol_spatial_overlap_box(&g[i].statics.index, min, max, 
+                    callback, ctx))
+            {
+                ecs_iter_fini(&it);
+                return;
+            }
+        }
+    }
+#else
+    (void)world; (void)min; (void)max; (void)callback; (void)ctx;
+    ecs_err("sokol: spatial queries require SOKOL_SPATIAL_INDEX");
+#endif
+}
+
+ecs_entity_t sokol_raycast(
+    const ecs_world_t *world,
+    const float *origin,
+    const float *direction,
+    float max_distance,
+    float *distance)
+{
+#if SOKOL_SPATIAL_INDEX
+    vec3 dir;
+    glm_vec3_normalize_to((float*)direction, dir);
+
+    ecs_entity_t result = 0;
+    float hit = max_distance;
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            ecs_entity_t e = sokol_spatial_raycast(
+                &g[i].solid.index, origin, dir, &hit);
+            result = e ? e : result;
+            e = sokol_spatial_raycast(
+                &g[i].statics.index, origin, dir, &hit);
+            result = e ? e : result;
+        }
+    }
+
+    if (result && distance) {
+        *distance = hit;
+    }
+    return result;
+#else
+    (void)world; (void)origin; (void)direction; (void)max_distance; 
+    (void)distance;
+    ecs_err("sokol: spatial queries require SOKOL_SPATIAL_INDEX");
+    return 0;
+#endif
+}
+
+void sokol_occlusion_set_desc(
+    ecs_world_t *world,
+    const sokol_occlusion_desc_t *desc)
+{
+#if SOKOL_OCCLUSION_CULLING
+    SokolOcclusion *occ = ecs_singleton_ensure(world, SokolOcclusion);
+    occ->desc = *desc;
+#else
+    (void)world; (void)desc;
+    ecs_err("sokol: occlusion culling requires SOKOL_OCCLUSION_CULLING");
+#endif
+}
+
+void sokol_occlusion_get_stats(
+    const ecs_world_t *world,
+    sokol_occlusion_stats_t *stats)
+{
+#if SOKOL_OCCLUSION_CULLING
+    const SokolOcclusion *occ = ecs_singleton_get(world, SokolOcclusion);
+    if (occ) {
+        *stats = occ->stats;
+        return;
+    }
+#else
+    (void)world;
+#endif
+    ecs_os_zeromem(stats);
+}
+
+void FlecsSystemsSokolGeometryImport(
+    ecs_world_t *world)
+{
+    ECS_MODULE(world, FlecsSystemsSokolGeometry);
+    ECS_IMPORT(world, FlecsComponentsTransform);
+    ECS_IMPORT(world, FlecsComponentsGeometry);
+    ECS_IMPORT(world, FlecsSystemsTransform);
+    ECS_IMPORT(world, FlecsGame);
+
+    sokol_init_kernels();
+
+    /* Store components in parent sokol scope */
+    ecs_entity_t parent = ecs_lookup(world, "flecs.systems.sokol");
+    ecs_entity_t module = ecs_set_scope(world, parent);
+    ecs_set_name_prefix(world, "Sokol");
+
+    ECS_COMPONENT_DEFINE(world, SokolGeometry);
+    ECS_COMPONENT_DEFINE(world, SokolGeometryQuery);
+    ECS_COMPONENT_DEFINE(world, SokolImpostorMesh);
+    ECS_TAG_DEFINE(world, SokolStatic);
+    ECS_TAG_DEFINE(world, SokolCluster);
+    ECS_TAG_DEFINE(world, SokolNoShadow);
+    ECS_TAG_DEFINE(world, SokolNoDepthPrepass);
+    ECS_COMPONENT_DEFINE(world, SokolSphere);
+    ECS_COMPONENT_DEFINE(world, SokolCylinder);
+    ECS_COMPONENT_DEFINE(world, SokolCone);
+#if SOKOL_INSTANCE_RING
+    ECS_COMPONENT_DEFINE(world, SokolInstanceRing);
+#endif
+
+    ecs_set_hooks(world, SokolGeometry, {
+        .ctor = ecs_ctor(SokolGeometry),
+        .move = ecs_move(SokolGeometry),
+        .dtor = ecs_dtor(SokolGeometry)
+    });
+
+#if SOKOL_OCCLUSION_CULLING
+    ECS_COMPONENT_DEFINE(world, SokolOcclusion);
+    ecs_set_hooks(world, SokolOcclusion, {
+        .ctor = ecs_ctor(SokolOcclusion),
+        .move = ecs_move(SokolOcclusion),
+        .dtor = ecs_dtor(SokolOcclusion)
+    });
+    ecs_singleton_set(world, SokolOcclusion, {
+        .desc = {
+            .min_radius = 2.0f,
+            .min_screen_size = 0.05f,
+            .max_occluders = 64
+        }
+    });
+#endif
+
+    ecs_set_scope(world, module);
+
+    /* Create queries for solid objects */
+    ECS_OBSERVER(world, CreateGeometryQueries, EcsOnSet, 
+        Geometry, GeometryQuery);
+
+    /* Support for rectangle primitive */
+    ECS_ENTITY_DEFINE(world, SokolRectangleGeometry, Geometry);
+        ecs_set(world, SokolRectangleGeometry, SokolGeometryQuery, {
+            .component = ecs_id(EcsRectangle)
+        });
+
+    /* Support for box primitive */
+    ECS_ENTITY_DEFINE(world, SokolBoxGeometry, Geometry);
+        ecs_set(world, SokolBoxGeometry, SokolGeometryQuery, {
+            .component = ecs_id(EcsBox)
+        });
+
+    /* Support for procedural primitives */
+    ECS_ENTITY_DEFINE(world, SokolSphereGeometry, Geometry);
+        ecs_set(world, SokolSphereGeometry, SokolGeometryQuery, {
+            .component = ecs_id(SokolSphere)
+        });
+
+    ECS_ENTITY_DEFINE(world, SokolCylinderGeometry, Geometry);
+        ecs_set(world, SokolCylinderGeometry, SokolGeometryQuery, {
+            .component = ecs_id(SokolCylinder)
+        });
+
+    ECS_ENTITY_DEFINE(world, SokolConeGeometry, Geometry);
+        ecs_set(world, SokolConeGeometry, SokolGeometryQuery, {
+            .component = ecs_id(SokolCone)
+        });
+
+    /* Create systems that manage buffers */
+    ECS_SYSTEM(world, SokolPopulateGeometry, EcsPreStore, 
+        Geometry, [in] GeometryQuery);
+
+    /* Copying data to instance buffers is divided over worker threads */
+    ecs_system(world, {
+        .entity = ecs_entity(world, {
+            .name = "SokolGatherGeometry",
+            .add = ecs_ids( ecs_dependson(EcsPreStore) )
+        }),
+        .query.terms = {
+            { .id = ecs_id(SokolGeometry) },
+            { .id = ecs_id(SokolGeometryQuery), .inout = EcsIn }
+        },
+        .run = SokolGatherGeometry,
+        .multi_threaded = true
+    });
+
+    ECS_SYSTEM(world, SokolUploadGeometry, EcsPreStore, 
+        Geometry);
+
+#if SOKOL_INSTANCE_RING
+    /* Appending data to the instance ring for all geometry kinds */
+    ECS_SYSTEM(world, SokolAppendInstanceRing, EcsPreStore, 
+        flecs.systems.sokol.InstanceRing($));
+#endif
+}
+
+#include <float.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SOKOL_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SOKOL_TARGET(isa)
+#else
+#define SOKOL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SOKOL_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void (*sokol_copy_scale_kernel_t)(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+typedef void (*sokol_copy_scale_3x4_kernel_t)(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+typedef int32_t (*sokol_cull_spheres_kernel_t)(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes);
+
+typedef void (*sokol_pack_colors_kernel_t)(
+    void *dst,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride);
+
+static
+const char *sokol_kernel_name = "scalar";
+
+// Scale factors that map color & material values to unorm ranges
+#define SOKOL_PACK_COLOR (255.0f)
+#define SOKOL_PACK_SPECULAR (255.0f / (float)SOKOL_PACKED_SPECULAR_MAX)
+#define SOKOL_PACK_SHININESS (255.0f / (float)SOKOL_PACKED_SHININESS_MAX)
+#define SOKOL_PACK_EMISSIVE (65535.0f / (float)SOKOL_PACKED_EMISSIVE_MAX)
+
+#define SOKOL_SCALE(scale, stride, i)\
+    ((const float*)ECS_OFFSET(scale, (stride) * (i)))
+
+static
+void sokol_copy_scale_scalar(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    int32_t i, r;
+    for (i = 0; i < count; i ++) {
+        const float *s = SOKOL_SCALE(scale, scale_stride, i);
+        float sx = s[0], sy = s[1], sz = dim > 2 ? s[2] : 1.0f;
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        for (r = 0; r < 4; r ++) {
+            d[r] = src[i][0][r] * sx;
+            d[4 + r] = src[i][1][r] * sy;
+            d[8 + r] = src[i][2][r] * sz;
+            d[12 + r] = src[i][3][r];
+        }
+    }
+}
+
+static
+void sokol_copy_scale_3x4_scalar(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    int32_t i, r;
+    for (i = 0; i < count; i ++) {
+        const float *s = SOKOL_SCALE(scale, scale_stride, i);
+        float sx = s[0], sy = s[1], sz = dim > 2 ? s[2] : 1.0f;
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        for (r = 0; r < 3; r ++) {
+            d[r * 4] = src[i][0][r] * sx;
+            d[r * 4 + 1] = src[i][1][r] * sy;
+            d[r * 4 + 2] = src[i][2][r] * sz;
+            d[r * 4 + 3] = src[i][3][r];
+        }
+    }
+}
+
+static
+uint32_t sokol_pack_unorm(
+    float v,
+    float scale,
+    uint32_t max)
+{
+    v = v * scale + 0.5f;
+    if (!(v > 0.0f)) {
+        return 0;
+    }
+    if (v >= (float)max) {
+        return max;
+    }
+    return (uint32_t)v;
+}
+
+static
+void sokol_pack_colors_scalar(
+    void *dst_ptr,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    uint8_t *dst = dst_ptr;
+    int32_t i;
+    for (i = 0; i < count; i ++, dst += dst_stride) {
+        const float *c = SOKOL_SCALE(color, color_stride, i);
+        const float *s = SOKOL_SCALE(specular, specular_stride, i);
+        const float *e = SOKOL_SCALE(emissive, emissive_stride, i);
+        uint32_t e16 = sokol_pack_unorm(e[0], SOKOL_PACK_EMISSIVE, 65535);
+        dst[0] = (uint8_t)sokol_pack_unorm(c[0], SOKOL_PACK_COLOR, 255);
+        dst[1] = (uint8_t)sokol_pack_unorm(c[1], SOKOL_PACK_COLOR, 255);
+        dst[2] = (uint8_t)sokol_pack_unorm(c[2], SOKOL_PACK_COLOR, 255);
+        dst[3] = 255;
+        dst[4] = (uint8_t)sokol_pack_unorm(s[0], SOKOL_PACK_SPECULAR, 255);
+        dst[5] = (uint8_t)sokol_pack_unorm(s[1], SOKOL_PACK_SHININESS, 255);
+        dst[6] = (uint8_t)(e16 & 0xFF);
+        dst[7] = (uint8_t)(e16 >> 8);
+    }
+}
+
+static
+int32_t sokol_cull_spheres_scalar(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    int32_t i, p, result = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+
+        for (p = 0; p < 6; p ++) {
+            const float *pl = planes[p];
+            float d = pl[0] * s[0] + pl[1] * s[1] + pl[2] * s[2] + pl[3];
+            if (d < -s[3]) {
+                break;
+            }
+        }
+
+        if (p == 6) {
+            visible[result ++] = i;
+        }
+    }
+    return result;
+}
+
+#ifdef SOKOL_KERNELS_X86
+
+// Planes are transposed into two groups of 4, so that a sphere is tested 
+// against all planes with two multiply-adds per component. The last two lanes
+// are padding planes that never cull.
+SOKOL_TARGET("sse2")
+static
+int32_t sokol_cull_spheres_sse2(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    const vec4 *p = planes;
+    __m128 px0 = _mm_setr_ps(p[0][0], p[1][0], p[2][0], p[3][0]);
+    __m128 py0 = _mm_setr_ps(p[0][1], p[1][1], p[2][1], p[3][1]);
+    __m128 pz0 = _mm_setr_ps(p[0][2], p[1][2], p[2][2], p[3][2]);
+    __m128 pd0 = _mm_setr_ps(p[0][3], p[1][3], p[2][3], p[3][3]);
+    __m128 px1 = _mm_setr_ps(p[4][0], p[5][0], 0.0f, 0.0f);
+    __m128 py1 = _mm_setr_ps(p[4][1], p[5][1], 0.0f, 0.0f);
+    __m128 pz1 = _mm_setr_ps(p[4][2], p[5][2], 0.0f, 0.0f);
+    __m128 pd1 = _mm_setr_ps(p[4][3], p[5][3], FLT_MAX, FLT_MAX);
+
+    int32_t i, result = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+
+        __m128 x = _mm_set1_ps(s[0]);
+        __m128 y = _mm_set1_ps(s[1]);
+        __m128 z = _mm_set1_ps(s[2]);
+        __m128 r = _mm_set1_ps(-s[3]);
+
+        __m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px0, x), 
+            _mm_mul_ps(py0, y)), _mm_add_ps(_mm_mul_ps(pz0, z), pd0));
+        __m128 d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px1, x), 
+            _mm_mul_ps(py1, y)), _mm_add_ps(_mm_mul_ps(pz1, z), pd1));
+        __m128 outside = _mm_or_ps(_mm_cmplt_ps(d0, r), _mm_cmplt_ps(d1, r));
+
+        if (!_mm_movemask_ps(outside)) {
+            visible[result ++] = i;
+        }
+    }
+    return result;
+}
+
+// SSE2 is part of the x86-64 baseline, a matrix column fits in a register.
+SOKOL_TARGET("sse2")
+static
+void sokol_copy_scale_sse2(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    __m128 sx = _mm_set1_ps(s[0]);
+    __m128 sy = _mm_set1_ps(s[1]);
+    __m128 sz = _mm_set1_ps(dim > 2 ? s[2] : 1.0f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            sx = _mm_set1_ps(s[0]);
+            sy = _mm_set1_ps(s[1]);
+            if (dim > 2) {
+                sz = _mm_set1_ps(s[2]);
+            }
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        __m128 c0 = _mm_loadu_ps(&m[0]);
+        __m128 c1 = _mm_loadu_ps(&m[4]);
+        __m128 c2 = _mm_loadu_ps(&m[8]);
+        __m128 c3 = _mm_loadu_ps(&m[12]);
+        _mm_storeu_ps(&d[0], _mm_mul_ps(c0, sx));
+        _mm_storeu_ps(&d[4], _mm_mul_ps(c1, sy));
+        _mm_storeu_ps(&d[8], _mm_mul_ps(c2, sz));
+        _mm_storeu_ps(&d[12], c3);
+    }
+}
+
+// Transposes matrix in registers, after which the scale is a single multiply
+// per row. The AVX2 kernel is not used for this layout, as rows are 16 bytes.
+SOKOL_TARGET("sse2")
+static
+void sokol_copy_scale_3x4_sse2(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    __m128 sv = _mm_setr_ps(s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            sv = _mm_setr_ps(s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f);
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        __m128 r0 = _mm_loadu_ps(&m[0]);
+        __m128 r1 = _mm_loadu_ps(&m[4]);
+        __m128 r2 = _mm_loadu_ps(&m[8]);
+        __m128 r3 = _mm_loadu_ps(&m[12]);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(&d[0], _mm_mul_ps(r0, sv));
+        _mm_storeu_ps(&d[4], _mm_mul_ps(r1, sv));
+        _mm_storeu_ps(&d[8], _mm_mul_ps(r2, sv));
+    }
+}
+
+// Converts color and material of an instance in two registers, and narrows
+// the results to the 8 bytes of the packed instance format.
+SOKOL_TARGET("sse2")
+static
+void sokol_pack_colors_sse2(
+    void *dst_ptr,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    uint8_t *dst = dst_ptr;
+    const __m128 c_scale = _mm_set1_ps(SOKOL_PACK_COLOR);
+    const __m128 c_max = _mm_set1_ps(255.0f);
+    const __m128 m_scale = _mm_setr_ps(
+        SOKOL_PACK_SPECULAR, SOKOL_PACK_SHININESS, SOKOL_PACK_EMISSIVE, 0.0f);
+    const __m128 m_max = _mm_setr_ps(255.0f, 255.0f, 65535.0f, 0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i lo_mask = _mm_setr_epi32(0xFF, 0xFF, 0xFF, 0);
+    const __m128i hi_mask = _mm_setr_epi32(0, 0, 0, 0xFF);
+
+    int32_t i;
+    for (i = 0; i < count; i ++, dst += dst_stride) {
+        const float *c = SOKOL_SCALE(color, color_stride, i);
+        const float *s = SOKOL_SCALE(specular, specular_stride, i);
+        const float *e = SOKOL_SCALE(emissive, emissive_stride, i);
+
+        __m128 cv = _mm_setr_ps(c[0], c[1], c[2], 1.0f);
+        __m128 mv = _mm_setr_ps(s[0], s[1], e[0], 0.0f);
+        cv = _mm_min_ps(_mm_max_ps(_mm_mul_ps(cv, c_scale), zero), c_max);
+        mv = _mm_min_ps(_mm_max_ps(_mm_mul_ps(mv, m_scale), zero), m_max);
+
+        // Lanes: r, g, b, a and specular, shininess, emissive (16 bit), 0
+        __m128i ci = _mm_cvttps_epi32(_mm_add_ps(cv, half));
+        __m128i mi = _mm_cvttps_epi32(_mm_add_ps(mv, half));
+
+        // Split 16 bit emissive into low byte (lane 2) and high byte (lane 3)
+        __m128i hi = _mm_shuffle_epi32(_mm_srli_epi32(mi, 8), 
+            _MM_SHUFFLE(2, 2, 2, 2));
+        mi = _mm_or_si128(_mm_and_si128(mi, lo_mask), 
+            _mm_and_si128(hi, hi_mask));
+
+        __m128i packed = _mm_packs_epi32(ci, mi);
+        packed = _mm_packus_epi16(packed, packed);
+        _mm_storel_epi64((__m128i*)dst, packed);
+    }
+}
+
+// AVX2 kernel processes two matrix columns per register
+SOKOL_TARGET("avx2")
+static
+void sokol_copy_scale_avx2(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    __m256 sxy = _mm256_setr_ps(s[0], s[0], s[0], s[0], s[1], s[1], s[1], s[1]);
+    float z = dim > 2 ? s[2] : 1.0f;
+    __m256 sz1 = _mm256_setr_ps(z, z, z, z, 1.0f, 1.0f, 1.0f, 1.0f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            __m128 x = _mm_set1_ps(s[0]);
+            __m128 y = _mm_set1_ps(s[1]);
+            sxy = _mm256_insertf128_ps(_mm256_castps128_ps256(x), y, 1);
+            if (dim > 2) {
+                __m128 zz = _mm_set1_ps(s[2]);
+                sz1 = _mm256_insertf128_ps(_mm256_castps128_ps256(zz),
+                    _mm_set1_ps(1.0f), 1);
+            }
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        __m256 c01 = _mm256_loadu_ps(&m[0]);
+        __m256 c23 = _mm256_loadu_ps(&m[8]);
+        _mm256_storeu_ps(&d[0], _mm256_mul_ps(c01, sxy));
+        _mm256_storeu_ps(&d[8], _mm256_mul_ps(c23, sz1));
+    }
+}
+
+static
+bool sokol_cpu_has_avx2(void) {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return false;
+    }
+
+    // Check that OS saves AVX registers
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || ((_xgetbv(0) & 6) != 6)) {
+        return false;
+    }
+
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#ifdef SOKOL_KERNELS_NEON
+
+static
+void sokol_copy_scale_neon(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    float sx = s[0], sy = s[1], sz = dim > 2 ? s[2] : 1.0f;
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            sx = s[0];
+            sy = s[1];
+            if (dim > 2) {
+                sz = s[2];
+            }
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        float32x4_t c0 = vld1q_f32(&m[0]);
+        float32x4_t c1 = vld1q_f32(&m[4]);
+        float32x4_t c2 = vld1q_f32(&m[8]);
+        float32x4_t c3 = vld1q_f32(&m[12]);
+        vst1q_f32(&d[0], vmulq_n_f32(c0, sx));
+        vst1q_f32(&d[4], vmulq_n_f32(c1, sy));
+        vst1q_f32(&d[8], vmulq_n_f32(c2, sz));
+        vst1q_f32(&d[12], c3);
+    }
+}
+
+static
+void sokol_pack_colors_neon(
+    void *dst_ptr,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    uint8_t *dst = dst_ptr;
+    const float32x4_t c_scale = vdupq_n_f32(SOKOL_PACK_COLOR);
+    const float32x4_t c_max = vdupq_n_f32(255.0f);
+    const float32x4_t m_scale = { 
+        SOKOL_PACK_SPECULAR, SOKOL_PACK_SHININESS, SOKOL_PACK_EMISSIVE, 0.0f };
+    const float32x4_t m_max = { 255.0f, 255.0f, 65535.0f, 0.0f };
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++, dst += dst_stride) {
+        const float *c = SOKOL_SCALE(color, color_stride, i);
+        const float *s = SOKOL_SCALE(specular, specular_stride, i);
+        const float *e = SOKOL_SCALE(emissive, emissive_stride, i);
+
+        float32x4_t cv = { c[0], c[1], c[2], 1.0f };
+        float32x4_t mv = { s[0], s[1], e[0], 0.0f };
+        cv = vminq_f32(vmaxq_f32(vmulq_f32(cv, c_scale), zero), c_max);
+        mv = vminq_f32(vmaxq_f32(vmulq_f32(mv, m_scale), zero), m_max);
+
+        uint32x4_t ci = vcvtq_u32_f32(vaddq_f32(cv, half));
+        uint32x4_t mi = vcvtq_u32_f32(vaddq_f32(mv, half));
+
+        // Split 16 bit emissive into low byte (lane 2) and high byte (lane 3)
+        uint32_t e16 = vgetq_lane_u32(mi, 2);
+        mi = vsetq_lane_u32(e16 & 0xFF, mi, 2);
+        mi = vsetq_lane_u32(e16 >> 8, mi, 3);
+
+        uint16x8_t packed = vcombine_u16(vmovn_u32(ci), vmovn_u32(mi));
+        vst1_u8(dst, vmovn_u16(packed));
+    }
+}
+
+// Same plane layout as the SSE2 kernel
+static
+int32_t sokol_cull_spheres_neon(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    const vec4 *p = planes;
+    float32x4_t px0 = { p[0][0], p[1][0], p[2][0], p[3][0] };
+    float32x4_t py0 = { p[0][1], p[1][1], p[2][1], p[3][1] };
+    float32x4_t pz0 = { p[0][2], p[1][2], p[2][2], p[3][2] };
+    float32x4_t pd0 = { p[0][3], p[1][3], p[2][3], p[3][3] };
+    float32x4_t px1 = { p[4][0], p[5][0], 0.0f, 0.0f };
+    float32x4_t py1 = { p[4][1], p[5][1], 0.0f, 0.0f };
+    float32x4_t pz1 = { p[4][2], p[5][2], 0.0f, 0.0f };
+    float32x4_t pd1 = { p[4][3], p[5][3], FLT_MAX, FLT_MAX };
+
+    int32_t i, result = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+
+        float32x4_t r = vdupq_n_f32(-s[3]);
+        float32x4_t d0 = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(
+            pd0, px0, s[0]), py0, s[1]), pz0, s[2]);
+        float32x4_t d1 = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(
+            pd1, px1, s[0]), py1, s[1]), pz1, s[2]);
+        uint32x4_t outside = vorrq_u32(vcltq_f32(d0, r), vcltq_f32(d1, r));
+        uint32x2_t any = vorr_u32(vget_low_u32(outside), vget_high_u32(outside));
+
+        if (!(vget_lane_u32(any, 0) | vget_lane_u32(any, 1))) {
+            visible[result ++] = i;
+        }
+    }
+    return result;
+}
+
+// Interleaved load transposes the matrix, so each row is a single multiply
+static
+void sokol_copy_scale_3x4_neon(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    float32x4_t sv = { s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f };
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            float32x4_t v = { s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f };
+            sv = v;
+        }
+
+        float32x4x4_t rows = vld4q_f32(src[i][0]);
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        vst1q_f32(&d[0], vmulq_f32(rows.val[0], sv));
+        vst1q_f32(&d[4], vmulq_f32(rows.val[1], sv));
+        vst1q_f32(&d[8], vmulq_f32(rows.val[2], sv));
+    }
+}
+
+#endif
+
+static
+sokol_copy_scale_kernel_t sokol_copy_scale_kernel = sokol_copy_scale_scalar;
+
+static
+sokol_copy_scale_3x4_kernel_t sokol_copy_scale_3x4_kernel = 
+    sokol_copy_scale_3x4_scalar;
+
+static
+sokol_pack_colors_kernel_t sokol_pack_colors_kernel = sokol_pack_colors_scalar;
+
+static
+sokol_cull_spheres_kernel_t sokol_cull_spheres_kernel = 
+    sokol_cull_spheres_scalar;
+
+void sokol_init_kernels(void) {
+#if defined(SOKOL_KERNELS_X86)
+    if (sokol_cpu_has_avx2()) {
+        sokol_copy_scale_kernel = sokol_copy_scale_avx2;
+        sokol_kernel_name = "avx2";
+    } else {
+        sokol_copy_scale_kernel = sokol_copy_scale_sse2;
+        sokol_kernel_name = "sse2";
+    }
+    sokol_copy_scale_3x4_kernel = sokol_copy_scale_3x4_sse2;
+    sokol_pack_colors_kernel = sokol_pack_colors_sse2;
+    sokol_cull_spheres_kernel = sokol_cull_spheres_sse2;
+#elif defined(SOKOL_KERNELS_NEON)
+    sokol_copy_scale_kernel = sokol_copy_scale_neon;
+    sokol_copy_scale_3x4_kernel = sokol_copy_scale_3x4_neon;
+    sokol_pack_colors_kernel = sokol_pack_colors_neon;
+    sokol_cull_spheres_kernel = sokol_cull_spheres_neon;
+    sokol_kernel_name = "neon";
+#endif
+    ecs_trace("sokol: using %s geometry kernels", sokol_kernel_name);
+}
+
+void sokol_copy_scale_transforms(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    ecs_assert(dim == 2 || dim == 3, ECS_INVALID_PARAMETER, NULL);
+    sokol_copy_scale_kernel(dst, dst_stride, src, count, scale, scale_stride, dim);
+}
+
+void sokol_copy_scale_transforms_3x4(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    ecs_assert(dim == 2 || dim == 3, ECS_INVALID_PARAMETER, NULL);
+    sokol_copy_scale_3x4_kernel(dst, dst_stride, src, count, scale, scale_stride, dim);
+}
+
+void sokol_copy_scale_instances(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+#if SOKOL_COMPACT_TRANSFORMS
+    sokol_copy_scale_transforms_3x4(
+        dst, dst_stride, src, count, scale, scale_stride, dim);
+#else
+    sokol_copy_scale_transforms(
+        dst, dst_stride, src, count, scale, scale_stride, dim);
+#endif
+}
+
+void sokol_scale_transforms(
+    mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    sokol_copy_scale_transforms(transforms[0][0], ECS_SIZEOF(mat4), 
+        transforms, count, scale, scale_stride, dim);
+}
+
+#if SOKOL_PACKED_INSTANCE_DATA
+void sokol_pack_instance_colors(
+    void *dst,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    sokol_pack_colors_kernel(dst, dst_stride, count, color, color_stride, 
+        specular, specular_stride, emissive, emissive_stride);
+}
+#endif
+
+void sokol_compute_bounds(
+    vec4 *dst,
+    const mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    ecs_assert(dim == 2 || dim == 3, ECS_INVALID_PARAMETER, NULL);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const float *s = SOKOL_SCALE(scale, scale_stride, i);
+        const float *m = transforms[i][0];
+        float sz = dim > 2 ? s[2] : 0.0f;
+
+        // Half of the diagonal of the scaled & rotated unit box
+        float x2 = (m[0] * m[0] + m[1] * m[1] + m[2] * m[2]) * s[0] * s[0];
+        float y2 = (m[4] * m[4] + m[5] * m[5] + m[6] * m[6]) * s[1] * s[1];
+        float z2 = (m[8] * m[8] + m[9] * m[9] + m[10] * m[10]) * sz * sz;
+
+        dst[i][0] = m[12];
+        dst[i][1] = m[13];
+        dst[i][2] = m[14];
+        dst[i][3] = 0.5f * sqrtf(x2 + y2 + z2);
+    }
+}
+
+void sokol_merge_bounds(
+    vec4 dst,
+    const vec4 *spheres,
+    int32_t count)
+{
+    vec3 min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    vec3 max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    int32_t i, c;
+
+    // Center the sphere on the bounding box of all spheres
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+        for (c = 0; c < 3; c ++) {
+            min[c] = glm_min(min[c], s[c] - s[3]);
+            max[c] = glm_max(max[c], s[c] + s[3]);
+        }
+    }
+
+    if (min[0] > max[0]) {
+        glm_vec4_zero(dst);
+        return;
+    }
+
+    glm_vec3_center(min, max, dst);
+
+    float radius = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+        radius = glm_max(radius, glm_vec3_distance(dst, (float*)s) + s[3]);
+    }
+
+    dst[3] = radius;
+}
+
+int32_t sokol_cull_spheres(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    return sokol_cull_spheres_kernel(visible, spheres, count, planes);
+}
+
+#include <float.h>
+
+#if SOKOL_OCCLUSION_CULLING
+
+/* Vertices with a w smaller than this are considered behind the camera */
+#define SOKOL_OCCLUSION_NEAR (0.0001f)
+
+/* Maximum number of polygon vertices, which is the vertex count of a box */
+#define SOKOL_OCCLUSION_POLYGON_MAX (8)
+
+static const float sokol_occlusion_box_vertices[8][3] = {
+    {-0.5f, -0.5f, -0.5f}, { 0.5f, -0.5f, -0.5f},
+    { 0.5f,  0.5f, -0.5f}, {-0.5f,  0.5f, -0.5f},
+    {-0.5f, -0.5f,  0.5f}, { 0.5f, -0.5f,  0.5f},
+    { 0.5f,  0.5f,  0.5f}, {-0.5f,  0.5f,  0.5f}
+};
+
+/* Faces of the box, counter clockwise when seen from outside of the box */
+static const int32_t sokol_occlusion_box_faces[6][4] = {
+    {0, 3, 2, 1}, /* Back */
+    {4, 5, 6, 7}, /* Front */
+    {0, 4, 7, 3}, /* Left */
+    {5, 1, 2, 6}, /* Right */
+    {0, 1, 5, 4}, /* Bottom */
+    {7, 6, 2, 3}  /* Top */
+};
+
+void sokol_occlusion_init(
+    sokol_occlusion_buffer_t *buf,
+    int32_t width,
+    int32_t height)
+{
+    ecs_assert(!(width % SOKOL_OCCLUSION_TILE_SIZE),
+        ECS_INVALID_PARAMETER, NULL);
+    ecs_assert(!(height % SOKOL_OCCLUSION_TILE_SIZE),
+        ECS_INVALID_PARAMETER, NULL);
+
+    buf->width = width;
+    buf->height = height;
+    buf->tile_cols = width / SOKOL_OCCLUSION_TILE_SIZE;
+    buf->tile_rows = height / SOKOL_OCCLUSION_TILE_SIZE;
+    buf->depth = ecs_os_malloc_n(float, width * height);
+    buf->tiles = ecs_os_malloc_n(float, buf->tile_cols * buf->tile_rows);
+    glm_mat4_identity(buf->mat_vp);
+}
+
+void sokol_occlusion_fini(
+    sokol_occlusion_buffer_t *buf)
+{
+    ecs_os_free(buf->depth);
+    ecs_os_free(buf->tiles);
+}
+
+void sokol_occlusion_clear(
+    sokol_occlusion_buffer_t *buf,
+    mat4 mat_vp)
+{
+    int32_t i, count = buf->width * buf->height;
+    for (i = 0; i < count; i ++) {
+        buf->depth[i] = 1.0f;
+    }
+    glm_mat4_copy(mat_vp, buf->mat_vp);
+}
+
+// Edge function of a and b, evaluated for p. Positive if p is left of a-b.
+static
+float sokol_occlusion_edge(
+    const float *a,
+    const float *b,
+    float px,
+    float py)
+{
+    return (b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0]);
+}
+
+// Draw convex counter clockwise polygon in pixel coordinates with a constant
+// depth. Only pixels that are fully covered by the polygon are drawn, so that
+// occluders never hide what is visible through the part of a pixel that they
+// do not cover.
+static
+void sokol_occlusion_draw_polygon(
+    sokol_occlusion_buffer_t *buf,
+    float (*s)[2],
+    int32_t count,
+    float depth)
+{
+    float fx0 = s[0][0], fx1 = s[0][0], fy0 = s[0][1], fy1 = s[0][1];
+    int32_t i;
+    for (i = 1; i < count; i ++) {
+        fx0 = glm_min(fx0, s[i][0]); fx1 = glm_max(fx1, s[i][0]);
+        fy0 = glm_min(fy0, s[i][1]); fy1 = glm_max(fy1, s[i][1]);
+    }
+
+    int32_t x0 = (int32_t)glm_max(floorf(fx0), 0);
+    int32_t x1 = (int32_t)glm_min(ceilf(fx1), (float)buf->width);
+    int32_t y0 = (int32_t)glm_max(floorf(fy0), 0);
+    int32_t y1 = (int32_t)glm_min(ceilf(fy1), (float)buf->height);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    // Edge functions are evaluated at pixel centers and stepped per pixel. A
+    // pixel is fully covered if all of its corners are inside, which is the
+    // case if the edge functions at its center exceed half of their steps.
+    float px = (float)x0 + 0.5f, py = (float)y0 + 0.5f;
+    float e[SOKOL_OCCLUSION_POLYGON_MAX];
+    float dx[SOKOL_OCCLUSION_POLYGON_MAX], dy[SOKOL_OCCLUSION_POLYGON_MAX];
+    for (i = 0; i < count; i ++) {
+        const float *a = s[i], *b = s[(i + 1) % count];
+        dx[i] = -(b[1] - a[1]);
+        dy[i] = b[0] - a[0];
+        e[i] = sokol_occlusion_edge(a, b, px, py) -
+            0.5f * (fabsf(dx[i]) + fabsf(dy[i]));
+    }
+
+    int32_t x, y;
+    for (y = y0; y < y1; y ++) {
+        float *row = &buf->depth[y * buf->width];
+        for (x = x0; x < x1; x ++) {
+            bool inside = true;
+            for (i = 0; i < count; i ++) {
+                inside &= (e[i] + dx[i] * (float)(x - x0)) >= 0;
+            }
+            float d = row[x];
+            row[x] = (inside && depth < d) ? depth : d;
+        }
+        for (i = 0; i < count; i ++) {
+            e[i] += dy[i];
+        }
+    }
+}
+
+void sokol_occlusion_draw_box(
+    sokol_occlusion_buffer_t *buf,
+    mat4 transform)
+{
+    mat4 mat_mvp;
+    float s[8][2], d[8], depth = 0;
+    int32_t i, j;
+
+    // Project to pixel coordinates. Boxes that cross the near plane are
+    // skipped, which removes occluders and so remains conservative.
+    glm_mat4_mul(buf->mat_vp, transform, mat_mvp);
+    for (i = 0; i < 8; i ++) {
+        vec4 p = {
+            sokol_occlusion_box_vertices[i][0],
+            sokol_occlusion_box_vertices[i][1],
+            sokol_occlusion_box_vertices[i][2],
+            1.0f
+        }, c;
+        glm_mat4_mulv(mat_mvp, p, c);
+        if (c[3] < SOKOL_OCCLUSION_NEAR) {
+            return;
+        }
+        s[i][0] = (c[0] / c[3] * 0.5f + 0.5f) * (float)buf->width;
+        s[i][1] = (c[1] / c[3] * 0.5f + 0.5f) * (float)buf->height;
+        d[i] = c[2] / c[3] * 0.5f + 0.5f;
+    }
+
+    // Faces that face the camera are counter clockwise on screen, or clockwise
+    // if the transform mirrors the box. The box covers its silhouette with at
+    // most the farthest depth of these faces.
+    vec3 cross;
+    glm_vec3_cross(transform[0], transform[1], cross);
+    float det = glm_vec3_dot(cross, transform[2]);
+    if (det == 0) {
+        return;
+    }
+
+    bool visible = false;
+    for (i = 0; i < 6; i ++) {
+        const int32_t *f = sokol_occlusion_box_faces[i];
+        float area = 0;
+        for (j = 0; j < 4; j ++) {
+            const float *a = s[f[j]], *b = s[f[(j + 1) % 4]];
+            area += a[0] * b[1] - b[0] * a[1];
+        }
+        if ((det > 0) ? (area > 0) : (area < 0)) {
+            for (j = 0; j < 4; j ++) {
+                depth = glm_max(depth, d[f[j]]);
+            }
+            visible = true;
+        }
+    }
+
+    if (!visible || depth > 1.0f) {
+        return;
+    }
+
+    // The silhouette is the convex hull of the projected vertices. Drawing it
+    // as a single polygon avoids gaps between faces, where pixels are only
+    // partially covered by each face.
+    for (i = 1; i < 8; i ++) {
+        float p[2] = { s[i][0], s[i][1] };
+        for (j = i; j > 0 && (s[j - 1][0] > p[0] ||
+            (s[j - 1][0] == p[0] && s[j - 1][1] > p[1])); j --)
+        {
+            s[j][0] = s[j - 1][0]; s[j][1] = s[j - 1][1];
+        }
+        s[j][0] = p[0]; s[j][1] = p[1];
+    }
+
+    float hull[16][2];
+    int32_t count = 0, lower;
+    for (i = 0; i < 8; i ++) {
+        while (count >= 2 && sokol_occlusion_edge(
+            hull[count - 2], hull[count - 1], s[i][0], s[i][1]) <= 0)
+        {
+            count --;
+        }
+        hull[count][0] = s[i][0]; hull[count][1] = s[i][1];
+        count ++;
+    }
+    for (i = 6, lower = count + 1; i >= 0; i --) {
+        while (count >= lower && sokol_occlusion_edge(
+            hull[count - 2], hull[count - 1], s[i][0], s[i][1]) <= 0)
+        {
+            count --;
+        }
+        hull[count][0] = s[i][0]; hull[count][1] = s[i][1];
+        count ++;
+    }
+    count --; /* Last vertex is the first */
+
+    if (count >= 3) {
+        sokol_occlusion_draw_polygon(buf, hull, count, depth);
+    }
+}
+
+void sokol_occlusion_draw_triangle(
+    sokol_occlusion_buffer_t *buf,
+    const vec4 v0,
+    const vec4 v1,
+    const vec4 v2)
+{
+    const float *v[3] = { v0, v1, v2 };
+    float s[3][2], depth = 0;
+    int32_t i;
+
+    // Project to pixel coordinates. Triangles that cross the near plane are
+    // skipped, which removes occluders and so remains conservative.
+    for (i = 0; i < 3; i ++) {
+        float w = v[i][3];
+        if (w < SOKOL_OCCLUSION_NEAR) {
+            return;
+        }
+        s[i][0] = (v[i][0] / w * 0.5f + 0.5f) * (float)buf->width;
+        s[i][1] = (v[i][1] / w * 0.5f + 0.5f) * (float)buf->height;
+        depth = glm_max(depth, v[i][2] / w * 0.5f + 0.5f);
+    }
+
+    if (depth > 1.0f) {
+        return;
+    }
+
+    float area = sokol_occlusion_edge(s[0], s[1], s[2][0], s[2][1]);
+    if (area == 0) {
+        return;
+    }
+
+    // Make triangle counter clockwise so edge functions are positive inside
+    if (area < 0) {
+        float tmp[2] = { s[1][0], s[1][1] };
+        s[1][0] = s[2][0]; s[1][1] = s[2][1];
+        s[2][0] = tmp[0]; s[2][1] = tmp[1];
+    }
+
+    sokol_occlusion_draw_polygon(buf, s, 3, depth);
+}
+
+void sokol_occlusion_finish(
+    sokol_occlusion_buffer_t *buf)
+{
+    int32_t tx, ty, x, y;
+    for (ty = 0; ty < buf->tile_rows; ty ++) {
+        for (tx = 0; tx < buf->tile_cols; tx ++) {
+            float depth = 0;
+            for (y = 0; y < SOKOL_OCCLUSION_TILE_SIZE; y ++) {
+                const float *row = &buf->depth[
+                    (ty * SOKOL_OCCLUSION_TILE_SIZE + y) * buf->width +
+                     tx * SOKOL_OCCLUSION_TILE_SIZE];
+                for (x = 0; x < SOKOL_OCCLUSION_TILE_SIZE; x ++) {
+                    depth = glm_max(depth, row[x]);
+                }
+            }
+            buf->tiles[ty * buf->tile_cols + tx] = depth;
+        }
+    }
+}
+
+bool sokol_occlusion_test_box(
+    const sokol_occlusion_buffer_t *buf,
+    const vec3 min,
+    const vec3 max)
+{
+    float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX, depth = 1;
+    int32_t i;
+
+    // Project corners of the box. The rectangle around the projected corners
+    // encloses the box on screen, and the nearest corner is nearest to the
+    // camera.
+    for (i = 0; i < 8; i ++) {
+        vec4 p = {
+            (i & 1) ? max[0] : min[0],
+            (i & 2) ? max[1] : min[1],
+            (i & 4) ? max[2] : min[2],
+            1.0f
+        }, c;
+        glm_mat4_mulv((vec4*)buf->mat_vp, p, c);
+        if (c[3] < SOKOL_OCCLUSION_NEAR) {
+            return true;
+        }
+        float x = c[0] / c[3], y = c[1] / c[3];
+        x0 = glm_min(x0, x); x1 = glm_max(x1, x);
+        y0 = glm_min(y0, y); y1 = glm_max(y1, y);
+        depth = glm_min(depth, c[2] / c[3] * 0.5f + 0.5f);
+    }
+
+    // Boxes outside of the view are left to frustum culling, since there are
+    // no occluders to test them against.
+    if (x1 < -1 || x0 > 1 || y1 < -1 || y0 > 1 || depth >= 1) {
+        return true;
+    }
+
+    float tile_w = (float)(buf->width / buf->tile_cols);
+    float tile_h = (float)(buf->height / buf->tile_rows);
+    int32_t tx0 = (int32_t)floorf((x0 * 0.5f + 0.5f) * (float)buf->width / tile_w);
+    int32_t tx1 = (int32_t)floorf((x1 * 0.5f + 0.5f) * (float)buf->width / tile_w);
+    int32_t ty0 = (int32_t)floorf((y0 * 0.5f + 0.5f) * (float)buf->height / tile_h);
+    int32_t ty1 = (int32_t)floorf((y1 * 0.5f + 0.5f) * (float)buf->height / tile_h);
+    tx0 = glm_imax(tx0, 0); tx1 = glm_imin(tx1, buf->tile_cols - 1);
+    ty0 = glm_imax(ty0, 0); ty1 = glm_imin(ty1, buf->tile_rows - 1);
+
+    // Box is visible if any tile has an occluder behind its nearest point
+    int32_t tx, ty;
+    for (ty = ty0; ty <= ty1; ty ++) {
+        const float *row = &buf->tiles[ty * buf->tile_cols];
+        for (tx = tx0; tx <= tx1; tx ++) {
+            if (row[tx] >= depth) {
+                return true;
+            }
+        }
+    }
 
-ECS_COMPONENT_DECLARE(SokolGeometry);
-ECS_COMPONENT_DECLARE(SokolGeometryQuery);
+    return false;
+}
 
-ECS_DECLARE(SokolRectangleGeometry);
-ECS_DECLARE(SokolBoxGeometry);
+bool sokol_occlusion_test_sphere(
+    const sokol_occlusion_buffer_t *buf,
+    const vec4 sphere)
+{
+    // Test the box around the sphere, which encloses it on screen
+    vec3 min, max;
+    glm_vec3_subs((float*)sphere, sphere[3], min);
+    glm_vec3_adds((float*)sphere, sphere[3], max);
+    return sokol_occlusion_test_box(buf, min, max);
+}
 
+#endif
+
+#include <float.h>
+
+#if SOKOL_SPATIAL_INDEX
+
+#define SOKOL_SPATIAL_AXIS_BITS (21)
+#define SOKOL_SPATIAL_AXIS_MIN (-(1 << (SOKOL_SPATIAL_AXIS_BITS - 1)))
+#define SOKOL_SPATIAL_AXIS_MAX ((1 << (SOKOL_SPATIAL_AXIS_BITS - 1)) - 1)
+#define SOKOL_SPATIAL_AXIS_MASK ((1 << SOKOL_SPATIAL_AXIS_BITS) - 1)
+
+// Get coordinate of cell that contains value, clamped to the range that can be
+// stored in a key.
 static
-void sokol_geometry_buffers_init(ecs_allocator_t *a, sokol_geometry_buffers_t *result) {
-    ecs_vec_init_t(a, &result->transforms_data, mat4, 0);
-    ecs_vec_init_t(a, &result->colors_data, ecs_rgb_t, 0);
-    ecs_vec_init_t(a, &result->materials_data, SokolMaterial, 0);
+int32_t sokol_spatial_coord(
+    float v)
+{
+    float c = floorf(v / SOKOL_SPATIAL_CELL_SIZE);
+    c = glm_clamp(c, SOKOL_SPATIAL_AXIS_MIN, SOKOL_SPATIAL_AXIS_MAX);
+    return (int32_t)c;
 }
 
+// Get key of cell from its coordinates. Coordinates are packed in 21 bits per
+// axis, so a key can be computed without a lookup.
 static
-void sokol_geometry_buffers_fini(ecs_allocator_t *a, sokol_geometry_buffers_t* result) {
-    if (result->colors.id) {
-        sg_destroy_buffer(result->colors);
-    }
-    if (result->transforms.id) {
-        sg_destroy_buffer(result->transforms);
-    }
-    if (result->materials.id) {
-        sg_destroy_buffer(result->materials);
+ecs_map_key_t sokol_spatial_coords_key(
+    const int32_t *coords)
+{
+    ecs_map_key_t key = 0;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        key = (key << SOKOL_SPATIAL_AXIS_BITS) |
+            (ecs_map_key_t)(coords[i] & SOKOL_SPATIAL_AXIS_MASK);
     }
-
-    ecs_vec_fini_t(a, &result->transforms_data, mat4);
-    ecs_vec_fini_t(a, &result->colors_data, ecs_rgb_t);
-    ecs_vec_fini_t(a, &result->materials_data, SokolMaterial);
+    return key;
 }
 
+// Get key of cell that contains point
 static
-void sokol_free_geometry(SokolGeometry *ptr) {
-    sokol_geometry_buffers_fini(ptr->allocator, &ptr->solid);
-    if (ptr->allocator) {
-        flecs_allocator_fini(ptr->allocator);
-        ecs_os_free(ptr->allocator);
-        ptr->allocator = NULL;
+ecs_map_key_t sokol_spatial_key(
+    const float *p,
+    int32_t *coords)
+{
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        coords[i] = sokol_spatial_coord(p[i]);
     }
+    return sokol_spatial_coords_key(coords);
 }
 
-ECS_CTOR(SokolGeometry, ptr, {
-    ecs_os_memset_t(ptr, 0, SokolGeometry);
-    ptr->allocator = ecs_os_malloc_t(ecs_allocator_t);
-    
-    flecs_allocator_init(ptr->allocator);
-    flecs_allocator_fini(ptr->allocator);
-    flecs_allocator_init(ptr->allocator);
+static
+sokol_spatial_cell_t* sokol_spatial_ensure_cell(
+    sokol_spatial_index_t *index,
+    ecs_map_key_t key,
+    const int32_t *coords)
+{
+    sokol_spatial_cell_t *cell = ecs_map_get_deref(
+        &index->cells, sokol_spatial_cell_t, key);
+    if (cell) {
+        return cell;
+    }
 
+    cell = ecs_map_ensure_alloc_t(&index->cells, sokol_spatial_cell_t, key);
+    ecs_vec_init_t(index->allocator, &cell->spheres, vec4, 0);
+    ecs_vec_init_t(index->allocator, &cell->slots, int32_t, 0);
+    ecs_vec_init_t(index->allocator, &cell->entities, ecs_entity_t, 0);
 
-    sokol_geometry_buffers_init(ptr->allocator, &ptr->solid);
-})
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        cell->bounds[i] = ((float)coords[i] + 0.5f) * SOKOL_SPATIAL_CELL_SIZE;
+    }
+    cell->bounds[3] = 0;
+    return cell;
+}
 
-ECS_MOVE(SokolGeometry, dst, src, {
-    sokol_free_geometry(dst);
-    ecs_os_memcpy_t(dst, src, SokolGeometry);
-    ecs_os_memset_t(src, 0, SokolGeometry);
-})
+static
+void sokol_spatial_cell_fini(
+    sokol_spatial_index_t *index,
+    sokol_spatial_cell_t *cell)
+{
+    ecs_vec_fini_t(index->allocator, &cell->spheres, vec4);
+    ecs_vec_fini_t(index->allocator, &cell->slots, int32_t);
+    ecs_vec_fini_t(index->allocator, &cell->entities, ecs_entity_t);
+}
 
-ECS_DTOR(SokolGeometry, ptr, {
-    sokol_free_geometry(ptr);
-})
+// Grow bounds of cell so that it encloses the sphere. Bounds don't shrink when
+// instances are removed, which keeps them conservative.
+static
+void sokol_spatial_cell_expand(
+    sokol_spatial_cell_t *cell,
+    const vec4 sphere)
+{
+    float radius = glm_vec3_distance(cell->bounds, (float*)sphere) + sphere[3];
+    cell->bounds[3] = glm_max(cell->bounds[3], radius);
+}
 
-// To ensure rectangles are of the right size, use the Rectangle component to
-// apply a scaling factor to the transform matrix that is sent to the GPU.
+// Grow extents of index so that they include an instance in the cell
 static
-void sokol_populate_rectangle(
-    mat4 *transforms, 
-    EcsRectangle *data, 
-    int32_t count,
-    bool self) 
+void sokol_spatial_grow(
+    sokol_spatial_index_t *index,
+    const int32_t *coords,
+    float radius)
 {
-    int i;
-    if (self) {
-        for (i = 0; i < count; i ++) {
-            vec3 scale = {data[i].width, data[i].height, 1.0};
-            glm_scale(transforms[i], scale);
-        }
-    } else {
-        vec3 scale = {data->width, data->height, 1.0};
-        for (i = 0; i < count; i ++) {
-            glm_scale(transforms[i], scale);
+    int32_t i;
+    if (!index->count) {
+        for (i = 0; i < 3; i ++) {
+            index->cell_min[i] = index->cell_max[i] = coords[i];
         }
+        index->max_radius = radius;
+        return;
+    }
+
+    for (i = 0; i < 3; i ++) {
+        index->cell_min[i] = glm_imin(index->cell_min[i], coords[i]);
+        index->cell_max[i] = glm_imax(index->cell_max[i], coords[i]);
     }
+    index->max_radius = glm_max(index->max_radius, radius);
 }
 
-// To ensure boxes are of the right size, use the Box component to apply
-// a scaling factor to the transform matrix that is sent to the GPU.
 static
-void sokol_populate_box(
-    mat4 *transforms, 
-    EcsBox *data, 
-    int32_t count,
-    bool self)
-     
-{    
-    int i;
-    if (self) {
-        for (i = 0; i < count; i ++) {
-            vec3 scale = {data[i].width, data[i].height, data[i].depth};
-            glm_scale(transforms[i], scale);
-        }
+void sokol_spatial_remove_slot(
+    sokol_spatial_index_t *index,
+    int32_t slot)
+{
+    sokol_spatial_loc_t *loc = ecs_vec_get_t(
+        &index->locations, sokol_spatial_loc_t, slot);
+    if (loc->index == -1) {
+        return;
+    }
+
+    sokol_spatial_cell_t *cell = ecs_map_get_deref(
+        &index->cells, sokol_spatial_cell_t, loc->cell);
+    ecs_assert(cell != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    int32_t last = ecs_vec_count(&cell->slots) - 1;
+    if (!last) {
+        sokol_spatial_cell_fini(index, cell);
+        ecs_map_remove_free(&index->cells, loc->cell);
     } else {
-        vec3 scale = {data->width, data->height, data->depth};
+        // Last instance is moved into the slot of the removed instance
+        int32_t moved = *ecs_vec_last_t(&cell->slots, int32_t);
+        ecs_vec_get_t(&index->locations, sokol_spatial_loc_t, moved)->index =
+            loc->index;
+        ecs_vec_remove_t(&cell->spheres, vec4, loc->index);
+        ecs_vec_remove_t(&cell->slots, int32_t, loc->index);
+        ecs_vec_remove_t(&cell->entities, ecs_entity_t, loc->index);
+    }
+
+    loc->index = -1;
+    index->count --;
+}
+
+void sokol_spatial_init(
+    sokol_spatial_index_t *index,
+    ecs_allocator_t *a)
+{
+    index->allocator = a;
+    ecs_map_init(&index->cells, a);
+    ecs_vec_init_t(a, &index->locations, sokol_spatial_loc_t, 0);
+    index->count = 0;
+
+    // Extents are initialized when the first instance is added
+    index->max_radius = 0;
+}
+
+void sokol_spatial_fini(
+    sokol_spatial_index_t *index)
+{
+    ecs_map_iter_t mit = ecs_map_iter(&index->cells);
+    while (ecs_map_next(&mit)) {
+        sokol_spatial_cell_t *cell = ecs_map_ptr(&mit);
+        sokol_spatial_cell_fini(index, cell);
+        ecs_os_free(cell);
+    }
+    ecs_map_fini(&index->cells);
+    ecs_vec_fini_t(index->allocator, &index->locations, sokol_spatial_loc_t);
+}
+
+void sokol_spatial_resize(
+    sokol_spatial_index_t *index,
+    int32_t slot_count)
+{
+    int32_t i, old_count = ecs_vec_count(&index->locations);
+    ecs_vec_set_count_t(index->allocator, &index->locations,
+        sokol_spatial_loc_t, slot_count);
+
+    sokol_spatial_loc_t *locs = ecs_vec_first_t(
+        &index->locations, sokol_spatial_loc_t);
+    for (i = old_count; i < slot_count; i ++) {
+        locs[i].cell = 0;
+        locs[i].index = -1;
+    }
+}
+
+void sokol_spatial_set(
+    sokol_spatial_index_t *index,
+    int32_t slot,
+    ecs_entity_t entity,
+    const vec4 sphere)
+{
+    if (!(sphere[3] > 0)) {
+        sokol_spatial_remove_slot(index, slot);
+        return;
+    }
+
+    int32_t coords[3];
+    ecs_map_key_t key = sokol_spatial_key(sphere, coords);
+    sokol_spatial_loc_t *loc = ecs_vec_get_t(
+        &index->locations, sokol_spatial_loc_t, slot);
+
+    // Instance didn't move to another cell, update in place
+    if (loc->index != -1 && loc->cell == key) {
+        sokol_spatial_cell_t *cell = ecs_map_get_deref(
+            &index->cells, sokol_spatial_cell_t, key);
+        glm_vec4_copy((float*)sphere,
+            *ecs_vec_get_t(&cell->spheres, vec4, loc->index));
+        *ecs_vec_get_t(&cell->entities, ecs_entity_t, loc->index) = entity;
+        sokol_spatial_cell_expand(cell, sphere);
+        sokol_spatial_grow(index, coords, sphere[3]);
+        return;
+    }
+
+    sokol_spatial_remove_slot(index, slot);
+
+    sokol_spatial_cell_t *cell = sokol_spatial_ensure_cell(index, key, coords);
+    ecs_allocator_t *a = index->allocator;
+    loc->cell = key;
+    loc->index = ecs_vec_count(&cell->slots);
+    glm_vec4_copy((float*)sphere, *ecs_vec_append_t(a, &cell->spheres, vec4));
+    *ecs_vec_append_t(a, &cell->slots, int32_t) = slot;
+    *ecs_vec_append_t(a, &cell->entities, ecs_entity_t) = entity;
+    sokol_spatial_cell_expand(cell, sphere);
+    sokol_spatial_grow(index, coords, sphere[3]);
+    index->count ++;
+}
+
+void sokol_spatial_remove(
+    sokol_spatial_index_t *index,
+    int32_t offset,
+    int32_t count)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        sokol_spatial_remove_slot(index, offset + i);
+    }
+}
+
+int32_t sokol_spatial_cull(
+    const sokol_spatial_index_t *index,
+    int32_t *visible,
+    const vec4 *planes,
+    int32_t *culled_cells)
+{
+    int32_t result = 0;
+
+    ecs_map_iter_t mit = ecs_map_iter(&index->cells);
+    while (ecs_map_next(&mit)) {
+        sokol_spatial_cell_t *cell = ecs_map_ptr(&mit);
+        int32_t cell_visible;
+        if (!sokol_cull_spheres(&cell_visible,
+            (const vec4*)&cell->bounds, 1, planes))
+        {
+            (*culled_cells) ++;
+            continue;
+        }
+
+        // Test instances of cell, and translate their indices to slots
+        int32_t *cell_slots = &visible[result];
+        int32_t i, count = sokol_cull_spheres(cell_slots,
+            ecs_vec_first_t(&cell->spheres, vec4),
+            ecs_vec_count(&cell->spheres), planes);
+        const int32_t *slots = ecs_vec_first_t(&cell->slots, int32_t);
         for (i = 0; i < count; i ++) {
-            glm_scale(transforms[i], scale);
+            cell_slots[i] = slots[cell_slots[i]];
         }
+
+        result += count;
     }
+
+    return result;
 }
 
-// Init static rectangle geometry data (vertices, indices)
+// Squared distance of point to box, which is zero for points inside the box
 static
-void sokol_init_rectangle(
-    ecs_world_t *world,
-    sokol_resources_t *resources) 
+float sokol_box_distance2(
+    const float *p,
+    const vec3 min,
+    const vec3 max)
 {
-    SokolGeometry *g = ecs_get_mut(
-        world, ecs_id(SokolRectangleGeometry), SokolGeometry);
-    ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
-
-    g->vertices = resources->rect;
-    g->normals = resources->rect_normals;
-    g->indices = resources->rect_indices;
-    g->index_count = sokol_rectangle_index_count();
-    g->populate = (sokol_geometry_action_t)sokol_populate_rectangle;
+    float result = 0;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        float d = glm_max(glm_max(min[i] - p[i], p[i] - max[i]), 0.0f);
+        result += d * d;
+    }
+    return result;
 }
 
-// Init static box geometry data (vertices, indices)
+// Distance along ray at which it enters the sphere. Returns 0 if origin is
+// inside the sphere, and a negative value if the ray doesn't hit the sphere.
 static
-void sokol_init_box(
-    ecs_world_t *world,
-    sokol_resources_t *resources) 
+float sokol_ray_sphere(
+    const float *sphere,
+    const vec3 origin,
+    const vec3 direction)
 {
-    if (SokolBoxGeometry) {
-        SokolGeometry *g = ecs_get_mut(
-            world, ecs_id(SokolBoxGeometry), SokolGeometry);
-        ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+    vec3 oc;
+    glm_vec3_sub((float*)sphere, (float*)origin, oc);
+    float r2 = sphere[3] * sphere[3];
+    float oc2 = glm_vec3_dot(oc, oc);
+    if (oc2 <= r2) {
+        return 0;
+    }
 
-        g->vertices = resources->box;
-        g->normals = resources->box_normals;
-        g->indices = resources->box_indices;
-        g->index_count = sokol_box_index_count();
-        g->populate = (sokol_geometry_action_t)sokol_populate_box;
+    float t = glm_vec3_dot(oc, (float*)direction);
+    float d2 = oc2 - t * t;
+    if (t < 0 || d2 > r2) {
+        return -1;
     }
+
+    return t - sqrtf(r2 - d2);
 }
 
-void sokol_init_geometry(
-    ecs_world_t *world,
-    sokol_resources_t *resources) 
+// Iterator over the cells that can contain instances that overlap with a box
+typedef struct sokol_spatial_iter_t {
+    const sokol_spatial_index_t *index;
+    ecs_map_iter_t cells;       /* Used when iterating all cells */
+    int32_t min[3];
+    int32_t max[3];
+    int32_t cur[3];
+    bool all;
+    bool done;
+} sokol_spatial_iter_t;
+
+static
+void sokol_spatial_iter_init(
+    sokol_spatial_iter_t *it,
+    const sokol_spatial_index_t *index,
+    const vec3 min,
+    const vec3 max)
 {
-    sokol_init_rectangle(world, resources);
-    sokol_init_box(world, resources);
+    it->index = index;
+    it->all = false;
+    it->done = !index->count;
+
+    // Instances can extend outside of their cell by up to the max radius, so
+    // the box is expanded by the radius before it's converted to cells.
+    float r = index->max_radius;
+    int64_t volume = 1;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        it->min[i] = glm_imax(sokol_spatial_coord(min[i] - r),
+            index->cell_min[i]);
+        it->max[i] = glm_imin(sokol_spatial_coord(max[i] + r),
+            index->cell_max[i]);
+        it->cur[i] = it->min[i];
+        if (it->max[i] < it->min[i]) {
+            it->done = true;
+        }
+        volume *= (int64_t)(it->max[i] - it->min[i] + 1);
+    }
+
+    // For large boxes it's cheaper to test all occupied cells than to do a
+    // lookup for each cell in the range.
+    if (!it->done && volume > ecs_map_count(&index->cells)) {
+        it->all = true;
+        it->cells = ecs_map_iter(&index->cells);
+    }
 }
 
 static
-void sokol_populate_buffers(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers,
-    ecs_query_t *query)
+sokol_spatial_cell_t* sokol_spatial_iter_next(
+    sokol_spatial_iter_t *it)
 {
-    const ecs_world_t *world = ecs_get_world(query);
-    ecs_allocator_t *a = geometry->allocator;
+    if (it->all) {
+        if (ecs_map_next(&it->cells)) {
+            return ecs_map_ptr(&it->cells);
+        }
+        return NULL;
+    }
+
+    while (!it->done) {
+        sokol_spatial_cell_t *cell = ecs_map_get_deref(&it->index->cells,
+            sokol_spatial_cell_t, sokol_spatial_coords_key(it->cur));
 
-    int32_t i, old_size = ecs_vec_size(&buffers->colors_data);
+        int32_t i;
+        for (i = 2; i >= 0; i --) {
+            if (it->cur[i] < it->max[i]) {
+                it->cur[i] ++;
+                break;
+            }
+            it->cur[i] = it->min[i];
+        }
+        it->done = i < 0;
 
-    ecs_vec_clear(&buffers->transforms_data);
-    ecs_vec_clear(&buffers->colors_data);
-    ecs_vec_clear(&buffers->materials_data);
+        if (cell) {
+            return cell;
+        }
+    }
 
-    ecs_iter_t qit = ecs_query_iter(world, query);
-    while (ecs_query_next(&qit)) {
-        EcsTransform3 *transforms = ecs_field(&qit, EcsTransform3, 0);
-        EcsRgb *colors = ecs_field(&qit, EcsRgb, 1);
-        EcsEmissive *emissive = ecs_field(&qit, EcsEmissive, 2);
-        EcsSpecular *specular = ecs_field(&qit, EcsSpecular, 3);
-        void *geometry_data = ecs_field_w_size(&qit, qit.sizes[4], 4);
-        bool geometry_self = ecs_field_is_self(&qit, 4);
-
-        int32_t cur = ecs_vec_count(&buffers->colors_data);
-        int32_t count = qit.count;
+    return NULL;
+}
 
-        ecs_vec_grow_t(a, &buffers->transforms_data, mat4, count);
-        ecs_vec_grow_t(a, &buffers->colors_data, ecs_rgb_t, count);
-        ecs_vec_grow_t(a, &buffers->materials_data, SokolMaterial, count);
+bool sokol_spatial_overlap_sphere(
+    const sokol_spatial_index_t *index,
+    const vec3 center,
+    float radius,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+    vec3 min, max;
+    glm_vec3_subs((float*)center, radius, min);
+    glm_vec3_adds((float*)center, radius, max);
 
-        // Copy transform data
-        ecs_os_memcpy_n( ecs_vec_get_t(&buffers->transforms_data, mat4, cur), 
-            transforms, mat4, count);
+    sokol_spatial_iter_t it;
+    sokol_spatial_iter_init(&it, index, min, max);
 
-        // Copy color data
-        if (ecs_field_is_self(&qit, 1)) {
-            ecs_os_memcpy_n( ecs_vec_get_t(&buffers->colors_data, ecs_rgb_t, cur), 
-                colors, ecs_rgb_t, count);
-        } else {
-            for (i = 0; i < count; i ++) {
-                *ecs_vec_get_t(&buffers->colors_data, ecs_rgb_t, cur + i) = colors[0];
+    sokol_spatial_cell_t *cell;
+    while ((cell = sokol_spatial_iter_next(&it))) {
+        if (glm_vec3_distance(cell->bounds, (float*)center) >
+            (cell->bounds[3] + radius))
+        {
+            continue;
+        }
+
+        const vec4 *spheres = ecs_vec_first_t(&cell->spheres, vec4);
+        const ecs_entity_t *entities = ecs_vec_first_t(
+            &cell->entities, ecs_entity_t);
+        int32_t i, count = ecs_vec_count(&cell->spheres);
+        for (i = 0; i < count; i ++) {
+            if (glm_vec3_distance((float*)spheres[i], (float*)center) >
+                (spheres[i][3] + radius))
+            {
+                continue;
+            }
+            if (!callback(entities[i], spheres[i], ctx)) {
+                return false;
             }
         }
+    }
 
-        if (emissive || specular) {
-            SokolMaterial *m = ecs_vec_get_t(
-                &buffers->materials_data, SokolMaterial, cur);
-            if (emissive) {
-                if (ecs_field_is_self(&qit, 2)) {
-                    for (i = 0; i < count; i ++) {
-                        m[i].emissive = emissive[i].value;
-                    }
-                } else {
-                    for (i = 0; i < count; i ++) {
-                        m[i].emissive = emissive->value;
-                    }
-                }
-            } else {
-                for (i = 0; i < count; i ++) {
-                    m[i].emissive = 0;
-                }
+    return true;
+}
+
+bool sokol_spatial_overlap_box(
+    const sokol_spatial_index_t *index,
+    const vec3 min,
+    const vec3 max,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+    sokol_spatial_iter_t it;
+    sokol_spatial_iter_init(&it, index, min, max);
+
+    sokol_spatial_cell_t *cell;
+    while ((cell = sokol_spatial_iter_next(&it))) {
+        float r = cell->bounds[3];
+        if (sokol_box_distance2(cell->bounds, min, max) > (r * r)) {
+            continue;
+        }
+
+        const vec4 *spheres = ecs_vec_first_t(&cell->spheres, vec4);
+        const ecs_entity_t *entities = ecs_vec_first_t(
+            &cell->entities, ecs_entity_t);
+        int32_t i, count = ecs_vec_count(&cell->spheres);
+        for (i = 0; i < count; i ++) {
+            r = spheres[i][3];
+            if (sokol_box_distance2(spheres[i], min, max) > (r * r)) {
+                continue;
+            }
+            if (!callback(entities[i], spheres[i], ctx)) {
+                return false;
             }
+        }
+    }
 
-            if (specular) {
-                if (ecs_field_is_self(&qit, 3)) {
-                    for (i = 0; i < count; i ++) {
-                        m[i].specular_power = specular[i].specular_power;
-                        m[i].shininess = specular[i].shininess;
-                    }
-                } else {
-                    for (i = 0; i < count; i ++) {
-                        m[i].specular_power = specular->specular_power;
-                        m[i].shininess = specular->shininess;
-                    }
-                }
-            } else {
-                for (i = 0; i < count; i ++) {
-                    m[i].specular_power = 0;
-                    m[i].shininess = 0;
+    return true;
+}
+
+// Test instances of cell against ray, and update nearest hit
+static
+void sokol_spatial_raycast_cell(
+    const sokol_spatial_cell_t *cell,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance,
+    ecs_entity_t *result)
+{
+    float t = sokol_ray_sphere(cell->bounds, origin, direction);
+    if (t < 0 || t >= *distance) {
+        return;
+    }
+
+    const vec4 *spheres = ecs_vec_first_t(&cell->spheres, vec4);
+    const ecs_entity_t *entities = ecs_vec_first_t(
+        &cell->entities, ecs_entity_t);
+    int32_t i, count = ecs_vec_count(&cell->spheres);
+    for (i = 0; i < count; i ++) {
+        t = sokol_ray_sphere(spheres[i], origin, direction);
+        if (t >= 0 && t < *distance) {
+            *distance = t;
+            *result = entities[i];
+        }
+    }
+}
+
+// Test occupied cells in range of cell coordinates against ray
+static
+void sokol_spatial_raycast_range(
+    const sokol_spatial_index_t *index,
+    const int32_t *min,
+    const int32_t *max,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance,
+    ecs_entity_t *result)
+{
+    int32_t lo[3], hi[3], c[3];
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        lo[i] = glm_imax(min[i], index->cell_min[i]);
+        hi[i] = glm_imin(max[i], index->cell_max[i]);
+        if (hi[i] < lo[i]) {
+            return;
+        }
+    }
+
+    for (c[0] = lo[0]; c[0] <= hi[0]; c[0] ++) {
+        for (c[1] = lo[1]; c[1] <= hi[1]; c[1] ++) {
+            for (c[2] = lo[2]; c[2] <= hi[2]; c[2] ++) {
+                const sokol_spatial_cell_t *cell = ecs_map_get_deref(
+                    &index->cells, sokol_spatial_cell_t,
+                    sokol_spatial_coords_key(c));
+                if (cell) {
+                    sokol_spatial_raycast_cell(
+                        cell, origin, direction, distance, result);
                 }
             }
-        } else {
-            ecs_os_memset_n(
-                ecs_vec_get_t(&buffers->materials_data, SokolMaterial, cur), 
-                    0, SokolMaterial, count);
         }
+    }
+}
 
-        // Apply geometry-specific scaling to transform matrix
-        geometry->populate(ecs_vec_get_t(&buffers->transforms_data, mat4, cur), 
-            geometry_data, count, geometry_self);
+ecs_entity_t sokol_spatial_raycast(
+    const sokol_spatial_index_t *index,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance)
+{
+    ecs_entity_t result = 0;
+    if (!index->count) {
+        return 0;
     }
 
-    // Populate sokol buffers
-    {
-        ecs_size_t new_size = ecs_vec_size(&buffers->colors_data);
-        if (new_size != old_size) {
-            if (old_size) {
-                sg_destroy_buffer(buffers->colors);
-                sg_destroy_buffer(buffers->transforms);
-                sg_destroy_buffer(buffers->materials);
+    // A hit point is within max_radius of the center of the instance, so the
+    // instance is stored at most k cells away from a cell the ray crosses.
+    int32_t k = (int32_t)ceilf(index->max_radius / SOKOL_SPATIAL_CELL_SIZE);
+
+    // Clip ray to the occupied cells, expanded by k cells
+    float t_min = 0, t_max = *distance;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        float lo = (float)(index->cell_min[i] - k);
+        float hi = (float)(index->cell_max[i] + k + 1);
+        lo *= SOKOL_SPATIAL_CELL_SIZE;
+        hi *= SOKOL_SPATIAL_CELL_SIZE;
+        if (direction[i] == 0) {
+            if (origin[i] < lo || origin[i] > hi) {
+                return 0;
             }
+            continue;
+        }
+
+        float t0 = (lo - origin[i]) / direction[i];
+        float t1 = (hi - origin[i]) / direction[i];
+        t_min = glm_max(t_min, glm_min(t0, t1));
+        t_max = glm_min(t_max, glm_max(t0, t1));
+    }
+
+    if (t_min > t_max) {
+        return 0;
+    }
+
+    // Each step of the ray visits the (2k + 1)^2 cells that weren't in the
+    // neighborhood of the previous cell. If that adds up to more lookups than
+    // there are cells, it's cheaper to test all cells.
+    float steps = 1;
+    for (i = 0; i < 3; i ++) {
+        steps += fabsf(direction[i]) * (t_max - t_min) /
+            SOKOL_SPATIAL_CELL_SIZE + 1;
+    }
+    float side = (float)(2 * k + 1);
+    if ((steps * side * side) > (float)ecs_map_count(&index->cells)) {
+        ecs_map_iter_t mit = ecs_map_iter(&index->cells);
+        while (ecs_map_next(&mit)) {
+            sokol_spatial_raycast_cell(ecs_map_ptr(&mit),
+                origin, direction, distance, &result);
+        }
+        return result;
+    }
+
+    // Step through the cells that the ray crosses
+    int32_t cur[3], step[3], lo[3], hi[3];
+    float next[3], delta[3];
+    for (i = 0; i < 3; i ++) {
+        float p = origin[i] + direction[i] * t_min;
+        cur[i] = glm_imax(glm_imin(sokol_spatial_coord(p),
+            index->cell_max[i] + k), index->cell_min[i] - k);
+        if (direction[i] > 0) {
+            float edge = (float)(cur[i] + 1) * SOKOL_SPATIAL_CELL_SIZE;
+            step[i] = 1;
+            next[i] = t_min + (edge - p) / direction[i];
+            delta[i] = SOKOL_SPATIAL_CELL_SIZE / direction[i];
+        } else if (direction[i] < 0) {
+            float edge = (float)cur[i] * SOKOL_SPATIAL_CELL_SIZE;
+            step[i] = -1;
+            next[i] = t_min + (edge - p) / direction[i];
+            delta[i] = -SOKOL_SPATIAL_CELL_SIZE / direction[i];
+        } else {
+            step[i] = 0;
+            next[i] = FLT_MAX;
+            delta[i] = 0;
+        }
+        lo[i] = cur[i] - k;
+        hi[i] = cur[i] + k;
+    }
+
+    sokol_spatial_raycast_range(
+        index, lo, hi, origin, direction, distance, &result);
 
-            buffers->colors = sg_make_buffer(&(sg_buffer_desc){
-                .size = new_size * sizeof(ecs_rgb_t), .usage = SG_USAGE_STREAM });
-            buffers->transforms = sg_make_buffer(&(sg_buffer_desc){
-                .size = new_size * sizeof(EcsTransform3), .usage = SG_USAGE_STREAM });
-            buffers->materials = sg_make_buffer(&(sg_buffer_desc){
-                .size = new_size * sizeof(SokolMaterial), .usage = SG_USAGE_STREAM });
+    for (;;) {
+        int32_t a = 0;
+        if (next[1] < next[a]) a = 1;
+        if (next[2] < next[a]) a = 2;
+
+        // Cells further along the ray can't contain a closer hit
+        if (next[a] >= *distance) {
+            break;
         }
 
-        buffers->instance_count = ecs_vec_count(&buffers->colors_data);
+        cur[a] += step[a];
+        if (cur[a] < (index->cell_min[a] - k) ||
+            cur[a] > (index->cell_max[a] + k))
+        {
+            break;
+        }
 
-        if (buffers->instance_count > 0) {
-            sg_update_buffer(buffers->colors, &(sg_range) {
-                ecs_vec_first_t(&buffers->colors_data, ecs_rgb_t), 
-                    buffers->instance_count * sizeof(ecs_rgb_t) } );
-            sg_update_buffer(buffers->transforms, &(sg_range) {
-                ecs_vec_first_t(&buffers->transforms_data, mat4), 
-                    buffers->instance_count * sizeof(mat4) } );
-            sg_update_buffer(buffers->materials, &(sg_range) {
-                ecs_vec_first_t(&buffers->materials_data, SokolMaterial), 
-                    buffers->instance_count * sizeof(SokolMaterial) } );
+        for (i = 0; i < 3; i ++) {
+            lo[i] = cur[i] - k;
+            hi[i] = cur[i] + k;
         }
+        lo[a] = hi[a] = cur[a] + step[a] * k;
+
+        sokol_spatial_raycast_range(
+            index, lo, hi, origin, direction, distance, &result);
+
+        next[a] += delta[a];
     }
+
+    return result;
 }
 
-// System that matches all geometry kinds & calls the function to update GPU
-// buffers with ECS data.
+#endif
+
+#include <float.h>
+
+#if SOKOL_CLUSTERED_LIGHTS
+
+#define SOKOL_CLUSTER_LIGHT_ROWS \
+    ((SOKOL_CLUSTER_MAX_LIGHTS * 2 + SOKOL_CLUSTER_TEXTURE_WIDTH - 1) / \
+        SOKOL_CLUSTER_TEXTURE_WIDTH)
+#define SOKOL_CLUSTER_INDEX_ROWS \
+    ((SOKOL_CLUSTER_MAX_INDICES + SOKOL_CLUSTER_TEXTURE_WIDTH - 1) / \
+        SOKOL_CLUSTER_TEXTURE_WIDTH)
+
 static
-void SokolPopulateGeometry(
-    ecs_iter_t *it) 
+sg_image sokol_cluster_image(
+    const char *label,
+    int32_t width,
+    int32_t height,
+    sg_pixel_format format)
 {
-    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
-    SokolGeometryQuery *q = ecs_field(it, SokolGeometryQuery, 1);
+    return sg_make_image(&(sg_image_desc){
+        .width = width,
+        .height = height,
+        .usage = SG_USAGE_STREAM,
+        .pixel_format = format,
+        .min_filter = SG_FILTER_NEAREST,
+        .mag_filter = SG_FILTER_NEAREST,
+        .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+        .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
+        .label = label
+    });
+}
 
-    int i;
-    for (i = 0; i < it->count; i ++) {
-        sokol_populate_buffers(&g[i], &g[i].solid, q[i].solid);    
+void sokol_clusters_init(
+    sokol_light_clusters_t *c)
+{
+    ecs_os_zeromem(c);
+
+    c->lights = sokol_cluster_image("Cluster lights",
+        SOKOL_CLUSTER_TEXTURE_WIDTH, SOKOL_CLUSTER_LIGHT_ROWS,
+        SG_PIXELFORMAT_RGBA32F);
+    c->clusters = sokol_cluster_image("Clusters",
+        SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y, SOKOL_CLUSTER_Z,
+        SG_PIXELFORMAT_RG32UI);
+    c->indices = sokol_cluster_image("Cluster light indices",
+        SOKOL_CLUSTER_TEXTURE_WIDTH, SOKOL_CLUSTER_INDEX_ROWS,
+        SG_PIXELFORMAT_R32UI);
+
+    c->light_data = ecs_os_calloc_n(float,
+        SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_LIGHT_ROWS * 4);
+    c->cluster_data = ecs_os_calloc_n(uint32_t, SOKOL_CLUSTER_COUNT * 2);
+    c->index_data = ecs_os_calloc_n(uint32_t,
+        SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_INDEX_ROWS);
+    c->spheres = ecs_os_malloc_n(vec4, SOKOL_CLUSTER_MAX_LIGHTS);
+}
+
+void sokol_clusters_fini(
+    sokol_light_clusters_t *c)
+{
+    sg_destroy_image(c->lights);
+    sg_destroy_image(c->clusters);
+    sg_destroy_image(c->indices);
+    ecs_os_free(c->light_data);
+    ecs_os_free(c->cluster_data);
+    ecs_os_free(c->index_data);
+    ecs_os_free(c->spheres);
+
+    int32_t i;
+    for (i = 0; i < c->stage_size; i ++) {
+        sokol_cluster_stage_t *s = &c->stages[i];
+        ecs_vec_fini_t(NULL, &s->indices, uint32_t);
+        ecs_vec_fini_t(NULL, &s->slice_lights, int32_t);
+        ecs_vec_fini_t(NULL, &s->slice_spheres, vec4);
+        ecs_vec_fini_t(NULL, &s->row_lights, int32_t);
+        ecs_vec_fini_t(NULL, &s->row_spheres, vec4);
+        ecs_vec_fini_t(NULL, &s->tile_lights, int32_t);
+    }
+    ecs_os_free(c->stages);
+}
+
+// Plane of points for which the projected axis is larger (sign = 1) or
+// smaller (sign = -1) than value. Axis and w are rows of the view projection.
+static
+void sokol_cluster_plane(
+    const vec4 axis,
+    const vec4 w,
+    float value,
+    float sign,
+    vec4 out)
+{
+    int32_t i;
+    for (i = 0; i < 4; i ++) {
+        out[i] = sign * (axis[i] - value * w[i]);
     }
+    glm_plane_normalize(out);
 }
 
+// Range of depth slices that are binned by a stage
 static
-void CreateGeometryQueries(ecs_iter_t *it) {
-    ecs_world_t *world = it->world;
-    SokolGeometryQuery *gq = ecs_field(it, SokolGeometryQuery, 1);
+void sokol_cluster_slices(
+    int32_t stage_id,
+    int32_t stage_count,
+    int32_t *z_begin,
+    int32_t *z_end)
+{
+    *z_begin = stage_id * SOKOL_CLUSTER_Z / stage_count;
+    *z_end = (stage_id + 1) * SOKOL_CLUSTER_Z / stage_count;
+}
+
+void sokol_clusters_prepare(
+    sokol_light_clusters_t *c,
+    const ecs_vec_t *lights,
+    const vec3 eye_pos,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float near_,
+    float far_,
+    int32_t stage_count)
+{
+    const sokol_light_t *l = ecs_vec_first(lights);
+    int32_t i, count = ecs_vec_count(lights);
+    if (count > SOKOL_CLUSTER_MAX_LIGHTS) {
+        count = SOKOL_CLUSTER_MAX_LIGHTS;
+    }
 
-    int i;
-    for (i = 0; i < it->count; i ++) {
-        // Geometry query that includes all components that are copied (or used
-        // to find data to copy) to GPU buffers.
-        ecs_query_desc_t desc = {
-            .terms = {{
-                .id        = ecs_id(EcsTransform3), 
-                .src.id    = EcsSelf,
-                .inout     = EcsIn
-            }, {
-                .id        = ecs_id(EcsRgb),
-                .inout     = EcsIn
-            }, {
-                .id        = ecs_id(EcsEmissive),
-                .inout     = EcsInOutNone,
-                .oper      = EcsOptional
-            }, {
-                .id        = ecs_id(EcsSpecular),
-                .inout     = EcsInOutNone,
-                .oper      = EcsOptional
-            }, {
-                .id        = gq[i].component, 
-                .inout     = EcsIn
-            }},
-            .cache_kind = EcsQueryCacheAuto
-        };
+    for (i = 0; i < count; i ++) {
+        float *t = &c->light_data[i * 8];
+        glm_vec3_copy((float*)l[i].position, t);
+        t[3] = l[i].distance;
+        glm_vec3_copy((float*)l[i].color, &t[4]);
+        t[7] = 0;
 
-        /* Query for solid objects */
-        desc.entity = ecs_entity(world, {
-            .name = ecs_get_name(world, gq[i].component),
-            .parent = ecs_entity(world, {
-                .name = "#0.flecs.systems.sokol.geometry_queries.solid"
-            })
-        });
+        glm_vec3_add((float*)l[i].position, (float*)eye_pos, c->spheres[i]);
+        c->spheres[i][3] = l[i].distance * SOKOL_LIGHT_RANGE;
+    }
+    c->light_count = count;
 
-        gq[i].solid = ecs_query_init(world, &desc);
-        if (!gq[i].solid) {
-            char *component_str = ecs_id_str(world, gq[i].component);
-            ecs_err("sokol: failed to create query for solid %s geometry", 
-                component_str);
-            ecs_os_free(component_str);
-        }
+    // Planes through the eye and the tile edges in normalized device space
+    vec4 r0, r1, r3;
+    for (i = 0; i < 4; i ++) {
+        r0[i] = mat_vp[i][0];
+        r1[i] = mat_vp[i][1];
+        r3[i] = mat_vp[i][3];
+    }
+
+    sokol_cluster_plane(r0, r3, -1, 1, c->frustum[0]);
+    sokol_cluster_plane(r0, r3, 1, -1, c->frustum[1]);
+    sokol_cluster_plane(r1, r3, -1, 1, c->frustum[2]);
+    sokol_cluster_plane(r1, r3, 1, -1, c->frustum[3]);
+
+    for (i = 0; i < SOKOL_CLUSTER_X; i ++) {
+        float x0 = -1.0f + 2.0f * (float)i / SOKOL_CLUSTER_X;
+        float x1 = -1.0f + 2.0f * (float)(i + 1) / SOKOL_CLUSTER_X;
+        sokol_cluster_plane(r0, r3, x0, 1, c->x_planes[i][0]);
+        sokol_cluster_plane(r0, r3, x1, -1, c->x_planes[i][1]);
+    }
+
+    for (i = 0; i < SOKOL_CLUSTER_Y; i ++) {
+        float y0 = -1.0f + 2.0f * (float)i / SOKOL_CLUSTER_Y;
+        float y1 = -1.0f + 2.0f * (float)(i + 1) / SOKOL_CLUSTER_Y;
+        sokol_cluster_plane(r1, r3, y0, 1, c->y_planes[i][0]);
+        sokol_cluster_plane(r1, r3, y1, -1, c->y_planes[i][1]);
+    }
+
+    // Depth slices, where depth is the negated z coordinate in view space
+    vec4 z;
+    for (i = 0; i < 4; i ++) {
+        z[i] = mat_v[i][2];
+    }
+
+    near_ = glm_max(near_, 0.001f);
+    far_ = glm_max(far_, near_ * 2.0f);
+    for (i = 0; i < SOKOL_CLUSTER_Z; i ++) {
+        float d0 = near_ * powf(far_ / near_, (float)i / SOKOL_CLUSTER_Z);
+        float d1 = near_ * powf(far_ / near_, (float)(i + 1) / SOKOL_CLUSTER_Z);
+        sokol_cluster_plane(z, (vec4){0, 0, 0, 1}, -d0, -1, c->z_planes[i][0]);
+        sokol_cluster_plane(z, (vec4){0, 0, 0, 1}, -d1, 1, c->z_planes[i][1]);
+    }
+
+    // The first and last slice extend to the eye and to infinity
+    c->z_planes[0][0][3] = FLT_MAX;
+    c->z_planes[SOKOL_CLUSTER_Z - 1][1][3] = FLT_MAX;
+
+    c->depth_scale = SOKOL_CLUSTER_Z / logf(far_ / near_);
+    c->depth_bias = -logf(near_) * c->depth_scale;
+
+    // Stage data is only accessed by the stage, so allocate it here
+    if (stage_count > c->stage_size) {
+        c->stages = ecs_os_realloc_n(c->stages, sokol_cluster_stage_t,
+            stage_count);
+        ecs_os_memset_n(&c->stages[c->stage_size], 0, sokol_cluster_stage_t,
+            stage_count - c->stage_size);
+        c->stage_size = stage_count;
+    }
+    c->stage_count = stage_count;
+
+    for (i = 0; i < stage_count; i ++) {
+        sokol_cluster_stage_t *s = &c->stages[i];
+        ecs_vec_clear(&s->indices);
+        ecs_vec_set_count_t(NULL, &s->slice_lights, int32_t, count);
+        ecs_vec_set_count_t(NULL, &s->slice_spheres, vec4, count);
+        ecs_vec_set_count_t(NULL, &s->row_lights, int32_t, count);
+        ecs_vec_set_count_t(NULL, &s->row_spheres, vec4, count);
+        ecs_vec_set_count_t(NULL, &s->tile_lights, int32_t, count);
     }
 }
 
-void FlecsSystemsSokolGeometryImport(
-    ecs_world_t *world)
+// Cull spheres against planes, and store the spheres & light ids that pass.
+// If ids is NULL, the sphere index is the light id.
+static
+int32_t sokol_cluster_cull(
+    const vec4 *spheres,
+    const int32_t *ids,
+    int32_t count,
+    const vec4 *planes,
+    vec4 *spheres_out,
+    int32_t *ids_out)
 {
-    ECS_MODULE(world, FlecsSystemsSokolGeometry);
-    ECS_IMPORT(world, FlecsComponentsTransform);
-    ECS_IMPORT(world, FlecsComponentsGeometry);
-    ECS_IMPORT(world, FlecsSystemsTransform);
-    ECS_IMPORT(world, FlecsGame);
-
-    /* Store components in parent sokol scope */
-    ecs_entity_t parent = ecs_lookup(world, "flecs.systems.sokol");
-    ecs_entity_t module = ecs_set_scope(world, parent);
-    ecs_set_name_prefix(world, "Sokol");
+    int32_t i, result = sokol_cull_spheres(ids_out, spheres, count, planes);
+    for (i = 0; i < result; i ++) {
+        int32_t index = ids_out[i];
+        glm_vec4_copy((float*)spheres[index], spheres_out[i]);
+        if (ids) {
+            ids_out[i] = ids[index];
+        }
+    }
+    return result;
+}
 
-    ECS_COMPONENT_DEFINE(world, SokolGeometry);
-    ECS_COMPONENT_DEFINE(world, SokolGeometryQuery);
+void sokol_clusters_bin(
+    sokol_light_clusters_t *c,
+    int32_t stage_id)
+{
+    sokol_cluster_stage_t *s = &c->stages[stage_id];
+    int32_t *slice_lights = ecs_vec_first(&s->slice_lights);
+    vec4 *slice_spheres = ecs_vec_first(&s->slice_spheres);
+    int32_t *row_lights = ecs_vec_first(&s->row_lights);
+    vec4 *row_spheres = ecs_vec_first(&s->row_spheres);
+    int32_t *tile_lights = ecs_vec_first(&s->tile_lights);
+    int32_t x, y, z, z_begin, z_end, i;
+    vec4 planes[6];
+
+    sokol_cluster_slices(stage_id, c->stage_count, &z_begin, &z_end);
+
+    // Lights are culled per slice, then per row of the slice, and then per
+    // tile of the row, so that each test only uses the lights of its parent.
+    for (z = z_begin; z < z_end; z ++) {
+        ecs_os_memcpy_n(planes, c->frustum, vec4, 4);
+        ecs_os_memcpy_n(&planes[4], c->z_planes[z], vec4, 2);
+        int32_t slice_count = sokol_cluster_cull(c->spheres, NULL,
+            c->light_count, planes, slice_spheres, slice_lights);
+
+        for (y = 0; y < SOKOL_CLUSTER_Y; y ++) {
+            int32_t row_count = 0;
+            if (slice_count) {
+                ecs_os_memcpy_n(&planes[2], c->y_planes[y], vec4, 2);
+                row_count = sokol_cluster_cull(slice_spheres, slice_lights,
+                    slice_count, planes, row_spheres, row_lights);
+            }
+
+            for (x = 0; x < SOKOL_CLUSTER_X; x ++) {
+                uint32_t *cluster = &c->cluster_data[
+                    ((z * SOKOL_CLUSTER_Y + y) * SOKOL_CLUSTER_X + x) * 2];
+                cluster[0] = (uint32_t)ecs_vec_count(&s->indices);
+                cluster[1] = 0;
+                if (!row_count) {
+                    continue;
+                }
 
-    ecs_set_hooks(world, SokolGeometry, {
-        .ctor = ecs_ctor(SokolGeometry),
-        .move = ecs_move(SokolGeometry),
-        .dtor = ecs_dtor(SokolGeometry)
-    });
+                vec4 tile_planes[6];
+                ecs_os_memcpy_n(tile_planes, c->x_planes[x], vec4, 2);
+                ecs_os_memcpy_n(&tile_planes[2], &planes[2], vec4, 4);
+                int32_t tile_count = sokol_cull_spheres(
+                    tile_lights, row_spheres, row_count, tile_planes);
+                if (!tile_count) {
+                    continue;
+                }
 
-    ecs_set_scope(world, module);
+                uint32_t *dst = ecs_vec_grow_t(
+                    NULL, &s->indices, uint32_t, tile_count);
+                for (i = 0; i < tile_count; i ++) {
+                    dst[i] = (uint32_t)row_lights[tile_lights[i]];
+                }
+                cluster[1] = (uint32_t)tile_count;
+            }
+        }
+    }
+}
 
-    /* Create queries for solid objects */
-    ECS_OBSERVER(world, CreateGeometryQueries, EcsOnSet, 
-        Geometry, GeometryQuery);
+void sokol_clusters_upload(
+    sokol_light_clusters_t *c)
+{
+    int32_t s, z, i, base = 0, dropped = 0;
+
+    // Concatenate indices of stages, and offset clusters of stages
+    for (s = 0; s < c->stage_count; s ++) {
+        const sokol_cluster_stage_t *stage = &c->stages[s];
+        int32_t count = ecs_vec_count(&stage->indices);
+        int32_t copy = glm_imin(count, SOKOL_CLUSTER_MAX_INDICES - base);
+        if (copy) {
+            ecs_os_memcpy_n(&c->index_data[base],
+                ecs_vec_first(&stage->indices), uint32_t, copy);
+        }
+
+        int32_t z_begin, z_end;
+        sokol_cluster_slices(s, c->stage_count, &z_begin, &z_end);
+        for (z = z_begin; z < z_end; z ++) {
+            uint32_t *cluster = &c->cluster_data[
+                z * SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y * 2];
+            for (i = 0; i < SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y; i ++) {
+                // Drop lights of clusters that don't fit in the index texture
+                uint32_t max = SOKOL_CLUSTER_MAX_INDICES;
+                uint32_t offset = cluster[i * 2] + (uint32_t)base;
+                if (offset > max) {
+                    offset = max;
+                }
+                if (cluster[i * 2 + 1] > (max - offset)) {
+                    cluster[i * 2 + 1] = max - offset;
+                }
+                cluster[i * 2] = offset;
+            }
+        }
 
-    /* Support for rectangle primitive */
-    ECS_ENTITY_DEFINE(world, SokolRectangleGeometry, Geometry);
-        ecs_set(world, SokolRectangleGeometry, SokolGeometryQuery, {
-            .component = ecs_id(EcsRectangle)
-        });
+        base += copy;
+        dropped += count - copy;
+    }
 
-    /* Support for box primitive */
-    ECS_ENTITY_DEFINE(world, SokolBoxGeometry, Geometry);
-        ecs_set(world, SokolBoxGeometry, SokolGeometryQuery, {
-            .component = ecs_id(EcsBox)
-        });
+    c->index_count = base;
+    c->indices_dropped = dropped;
+    if (dropped) {
+        ecs_dbg_3("sokol: %d clustered light indices dropped", dropped);
+    }
 
-    /* Create system that manages buffers */
-    ECS_SYSTEM(world, SokolPopulateGeometry, EcsPreStore, 
-        Geometry, [in] GeometryQuery);
+    sg_update_image(c->lights, &(sg_image_data){
+        .subimage[0][0] = { c->light_data, sizeof(float) * 4 *
+            SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_LIGHT_ROWS }
+    });
+    sg_update_image(c->clusters, &(sg_image_data){
+        .subimage[0][0] = { c->cluster_data,
+            sizeof(uint32_t) * 2 * SOKOL_CLUSTER_COUNT }
+    });
+    sg_update_image(c->indices, &(sg_image_data){
+        .subimage[0][0] = { c->index_data, sizeof(uint32_t) *
+            SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_INDEX_ROWS }
+    });
 }
 
+#endif
+
 #include "math.h"
 
 ECS_COMPONENT_DECLARE(SokolRenderer);
 
+/* Number of segments of procedural primitives, per level of detail */
+static const int32_t sokol_primitive_segments[SOKOL_MAX_LODS] = { 32, 16, 8 };
+
 /* Static geometry/texture resources */
 static
 sokol_resources_t sokol_init_resources(void) {
-    return (sokol_resources_t){
+    sokol_resources_t result = {
         .quad = sokol_buffer_quad(),
 
         .rect = sokol_buffer_rectangle(),
         .rect_indices = sokol_buffer_rectangle_indices(),
         .rect_normals = sokol_buffer_rectangle_normals(),
+        .rect_impostor_indices = sokol_buffer_rectangle_impostor_indices(),
 
         .box = sokol_buffer_box(),
         .box_indices = sokol_buffer_box_indices(),
@@ -32674,6 +40329,16 @@ sokol_resources_t sokol_init_resources(void) {
 
         .noise_texture = sokol_noise_texture(16, 16)
     };
+
+    int32_t i;
+    for (i = 0; i < SOKOL_MAX_LODS; i ++) {
+        int32_t segments = sokol_primitive_segments[i];
+        result.sphere[i] = sokol_mesh_sphere(segments);
+        result.cylinder[i] = sokol_mesh_cylinder(segments);
+        result.cone[i] = sokol_mesh_cone(segments);
+    }
+
+    return result;
 }
 
 static
@@ -32877,8 +40542,8 @@ void sokol_init_global_uniforms(
     u->ortho = false;
 
     /* If camera is set, get values */
-    if (state->camera) {
-        EcsCamera cam = *state->camera;
+    if (state->has_camera) {
+        EcsCamera cam = state->camera;
 
         if (cam.fov) {
             u->fov = cam.fov;
@@ -32921,8 +40586,8 @@ void sokol_init_global_uniforms(
     glm_mat4_inv(u->mat_v, u->inv_mat_v);
 
     /* Light parameters */
-    if (state->light) {
-        EcsDirectionalLight l = *state->light;
+    if (state->has_light) {
+        EcsDirectionalLight l = state->light;
         glm_vec3_copy(l.direction, u->sun_direction);
         glm_vec3_copy(l.color, u->sun_color);
         u->sun_intensity = l.intensity;
@@ -32962,81 +40627,186 @@ void sokol_init_global_uniforms(
     sokol_world_to_screen(lookat, u->eye_horizon, state);
 }
 
+/* Store point light with position relative to the eye */
+static
+void sokol_init_light(
+    sokol_light_t *light,
+    const EcsPointLight *l,
+    const EcsTransform3 *m,
+    const vec3 eye_pos)
+{
+    glm_vec3_copy((float*)l->color, light->color);
+
+    light->color[0] *= l->intensity;
+    light->color[1] *= l->intensity;
+    light->color[2] *= l->intensity;
+
+    light->position[0] = m->value[3][0] - eye_pos[0];
+    light->position[1] = m->value[3][1] - eye_pos[1];
+    light->position[2] = m->value[3][2] - eye_pos[2];
+
+    light->distance = l->distance;
+}
+
+/* Visible light, with an estimate of its contribution to the frame */
+typedef struct sokol_light_candidate_t {
+    sokol_light_t light;
+    ecs_entity_t entity;
+    float score;
+} sokol_light_candidate_t;
+
+/* Partially sort candidates so that the k candidates with the highest score
+ * come first, in no particular order. */
+static
+void sokol_select_lights(
+    sokol_light_candidate_t *c,
+    int32_t count,
+    int32_t k)
+{
+    int32_t lo = 0, hi = count - 1, nth = k - 1;
+    while (lo < hi) {
+        float pivot = c[lo + (hi - lo) / 2].score;
+        int32_t i = lo, j = hi;
+        while (i <= j) {
+            while (c[i].score > pivot) i ++;
+            while (c[j].score < pivot) j --;
+            if (i <= j) {
+                sokol_light_candidate_t tmp = c[i];
+                c[i ++] = c[j];
+                c[j --] = tmp;
+            }
+        }
+
+        if (nth <= j) {
+            hi = j;
+        } else if (nth >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+}
+
+/* Select the max_count visible lights with the largest contribution */
 static
-int sokol_qsort_light_compare(const void *ptr1, const void *ptr2) {
-    const sokol_light_t *l1 = ptr1;
-    const sokol_light_t *l2 = ptr2;
+void sokol_select_visible_lights(
+    SokolRenderer *r,
+    sokol_render_state_t *state,
+    const vec3 eye_pos,
+    int32_t max_count)
+{
+    sokol_light_candidate_t *candidates = ecs_vec_first(&r->light_candidates);
+    int32_t i, count = ecs_vec_count(&r->light_candidates);
+
+    /* Cull lights of which the range doesn't intersect with the frustum */
+    ecs_vec_set_count_t(NULL, &r->light_spheres, vec4, count);
+    ecs_vec_set_count_t(NULL, &r->light_visible, int32_t, count);
+    vec4 *spheres = ecs_vec_first(&r->light_spheres);
+    int32_t *visible = ecs_vec_first(&r->light_visible);
+    for (i = 0; i < count; i ++) {
+        const sokol_light_t *light = &candidates[i].light;
+        glm_vec3_add((float*)light->position, (float*)eye_pos, spheres[i]);
+        spheres[i][3] = light->distance * SOKOL_LIGHT_RANGE;
+    }
+
+    vec4 planes[6];
+    glm_frustum_planes(state->uniforms.mat_vp, planes);
+    count = sokol_cull_spheres(visible, (const vec4*)spheres, count,
+        (const vec4*)planes);
+
+    /* Rank lights by their brightest color channel, attenuated by the
+     * distance to the eye. Lights that were selected in the last frame get
+     * a higher score, so that lights with a similar score don't flicker. */
+    for (i = 0; i < count; i ++) {
+        sokol_light_candidate_t *c = &candidates[i];
+        *c = candidates[visible[i]];
+        const float *color = c->light.color;
+        float brightness = glm_max(color[0], glm_max(color[1], color[2]));
+        float d = glm_vec3_norm(c->light.position);
+        c->score = brightness * expf(-d / c->light.distance);
+        if (ecs_map_get(&r->lights_selected, c->entity)) {
+            c->score *= SOKOL_LIGHT_HYSTERESIS;
+        }
+    }
+
+    int32_t lights_count = glm_imin(count, max_count);
+    if (count > lights_count) {
+        sokol_select_lights(candidates, count, lights_count);
+    }
 
-    float d1 = pow(l1->position[0], 2.0) + 
-               pow(l1->position[2], 2.0);
-    float d2 = pow(l2->position[0], 2.0) + 
-               pow(l2->position[2], 2.0);
+    r->lights_dropped = count - lights_count;
+    if (r->lights_dropped) {
+        ecs_dbg_3("sokol: %d visible lights dropped", r->lights_dropped);
+    }
 
-    return (d1 > d2) - (d1 < d2);
+    ecs_vec_set_count_t(NULL, &r->lights, sokol_light_t, lights_count);
+    sokol_light_t *lights = ecs_vec_first(&r->lights);
+    ecs_map_clear(&r->lights_selected);
+    for (i = 0; i < lights_count; i ++) {
+        lights[i] = candidates[i].light;
+        ecs_map_insert(&r->lights_selected, candidates[i].entity, 0);
+    }
 }
 
 /* Collect lights */
 static
 void sokol_gather_lights(ecs_world_t *world, SokolRenderer *r, sokol_render_state_t *state) {
-    ecs_vec_clear(&r->lights);
+    /* Light positions are relative to the eye, so lights only need to be
+     * collected again if lights or the camera changed. */
+    bool changed = ecs_query_changed(r->lights_query);
+    changed |= !r->lights_valid;
+    changed |= ecs_os_memcmp(r->lights_mat_vp, state->uniforms.mat_vp,
+        ECS_SIZEOF(mat4)) != 0;
+    changed |= ecs_os_memcmp(r->lights_eye_pos, state->uniforms.eye_pos,
+        ECS_SIZEOF(vec3)) != 0;
+    if (!changed) {
+        state->lights = r->lights;
+        return;
+    }
 
     vec3 eye_pos;
     glm_vec3_copy(state->uniforms.eye_pos, eye_pos);
 
     eye_pos[0] *= -1;
 
+    ecs_vec_t *dst = &r->light_candidates;
+    ecs_vec_clear(dst);
+
     ecs_iter_t it = ecs_query_iter(world, r->lights_query);
     while (ecs_query_next(&it)) {
         EcsPointLight *l = ecs_field(&it, EcsPointLight, 0);
         EcsTransform3 *m = ecs_field(&it, EcsTransform3, 1);
 
         for (int i = 0; i < it.count; i ++) {
-            sokol_light_t *light = ecs_vec_append_t(
-                NULL, &r->lights, sokol_light_t);
-            glm_vec3_copy(l[i].color, light->color);
-
-            light->color[0] *= l[i].intensity;
-            light->color[1] *= l[i].intensity;
-            light->color[2] *= l[i].intensity;
-
-            vec3 pos = {
-                m[i].value[3][0],
-                m[i].value[3][1],
-                m[i].value[3][2]
-            };
-
-            light->position[0] = pos[0];
-            light->position[1] = pos[1];
-            light->position[2] = pos[2];
-
-            light->distance = l[i].distance;
-
-            glm_vec3_sub(light->position, eye_pos, light->position);
+            sokol_light_candidate_t *c = ecs_vec_append_t(
+                NULL, dst, sokol_light_candidate_t);
+            sokol_init_light(&c->light, &l[i], &m[i], eye_pos);
+            c->entity = it.entities[i];
         }
     }
 
-    sokol_light_t *lights = ecs_vec_first(&r->lights);
-    qsort(lights, ecs_vec_count(&r->lights), sizeof(sokol_light_t),
-        sokol_qsort_light_compare);
-
-    int32_t lights_count = ecs_vec_count(&r->lights);
-    if (lights_count > SOKOL_MAX_LIGHTS) {
-        lights_count = SOKOL_MAX_LIGHTS;
-    }
+#if SOKOL_CLUSTERED_LIGHTS
+    /* Lights are selected per cluster, so only drop lights that don't fit in
+     * the light texture, starting with the ones that contribute least. */
+    sokol_select_visible_lights(r, state, eye_pos, SOKOL_CLUSTER_MAX_LIGHTS);
+#else
+    sokol_select_visible_lights(r, state, eye_pos, SOKOL_MAX_LIGHTS);
+#endif
 
-    ecs_vec_set_count_t(NULL, &r->lights, sokol_light_t, lights_count);
+    glm_mat4_copy(state->uniforms.mat_vp, r->lights_mat_vp);
+    glm_vec3_copy(state->uniforms.eye_pos, r->lights_eye_pos);
+    r->lights_valid = true;
 
     state->lights = r->lights;
 }
 
-/* Render */
+/* Prepare frame: compute uniforms, cull instances and collect lights */
 static
-void SokolRender(ecs_iter_t *it) {
+void SokolPrepareRender(ecs_iter_t *it) {
     ecs_world_t *world = it->world;
     SokolRenderer *r = ecs_field(it, SokolRenderer, 0);
     SokolQuery *q_buffers = ecs_field(it, SokolQuery, 1);
     sokol_render_state_t state = {0};
-    sokol_fx_resources_t *fx = r->fx;
 
     if (it->count > 1) {
         ecs_err("sokol: multiple canvas instances unsupported");
@@ -33072,11 +40842,17 @@ void SokolRender(ecs_iter_t *it) {
     }
 
     /* Load active camera & light data from canvas */
+    const EcsCamera *camera = NULL;
     if (canvas->camera) {
-        state.camera = ecs_get(world, canvas->camera, EcsCamera);
+        camera = ecs_get(world, canvas->camera, EcsCamera);
         r->camera = canvas->camera;
+    }
 
-        float camera_y_offset = state.camera->position[1] - state.uniforms.shadow_far / 2;
+    if (camera) {
+        state.camera = *camera;
+        state.has_camera = true;
+
+        float camera_y_offset = state.camera.position[1] - state.uniforms.shadow_far / 2;
         if (camera_y_offset < 0) {
             camera_y_offset = 0;
         }
@@ -33085,11 +40861,15 @@ void SokolRender(ecs_iter_t *it) {
         state.uniforms.shadow_far = glm_max(
             state.uniforms.shadow_far, pow(camera_y_offset, 1.4));
         state.uniforms.shadow_far = glm_min(state.uniforms.shadow_far,
-            state.camera->far_);
+            state.camera.far_);
     }
 
     /* Get atmosphere settings */
-    state.atmosphere = ecs_get(world, r->canvas, EcsAtmosphere);
+    const EcsAtmosphere *atmosphere = ecs_get(world, r->canvas, EcsAtmosphere);
+    if (atmosphere) {
+        state.atmosphere = *atmosphere;
+        state.has_atmosphere = true;
+    }
 
     /* Get ambient light */
     state.ambient_light = canvas->ambient_light;
@@ -33099,8 +40879,12 @@ void SokolRender(ecs_iter_t *it) {
     state.ambient_light_ground_intensity = canvas->ambient_light_ground_intensity;
 
     if (canvas->directional_light) {
-        state.light = ecs_get(world, canvas->directional_light, 
-            EcsDirectionalLight);
+        const EcsDirectionalLight *light = ecs_get(world, 
+            canvas->directional_light, EcsDirectionalLight);
+        if (light) {
+            state.light = *light;
+            state.has_light = true;
+        }
     } else {
         /* Set default ambient light if nothing is configured */
         if (!state.ambient_light.r && !state.ambient_light.g && 
@@ -33113,12 +40897,81 @@ void SokolRender(ecs_iter_t *it) {
     /* Compute uniforms that are shared between passes */
     sokol_init_global_uniforms(&state);
 
+#if SOKOL_CULL_INSTANCES
+    /* Find instances that are visible to the camera */
+    sokol_cull_instances(world, state.q_scene, SOKOL_VIEW_CAMERA, 
+        state.uniforms.mat_vp, state.uniforms.mat_v, (float)state.height);
+#endif
+
     /* Collect lights for scene */
-    // sokol_gather_lights(world, r, &state);
+    sokol_gather_lights(world, r, &state);
 
-    /* Compute shadow parameters and run shadow pass */
+    /* Compute shadow parameters */
     if (canvas->directional_light) {
         sokol_init_light_mat_vp(&state);
+#if SOKOL_CULL_INSTANCES
+        sokol_cull_shadow_casters(world, state.q_scene, 
+            state.uniforms.light_mat_vp, state.uniforms.mat_vp, 
+            state.uniforms.sun_direction);
+#endif
+    }
+
+    /* Collect geometry to draw, shared by all passes */
+    sokol_build_draw_list(world, state.q_scene, &r->draw_list);
+    state.draw_list = r->draw_list;
+
+#if SOKOL_CLUSTERED_LIGHTS
+    /* Set up cluster planes for binning lights on worker threads */
+    vec3 eye_pos;
+    glm_vec3_copy(state.uniforms.eye_pos, eye_pos);
+    eye_pos[0] *= -1;
+    sokol_clusters_prepare(&r->clusters, &state.lights, eye_pos,
+        state.uniforms.mat_vp, state.uniforms.mat_v, state.uniforms.near_,
+        state.uniforms.far_, ecs_get_stage_count(world));
+    state.cluster_depth_scale = r->clusters.depth_scale;
+    state.cluster_depth_bias = r->clusters.depth_bias;
+#endif
+
+    r->state = state;
+}
+
+#if SOKOL_CLUSTERED_LIGHTS
+/* Bin lights into clusters. Runs on all worker threads, every worker bins a
+ * range of depth slices. */
+static
+void SokolClusterLights(ecs_iter_t *it) {
+    ecs_world_t *stage = it->world;
+    int32_t stage_id = ecs_stage_get_id(stage);
+
+    /* Work is not divided by entity, so don't use system iterator */
+    ecs_iter_fini(it);
+
+    /* Stages only write to their own bins, so this doesn't race */
+    SokolRenderer *r = ecs_get_mut(stage, SokolRendererInst, SokolRenderer);
+    if (r) {
+        sokol_clusters_bin(&r->clusters, stage_id);
+    }
+}
+#endif
+
+/* Render */
+static
+void SokolRender(ecs_iter_t *it) {
+    ecs_world_t *world = it->world;
+    SokolRenderer *r = ecs_field(it, SokolRenderer, 0);
+    sokol_render_state_t state = r->state;
+    sokol_fx_resources_t *fx = r->fx;
+    const EcsCanvas *canvas = ecs_get(world, r->canvas, EcsCanvas);
+
+#if SOKOL_CLUSTERED_LIGHTS
+    sokol_clusters_upload(&r->clusters);
+    state.light_data = r->clusters.lights;
+    state.light_clusters = r->clusters.clusters;
+    state.light_indices = r->clusters.indices;
+#endif
+
+    /* Run shadow pass */
+    if (canvas->directional_light) {
         sokol_run_shadow_pass(&r->shadow_pass, &state);
     }
 
@@ -33126,7 +40979,7 @@ void SokolRender(ecs_iter_t *it) {
     sokol_run_depth_pass(&r->depth_pass, &state);
 
     /* Render atmosphere */
-    if (state.atmosphere) {
+    if (state.has_atmosphere) {
         sokol_run_atmos_pass(&r->atmos_pass, &state);
         state.atmos = r->atmos_pass.color_target;
     } else {
@@ -33137,6 +40990,9 @@ void SokolRender(ecs_iter_t *it) {
     sokol_run_scene_pass(&r->scene_pass, &state);
     sg_image hdr = r->scene_pass.color_target;
 
+    /* Add depth of entities that are not in the depth prepass */
+    sokol_run_late_depth_pass(&r->depth_pass, &state);
+
     /* Ssao */
     sg_image ssao = sokol_fx_run(&fx->ssao, 2, (sg_image[]){ 
         hdr, r->depth_pass.color_target }, 
@@ -33159,6 +41015,7 @@ void SokolRender(ecs_iter_t *it) {
 
 static
 void SokolCommit(ecs_iter_t *it) {
+    sokol_submit_frame();
     sg_commit();
 }
 
@@ -33198,12 +41055,16 @@ void SokolInitRenderer(ecs_iter_t *it) {
     ecs_vec_t lights; 
     ecs_vec_init_t(NULL, &lights, sokol_light_t, 0);
 
+    ecs_vec_t draw_list;
+    ecs_vec_init_t(NULL, &draw_list, sokol_draw_batch_t, 0);
+
     ecs_query_t *lights_query = ecs_query(world, {
         .terms = {
             { ecs_id(EcsPointLight) },
             { ecs_id(EcsTransform3) }
         },
-        .cache_kind = EcsQueryCacheAuto
+        .cache_kind = EcsQueryCacheAuto,
+        .flags = EcsQueryDetectChanges
     });
 
     ecs_set(world, SokolRendererInst, SokolRenderer, {
@@ -33216,9 +41077,20 @@ void SokolInitRenderer(ecs_iter_t *it) {
         .screen_pass = sokol_init_screen_pass(),
         .fx = sokol_init_fx(w, h),
         .lights = lights,
-        .lights_query = lights_query
+        .lights_query = lights_query,
+        .draw_list = draw_list
     });
 
+    SokolRenderer *renderer = ecs_get_mut(world, SokolRendererInst, SokolRenderer);
+#if SOKOL_CLUSTERED_LIGHTS
+    sokol_clusters_init(&renderer->clusters);
+#endif
+    ecs_vec_init_t(NULL, &renderer->light_candidates, 
+        sokol_light_candidate_t, 0);
+    ecs_vec_init_t(NULL, &renderer->light_spheres, vec4, 0);
+    ecs_vec_init_t(NULL, &renderer->light_visible, int32_t, 0);
+    ecs_map_init(&renderer->lights_selected, NULL);
+
     ecs_trace("sokol: canvas initialized");
 
     ecs_set_pair(world, SokolRendererInst, SokolQuery, ecs_id(SokolGeometry), {
@@ -33238,6 +41110,17 @@ void SokolInitRenderer(ecs_iter_t *it) {
 static
 void SokolFiniRenderer(ecs_iter_t *it) {
     ecs_trace("sokol: shutting down");
+    SokolRenderer *r = ecs_field(it, SokolRenderer, 0);
+    for (int i = 0; i < it->count; i ++) {
+#if SOKOL_CLUSTERED_LIGHTS
+        sokol_clusters_fini(&r[i].clusters);
+#endif
+        ecs_vec_fini_t(NULL, &r[i].light_candidates, sokol_light_candidate_t);
+        ecs_vec_fini_t(NULL, &r[i].light_spheres, vec4);
+        ecs_vec_fini_t(NULL, &r[i].light_visible, int32_t);
+        ecs_map_fini(&r[i].lights_selected);
+    }
+    sokol_submit_fini();
     sg_shutdown();
 }
 
@@ -33273,11 +41156,30 @@ void FlecsSystemsSokolRendererImport(
     ECS_OBSERVER(world, SokolFiniRenderer, EcsOnRemove, 
         flecs.systems.sokol.Renderer);
 
-    /* System that orchestrates the render tasks */
-    ECS_SYSTEM(world, SokolRender, EcsOnStore, 
+    /* System that prepares the frame before rendering */
+    ECS_SYSTEM(world, SokolPrepareRender, EcsOnStore, 
         flecs.systems.sokol.Renderer,
         (sokol.Query, Geometry));
 
+#if SOKOL_CLUSTERED_LIGHTS
+    /* Binning lights into clusters is divided over worker threads */
+    ecs_system(world, {
+        .entity = ecs_entity(world, {
+            .name = "SokolClusterLights",
+            .add = ecs_ids( ecs_dependson(EcsOnStore) )
+        }),
+        .query.terms = {
+            { .id = ecs_id(SokolRenderer), .inout = EcsInOut }
+        },
+        .run = SokolClusterLights,
+        .multi_threaded = true
+    });
+#endif
+
+    /* System that orchestrates the render tasks */
+    ECS_SYSTEM(world, SokolRender, EcsOnStore, 
+        flecs.systems.sokol.Renderer);
+
     /* System that calls sg_commit */
     ECS_SYSTEM(world, SokolCommit, EcsOnStore, 0);
 }
@@ -56,10 +56,206 @@
 extern "C" {
 #endif
 
+/* Tag for entities that don't move after they're created. Static entities are
+ * stored in separate instance buffers that are only uploaded when a static
+ * entity is added, removed or modified. */
+FLECS_SYSTEMS_SOKOL_API
+extern ECS_TAG_DECLARE(SokolStatic);
+
+/* Relationship that groups static entities into spatial clusters, for example
+ * (SokolCluster, building). When the module is built with 
+ * SOKOL_CLUSTER_INSTANCES, the instances of a cluster are stored in a
+ * contiguous range, and are culled & drawn as a whole. Static entities that
+ * are not in a cluster are clustered per table. */
+FLECS_SYSTEMS_SOKOL_API
+extern ECS_TAG_DECLARE(SokolCluster);
+
+/* Tag for entities that don't cast shadows. Entities with this tag are not
+ * drawn by the shadow pass. */
+FLECS_SYSTEMS_SOKOL_API
+extern ECS_TAG_DECLARE(SokolNoShadow);
+
+/* Tag for entities that are not drawn by the depth prepass. Tagged entities
+ * write depth while they are drawn, which is useful for entities that occlude
+ * little of the scene. Their depth is still used by the ambient occlusion and
+ * fog effects. */
+FLECS_SYSTEMS_SOKOL_API
+extern ECS_TAG_DECLARE(SokolNoDepthPrepass);
+
+/* Procedural primitives, centered on the entity. Cylinders and cones are 
+ * aligned with the y axis of the entity, and the tip of a cone points up. 
+ * Primitives are tessellated at multiple levels of detail, which are selected
+ * per instance when the module is built with SOKOL_LOD. */
+typedef struct SokolSphere {
+    float radius;
+} SokolSphere;
+
+typedef struct SokolCylinder {
+    float radius;
+    float height;
+} SokolCylinder;
+
+typedef struct SokolCone {
+    float radius;
+    float height;
+} SokolCone;
+
+FLECS_SYSTEMS_SOKOL_API
+extern ECS_COMPONENT_DECLARE(SokolSphere);
+
+FLECS_SYSTEMS_SOKOL_API
+extern ECS_COMPONENT_DECLARE(SokolCylinder);
+
+FLECS_SYSTEMS_SOKOL_API
+extern ECS_COMPONENT_DECLARE(SokolCone);
+
 FLECS_SYSTEMS_SOKOL_API
 void FlecsSystemsSokolImport(
     ecs_world_t *world);
 
+/* Reserve space in instance buffers for a geometry kind, identified by its
+ * geometry component (for example EcsBox). The count is the number of dynamic
+ * instances, the static_count the number of instances with the SokolStatic 
+ * tag. Buffers are not shrunk below the hint, which avoids reallocations when
+ * the number of instances fluctuates. 
+ *
+ * The hints apply to the instance buffers, to the buffers with the visible
+ * instances of each view (SOKOL_CULL_INSTANCES) and to the size of the
+ * instance ring (SOKOL_INSTANCE_RING). The GPU buffers of static instances are
+ * immutable and are recreated with the exact instance count when they change,
+ * so for those the hint only reserves CPU memory, unless static instances are
+ * clustered (SOKOL_CLUSTER_INSTANCES). */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_geometry_capacity_hint(
+    ecs_world_t *world,
+    ecs_entity_t component,
+    int32_t count,
+    int32_t static_count);
+
+/* Draw instances of a geometry kind that are further away from the camera 
+ * than distance as camera facing quads (impostors). Impostors are colored like
+ * the instance, and lit as if they were a face of the instance that faces the
+ * camera. A distance of 0 disables impostors. Requires the module to be built
+ * with SOKOL_IMPOSTORS. Static instances in clusters are not drawn as
+ * impostors. */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_geometry_impostor_distance(
+    ecs_world_t *world,
+    ecs_entity_t component,
+    float distance);
+
+/* Instance buffer statistics of the last frame */
+typedef struct sokol_geometry_stats_t {
+    int32_t uploads_performed;  /* Instance buffers that were (re)uploaded */
+    int32_t uploads_skipped;    /* Instance buffers skipped because no table changed */
+    int32_t ranges_uploaded;    /* Number of sub-range updates */
+    int32_t instances_uploaded; /* Number of instances sent to the GPU */
+    int32_t compactions;        /* Number of times instance slots were repacked */
+    int32_t reallocations;      /* Number of times instance buffers were resized */
+    int32_t instances_culled;   /* Instances not visible, summed over views */
+    int32_t tables_culled;      /* Tables not visible, summed over views */
+    int32_t cells_culled;       /* Spatial cells not visible, summed over views */
+    int32_t clusters_culled;    /* Clusters not visible, summed over views */
+    int32_t casters_culled;     /* Shadow casters without visible shadows */
+    int32_t instances_small;    /* Instances or clusters smaller than 
+                                 * SOKOL_LOD_MIN_SIZE, summed over views */
+    int32_t impostors;          /* Instances drawn as impostors */
+} sokol_geometry_stats_t;
+
+/* Get instance buffer statistics of a geometry kind, identified by its 
+ * geometry component. If component is 0, statistics are summed over all 
+ * geometry kinds. */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_geometry_get_stats(
+    const ecs_world_t *world,
+    ecs_entity_t component,
+    sokol_geometry_stats_t *stats);
+
+/* Called for each entity found by a spatial query. The sphere contains the
+ * center (x, y, z) and radius of the entity's bounding sphere. Return false to
+ * stop the query. */
+typedef bool (*sokol_spatial_callback_t)(
+    ecs_entity_t entity,
+    const float *sphere,
+    void *ctx);
+
+/* Find rendered entities with a bounding sphere that overlaps with a sphere.
+ * Spatial queries use the index that is built for culling, and require the
+ * module to be built with SOKOL_SPATIAL_INDEX. Results reflect the state of
+ * entities when instance buffers were last populated. */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_query_sphere(
+    const ecs_world_t *world,
+    const float *center,
+    float radius,
+    sokol_spatial_callback_t callback,
+    void *ctx);
+
+/* Find rendered entities with a bounding sphere that overlaps with a box */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_query_box(
+    const ecs_world_t *world,
+    const float *min,
+    const float *max,
+    sokol_spatial_callback_t callback,
+    void *ctx);
+
+/* Find the nearest rendered entity with a bounding sphere that is hit by a 
+ * ray. Returns 0 if no entity is hit within max_distance. If distance is not
+ * NULL, it is set to the distance of the hit. */
+FLECS_SYSTEMS_SOKOL_API
+ecs_entity_t sokol_raycast(
+    const ecs_world_t *world,
+    const float *origin,
+    const float *direction,
+    float max_distance,
+    float *distance);
+
+/* Heuristics for selecting occluders. Occluders are boxes that are visible to
+ * the camera. Candidates are sorted by their screen size (bounding radius 
+ * divided by view distance), and the largest max_occluders are drawn. */
+typedef struct sokol_occlusion_desc_t {
+    float min_radius;           /* Minimum bounding radius of an occluder */
+    float min_screen_size;      /* Minimum screen size of an occluder */
+    int32_t max_occluders;      /* Maximum number of occluders per frame */
+} sokol_occlusion_desc_t;
+
+/* Occlusion culling statistics of the last frame */
+typedef struct sokol_occlusion_stats_t {
+    int32_t occluders;          /* Number of occluders drawn */
+    int32_t tested;             /* Number of instances & clusters tested */
+    int32_t occluded;           /* Number of instances & clusters occluded */
+} sokol_occlusion_stats_t;
+
+/* Set occluder heuristics. Occlusion culling requires the module to be built
+ * with SOKOL_OCCLUSION_CULLING. */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_occlusion_set_desc(
+    ecs_world_t *world,
+    const sokol_occlusion_desc_t *desc);
+
+/* Get occlusion culling statistics */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_occlusion_get_stats(
+    const ecs_world_t *world,
+    sokol_occlusion_stats_t *stats);
+
+/* Graphics API calls of the last frame. Elided calls were skipped because
+ * they applied the same state as the previous call. */
+typedef struct sokol_submit_stats_t {
+    int32_t pipelines;          /* Pipelines applied */
+    int32_t pipelines_elided;   /* Pipelines not applied */
+    int32_t bindings;           /* Bindings applied */
+    int32_t bindings_elided;    /* Bindings not applied */
+    int32_t uniforms;           /* Uniform blocks applied */
+    int32_t uniforms_elided;    /* Uniform blocks not applied */
+} sokol_submit_stats_t;
+
+/* Get submission statistics */
+FLECS_SYSTEMS_SOKOL_API
+void sokol_submit_get_stats(
+    sokol_submit_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,15 +1,26 @@
 #include "private_api.h"
 
+/* Uniform structs have the std140 layout */
 typedef struct atmos_fs_uniforms_t {
     mat4 inv_mat_vp;
     vec3 eye_pos;
-    vec3 light_pos;
-    vec3 night_color;
     float aspect;
+    vec3 light_pos;
     float offset;
+    vec3 night_color;
+    float padding;
 } atmos_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, inv_mat_vp, 0);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, eye_pos, 64);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, aspect, 76);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, light_pos, 80);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, offset, 92);
+SOKOL_UNIFORM_OFFSET(atmos_fs_uniforms_t, night_color, 96);
+SOKOL_UNIFORM_SIZE(atmos_fs_uniforms_t, 112);
+
 typedef struct atmos_param_fs_uniforms_t {
+    vec3 rayleigh_coef;
     float intensity;
     float planet_radius;
     float atmosphere_radius;
@@ -17,9 +28,19 @@ typedef struct atmos_param_fs_uniforms_t {
     float rayleigh_scale_height;
     float mie_scale_height;
     float mie_scatter_dir;
-    vec3 rayleigh_coef;
+    float padding[2];
 } atmos_param_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, rayleigh_coef, 0);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, intensity, 12);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, planet_radius, 16);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, atmosphere_radius, 20);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, mie_coef, 24);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, rayleigh_scale_height, 28);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, mie_scale_height, 32);
+SOKOL_UNIFORM_OFFSET(atmos_param_fs_uniforms_t, mie_scatter_dir, 36);
+SOKOL_UNIFORM_SIZE(atmos_param_fs_uniforms_t, 48);
+
 static const char *atmosphere_f =
     SOKOL_SHADER_HEADER
     "#include \"etc/sokol/shaders/atmosphere_frag.glsl\"\n";
@@ -49,27 +70,30 @@ sokol_offscreen_pass_t sokol_init_atmos_pass(void)
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(atmos_fs_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "atmos_fs_params",
                     .uniforms = {
                         [0] = { .name="u_mat_v", .type=SG_UNIFORMTYPE_MAT4 },
                         [1] = { .name="u_eye_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [2] = { .name="u_light_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [3] = { .name="u_night_color", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [4] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
-                        [5] = { .name="u_offset", .type=SG_UNIFORMTYPE_FLOAT },
-                        [6] = { .name="padding", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
+                        [3] = { .name="u_light_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [4] = { .name="u_offset", .type=SG_UNIFORMTYPE_FLOAT },
+                        [5] = { .name="u_night_color", .type=SG_UNIFORMTYPE_FLOAT3 }
                     }
                 },
                 [1] = {
                     .size = sizeof(atmos_param_fs_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "atmos_fs_coefs",
                     .uniforms = {
-                        [0] = { .name="intensity", .type=SG_UNIFORMTYPE_FLOAT },
-                        [1] = { .name="planet_radius", .type=SG_UNIFORMTYPE_FLOAT },
-                        [2] = { .name="atmosphere_radius", .type=SG_UNIFORMTYPE_FLOAT },
-                        [3] = { .name="mie_coef", .type=SG_UNIFORMTYPE_FLOAT },
-                        [4] = { .name="rayleigh_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
-                        [5] = { .name="mie_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
-                        [6] = { .name="mie_scatter_dir", .type=SG_UNIFORMTYPE_FLOAT },
-                        [7] = { .name="rayleigh_coef", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [0] = { .name="rayleigh_coef", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [1] = { .name="intensity", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="planet_radius", .type=SG_UNIFORMTYPE_FLOAT },
+                        [3] = { .name="atmosphere_radius", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="mie_coef", .type=SG_UNIFORMTYPE_FLOAT },
+                        [5] = { .name="rayleigh_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
+                        [6] = { .name="mie_scale_height", .type=SG_UNIFORMTYPE_FLOAT },
+                        [7] = { .name="mie_scatter_dir", .type=SG_UNIFORMTYPE_FLOAT }
                     }
                 }
             }
@@ -102,40 +126,40 @@ void sokol_run_atmos_pass(
     sokol_offscreen_pass_t *pass,
     sokol_render_state_t *state) 
 {
-    if (!state->atmosphere) {
+    if (!state->has_atmosphere) {
         ecs_err("atmosphere pass called without atmosphere parameters");
         return;
     }
 
-    atmos_fs_uniforms_t fs_u;
+    atmos_fs_uniforms_t fs_u = {0};
     glm_mat4_copy(state->uniforms.inv_mat_v, fs_u.inv_mat_vp);
     glm_vec3_copy(state->uniforms.eye_pos, fs_u.eye_pos);
     glm_vec3_copy(state->uniforms.sun_direction, fs_u.light_pos);
-    glm_vec3_copy((float*)&state->atmosphere->night_color, fs_u.night_color);
+    glm_vec3_copy((float*)&state->atmosphere.night_color, fs_u.night_color);
     // fs_u.night_color[0] = 0.001 / 8.0;
     // fs_u.night_color[1] = 0.008 / 8.0;
     // fs_u.night_color[2] = 0.016 / 8.0;
     fs_u.aspect = state->uniforms.aspect;
     fs_u.offset = 0.05;
 
-    atmos_param_fs_uniforms_t fs_p_u;
-    fs_p_u.intensity = state->atmosphere->intensity;
-    fs_p_u.planet_radius = state->atmosphere->planet_radius;
-    fs_p_u.atmosphere_radius = state->atmosphere->atmosphere_radius;
-    fs_p_u.mie_coef = state->atmosphere->mie_coef;
-    fs_p_u.rayleigh_scale_height = state->atmosphere->rayleigh_scale_height;
-    fs_p_u.mie_scale_height = state->atmosphere->mie_scale_height;
-    fs_p_u.mie_scatter_dir = state->atmosphere->mie_scatter_dir;
-    glm_vec3_copy((float*)state->atmosphere->rayleigh_coef, fs_p_u.rayleigh_coef);
+    atmos_param_fs_uniforms_t fs_p_u = {0};
+    fs_p_u.intensity = state->atmosphere.intensity;
+    fs_p_u.planet_radius = state->atmosphere.planet_radius;
+    fs_p_u.atmosphere_radius = state->atmosphere.atmosphere_radius;
+    fs_p_u.mie_coef = state->atmosphere.mie_coef;
+    fs_p_u.rayleigh_scale_height = state->atmosphere.rayleigh_scale_height;
+    fs_p_u.mie_scale_height = state->atmosphere.mie_scale_height;
+    fs_p_u.mie_scatter_dir = state->atmosphere.mie_scatter_dir;
+    glm_vec3_copy(state->atmosphere.rayleigh_coef, fs_p_u.rayleigh_coef);
 
     sg_begin_pass(pass->pass, &pass->pass_action);
-    sg_apply_pipeline(pass->pip);
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(atmos_fs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&fs_p_u, sizeof(atmos_param_fs_uniforms_t)});
+    sokol_apply_pipeline(pass->pip);
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(atmos_fs_uniforms_t)});
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&fs_p_u, sizeof(atmos_param_fs_uniforms_t)});
 
     sg_bindings bind = { .vertex_buffers = { state->resources->quad } };
-    sg_apply_bindings(&bind);
+    sokol_apply_bindings(&bind);
     sg_draw(0, 6, 1);
 
-    sg_end_pass();
+    sokol_end_pass();
 }
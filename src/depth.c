@@ -4,6 +4,9 @@ typedef struct depth_vs_uniforms_t {
     mat4 mat_vp;
 } depth_vs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(depth_vs_uniforms_t, mat_vp, 0);
+SOKOL_UNIFORM_SIZE(depth_vs_uniforms_t, 64);
+
 typedef struct depth_fs_uniforms_t {
     vec3 eye_pos;
     float near_;
@@ -12,16 +15,23 @@ typedef struct depth_fs_uniforms_t {
     float inv_log_far;
 } depth_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, eye_pos, 0);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, near_, 12);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, far_, 16);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, depth_c, 20);
+SOKOL_UNIFORM_OFFSET(depth_fs_uniforms_t, inv_log_far, 24);
+SOKOL_UNIFORM_SIZE(depth_fs_uniforms_t, 28);
+
 const char* sokol_vs_depth(void) 
 {
     return SOKOL_SHADER_HEADER
         "uniform mat4 u_mat_vp;\n"
         "uniform vec3 u_eye_pos;\n"
         "layout(location=0) in vec4 v_position;\n"
-        "layout(location=1) in mat4 i_mat_m;\n"
+        SOKOL_SHADER_INSTANCE_TRANSFORM(1, 5)
         "out vec3 position;\n"
         "void main() {\n"
-        "  gl_Position = u_mat_vp * i_mat_m * v_position;\n"
+        "  gl_Position = u_mat_vp * instance_transform() * v_position;\n"
         "  position = gl_Position.xyz;\n"
         "}\n";
 }
@@ -90,23 +100,13 @@ sg_pipeline init_depth_pipeline(int32_t sample_count) {
         .fs.source = sokol_fs_depth()
     });
 
-    return sg_make_pipeline(&(sg_pipeline_desc){
+    sg_pipeline_desc desc = {
         .shader = shd,
         .index_type = SG_INDEXTYPE_UINT16,
         .layout = {
-            .buffers = {
-                [1] = { .stride = 64, .step_func=SG_VERTEXSTEP_PER_INSTANCE }
-            },
-
             .attrs = {
                 /* Static geometry */
-                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-         
-                /* Matrix (per instance) */
-                [1] = { .buffer_index=1, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT4 },
-                [2] = { .buffer_index=1, .offset=16, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [3] = { .buffer_index=1, .offset=32, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [4] = { .buffer_index=1, .offset=48, .format=SG_VERTEXFORMAT_FLOAT4 }
+                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 }
             }
         },
         .depth = {
@@ -119,7 +119,13 @@ sg_pipeline init_depth_pipeline(int32_t sample_count) {
         }},
         .cull_mode = SG_CULLMODE_BACK,
         .sample_count = sample_count
-    });
+    };
+
+    /* Matrix (per instance) */
+    sokol_instance_pipeline_layout(&desc.layout, SOKOL_INSTANCE_TRANSFORM, 
+        1, 1, -1, -1);
+
+    return sg_make_pipeline(&desc);
 }
 
 sokol_offscreen_pass_t sokol_init_depth_pass(
@@ -170,27 +176,29 @@ void sokol_update_depth_pass(
 
 static
 void depth_draw_instances(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers)
+    const sokol_draw_batch_t *batch,
+    bool no_prepass)
 {
-    if (!buffers->instance_count) {
-        return;
-    }
-
     sg_bindings bind = {
         .vertex_buffers = {
-            [0] = geometry->vertices,
-            [1] = buffers->transforms
+            [0] = batch->mesh.vertices
         },
-        .index_buffer = geometry->indices
+        .index_buffer = batch->mesh.indices
     };
 
-    sg_apply_bindings(&bind);
-    sg_draw(0, geometry->index_count, buffers->instance_count);
+    if (no_prepass) {
+        sokol_draw_excluded_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, 
+            SOKOL_INSTANCE_TRANSFORM, 1);
+    } else {
+        sokol_draw_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, 
+            SOKOL_INSTANCE_TRANSFORM, 1);
+    }
 }
 
-void sokol_run_depth_pass(
-    sokol_offscreen_pass_t *pass,
+static
+void depth_apply_uniforms(
     sokol_render_state_t *state)
 {
     depth_vs_uniforms_t vs_u;
@@ -203,24 +211,70 @@ void sokol_run_depth_pass(
     fs_u.depth_c = SOKOL_DEPTH_C;
     fs_u.inv_log_far = 1.0 / log(SOKOL_DEPTH_C * fs_u.far_ + 1.0);
 
+    sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(depth_vs_uniforms_t)});
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(depth_fs_uniforms_t)});
+}
+
+void sokol_run_depth_pass(
+    sokol_offscreen_pass_t *pass,
+    sokol_render_state_t *state)
+{
     /* Render to offscreen texture so screen-space effects can be applied */
     sg_begin_pass(pass->pass, &pass->pass_action);
-    sg_apply_pipeline(pass->pip);
+    sokol_apply_pipeline(pass->pip);
+    depth_apply_uniforms(state);
+
+    /* Loop draw list, render scene */
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    for (b = 0; b < count; b ++) {
+        if (batches[b].passes & (1u << SOKOL_PASS_DEPTH)) {
+            depth_draw_instances(&batches[b], false);
+        }
+    }
 
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(depth_vs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(depth_fs_uniforms_t)});
+    sokol_end_pass();
+}
+
+void sokol_run_late_depth_pass(
+    sokol_offscreen_pass_t *pass,
+    sokol_render_state_t *state)
+{
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    for (b = 0; b < count; b ++) {
+        if (batches[b].exclude & (1u << SOKOL_PASS_DEPTH)) {
+            break;
+        }
+    }
+
+    /* Skip pass if all instances were drawn by the depth prepass */
+    if (b == count) {
+        return;
+    }
+
+    /* The scene pass wrote the depth of instances that are not in the depth
+     * prepass to the depth buffer. Draw them on top of the depth texture, so
+     * that screen-space effects see them. */
+    sg_pass_action action = {
+        .colors[0].action = SG_ACTION_LOAD,
+        .depth.action = SG_ACTION_LOAD,
+        .stencil.action = SG_ACTION_LOAD
+    };
 
-    /* Loop geometry, render scene */
-    ecs_iter_t qit = ecs_query_iter(state->world, state->q_scene);
-    while (ecs_query_next(&qit)) {
-        SokolGeometry *geometry = ecs_field(&qit, SokolGeometry, 0);
+    sg_begin_pass(pass->pass, &action);
+    sokol_apply_pipeline(pass->pip);
+    depth_apply_uniforms(state);
 
-        int b;
-        for (b = 0; b < qit.count; b ++) {
-            depth_draw_instances(&geometry[b], &geometry[b].solid);
-            depth_draw_instances(&geometry[b], &geometry[b].emissive);
+    for (; b < count; b ++) {
+        if ((batches[b].passes & (1u << SOKOL_PASS_SCENE)) &&
+            (batches[b].exclude & (1u << SOKOL_PASS_DEPTH))) 
+        {
+            depth_draw_instances(&batches[b], true);
         }
     }
 
-    sg_end_pass();
+    sokol_end_pass();
 }
@@ -1,19 +1,33 @@
 #include "private_api.h"
 
+/* Uniform structs have the std140 layout */
 typedef struct fx_uniforms_t {
+    float target_size[2];
     float t;
     float dt;
     float aspect;
     float near_;
     float far_;
-    float target_size[2];
+    float padding;
 } fx_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, target_size, 0);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, t, 8);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, dt, 12);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, aspect, 16);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, near_, 20);
+SOKOL_UNIFORM_OFFSET(fx_uniforms_t, far_, 24);
+SOKOL_UNIFORM_SIZE(fx_uniforms_t, 32);
+
 typedef struct fx_mat_uniforms_t {
     mat4 mat_p;
     mat4 inv_mat_p;
 } fx_mat_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(fx_mat_uniforms_t, mat_p, 0);
+SOKOL_UNIFORM_OFFSET(fx_mat_uniforms_t, inv_mat_p, 64);
+SOKOL_UNIFORM_SIZE(fx_mat_uniforms_t, 128);
+
 static
 char* fx_build_shader(
     sokol_fx_pass_desc_t *pass)
@@ -27,14 +41,18 @@ char* fx_build_shader(
         "#define FX\n"
         "out vec4 frag_color;\n"
         "in vec2 uv;\n"
-        "uniform float u_t;\n"
-        "uniform float u_dt;\n"
-        "uniform float u_aspect;\n"
-        "uniform float u_near;\n"
-        "uniform float u_far;\n"
-        "uniform vec2 u_target_size;\n"
-        "uniform mat4 u_mat_p;\n"
-        "uniform mat4 u_inv_mat_p;\n"
+        "SOKOL_UNIFORM_BLOCK(fx_params)\n"
+        "SOKOL_UNIFORM vec2 u_target_size;\n"
+        "SOKOL_UNIFORM float u_t;\n"
+        "SOKOL_UNIFORM float u_dt;\n"
+        "SOKOL_UNIFORM float u_aspect;\n"
+        "SOKOL_UNIFORM float u_near;\n"
+        "SOKOL_UNIFORM float u_far;\n"
+        "SOKOL_UNIFORM_BLOCK_END\n"
+        "SOKOL_UNIFORM_BLOCK(fx_mat_params)\n"
+        "SOKOL_UNIFORM mat4 u_mat_p;\n"
+        "SOKOL_UNIFORM mat4 u_inv_mat_p;\n"
+        "SOKOL_UNIFORM_BLOCK_END\n"
         "uniform sampler2D u_noise;\n");
 
     /* Add inputs */
@@ -48,13 +66,21 @@ char* fx_build_shader(
     }
 
     /* Add uniform params */
+    if (pass->params[0]) {
+        ecs_strbuf_appendstr(&shad, "SOKOL_UNIFORM_BLOCK(fx_pass_params)\n");
+    }
+
     for (int32_t i = 0; i < SOKOL_MAX_FX_INPUTS; i ++) {
         const char *param = pass->params[i];
         if (!param) {
             break;
         }
 
-        ecs_strbuf_append(&shad, "uniform float %s;\n", param);
+        ecs_strbuf_append(&shad, "SOKOL_UNIFORM float %s;\n", param);
+    }
+
+    if (pass->params[0]) {
+        ecs_strbuf_appendstr(&shad, "SOKOL_UNIFORM_BLOCK_END\n");
     }
 
     /* Add shader header */
@@ -95,14 +121,16 @@ int sokol_fx_add_pass(
     char *fs_prog = fx_build_shader(pass_desc);
 
     /* Populate list of shader specific uniforms */
-    sg_shader_uniform_block_desc prog_ub = { 0 };
+    sg_shader_uniform_block_desc prog_ub = { 
+        .layout = SG_UNIFORMLAYOUT_STD140,
+        .block_name = "fx_pass_params"
+    };
 
-    for (int32_t i = 0; i < SOKOL_MAX_FX_PARAMS; i ++) {
+    for (int32_t i = 0; i < SOKOL_MAX_FX_INPUTS; i ++) {
         const char *param = pass_desc->params[i];
         if (!param) {
             break;
         }
-        prog_ub.size += sizeof(float);
         prog_ub.uniforms[i] = (sg_shader_uniform_desc){
             .name = param, 
             .type = SG_UNIFORMTYPE_FLOAT 
@@ -110,6 +138,11 @@ int sokol_fx_add_pass(
         pass->param_count ++;
     }
 
+    /* Float params are tightly packed, std140 blocks are padded to 16 bytes */
+    if (pass->param_count) {
+        prog_ub.size = (size_t)ECS_ALIGN(pass->param_count * ECS_SIZEOF(float), 16);
+    }
+
     /* Shader program */
     sg_shader_desc prog = {
         .vs = {
@@ -120,17 +153,21 @@ int sokol_fx_add_pass(
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(fx_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "fx_params",
                     .uniforms = {
-                        [0] = { .name="u_t", .type=SG_UNIFORMTYPE_FLOAT },
-                        [1] = { .name="u_dt", .type=SG_UNIFORMTYPE_FLOAT },
-                        [2] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
-                        [3] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
-                        [4] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT },
-                        [5] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 }
+                        [0] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 },
+                        [1] = { .name="u_t", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_dt", .type=SG_UNIFORMTYPE_FLOAT },
+                        [3] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
+                        [5] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT }
                     }
                 },
                 [1] = {
                     .size = sizeof(fx_mat_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "fx_mat_params",
                     .uniforms = {
                         [0] = { .name = "u_mat_p", .type = SG_UNIFORMTYPE_MAT4 },
                         [1] = { .name = "u_inv_mat_p", .type = SG_UNIFORMTYPE_MAT4 }
@@ -343,21 +380,22 @@ void fx_draw(
             sg_begin_default_pass(&screen_pass->pass_action, width, height);
         }
 
-        sg_apply_pipeline(pass->pip);
+        sokol_apply_pipeline(pass->pip);
 
         f_u.target_size[0] = output->width;
         f_u.target_size[1] = output->height;
-        sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){
             &f_u, sizeof(fx_uniforms_t) 
         });
 
-        sg_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){
             &fs_mat_u, sizeof(fx_mat_uniforms_t)
         });
 
         if (pass->param_count) {
-            sg_apply_uniforms(SG_SHADERSTAGE_FS, 2, &(sg_range){
-                step->params, pass->param_count * sizeof(float)
+            sokol_apply_uniforms(SG_SHADERSTAGE_FS, 2, &(sg_range){
+                step->params, (size_t)ECS_ALIGN(
+                    pass->param_count * ECS_SIZEOF(float), 16)
             });
         }
 
@@ -385,11 +423,11 @@ void fx_draw(
             }
         }
 
-        sg_apply_bindings(&bind);
+        sokol_apply_bindings(&bind);
 
         sg_draw(0, 6, 1);
 
-        sg_end_pass();
+        sokol_end_pass();
 
         output->toggle = !toggle;
     }
@@ -1,309 +1,3571 @@
 #include "geometry.h"
+#include "kernels.h"
+#include <float.h>
 
 ECS_COMPONENT_DECLARE(SokolGeometry);
 ECS_COMPONENT_DECLARE(SokolGeometryQuery);
+ECS_COMPONENT_DECLARE(SokolImpostorMesh);
+#if SOKOL_INSTANCE_RING
+ECS_COMPONENT_DECLARE(SokolInstanceRing);
+#endif
+#if SOKOL_OCCLUSION_CULLING
+ECS_COMPONENT_DECLARE(SokolOcclusion);
+#endif
 
 ECS_DECLARE(SokolRectangleGeometry);
 ECS_DECLARE(SokolBoxGeometry);
+ECS_DECLARE(SokolSphereGeometry);
+ECS_DECLARE(SokolCylinderGeometry);
+ECS_DECLARE(SokolConeGeometry);
+ECS_COMPONENT_DECLARE(SokolSphere);
+ECS_COMPONENT_DECLARE(SokolCylinder);
+ECS_COMPONENT_DECLARE(SokolCone);
+ECS_TAG_DECLARE(SokolStatic);
+ECS_TAG_DECLARE(SokolCluster);
+ECS_TAG_DECLARE(SokolNoShadow);
+ECS_TAG_DECLARE(SokolNoDepthPrepass);
 
+#if SOKOL_INTERLEAVED_INSTANCES
+// All instance data in a single stream
+const sokol_instance_layout_t sokol_instance_layout = {
+    .stream_count = 1,
+    .stream_size = { ECS_SIZEOF(sokol_instance_t) },
+    .transform = { 0, offsetof(sokol_instance_t, transform) },
+    .color = { 0, offsetof(sokol_instance_t, color) },
+#if SOKOL_PACKED_INSTANCE_DATA
+    .material = { 0, offsetof(sokol_instance_t, color) + 4 }
+#else
+    .material = { 0, offsetof(sokol_instance_t, material) }
+#endif
+};
+#elif SOKOL_PACKED_INSTANCE_DATA
+// Transforms, and packed colors & materials in separate streams
+const sokol_instance_layout_t sokol_instance_layout = {
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    .stream_count = 3,
+    .scale = { 2, 0 },
+#else
+    .stream_count = 2,
+#endif
+    .stream_size = { 
+        ECS_SIZEOF(sokol_transform_t), 
+        ECS_SIZEOF(sokol_instance_color_t),
+        ECS_SIZEOF(vec3)
+    },
+    .transform = { 0, 0 },
+    .color = { 1, 0 },
+    .material = { 1, 4 }
+};
+#else
+// Transforms, colors and materials in separate streams
+const sokol_instance_layout_t sokol_instance_layout = {
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    .stream_count = 4,
+    .scale = { 3, 0 },
+#else
+    .stream_count = 3,
+#endif
+    .stream_size = { 
+        ECS_SIZEOF(sokol_transform_t), 
+        ECS_SIZEOF(sokol_instance_color_t), 
+        ECS_SIZEOF(SokolMaterial),
+        ECS_SIZEOF(vec3)
+    },
+    .transform = { 0, 0 },
+    .color = { 1, 0 },
+    .material = { 2, 0 }
+};
+#endif
+
+// Whether stream is stored in CPU buffers. With zero-copy transforms, the 
+// transforms of dynamic entities are uploaded directly from table columns,
+// unless they are appended to the instance ring. With culling, the transforms
+// of visible instances are uploaded from the table columns to the views.
+static
+bool sokol_instance_stream_staged(
+    const sokol_geometry_buffers_t *buffers,
+    int32_t stream)
+{
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    return (buffers->usage != SG_USAGE_DYNAMIC) || 
+        (stream != sokol_instance_layout.transform.stream);
+#else
+    (void)buffers;
+    (void)stream;
+    return true;
+#endif
+}
+
+#if SOKOL_CULL_INSTANCES
+// Whether instances are stored, culled & drawn per cluster
+static
+bool sokol_instance_clustered(
+    const sokol_geometry_buffers_t *buffers)
+{
+#if SOKOL_CLUSTER_INSTANCES
+    return buffers->usage == SG_USAGE_IMMUTABLE;
+#else
+    (void)buffers;
+    return false;
+#endif
+}
+#endif
+
+// Get pointer to instance attribute in CPU buffers
+static
+void* sokol_instance_ptr(
+    sokol_geometry_buffers_t *buffers,
+    const sokol_instance_attr_t *attr,
+    int32_t offset)
+{
+    ecs_size_t size = sokol_instance_layout.stream_size[attr->stream];
+    return ECS_OFFSET(ecs_vec_get(
+        &buffers->streams[attr->stream].data, size, offset), attr->offset);
+}
+
+// Find vertex buffer for each stream that contains one of the attributes
+static
+void sokol_instance_stream_buffers(
+    ecs_flags32_t attrs,
+    int32_t first_buffer,
+    int32_t *stream_buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t i, buffer = first_buffer;
+    for (i = 0; i < l->stream_count; i ++) {
+        ecs_flags32_t stream_attrs = 0;
+        if (l->transform.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_TRANSFORM;
+        }
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        if (l->scale.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_TRANSFORM;
+        }
+#endif
+        if (l->color.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_COLOR;
+        }
+        if (l->material.stream == i) {
+            stream_attrs |= SOKOL_INSTANCE_MATERIAL;
+        }
+
+        if (stream_attrs & attrs) {
+            stream_buffers[i] = buffer ++;
+        } else {
+            stream_buffers[i] = -1;
+        }
+    }
+}
+
+void sokol_instance_pipeline_layout(
+    sg_layout_desc *layout,
+    ecs_flags32_t attrs,
+    int32_t first_buffer,
+    int32_t transform_attr,
+    int32_t color_attr,
+    int32_t material_attr)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t i, stream_buffers[SOKOL_MAX_INSTANCE_STREAMS];
+    sokol_instance_stream_buffers(attrs, first_buffer, stream_buffers);
+
+    for (i = 0; i < l->stream_count; i ++) {
+        int32_t buffer = stream_buffers[i];
+        if (buffer != -1) {
+            layout->buffers[buffer] = (sg_buffer_layout_desc){
+                .stride = l->stream_size[i],
+                .step_func = SG_VERTEXSTEP_PER_INSTANCE
+            };
+        }
+    }
+
+    // Transform is passed as a matrix of vec4 attributes
+    if (attrs & SOKOL_INSTANCE_TRANSFORM) {
+        int32_t count = ECS_SIZEOF(sokol_transform_t) / ECS_SIZEOF(vec4);
+        for (i = 0; i < count; i ++) {
+            layout->attrs[transform_attr + i] = (sg_vertex_attr_desc){
+                .buffer_index = stream_buffers[l->transform.stream],
+                .offset = l->transform.offset + i * ECS_SIZEOF(vec4),
+                .format = SG_VERTEXFORMAT_FLOAT4
+            };
+        }
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        layout->attrs[transform_attr + count] = (sg_vertex_attr_desc){
+            .buffer_index = stream_buffers[l->scale.stream],
+            .offset = l->scale.offset,
+            .format = SG_VERTEXFORMAT_FLOAT3
+        };
+#endif
+    }
+
+#if SOKOL_PACKED_INSTANCE_DATA
+    sg_vertex_format color_format = SG_VERTEXFORMAT_UBYTE4N;
+#else
+    sg_vertex_format color_format = SG_VERTEXFORMAT_FLOAT3;
+#endif
+
+    if (attrs & SOKOL_INSTANCE_COLOR) {
+        layout->attrs[color_attr] = (sg_vertex_attr_desc){
+            .buffer_index = stream_buffers[l->color.stream],
+            .offset = l->color.offset,
+            .format = color_format
+        };
+    }
+
+    if (attrs & SOKOL_INSTANCE_MATERIAL) {
+        layout->attrs[material_attr] = (sg_vertex_attr_desc){
+            .buffer_index = stream_buffers[l->material.stream],
+            .offset = l->material.offset,
+            .format = color_format
+        };
+    }
+}
+
+void sokol_instance_bindings(
+    sg_bindings *bind,
+    const sokol_instance_stream_t *streams,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    int32_t i, stream_buffers[SOKOL_MAX_INSTANCE_STREAMS];
+    sokol_instance_stream_buffers(attrs, first_buffer, stream_buffers);
+
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        if (stream_buffers[i] != -1) {
+            bind->vertex_buffers[stream_buffers[i]] = streams[i].buffer;
+            bind->vertex_buffer_offsets[stream_buffers[i]] = streams[i].offset;
+        }
+    }
+}
+
+// Draw range of instance slots. Instances are selected with vertex buffer
+// offsets, as there is no base instance parameter.
+static
+void sokol_draw_range(
+    int32_t index_count,
+    const sokol_instance_stream_t *streams,
+    int32_t offset,
+    int32_t count,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    sokol_instance_stream_t range_streams[SOKOL_MAX_INSTANCE_STREAMS];
+    int32_t s;
+
+    if (!count) {
+        return;
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        range_streams[s] = streams[s];
+        range_streams[s].offset += offset * l->stream_size[s];
+    }
+
+    sokol_instance_bindings(bind, range_streams, attrs, first_buffer);
+    sokol_apply_bindings(bind);
+    sg_draw(0, index_count, count);
+}
+
+#if SOKOL_CULL_INSTANCES
+// Get mesh of a level of detail in a view, which can be the impostor level
+static
+const sokol_mesh_t* sokol_view_lod_mesh(
+    const SokolGeometry *geometry,
+    int32_t lod)
+{
+    if (lod == SOKOL_LOD_IMPOSTOR) {
+        return &geometry->impostor;
+    }
+    return &geometry->lods[lod];
+}
+
+// Replace the buffers of the bound level of detail in the bindings with the
+// buffers of another level. Returns the number of indices of the level.
+static
+int32_t sokol_bind_lod(
+    const SokolGeometry *geometry,
+    int32_t bound,
+    int32_t lod,
+    sg_bindings *bind)
+{
+    const sokol_mesh_t *from = sokol_view_lod_mesh(geometry, bound);
+    const sokol_mesh_t *to = sokol_view_lod_mesh(geometry, lod);
+    int32_t i;
+
+    if (bound != lod) {
+        for (i = 0; i < SG_MAX_SHADERSTAGE_BUFFERS; i ++) {
+            uint32_t id = bind->vertex_buffers[i].id;
+            if (id == SG_INVALID_ID) {
+                continue;
+            }
+            if (id == from->vertices.id) {
+                bind->vertex_buffers[i] = to->vertices;
+            } else if (id == from->normals.id) {
+                bind->vertex_buffers[i] = to->normals;
+            }
+        }
+        bind->index_buffer = to->indices;
+    }
+
+    return to->index_count;
+}
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+// Draw visible clusters from the instance buffers. Adjacent visible clusters 
+// with the same level of detail are drawn with a single call.
+static
+void sokol_draw_clusters(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    const sokol_instance_view_t *view,
+    int32_t pass,
+    bool excluded,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    const sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    ecs_flags32_t pass_flag = 1u << pass;
+    int32_t l, bound = 0;
+
+    for (l = 0; l < SOKOL_MAX_VIEW_LODS; l ++) {
+        const sokol_instance_lod_t *lod = &view->lods[l];
+        int32_t i = lod->offset, end = lod->offset + lod->count;
+        if (!lod->count) {
+            continue;
+        }
+
+        int32_t index_count = sokol_bind_lod(geometry, bound, l, bind);
+        bound = l;
+
+        while (i < end) {
+            const sokol_instance_cluster_t *cluster = &clusters[visible[i]];
+            int32_t offset = cluster->offset;
+            int32_t count = cluster->count;
+
+            if (((cluster->exclude & pass_flag) != 0) != excluded) {
+                i ++;
+                continue;
+            }
+
+            for (i ++; i < end; i ++) {
+                cluster = &clusters[visible[i]];
+                if ((cluster->offset != (offset + count)) || 
+                    (((cluster->exclude & pass_flag) != 0) != excluded)) 
+                {
+                    break;
+                }
+                count += cluster->count;
+            }
+
+            sokol_draw_range(index_count, buffers->streams, offset, count, 
+                bind, attrs, first_buffer);
+        }
+    }
+}
+#endif
+
+// Draw the instances that are drawn by pass, or the instances that are
+// excluded from pass.
+static
+void sokol_draw_pass_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    bool excluded,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    ecs_assert(pass >= 0 && pass < SOKOL_MAX_PASSES, 
+        ECS_INVALID_PARAMETER, NULL);
+
+#if SOKOL_CULL_INSTANCES
+    ecs_assert(view >= 0 && view < SOKOL_MAX_VIEWS, ECS_INVALID_PARAMETER, NULL);
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        sokol_draw_clusters(geometry, buffers, &buffers->views[view], pass,
+            excluded, bind, attrs, first_buffer);
+        return;
+    }
+#endif
+
+    // Instances that are excluded from the shadow pass are not visible in the
+    // shadow view, and instances that are excluded from the depth pass are
+    // stored at the end of each level of detail. Impostors are drawn last.
+    const sokol_instance_view_t *v = &buffers->views[view];
+    int32_t l, bound = 0;
+    for (l = 0; l < SOKOL_MAX_VIEW_LODS; l ++) {
+        const sokol_instance_lod_t *lod = &v->lods[l];
+        int32_t offset = lod->offset, count = lod->count;
+        if (pass == SOKOL_PASS_DEPTH) {
+            if (excluded) {
+                offset += lod->depth_count;
+                count -= lod->depth_count;
+            } else {
+                count = lod->depth_count;
+            }
+        } else if (excluded) {
+            count = 0;
+        }
+
+        if (!count) {
+            continue;
+        }
+
+        int32_t index_count = sokol_bind_lod(geometry, bound, l, bind);
+        bound = l;
+        sokol_draw_range(index_count, v->streams, offset, count, 
+            bind, attrs, first_buffer);
+    }
+#else
+    (void)view;
+
+    const ecs_vec_t *ex = &buffers->excluded[pass];
+    const sokol_instance_range_t *ranges = ecs_vec_first_t(
+        ex, sokol_instance_range_t);
+    int32_t i, count = ecs_vec_count(ex), offset = 0;
+
+    if (excluded) {
+        for (i = 0; i < count; i ++) {
+            sokol_draw_range(geometry->index_count, buffers->streams, 
+                ranges[i].offset, ranges[i].count, bind, attrs, first_buffer);
+        }
+        return;
+    }
+
+    // Draw the slots between the ranges that are excluded from the pass
+    for (i = 0; i < count; i ++) {
+        sokol_draw_range(geometry->index_count, buffers->streams, offset, 
+            ranges[i].offset - offset, bind, attrs, first_buffer);
+        offset = ranges[i].offset + ranges[i].count;
+    }
+
+    sokol_draw_range(geometry->index_count, buffers->streams, offset, 
+        buffers->instance_count - offset, bind, attrs, first_buffer);
+#endif
+}
+
+void sokol_draw_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    sokol_draw_pass_instances(geometry, buffers, view, pass, false, 
+        bind, attrs, first_buffer);
+}
+
+void sokol_draw_excluded_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer)
+{
+    sokol_draw_pass_instances(geometry, buffers, view, pass, true, 
+        bind, attrs, first_buffer);
+}
+
+// Add instance buffers to draw list if they have instances to draw in passes
+static
+void sokol_draw_list_add(
+    ecs_vec_t *draw_list,
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t kind,
+    ecs_flags32_t passes)
+{
+#if SOKOL_CULL_INSTANCES
+    int32_t count = buffers->views[SOKOL_VIEW_CAMERA].count;
+    if (!count) {
+        passes &= ~((1u << SOKOL_PASS_SCENE) | (1u << SOKOL_PASS_DEPTH));
+    }
+    if (!buffers->views[SOKOL_VIEW_SHADOW].count) {
+        passes &= ~(1u << SOKOL_PASS_SHADOW);
+    }
+#else
+    int32_t count = buffers->instance_count;
+    if (!count) {
+        passes = 0;
+    }
+#endif
+
+    if (!passes) {
+        return;
+    }
+
+    // Passes that some of the instances are excluded from
+    ecs_flags32_t exclude = 0;
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        if (buffers->exclude_count[p]) {
+            exclude |= 1u << p;
+        }
+    }
+
+    sokol_draw_batch_t *batch = ecs_vec_append_t(
+        NULL, draw_list, sokol_draw_batch_t);
+    batch->geometry = geometry;
+    batch->buffers = buffers;
+    batch->mesh = (sokol_mesh_t){
+        .vertices = geometry->vertices,
+        .normals = geometry->normals,
+        .indices = geometry->indices,
+        .index_count = geometry->index_count
+    };
+    batch->instance_count = count;
+    batch->passes = passes;
+    batch->exclude = exclude;
+
+    // Batches that share geometry buffers are drawn after each other, and
+    // batches of the same geometry are drawn front to back. Positive floats
+    // have the same order as their bits.
+#if SOKOL_CULL_INSTANCES
+    float depth = buffers->views[SOKOL_VIEW_CAMERA].depth;
+#else
+    float depth = 0;
+#endif
+    uint32_t depth_bits;
+    ecs_os_memcpy(&depth_bits, &depth, ECS_SIZEOF(float));
+    batch->sort_key = ((uint64_t)geometry->vertices.id << 32) | 
+        ((uint64_t)(depth_bits >> 8) << 8) | (uint64_t)kind;
+}
+
+static
+int sokol_compare_draw_batch(
+    const void *ptr_1,
+    const void *ptr_2)
+{
+    const sokol_draw_batch_t *b1 = ptr_1, *b2 = ptr_2;
+    return (b1->sort_key > b2->sort_key) - (b1->sort_key < b2->sort_key);
+}
+
+void sokol_build_draw_list(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    ecs_vec_t *draw_list)
+{
+    const ecs_flags32_t all = (1u << SOKOL_PASS_SCENE) | 
+        (1u << SOKOL_PASS_DEPTH) | (1u << SOKOL_PASS_SHADOW);
+
+    ecs_vec_clear(draw_list);
+
+    ecs_iter_t qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_draw_list_add(draw_list, &g[i], &g[i].solid, 0, all);
+            sokol_draw_list_add(draw_list, &g[i], &g[i].statics, 1, all);
+        }
+    }
+
+    qsort(ecs_vec_first(draw_list), (size_t)ecs_vec_count(draw_list), 
+        sizeof(sokol_draw_batch_t), sokol_compare_draw_batch);
+}
+
+static
+void sokol_geometry_buffers_init(
+    ecs_allocator_t *a, 
+    sokol_geometry_buffers_t *result, 
+    sg_usage usage) 
+{
+    int32_t i;
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        ecs_vec_init(a, &result->streams[i].data, 
+            sokol_instance_layout.stream_size[i], 0);
+    }
+    ecs_vec_init_t(a, &result->free_ranges, sokol_instance_range_t, 0);
+    ecs_vec_init_t(a, &result->dirty_ranges, sokol_instance_range_t, 0);
+    ecs_map_init(&result->tables, a);
+    result->usage = usage;
+
+#if SOKOL_CULL_INSTANCES
+    ecs_vec_init_t(a, &result->bounds, vec4, 0);
+    int32_t v;
+    for (v = 0; v < SOKOL_MAX_VIEWS; v ++) {
+        sokol_instance_view_t *view = &result->views[v];
+        for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+            ecs_vec_init(a, &view->streams[i].data, 
+                sokol_instance_layout.stream_size[i], 0);
+        }
+        ecs_vec_init_t(a, &view->visible, int32_t, 0);
+        ecs_vec_init_t(a, &view->bins, int8_t, 0);
+        ecs_vec_init_t(a, &view->sorted, int32_t, 0);
+    }
+    ecs_vec_init_t(a, &result->exclude, uint8_t, 0);
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    ecs_vec_init_t(a, &result->table_slots, sokol_table_slots_t, 0);
+#endif
+#else
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        ecs_vec_init_t(a, &result->excluded[p], sokol_instance_range_t, 0);
+    }
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_init(&result->index, a);
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+    ecs_vec_init_t(a, &result->clusters, sokol_instance_cluster_t, 0);
+    ecs_vec_init_t(a, &result->cluster_bounds, vec4, 0);
+    ecs_map_init(&result->groups, a);
+#endif
+}
+
+static
+void sokol_geometry_buffers_fini(ecs_allocator_t *a, sokol_geometry_buffers_t* result) {
+    int32_t i;
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        sokol_instance_stream_t *stream = &result->streams[i];
+        // Stream buffers are owned by the instance ring
+        if (stream->buffer.id && (result->usage != SG_USAGE_STREAM)) {
+            sg_destroy_buffer(stream->buffer);
+        }
+        ecs_vec_fini(a, &stream->data, sokol_instance_layout.stream_size[i]);
+    }
+
+    ecs_vec_fini_t(a, &result->free_ranges, sokol_instance_range_t);
+    ecs_vec_fini_t(a, &result->dirty_ranges, sokol_instance_range_t);
+
+#if SOKOL_CULL_INSTANCES
+    ecs_vec_fini_t(a, &result->bounds, vec4);
+    int32_t v;
+    for (v = 0; v < SOKOL_MAX_VIEWS; v ++) {
+        sokol_instance_view_t *view = &result->views[v];
+        for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+            sokol_instance_stream_t *stream = &view->streams[i];
+            // View data is appended to the instance ring, which owns the buffer
+            if (stream->buffer.id && !SOKOL_INSTANCE_RING) {
+                sg_destroy_buffer(stream->buffer);
+            }
+            ecs_vec_fini(a, &stream->data, sokol_instance_layout.stream_size[i]);
+        }
+        ecs_vec_fini_t(a, &view->visible, int32_t);
+        ecs_vec_fini_t(a, &view->bins, int8_t);
+        ecs_vec_fini_t(a, &view->sorted, int32_t);
+    }
+    ecs_vec_fini_t(a, &result->exclude, uint8_t);
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    ecs_vec_fini_t(a, &result->table_slots, sokol_table_slots_t);
+#endif
+#else
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        ecs_vec_fini_t(a, &result->excluded[p], sokol_instance_range_t);
+    }
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_fini(&result->index);
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+    ecs_vec_fini_t(a, &result->clusters, sokol_instance_cluster_t);
+    ecs_vec_fini_t(a, &result->cluster_bounds, vec4);
+
+    ecs_map_iter_t git = ecs_map_iter(&result->groups);
+    while (ecs_map_next(&git)) {
+        ecs_os_free(ecs_map_ptr(&git));
+    }
+    ecs_map_fini(&result->groups);
+#endif
+
+    ecs_map_iter_t mit = ecs_map_iter(&result->tables);
+    while (ecs_map_next(&mit)) {
+        ecs_os_free(ecs_map_ptr(&mit));
+    }
+    ecs_map_fini(&result->tables);
+}
+
+static
+void sokol_free_geometry(SokolGeometry *ptr) {
+    sokol_geometry_buffers_fini(ptr->allocator, &ptr->solid);
+    sokol_geometry_buffers_fini(ptr->allocator, &ptr->statics);
+    if (ptr->allocator) {
+        flecs_allocator_fini(ptr->allocator);
+        ecs_os_free(ptr->allocator);
+        ptr->allocator = NULL;
+    }
+}
+
+ECS_CTOR(SokolGeometry, ptr, {
+    ecs_os_memset_t(ptr, 0, SokolGeometry);
+    ptr->allocator = ecs_os_malloc_t(ecs_allocator_t);
+    
+    flecs_allocator_init(ptr->allocator);
+    flecs_allocator_fini(ptr->allocator);
+    flecs_allocator_init(ptr->allocator);
+
+
+#if SOKOL_INSTANCE_RING
+    sokol_geometry_buffers_init(ptr->allocator, &ptr->solid, SG_USAGE_STREAM);
+#else
+    sokol_geometry_buffers_init(ptr->allocator, &ptr->solid, SG_USAGE_DYNAMIC);
+#endif
+    sokol_geometry_buffers_init(ptr->allocator, &ptr->statics, 
+        SG_USAGE_IMMUTABLE);
+})
+
+ECS_MOVE(SokolGeometry, dst, src, {
+    sokol_free_geometry(dst);
+    ecs_os_memcpy_t(dst, src, SokolGeometry);
+    ecs_os_memset_t(src, 0, SokolGeometry);
+})
+
+ECS_DTOR(SokolGeometry, ptr, {
+    sokol_free_geometry(ptr);
+})
+
+#if SOKOL_OCCLUSION_CULLING
+ECS_CTOR(SokolOcclusion, ptr, {
+    ecs_os_memset_t(ptr, 0, SokolOcclusion);
+})
+
+static
+void sokol_free_occlusion(SokolOcclusion *ptr) {
+    if (ptr->buffer.depth) {
+        sokol_occlusion_fini(&ptr->buffer);
+    }
+    ecs_vec_fini_t(NULL, &ptr->occluders, sokol_occluder_t);
+}
+
+ECS_MOVE(SokolOcclusion, dst, src, {
+    sokol_free_occlusion(dst);
+    ecs_os_memcpy_t(dst, src, SokolOcclusion);
+    ecs_os_memset_t(src, 0, SokolOcclusion);
+})
+
+ECS_DTOR(SokolOcclusion, ptr, {
+    sokol_free_occlusion(ptr);
+})
+#endif
+
+// To ensure rectangles are of the right size, use the Rectangle component to
+// apply a scaling factor to the transform matrix that is sent to the GPU.
+static
+void sokol_populate_rectangle(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    EcsRectangle *data, 
+    int32_t count,
+    bool self) 
+{
+    sokol_copy_scale_instances(dst, dst_stride, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsRectangle) : 0, 2);
+}
+
+// To ensure boxes are of the right size, use the Box component to apply
+// a scaling factor to the transform matrix that is sent to the GPU.
+static
+void sokol_populate_box(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    EcsBox *data, 
+    int32_t count,
+    bool self)
+{
+    sokol_copy_scale_instances(dst, dst_stride, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsBox) : 0, 3);
+}
+
+// Scale for rectangles that is applied by the shader. Rectangles are not
+// scaled on the z axis.
+static
+void sokol_scale_rectangle(
+    void *dst,
+    ecs_size_t dst_stride,
+    EcsRectangle *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const EcsRectangle *r = self ? &data[i] : data;
+        float *scale = ECS_ELEM(dst, dst_stride, i);
+        scale[0] = r->width;
+        scale[1] = r->height;
+        scale[2] = 1.0;
+    }
+}
+
+// Scale for boxes that is applied by the shader
+static
+void sokol_scale_box(
+    void *dst,
+    ecs_size_t dst_stride,
+    EcsBox *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const EcsBox *b = self ? &data[i] : data;
+        float *scale = ECS_ELEM(dst, dst_stride, i);
+        scale[0] = b->width;
+        scale[1] = b->height;
+        scale[2] = b->depth;
+    }
+}
+
+// Bounding spheres for rectangles
+static
+void sokol_bounds_rectangle(
+    vec4 *dst,
+    const mat4 *transforms,
+    EcsRectangle *data,
+    int32_t count,
+    bool self)
+{
+    sokol_compute_bounds(dst, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsRectangle) : 0, 2);
+}
+
+// Bounding spheres for boxes
+static
+void sokol_bounds_box(
+    vec4 *dst,
+    const mat4 *transforms,
+    EcsBox *data,
+    int32_t count,
+    bool self)
+{
+    sokol_compute_bounds(dst, transforms, count, &data->width, 
+        self ? ECS_SIZEOF(EcsBox) : 0, 3);
+}
+
+/* Number of scale vectors of primitives that are computed at a time */
+#define SOKOL_PRIMITIVE_BATCH (256)
+
+// Scale vectors for primitives with a radius, and a height if not NULL. The
+// unit primitive meshes have a diameter and height of 1.
+static
+void sokol_primitive_scales(
+    vec3 *dst,
+    const float *radius,
+    const float *height,
+    ecs_size_t stride,
+    int32_t count)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        float r = *(const float*)ECS_ELEM(radius, stride, i);
+        dst[i][0] = r * 2.0f;
+        dst[i][1] = height ? 
+            *(const float*)ECS_ELEM(height, stride, i) : r * 2.0f;
+        dst[i][2] = r * 2.0f;
+    }
+}
+
+// Copy & scale transforms of primitives. Scale vectors are computed in 
+// batches, so that the transform kernels can be used.
+static
+void sokol_populate_primitive(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    const float *radius,
+    const float *height,
+    ecs_size_t stride,
+    int32_t count)
+{
+    vec3 scale[SOKOL_PRIMITIVE_BATCH];
+    int32_t i;
+
+    if (!stride) {
+        sokol_primitive_scales(scale, radius, height, 0, 1);
+        sokol_copy_scale_instances(dst, dst_stride, transforms, count, 
+            scale[0], 0, 3);
+        return;
+    }
+
+    for (i = 0; i < count; i += SOKOL_PRIMITIVE_BATCH) {
+        int32_t n = glm_imin(count - i, SOKOL_PRIMITIVE_BATCH);
+        sokol_primitive_scales(scale, ECS_ELEM(radius, stride, i), 
+            height ? ECS_ELEM(height, stride, i) : NULL, stride, n);
+        sokol_copy_scale_instances(ECS_ELEM(dst, dst_stride, i), dst_stride, 
+            &transforms[i], n, scale[0], ECS_SIZEOF(vec3), 3);
+    }
+}
+
+// Bounding spheres of primitives, computed in batches like transforms
+static
+void sokol_bounds_primitive(
+    vec4 *dst,
+    const mat4 *transforms,
+    const float *radius,
+    const float *height,
+    ecs_size_t stride,
+    int32_t count)
+{
+    vec3 scale[SOKOL_PRIMITIVE_BATCH];
+    int32_t i;
+
+    if (!stride) {
+        sokol_primitive_scales(scale, radius, height, 0, 1);
+        sokol_compute_bounds(dst, transforms, count, scale[0], 0, 3);
+        return;
+    }
+
+    for (i = 0; i < count; i += SOKOL_PRIMITIVE_BATCH) {
+        int32_t n = glm_imin(count - i, SOKOL_PRIMITIVE_BATCH);
+        sokol_primitive_scales(scale, ECS_ELEM(radius, stride, i), 
+            height ? ECS_ELEM(height, stride, i) : NULL, stride, n);
+        sokol_compute_bounds(&dst[i], &transforms[i], n, scale[0], 
+            ECS_SIZEOF(vec3), 3);
+    }
+}
+
+static
+void sokol_populate_sphere(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    SokolSphere *data,
+    int32_t count,
+    bool self)
+{
+    sokol_populate_primitive(dst, dst_stride, transforms, &data->radius, NULL,
+        self ? ECS_SIZEOF(SokolSphere) : 0, count);
+}
+
+static
+void sokol_populate_cylinder(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    SokolCylinder *data,
+    int32_t count,
+    bool self)
+{
+    sokol_populate_primitive(dst, dst_stride, transforms, &data->radius, 
+        &data->height, self ? ECS_SIZEOF(SokolCylinder) : 0, count);
+}
+
+static
+void sokol_populate_cone(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
+    SokolCone *data,
+    int32_t count,
+    bool self)
+{
+    sokol_populate_primitive(dst, dst_stride, transforms, &data->radius, 
+        &data->height, self ? ECS_SIZEOF(SokolCone) : 0, count);
+}
+
+static
+void sokol_scale_sphere(
+    void *dst,
+    ecs_size_t dst_stride,
+    SokolSphere *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const SokolSphere *p = self ? &data[i] : data;
+        sokol_primitive_scales(ECS_ELEM(dst, dst_stride, i), &p->radius, 
+            NULL, 0, 1);
+    }
+}
+
+static
+void sokol_scale_cylinder(
+    void *dst,
+    ecs_size_t dst_stride,
+    SokolCylinder *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const SokolCylinder *p = self ? &data[i] : data;
+        sokol_primitive_scales(ECS_ELEM(dst, dst_stride, i), &p->radius, 
+            &p->height, 0, 1);
+    }
+}
+
+static
+void sokol_scale_cone(
+    void *dst,
+    ecs_size_t dst_stride,
+    SokolCone *data,
+    int32_t count,
+    bool self)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const SokolCone *p = self ? &data[i] : data;
+        sokol_primitive_scales(ECS_ELEM(dst, dst_stride, i), &p->radius, 
+            &p->height, 0, 1);
+    }
+}
+
+static
+void sokol_bounds_sphere(
+    vec4 *dst,
+    const mat4 *transforms,
+    SokolSphere *data,
+    int32_t count,
+    bool self)
+{
+    sokol_bounds_primitive(dst, transforms, &data->radius, NULL, 
+        self ? ECS_SIZEOF(SokolSphere) : 0, count);
+}
+
+static
+void sokol_bounds_cylinder(
+    vec4 *dst,
+    const mat4 *transforms,
+    SokolCylinder *data,
+    int32_t count,
+    bool self)
+{
+    sokol_bounds_primitive(dst, transforms, &data->radius, &data->height, 
+        self ? ECS_SIZEOF(SokolCylinder) : 0, count);
+}
+
+static
+void sokol_bounds_cone(
+    vec4 *dst,
+    const mat4 *transforms,
+    SokolCone *data,
+    int32_t count,
+    bool self)
+{
+    sokol_bounds_primitive(dst, transforms, &data->radius, &data->height, 
+        self ? ECS_SIZEOF(SokolCone) : 0, count);
+}
+
+// Set levels of detail of geometry. The first level is also used when levels
+// of detail are disabled.
+static
+void sokol_geometry_set_lods(
+    SokolGeometry *g,
+    const sokol_mesh_t *lods,
+    const float *lod_sizes,
+    int32_t lod_count)
+{
+    ecs_assert(lod_count > 0 && lod_count <= SOKOL_MAX_LODS, 
+        ECS_INVALID_PARAMETER, NULL);
+
+    int32_t i;
+    for (i = 0; i < lod_count; i ++) {
+        g->lods[i] = lods[i];
+        g->lod_sizes[i] = lod_sizes ? lod_sizes[i] : 0;
+    }
+
+    g->lod_count = lod_count;
+    g->vertices = lods[0].vertices;
+    g->normals = lods[0].normals;
+    g->indices = lods[0].indices;
+    g->index_count = lods[0].index_count;
+}
+
+// Init static rectangle geometry data (vertices, indices)
+static
+void sokol_init_rectangle(
+    ecs_world_t *world,
+    sokol_resources_t *resources) 
+{
+    SokolGeometry *g = ecs_get_mut(
+        world, ecs_id(SokolRectangleGeometry), SokolGeometry);
+    ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    sokol_geometry_set_lods(g, &(sokol_mesh_t){
+        .vertices = resources->rect,
+        .normals = resources->rect_normals,
+        .indices = resources->rect_indices,
+        .index_count = sokol_rectangle_index_count()
+    }, NULL, 1);
+    g->populate = (sokol_geometry_action_t)sokol_populate_rectangle;
+    g->scale = (sokol_geometry_scale_action_t)sokol_scale_rectangle;
+    g->bounds = (sokol_geometry_bounds_action_t)sokol_bounds_rectangle;
+}
+
+// Init static box geometry data (vertices, indices)
+static
+void sokol_init_box(
+    ecs_world_t *world,
+    sokol_resources_t *resources) 
+{
+    if (SokolBoxGeometry) {
+        SokolGeometry *g = ecs_get_mut(
+            world, ecs_id(SokolBoxGeometry), SokolGeometry);
+        ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+
+        sokol_geometry_set_lods(g, &(sokol_mesh_t){
+            .vertices = resources->box,
+            .normals = resources->box_normals,
+            .indices = resources->box_indices,
+            .index_count = sokol_box_index_count()
+        }, NULL, 1);
+        g->populate = (sokol_geometry_action_t)sokol_populate_box;
+        g->scale = (sokol_geometry_scale_action_t)sokol_scale_box;
+        g->bounds = (sokol_geometry_bounds_action_t)sokol_bounds_box;
+#if SOKOL_OCCLUSION_CULLING
+        g->occluder = true;
+#endif
+    }
+}
+
+/* Minimum projected diameter in pixels per primitive level of detail */
+static const float sokol_primitive_lod_sizes[SOKOL_MAX_LODS] = { 128, 32, 0 };
+
+// Init procedural primitive geometry with levels of detail from resources
+static
+void sokol_init_primitive(
+    ecs_world_t *world,
+    ecs_entity_t geometry,
+    const sokol_mesh_t *lods,
+    sokol_geometry_action_t populate,
+    sokol_geometry_scale_action_t scale,
+    sokol_geometry_bounds_action_t bounds)
+{
+    SokolGeometry *g = ecs_get_mut(world, geometry, SokolGeometry);
+    ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    sokol_geometry_set_lods(g, lods, sokol_primitive_lod_sizes, 
+        SOKOL_MAX_LODS);
+    g->populate = populate;
+    g->scale = scale;
+    g->bounds = bounds;
+}
+
+void sokol_init_geometry(
+    ecs_world_t *world,
+    sokol_resources_t *resources) 
+{
+    sokol_init_rectangle(world, resources);
+    sokol_init_box(world, resources);
+
+    sokol_init_primitive(world, SokolSphereGeometry, resources->sphere,
+        (sokol_geometry_action_t)sokol_populate_sphere,
+        (sokol_geometry_scale_action_t)sokol_scale_sphere,
+        (sokol_geometry_bounds_action_t)sokol_bounds_sphere);
+    sokol_init_primitive(world, SokolCylinderGeometry, resources->cylinder,
+        (sokol_geometry_action_t)sokol_populate_cylinder,
+        (sokol_geometry_scale_action_t)sokol_scale_cylinder,
+        (sokol_geometry_bounds_action_t)sokol_bounds_cylinder);
+    sokol_init_primitive(world, SokolConeGeometry, resources->cone,
+        (sokol_geometry_action_t)sokol_populate_cone,
+        (sokol_geometry_scale_action_t)sokol_scale_cone,
+        (sokol_geometry_bounds_action_t)sokol_bounds_cone);
+
+    // All geometries use the same camera facing quad for impostors. Geometries
+    // that are created later get the quad from the singleton.
+    sokol_mesh_t impostor = {
+        .vertices = resources->rect,
+        .normals = resources->rect_normals,
+        .indices = resources->rect_impostor_indices,
+        .index_count = sokol_rectangle_impostor_index_count()
+    };
+    ecs_singleton_set(world, SokolImpostorMesh, { impostor });
+
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            g[i].impostor = impostor;
+        }
+    }
+
+#if SOKOL_INSTANCE_RING
+    // Ring buffer is created when instance data is first appended
+    ecs_singleton_set(world, SokolInstanceRing, {0});
+#endif
+}
+
+// Number of slots to reserve for a table with the specified number of
+// entities. Tables get some headroom so that adding a few entities doesn't
+// immediately require moving the table to a different range.
+static
+int32_t sokol_instance_capacity(
+    int32_t count)
+{
+    int32_t capacity = count + (count >> 3);
+    return (capacity + 3) & ~3;
+}
+
+// Compute capacity of instance buffers that can hold count instances. The 
+// capacity grows geometrically, so that spawning entities in waves doesn't
+// cause a reallocation each frame.
+static
+int32_t sokol_instance_buffer_capacity(
+    int32_t capacity,
+    int32_t count,
+    int32_t hint)
+{
+    if (capacity < SOKOL_INSTANCE_MIN_CAPACITY) {
+        capacity = SOKOL_INSTANCE_MIN_CAPACITY;
+    }
+    if (capacity < hint) {
+        capacity = hint;
+    }
+    while (capacity < count) {
+        capacity += capacity >> 1;
+    }
+    return capacity;
+}
+
+// Zero out instance slots. Unused slots are zero, which produces a degenerate
+// transform so that they don't render anything.
+static
+void sokol_clear_instances(
+    sokol_geometry_buffers_t *buffers,
+    int32_t offset,
+    int32_t count)
+{
+    if (!count) {
+        return;
+    }
+
+    int32_t i;
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        if (!sokol_instance_stream_staged(buffers, i)) {
+            continue;
+        }
+        ecs_size_t size = sokol_instance_layout.stream_size[i];
+        ecs_os_memset(ecs_vec_get(&buffers->streams[i].data, size, offset), 
+            0, size * count);
+    }
+
+#if SOKOL_CULL_INSTANCES
+    ecs_os_memset_n(ecs_vec_get_t(&buffers->bounds, vec4, offset), 0, 
+        vec4, count);
+    ecs_os_memset_n(ecs_vec_get_t(&buffers->exclude, uint8_t, offset), 0, 
+        uint8_t, count);
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_remove(&buffers->index, offset, count);
+#endif
+}
+
+// Resize CPU buffers. Sokol buffers are recreated with the new capacity the 
+// next time instances are uploaded.
+static
+void sokol_resize_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t capacity)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    int32_t i, old_capacity = buffers->capacity;
+    ecs_assert(capacity >= buffers->instance_count, ECS_INTERNAL_ERROR, NULL);
+
+    for (i = 0; i < sokol_instance_layout.stream_count; i ++) {
+        if (!sokol_instance_stream_staged(buffers, i)) {
+            continue;
+        }
+        ecs_vec_t *data = &buffers->streams[i].data;
+        ecs_size_t size = sokol_instance_layout.stream_size[i];
+        ecs_vec_set_count(a, data, size, capacity);
+        if (capacity < old_capacity) {
+            ecs_vec_reclaim(a, data, size);
+        }
+    }
+
+#if SOKOL_CULL_INSTANCES
+    ecs_vec_set_count_t(a, &buffers->bounds, vec4, capacity);
+    ecs_vec_set_count_t(a, &buffers->exclude, uint8_t, capacity);
+    if (capacity < old_capacity) {
+        ecs_vec_reclaim_t(a, &buffers->bounds, vec4);
+        ecs_vec_reclaim_t(a, &buffers->exclude, uint8_t);
+    }
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    sokol_spatial_resize(&buffers->index, capacity);
+#endif
+
+    // New slots are zero
+    if (capacity > old_capacity) {
+        sokol_clear_instances(buffers, old_capacity, capacity - old_capacity);
+    }
+
+    buffers->capacity = capacity;
+    buffers->low_frames = 0;
+    geometry->stats.reallocations ++;
+    ecs_dbg_2("sokol: resized instance buffers from %d to %d instances", 
+        old_capacity, capacity);
+}
+
+// Shrink buffers when they have been mostly unused for a number of frames, or 
+// grow them when the capacity hint increased.
+static
+void sokol_update_capacity(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    int32_t hint = buffers->capacity_hint;
+    if (buffers->capacity < hint) {
+        sokol_resize_instances(geometry, buffers, hint);
+        return;
+    }
+
+    // Low watermark is a quarter of the capacity. Buffers are shrunk to twice
+    // the number of instances, so that there is a wide margin before buffers
+    // need to grow or shrink again.
+    int32_t count = buffers->instance_count;
+    if (count >= (buffers->capacity >> 2)) {
+        buffers->low_frames = 0;
+        return;
+    }
+
+    if (++ buffers->low_frames < SOKOL_INSTANCE_SHRINK_FRAMES) {
+        return;
+    }
+
+    int32_t capacity = sokol_instance_buffer_capacity(0, count * 2, hint);
+    if (capacity < buffers->capacity) {
+        sokol_resize_instances(geometry, buffers, capacity);
+    } else {
+        buffers->low_frames = 0;
+    }
+}
+
+// Mark range of instances as modified so it gets uploaded to the GPU
+static
+void sokol_dirty_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    int32_t offset,
+    int32_t count)
+{
+    if (count) {
+        sokol_instance_range_t *r = ecs_vec_append_t(
+            a, &buffers->dirty_ranges, sokol_instance_range_t);
+        r->offset = offset;
+        r->count = count;
+    }
+}
+
+// Return range of instance slots to the free list. The free list is kept 
+// sorted by offset so that adjacent ranges can be merged.
+static
+void sokol_release_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    int32_t offset,
+    int32_t count)
+{
+    if (!count) {
+        return;
+    }
+
+    sokol_clear_instances(buffers, offset, count);
+
+    // If range is at the end of the buffer just stop drawing it
+    if ((offset + count) == buffers->instance_count) {
+        buffers->instance_count = offset;
+
+        // Previous free range may now also be at the end of the buffer
+        sokol_instance_range_t *last = ecs_vec_last_t(
+            &buffers->free_ranges, sokol_instance_range_t);
+        if (last && (last->offset + last->count) == buffers->instance_count) {
+            buffers->instance_count = last->offset;
+            buffers->free_count -= last->count;
+            ecs_vec_remove_last(&buffers->free_ranges);
+        }
+        return;
+    }
+
+    // Slots were cleared, so the GPU buffer needs to be updated
+    sokol_dirty_instances(a, buffers, offset, count);
+
+    int32_t i, free_count = ecs_vec_count(&buffers->free_ranges);
+    sokol_instance_range_t *ranges = ecs_vec_first_t(
+        &buffers->free_ranges, sokol_instance_range_t);
+    for (i = 0; i < free_count; i ++) {
+        if (ranges[i].offset > offset) {
+            break;
+        }
+    }
+
+    buffers->free_count += count;
+
+    // Merge with previous range
+    if (i && (ranges[i - 1].offset + ranges[i - 1].count) == offset) {
+        ranges[i - 1].count += count;
+        
+        // Merge with next range
+        if (i < free_count && (offset + count) == ranges[i].offset) {
+            ranges[i - 1].count += ranges[i].count;
+            ecs_os_memmove_n(&ranges[i], &ranges[i + 1], 
+                sokol_instance_range_t, free_count - i - 1);
+            ecs_vec_remove_last(&buffers->free_ranges);
+        }
+        return;
+    }
+
+    // Merge with next range
+    if (i < free_count && (offset + count) == ranges[i].offset) {
+        ranges[i].offset = offset;
+        ranges[i].count += count;
+        return;
+    }
+
+    // Insert new range
+    ecs_vec_append_t(a, &buffers->free_ranges, sokol_instance_range_t);
+    ranges = ecs_vec_first_t(&buffers->free_ranges, sokol_instance_range_t);
+    ecs_os_memmove_n(&ranges[i + 1], &ranges[i], 
+        sokol_instance_range_t, free_count - i);
+    ranges[i].offset = offset;
+    ranges[i].count = count;
+}
+
+// Find range of instance slots for table. Uses first range in the free list 
+// that's large enough, or adds slots to the end of the buffer.
+static
+int32_t sokol_alloc_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t count)
+{
+    int32_t i, free_count = ecs_vec_count(&buffers->free_ranges);
+    sokol_instance_range_t *ranges = ecs_vec_first_t(
+        &buffers->free_ranges, sokol_instance_range_t);
+    for (i = 0; i < free_count; i ++) {
+        sokol_instance_range_t *r = &ranges[i];
+        if (r->count >= count) {
+            int32_t offset = r->offset;
+            r->offset += count;
+            r->count -= count;
+            if (!r->count) {
+                ecs_os_memmove_n(&ranges[i], &ranges[i + 1], 
+                    sokol_instance_range_t, free_count - i - 1);
+                ecs_vec_remove_last(&buffers->free_ranges);
+            }
+            buffers->free_count -= count;
+            return offset;
+        }
+    }
+
+    int32_t offset = buffers->instance_count;
+    buffers->instance_count += count;
+
+    // Make sure CPU buffers are large enough
+    if (buffers->instance_count > buffers->capacity) {
+        sokol_resize_instances(geometry, buffers, sokol_instance_buffer_capacity(
+            buffers->capacity, buffers->instance_count, 
+                buffers->capacity_hint));
+    }
+
+    return offset;
+}
+
+// When a large part of the instance buffer consists of unused slots, release
+// all table ranges so they're packed again when the buffers are populated.
+static
+void sokol_compact_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    if (buffers->free_count <= (buffers->instance_count >> 2)) {
+        return;
+    }
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        ti->offset = 0;
+        ti->capacity = 0;
+        ti->count = 0;
+    }
+
+    sokol_clear_instances(buffers, 0, buffers->capacity);
+    ecs_vec_clear(&buffers->free_ranges);
+    ecs_vec_clear(&buffers->dirty_ranges);
+    ecs_os_memset_n(buffers->exclude_count, 0, int32_t, SOKOL_MAX_PASSES);
+    buffers->free_count = 0;
+    buffers->instance_count = 0;
+    geometry->stats.compactions ++;
+
+#if SOKOL_CLUSTER_INSTANCES
+    mit = ecs_map_iter(&buffers->groups);
+    while (ecs_map_next(&mit)) {
+        sokol_cluster_group_t *g = ecs_map_ptr(&mit);
+        g->offset = 0;
+        g->capacity = 0;
+        g->count = 0;
+        g->dirty = true;
+    }
+#endif
+}
+
+#if SOKOL_PACKED_INSTANCE_DATA
+// Convert colors & materials to packed instance format
+static
+void sokol_gather_colors(
+    sokol_geometry_buffers_t *buffers,
+    ecs_iter_t *qit,
+    int32_t offset)
+{
+    static const float zero[2] = {0};
+
+    EcsRgb *colors = ecs_field(qit, EcsRgb, 1);
+    EcsEmissive *emissive = ecs_field(qit, EcsEmissive, 2);
+    EcsSpecular *specular = ecs_field(qit, EcsSpecular, 3);
+
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    void *c = sokol_instance_ptr(buffers, &l->color, offset);
+    const float *specular_ptr = zero, *emissive_ptr = zero;
+    ecs_size_t specular_stride = 0, emissive_stride = 0;
+
+    if (specular) {
+        specular_ptr = &specular->specular_power;
+        if (ecs_field_is_self(qit, 3)) {
+            specular_stride = ECS_SIZEOF(EcsSpecular);
+        }
+    }
+    if (emissive) {
+        emissive_ptr = &emissive->value;
+        if (ecs_field_is_self(qit, 2)) {
+            emissive_stride = ECS_SIZEOF(EcsEmissive);
+        }
+    }
+
+    sokol_pack_instance_colors(c, l->stream_size[l->color.stream], qit->count,
+        &colors->r, ecs_field_is_self(qit, 1) ? ECS_SIZEOF(EcsRgb) : 0,
+        specular_ptr, specular_stride,
+        emissive_ptr, emissive_stride);
+}
+#else
+// Copy colors & materials to instance buffers
+static
+void sokol_gather_colors(
+    sokol_geometry_buffers_t *buffers,
+    ecs_iter_t *qit,
+    int32_t offset)
+{
+    EcsRgb *colors = ecs_field(qit, EcsRgb, 1);
+    EcsEmissive *emissive = ecs_field(qit, EcsEmissive, 2);
+    EcsSpecular *specular = ecs_field(qit, EcsSpecular, 3);
+
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    ecs_size_t c_stride = l->stream_size[l->color.stream];
+    ecs_size_t m_stride = l->stream_size[l->material.stream];
+    void *c = sokol_instance_ptr(buffers, &l->color, offset);
+    void *m = sokol_instance_ptr(buffers, &l->material, offset);
+    int32_t i, count = qit->count;
+
+    // Copy color data
+    if (ecs_field_is_self(qit, 1)) {
+        if (c_stride == ECS_SIZEOF(ecs_rgb_t)) {
+            ecs_os_memcpy_n(c, colors, ecs_rgb_t, count);
+        } else {
+            for (i = 0; i < count; i ++) {
+                *(ecs_rgb_t*)ECS_ELEM(c, c_stride, i) = colors[i];
+            }
+        }
+    } else {
+        for (i = 0; i < count; i ++) {
+            *(ecs_rgb_t*)ECS_ELEM(c, c_stride, i) = colors[0];
+        }
+    }
+
+    // Copy material data. Fields that are not owned by the entities use the
+    // same value for all instances.
+    const float zero[2] = {0};
+    const float *e = zero, *s = zero;
+    ecs_size_t e_stride = 0, s_stride = 0;
+    if (emissive) {
+        e = &emissive->value;
+        if (ecs_field_is_self(qit, 2)) {
+            e_stride = ECS_SIZEOF(EcsEmissive);
+        }
+    }
+    if (specular) {
+        s = &specular->specular_power;
+        if (ecs_field_is_self(qit, 3)) {
+            s_stride = ECS_SIZEOF(EcsSpecular);
+        }
+    }
+
+    for (i = 0; i < count; i ++) {
+        SokolMaterial *mi = ECS_ELEM(m, m_stride, i);
+        const float *ei = ECS_ELEM(e, e_stride, i);
+        const float *si = ECS_ELEM(s, s_stride, i);
+        mi->specular_power = si[0];
+        mi->shininess = si[1];
+        mi->emissive = ei[0];
+    }
+}
+#endif
+
+// Copy ECS data for a table into its instance slots
+static
+void sokol_gather_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    ecs_iter_t *qit,
+    int32_t offset)
+{
+    EcsTransform3 *transforms = ecs_field(qit, EcsTransform3, 0);
+    void *geometry_data = ecs_field_w_size(qit, qit->sizes[4], 4);
+    bool geometry_self = ecs_field_is_self(qit, 4);
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+
+    // Copy color & material data
+    sokol_gather_colors(buffers, qit, offset);
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    // Geometry-specific scaling is applied by the shader
+    void *scale = sokol_instance_ptr(buffers, &l->scale, offset);
+    geometry->scale(scale, l->stream_size[l->scale.stream], geometry_data, 
+        qit->count, geometry_self);
+
+    // Transforms of dynamic entities are uploaded from the table column
+    if (sokol_instance_stream_staged(buffers, l->transform.stream)) {
+        void *t = sokol_instance_ptr(buffers, &l->transform, offset);
+        ecs_os_memcpy_n(t, transforms, EcsTransform3, qit->count);
+    }
+#else
+    void *t = sokol_instance_ptr(buffers, &l->transform, offset);
+
+    // Copy transform data & apply geometry-specific scaling
+    geometry->populate(t, l->stream_size[l->transform.stream], 
+        (const mat4*)transforms, geometry_data, qit->count, geometry_self);
+#endif
+
+#if SOKOL_CULL_INSTANCES
+    geometry->bounds(ecs_vec_get_t(&buffers->bounds, vec4, offset), 
+        (const mat4*)transforms, geometry_data, qit->count, geometry_self);
+#endif
+}
+
+static
+int sokol_compare_instance_range(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const sokol_instance_range_t *r1 = ptr1;
+    const sokol_instance_range_t *r2 = ptr2;
+    return (r1->offset > r2->offset) - (r1->offset < r2->offset);
+}
+
+// Immutable buffers can't be updated, so recreate them when data changed. The
+// buffers are created with the number of instances in use, as there is no 
+// point in reserving space for new instances.
+static
+void sokol_upload_immutable_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, count = buffers->instance_count;
+    if (!ecs_vec_count(&buffers->dirty_ranges) && 
+        (buffers->buffer_size == count)) 
+    {
+        return;
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        sokol_instance_stream_t *stream = &buffers->streams[s];
+        ecs_size_t elem_size = l->stream_size[s];
+        if (stream->buffer.id) {
+            sg_destroy_buffer(stream->buffer);
+            stream->buffer.id = 0;
+        }
+        if (!count) {
+            continue;
+        }
+
+        stream->buffer = sg_make_buffer(&(sg_buffer_desc){
+            .size = count * elem_size,
+            .data = { ecs_vec_first(&stream->data), count * elem_size },
+            .usage = SG_USAGE_IMMUTABLE });
+    }
+
+    buffers->buffer_size = count;
+    geometry->stats.ranges_uploaded ++;
+    geometry->stats.instances_uploaded += count;
+    ecs_vec_clear(&buffers->dirty_ranges);
+}
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+// Upload transforms of modified tables directly from the EcsTransform3 table
+// columns. When all is true, the transforms of all tables are uploaded.
+static
+void sokol_upload_transform_columns(
+    const ecs_world_t *world,
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    bool all)
+{
+    int32_t stream = sokol_instance_layout.transform.stream;
+    if ((!all && !buffers->gather_count) || 
+        sokol_instance_stream_staged(buffers, stream)) 
+    {
+        return;
+    }
+
+    sg_buffer buffer = buffers->streams[stream].buffer;
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->count || (!all && !ti->gather)) {
+            continue;
+        }
+
+        // Skip tables that changed after slots were reserved, same as when
+        // gathering data.
+        ecs_table_t *table = (ecs_table_t*)(uintptr_t)ecs_map_key(&mit);
+        if (ecs_table_count(table) != ti->count) {
+            continue;
+        }
+
+        const EcsTransform3 *transforms = ecs_table_get_id(
+            world, table, ecs_id(EcsTransform3), 0);
+        sg_update_buffer_range(buffer, 
+            ti->offset * ECS_SIZEOF(EcsTransform3), &(sg_range) {
+                transforms, ti->count * sizeof(EcsTransform3) } );
+        geometry->stats.ranges_uploaded ++;
+    }
+}
+#endif
+
+// Upload modified instance data to GPU buffers
+#if SOKOL_CLUSTER_INSTANCES
+// Add table to the cluster of its query group. Tables are iterated in group
+// order, and tables without a SokolCluster pair (group 0) get their own cluster.
+// Tables of a group that are excluded from different passes are stored in
+// separate clusters.
+static
+void sokol_cluster_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    const sokol_table_instances_t *ti)
+{
+    uint64_t group = ti->group;
+    sokol_instance_cluster_t *cluster = ecs_vec_last_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    if (group && cluster && (cluster->group == group) && 
+        (cluster->exclude == ti->exclude)) 
+    {
+        cluster->count = ti->offset + ti->count - cluster->offset;
+        cluster->dirty |= ti->bounds_dirty;
+        return;
+    }
+
+    cluster = ecs_vec_append_t(a, &buffers->clusters, sokol_instance_cluster_t);
+    cluster->group = group;
+    cluster->exclude = ti->exclude;
+    cluster->offset = ti->offset;
+    cluster->count = ti->count;
+    cluster->dirty = ti->bounds_dirty;
+}
+
+static
+int sokol_compare_cluster(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const sokol_instance_cluster_t *c1 = ptr1;
+    const sokol_instance_cluster_t *c2 = ptr2;
+    return (c1->offset > c2->offset) - (c1->offset < c2->offset);
+}
+
+// Rebuild clusters from the tables of the buffers, which are in group order.
+// Clusters are sorted by slot so that adjacent visible clusters can be drawn
+// together. Clusters with tables that weren't gathered keep their bounds.
+static
+void sokol_build_clusters(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t **tables,
+    int32_t table_count)
+{
+    ecs_vec_t old = buffers->clusters, old_bounds = buffers->cluster_bounds;
+    ecs_vec_init_t(a, &buffers->clusters, sokol_instance_cluster_t, 0);
+    ecs_vec_init_t(a, &buffers->cluster_bounds, vec4, 0);
+
+    int32_t i;
+    for (i = 0; i < table_count; i ++) {
+        if (tables[i]->count) {
+            sokol_cluster_instances(a, buffers, tables[i]);
+        }
+    }
+
+    sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    int32_t count = ecs_vec_count(&buffers->clusters);
+    if (count) {
+        qsort(clusters, (size_t)count, sizeof(sokol_instance_cluster_t),
+            sokol_compare_cluster);
+    }
+
+    ecs_vec_set_count_t(a, &buffers->cluster_bounds, vec4, count);
+    vec4 *bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    const sokol_instance_cluster_t *old_clusters = ecs_vec_first_t(
+        &old, sokol_instance_cluster_t);
+    int32_t old_count = ecs_vec_count(&old);
+    for (i = 0; i < count; i ++) {
+        sokol_instance_cluster_t *c = &clusters[i];
+        if (c->dirty) {
+            continue;
+        }
+
+        const sokol_instance_cluster_t *o = old_count ? bsearch(c, old_clusters,
+            (size_t)old_count, sizeof(sokol_instance_cluster_t), 
+                sokol_compare_cluster) : NULL;
+        if (o && (o->count == c->count) && (o->exclude == c->exclude)) {
+            glm_vec4_copy(*ecs_vec_get_t(&old_bounds, vec4, o - old_clusters),
+                bounds[i]);
+        } else {
+            c->dirty = true;
+        }
+    }
+
+    ecs_vec_fini_t(a, &old, sokol_instance_cluster_t);
+    ecs_vec_fini_t(a, &old_bounds, vec4);
+}
+
+// Compute bounds of clusters after they were gathered
+static
+void sokol_update_cluster_bounds(
+    sokol_geometry_buffers_t *buffers)
+{
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+    sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+        &buffers->clusters, sokol_instance_cluster_t);
+    vec4 *cluster_bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    int32_t i, count = ecs_vec_count(&buffers->clusters);
+
+    for (i = 0; i < count; i ++) {
+        if (clusters[i].dirty) {
+            sokol_merge_bounds(cluster_bounds[i], 
+                &bounds[clusters[i].offset], clusters[i].count);
+            clusters[i].dirty = false;
+        }
+    }
+}
+#endif
+
+#if SOKOL_CULL_INSTANCES
+// Update bounds of tables that were gathered. This runs on the main thread
+// after gathering, so that culling only has to test bounds.
+static
+void sokol_update_bounds(
+    sokol_geometry_buffers_t *buffers)
+{
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->bounds_dirty) {
+            continue;
+        }
+
+        // Table changed after it was gathered, wait for next populate
+        ecs_table_t *table = (ecs_table_t*)(uintptr_t)ecs_map_key(&mit);
+        if (ecs_table_count(table) != ti->count) {
+            continue;
+        }
+
+#if SOKOL_SPATIAL_INDEX
+        const ecs_entity_t *entities = ecs_table_entities(table);
+        int32_t i;
+        for (i = 0; i < ti->count; i ++) {
+            sokol_spatial_set(&buffers->index, ti->offset + i, entities[i],
+                bounds[ti->offset + i]);
+        }
+#else
+        sokol_merge_bounds(ti->bounds, &bounds[ti->offset], ti->count);
+#endif
+        ti->bounds_dirty = false;
+    }
+}
+#endif
+
+// Upload modified ranges to dynamic sokol buffers, which have the same capacity
+// as the CPU buffers.
+static
+void sokol_upload_dynamic_instances(
+    const ecs_world_t *world,
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, size = buffers->capacity;
+
+    // If buffers were resized, create new buffers & upload everything
+    if (buffers->buffer_size != size) {
+        int32_t count = buffers->instance_count;
+        for (s = 0; s < l->stream_count; s ++) {
+            sokol_instance_stream_t *stream = &buffers->streams[s];
+            ecs_size_t elem_size = l->stream_size[s];
+            if (stream->buffer.id) {
+                sg_destroy_buffer(stream->buffer);
+                stream->buffer.id = 0;
+            }
+            if (!size) {
+                continue;
+            }
+
+            stream->buffer = sg_make_buffer(&(sg_buffer_desc){
+                .size = size * elem_size, .usage = SG_USAGE_DYNAMIC });
+            // sg_update_buffer doesn't accept empty data, which happens when
+            // the buffers of a geometry without instances are shrunk.
+            if (count && sokol_instance_stream_staged(buffers, s)) {
+                sg_update_buffer(stream->buffer, &(sg_range) {
+                    ecs_vec_first(&stream->data), count * elem_size } );
+            }
+        }
+        buffers->buffer_size = size;
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        sokol_upload_transform_columns(world, geometry, buffers, true);
+#endif
+
+        geometry->stats.ranges_uploaded ++;
+        geometry->stats.instances_uploaded += count;
+        ecs_vec_clear(&buffers->dirty_ranges);
+        return;
+    }
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    sokol_upload_transform_columns(world, geometry, buffers, false);
+#else
+    (void)world;
+#endif
+
+    int32_t i, dirty_count = ecs_vec_count(&buffers->dirty_ranges);
+    if (!dirty_count) {
+        return;
+    }
+
+    sokol_instance_range_t *ranges = ecs_vec_first_t(
+        &buffers->dirty_ranges, sokol_instance_range_t);
+    qsort(ranges, dirty_count, sizeof(sokol_instance_range_t), 
+        sokol_compare_instance_range);
+
+    for (i = 0; i < dirty_count; ) {
+        int32_t offset = ranges[i].offset;
+        int32_t end = offset + ranges[i].count;
+
+        // Merge ranges that overlap or are close together, as uploading a 
+        // few unmodified slots is cheaper than an extra buffer update.
+        for (i ++; i < dirty_count; i ++) {
+            if (ranges[i].offset > (end + SOKOL_INSTANCE_RANGE_MERGE_GAP)) {
+                break;
+            }
+            int32_t range_end = ranges[i].offset + ranges[i].count;
+            if (range_end > end) {
+                end = range_end;
+            }
+        }
+
+        // Ranges past the end of the buffer are no longer drawn
+        if (end > buffers->instance_count) {
+            end = buffers->instance_count;
+        }
+        if (end <= offset) {
+            continue;
+        }
+
+        int32_t count = end - offset;
+        for (s = 0; s < l->stream_count; s ++) {
+            if (!sokol_instance_stream_staged(buffers, s)) {
+                continue;
+            }
+            sokol_instance_stream_t *stream = &buffers->streams[s];
+            ecs_size_t elem_size = l->stream_size[s];
+            sg_update_buffer_range(stream->buffer, offset * elem_size, 
+                &(sg_range) { 
+                    ecs_vec_get(&stream->data, elem_size, offset), 
+                    count * elem_size } );
+        }
+
+        geometry->stats.ranges_uploaded ++;
+        geometry->stats.instances_uploaded += count;
+    }
+
+    ecs_vec_clear(&buffers->dirty_ranges);
+}
+
+static
+void sokol_upload_instances(
+    const ecs_world_t *world,
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers)
+{
+#if SOKOL_CULL_INSTANCES
+    sokol_update_bounds(buffers);
+
+#if SOKOL_CLUSTER_INSTANCES
+    // Clusters are drawn directly from the instance buffers. These are dynamic
+    // so that only the ranges of groups that changed have to be uploaded.
+    if (sokol_instance_clustered(buffers)) {
+        sokol_update_cluster_bounds(buffers);
+        sokol_upload_dynamic_instances(world, geometry, buffers);
+        return;
+    }
+#endif
+
+    // Only visible instances are uploaded, which happens after culling
+    ecs_vec_clear(&buffers->dirty_ranges);
+    return;
+#endif
+
+    if (buffers->usage == SG_USAGE_IMMUTABLE) {
+        sokol_upload_immutable_instances(geometry, buffers);
+        return;
+    }
+
+    // Data is appended to the instance ring, so all of it is uploaded
+    if (buffers->usage == SG_USAGE_STREAM) {
+        ecs_vec_clear(&buffers->dirty_ranges);
+        return;
+    }
+
+    sokol_upload_dynamic_instances(world, geometry, buffers);
+}
+
+// Passes that the entities of a table are excluded from
+static
+ecs_flags32_t sokol_table_exclude(
+    const ecs_world_t *world,
+    const ecs_table_t *table)
+{
+    ecs_flags32_t result = 0;
+    if (ecs_table_has_id(world, table, SokolNoShadow)) {
+        result |= 1u << SOKOL_PASS_SHADOW;
+    }
+    if (ecs_table_has_id(world, table, SokolNoDepthPrepass)) {
+        result |= 1u << SOKOL_PASS_DEPTH;
+    }
+    return result;
+}
+
+#if !SOKOL_CULL_INSTANCES
+// Collect the slot ranges of tables that are excluded from a pass. Adjacent
+// ranges are merged, so that a pass draws as few ranges as possible.
+static
+void sokol_exclude_instances(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers)
+{
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        ecs_vec_t *excluded = &buffers->excluded[p];
+        ecs_vec_clear(excluded);
+
+        ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+        while (ecs_map_next(&mit)) {
+            sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+            if ((ti->exclude & (1u << p)) && ti->count) {
+                sokol_instance_range_t *r = ecs_vec_append_t(
+                    a, excluded, sokol_instance_range_t);
+                r->offset = ti->offset;
+                r->count = ti->count;
+            }
+        }
+
+        int32_t i, count = ecs_vec_count(excluded);
+        if (!count) {
+            continue;
+        }
+
+        sokol_instance_range_t *ranges = ecs_vec_first_t(
+            excluded, sokol_instance_range_t);
+        qsort(ranges, count, sizeof(sokol_instance_range_t), 
+            sokol_compare_instance_range);
+
+        int32_t merged = 0;
+        for (i = 1; i < count; i ++) {
+            sokol_instance_range_t *last = &ranges[merged];
+            if (ranges[i].offset == (last->offset + last->count)) {
+                last->count += ranges[i].count;
+            } else {
+                ranges[++ merged] = ranges[i];
+            }
+        }
+        ecs_vec_set_count_t(a, excluded, sokol_instance_range_t, merged + 1);
+    }
+}
+#endif
+
+#if SOKOL_CULL_INSTANCES && SOKOL_ZERO_COPY_TRANSFORMS
+static
+int sokol_compare_table_slots(
+    const void *ptr1,
+    const void *ptr2)
+{
+    const sokol_table_slots_t *t1 = ptr1;
+    const sokol_table_slots_t *t2 = ptr2;
+    return (t1->offset > t2->offset) - (t1->offset < t2->offset);
+}
+
+// Collect the slot ranges of tables in slot order, so that views can find the
+// table column that the transform of a visible slot is stored in.
+static
+void sokol_index_table_slots(
+    const ecs_world_t *world,
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers)
+{
+    ecs_vec_clear(&buffers->table_slots);
+    if (sokol_instance_stream_staged(
+        buffers, sokol_instance_layout.transform.stream)) 
+    {
+        return;
+    }
+
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->count) {
+            continue;
+        }
+
+        ecs_table_t *table = (ecs_table_t*)(uintptr_t)ecs_map_key(&mit);
+        sokol_table_slots_t *ts = ecs_vec_append_t(
+            a, &buffers->table_slots, sokol_table_slots_t);
+        ts->offset = ti->offset;
+        ts->count = ti->count;
+        ts->table = table;
+        ts->column = ecs_table_get_column_index(
+            world, table, ecs_id(EcsTransform3));
+    }
+
+    int32_t count = ecs_vec_count(&buffers->table_slots);
+    if (count) {
+        qsort(ecs_vec_first(&buffers->table_slots), (size_t)count, 
+            sizeof(sokol_table_slots_t), sokol_compare_table_slots);
+    }
+}
+
+// Get transform of an instance slot from its table column, and the number of
+// slots from slot to the end of the table in run. Returns NULL if the slot is
+// not in use, or if the table changed after its slots were reserved.
+static
+const EcsTransform3* sokol_column_transform(
+    const sokol_geometry_buffers_t *buffers,
+    int32_t slot,
+    int32_t *run)
+{
+    const sokol_table_slots_t *ts = ecs_vec_first_t(
+        &buffers->table_slots, sokol_table_slots_t);
+    int32_t lo = 0, hi = ecs_vec_count(&buffers->table_slots);
+    while (lo < hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (ts[mid].offset > slot) {
+            hi = mid;
+        } else if ((ts[mid].offset + ts[mid].count) <= slot) {
+            lo = mid + 1;
+        } else {
+            ts = &ts[mid];
+            if (ecs_table_count(ts->table) != ts->count) {
+                return NULL;
+            }
+            if (run) {
+                *run = ts->offset + ts->count - slot;
+            }
+            const EcsTransform3 *column = ecs_table_get_column(
+                ts->table, ts->column, 0);
+            return &column[slot - ts->offset];
+        }
+    }
+    return NULL;
+}
+#endif
+
+// Set number of instances & passes that a table is excluded from, and keep
+// the number of excluded instances per pass in sync.
+static
+void sokol_set_table_instances(
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t *ti,
+    int32_t count,
+    ecs_flags32_t exclude)
+{
+    int32_t p;
+    for (p = 0; p < SOKOL_MAX_PASSES; p ++) {
+        if (ti->exclude & (1u << p)) {
+            buffers->exclude_count[p] -= ti->count;
+        }
+        if (exclude & (1u << p)) {
+            buffers->exclude_count[p] += count;
+        }
+    }
+    ti->count = count;
+    ti->exclude = exclude;
+}
+
+// Mark table data to be copied to its slots by SokolGatherGeometry
+static
+void sokol_gather_table(
+    ecs_allocator_t *a,
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t *ti)
+{
+    ti->gather = true;
+    sokol_dirty_instances(a, buffers, ti->offset, ti->count);
+    buffers->gather_count ++;
+#if SOKOL_CULL_INSTANCES
+    ti->bounds_dirty = true;
+    ecs_os_memset_n(ecs_vec_get_t(&buffers->exclude, uint8_t, ti->offset), 
+        (uint8_t)ti->exclude, uint8_t, ti->count);
+#endif
+}
+
+#if SOKOL_CLUSTER_INSTANCES
+// Store tables of a group consecutively in the range of the group, in query 
+// order. The range only moves when the tables no longer fit.
+static
+void sokol_layout_cluster_group(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_cluster_group_t *group,
+    sokol_table_instances_t **tables,
+    int32_t table_count)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    int32_t i, count = 0;
+    for (i = 0; i < table_count; i ++) {
+        count += tables[i]->count;
+    }
+
+    if (count > group->capacity) {
+        sokol_release_instances(a, buffers, group->offset, group->capacity);
+        group->capacity = sokol_instance_capacity(count);
+        group->offset = sokol_alloc_instances(geometry, buffers, group->capacity);
+    } else if (count < group->count) {
+        // Clear slots of entities that are no longer in the group
+        sokol_clear_instances(buffers, group->offset + count, 
+            group->count - count);
+        sokol_dirty_instances(a, buffers, group->offset + count, 
+            group->count - count);
+    }
+
+    int32_t offset = group->offset;
+    for (i = 0; i < table_count; i ++) {
+        sokol_table_instances_t *ti = tables[i];
+        ti->offset = offset;
+        ti->capacity = ti->count;
+        offset += ti->count;
+        sokol_gather_table(a, buffers, ti);
+    }
+
+    group->count = count;
+    group->dirty = false;
+}
+
+// Lay out groups with tables that changed & rebuild clusters. Tables are in 
+// query order, which stores the tables of a group next to each other.
+static
+void sokol_layout_clusters(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_table_instances_t **tables,
+    int32_t table_count)
+{
+    int32_t i, last;
+    for (i = 0; i < table_count; i = last) {
+        uint64_t group = tables[i]->group;
+        for (last = i + 1; last < table_count; last ++) {
+            if (tables[last]->group != group) {
+                break;
+            }
+        }
+
+        sokol_cluster_group_t *g = group ? ecs_map_get_deref(
+            &buffers->groups, sokol_cluster_group_t, group) : NULL;
+        if (g && g->dirty) {
+            sokol_layout_cluster_group(
+                geometry, buffers, g, &tables[i], last - i);
+        }
+    }
+
+    sokol_build_clusters(geometry->allocator, buffers, tables, table_count);
+}
+#endif
+
+static
+void sokol_populate_buffers(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    ecs_query_t *query)
+{
+    const ecs_world_t *world = ecs_get_world(query);
+    ecs_allocator_t *a = geometry->allocator;
+
+    sokol_update_capacity(geometry, buffers);
+
+    // If none of the tables matched by the query changed since the last time
+    // the buffers were populated, the GPU buffers still contain valid data.
+    buffers->gather_count = 0;
+    if (!ecs_query_changed(query)) {
+        geometry->stats.uploads_skipped ++;
+        return;
+    }
+
+    buffers->frame ++;
+
+    sokol_compact_instances(geometry, buffers);
+
+#if SOKOL_CLUSTER_INSTANCES
+    // Tables of clustered buffers in query order (vec<sokol_table_instances_t*>)
+    bool clustered = sokol_instance_clustered(buffers);
+    ecs_vec_t clustered_tables;
+    ecs_vec_init_t(a, &clustered_tables, sokol_table_instances_t*, 0);
+#endif
+
+    ecs_iter_t qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        sokol_table_instances_t *ti = ecs_map_ensure_alloc_t(&buffers->tables, 
+            sokol_table_instances_t, (ecs_map_key_t)(uintptr_t)qit.table);
+        ecs_flags32_t exclude = sokol_table_exclude(world, qit.table);
+        int32_t count = qit.count;
+        bool moved = false;
+
+        ti->frame = buffers->frame;
+
+#if SOKOL_CLUSTER_INSTANCES
+        if (clustered) {
+            *ecs_vec_append_t(a, &clustered_tables, sokol_table_instances_t*) =
+                ti;
+
+            // Table moved between a group range and a range of its own
+            uint64_t group = qit.group_id;
+            if (group != ti->group) {
+                if (ti->group) {
+                    ecs_map_ensure_alloc_t(&buffers->groups, 
+                        sokol_cluster_group_t, ti->group)->dirty = true;
+                } else {
+                    sokol_release_instances(
+                        a, buffers, ti->offset, ti->capacity);
+                }
+                ti->offset = 0;
+                ti->capacity = 0;
+                ti->group = group;
+                sokol_set_table_instances(buffers, ti, 0, ti->exclude);
+            }
+
+            // Slots of grouped tables are reserved after all tables are 
+            // iterated, for the groups that changed.
+            if (group) {
+                sokol_cluster_group_t *g = ecs_map_ensure_alloc_t(
+                    &buffers->groups, sokol_cluster_group_t, group);
+                g->frame = buffers->frame;
+                if ((ti->count != count) || (ti->exclude != exclude) || 
+                    ecs_iter_changed(&qit)) 
+                {
+                    g->dirty = true;
+                }
+                sokol_set_table_instances(buffers, ti, count, exclude);
+                ti->gather = false;
+                continue;
+            }
+        }
+#endif
+
+        if (count > ti->capacity) {
+            // Table no longer fits in its range, move it to a new range
+            sokol_release_instances(a, buffers, ti->offset, ti->capacity);
+            ti->capacity = sokol_instance_capacity(count);
+            ti->offset = sokol_alloc_instances(geometry, buffers, ti->capacity);
+            moved = true;
+        } else if (count < ti->count) {
+            // Clear slots of entities that are no longer in the table
+            sokol_clear_instances(buffers, ti->offset + count, ti->count - count);
+            sokol_dirty_instances(a, buffers, ti->offset + count, ti->count - count);
+#if SOKOL_CULL_INSTANCES
+            ti->bounds_dirty = true;
+#endif
+        }
+
+        sokol_set_table_instances(buffers, ti, count, exclude);
+
+        // Only copy data for tables that were moved or modified. Data is
+        // copied by the SokolGatherGeometry system, which can run on
+        // multiple threads as each table writes to its own range.
+        if (moved || ecs_iter_changed(&qit)) {
+            sokol_gather_table(a, buffers, ti);
+        } else {
+            ti->gather = false;
+        }
+    }
+
+    // Release ranges of tables that are no longer matched
+    {
+        ecs_vec_t unmatched;
+        ecs_vec_init_t(a, &unmatched, ecs_map_key_t, 0);
+
+        ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+        while (ecs_map_next(&mit)) {
+            sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+            if (ti->frame == buffers->frame) {
+                continue;
+            }
+
+            sokol_set_table_instances(buffers, ti, 0, 0);
+#if SOKOL_CLUSTER_INSTANCES
+            // Slots of grouped tables are owned by the group
+            if (ti->group) {
+                sokol_cluster_group_t *g = ecs_map_get_deref(
+                    &buffers->groups, sokol_cluster_group_t, ti->group);
+                if (g) {
+                    g->dirty = true;
+                }
+            } else
+#endif
+            {
+                sokol_release_instances(a, buffers, ti->offset, ti->capacity);
+            }
+            *ecs_vec_append_t(a, &unmatched, ecs_map_key_t) = 
+                ecs_map_key(&mit);
+        }
+
+#if SOKOL_CLUSTER_INSTANCES
+        ecs_vec_t unmatched_groups;
+        ecs_vec_init_t(a, &unmatched_groups, ecs_map_key_t, 0);
+
+        mit = ecs_map_iter(&buffers->groups);
+        while (ecs_map_next(&mit)) {
+            sokol_cluster_group_t *g = ecs_map_ptr(&mit);
+            if (g->frame != buffers->frame) {
+                sokol_release_instances(a, buffers, g->offset, g->capacity);
+                *ecs_vec_append_t(a, &unmatched_groups, ecs_map_key_t) = 
+                    ecs_map_key(&mit);
+            }
+        }
+
+        int32_t g, group_count = ecs_vec_count(&unmatched_groups);
+        ecs_map_key_t *group_keys = ecs_vec_first_t(
+            &unmatched_groups, ecs_map_key_t);
+        for (g = 0; g < group_count; g ++) {
+            ecs_map_remove_free(&buffers->groups, group_keys[g]);
+        }
+
+        ecs_vec_fini_t(a, &unmatched_groups, ecs_map_key_t);
+#endif
+
+        int32_t i, count = ecs_vec_count(&unmatched);
+        ecs_map_key_t *keys = ecs_vec_first_t(&unmatched, ecs_map_key_t);
+        for (i = 0; i < count; i ++) {
+            ecs_map_remove_free(&buffers->tables, keys[i]);
+        }
+
+        ecs_vec_fini_t(a, &unmatched, ecs_map_key_t);
+    }
+
+#if SOKOL_CLUSTER_INSTANCES
+    if (clustered) {
+        sokol_layout_clusters(geometry, buffers, 
+            ecs_vec_first_t(&clustered_tables, sokol_table_instances_t*),
+            ecs_vec_count(&clustered_tables));
+    }
+    ecs_vec_fini_t(a, &clustered_tables, sokol_table_instances_t*);
+#endif
+
+#if !SOKOL_CULL_INSTANCES
+    sokol_exclude_instances(a, buffers);
+#elif SOKOL_ZERO_COPY_TRANSFORMS
+    sokol_index_table_slots(world, a, buffers);
+#endif
+
+    geometry->stats.uploads_performed ++;
+}
+
+// Copy data of modified tables to instance slots. Each worker gets a slice of
+// every table, and writes to the slots reserved for that slice.
+static
+void sokol_gather_buffers(
+    SokolGeometry *geometry,
+    ecs_world_t *stage,
+    ecs_query_t *query,
+    int32_t stage_id,
+    int32_t stage_count)
+{
+    if (!geometry->solid.gather_count && !geometry->statics.gather_count) {
+        return;
+    }
+
+    // The gather query matches tables of both static and dynamic entities. A
+    // table is stored in the buffers of the query that reserved its slots.
+    ecs_iter_t qit = ecs_query_iter(stage, query);
+    ecs_iter_t wit = ecs_worker_iter(&qit, stage_id, stage_count);
+    while (ecs_worker_next(&wit)) {
+        ecs_map_key_t key = (ecs_map_key_t)(uintptr_t)wit.table;
+        sokol_geometry_buffers_t *buffers = &geometry->solid;
+        sokol_table_instances_t *ti = ecs_map_get_deref(&buffers->tables, 
+            sokol_table_instances_t, key);
+        if (!ti) {
+            buffers = &geometry->statics;
+            ti = ecs_map_get_deref(&buffers->tables, 
+                sokol_table_instances_t, key);
+        }
+        if (!ti || !ti->gather) {
+            continue;
+        }
+
+        // Skip tables that changed after slots were reserved. The change is
+        // picked up the next time buffers are populated.
+        if (ecs_table_count(wit.table) != ti->count) {
+            continue;
+        }
+
+        sokol_gather_instances(geometry, buffers, &wit, ti->offset + wit.offset);
+    }
+}
+
+// System that matches all geometry kinds & reserves instance slots for the
+// tables that have to be copied to GPU buffers.
+static
+void SokolPopulateGeometry(
+    ecs_iter_t *it) 
+{
+    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
+    SokolGeometryQuery *q = ecs_field(it, SokolGeometryQuery, 1);
+
+    int i;
+    for (i = 0; i < it->count; i ++) {
+        ecs_os_zeromem(&g[i].stats);
+        sokol_populate_buffers(&g[i], &g[i].solid, q[i].solid);
+        sokol_populate_buffers(&g[i], &g[i].statics, q[i].statics);
+    }
+}
+
+// System that copies ECS data to instance buffers. Runs on all worker threads,
+// every worker iterates all geometry kinds.
+static
+void SokolGatherGeometry(
+    ecs_iter_t *it) 
+{
+    ecs_world_t *stage = it->world;
+    ecs_query_t *query = it->query;
+    int32_t stage_id = ecs_stage_get_id(stage);
+    int32_t stage_count = ecs_get_stage_count(stage);
+
+    // Work is not divided by geometry entity, so don't use system iterator
+    ecs_iter_fini(it);
+
+    ecs_iter_t qit = ecs_query_iter(stage, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        SokolGeometryQuery *q = ecs_field(&qit, SokolGeometryQuery, 1);
+
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_gather_buffers(&g[i], stage, q[i].gather, 
+                stage_id, stage_count);
+        }
+    }
+}
+
+// System that uploads modified instance data to GPU buffers
+static
+void SokolUploadGeometry(
+    ecs_iter_t *it) 
+{
+    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
+
+    int i;
+    for (i = 0; i < it->count; i ++) {
+        sokol_upload_instances(it->world, &g[i], &g[i].solid);
+        sokol_upload_instances(it->world, &g[i], &g[i].statics);
+        ecs_dbg_3("sokol: geometry %s: %d uploads, %d skipped, "
+            "%d ranges (%d instances) uploaded, %d reallocations", 
+            ecs_get_name(it->world, it->entities[i]),
+            g[i].stats.uploads_performed, g[i].stats.uploads_skipped,
+            g[i].stats.ranges_uploaded, g[i].stats.instances_uploaded,
+            g[i].stats.reallocations);
+    }
+}
+
+#if SOKOL_INSTANCE_RING
+// Number of bytes that buffers append to the instance ring. With culling, the
+// visible instances of each view are appended, which are at most all instances
+// of the buffers per view. Space is reserved for at least the capacity hint.
+static
+int32_t sokol_instance_ring_size(
+    const sokol_geometry_buffers_t *buffers)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, size = 0, views = 1;
+    int32_t count = glm_imax(buffers->instance_count, buffers->capacity_hint);
+#if SOKOL_CULL_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        return 0;
+    }
+    views = SOKOL_MAX_VIEWS;
+#endif
+    for (s = 0; s < l->stream_count; s ++) {
+        // Sokol aligns appended data to 4 bytes
+        size += views * ((count * l->stream_size[s] + 3) & ~3);
+    }
+    return size;
+}
+
+#if !SOKOL_CULL_INSTANCES
+// Append instance data to the instance ring, and store the offsets that are
+// used when binding the streams.
+static
+void sokol_append_instances(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sg_buffer ring)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    int32_t s, count = buffers->instance_count;
+    if (!count) {
+        return;
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        sokol_instance_stream_t *stream = &buffers->streams[s];
+        stream->buffer = ring;
+        stream->offset = sg_append_buffer(ring, &(sg_range) {
+            ecs_vec_first(&stream->data), count * l->stream_size[s] });
+    }
+
+    geometry->stats.ranges_uploaded ++;
+    geometry->stats.instances_uploaded += count;
+}
+#endif
+
+// System that appends the instance data of all geometry kinds to the instance
+// ring. The ring is grown before appending when it's too small for the data
+// of this frame, as the data of a frame must be in the same buffer. With 
+// culling, the ring is only grown here, and the visible instances of both
+// static and dynamic entities are appended when views are uploaded.
+static
+void SokolAppendInstanceRing(
+    ecs_iter_t *it)
+{
+    SokolInstanceRing *ring = ecs_field(it, SokolInstanceRing, 0);
+
+    int32_t size = 0;
+    ecs_iter_t git = ecs_each(it->world, SokolGeometry);
+    while (ecs_each_next(&git)) {
+        SokolGeometry *g = ecs_field(&git, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < git.count; i ++) {
+            size += sokol_instance_ring_size(&g[i].solid);
+#if SOKOL_CULL_INSTANCES
+            size += sokol_instance_ring_size(&g[i].statics);
+#endif
+        }
+    }
+
+    if (size > ring->size) {
+        if (ring->buffer.id) {
+            sg_destroy_buffer(ring->buffer);
+        }
+
+        ecs_dbg_2("sokol: resized instance ring from %d to %d bytes", 
+            ring->size, size + (size >> 1));
+        ring->size = size + (size >> 1);
+        ring->buffer = sg_make_buffer(&(sg_buffer_desc){
+            .size = ring->size, .usage = SG_USAGE_STREAM });
+    }
+
+#if !SOKOL_CULL_INSTANCES
+    if (!size) {
+        return;
+    }
+
+    git = ecs_each(it->world, SokolGeometry);
+    while (ecs_each_next(&git)) {
+        SokolGeometry *g = ecs_field(&git, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < git.count; i ++) {
+            sokol_append_instances(&g[i], &g[i].solid, ring->buffer);
+        }
+    }
+#endif
+}
+#endif
+
+#if SOKOL_CULL_INSTANCES
+// Remove visible instances or clusters with a bounding sphere that is outside
+// of one of the receiver planes.
+static
+void sokol_cull_receivers(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_instance_view_t *view,
+    const vec4 *receivers)
+{
+    int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+    int32_t i, p, count = 0;
+
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    }
+#endif
+
+    for (i = 0; i < view->count; i ++) {
+        const float *s = bounds[visible[i]];
+        for (p = 0; p < 6; p ++) {
+            const float *pl = receivers[p];
+            if ((pl[0] * s[0] + pl[1] * s[1] + pl[2] * s[2] + pl[3]) < -s[3]) {
+                break;
+            }
+        }
+        if (p == 6) {
+            visible[count ++] = visible[i];
+        }
+    }
+
+    geometry->stats.casters_culled += view->count - count;
+    view->count = count;
+}
+
+// Find instances that are visible in view
+static
+void sokol_cull_buffers(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_instance_view_t *view,
+    const vec4 *planes,
+    const vec4 *receivers)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    int32_t count = buffers->instance_count;
+
+#if SOKOL_CLUSTER_INSTANCES
+    // Clusters are tested as a whole, and don't need to be copied
+    if (sokol_instance_clustered(buffers)) {
+        int32_t cluster_count = ecs_vec_count(&buffers->cluster_bounds);
+        ecs_vec_set_count_t(a, &view->visible, int32_t, cluster_count);
+        view->count = 0;
+        if (cluster_count) {
+            view->count = sokol_cull_spheres(
+                ecs_vec_first_t(&view->visible, int32_t), 
+                ecs_vec_first_t(&buffers->cluster_bounds, vec4), 
+                cluster_count, planes);
+        }
+        geometry->stats.clusters_culled += cluster_count - view->count;
+        if (receivers) {
+            sokol_cull_receivers(geometry, buffers, view, receivers);
+        }
+        return;
+    }
+#endif
+
+    ecs_vec_set_count_t(a, &view->visible, int32_t, count);
+    int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    view->count = 0;
+
+#if SOKOL_SPATIAL_INDEX
+    // Only test instances in grid cells that intersect with the frustum
+    view->count = sokol_spatial_cull(&buffers->index, visible, planes, 
+        &geometry->stats.cells_culled);
+#else
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+
+    // Test table bounds first, so that instances of tables that are outside of
+    // the frustum don't have to be tested.
+    ecs_map_iter_t mit = ecs_map_iter(&buffers->tables);
+    while (ecs_map_next(&mit)) {
+        sokol_table_instances_t *ti = ecs_map_ptr(&mit);
+        if (!ti->count) {
+            continue;
+        }
+
+        // Bounds of tables that changed after gathering are not up to date
+        int32_t table_visible;
+        if (!ti->bounds_dirty && !sokol_cull_spheres(&table_visible, 
+            (const vec4*)&ti->bounds, 1, planes)) 
+        {
+            geometry->stats.tables_culled ++;
+            continue;
+        }
+
+        int32_t *table_slots = &visible[view->count];
+        int32_t i, table_count = sokol_cull_spheres(table_slots, 
+            &bounds[ti->offset], ti->count, planes);
+        for (i = 0; i < table_count; i ++) {
+            table_slots[i] += ti->offset;
+        }
+
+        view->count += table_count;
+    }
+#endif
+
+    geometry->stats.instances_culled += count - view->count;
+
+    if (receivers) {
+        sokol_cull_receivers(geometry, buffers, view, receivers);
+    }
+}
+
+#if SOKOL_LOD
+// Select level of detail from the projected diameter of a bounding sphere.
+// Returns -1 if the sphere is too small to be drawn.
+static
+int32_t sokol_select_lod(
+    const SokolGeometry *geometry,
+    const vec4 sphere,
+    const vec4 w_row,
+    float size_scale)
+{
+    float w = glm_vec3_dot((float*)w_row, (float*)sphere) + w_row[3];
+    if (w <= sphere[3]) {
+        return 0; // Camera is inside or close to the sphere
+    }
+
+    float size = sphere[3] * size_scale / w;
+    if (size < SOKOL_LOD_MIN_SIZE) {
+        return -1;
+    }
+
+    int32_t l;
+    for (l = 0; l < geometry->lod_count - 1; l ++) {
+        if (size >= geometry->lod_sizes[l]) {
+            break;
+        }
+    }
+    return l;
+}
+#endif
+
+// Sort visible instances by level of detail, and within a level store the
+// instances that are excluded from the depth pass last. Instances excluded 
+// from the shadow pass are removed from the shadow view. Clusters are only
+// sorted by level of detail, as exclusion is applied per cluster when drawn.
+// Instances in the camera view that are beyond the impostor distance are 
+// stored after the last level of detail.
+static
+void sokol_bin_view(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t view_index,
+    mat4 mat_vp,
+    float screen_height)
+{
+    ecs_allocator_t *a = geometry->allocator;
+    sokol_instance_view_t *view = &buffers->views[view_index];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    const uint8_t *exclude = ecs_vec_first_t(&buffers->exclude, uint8_t);
+    bool clustered = sokol_instance_clustered(buffers);
+    int32_t bins[SOKOL_MAX_VIEW_LODS * 2] = {0};
+    int32_t i, l, count = view->count;
+
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+#if SOKOL_CLUSTER_INSTANCES
+    if (clustered) {
+        bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
+    }
+#endif
+
+    // The distance from the camera is the w component in clip space
+    vec4 w_row = { mat_vp[0][3], mat_vp[1][3], mat_vp[2][3], mat_vp[3][3] };
+    float depth = FLT_MAX;
+
+#if SOKOL_LOD
+    // The projected diameter in pixels is radius * size_scale / w, where the
+    // length of the y row of the view projection matrix is the vertical scale
+    // of the projection.
+    vec3 y_row = { mat_vp[0][1], mat_vp[1][1], mat_vp[2][1] };
+    float size_scale = glm_vec3_norm(y_row) * screen_height;
+#else
+    (void)screen_height;
+#endif
+
+#if SOKOL_IMPOSTORS
+    // Clusters are drawn from the instance buffers, and shadows are cast by
+    // the instance geometry, so neither uses impostors.
+    float impostor_distance = 0;
+    if (!clustered && view_index == SOKOL_VIEW_CAMERA) {
+        impostor_distance = geometry->impostor_distance;
+    }
+#endif
+
+    ecs_vec_set_count_t(a, &view->bins, int8_t, count);
+    int8_t *elem_bins = ecs_vec_first_t(&view->bins, int8_t);
+
+    for (i = 0; i < count; i ++) {
+        int32_t elem = visible[i], bin = 0;
+
+#if SOKOL_LOD
+        bin = sokol_select_lod(geometry, bounds[elem], w_row, size_scale);
+        if (bin == -1) {
+            elem_bins[i] = -1;
+            geometry->stats.instances_small ++;
+            continue;
+        }
+#endif
+
+        float w = glm_vec3_dot((float*)w_row, (float*)bounds[elem]) + 
+            w_row[3];
+
+#if SOKOL_IMPOSTORS
+        if (impostor_distance > 0 && w > impostor_distance) {
+            bin = SOKOL_LOD_IMPOSTOR;
+            geometry->stats.impostors ++;
+        }
+#endif
+
+        bin *= 2;
+
+        if (!clustered) {
+            if (view_index == SOKOL_VIEW_SHADOW) {
+                if (exclude[elem] & (1u << SOKOL_PASS_SHADOW)) {
+                    elem_bins[i] = -1;
+                    continue;
+                }
+            } else if (exclude[elem] & (1u << SOKOL_PASS_DEPTH)) {
+                bin ++;
+            }
+        }
+
+        elem_bins[i] = (int8_t)bin;
+        bins[bin] ++;
+        depth = glm_min(depth, w - bounds[elem][3]);
+    }
+
+    // Convert bin counts to offsets, and store ranges per level of detail
+    int32_t offset = 0;
+    for (l = 0; l < SOKOL_MAX_VIEW_LODS; l ++) {
+        sokol_instance_lod_t *lod = &view->lods[l];
+        lod->offset = offset;
+        lod->depth_count = bins[l * 2];
+        lod->count = bins[l * 2] + bins[l * 2 + 1];
+        bins[l * 2] = offset;
+        bins[l * 2 + 1] = offset + lod->depth_count;
+        offset += lod->count;
+    }
+
+    ecs_vec_set_count_t(a, &view->sorted, int32_t, offset);
+    int32_t *sorted = ecs_vec_first_t(&view->sorted, int32_t);
+    for (i = 0; i < count; i ++) {
+        int32_t bin = elem_bins[i];
+        if (bin != -1) {
+            sorted[bins[bin] ++] = visible[i];
+        }
+    }
+
+    // Sorted elements become the visible elements
+    ecs_vec_t tmp = view->visible;
+    view->visible = view->sorted;
+    view->sorted = tmp;
+    view->count = offset;
+    view->depth = glm_max(depth, 0);
+}
+
+#if SOKOL_OCCLUSION_CULLING || SOKOL_IMPOSTORS
+// Get instance transform, including geometry scaling. Returns false if the
+// transform is read from a table that changed after it was populated.
+static
+bool sokol_instance_transform(
+    sokol_geometry_buffers_t *buffers,
+    int32_t slot,
+    mat4 dst)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    const float *src;
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    if (!sokol_instance_stream_staged(buffers, l->transform.stream)) {
+        src = (const float*)sokol_column_transform(buffers, slot, NULL);
+        if (!src) {
+            return false;
+        }
+    } else
+#endif
+    {
+        src = sokol_instance_ptr(buffers, &l->transform, slot);
+    }
+
+#if SOKOL_COMPACT_TRANSFORMS
+    int32_t r, c;
+    for (c = 0; c < 4; c ++) {
+        for (r = 0; r < 3; r ++) {
+            dst[c][r] = src[r * 4 + c];
+        }
+        dst[c][3] = c == 3 ? 1.0f : 0.0f;
+    }
+#else
+    glm_mat4_copy((vec4*)src, dst);
+#endif
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    // Geometry scaling is stored separately, and applied like the shader does
+    const float *scale = sokol_instance_ptr(buffers, &l->scale, slot);
+    glm_vec4_scale(dst[0], scale[0], dst[0]);
+    glm_vec4_scale(dst[1], scale[1], dst[1]);
+    glm_vec4_scale(dst[2], scale[2], dst[2]);
+#endif
+
+    return true;
+}
+#endif
+
+#if SOKOL_IMPOSTORS
+// Write transform in the instance layout
+static
+void sokol_write_transform(
+    float *dst,
+    mat4 src)
+{
+#if SOKOL_COMPACT_TRANSFORMS
+    int32_t r, c;
+    for (r = 0; r < 3; r ++) {
+        for (c = 0; c < 4; c ++) {
+            dst[r * 4 + c] = src[c][r];
+        }
+    }
+#else
+    ecs_os_memcpy(dst, src, sizeof(mat4));
+#endif
+}
+
+// Replace transforms of impostors in the view stream with transforms of quads
+// that face the camera. A quad covers the extents of its instance along the 
+// camera axes, and is moved to the front of the instance so that it isn't
+// hidden by instances it overlaps with. The normal of the quad points away
+// from the camera, so that it's lit like the instance face facing the camera.
+static
+void sokol_write_impostors(
+    sokol_geometry_buffers_t *buffers,
+    const sokol_instance_view_t *view,
+    void *dst,
+    mat4 mat_v)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    const sokol_instance_lod_t *range = &view->lods[SOKOL_LOD_IMPOSTOR];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    ecs_size_t size = l->stream_size[l->transform.stream];
+    vec3 eye, right, up;
+    int32_t i, k;
+
+    // Camera axes are the rows of the view matrix, and the camera position is
+    // the inverse rotation applied to the negated view translation.
+    for (k = 0; k < 3; k ++) {
+        right[k] = mat_v[k][0];
+        up[k] = mat_v[k][1];
+        eye[k] = -(mat_v[3][0] * mat_v[k][0] + mat_v[3][1] * mat_v[k][1] + 
+            mat_v[3][2] * mat_v[k][2]);
+    }
+
+    for (i = range->offset; i < range->offset + range->count; i ++) {
+        mat4 m, quad;
+        vec3 forward;
+        float ext[3];
+        if (!sokol_instance_transform(buffers, visible[i], m)) {
+            // Degenerate transform, which doesn't render anything
+            ecs_os_memset(ECS_OFFSET(ECS_ELEM(dst, size, i), 
+                l->transform.offset), 0, ECS_SIZEOF(sokol_transform_t));
+            continue;
+        }
+
+        glm_vec3_sub(m[3], eye, forward);
+        glm_vec3_normalize(forward);
+
+        // Half extents of the transformed unit geometry along camera axes
+        const float *axes[3] = { right, up, forward };
+        for (k = 0; k < 3; k ++) {
+            ext[k] = 0.5f * (fabsf(glm_vec3_dot(m[0], (float*)axes[k])) +
+                fabsf(glm_vec3_dot(m[1], (float*)axes[k])) + 
+                fabsf(glm_vec3_dot(m[2], (float*)axes[k])));
+        }
+
+        glm_vec3_scale(right, ext[0] * 2, quad[0]);
+        glm_vec3_scale(up, ext[1] * 2, quad[1]);
+        glm_vec3_copy(forward, quad[2]);
+        glm_vec3_scale(forward, -ext[2], quad[3]);
+        glm_vec3_add(quad[3], m[3], quad[3]);
+        quad[0][3] = quad[1][3] = quad[2][3] = 0;
+        quad[3][3] = 1;
+
+        sokol_write_transform(ECS_OFFSET(ECS_ELEM(dst, size, i), 
+            l->transform.offset), quad);
+    }
+}
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+// Impostor quads are written with their final size, so reset the geometry 
+// scaling of impostors in the view stream.
+static
+void sokol_write_impostor_scales(
+    const sokol_instance_view_t *view,
+    void *dst)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    const sokol_instance_lod_t *range = &view->lods[SOKOL_LOD_IMPOSTOR];
+    ecs_size_t size = l->stream_size[l->scale.stream];
+    int32_t i;
+
+    for (i = range->offset; i < range->offset + range->count; i ++) {
+        float *scale = ECS_OFFSET(ECS_ELEM(dst, size, i), l->scale.offset);
+        scale[0] = scale[1] = scale[2] = 1.0f;
+    }
+}
+#endif
+#endif
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+// Upload transforms of visible instances from the EcsTransform3 table columns.
+// Runs of visible instances that are stored consecutively in a table column 
+// are uploaded directly from the column, other transforms are copied to the 
+// view stream and uploaded in between runs. Impostors are always copied, as
+// their transforms are replaced with the transforms of camera facing quads.
 static
-void sokol_geometry_buffers_init(ecs_allocator_t *a, sokol_geometry_buffers_t *result) {
-    ecs_vec_init_t(a, &result->transforms_data, mat4, 0);
-    ecs_vec_init_t(a, &result->colors_data, ecs_rgb_t, 0);
-    ecs_vec_init_t(a, &result->materials_data, SokolMaterial, 0);
+void sokol_upload_view_columns(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    sokol_instance_view_t *view,
+    void *dst,
+    mat4 mat_v)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    sokol_instance_stream_t *stream = &view->streams[l->transform.stream];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    ecs_size_t size = l->stream_size[l->transform.stream];
+    int32_t i = 0, staged = 0, end = view->count;
+
+#if SOKOL_IMPOSTORS
+    if (mat_v && view->lods[SOKOL_LOD_IMPOSTOR].count) {
+        end = view->lods[SOKOL_LOD_IMPOSTOR].offset;
+    }
+#endif
+
+    while (i < view->count) {
+        int32_t slot = visible[i], run = 0, count = 1;
+        const EcsTransform3 *src = sokol_column_transform(buffers, slot, &run);
+        if (!src) {
+            ecs_os_memset(ECS_ELEM(dst, size, i), 0, size);
+            i ++;
+            continue;
+        }
+
+        while (count < run && (i + count) < view->count && 
+            visible[i + count] == (slot + count)) 
+        {
+            count ++;
+        }
+
+        if (count >= SOKOL_INSTANCE_COLUMN_RUN && (i + count) <= end) {
+            if (i > staged) {
+                sg_update_buffer_range(stream->buffer, staged * size, 
+                    &(sg_range) { ECS_ELEM(dst, size, staged), 
+                        (i - staged) * size });
+            }
+            sg_update_buffer_range(stream->buffer, i * size, 
+                &(sg_range) { src, count * size });
+            geometry->stats.ranges_uploaded ++;
+            staged = i + count;
+        } else {
+            ecs_os_memcpy(ECS_ELEM(dst, size, i), src, count * size);
+        }
+
+        i += count;
+    }
+
+#if SOKOL_IMPOSTORS
+    if (end != view->count) {
+        sokol_write_impostors(buffers, view, dst, mat_v);
+    }
+#else
+    (void)mat_v;
+#endif
+
+    if (view->count > staged) {
+        sg_update_buffer_range(stream->buffer, staged * size, &(sg_range) { 
+            ECS_ELEM(dst, size, staged), (view->count - staged) * size });
+    }
 }
+#endif
+
+// Copy visible instances to the view buffers and upload them to the GPU. The
+// view matrix is used to orient impostors, and may be NULL for views without
+// impostors. When the ring is set, visible instances are appended to the ring
+// instead of uploaded to buffers owned by the view.
+static
+void sokol_upload_view(
+    SokolGeometry *geometry,
+    sokol_geometry_buffers_t *buffers,
+    int32_t view_index,
+    mat4 mat_v,
+    sg_buffer ring)
+{
+    const sokol_instance_layout_t *l = &sokol_instance_layout;
+    ecs_allocator_t *a = geometry->allocator;
+    sokol_instance_view_t *view = &buffers->views[view_index];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    int32_t i, s;
+
+    // Clusters are drawn from the instance buffers
+    if (sokol_instance_clustered(buffers) || !view->count) {
+        return;
+    }
+
+    // Grow buffers if the visible set doesn't fit
+    bool realloc = !ring.id && view->count > view->buffer_size;
+    if (realloc) {
+        view->buffer_size = sokol_instance_buffer_capacity(
+            view->buffer_size, view->count, buffers->capacity_hint);
+    }
+
+    for (s = 0; s < l->stream_count; s ++) {
+        sokol_instance_stream_t *stream = &view->streams[s];
+        ecs_size_t size = l->stream_size[s];
+        ecs_vec_set_count(a, &stream->data, size, view->count);
+        void *dst = ecs_vec_first(&stream->data);
+
+        if (realloc) {
+            if (stream->buffer.id) {
+                sg_destroy_buffer(stream->buffer);
+            }
+            stream->buffer = sg_make_buffer(&(sg_buffer_desc){
+                .size = view->buffer_size * size, 
+                .usage = SG_USAGE_DYNAMIC });
+        }
+
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        if (!sokol_instance_stream_staged(buffers, s)) {
+            sokol_upload_view_columns(geometry, buffers, view, dst, mat_v);
+            continue;
+        }
+#endif
+
+        const void *src = ecs_vec_first(&buffers->streams[s].data);
+        for (i = 0; i < view->count; i ++) {
+            ecs_os_memcpy(ECS_ELEM(dst, size, i), 
+                ECS_ELEM(src, size, visible[i]), size);
+        }
 
-static
-void sokol_geometry_buffers_fini(ecs_allocator_t *a, sokol_geometry_buffers_t* result) {
-    if (result->colors.id) {
-        sg_destroy_buffer(result->colors);
-    }
-    if (result->transforms.id) {
-        sg_destroy_buffer(result->transforms);
-    }
-    if (result->materials.id) {
-        sg_destroy_buffer(result->materials);
+#if SOKOL_IMPOSTORS
+        if (s == l->transform.stream && mat_v && 
+            view->lods[SOKOL_LOD_IMPOSTOR].count) 
+        {
+            sokol_write_impostors(buffers, view, dst, mat_v);
+        }
+#if SOKOL_ZERO_COPY_TRANSFORMS
+        if (s == l->scale.stream && mat_v && 
+            view->lods[SOKOL_LOD_IMPOSTOR].count) 
+        {
+            sokol_write_impostor_scales(view, dst);
+        }
+#endif
+#else
+        (void)mat_v;
+#endif
+
+        if (ring.id) {
+            stream->buffer = ring;
+            stream->offset = sg_append_buffer(ring, &(sg_range) { 
+                dst, view->count * size });
+            continue;
+        }
+
+        sg_update_buffer(stream->buffer, &(sg_range) { 
+            dst, view->count * size });
     }
 
-    ecs_vec_fini_t(a, &result->transforms_data, mat4);
-    ecs_vec_fini_t(a, &result->colors_data, ecs_rgb_t);
-    ecs_vec_fini_t(a, &result->materials_data, SokolMaterial);
+    geometry->stats.instances_uploaded += view->count;
 }
 
+#if SOKOL_OCCLUSION_CULLING
+// Add visible instance to occluder candidates if it's large enough on screen
 static
-void sokol_free_geometry(SokolGeometry *ptr) {
-    sokol_geometry_buffers_fini(ptr->allocator, &ptr->solid);
-    if (ptr->allocator) {
-        flecs_allocator_fini(ptr->allocator);
-        ecs_os_free(ptr->allocator);
-        ptr->allocator = NULL;
+void sokol_select_occluder(
+    SokolOcclusion *occ,
+    sokol_geometry_buffers_t *buffers,
+    int32_t slot)
+{
+    const float *sphere = *ecs_vec_get_t(&buffers->bounds, vec4, slot);
+    if (sphere[3] < occ->desc.min_radius) {
+        return;
     }
-}
-
-ECS_CTOR(SokolGeometry, ptr, {
-    ecs_os_memset_t(ptr, 0, SokolGeometry);
-    ptr->allocator = ecs_os_malloc_t(ecs_allocator_t);
-    
-    flecs_allocator_init(ptr->allocator);
-    flecs_allocator_fini(ptr->allocator);
-    flecs_allocator_init(ptr->allocator);
-
 
-    sokol_geometry_buffers_init(ptr->allocator, &ptr->solid);
-})
+    // Distance from camera is the w component of the clip space position
+    mat4 *mat_vp = &occ->buffer.mat_vp;
+    float w = (*mat_vp)[0][3] * sphere[0] + (*mat_vp)[1][3] * sphere[1] + 
+        (*mat_vp)[2][3] * sphere[2] + (*mat_vp)[3][3];
+    if (w <= 0) {
+        return;
+    }
 
-ECS_MOVE(SokolGeometry, dst, src, {
-    sokol_free_geometry(dst);
-    ecs_os_memcpy_t(dst, src, SokolGeometry);
-    ecs_os_memset_t(src, 0, SokolGeometry);
-})
+    float size = sphere[3] / w;
+    if (size < occ->desc.min_screen_size) {
+        return;
+    }
 
-ECS_DTOR(SokolGeometry, ptr, {
-    sokol_free_geometry(ptr);
-})
+    sokol_occluder_t *o = ecs_vec_append_t(NULL, &occ->occluders, 
+        sokol_occluder_t);
+    o->buffers = buffers;
+    o->slot = slot;
+    o->size = size;
+}
 
-// To ensure rectangles are of the right size, use the Rectangle component to
-// apply a scaling factor to the transform matrix that is sent to the GPU.
 static
-void sokol_populate_rectangle(
-    mat4 *transforms, 
-    EcsRectangle *data, 
-    int32_t count,
-    bool self) 
+void sokol_select_occluders(
+    SokolOcclusion *occ,
+    sokol_geometry_buffers_t *buffers)
 {
-    int i;
-    if (self) {
-        for (i = 0; i < count; i ++) {
-            vec3 scale = {data[i].width, data[i].height, 1.0};
-            glm_scale(transforms[i], scale);
-        }
-    } else {
-        vec3 scale = {data->width, data->height, 1.0};
-        for (i = 0; i < count; i ++) {
-            glm_scale(transforms[i], scale);
+    const sokol_instance_view_t *view = &buffers->views[SOKOL_VIEW_CAMERA];
+    const int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    int32_t i;
+
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        const sokol_instance_cluster_t *clusters = ecs_vec_first_t(
+            &buffers->clusters, sokol_instance_cluster_t);
+        for (i = 0; i < view->count; i ++) {
+            const sokol_instance_cluster_t *cluster = &clusters[visible[i]];
+            int32_t slot;
+            for (slot = cluster->offset; 
+                slot < (cluster->offset + cluster->count); slot ++) 
+            {
+                sokol_select_occluder(occ, buffers, slot);
+            }
         }
+        return;
     }
-}
+#endif
 
-// To ensure boxes are of the right size, use the Box component to apply
-// a scaling factor to the transform matrix that is sent to the GPU.
-static
-void sokol_populate_box(
-    mat4 *transforms, 
-    EcsBox *data, 
-    int32_t count,
-    bool self)
-     
-{    
-    int i;
-    if (self) {
-        for (i = 0; i < count; i ++) {
-            vec3 scale = {data[i].width, data[i].height, data[i].depth};
-            glm_scale(transforms[i], scale);
-        }
-    } else {
-        vec3 scale = {data->width, data->height, data->depth};
-        for (i = 0; i < count; i ++) {
-            glm_scale(transforms[i], scale);
-        }
+    for (i = 0; i < view->count; i ++) {
+        sokol_select_occluder(occ, buffers, visible[i]);
     }
 }
 
-// Init static rectangle geometry data (vertices, indices)
 static
-void sokol_init_rectangle(
-    ecs_world_t *world,
-    sokol_resources_t *resources) 
+int sokol_compare_occluders(
+    const void *ptr1,
+    const void *ptr2)
 {
-    SokolGeometry *g = ecs_get_mut(
-        world, ecs_id(SokolRectangleGeometry), SokolGeometry);
-    ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
-
-    g->vertices = resources->rect;
-    g->normals = resources->rect_normals;
-    g->indices = resources->rect_indices;
-    g->index_count = sokol_rectangle_index_count();
-    g->populate = (sokol_geometry_action_t)sokol_populate_rectangle;
+    const sokol_occluder_t *o1 = ptr1, *o2 = ptr2;
+    return (o1->size < o2->size) - (o1->size > o2->size);
 }
 
-// Init static box geometry data (vertices, indices)
+// Remove visible instances (or clusters) that are hidden behind occluders
 static
-void sokol_init_box(
-    ecs_world_t *world,
-    sokol_resources_t *resources) 
+void sokol_occlude_buffers(
+    SokolOcclusion *occ,
+    sokol_geometry_buffers_t *buffers)
 {
-    if (SokolBoxGeometry) {
-        SokolGeometry *g = ecs_get_mut(
-            world, ecs_id(SokolBoxGeometry), SokolGeometry);
-        ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+    sokol_instance_view_t *view = &buffers->views[SOKOL_VIEW_CAMERA];
+    int32_t *visible = ecs_vec_first_t(&view->visible, int32_t);
+    const vec4 *bounds = ecs_vec_first_t(&buffers->bounds, vec4);
+    int32_t i, count = 0;
 
-        g->vertices = resources->box;
-        g->normals = resources->box_normals;
-        g->indices = resources->box_indices;
-        g->index_count = sokol_box_index_count();
-        g->populate = (sokol_geometry_action_t)sokol_populate_box;
+#if SOKOL_CLUSTER_INSTANCES
+    if (sokol_instance_clustered(buffers)) {
+        bounds = ecs_vec_first_t(&buffers->cluster_bounds, vec4);
     }
-}
+#endif
 
-void sokol_init_geometry(
-    ecs_world_t *world,
-    sokol_resources_t *resources) 
-{
-    sokol_init_rectangle(world, resources);
-    sokol_init_box(world, resources);
+    for (i = 0; i < view->count; i ++) {
+        if (sokol_occlusion_test_sphere(&occ->buffer, bounds[visible[i]])) {
+            visible[count ++] = visible[i];
+        }
+    }
+
+    occ->stats.tested += view->count;
+    occ->stats.occluded += view->count - count;
+    view->count = count;
 }
 
+// Draw occluders to the occlusion buffer and remove hidden instances from the
+// camera view. 
 static
-void sokol_populate_buffers(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers,
-    ecs_query_t *query)
+void sokol_occlude_instances(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    mat4 mat_vp)
 {
-    const ecs_world_t *world = ecs_get_world(query);
-    ecs_allocator_t *a = geometry->allocator;
-
-    int32_t i, old_size = ecs_vec_size(&buffers->colors_data);
+    SokolOcclusion *occ = ecs_singleton_ensure(world, SokolOcclusion);
+    if (!occ->buffer.depth) {
+        sokol_occlusion_init(&occ->buffer, 
+            SOKOL_OCCLUSION_WIDTH, SOKOL_OCCLUSION_HEIGHT);
+    }
 
-    ecs_vec_clear(&buffers->transforms_data);
-    ecs_vec_clear(&buffers->colors_data);
-    ecs_vec_clear(&buffers->materials_data);
+    ecs_os_zeromem(&occ->stats);
+    ecs_vec_clear(&occ->occluders);
+    sokol_occlusion_clear(&occ->buffer, mat_vp);
 
     ecs_iter_t qit = ecs_query_iter(world, query);
     while (ecs_query_next(&qit)) {
-        EcsTransform3 *transforms = ecs_field(&qit, EcsTransform3, 0);
-        EcsRgb *colors = ecs_field(&qit, EcsRgb, 1);
-        EcsEmissive *emissive = ecs_field(&qit, EcsEmissive, 2);
-        EcsSpecular *specular = ecs_field(&qit, EcsSpecular, 3);
-        void *geometry_data = ecs_field_w_size(&qit, qit.sizes[4], 4);
-        bool geometry_self = ecs_field_is_self(&qit, 4);
-
-        int32_t cur = ecs_vec_count(&buffers->colors_data);
-        int32_t count = qit.count;
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            if (g[i].occluder) {
+                sokol_select_occluders(occ, &g[i].solid);
+                sokol_select_occluders(occ, &g[i].statics);
+            }
+        }
+    }
 
-        ecs_vec_grow_t(a, &buffers->transforms_data, mat4, count);
-        ecs_vec_grow_t(a, &buffers->colors_data, ecs_rgb_t, count);
-        ecs_vec_grow_t(a, &buffers->materials_data, SokolMaterial, count);
+    sokol_occluder_t *occluders = ecs_vec_first_t(
+        &occ->occluders, sokol_occluder_t);
+    int32_t i, count = ecs_vec_count(&occ->occluders);
+    if (!count) {
+        return;
+    }
 
-        // Copy transform data
-        ecs_os_memcpy_n( ecs_vec_get_t(&buffers->transforms_data, mat4, cur), 
-            transforms, mat4, count);
+    qsort(occluders, (size_t)count, sizeof(sokol_occluder_t), 
+        sokol_compare_occluders);
+    if (count > occ->desc.max_occluders) {
+        count = occ->desc.max_occluders;
+    }
 
-        // Copy color data
-        if (ecs_field_is_self(&qit, 1)) {
-            ecs_os_memcpy_n( ecs_vec_get_t(&buffers->colors_data, ecs_rgb_t, cur), 
-                colors, ecs_rgb_t, count);
-        } else {
-            for (i = 0; i < count; i ++) {
-                *ecs_vec_get_t(&buffers->colors_data, ecs_rgb_t, cur + i) = colors[0];
-            }
+    for (i = 0; i < count; i ++) {
+        mat4 transform;
+        if (sokol_instance_transform(occluders[i].buffers, occluders[i].slot, 
+            transform)) 
+        {
+            sokol_occlusion_draw_box(&occ->buffer, transform);
         }
+    }
 
-        if (emissive || specular) {
-            SokolMaterial *m = ecs_vec_get_t(
-                &buffers->materials_data, SokolMaterial, cur);
-            if (emissive) {
-                if (ecs_field_is_self(&qit, 2)) {
-                    for (i = 0; i < count; i ++) {
-                        m[i].emissive = emissive[i].value;
-                    }
-                } else {
-                    for (i = 0; i < count; i ++) {
-                        m[i].emissive = emissive->value;
-                    }
-                }
-            } else {
-                for (i = 0; i < count; i ++) {
-                    m[i].emissive = 0;
-                }
-            }
+    sokol_occlusion_finish(&occ->buffer);
+    occ->stats.occluders = count;
 
-            if (specular) {
-                if (ecs_field_is_self(&qit, 3)) {
-                    for (i = 0; i < count; i ++) {
-                        m[i].specular_power = specular[i].specular_power;
-                        m[i].shininess = specular[i].shininess;
-                    }
-                } else {
-                    for (i = 0; i < count; i ++) {
-                        m[i].specular_power = specular->specular_power;
-                        m[i].shininess = specular->shininess;
-                    }
-                }
-            } else {
-                for (i = 0; i < count; i ++) {
-                    m[i].specular_power = 0;
-                    m[i].shininess = 0;
-                }
-            }
-        } else {
-            ecs_os_memset_n(
-                ecs_vec_get_t(&buffers->materials_data, SokolMaterial, cur), 
-                    0, SokolMaterial, count);
+    qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        for (i = 0; i < qit.count; i ++) {
+            sokol_occlude_buffers(occ, &g[i].solid);
+            sokol_occlude_buffers(occ, &g[i].statics);
         }
-
-        // Apply geometry-specific scaling to transform matrix
-        geometry->populate(ecs_vec_get_t(&buffers->transforms_data, mat4, cur), 
-            geometry_data, count, geometry_self);
     }
+}
+#endif
 
-    // Populate sokol buffers
-    {
-        ecs_size_t new_size = ecs_vec_size(&buffers->colors_data);
-        if (new_size != old_size) {
-            if (old_size) {
-                sg_destroy_buffer(buffers->colors);
-                sg_destroy_buffer(buffers->transforms);
-                sg_destroy_buffer(buffers->materials);
-            }
+// Cull instances against planes, and optionally against receiver planes.
+// Visible instances are sorted by level of detail and uploaded to the view 
+// buffers.
+static
+void sokol_cull_view(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    int32_t view,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float screen_height,
+    const vec4 *planes,
+    const vec4 *receivers)
+{
+    sg_buffer ring = {0};
+#if SOKOL_INSTANCE_RING
+    ring = ecs_singleton_get(world, SokolInstanceRing)->buffer;
+#endif
 
-            buffers->colors = sg_make_buffer(&(sg_buffer_desc){
-                .size = new_size * sizeof(ecs_rgb_t), .usage = SG_USAGE_STREAM });
-            buffers->transforms = sg_make_buffer(&(sg_buffer_desc){
-                .size = new_size * sizeof(EcsTransform3), .usage = SG_USAGE_STREAM });
-            buffers->materials = sg_make_buffer(&(sg_buffer_desc){
-                .size = new_size * sizeof(SokolMaterial), .usage = SG_USAGE_STREAM });
+    ecs_iter_t qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_cull_buffers(&g[i], &g[i].solid, 
+                &g[i].solid.views[view], planes, receivers);
+            sokol_cull_buffers(&g[i], &g[i].statics, 
+                &g[i].statics.views[view], planes, receivers);
         }
+    }
 
-        buffers->instance_count = ecs_vec_count(&buffers->colors_data);
+#if SOKOL_OCCLUSION_CULLING
+    if (view == SOKOL_VIEW_CAMERA) {
+        sokol_occlude_instances(world, query, mat_vp);
+    }
+#endif
 
-        if (buffers->instance_count > 0) {
-            sg_update_buffer(buffers->colors, &(sg_range) {
-                ecs_vec_first_t(&buffers->colors_data, ecs_rgb_t), 
-                    buffers->instance_count * sizeof(ecs_rgb_t) } );
-            sg_update_buffer(buffers->transforms, &(sg_range) {
-                ecs_vec_first_t(&buffers->transforms_data, mat4), 
-                    buffers->instance_count * sizeof(mat4) } );
-            sg_update_buffer(buffers->materials, &(sg_range) {
-                ecs_vec_first_t(&buffers->materials_data, SokolMaterial), 
-                    buffers->instance_count * sizeof(SokolMaterial) } );
+    qit = ecs_query_iter(world, query);
+    while (ecs_query_next(&qit)) {
+        SokolGeometry *g = ecs_field(&qit, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < qit.count; i ++) {
+            sokol_bin_view(&g[i], &g[i].solid, view, mat_vp, screen_height);
+            sokol_bin_view(&g[i], &g[i].statics, view, mat_vp, screen_height);
+            sokol_upload_view(&g[i], &g[i].solid, view, mat_v, ring);
+            sokol_upload_view(&g[i], &g[i].statics, view, mat_v, ring);
         }
     }
 }
 
-// System that matches all geometry kinds & calls the function to update GPU
-// buffers with ECS data.
-static
-void SokolPopulateGeometry(
-    ecs_iter_t *it) 
+void sokol_cull_instances(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    int32_t view,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float screen_height)
 {
-    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
-    SokolGeometryQuery *q = ecs_field(it, SokolGeometryQuery, 1);
+    ecs_assert(view >= 0 && view < SOKOL_MAX_VIEWS, ECS_INVALID_PARAMETER, NULL);
 
-    int i;
-    for (i = 0; i < it->count; i ++) {
-        sokol_populate_buffers(&g[i], &g[i].solid, q[i].solid);    
+    vec4 planes[6];
+    glm_frustum_planes(mat_vp, planes);
+    sokol_cull_view(world, query, view, mat_vp, mat_v, screen_height, 
+        (const vec4*)planes, NULL);
+}
+
+void sokol_cull_shadow_casters(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    mat4 light_mat_vp,
+    mat4 camera_mat_vp,
+    vec3 light_dir)
+{
+    vec4 planes[6], receivers[6];
+    int32_t p;
+
+    // Casters between the light and the light volume cast shadows into the
+    // volume, so the near plane of the light volume is not tested.
+    glm_frustum_planes(light_mat_vp, planes);
+    glm_vec4_copy((vec4){ 0, 0, 0, FLT_MAX }, planes[GLM_NEAR]);
+
+    // A shadow reaches the camera frustum only if the caster, swept along the
+    // light direction, is inside every camera plane. Planes that face the 
+    // light direction are always crossed by the sweep.
+    glm_frustum_planes(camera_mat_vp, receivers);
+    for (p = 0; p < 6; p ++) {
+        if (glm_vec3_dot(receivers[p], light_dir) > 0) {
+            glm_vec4_copy((vec4){ 0, 0, 0, FLT_MAX }, receivers[p]);
+        }
     }
+
+    sokol_cull_view(world, query, SOKOL_VIEW_SHADOW, light_mat_vp, NULL,
+        SOKOL_SHADOW_MAP_SIZE, (const vec4*)planes, (const vec4*)receivers);
 }
+#endif
 
 static
 void CreateGeometryQueries(ecs_iter_t *it) {
     ecs_world_t *world = it->world;
+    SokolGeometry *g = ecs_field(it, SokolGeometry, 0);
     SokolGeometryQuery *gq = ecs_field(it, SokolGeometryQuery, 1);
+    const SokolImpostorMesh *impostor = ecs_singleton_get(
+        world, SokolImpostorMesh);
 
     int i;
     for (i = 0; i < it->count; i ++) {
+        // Geometries that are created before the renderer is initialized get
+        // the impostor quad from sokol_init_geometry.
+        if (impostor) {
+            g[i].impostor = impostor->mesh;
+        }
+
         // Geometry query that includes all components that are copied (or used
-        // to find data to copy) to GPU buffers.
+        // to find data to copy) to GPU buffers. All terms are marked [in] so
+        // that writes to them are picked up by query change detection.
         ecs_query_desc_t desc = {
             .terms = {{
                 .id        = ecs_id(EcsTransform3), 
@@ -314,17 +3576,21 @@ void CreateGeometryQueries(ecs_iter_t *it) {
                 .inout     = EcsIn
             }, {
                 .id        = ecs_id(EcsEmissive),
-                .inout     = EcsInOutNone,
+                .inout     = EcsIn,
                 .oper      = EcsOptional
             }, {
                 .id        = ecs_id(EcsSpecular),
-                .inout     = EcsInOutNone,
+                .inout     = EcsIn,
                 .oper      = EcsOptional
             }, {
                 .id        = gq[i].component, 
                 .inout     = EcsIn
+            }, {
+                .id        = SokolStatic,
+                .oper      = EcsNot
             }},
-            .cache_kind = EcsQueryCacheAuto
+            .cache_kind = EcsQueryCacheAuto,
+            .flags = EcsQueryDetectChanges
         };
 
         /* Query for solid objects */
@@ -342,7 +3608,279 @@ void CreateGeometryQueries(ecs_iter_t *it) {
                 component_str);
             ecs_os_free(component_str);
         }
+
+        /* Query for static objects. Tables are grouped by cluster, so that
+         * instances of a cluster are stored in a contiguous range. */
+        desc.terms[5].oper = EcsAnd;
+#if SOKOL_CLUSTER_INSTANCES
+        desc.group_by = SokolCluster;
+#endif
+        desc.entity = ecs_entity(world, {
+            .name = ecs_get_name(world, gq[i].component),
+            .parent = ecs_entity(world, {
+                .name = "#0.flecs.systems.sokol.geometry_queries.static"
+            })
+        });
+
+        gq[i].statics = ecs_query_init(world, &desc);
+        if (!gq[i].statics) {
+            char *component_str = ecs_id_str(world, gq[i].component);
+            ecs_err("sokol: failed to create query for static %s geometry", 
+                component_str);
+            ecs_os_free(component_str);
+        }
+
+        /* Query used by worker threads to copy data to buffers. Does not
+         * detect changes, as that would reset change state of tables. Matches
+         * both static and dynamic objects. */
+        desc.terms[5] = (ecs_term_t){0};
+        desc.flags = 0;
+        desc.group_by = 0;
+        desc.entity = ecs_entity(world, {
+            .name = ecs_get_name(world, gq[i].component),
+            .parent = ecs_entity(world, {
+                .name = "#0.flecs.systems.sokol.geometry_queries.gather"
+            })
+        });
+
+        gq[i].gather = ecs_query_init(world, &desc);
+        if (!gq[i].gather) {
+            char *component_str = ecs_id_str(world, gq[i].component);
+            ecs_err("sokol: failed to create gather query for %s geometry", 
+                component_str);
+            ecs_os_free(component_str);
+        }
+    }
+}
+
+// Find geometry for a geometry component (like EcsBox)
+static
+SokolGeometry* sokol_find_geometry(
+    ecs_world_t *world,
+    ecs_entity_t component)
+{
+    ecs_iter_t it = ecs_each(world, SokolGeometryQuery);
+    while (ecs_each_next(&it)) {
+        SokolGeometryQuery *q = ecs_field(&it, SokolGeometryQuery, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (q[i].component == component) {
+                SokolGeometry *g = ecs_get_mut(
+                    world, it.entities[i], SokolGeometry);
+                ecs_assert(g != NULL, ECS_INTERNAL_ERROR, NULL);
+                ecs_iter_fini(&it);
+                return g;
+            }
+        }
+    }
+
+    char *component_str = ecs_id_str(world, component);
+    ecs_err("sokol: no geometry for component %s", component_str);
+    ecs_os_free(component_str);
+    return NULL;
+}
+
+void sokol_geometry_capacity_hint(
+    ecs_world_t *world,
+    ecs_entity_t component,
+    int32_t count,
+    int32_t static_count)
+{
+    SokolGeometry *g = sokol_find_geometry(world, component);
+    if (g) {
+        g->solid.capacity_hint = count;
+        g->statics.capacity_hint = static_count;
+    }
+}
+
+void sokol_geometry_impostor_distance(
+    ecs_world_t *world,
+    ecs_entity_t component,
+    float distance)
+{
+#if SOKOL_IMPOSTORS
+    ecs_assert(distance >= 0, ECS_INVALID_PARAMETER, NULL);
+    SokolGeometry *g = sokol_find_geometry(world, component);
+    if (g) {
+        g->impostor_distance = distance;
+    }
+#else
+    (void)world;
+    (void)component;
+    (void)distance;
+    ecs_err("sokol: impostors require SOKOL_IMPOSTORS");
+#endif
+}
+
+static
+void sokol_geometry_stats_add(
+    sokol_geometry_stats_t *dst,
+    const sokol_geometry_stats_t *src)
+{
+    dst->uploads_performed += src->uploads_performed;
+    dst->uploads_skipped += src->uploads_skipped;
+    dst->ranges_uploaded += src->ranges_uploaded;
+    dst->instances_uploaded += src->instances_uploaded;
+    dst->compactions += src->compactions;
+    dst->reallocations += src->reallocations;
+    dst->instances_culled += src->instances_culled;
+    dst->tables_culled += src->tables_culled;
+    dst->cells_culled += src->cells_culled;
+    dst->clusters_culled += src->clusters_culled;
+    dst->casters_culled += src->casters_culled;
+    dst->instances_small += src->instances_small;
+    dst->impostors += src->impostors;
+}
+
+void sokol_geometry_get_stats(
+    const ecs_world_t *world,
+    ecs_entity_t component,
+    sokol_geometry_stats_t *stats)
+{
+    ecs_os_zeromem(stats);
+
+    ecs_iter_t it = ecs_each(world, SokolGeometryQuery);
+    while (ecs_each_next(&it)) {
+        SokolGeometryQuery *q = ecs_field(&it, SokolGeometryQuery, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (component && q[i].component != component) {
+                continue;
+            }
+
+            const SokolGeometry *g = ecs_get(
+                world, it.entities[i], SokolGeometry);
+            if (g) {
+                sokol_geometry_stats_add(stats, &g->stats);
+            }
+        }
+    }
+}
+
+void sokol_query_sphere(
+    const ecs_world_t *world,
+    const float *center,
+    float radius,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+#if SOKOL_SPATIAL_INDEX
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (!sokol_spatial_overlap_sphere(&g[i].solid.index, center, 
+                    radius, callback, ctx) || 
+                !sokol_spatial_overlap_sphere(&g[i].statics.index, center, 
+                    radius, callback, ctx))
+            {
+                ecs_iter_fini(&it);
+                return;
+            }
+        }
+    }
+#else
+    (void)world; (void)center; (void)radius; (void)callback; (void)ctx;
+    ecs_err("sokol: spatial queries require SOKOL_SPATIAL_INDEX");
+#endif
+}
+
+void sokol_query_box(
+    const ecs_world_t *world,
+    const float *min,
+    const float *max,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+#if SOKOL_SPATIAL_INDEX
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            if (!sokol_spatial_overlap_box(&g[i].solid.index, min, max, 
+                    callback, ctx) || 
+                !sokol_spatial_overlap_box(&g[i].statics.index, min, max, 
+                    callback, ctx))
+            {
+                ecs_iter_fini(&it);
+                return;
+            }
+        }
+    }
+#else
+    (void)world; (void)min; (void)max; (void)callback; (void)ctx;
+    ecs_err("sokol: spatial queries require SOKOL_SPATIAL_INDEX");
+#endif
+}
+
+ecs_entity_t sokol_raycast(
+    const ecs_world_t *world,
+    const float *origin,
+    const float *direction,
+    float max_distance,
+    float *distance)
+{
+#if SOKOL_SPATIAL_INDEX
+    vec3 dir;
+    glm_vec3_normalize_to((float*)direction, dir);
+
+    ecs_entity_t result = 0;
+    float hit = max_distance;
+    ecs_iter_t it = ecs_each(world, SokolGeometry);
+    while (ecs_each_next(&it)) {
+        SokolGeometry *g = ecs_field(&it, SokolGeometry, 0);
+        int i;
+        for (i = 0; i < it.count; i ++) {
+            ecs_entity_t e = sokol_spatial_raycast(
+                &g[i].solid.index, origin, dir, &hit);
+            result = e ? e : result;
+            e = sokol_spatial_raycast(
+                &g[i].statics.index, origin, dir, &hit);
+            result = e ? e : result;
+        }
+    }
+
+    if (result && distance) {
+        *distance = hit;
+    }
+    return result;
+#else
+    (void)world; (void)origin; (void)direction; (void)max_distance; 
+    (void)distance;
+    ecs_err("sokol: spatial queries require SOKOL_SPATIAL_INDEX");
+    return 0;
+#endif
+}
+
+void sokol_occlusion_set_desc(
+    ecs_world_t *world,
+    const sokol_occlusion_desc_t *desc)
+{
+#if SOKOL_OCCLUSION_CULLING
+    SokolOcclusion *occ = ecs_singleton_ensure(world, SokolOcclusion);
+    occ->desc = *desc;
+#else
+    (void)world; (void)desc;
+    ecs_err("sokol: occlusion culling requires SOKOL_OCCLUSION_CULLING");
+#endif
+}
+
+void sokol_occlusion_get_stats(
+    const ecs_world_t *world,
+    sokol_occlusion_stats_t *stats)
+{
+#if SOKOL_OCCLUSION_CULLING
+    const SokolOcclusion *occ = ecs_singleton_get(world, SokolOcclusion);
+    if (occ) {
+        *stats = occ->stats;
+        return;
     }
+#else
+    (void)world;
+#endif
+    ecs_os_zeromem(stats);
 }
 
 void FlecsSystemsSokolGeometryImport(
@@ -354,6 +3892,8 @@ void FlecsSystemsSokolGeometryImport(
     ECS_IMPORT(world, FlecsSystemsTransform);
     ECS_IMPORT(world, FlecsGame);
 
+    sokol_init_kernels();
+
     /* Store components in parent sokol scope */
     ecs_entity_t parent = ecs_lookup(world, "flecs.systems.sokol");
     ecs_entity_t module = ecs_set_scope(world, parent);
@@ -361,6 +3901,17 @@ void FlecsSystemsSokolGeometryImport(
 
     ECS_COMPONENT_DEFINE(world, SokolGeometry);
     ECS_COMPONENT_DEFINE(world, SokolGeometryQuery);
+    ECS_COMPONENT_DEFINE(world, SokolImpostorMesh);
+    ECS_TAG_DEFINE(world, SokolStatic);
+    ECS_TAG_DEFINE(world, SokolCluster);
+    ECS_TAG_DEFINE(world, SokolNoShadow);
+    ECS_TAG_DEFINE(world, SokolNoDepthPrepass);
+    ECS_COMPONENT_DEFINE(world, SokolSphere);
+    ECS_COMPONENT_DEFINE(world, SokolCylinder);
+    ECS_COMPONENT_DEFINE(world, SokolCone);
+#if SOKOL_INSTANCE_RING
+    ECS_COMPONENT_DEFINE(world, SokolInstanceRing);
+#endif
 
     ecs_set_hooks(world, SokolGeometry, {
         .ctor = ecs_ctor(SokolGeometry),
@@ -368,6 +3919,22 @@ void FlecsSystemsSokolGeometryImport(
         .dtor = ecs_dtor(SokolGeometry)
     });
 
+#if SOKOL_OCCLUSION_CULLING
+    ECS_COMPONENT_DEFINE(world, SokolOcclusion);
+    ecs_set_hooks(world, SokolOcclusion, {
+        .ctor = ecs_ctor(SokolOcclusion),
+        .move = ecs_move(SokolOcclusion),
+        .dtor = ecs_dtor(SokolOcclusion)
+    });
+    ecs_singleton_set(world, SokolOcclusion, {
+        .desc = {
+            .min_radius = 2.0f,
+            .min_screen_size = 0.05f,
+            .max_occluders = 64
+        }
+    });
+#endif
+
     ecs_set_scope(world, module);
 
     /* Create queries for solid objects */
@@ -386,7 +3953,46 @@ void FlecsSystemsSokolGeometryImport(
             .component = ecs_id(EcsBox)
         });
 
-    /* Create system that manages buffers */
+    /* Support for procedural primitives */
+    ECS_ENTITY_DEFINE(world, SokolSphereGeometry, Geometry);
+        ecs_set(world, SokolSphereGeometry, SokolGeometryQuery, {
+            .component = ecs_id(SokolSphere)
+        });
+
+    ECS_ENTITY_DEFINE(world, SokolCylinderGeometry, Geometry);
+        ecs_set(world, SokolCylinderGeometry, SokolGeometryQuery, {
+            .component = ecs_id(SokolCylinder)
+        });
+
+    ECS_ENTITY_DEFINE(world, SokolConeGeometry, Geometry);
+        ecs_set(world, SokolConeGeometry, SokolGeometryQuery, {
+            .component = ecs_id(SokolCone)
+        });
+
+    /* Create systems that manage buffers */
     ECS_SYSTEM(world, SokolPopulateGeometry, EcsPreStore, 
         Geometry, [in] GeometryQuery);
+
+    /* Copying data to instance buffers is divided over worker threads */
+    ecs_system(world, {
+        .entity = ecs_entity(world, {
+            .name = "SokolGatherGeometry",
+            .add = ecs_ids( ecs_dependson(EcsPreStore) )
+        }),
+        .query.terms = {
+            { .id = ecs_id(SokolGeometry) },
+            { .id = ecs_id(SokolGeometryQuery), .inout = EcsIn }
+        },
+        .run = SokolGatherGeometry,
+        .multi_threaded = true
+    });
+
+    ECS_SYSTEM(world, SokolUploadGeometry, EcsPreStore, 
+        Geometry);
+
+#if SOKOL_INSTANCE_RING
+    /* Appending data to the instance ring for all geometry kinds */
+    ECS_SYSTEM(world, SokolAppendInstanceRing, EcsPreStore, 
+        flecs.systems.sokol.InstanceRing($));
+#endif
 }
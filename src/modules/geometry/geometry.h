@@ -3,26 +3,275 @@
 
 #include "../../types.h"
 #include "../renderer/renderer.h"
+#include "spatial.h"
+#include "occlusion.h"
 
+/* Copies transforms to dst while applying geometry-specific scaling. The
+ * transform of instance i is written to dst + i * dst_stride. */
 typedef void (*sokol_geometry_action_t)(
-    mat4 *transforms,
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *transforms,
     void *data,
     int32_t count,
     bool self);
 
+/* Writes geometry-specific scaling as a vec3 per instance, which is applied
+ * by the shader when SOKOL_ZERO_COPY_TRANSFORMS is enabled. The scale of
+ * instance i is written to dst + i * dst_stride. */
+typedef void (*sokol_geometry_scale_action_t)(
+    void *dst,
+    ecs_size_t dst_stride,
+    void *data,
+    int32_t count,
+    bool self);
+
+/* Computes a bounding sphere per instance, used for culling */
+typedef void (*sokol_geometry_bounds_action_t)(
+    vec4 *dst,
+    const mat4 *transforms,
+    void *data,
+    int32_t count,
+    bool self);
+
+/* Element with material parameters */
+typedef struct {
+    float specular_power;
+    float shininess;
+    float emissive;
+} SokolMaterial;
+
+#if SOKOL_INTERLEAVED_INSTANCES
+/* Interleaved instance data. The transform is stored as a float array so that
+ * the struct isn't padded to the alignment of cglm types. */
+typedef struct sokol_instance_t {
+    float transform[sizeof(sokol_transform_t) / sizeof(float)];
+    sokol_instance_color_t color;
+#if !SOKOL_PACKED_INSTANCE_DATA
+    SokolMaterial material;
+#endif
+} sokol_instance_t;
+#endif
+
+/* Maximum number of vertex buffers with instance data */
+#define SOKOL_MAX_INSTANCE_STREAMS (4)
+
+/* Instance attributes, used to select the attributes used by a pipeline */
+#define SOKOL_INSTANCE_TRANSFORM (1 << 0)
+#define SOKOL_INSTANCE_COLOR     (1 << 1)
+#define SOKOL_INSTANCE_MATERIAL  (1 << 2)
+#define SOKOL_INSTANCE_ALL \
+    (SOKOL_INSTANCE_TRANSFORM | SOKOL_INSTANCE_COLOR | SOKOL_INSTANCE_MATERIAL)
+
+/* Location of instance attribute */
+typedef struct sokol_instance_attr_t {
+    int32_t stream;             /* Stream that contains the attribute */
+    int32_t offset;             /* Offset of attribute in stream element */
+} sokol_instance_attr_t;
+
+/* Describes how instance attributes are stored in streams. Each stream is a
+ * separate vertex buffer. */
+typedef struct sokol_instance_layout_t {
+    int32_t stream_count;
+    ecs_size_t stream_size[SOKOL_MAX_INSTANCE_STREAMS];
+    sokol_instance_attr_t transform;
+    sokol_instance_attr_t color;
+    sokol_instance_attr_t material;
+#if SOKOL_ZERO_COPY_TRANSFORMS
+    sokol_instance_attr_t scale;  /* Used together with transform */
+#endif
+} sokol_instance_layout_t;
+
+/* Instance data stream */
+typedef struct sokol_instance_stream_t {
+    ecs_vec_t data;             /* CPU copy of instance data */
+    sg_buffer buffer;           /* Sokol buffer with instance data */
+    int32_t offset;             /* Offset of instance data in buffer */
+} sokol_instance_stream_t;
+
+/* Passes that draw instances. Entities can be excluded from a pass with the
+ * SokolNoDepthPrepass and SokolNoShadow tags. The scene pass draws instances
+ * that are excluded from the depth prepass with depth writes enabled, after
+ * which their depth is written to the depth prepass target. */
+#define SOKOL_PASS_SCENE (0)
+#define SOKOL_PASS_DEPTH (1)
+#define SOKOL_PASS_SHADOW (2)
+#define SOKOL_MAX_PASSES (3)
+
+/* Views that instances are culled for */
+#define SOKOL_VIEW_CAMERA (0)
+#define SOKOL_VIEW_SHADOW (1)
+#define SOKOL_MAX_VIEWS (2)
+
+/* Visible instances are drawn per level of detail, followed by impostors */
+#define SOKOL_LOD_IMPOSTOR (SOKOL_MAX_LODS)
+#define SOKOL_MAX_VIEW_LODS (SOKOL_MAX_LODS + 1)
+
+/* Range of visible instances or clusters with the same level of detail */
+typedef struct sokol_instance_lod_t {
+    int32_t offset;
+    int32_t count;
+    int32_t depth_count;        /* Number of instances in depth pass. Instances
+                                 * excluded from the depth pass are stored after
+                                 * the other instances of the range. */
+} sokol_instance_lod_t;
+
+/* Instances that are visible in a view */
+typedef struct sokol_instance_view_t {
+    sokol_instance_stream_t streams[SOKOL_MAX_INSTANCE_STREAMS];
+    ecs_vec_t visible;          /* Slots of visible instances, or indices of 
+                                 * visible clusters (vec<int32_t>) */
+    ecs_vec_t bins;             /* Bin per visible element while sorting visible
+                                 * by level of detail (vec<int8_t>) */
+    ecs_vec_t sorted;           /* Sorted visible elements (vec<int32_t>) */
+    sokol_instance_lod_t lods[SOKOL_MAX_VIEW_LODS];
+    float depth;                /* Distance to nearest visible element */
+    int32_t count;              /* Number of visible instances or clusters */
+    int32_t buffer_size;        /* Number of instances that fit in sokol buffers */
+} sokol_instance_view_t;
+
+/* Contiguous range of instances that is culled & drawn as a whole */
+typedef struct sokol_instance_cluster_t {
+    uint64_t group;             /* Query group (SokolCluster target) */
+    ecs_flags32_t exclude;      /* Passes that cluster is excluded from */
+    int32_t offset;
+    int32_t count;
+    bool dirty;                 /* Whether bounds must be recomputed */
+} sokol_instance_cluster_t;
+
+/* Instance slots reserved for a query group (SokolCluster target). The tables
+ * of a group are stored consecutively in the range of the group, so that only
+ * groups with tables that changed are laid out, gathered & uploaded again. */
+typedef struct sokol_cluster_group_t {
+    int32_t offset;             /* First slot in the instance buffers */
+    int32_t capacity;           /* Number of slots reserved for group */
+    int32_t count;              /* Number of slots in use */
+    int32_t frame;              /* Last populate in which group was matched */
+    bool dirty;                 /* Whether tables of group must be laid out */
+} sokol_cluster_group_t;
+
+/* Range of instance slots */
+typedef struct sokol_instance_range_t {
+    int32_t offset;
+    int32_t count;
+} sokol_instance_range_t;
+
+/* Instance slots reserved for a table matched by a geometry query. The slots
+ * of a table stay at the same offset across frames, so that only data of
+ * tables that changed has to be copied & uploaded. */
+typedef struct sokol_table_instances_t {
+    int32_t offset;             /* First slot in the instance buffers */
+    int32_t capacity;           /* Number of slots reserved for table */
+    int32_t count;              /* Number of slots in use */
+    int32_t frame;              /* Last populate in which table was matched */
+    ecs_flags32_t exclude;      /* Passes that table is excluded from */
+    bool gather;                /* Whether table data must be copied */
+#if SOKOL_CLUSTER_INSTANCES
+    uint64_t group;             /* Query group, if stored in a group range */
+#endif
+#if SOKOL_CULL_INSTANCES
+    bool bounds_dirty;          /* Whether bounds must be recomputed */
+    vec4 bounds;                /* Sphere that encloses all table instances */
+#endif
+} sokol_table_instances_t;
+
+#if SOKOL_CULL_INSTANCES && SOKOL_ZERO_COPY_TRANSFORMS
+/* Instance slots of a table, used to find the table column with the transform
+ * of a slot when transforms are not stored in the instance buffers. */
+typedef struct sokol_table_slots_t {
+    int32_t offset;             /* First slot of table */
+    int32_t count;              /* Number of slots in use */
+    ecs_table_t *table;
+    int32_t column;             /* Column index of EcsTransform3 */
+} sokol_table_slots_t;
+#endif
+
 typedef struct sokol_geometry_buffers_t {
-    /* Temporary buffers for storing data gathered from ECS. This allows data to
-     * be copied in one call to the graphics API. */
-    ecs_vec_t colors_data;
-    ecs_vec_t transforms_data;
-    ecs_vec_t materials_data;
-
-    /* Sokol buffers with instanced data */
-    sg_buffer colors;
-    sg_buffer transforms;
-    sg_buffer materials;
-
-    /* Number of instances */
+    /* Instance data gathered from ECS, stored as described by the instance 
+     * layout. Data is stored at persistent per-table offsets. Slots that are
+     * not in use are zero, which produces a degenerate transform that is 
+     * culled by the GPU. */
+    sokol_instance_stream_t streams[SOKOL_MAX_INSTANCE_STREAMS];
+
+#if SOKOL_CULL_INSTANCES
+    /* Bounding sphere per instance slot (vec<vec4>). Slots that are not in use
+     * have a radius of zero. */
+    ecs_vec_t bounds;
+
+    /* Visible instances per view */
+    sokol_instance_view_t views[SOKOL_MAX_VIEWS];
+
+    /* Passes that instance slot is excluded from (vec<uint8_t>) */
+    ecs_vec_t exclude;
+#else
+    /* Slot ranges that are not drawn, per pass (vec<sokol_instance_range_t>).
+     * Ranges are sorted by offset. */
+    ecs_vec_t excluded[SOKOL_MAX_PASSES];
+#endif
+
+#if SOKOL_CULL_INSTANCES && SOKOL_ZERO_COPY_TRANSFORMS
+    /* Slots of tables sorted by offset, rebuilt when buffers are populated
+     * (vec<sokol_table_slots_t>). Only used when transforms are uploaded from
+     * table columns. */
+    ecs_vec_t table_slots;
+#endif
+
+#if SOKOL_SPATIAL_INDEX
+    /* Grid with bounding spheres of instance slots */
+    sokol_spatial_index_t index;
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES
+    /* Instance clusters, in slot order (vec<sokol_instance_cluster_t>). Only
+     * used for static instances. */
+    ecs_vec_t clusters;
+    ecs_vec_t cluster_bounds;   /* Bounding sphere per cluster (vec<vec4>) */
+
+    /* Slot ranges per query group (map<uint64_t, sokol_cluster_group_t*>).
+     * Tables without a SokolCluster pair (group 0) have their own range. */
+    ecs_map_t groups;
+#endif
+
+    /* Number of instance slots in CPU buffers. Sokol buffers are resized to
+     * the same capacity when data is uploaded. */
+    int32_t capacity;
+
+    /* Number of instances that fit in sokol buffers */
+    int32_t buffer_size;
+
+    /* Number of consecutive frames in which the buffers were underused */
+    int32_t low_frames;
+
+    /* Minimum capacity of buffers, view buffers and the space reserved in
+     * the instance ring (see sokol_geometry_capacity_hint) */
+    int32_t capacity_hint;
+
+    /* Usage of sokol buffers. Immutable buffers are recreated when modified,
+     * stream buffers are appended to the instance ring each frame. Clustered
+     * buffers are marked immutable, but use dynamic sokol buffers. */
+    sg_usage usage;
+
+    /* Slot ranges per table (map<ecs_table_t*, sokol_table_instances_t*>) */
+    ecs_map_t tables;
+
+    /* Number of instances excluded from each pass, updated when tables are
+     * populated or released */
+    int32_t exclude_count[SOKOL_MAX_PASSES];
+
+    /* Unused slot ranges, sorted by offset (vec<sokol_instance_range_t>) */
+    ecs_vec_t free_ranges;
+    int32_t free_count;
+
+    /* Ranges written this frame that need uploading (vec<sokol_instance_range_t>) */
+    ecs_vec_t dirty_ranges;
+
+    /* Incremented each time buffers are populated */
+    int32_t frame;
+
+    /* Number of tables that need to be copied to buffers */
+    int32_t gather_count;
+
+    /* Number of instances to draw (includes unused slots) */
     int32_t instance_count;
 } sokol_geometry_buffers_t;
 
@@ -35,32 +284,185 @@ typedef struct SokolGeometry {
     /* Number of indices */
     int32_t index_count;
 
+    /* Levels of detail, from highest to lowest. The first level has the same
+     * buffers as vertices, normals and indices. A level is used for instances
+     * with a projected diameter of at least lod_sizes[level] pixels. */
+    sokol_mesh_t lods[SOKOL_MAX_LODS];
+    float lod_sizes[SOKOL_MAX_LODS];
+    int32_t lod_count;
+
+    /* Camera facing quad used for impostors */
+    sokol_mesh_t impostor;
+
+    /* Distance from camera beyond which instances are drawn as impostors. 
+     * Impostors are disabled if zero. */
+    float impostor_distance;
+
     /* Buffers with instanced data */
     sokol_geometry_buffers_t solid;
-    sokol_geometry_buffers_t emissive;
+    sokol_geometry_buffers_t statics; /* Entities with the SokolStatic tag */
 
     /* Function that copies geometry-specific data to GPU buffer */
     sokol_geometry_action_t populate;
 
+    /* Function that writes geometry-specific scaling to GPU buffer */
+    sokol_geometry_scale_action_t scale;
+
+    /* Function that computes bounding spheres for instances */
+    sokol_geometry_bounds_action_t bounds;
+
+#if SOKOL_OCCLUSION_CULLING
+    /* Whether instances can be used as occluders */
+    bool occluder;
+#endif
+
+    /* Statistics for the last frame */
+    sokol_geometry_stats_t stats;
+
     /* Allocator */
     ecs_allocator_t *allocator;
 } SokolGeometry;
 
+#if SOKOL_INSTANCE_RING
+/* Stream buffer that instance data of all geometry kinds is appended to. 
+ * Sokol rotates the underlying buffers between frames in flight, so data can
+ * be appended while the GPU reads the data of the previous frame. */
+typedef struct SokolInstanceRing {
+    sg_buffer buffer;
+    int32_t size;               /* Size of buffer in bytes */
+} SokolInstanceRing;
+#endif
+
+#if SOKOL_OCCLUSION_CULLING
+/* Instance that is drawn as occluder */
+typedef struct sokol_occluder_t {
+    sokol_geometry_buffers_t *buffers;
+    int32_t slot;
+    float size;                 /* Screen size used to select occluders */
+} sokol_occluder_t;
+
+/* Singleton with occlusion culling state */
+typedef struct SokolOcclusion {
+    sokol_occlusion_buffer_t buffer;
+    sokol_occlusion_desc_t desc;
+    sokol_occlusion_stats_t stats;
+    ecs_vec_t occluders;        /* Occluder candidates (vec<sokol_occluder_t>) */
+} SokolOcclusion;
+#endif
+
+/* Singleton with the camera facing quad that all geometries use to draw
+ * impostors. Set when the renderer creates its resources, and assigned to
+ * geometries that are created after that by CreateGeometryQueries. */
+typedef struct SokolImpostorMesh {
+    sokol_mesh_t mesh;
+} SokolImpostorMesh;
+
 typedef struct SokolGeometryQuery {
     ecs_entity_t component;
     ecs_query_t *parent_query;
     ecs_query_t *solid;
+    ecs_query_t *statics;
+    ecs_query_t *gather;
 } SokolGeometryQuery;
 
-/* Element with material parameters */
-typedef struct {
-    float specular_power;
-    float shininess;
-    float emissive;
-} SokolMaterial;
-
 extern ECS_COMPONENT_DECLARE(SokolGeometry);
 extern ECS_COMPONENT_DECLARE(SokolGeometryQuery);
+extern ECS_COMPONENT_DECLARE(SokolImpostorMesh);
+#if SOKOL_INSTANCE_RING
+extern ECS_COMPONENT_DECLARE(SokolInstanceRing);
+#endif
+#if SOKOL_OCCLUSION_CULLING
+extern ECS_COMPONENT_DECLARE(SokolOcclusion);
+#endif
+
+/* Instance layout, selected by SOKOL_INTERLEAVED_INSTANCES */
+extern const sokol_instance_layout_t sokol_instance_layout;
+
+/* Add instance attributes to pipeline layout. Streams that contain one of the
+ * attributes in the attrs mask are assigned to consecutive vertex buffers,
+ * starting from first_buffer. With SOKOL_ZERO_COPY_TRANSFORMS the scale
+ * attribute is added after the transform attributes. */
+void sokol_instance_pipeline_layout(
+    sg_layout_desc *layout,
+    ecs_flags32_t attrs,
+    int32_t first_buffer,
+    int32_t transform_attr,
+    int32_t color_attr,
+    int32_t material_attr);
+
+/* Bind instance streams, using the same assignment of streams to vertex 
+ * buffers as sokol_instance_pipeline_layout. */
+void sokol_instance_bindings(
+    sg_bindings *bind,
+    const sokol_instance_stream_t *streams,
+    ecs_flags32_t attrs,
+    int32_t first_buffer);
+
+/* Bind instance streams and draw the instances of buffers that are visible in
+ * view, skipping instances that are excluded from pass. Bindings must contain
+ * the geometry buffers of the pass. */
+void sokol_draw_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer);
+
+/* Same as sokol_draw_instances, but only draws the instances that are
+ * excluded from pass. */
+void sokol_draw_excluded_instances(
+    const SokolGeometry *geometry,
+    const sokol_geometry_buffers_t *buffers,
+    int32_t view,
+    int32_t pass,
+    sg_bindings *bind,
+    ecs_flags32_t attrs,
+    int32_t first_buffer);
+
+/* Instance buffers of a geometry that are drawn in a frame */
+typedef struct sokol_draw_batch_t {
+    const SokolGeometry *geometry;
+    const sokol_geometry_buffers_t *buffers;
+    sokol_mesh_t mesh;          /* Geometry buffers to bind */
+    int32_t instance_count;     /* Instances visible to the camera */
+    ecs_flags32_t passes;       /* Passes to draw batch in (1 << SOKOL_PASS_*) */
+    ecs_flags32_t exclude;      /* Passes that some instances are excluded from */
+    uint64_t sort_key;          /* Geometry, depth, buffer kind */
+} sokol_draw_batch_t;
+
+/* Collect instance buffers of geometries matched by query with instances to
+ * draw into the draw list (vec<sokol_draw_batch_t>). The draw list is built
+ * once per frame after culling, and is drawn by all passes. */
+void sokol_build_draw_list(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    ecs_vec_t *draw_list);
+
+#if SOKOL_CULL_INSTANCES
+/* Cull instances of geometries matched by query against the frustum of the
+ * view projection matrix, and upload visible instances to view buffers. The
+ * screen height (in pixels) is used to select levels of detail, and the view
+ * matrix to orient impostors. */
+void sokol_cull_instances(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    int32_t view,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float screen_height);
+
+/* Find shadow casters for the shadow view. Casters are culled against the
+ * light volume, extended toward the light, and are dropped if their shadow
+ * (swept along the light direction) can't reach the camera frustum. */
+void sokol_cull_shadow_casters(
+    ecs_world_t *world,
+    ecs_query_t *query,
+    mat4 light_mat_vp,
+    mat4 camera_mat_vp,
+    vec3 light_dir);
+#endif
 
 /* Initialize static resources for geometry rendering */
 void sokol_init_geometry(
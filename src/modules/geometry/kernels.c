@@ -0,0 +1,773 @@
+#include "kernels.h"
+#include <float.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SOKOL_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SOKOL_TARGET(isa)
+#else
+#define SOKOL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SOKOL_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void (*sokol_copy_scale_kernel_t)(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+typedef void (*sokol_copy_scale_3x4_kernel_t)(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+typedef int32_t (*sokol_cull_spheres_kernel_t)(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes);
+
+typedef void (*sokol_pack_colors_kernel_t)(
+    void *dst,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride);
+
+static
+const char *sokol_kernel_name = "scalar";
+
+// Scale factors that map color & material values to unorm ranges
+#define SOKOL_PACK_COLOR (255.0f)
+#define SOKOL_PACK_SPECULAR (255.0f / (float)SOKOL_PACKED_SPECULAR_MAX)
+#define SOKOL_PACK_SHININESS (255.0f / (float)SOKOL_PACKED_SHININESS_MAX)
+#define SOKOL_PACK_EMISSIVE (65535.0f / (float)SOKOL_PACKED_EMISSIVE_MAX)
+
+#define SOKOL_SCALE(scale, stride, i)\
+    ((const float*)ECS_OFFSET(scale, (stride) * (i)))
+
+static
+void sokol_copy_scale_scalar(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    int32_t i, r;
+    for (i = 0; i < count; i ++) {
+        const float *s = SOKOL_SCALE(scale, scale_stride, i);
+        float sx = s[0], sy = s[1], sz = dim > 2 ? s[2] : 1.0f;
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        for (r = 0; r < 4; r ++) {
+            d[r] = src[i][0][r] * sx;
+            d[4 + r] = src[i][1][r] * sy;
+            d[8 + r] = src[i][2][r] * sz;
+            d[12 + r] = src[i][3][r];
+        }
+    }
+}
+
+static
+void sokol_copy_scale_3x4_scalar(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    int32_t i, r;
+    for (i = 0; i < count; i ++) {
+        const float *s = SOKOL_SCALE(scale, scale_stride, i);
+        float sx = s[0], sy = s[1], sz = dim > 2 ? s[2] : 1.0f;
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        for (r = 0; r < 3; r ++) {
+            d[r * 4] = src[i][0][r] * sx;
+            d[r * 4 + 1] = src[i][1][r] * sy;
+            d[r * 4 + 2] = src[i][2][r] * sz;
+            d[r * 4 + 3] = src[i][3][r];
+        }
+    }
+}
+
+static
+uint32_t sokol_pack_unorm(
+    float v,
+    float scale,
+    uint32_t max)
+{
+    v = v * scale + 0.5f;
+    if (!(v > 0.0f)) {
+        return 0;
+    }
+    if (v >= (float)max) {
+        return max;
+    }
+    return (uint32_t)v;
+}
+
+static
+void sokol_pack_colors_scalar(
+    void *dst_ptr,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    uint8_t *dst = dst_ptr;
+    int32_t i;
+    for (i = 0; i < count; i ++, dst += dst_stride) {
+        const float *c = SOKOL_SCALE(color, color_stride, i);
+        const float *s = SOKOL_SCALE(specular, specular_stride, i);
+        const float *e = SOKOL_SCALE(emissive, emissive_stride, i);
+        uint32_t e16 = sokol_pack_unorm(e[0], SOKOL_PACK_EMISSIVE, 65535);
+        dst[0] = (uint8_t)sokol_pack_unorm(c[0], SOKOL_PACK_COLOR, 255);
+        dst[1] = (uint8_t)sokol_pack_unorm(c[1], SOKOL_PACK_COLOR, 255);
+        dst[2] = (uint8_t)sokol_pack_unorm(c[2], SOKOL_PACK_COLOR, 255);
+        dst[3] = 255;
+        dst[4] = (uint8_t)sokol_pack_unorm(s[0], SOKOL_PACK_SPECULAR, 255);
+        dst[5] = (uint8_t)sokol_pack_unorm(s[1], SOKOL_PACK_SHININESS, 255);
+        dst[6] = (uint8_t)(e16 & 0xFF);
+        dst[7] = (uint8_t)(e16 >> 8);
+    }
+}
+
+static
+int32_t sokol_cull_spheres_scalar(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    int32_t i, p, result = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+
+        for (p = 0; p < 6; p ++) {
+            const float *pl = planes[p];
+            float d = pl[0] * s[0] + pl[1] * s[1] + pl[2] * s[2] + pl[3];
+            if (d < -s[3]) {
+                break;
+            }
+        }
+
+        if (p == 6) {
+            visible[result ++] = i;
+        }
+    }
+    return result;
+}
+
+#ifdef SOKOL_KERNELS_X86
+
+// Planes are transposed into two groups of 4, so that a sphere is tested 
+// against all planes with two multiply-adds per component. The last two lanes
+// are padding planes that never cull.
+SOKOL_TARGET("sse2")
+static
+int32_t sokol_cull_spheres_sse2(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    const vec4 *p = planes;
+    __m128 px0 = _mm_setr_ps(p[0][0], p[1][0], p[2][0], p[3][0]);
+    __m128 py0 = _mm_setr_ps(p[0][1], p[1][1], p[2][1], p[3][1]);
+    __m128 pz0 = _mm_setr_ps(p[0][2], p[1][2], p[2][2], p[3][2]);
+    __m128 pd0 = _mm_setr_ps(p[0][3], p[1][3], p[2][3], p[3][3]);
+    __m128 px1 = _mm_setr_ps(p[4][0], p[5][0], 0.0f, 0.0f);
+    __m128 py1 = _mm_setr_ps(p[4][1], p[5][1], 0.0f, 0.0f);
+    __m128 pz1 = _mm_setr_ps(p[4][2], p[5][2], 0.0f, 0.0f);
+    __m128 pd1 = _mm_setr_ps(p[4][3], p[5][3], FLT_MAX, FLT_MAX);
+
+    int32_t i, result = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+
+        __m128 x = _mm_set1_ps(s[0]);
+        __m128 y = _mm_set1_ps(s[1]);
+        __m128 z = _mm_set1_ps(s[2]);
+        __m128 r = _mm_set1_ps(-s[3]);
+
+        __m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px0, x), 
+            _mm_mul_ps(py0, y)), _mm_add_ps(_mm_mul_ps(pz0, z), pd0));
+        __m128 d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px1, x), 
+            _mm_mul_ps(py1, y)), _mm_add_ps(_mm_mul_ps(pz1, z), pd1));
+        __m128 outside = _mm_or_ps(_mm_cmplt_ps(d0, r), _mm_cmplt_ps(d1, r));
+
+        if (!_mm_movemask_ps(outside)) {
+            visible[result ++] = i;
+        }
+    }
+    return result;
+}
+
+// SSE2 is part of the x86-64 baseline, a matrix column fits in a register.
+SOKOL_TARGET("sse2")
+static
+void sokol_copy_scale_sse2(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    __m128 sx = _mm_set1_ps(s[0]);
+    __m128 sy = _mm_set1_ps(s[1]);
+    __m128 sz = _mm_set1_ps(dim > 2 ? s[2] : 1.0f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            sx = _mm_set1_ps(s[0]);
+            sy = _mm_set1_ps(s[1]);
+            if (dim > 2) {
+                sz = _mm_set1_ps(s[2]);
+            }
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        __m128 c0 = _mm_loadu_ps(&m[0]);
+        __m128 c1 = _mm_loadu_ps(&m[4]);
+        __m128 c2 = _mm_loadu_ps(&m[8]);
+        __m128 c3 = _mm_loadu_ps(&m[12]);
+        _mm_storeu_ps(&d[0], _mm_mul_ps(c0, sx));
+        _mm_storeu_ps(&d[4], _mm_mul_ps(c1, sy));
+        _mm_storeu_ps(&d[8], _mm_mul_ps(c2, sz));
+        _mm_storeu_ps(&d[12], c3);
+    }
+}
+
+// Transposes matrix in registers, after which the scale is a single multiply
+// per row. The AVX2 kernel is not used for this layout, as rows are 16 bytes.
+SOKOL_TARGET("sse2")
+static
+void sokol_copy_scale_3x4_sse2(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    __m128 sv = _mm_setr_ps(s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            sv = _mm_setr_ps(s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f);
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        __m128 r0 = _mm_loadu_ps(&m[0]);
+        __m128 r1 = _mm_loadu_ps(&m[4]);
+        __m128 r2 = _mm_loadu_ps(&m[8]);
+        __m128 r3 = _mm_loadu_ps(&m[12]);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(&d[0], _mm_mul_ps(r0, sv));
+        _mm_storeu_ps(&d[4], _mm_mul_ps(r1, sv));
+        _mm_storeu_ps(&d[8], _mm_mul_ps(r2, sv));
+    }
+}
+
+// Converts color and material of an instance in two registers, and narrows
+// the results to the 8 bytes of the packed instance format.
+SOKOL_TARGET("sse2")
+static
+void sokol_pack_colors_sse2(
+    void *dst_ptr,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    uint8_t *dst = dst_ptr;
+    const __m128 c_scale = _mm_set1_ps(SOKOL_PACK_COLOR);
+    const __m128 c_max = _mm_set1_ps(255.0f);
+    const __m128 m_scale = _mm_setr_ps(
+        SOKOL_PACK_SPECULAR, SOKOL_PACK_SHININESS, SOKOL_PACK_EMISSIVE, 0.0f);
+    const __m128 m_max = _mm_setr_ps(255.0f, 255.0f, 65535.0f, 0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i lo_mask = _mm_setr_epi32(0xFF, 0xFF, 0xFF, 0);
+    const __m128i hi_mask = _mm_setr_epi32(0, 0, 0, 0xFF);
+
+    int32_t i;
+    for (i = 0; i < count; i ++, dst += dst_stride) {
+        const float *c = SOKOL_SCALE(color, color_stride, i);
+        const float *s = SOKOL_SCALE(specular, specular_stride, i);
+        const float *e = SOKOL_SCALE(emissive, emissive_stride, i);
+
+        __m128 cv = _mm_setr_ps(c[0], c[1], c[2], 1.0f);
+        __m128 mv = _mm_setr_ps(s[0], s[1], e[0], 0.0f);
+        cv = _mm_min_ps(_mm_max_ps(_mm_mul_ps(cv, c_scale), zero), c_max);
+        mv = _mm_min_ps(_mm_max_ps(_mm_mul_ps(mv, m_scale), zero), m_max);
+
+        // Lanes: r, g, b, a and specular, shininess, emissive (16 bit), 0
+        __m128i ci = _mm_cvttps_epi32(_mm_add_ps(cv, half));
+        __m128i mi = _mm_cvttps_epi32(_mm_add_ps(mv, half));
+
+        // Split 16 bit emissive into low byte (lane 2) and high byte (lane 3)
+        __m128i hi = _mm_shuffle_epi32(_mm_srli_epi32(mi, 8), 
+            _MM_SHUFFLE(2, 2, 2, 2));
+        mi = _mm_or_si128(_mm_and_si128(mi, lo_mask), 
+            _mm_and_si128(hi, hi_mask));
+
+        __m128i packed = _mm_packs_epi32(ci, mi);
+        packed = _mm_packus_epi16(packed, packed);
+        _mm_storel_epi64((__m128i*)dst, packed);
+    }
+}
+
+// AVX2 kernel processes two matrix columns per register
+SOKOL_TARGET("avx2")
+static
+void sokol_copy_scale_avx2(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    __m256 sxy = _mm256_setr_ps(s[0], s[0], s[0], s[0], s[1], s[1], s[1], s[1]);
+    float z = dim > 2 ? s[2] : 1.0f;
+    __m256 sz1 = _mm256_setr_ps(z, z, z, z, 1.0f, 1.0f, 1.0f, 1.0f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            __m128 x = _mm_set1_ps(s[0]);
+            __m128 y = _mm_set1_ps(s[1]);
+            sxy = _mm256_insertf128_ps(_mm256_castps128_ps256(x), y, 1);
+            if (dim > 2) {
+                __m128 zz = _mm_set1_ps(s[2]);
+                sz1 = _mm256_insertf128_ps(_mm256_castps128_ps256(zz),
+                    _mm_set1_ps(1.0f), 1);
+            }
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        __m256 c01 = _mm256_loadu_ps(&m[0]);
+        __m256 c23 = _mm256_loadu_ps(&m[8]);
+        _mm256_storeu_ps(&d[0], _mm256_mul_ps(c01, sxy));
+        _mm256_storeu_ps(&d[8], _mm256_mul_ps(c23, sz1));
+    }
+}
+
+static
+bool sokol_cpu_has_avx2(void) {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return false;
+    }
+
+    // Check that OS saves AVX registers
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || ((_xgetbv(0) & 6) != 6)) {
+        return false;
+    }
+
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#ifdef SOKOL_KERNELS_NEON
+
+static
+void sokol_copy_scale_neon(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    float sx = s[0], sy = s[1], sz = dim > 2 ? s[2] : 1.0f;
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            sx = s[0];
+            sy = s[1];
+            if (dim > 2) {
+                sz = s[2];
+            }
+        }
+
+        const float *m = src[i][0];
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        float32x4_t c0 = vld1q_f32(&m[0]);
+        float32x4_t c1 = vld1q_f32(&m[4]);
+        float32x4_t c2 = vld1q_f32(&m[8]);
+        float32x4_t c3 = vld1q_f32(&m[12]);
+        vst1q_f32(&d[0], vmulq_n_f32(c0, sx));
+        vst1q_f32(&d[4], vmulq_n_f32(c1, sy));
+        vst1q_f32(&d[8], vmulq_n_f32(c2, sz));
+        vst1q_f32(&d[12], c3);
+    }
+}
+
+static
+void sokol_pack_colors_neon(
+    void *dst_ptr,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    uint8_t *dst = dst_ptr;
+    const float32x4_t c_scale = vdupq_n_f32(SOKOL_PACK_COLOR);
+    const float32x4_t c_max = vdupq_n_f32(255.0f);
+    const float32x4_t m_scale = { 
+        SOKOL_PACK_SPECULAR, SOKOL_PACK_SHININESS, SOKOL_PACK_EMISSIVE, 0.0f };
+    const float32x4_t m_max = { 255.0f, 255.0f, 65535.0f, 0.0f };
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+
+    int32_t i;
+    for (i = 0; i < count; i ++, dst += dst_stride) {
+        const float *c = SOKOL_SCALE(color, color_stride, i);
+        const float *s = SOKOL_SCALE(specular, specular_stride, i);
+        const float *e = SOKOL_SCALE(emissive, emissive_stride, i);
+
+        float32x4_t cv = { c[0], c[1], c[2], 1.0f };
+        float32x4_t mv = { s[0], s[1], e[0], 0.0f };
+        cv = vminq_f32(vmaxq_f32(vmulq_f32(cv, c_scale), zero), c_max);
+        mv = vminq_f32(vmaxq_f32(vmulq_f32(mv, m_scale), zero), m_max);
+
+        uint32x4_t ci = vcvtq_u32_f32(vaddq_f32(cv, half));
+        uint32x4_t mi = vcvtq_u32_f32(vaddq_f32(mv, half));
+
+        // Split 16 bit emissive into low byte (lane 2) and high byte (lane 3)
+        uint32_t e16 = vgetq_lane_u32(mi, 2);
+        mi = vsetq_lane_u32(e16 & 0xFF, mi, 2);
+        mi = vsetq_lane_u32(e16 >> 8, mi, 3);
+
+        uint16x8_t packed = vcombine_u16(vmovn_u32(ci), vmovn_u32(mi));
+        vst1_u8(dst, vmovn_u16(packed));
+    }
+}
+
+// Same plane layout as the SSE2 kernel
+static
+int32_t sokol_cull_spheres_neon(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    const vec4 *p = planes;
+    float32x4_t px0 = { p[0][0], p[1][0], p[2][0], p[3][0] };
+    float32x4_t py0 = { p[0][1], p[1][1], p[2][1], p[3][1] };
+    float32x4_t pz0 = { p[0][2], p[1][2], p[2][2], p[3][2] };
+    float32x4_t pd0 = { p[0][3], p[1][3], p[2][3], p[3][3] };
+    float32x4_t px1 = { p[4][0], p[5][0], 0.0f, 0.0f };
+    float32x4_t py1 = { p[4][1], p[5][1], 0.0f, 0.0f };
+    float32x4_t pz1 = { p[4][2], p[5][2], 0.0f, 0.0f };
+    float32x4_t pd1 = { p[4][3], p[5][3], FLT_MAX, FLT_MAX };
+
+    int32_t i, result = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+
+        float32x4_t r = vdupq_n_f32(-s[3]);
+        float32x4_t d0 = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(
+            pd0, px0, s[0]), py0, s[1]), pz0, s[2]);
+        float32x4_t d1 = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(
+            pd1, px1, s[0]), py1, s[1]), pz1, s[2]);
+        uint32x4_t outside = vorrq_u32(vcltq_f32(d0, r), vcltq_f32(d1, r));
+        uint32x2_t any = vorr_u32(vget_low_u32(outside), vget_high_u32(outside));
+
+        if (!(vget_lane_u32(any, 0) | vget_lane_u32(any, 1))) {
+            visible[result ++] = i;
+        }
+    }
+    return result;
+}
+
+// Interleaved load transposes the matrix, so each row is a single multiply
+static
+void sokol_copy_scale_3x4_neon(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    const float *s = scale;
+    float32x4_t sv = { s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f };
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        if (scale_stride) {
+            s = SOKOL_SCALE(scale, scale_stride, i);
+            float32x4_t v = { s[0], s[1], dim > 2 ? s[2] : 1.0f, 1.0f };
+            sv = v;
+        }
+
+        float32x4x4_t rows = vld4q_f32(src[i][0]);
+        float *d = ECS_ELEM(dst, dst_stride, i);
+        vst1q_f32(&d[0], vmulq_f32(rows.val[0], sv));
+        vst1q_f32(&d[4], vmulq_f32(rows.val[1], sv));
+        vst1q_f32(&d[8], vmulq_f32(rows.val[2], sv));
+    }
+}
+
+#endif
+
+static
+sokol_copy_scale_kernel_t sokol_copy_scale_kernel = sokol_copy_scale_scalar;
+
+static
+sokol_copy_scale_3x4_kernel_t sokol_copy_scale_3x4_kernel = 
+    sokol_copy_scale_3x4_scalar;
+
+static
+sokol_pack_colors_kernel_t sokol_pack_colors_kernel = sokol_pack_colors_scalar;
+
+static
+sokol_cull_spheres_kernel_t sokol_cull_spheres_kernel = 
+    sokol_cull_spheres_scalar;
+
+void sokol_init_kernels(void) {
+#if defined(SOKOL_KERNELS_X86)
+    if (sokol_cpu_has_avx2()) {
+        sokol_copy_scale_kernel = sokol_copy_scale_avx2;
+        sokol_kernel_name = "avx2";
+    } else {
+        sokol_copy_scale_kernel = sokol_copy_scale_sse2;
+        sokol_kernel_name = "sse2";
+    }
+    sokol_copy_scale_3x4_kernel = sokol_copy_scale_3x4_sse2;
+    sokol_pack_colors_kernel = sokol_pack_colors_sse2;
+    sokol_cull_spheres_kernel = sokol_cull_spheres_sse2;
+#elif defined(SOKOL_KERNELS_NEON)
+    sokol_copy_scale_kernel = sokol_copy_scale_neon;
+    sokol_copy_scale_3x4_kernel = sokol_copy_scale_3x4_neon;
+    sokol_pack_colors_kernel = sokol_pack_colors_neon;
+    sokol_cull_spheres_kernel = sokol_cull_spheres_neon;
+    sokol_kernel_name = "neon";
+#endif
+    ecs_trace("sokol: using %s geometry kernels", sokol_kernel_name);
+}
+
+void sokol_copy_scale_transforms(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    ecs_assert(dim == 2 || dim == 3, ECS_INVALID_PARAMETER, NULL);
+    sokol_copy_scale_kernel(dst, dst_stride, src, count, scale, scale_stride, dim);
+}
+
+void sokol_copy_scale_transforms_3x4(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    ecs_assert(dim == 2 || dim == 3, ECS_INVALID_PARAMETER, NULL);
+    sokol_copy_scale_3x4_kernel(dst, dst_stride, src, count, scale, scale_stride, dim);
+}
+
+void sokol_copy_scale_instances(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+#if SOKOL_COMPACT_TRANSFORMS
+    sokol_copy_scale_transforms_3x4(
+        dst, dst_stride, src, count, scale, scale_stride, dim);
+#else
+    sokol_copy_scale_transforms(
+        dst, dst_stride, src, count, scale, scale_stride, dim);
+#endif
+}
+
+void sokol_scale_transforms(
+    mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    sokol_copy_scale_transforms(transforms[0][0], ECS_SIZEOF(mat4), 
+        transforms, count, scale, scale_stride, dim);
+}
+
+#if SOKOL_PACKED_INSTANCE_DATA
+void sokol_pack_instance_colors(
+    void *dst,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride)
+{
+    sokol_pack_colors_kernel(dst, dst_stride, count, color, color_stride, 
+        specular, specular_stride, emissive, emissive_stride);
+}
+#endif
+
+void sokol_compute_bounds(
+    vec4 *dst,
+    const mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim)
+{
+    ecs_assert(dim == 2 || dim == 3, ECS_INVALID_PARAMETER, NULL);
+
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        const float *s = SOKOL_SCALE(scale, scale_stride, i);
+        const float *m = transforms[i][0];
+        float sz = dim > 2 ? s[2] : 0.0f;
+
+        // Half of the diagonal of the scaled & rotated unit box
+        float x2 = (m[0] * m[0] + m[1] * m[1] + m[2] * m[2]) * s[0] * s[0];
+        float y2 = (m[4] * m[4] + m[5] * m[5] + m[6] * m[6]) * s[1] * s[1];
+        float z2 = (m[8] * m[8] + m[9] * m[9] + m[10] * m[10]) * sz * sz;
+
+        dst[i][0] = m[12];
+        dst[i][1] = m[13];
+        dst[i][2] = m[14];
+        dst[i][3] = 0.5f * sqrtf(x2 + y2 + z2);
+    }
+}
+
+void sokol_merge_bounds(
+    vec4 dst,
+    const vec4 *spheres,
+    int32_t count)
+{
+    vec3 min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    vec3 max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    int32_t i, c;
+
+    // Center the sphere on the bounding box of all spheres
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+        for (c = 0; c < 3; c ++) {
+            min[c] = glm_min(min[c], s[c] - s[3]);
+            max[c] = glm_max(max[c], s[c] + s[3]);
+        }
+    }
+
+    if (min[0] > max[0]) {
+        glm_vec4_zero(dst);
+        return;
+    }
+
+    glm_vec3_center(min, max, dst);
+
+    float radius = 0;
+    for (i = 0; i < count; i ++) {
+        const float *s = spheres[i];
+        if (!(s[3] > 0)) {
+            continue;
+        }
+        radius = glm_max(radius, glm_vec3_distance(dst, (float*)s) + s[3]);
+    }
+
+    dst[3] = radius;
+}
+
+int32_t sokol_cull_spheres(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes)
+{
+    return sokol_cull_spheres_kernel(visible, spheres, count, planes);
+}
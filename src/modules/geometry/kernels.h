@@ -0,0 +1,106 @@
+#ifndef SOKOL_MODULES_GEOMETRY_KERNELS_H
+#define SOKOL_MODULES_GEOMETRY_KERNELS_H
+
+#include "../../types.h"
+
+/* Copy transform matrices to dst while scaling their x, y and z axes. This
+ * does the same as a memcpy followed by a glm_scale for each matrix, in a
+ * single pass over memory. Matrix i is stored at dst + i * dst_stride (in 
+ * bytes), which allows for writing to interleaved instance data.
+ *
+ * The scale vector for matrix i is read from scale + i * scale_stride (in
+ * bytes). A scale_stride of 0 applies the same scale to all matrices. The
+ * dim parameter specifies whether scale vectors have 2 (x, y) or 3 (x, y, z)
+ * elements. For 2 elements, the z axis is not scaled.
+ *
+ * dst and src may point to the same matrices. Kernels use SIMD instructions
+ * when supported by the CPU, which is detected by sokol_init_kernels. */
+void sokol_copy_scale_transforms(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Same as sokol_copy_scale_transforms, but stores the first three rows of
+ * each matrix in dst, which is the compact 3x4 affine instance layout. */
+void sokol_copy_scale_transforms_3x4(
+    float *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Copy & scale transforms to instance buffer, using the instance layout that
+ * is selected by SOKOL_COMPACT_TRANSFORMS. */
+void sokol_copy_scale_instances(
+    void *dst,
+    ecs_size_t dst_stride,
+    const mat4 *src,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Scale transform matrices in place */
+void sokol_scale_transforms(
+    mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+#if SOKOL_PACKED_INSTANCE_DATA
+/* Convert float colors and materials to the packed instance format. Each
+ * input is read from its pointer + i * stride (in bytes), where a stride of 0
+ * uses the same value for all instances. The specular pointer points to the
+ * specular power, which must be followed by the shininess. */
+void sokol_pack_instance_colors(
+    void *dst,
+    ecs_size_t dst_stride,
+    int32_t count,
+    const float *color,
+    ecs_size_t color_stride,
+    const float *specular,
+    ecs_size_t specular_stride,
+    const float *emissive,
+    ecs_size_t emissive_stride);
+#endif
+
+/* Compute a bounding sphere (center, radius) for each transform. Scale is 
+ * passed in the same way as for sokol_copy_scale_transforms, and is applied to
+ * a unit sized geometry centered on the origin. For 2 dimensional geometry
+ * the z axis has no extent. */
+void sokol_compute_bounds(
+    vec4 *dst,
+    const mat4 *transforms,
+    int32_t count,
+    const float *scale,
+    ecs_size_t scale_stride,
+    int32_t dim);
+
+/* Compute a bounding sphere that encloses all spheres with a radius larger than
+ * zero. If there are no such spheres, the radius of dst is set to zero. */
+void sokol_merge_bounds(
+    vec4 dst,
+    const vec4 *spheres,
+    int32_t count);
+
+/* Test bounding spheres against 6 frustum planes, and write the indices of
+ * spheres that intersect with the frustum to visible. Planes must be 
+ * normalized and point inwards. Spheres with a radius of zero or less are 
+ * never visible. Returns the number of visible spheres. */
+int32_t sokol_cull_spheres(
+    int32_t *visible,
+    const vec4 *spheres,
+    int32_t count,
+    const vec4 *planes);
+
+/* Select kernels for CPU. Must be called before kernels are used. */
+void sokol_init_kernels(void);
+
+#endif
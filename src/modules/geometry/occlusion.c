@@ -0,0 +1,360 @@
+#include "occlusion.h"
+#include <float.h>
+
+#if SOKOL_OCCLUSION_CULLING
+
+/* Vertices with a w smaller than this are considered behind the camera */
+#define SOKOL_OCCLUSION_NEAR (0.0001f)
+
+/* Maximum number of polygon vertices, which is the vertex count of a box */
+#define SOKOL_OCCLUSION_POLYGON_MAX (8)
+
+static const float sokol_occlusion_box_vertices[8][3] = {
+    {-0.5f, -0.5f, -0.5f}, { 0.5f, -0.5f, -0.5f},
+    { 0.5f,  0.5f, -0.5f}, {-0.5f,  0.5f, -0.5f},
+    {-0.5f, -0.5f,  0.5f}, { 0.5f, -0.5f,  0.5f},
+    { 0.5f,  0.5f,  0.5f}, {-0.5f,  0.5f,  0.5f}
+};
+
+/* Faces of the box, counter clockwise when seen from outside of the box */
+static const int32_t sokol_occlusion_box_faces[6][4] = {
+    {0, 3, 2, 1}, /* Back */
+    {4, 5, 6, 7}, /* Front */
+    {0, 4, 7, 3}, /* Left */
+    {5, 1, 2, 6}, /* Right */
+    {0, 1, 5, 4}, /* Bottom */
+    {7, 6, 2, 3}  /* Top */
+};
+
+void sokol_occlusion_init(
+    sokol_occlusion_buffer_t *buf,
+    int32_t width,
+    int32_t height)
+{
+    ecs_assert(!(width % SOKOL_OCCLUSION_TILE_SIZE),
+        ECS_INVALID_PARAMETER, NULL);
+    ecs_assert(!(height % SOKOL_OCCLUSION_TILE_SIZE),
+        ECS_INVALID_PARAMETER, NULL);
+
+    buf->width = width;
+    buf->height = height;
+    buf->tile_cols = width / SOKOL_OCCLUSION_TILE_SIZE;
+    buf->tile_rows = height / SOKOL_OCCLUSION_TILE_SIZE;
+    buf->depth = ecs_os_malloc_n(float, width * height);
+    buf->tiles = ecs_os_malloc_n(float, buf->tile_cols * buf->tile_rows);
+    glm_mat4_identity(buf->mat_vp);
+}
+
+void sokol_occlusion_fini(
+    sokol_occlusion_buffer_t *buf)
+{
+    ecs_os_free(buf->depth);
+    ecs_os_free(buf->tiles);
+}
+
+void sokol_occlusion_clear(
+    sokol_occlusion_buffer_t *buf,
+    mat4 mat_vp)
+{
+    int32_t i, count = buf->width * buf->height;
+    for (i = 0; i < count; i ++) {
+        buf->depth[i] = 1.0f;
+    }
+    glm_mat4_copy(mat_vp, buf->mat_vp);
+}
+
+// Edge function of a and b, evaluated for p. Positive if p is left of a-b.
+static
+float sokol_occlusion_edge(
+    const float *a,
+    const float *b,
+    float px,
+    float py)
+{
+    return (b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0]);
+}
+
+// Draw convex counter clockwise polygon in pixel coordinates with a constant
+// depth. Only pixels that are fully covered by the polygon are drawn, so that
+// occluders never hide what is visible through the part of a pixel that they
+// do not cover.
+static
+void sokol_occlusion_draw_polygon(
+    sokol_occlusion_buffer_t *buf,
+    float (*s)[2],
+    int32_t count,
+    float depth)
+{
+    float fx0 = s[0][0], fx1 = s[0][0], fy0 = s[0][1], fy1 = s[0][1];
+    int32_t i;
+    for (i = 1; i < count; i ++) {
+        fx0 = glm_min(fx0, s[i][0]); fx1 = glm_max(fx1, s[i][0]);
+        fy0 = glm_min(fy0, s[i][1]); fy1 = glm_max(fy1, s[i][1]);
+    }
+
+    int32_t x0 = (int32_t)glm_max(floorf(fx0), 0);
+    int32_t x1 = (int32_t)glm_min(ceilf(fx1), (float)buf->width);
+    int32_t y0 = (int32_t)glm_max(floorf(fy0), 0);
+    int32_t y1 = (int32_t)glm_min(ceilf(fy1), (float)buf->height);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    // Edge functions are evaluated at pixel centers and stepped per pixel. A
+    // pixel is fully covered if all of its corners are inside, which is the
+    // case if the edge functions at its center exceed half of their steps.
+    float px = (float)x0 + 0.5f, py = (float)y0 + 0.5f;
+    float e[SOKOL_OCCLUSION_POLYGON_MAX];
+    float dx[SOKOL_OCCLUSION_POLYGON_MAX], dy[SOKOL_OCCLUSION_POLYGON_MAX];
+    for (i = 0; i < count; i ++) {
+        const float *a = s[i], *b = s[(i + 1) % count];
+        dx[i] = -(b[1] - a[1]);
+        dy[i] = b[0] - a[0];
+        e[i] = sokol_occlusion_edge(a, b, px, py) -
+            0.5f * (fabsf(dx[i]) + fabsf(dy[i]));
+    }
+
+    int32_t x, y;
+    for (y = y0; y < y1; y ++) {
+        float *row = &buf->depth[y * buf->width];
+        for (x = x0; x < x1; x ++) {
+            bool inside = true;
+            for (i = 0; i < count; i ++) {
+                inside &= (e[i] + dx[i] * (float)(x - x0)) >= 0;
+            }
+            float d = row[x];
+            row[x] = (inside && depth < d) ? depth : d;
+        }
+        for (i = 0; i < count; i ++) {
+            e[i] += dy[i];
+        }
+    }
+}
+
+void sokol_occlusion_draw_box(
+    sokol_occlusion_buffer_t *buf,
+    mat4 transform)
+{
+    mat4 mat_mvp;
+    float s[8][2], d[8], depth = 0;
+    int32_t i, j;
+
+    // Project to pixel coordinates. Boxes that cross the near plane are
+    // skipped, which removes occluders and so remains conservative.
+    glm_mat4_mul(buf->mat_vp, transform, mat_mvp);
+    for (i = 0; i < 8; i ++) {
+        vec4 p = {
+            sokol_occlusion_box_vertices[i][0],
+            sokol_occlusion_box_vertices[i][1],
+            sokol_occlusion_box_vertices[i][2],
+            1.0f
+        }, c;
+        glm_mat4_mulv(mat_mvp, p, c);
+        if (c[3] < SOKOL_OCCLUSION_NEAR) {
+            return;
+        }
+        s[i][0] = (c[0] / c[3] * 0.5f + 0.5f) * (float)buf->width;
+        s[i][1] = (c[1] / c[3] * 0.5f + 0.5f) * (float)buf->height;
+        d[i] = c[2] / c[3] * 0.5f + 0.5f;
+    }
+
+    // Faces that face the camera are counter clockwise on screen, or clockwise
+    // if the transform mirrors the box. The box covers its silhouette with at
+    // most the farthest depth of these faces.
+    vec3 cross;
+    glm_vec3_cross(transform[0], transform[1], cross);
+    float det = glm_vec3_dot(cross, transform[2]);
+    if (det == 0) {
+        return;
+    }
+
+    bool visible = false;
+    for (i = 0; i < 6; i ++) {
+        const int32_t *f = sokol_occlusion_box_faces[i];
+        float area = 0;
+        for (j = 0; j < 4; j ++) {
+            const float *a = s[f[j]], *b = s[f[(j + 1) % 4]];
+            area += a[0] * b[1] - b[0] * a[1];
+        }
+        if ((det > 0) ? (area > 0) : (area < 0)) {
+            for (j = 0; j < 4; j ++) {
+                depth = glm_max(depth, d[f[j]]);
+            }
+            visible = true;
+        }
+    }
+
+    if (!visible || depth > 1.0f) {
+        return;
+    }
+
+    // The silhouette is the convex hull of the projected vertices. Drawing it
+    // as a single polygon avoids gaps between faces, where pixels are only
+    // partially covered by each face.
+    for (i = 1; i < 8; i ++) {
+        float p[2] = { s[i][0], s[i][1] };
+        for (j = i; j > 0 && (s[j - 1][0] > p[0] ||
+            (s[j - 1][0] == p[0] && s[j - 1][1] > p[1])); j --)
+        {
+            s[j][0] = s[j - 1][0]; s[j][1] = s[j - 1][1];
+        }
+        s[j][0] = p[0]; s[j][1] = p[1];
+    }
+
+    float hull[16][2];
+    int32_t count = 0, lower;
+    for (i = 0; i < 8; i ++) {
+        while (count >= 2 && sokol_occlusion_edge(
+            hull[count - 2], hull[count - 1], s[i][0], s[i][1]) <= 0)
+        {
+            count --;
+        }
+        hull[count][0] = s[i][0]; hull[count][1] = s[i][1];
+        count ++;
+    }
+    for (i = 6, lower = count + 1; i >= 0; i --) {
+        while (count >= lower && sokol_occlusion_edge(
+            hull[count - 2], hull[count - 1], s[i][0], s[i][1]) <= 0)
+        {
+            count --;
+        }
+        hull[count][0] = s[i][0]; hull[count][1] = s[i][1];
+        count ++;
+    }
+    count --; /* Last vertex is the first */
+
+    if (count >= 3) {
+        sokol_occlusion_draw_polygon(buf, hull, count, depth);
+    }
+}
+
+void sokol_occlusion_draw_triangle(
+    sokol_occlusion_buffer_t *buf,
+    const vec4 v0,
+    const vec4 v1,
+    const vec4 v2)
+{
+    const float *v[3] = { v0, v1, v2 };
+    float s[3][2], depth = 0;
+    int32_t i;
+
+    // Project to pixel coordinates. Triangles that cross the near plane are
+    // skipped, which removes occluders and so remains conservative.
+    for (i = 0; i < 3; i ++) {
+        float w = v[i][3];
+        if (w < SOKOL_OCCLUSION_NEAR) {
+            return;
+        }
+        s[i][0] = (v[i][0] / w * 0.5f + 0.5f) * (float)buf->width;
+        s[i][1] = (v[i][1] / w * 0.5f + 0.5f) * (float)buf->height;
+        depth = glm_max(depth, v[i][2] / w * 0.5f + 0.5f);
+    }
+
+    if (depth > 1.0f) {
+        return;
+    }
+
+    float area = sokol_occlusion_edge(s[0], s[1], s[2][0], s[2][1]);
+    if (area == 0) {
+        return;
+    }
+
+    // Make triangle counter clockwise so edge functions are positive inside
+    if (area < 0) {
+        float tmp[2] = { s[1][0], s[1][1] };
+        s[1][0] = s[2][0]; s[1][1] = s[2][1];
+        s[2][0] = tmp[0]; s[2][1] = tmp[1];
+    }
+
+    sokol_occlusion_draw_polygon(buf, s, 3, depth);
+}
+
+void sokol_occlusion_finish(
+    sokol_occlusion_buffer_t *buf)
+{
+    int32_t tx, ty, x, y;
+    for (ty = 0; ty < buf->tile_rows; ty ++) {
+        for (tx = 0; tx < buf->tile_cols; tx ++) {
+            float depth = 0;
+            for (y = 0; y < SOKOL_OCCLUSION_TILE_SIZE; y ++) {
+                const float *row = &buf->depth[
+                    (ty * SOKOL_OCCLUSION_TILE_SIZE + y) * buf->width +
+                     tx * SOKOL_OCCLUSION_TILE_SIZE];
+                for (x = 0; x < SOKOL_OCCLUSION_TILE_SIZE; x ++) {
+                    depth = glm_max(depth, row[x]);
+                }
+            }
+            buf->tiles[ty * buf->tile_cols + tx] = depth;
+        }
+    }
+}
+
+bool sokol_occlusion_test_box(
+    const sokol_occlusion_buffer_t *buf,
+    const vec3 min,
+    const vec3 max)
+{
+    float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX, depth = 1;
+    int32_t i;
+
+    // Project corners of the box. The rectangle around the projected corners
+    // encloses the box on screen, and the nearest corner is nearest to the
+    // camera.
+    for (i = 0; i < 8; i ++) {
+        vec4 p = {
+            (i & 1) ? max[0] : min[0],
+            (i & 2) ? max[1] : min[1],
+            (i & 4) ? max[2] : min[2],
+            1.0f
+        }, c;
+        glm_mat4_mulv((vec4*)buf->mat_vp, p, c);
+        if (c[3] < SOKOL_OCCLUSION_NEAR) {
+            return true;
+        }
+        float x = c[0] / c[3], y = c[1] / c[3];
+        x0 = glm_min(x0, x); x1 = glm_max(x1, x);
+        y0 = glm_min(y0, y); y1 = glm_max(y1, y);
+        depth = glm_min(depth, c[2] / c[3] * 0.5f + 0.5f);
+    }
+
+    // Boxes outside of the view are left to frustum culling, since there are
+    // no occluders to test them against.
+    if (x1 < -1 || x0 > 1 || y1 < -1 || y0 > 1 || depth >= 1) {
+        return true;
+    }
+
+    float tile_w = (float)(buf->width / buf->tile_cols);
+    float tile_h = (float)(buf->height / buf->tile_rows);
+    int32_t tx0 = (int32_t)floorf((x0 * 0.5f + 0.5f) * (float)buf->width / tile_w);
+    int32_t tx1 = (int32_t)floorf((x1 * 0.5f + 0.5f) * (float)buf->width / tile_w);
+    int32_t ty0 = (int32_t)floorf((y0 * 0.5f + 0.5f) * (float)buf->height / tile_h);
+    int32_t ty1 = (int32_t)floorf((y1 * 0.5f + 0.5f) * (float)buf->height / tile_h);
+    tx0 = glm_imax(tx0, 0); tx1 = glm_imin(tx1, buf->tile_cols - 1);
+    ty0 = glm_imax(ty0, 0); ty1 = glm_imin(ty1, buf->tile_rows - 1);
+
+    // Box is visible if any tile has an occluder behind its nearest point
+    int32_t tx, ty;
+    for (ty = ty0; ty <= ty1; ty ++) {
+        const float *row = &buf->tiles[ty * buf->tile_cols];
+        for (tx = tx0; tx <= tx1; tx ++) {
+            if (row[tx] >= depth) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool sokol_occlusion_test_sphere(
+    const sokol_occlusion_buffer_t *buf,
+    const vec4 sphere)
+{
+    // Test the box around the sphere, which encloses it on screen
+    vec3 min, max;
+    glm_vec3_subs((float*)sphere, sphere[3], min);
+    glm_vec3_adds((float*)sphere, sphere[3], max);
+    return sokol_occlusion_test_box(buf, min, max);
+}
+
+#endif
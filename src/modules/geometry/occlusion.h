@@ -0,0 +1,72 @@
+#ifndef SOKOL_MODULES_GEOMETRY_OCCLUSION_H
+#define SOKOL_MODULES_GEOMETRY_OCCLUSION_H
+
+#include "../../types.h"
+
+#if SOKOL_OCCLUSION_CULLING
+
+/* Low resolution depth buffer with occluders, rasterized on the CPU. Depth is
+ * stored in [0, 1], where pixels without occluders have depth 1. Occluders
+ * only write pixels that they fully cover, with the depth of their farthest
+ * visible vertex, and the depth of a tile is the farthest depth of its pixels,
+ * so tests are conservative. */
+typedef struct sokol_occlusion_buffer_t {
+    float *depth;               /* Depth per pixel */
+    float *tiles;               /* Farthest depth per tile */
+    int32_t width;
+    int32_t height;
+    int32_t tile_cols;
+    int32_t tile_rows;
+    mat4 mat_vp;                /* View projection matrix of frame */
+} sokol_occlusion_buffer_t;
+
+/* Width and height must be multiples of SOKOL_OCCLUSION_TILE_SIZE */
+void sokol_occlusion_init(
+    sokol_occlusion_buffer_t *buf,
+    int32_t width,
+    int32_t height);
+
+void sokol_occlusion_fini(
+    sokol_occlusion_buffer_t *buf);
+
+/* Clear depth, and set view projection matrix for occluders & tests */
+void sokol_occlusion_clear(
+    sokol_occlusion_buffer_t *buf,
+    mat4 mat_vp);
+
+/* Draw unit box centered on the origin, transformed by transform. The
+ * silhouette of the box is drawn with the farthest depth of the faces that face
+ * the camera. Boxes that cross the near plane are not drawn. */
+void sokol_occlusion_draw_box(
+    sokol_occlusion_buffer_t *buf,
+    mat4 transform);
+
+/* Draw triangle with the depth of its farthest vertex. Vertices are in clip
+ * space. Triangles that cross the near plane are not drawn. */
+void sokol_occlusion_draw_triangle(
+    sokol_occlusion_buffer_t *buf,
+    const vec4 v0,
+    const vec4 v1,
+    const vec4 v2);
+
+/* Compute tile depths. Must be called after drawing and before testing. */
+void sokol_occlusion_finish(
+    sokol_occlusion_buffer_t *buf);
+
+/* Test whether an axis aligned box may be visible. Returns false only if the
+ * box is fully behind occluders. Boxes that are partially visible, cross the
+ * near plane or are outside of the view are reported as visible. */
+bool sokol_occlusion_test_box(
+    const sokol_occlusion_buffer_t *buf,
+    const vec3 min,
+    const vec3 max);
+
+/* Test whether a bounding sphere may be visible, by testing its enclosing box.
+ * Returns false only if the sphere is fully behind occluders. */
+bool sokol_occlusion_test_sphere(
+    const sokol_occlusion_buffer_t *buf,
+    const vec4 sphere);
+
+#endif
+
+#endif
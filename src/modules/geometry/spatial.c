@@ -0,0 +1,662 @@
+#include "spatial.h"
+#include "kernels.h"
+#include <float.h>
+
+#if SOKOL_SPATIAL_INDEX
+
+#define SOKOL_SPATIAL_AXIS_BITS (21)
+#define SOKOL_SPATIAL_AXIS_MIN (-(1 << (SOKOL_SPATIAL_AXIS_BITS - 1)))
+#define SOKOL_SPATIAL_AXIS_MAX ((1 << (SOKOL_SPATIAL_AXIS_BITS - 1)) - 1)
+#define SOKOL_SPATIAL_AXIS_MASK ((1 << SOKOL_SPATIAL_AXIS_BITS) - 1)
+
+// Get coordinate of cell that contains value, clamped to the range that can be
+// stored in a key.
+static
+int32_t sokol_spatial_coord(
+    float v)
+{
+    float c = floorf(v / SOKOL_SPATIAL_CELL_SIZE);
+    c = glm_clamp(c, SOKOL_SPATIAL_AXIS_MIN, SOKOL_SPATIAL_AXIS_MAX);
+    return (int32_t)c;
+}
+
+// Get key of cell from its coordinates. Coordinates are packed in 21 bits per
+// axis, so a key can be computed without a lookup.
+static
+ecs_map_key_t sokol_spatial_coords_key(
+    const int32_t *coords)
+{
+    ecs_map_key_t key = 0;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        key = (key << SOKOL_SPATIAL_AXIS_BITS) |
+            (ecs_map_key_t)(coords[i] & SOKOL_SPATIAL_AXIS_MASK);
+    }
+    return key;
+}
+
+// Get key of cell that contains point
+static
+ecs_map_key_t sokol_spatial_key(
+    const float *p,
+    int32_t *coords)
+{
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        coords[i] = sokol_spatial_coord(p[i]);
+    }
+    return sokol_spatial_coords_key(coords);
+}
+
+static
+sokol_spatial_cell_t* sokol_spatial_ensure_cell(
+    sokol_spatial_index_t *index,
+    ecs_map_key_t key,
+    const int32_t *coords)
+{
+    sokol_spatial_cell_t *cell = ecs_map_get_deref(
+        &index->cells, sokol_spatial_cell_t, key);
+    if (cell) {
+        return cell;
+    }
+
+    cell = ecs_map_ensure_alloc_t(&index->cells, sokol_spatial_cell_t, key);
+    ecs_vec_init_t(index->allocator, &cell->spheres, vec4, 0);
+    ecs_vec_init_t(index->allocator, &cell->slots, int32_t, 0);
+    ecs_vec_init_t(index->allocator, &cell->entities, ecs_entity_t, 0);
+
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        cell->bounds[i] = ((float)coords[i] + 0.5f) * SOKOL_SPATIAL_CELL_SIZE;
+    }
+    cell->bounds[3] = 0;
+    return cell;
+}
+
+static
+void sokol_spatial_cell_fini(
+    sokol_spatial_index_t *index,
+    sokol_spatial_cell_t *cell)
+{
+    ecs_vec_fini_t(index->allocator, &cell->spheres, vec4);
+    ecs_vec_fini_t(index->allocator, &cell->slots, int32_t);
+    ecs_vec_fini_t(index->allocator, &cell->entities, ecs_entity_t);
+}
+
+// Grow bounds of cell so that it encloses the sphere. Bounds don't shrink when
+// instances are removed, which keeps them conservative.
+static
+void sokol_spatial_cell_expand(
+    sokol_spatial_cell_t *cell,
+    const vec4 sphere)
+{
+    float radius = glm_vec3_distance(cell->bounds, (float*)sphere) + sphere[3];
+    cell->bounds[3] = glm_max(cell->bounds[3], radius);
+}
+
+// Grow extents of index so that they include an instance in the cell
+static
+void sokol_spatial_grow(
+    sokol_spatial_index_t *index,
+    const int32_t *coords,
+    float radius)
+{
+    int32_t i;
+    if (!index->count) {
+        for (i = 0; i < 3; i ++) {
+            index->cell_min[i] = index->cell_max[i] = coords[i];
+        }
+        index->max_radius = radius;
+        return;
+    }
+
+    for (i = 0; i < 3; i ++) {
+        index->cell_min[i] = glm_imin(index->cell_min[i], coords[i]);
+        index->cell_max[i] = glm_imax(index->cell_max[i], coords[i]);
+    }
+    index->max_radius = glm_max(index->max_radius, radius);
+}
+
+static
+void sokol_spatial_remove_slot(
+    sokol_spatial_index_t *index,
+    int32_t slot)
+{
+    sokol_spatial_loc_t *loc = ecs_vec_get_t(
+        &index->locations, sokol_spatial_loc_t, slot);
+    if (loc->index == -1) {
+        return;
+    }
+
+    sokol_spatial_cell_t *cell = ecs_map_get_deref(
+        &index->cells, sokol_spatial_cell_t, loc->cell);
+    ecs_assert(cell != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    int32_t last = ecs_vec_count(&cell->slots) - 1;
+    if (!last) {
+        sokol_spatial_cell_fini(index, cell);
+        ecs_map_remove_free(&index->cells, loc->cell);
+    } else {
+        // Last instance is moved into the slot of the removed instance
+        int32_t moved = *ecs_vec_last_t(&cell->slots, int32_t);
+        ecs_vec_get_t(&index->locations, sokol_spatial_loc_t, moved)->index =
+            loc->index;
+        ecs_vec_remove_t(&cell->spheres, vec4, loc->index);
+        ecs_vec_remove_t(&cell->slots, int32_t, loc->index);
+        ecs_vec_remove_t(&cell->entities, ecs_entity_t, loc->index);
+    }
+
+    loc->index = -1;
+    index->count --;
+}
+
+void sokol_spatial_init(
+    sokol_spatial_index_t *index,
+    ecs_allocator_t *a)
+{
+    index->allocator = a;
+    ecs_map_init(&index->cells, a);
+    ecs_vec_init_t(a, &index->locations, sokol_spatial_loc_t, 0);
+    index->count = 0;
+
+    // Extents are initialized when the first instance is added
+    index->max_radius = 0;
+}
+
+void sokol_spatial_fini(
+    sokol_spatial_index_t *index)
+{
+    ecs_map_iter_t mit = ecs_map_iter(&index->cells);
+    while (ecs_map_next(&mit)) {
+        sokol_spatial_cell_t *cell = ecs_map_ptr(&mit);
+        sokol_spatial_cell_fini(index, cell);
+        ecs_os_free(cell);
+    }
+    ecs_map_fini(&index->cells);
+    ecs_vec_fini_t(index->allocator, &index->locations, sokol_spatial_loc_t);
+}
+
+void sokol_spatial_resize(
+    sokol_spatial_index_t *index,
+    int32_t slot_count)
+{
+    int32_t i, old_count = ecs_vec_count(&index->locations);
+    ecs_vec_set_count_t(index->allocator, &index->locations,
+        sokol_spatial_loc_t, slot_count);
+
+    sokol_spatial_loc_t *locs = ecs_vec_first_t(
+        &index->locations, sokol_spatial_loc_t);
+    for (i = old_count; i < slot_count; i ++) {
+        locs[i].cell = 0;
+        locs[i].index = -1;
+    }
+}
+
+void sokol_spatial_set(
+    sokol_spatial_index_t *index,
+    int32_t slot,
+    ecs_entity_t entity,
+    const vec4 sphere)
+{
+    if (!(sphere[3] > 0)) {
+        sokol_spatial_remove_slot(index, slot);
+        return;
+    }
+
+    int32_t coords[3];
+    ecs_map_key_t key = sokol_spatial_key(sphere, coords);
+    sokol_spatial_loc_t *loc = ecs_vec_get_t(
+        &index->locations, sokol_spatial_loc_t, slot);
+
+    // Instance didn't move to another cell, update in place
+    if (loc->index != -1 && loc->cell == key) {
+        sokol_spatial_cell_t *cell = ecs_map_get_deref(
+            &index->cells, sokol_spatial_cell_t, key);
+        glm_vec4_copy((float*)sphere,
+            *ecs_vec_get_t(&cell->spheres, vec4, loc->index));
+        *ecs_vec_get_t(&cell->entities, ecs_entity_t, loc->index) = entity;
+        sokol_spatial_cell_expand(cell, sphere);
+        sokol_spatial_grow(index, coords, sphere[3]);
+        return;
+    }
+
+    sokol_spatial_remove_slot(index, slot);
+
+    sokol_spatial_cell_t *cell = sokol_spatial_ensure_cell(index, key, coords);
+    ecs_allocator_t *a = index->allocator;
+    loc->cell = key;
+    loc->index = ecs_vec_count(&cell->slots);
+    glm_vec4_copy((float*)sphere, *ecs_vec_append_t(a, &cell->spheres, vec4));
+    *ecs_vec_append_t(a, &cell->slots, int32_t) = slot;
+    *ecs_vec_append_t(a, &cell->entities, ecs_entity_t) = entity;
+    sokol_spatial_cell_expand(cell, sphere);
+    sokol_spatial_grow(index, coords, sphere[3]);
+    index->count ++;
+}
+
+void sokol_spatial_remove(
+    sokol_spatial_index_t *index,
+    int32_t offset,
+    int32_t count)
+{
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        sokol_spatial_remove_slot(index, offset + i);
+    }
+}
+
+int32_t sokol_spatial_cull(
+    const sokol_spatial_index_t *index,
+    int32_t *visible,
+    const vec4 *planes,
+    int32_t *culled_cells)
+{
+    int32_t result = 0;
+
+    ecs_map_iter_t mit = ecs_map_iter(&index->cells);
+    while (ecs_map_next(&mit)) {
+        sokol_spatial_cell_t *cell = ecs_map_ptr(&mit);
+        int32_t cell_visible;
+        if (!sokol_cull_spheres(&cell_visible,
+            (const vec4*)&cell->bounds, 1, planes))
+        {
+            (*culled_cells) ++;
+            continue;
+        }
+
+        // Test instances of cell, and translate their indices to slots
+        int32_t *cell_slots = &visible[result];
+        int32_t i, count = sokol_cull_spheres(cell_slots,
+            ecs_vec_first_t(&cell->spheres, vec4),
+            ecs_vec_count(&cell->spheres), planes);
+        const int32_t *slots = ecs_vec_first_t(&cell->slots, int32_t);
+        for (i = 0; i < count; i ++) {
+            cell_slots[i] = slots[cell_slots[i]];
+        }
+
+        result += count;
+    }
+
+    return result;
+}
+
+// Squared distance of point to box, which is zero for points inside the box
+static
+float sokol_box_distance2(
+    const float *p,
+    const vec3 min,
+    const vec3 max)
+{
+    float result = 0;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        float d = glm_max(glm_max(min[i] - p[i], p[i] - max[i]), 0.0f);
+        result += d * d;
+    }
+    return result;
+}
+
+// Distance along ray at which it enters the sphere. Returns 0 if origin is
+// inside the sphere, and a negative value if the ray doesn't hit the sphere.
+static
+float sokol_ray_sphere(
+    const float *sphere,
+    const vec3 origin,
+    const vec3 direction)
+{
+    vec3 oc;
+    glm_vec3_sub((float*)sphere, (float*)origin, oc);
+    float r2 = sphere[3] * sphere[3];
+    float oc2 = glm_vec3_dot(oc, oc);
+    if (oc2 <= r2) {
+        return 0;
+    }
+
+    float t = glm_vec3_dot(oc, (float*)direction);
+    float d2 = oc2 - t * t;
+    if (t < 0 || d2 > r2) {
+        return -1;
+    }
+
+    return t - sqrtf(r2 - d2);
+}
+
+// Iterator over the cells that can contain instances that overlap with a box
+typedef struct sokol_spatial_iter_t {
+    const sokol_spatial_index_t *index;
+    ecs_map_iter_t cells;       /* Used when iterating all cells */
+    int32_t min[3];
+    int32_t max[3];
+    int32_t cur[3];
+    bool all;
+    bool done;
+} sokol_spatial_iter_t;
+
+static
+void sokol_spatial_iter_init(
+    sokol_spatial_iter_t *it,
+    const sokol_spatial_index_t *index,
+    const vec3 min,
+    const vec3 max)
+{
+    it->index = index;
+    it->all = false;
+    it->done = !index->count;
+
+    // Instances can extend outside of their cell by up to the max radius, so
+    // the box is expanded by the radius before it's converted to cells.
+    float r = index->max_radius;
+    int64_t volume = 1;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        it->min[i] = glm_imax(sokol_spatial_coord(min[i] - r),
+            index->cell_min[i]);
+        it->max[i] = glm_imin(sokol_spatial_coord(max[i] + r),
+            index->cell_max[i]);
+        it->cur[i] = it->min[i];
+        if (it->max[i] < it->min[i]) {
+            it->done = true;
+        }
+        volume *= (int64_t)(it->max[i] - it->min[i] + 1);
+    }
+
+    // For large boxes it's cheaper to test all occupied cells than to do a
+    // lookup for each cell in the range.
+    if (!it->done && volume > ecs_map_count(&index->cells)) {
+        it->all = true;
+        it->cells = ecs_map_iter(&index->cells);
+    }
+}
+
+static
+sokol_spatial_cell_t* sokol_spatial_iter_next(
+    sokol_spatial_iter_t *it)
+{
+    if (it->all) {
+        if (ecs_map_next(&it->cells)) {
+            return ecs_map_ptr(&it->cells);
+        }
+        return NULL;
+    }
+
+    while (!it->done) {
+        sokol_spatial_cell_t *cell = ecs_map_get_deref(&it->index->cells,
+            sokol_spatial_cell_t, sokol_spatial_coords_key(it->cur));
+
+        int32_t i;
+        for (i = 2; i >= 0; i --) {
+            if (it->cur[i] < it->max[i]) {
+                it->cur[i] ++;
+                break;
+            }
+            it->cur[i] = it->min[i];
+        }
+        it->done = i < 0;
+
+        if (cell) {
+            return cell;
+        }
+    }
+
+    return NULL;
+}
+
+bool sokol_spatial_overlap_sphere(
+    const sokol_spatial_index_t *index,
+    const vec3 center,
+    float radius,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+    vec3 min, max;
+    glm_vec3_subs((float*)center, radius, min);
+    glm_vec3_adds((float*)center, radius, max);
+
+    sokol_spatial_iter_t it;
+    sokol_spatial_iter_init(&it, index, min, max);
+
+    sokol_spatial_cell_t *cell;
+    while ((cell = sokol_spatial_iter_next(&it))) {
+        if (glm_vec3_distance(cell->bounds, (float*)center) >
+            (cell->bounds[3] + radius))
+        {
+            continue;
+        }
+
+        const vec4 *spheres = ecs_vec_first_t(&cell->spheres, vec4);
+        const ecs_entity_t *entities = ecs_vec_first_t(
+            &cell->entities, ecs_entity_t);
+        int32_t i, count = ecs_vec_count(&cell->spheres);
+        for (i = 0; i < count; i ++) {
+            if (glm_vec3_distance((float*)spheres[i], (float*)center) >
+                (spheres[i][3] + radius))
+            {
+                continue;
+            }
+            if (!callback(entities[i], spheres[i], ctx)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool sokol_spatial_overlap_box(
+    const sokol_spatial_index_t *index,
+    const vec3 min,
+    const vec3 max,
+    sokol_spatial_callback_t callback,
+    void *ctx)
+{
+    sokol_spatial_iter_t it;
+    sokol_spatial_iter_init(&it, index, min, max);
+
+    sokol_spatial_cell_t *cell;
+    while ((cell = sokol_spatial_iter_next(&it))) {
+        float r = cell->bounds[3];
+        if (sokol_box_distance2(cell->bounds, min, max) > (r * r)) {
+            continue;
+        }
+
+        const vec4 *spheres = ecs_vec_first_t(&cell->spheres, vec4);
+        const ecs_entity_t *entities = ecs_vec_first_t(
+            &cell->entities, ecs_entity_t);
+        int32_t i, count = ecs_vec_count(&cell->spheres);
+        for (i = 0; i < count; i ++) {
+            r = spheres[i][3];
+            if (sokol_box_distance2(spheres[i], min, max) > (r * r)) {
+                continue;
+            }
+            if (!callback(entities[i], spheres[i], ctx)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Test instances of cell against ray, and update nearest hit
+static
+void sokol_spatial_raycast_cell(
+    const sokol_spatial_cell_t *cell,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance,
+    ecs_entity_t *result)
+{
+    float t = sokol_ray_sphere(cell->bounds, origin, direction);
+    if (t < 0 || t >= *distance) {
+        return;
+    }
+
+    const vec4 *spheres = ecs_vec_first_t(&cell->spheres, vec4);
+    const ecs_entity_t *entities = ecs_vec_first_t(
+        &cell->entities, ecs_entity_t);
+    int32_t i, count = ecs_vec_count(&cell->spheres);
+    for (i = 0; i < count; i ++) {
+        t = sokol_ray_sphere(spheres[i], origin, direction);
+        if (t >= 0 && t < *distance) {
+            *distance = t;
+            *result = entities[i];
+        }
+    }
+}
+
+// Test occupied cells in range of cell coordinates against ray
+static
+void sokol_spatial_raycast_range(
+    const sokol_spatial_index_t *index,
+    const int32_t *min,
+    const int32_t *max,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance,
+    ecs_entity_t *result)
+{
+    int32_t lo[3], hi[3], c[3];
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        lo[i] = glm_imax(min[i], index->cell_min[i]);
+        hi[i] = glm_imin(max[i], index->cell_max[i]);
+        if (hi[i] < lo[i]) {
+            return;
+        }
+    }
+
+    for (c[0] = lo[0]; c[0] <= hi[0]; c[0] ++) {
+        for (c[1] = lo[1]; c[1] <= hi[1]; c[1] ++) {
+            for (c[2] = lo[2]; c[2] <= hi[2]; c[2] ++) {
+                const sokol_spatial_cell_t *cell = ecs_map_get_deref(
+                    &index->cells, sokol_spatial_cell_t,
+                    sokol_spatial_coords_key(c));
+                if (cell) {
+                    sokol_spatial_raycast_cell(
+                        cell, origin, direction, distance, result);
+                }
+            }
+        }
+    }
+}
+
+ecs_entity_t sokol_spatial_raycast(
+    const sokol_spatial_index_t *index,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance)
+{
+    ecs_entity_t result = 0;
+    if (!index->count) {
+        return 0;
+    }
+
+    // A hit point is within max_radius of the center of the instance, so the
+    // instance is stored at most k cells away from a cell the ray crosses.
+    int32_t k = (int32_t)ceilf(index->max_radius / SOKOL_SPATIAL_CELL_SIZE);
+
+    // Clip ray to the occupied cells, expanded by k cells
+    float t_min = 0, t_max = *distance;
+    int32_t i;
+    for (i = 0; i < 3; i ++) {
+        float lo = (float)(index->cell_min[i] - k);
+        float hi = (float)(index->cell_max[i] + k + 1);
+        lo *= SOKOL_SPATIAL_CELL_SIZE;
+        hi *= SOKOL_SPATIAL_CELL_SIZE;
+        if (direction[i] == 0) {
+            if (origin[i] < lo || origin[i] > hi) {
+                return 0;
+            }
+            continue;
+        }
+
+        float t0 = (lo - origin[i]) / direction[i];
+        float t1 = (hi - origin[i]) / direction[i];
+        t_min = glm_max(t_min, glm_min(t0, t1));
+        t_max = glm_min(t_max, glm_max(t0, t1));
+    }
+
+    if (t_min > t_max) {
+        return 0;
+    }
+
+    // Each step of the ray visits the (2k + 1)^2 cells that weren't in the
+    // neighborhood of the previous cell. If that adds up to more lookups than
+    // there are cells, it's cheaper to test all cells.
+    float steps = 1;
+    for (i = 0; i < 3; i ++) {
+        steps += fabsf(direction[i]) * (t_max - t_min) /
+            SOKOL_SPATIAL_CELL_SIZE + 1;
+    }
+    float side = (float)(2 * k + 1);
+    if ((steps * side * side) > (float)ecs_map_count(&index->cells)) {
+        ecs_map_iter_t mit = ecs_map_iter(&index->cells);
+        while (ecs_map_next(&mit)) {
+            sokol_spatial_raycast_cell(ecs_map_ptr(&mit),
+                origin, direction, distance, &result);
+        }
+        return result;
+    }
+
+    // Step through the cells that the ray crosses
+    int32_t cur[3], step[3], lo[3], hi[3];
+    float next[3], delta[3];
+    for (i = 0; i < 3; i ++) {
+        float p = origin[i] + direction[i] * t_min;
+        cur[i] = glm_imax(glm_imin(sokol_spatial_coord(p),
+            index->cell_max[i] + k), index->cell_min[i] - k);
+        if (direction[i] > 0) {
+            float edge = (float)(cur[i] + 1) * SOKOL_SPATIAL_CELL_SIZE;
+            step[i] = 1;
+            next[i] = t_min + (edge - p) / direction[i];
+            delta[i] = SOKOL_SPATIAL_CELL_SIZE / direction[i];
+        } else if (direction[i] < 0) {
+            float edge = (float)cur[i] * SOKOL_SPATIAL_CELL_SIZE;
+            step[i] = -1;
+            next[i] = t_min + (edge - p) / direction[i];
+            delta[i] = -SOKOL_SPATIAL_CELL_SIZE / direction[i];
+        } else {
+            step[i] = 0;
+            next[i] = FLT_MAX;
+            delta[i] = 0;
+        }
+        lo[i] = cur[i] - k;
+        hi[i] = cur[i] + k;
+    }
+
+    sokol_spatial_raycast_range(
+        index, lo, hi, origin, direction, distance, &result);
+
+    for (;;) {
+        int32_t a = 0;
+        if (next[1] < next[a]) a = 1;
+        if (next[2] < next[a]) a = 2;
+
+        // Cells further along the ray can't contain a closer hit
+        if (next[a] >= *distance) {
+            break;
+        }
+
+        cur[a] += step[a];
+        if (cur[a] < (index->cell_min[a] - k) ||
+            cur[a] > (index->cell_max[a] + k))
+        {
+            break;
+        }
+
+        for (i = 0; i < 3; i ++) {
+            lo[i] = cur[i] - k;
+            hi[i] = cur[i] + k;
+        }
+        lo[a] = hi[a] = cur[a] + step[a] * k;
+
+        sokol_spatial_raycast_range(
+            index, lo, hi, origin, direction, distance, &result);
+
+        next[a] += delta[a];
+    }
+
+    return result;
+}
+
+#endif
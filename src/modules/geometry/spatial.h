@@ -0,0 +1,101 @@
+#ifndef SOKOL_MODULES_GEOMETRY_SPATIAL_H
+#define SOKOL_MODULES_GEOMETRY_SPATIAL_H
+
+#include "../../types.h"
+
+#if SOKOL_SPATIAL_INDEX
+
+/* Cell of the loose grid. Instances are stored in the cell that contains the
+ * center of their bounding sphere, and may extend outside of the cell. */
+typedef struct sokol_spatial_cell_t {
+    vec4 bounds;                /* Sphere that encloses cell & its instances */
+    ecs_vec_t spheres;          /* Bounding sphere per instance (vec<vec4>) */
+    ecs_vec_t slots;            /* Instance slot per instance (vec<int32_t>) */
+    ecs_vec_t entities;         /* Entity per instance (vec<ecs_entity_t>) */
+} sokol_spatial_cell_t;
+
+/* Location of an instance slot in the grid */
+typedef struct sokol_spatial_loc_t {
+    ecs_map_key_t cell;
+    int32_t index;              /* Index in cell, -1 if slot is not stored */
+} sokol_spatial_loc_t;
+
+/* Loose grid over the instance slots of a geometry buffer */
+typedef struct sokol_spatial_index_t {
+    ecs_allocator_t *allocator;
+    ecs_map_t cells;            /* map<cell key, sokol_spatial_cell_t*> */
+    ecs_vec_t locations;        /* Location per slot (vec<sokol_spatial_loc_t>) */
+    int32_t count;              /* Number of instances in index */
+
+    /* Conservative extents of the index, used to limit queries to the cells
+     * they overlap with. Extents don't shrink until the index is empty. */
+    int32_t cell_min[3];        /* Min coordinates of occupied cells */
+    int32_t cell_max[3];        /* Max coordinates of occupied cells */
+    float max_radius;           /* Largest radius of an instance */
+} sokol_spatial_index_t;
+
+void sokol_spatial_init(
+    sokol_spatial_index_t *index,
+    ecs_allocator_t *a);
+
+void sokol_spatial_fini(
+    sokol_spatial_index_t *index);
+
+/* Set number of instance slots. Slots that are removed must not be stored. */
+void sokol_spatial_resize(
+    sokol_spatial_index_t *index,
+    int32_t slot_count);
+
+/* Store or move instance slot. A sphere with a radius of zero or less removes
+ * the slot from the index. */
+void sokol_spatial_set(
+    sokol_spatial_index_t *index,
+    int32_t slot,
+    ecs_entity_t entity,
+    const vec4 sphere);
+
+/* Remove range of instance slots */
+void sokol_spatial_remove(
+    sokol_spatial_index_t *index,
+    int32_t offset,
+    int32_t count);
+
+/* Write slots of instances that intersect with the frustum to visible, which
+ * must be large enough to hold all instances. Returns number of visible slots.
+ * The number of cells outside of the frustum is added to culled_cells. */
+int32_t sokol_spatial_cull(
+    const sokol_spatial_index_t *index,
+    int32_t *visible,
+    const vec4 *planes,
+    int32_t *culled_cells);
+
+/* Find instances with bounding spheres that overlap with sphere. Returns false
+ * if the callback stopped the query. */
+bool sokol_spatial_overlap_sphere(
+    const sokol_spatial_index_t *index,
+    const vec3 center,
+    float radius,
+    sokol_spatial_callback_t callback,
+    void *ctx);
+
+/* Find instances with bounding spheres that overlap with box. Returns false
+ * if the callback stopped the query. */
+bool sokol_spatial_overlap_box(
+    const sokol_spatial_index_t *index,
+    const vec3 min,
+    const vec3 max,
+    sokol_spatial_callback_t callback,
+    void *ctx);
+
+/* Find nearest instance with a bounding sphere that is hit by the ray. The
+ * direction must be normalized. Returns 0 if no instance closer than distance
+ * is hit, otherwise distance is set to the distance of the hit. */
+ecs_entity_t sokol_spatial_raycast(
+    const sokol_spatial_index_t *index,
+    const vec3 origin,
+    const vec3 direction,
+    float *distance);
+
+#endif
+
+#endif
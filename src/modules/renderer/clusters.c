@@ -0,0 +1,348 @@
+#include "../../private_api.h"
+#include "../geometry/kernels.h"
+#include <float.h>
+
+#if SOKOL_CLUSTERED_LIGHTS
+
+#define SOKOL_CLUSTER_LIGHT_ROWS \
+    ((SOKOL_CLUSTER_MAX_LIGHTS * 2 + SOKOL_CLUSTER_TEXTURE_WIDTH - 1) / \
+        SOKOL_CLUSTER_TEXTURE_WIDTH)
+#define SOKOL_CLUSTER_INDEX_ROWS \
+    ((SOKOL_CLUSTER_MAX_INDICES + SOKOL_CLUSTER_TEXTURE_WIDTH - 1) / \
+        SOKOL_CLUSTER_TEXTURE_WIDTH)
+
+static
+sg_image sokol_cluster_image(
+    const char *label,
+    int32_t width,
+    int32_t height,
+    sg_pixel_format format)
+{
+    return sg_make_image(&(sg_image_desc){
+        .width = width,
+        .height = height,
+        .usage = SG_USAGE_STREAM,
+        .pixel_format = format,
+        .min_filter = SG_FILTER_NEAREST,
+        .mag_filter = SG_FILTER_NEAREST,
+        .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+        .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
+        .label = label
+    });
+}
+
+void sokol_clusters_init(
+    sokol_light_clusters_t *c)
+{
+    ecs_os_zeromem(c);
+
+    c->lights = sokol_cluster_image("Cluster lights",
+        SOKOL_CLUSTER_TEXTURE_WIDTH, SOKOL_CLUSTER_LIGHT_ROWS,
+        SG_PIXELFORMAT_RGBA32F);
+    c->clusters = sokol_cluster_image("Clusters",
+        SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y, SOKOL_CLUSTER_Z,
+        SG_PIXELFORMAT_RG32UI);
+    c->indices = sokol_cluster_image("Cluster light indices",
+        SOKOL_CLUSTER_TEXTURE_WIDTH, SOKOL_CLUSTER_INDEX_ROWS,
+        SG_PIXELFORMAT_R32UI);
+
+    c->light_data = ecs_os_calloc_n(float,
+        SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_LIGHT_ROWS * 4);
+    c->cluster_data = ecs_os_calloc_n(uint32_t, SOKOL_CLUSTER_COUNT * 2);
+    c->index_data = ecs_os_calloc_n(uint32_t,
+        SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_INDEX_ROWS);
+    c->spheres = ecs_os_malloc_n(vec4, SOKOL_CLUSTER_MAX_LIGHTS);
+}
+
+void sokol_clusters_fini(
+    sokol_light_clusters_t *c)
+{
+    sg_destroy_image(c->lights);
+    sg_destroy_image(c->clusters);
+    sg_destroy_image(c->indices);
+    ecs_os_free(c->light_data);
+    ecs_os_free(c->cluster_data);
+    ecs_os_free(c->index_data);
+    ecs_os_free(c->spheres);
+
+    int32_t i;
+    for (i = 0; i < c->stage_size; i ++) {
+        sokol_cluster_stage_t *s = &c->stages[i];
+        ecs_vec_fini_t(NULL, &s->indices, uint32_t);
+        ecs_vec_fini_t(NULL, &s->slice_lights, int32_t);
+        ecs_vec_fini_t(NULL, &s->slice_spheres, vec4);
+        ecs_vec_fini_t(NULL, &s->row_lights, int32_t);
+        ecs_vec_fini_t(NULL, &s->row_spheres, vec4);
+        ecs_vec_fini_t(NULL, &s->tile_lights, int32_t);
+    }
+    ecs_os_free(c->stages);
+}
+
+// Plane of points for which the projected axis is larger (sign = 1) or
+// smaller (sign = -1) than value. Axis and w are rows of the view projection.
+static
+void sokol_cluster_plane(
+    const vec4 axis,
+    const vec4 w,
+    float value,
+    float sign,
+    vec4 out)
+{
+    int32_t i;
+    for (i = 0; i < 4; i ++) {
+        out[i] = sign * (axis[i] - value * w[i]);
+    }
+    glm_plane_normalize(out);
+}
+
+// Range of depth slices that are binned by a stage
+static
+void sokol_cluster_slices(
+    int32_t stage_id,
+    int32_t stage_count,
+    int32_t *z_begin,
+    int32_t *z_end)
+{
+    *z_begin = stage_id * SOKOL_CLUSTER_Z / stage_count;
+    *z_end = (stage_id + 1) * SOKOL_CLUSTER_Z / stage_count;
+}
+
+void sokol_clusters_prepare(
+    sokol_light_clusters_t *c,
+    const ecs_vec_t *lights,
+    const vec3 eye_pos,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float near_,
+    float far_,
+    int32_t stage_count)
+{
+    const sokol_light_t *l = ecs_vec_first(lights);
+    int32_t i, count = ecs_vec_count(lights);
+    if (count > SOKOL_CLUSTER_MAX_LIGHTS) {
+        count = SOKOL_CLUSTER_MAX_LIGHTS;
+    }
+
+    for (i = 0; i < count; i ++) {
+        float *t = &c->light_data[i * 8];
+        glm_vec3_copy((float*)l[i].position, t);
+        t[3] = l[i].distance;
+        glm_vec3_copy((float*)l[i].color, &t[4]);
+        t[7] = 0;
+
+        glm_vec3_add((float*)l[i].position, (float*)eye_pos, c->spheres[i]);
+        c->spheres[i][3] = l[i].distance * SOKOL_LIGHT_RANGE;
+    }
+    c->light_count = count;
+
+    // Planes through the eye and the tile edges in normalized device space
+    vec4 r0, r1, r3;
+    for (i = 0; i < 4; i ++) {
+        r0[i] = mat_vp[i][0];
+        r1[i] = mat_vp[i][1];
+        r3[i] = mat_vp[i][3];
+    }
+
+    sokol_cluster_plane(r0, r3, -1, 1, c->frustum[0]);
+    sokol_cluster_plane(r0, r3, 1, -1, c->frustum[1]);
+    sokol_cluster_plane(r1, r3, -1, 1, c->frustum[2]);
+    sokol_cluster_plane(r1, r3, 1, -1, c->frustum[3]);
+
+    for (i = 0; i < SOKOL_CLUSTER_X; i ++) {
+        float x0 = -1.0f + 2.0f * (float)i / SOKOL_CLUSTER_X;
+        float x1 = -1.0f + 2.0f * (float)(i + 1) / SOKOL_CLUSTER_X;
+        sokol_cluster_plane(r0, r3, x0, 1, c->x_planes[i][0]);
+        sokol_cluster_plane(r0, r3, x1, -1, c->x_planes[i][1]);
+    }
+
+    for (i = 0; i < SOKOL_CLUSTER_Y; i ++) {
+        float y0 = -1.0f + 2.0f * (float)i / SOKOL_CLUSTER_Y;
+        float y1 = -1.0f + 2.0f * (float)(i + 1) / SOKOL_CLUSTER_Y;
+        sokol_cluster_plane(r1, r3, y0, 1, c->y_planes[i][0]);
+        sokol_cluster_plane(r1, r3, y1, -1, c->y_planes[i][1]);
+    }
+
+    // Depth slices, where depth is the negated z coordinate in view space
+    vec4 z;
+    for (i = 0; i < 4; i ++) {
+        z[i] = mat_v[i][2];
+    }
+
+    near_ = glm_max(near_, 0.001f);
+    far_ = glm_max(far_, near_ * 2.0f);
+    for (i = 0; i < SOKOL_CLUSTER_Z; i ++) {
+        float d0 = near_ * powf(far_ / near_, (float)i / SOKOL_CLUSTER_Z);
+        float d1 = near_ * powf(far_ / near_, (float)(i + 1) / SOKOL_CLUSTER_Z);
+        sokol_cluster_plane(z, (vec4){0, 0, 0, 1}, -d0, -1, c->z_planes[i][0]);
+        sokol_cluster_plane(z, (vec4){0, 0, 0, 1}, -d1, 1, c->z_planes[i][1]);
+    }
+
+    // The first and last slice extend to the eye and to infinity
+    c->z_planes[0][0][3] = FLT_MAX;
+    c->z_planes[SOKOL_CLUSTER_Z - 1][1][3] = FLT_MAX;
+
+    c->depth_scale = SOKOL_CLUSTER_Z / logf(far_ / near_);
+    c->depth_bias = -logf(near_) * c->depth_scale;
+
+    // Stage data is only accessed by the stage, so allocate it here
+    if (stage_count > c->stage_size) {
+        c->stages = ecs_os_realloc_n(c->stages, sokol_cluster_stage_t,
+            stage_count);
+        ecs_os_memset_n(&c->stages[c->stage_size], 0, sokol_cluster_stage_t,
+            stage_count - c->stage_size);
+        c->stage_size = stage_count;
+    }
+    c->stage_count = stage_count;
+
+    for (i = 0; i < stage_count; i ++) {
+        sokol_cluster_stage_t *s = &c->stages[i];
+        ecs_vec_clear(&s->indices);
+        ecs_vec_set_count_t(NULL, &s->slice_lights, int32_t, count);
+        ecs_vec_set_count_t(NULL, &s->slice_spheres, vec4, count);
+        ecs_vec_set_count_t(NULL, &s->row_lights, int32_t, count);
+        ecs_vec_set_count_t(NULL, &s->row_spheres, vec4, count);
+        ecs_vec_set_count_t(NULL, &s->tile_lights, int32_t, count);
+    }
+}
+
+// Cull spheres against planes, and store the spheres & light ids that pass.
+// If ids is NULL, the sphere index is the light id.
+static
+int32_t sokol_cluster_cull(
+    const vec4 *spheres,
+    const int32_t *ids,
+    int32_t count,
+    const vec4 *planes,
+    vec4 *spheres_out,
+    int32_t *ids_out)
+{
+    int32_t i, result = sokol_cull_spheres(ids_out, spheres, count, planes);
+    for (i = 0; i < result; i ++) {
+        int32_t index = ids_out[i];
+        glm_vec4_copy((float*)spheres[index], spheres_out[i]);
+        if (ids) {
+            ids_out[i] = ids[index];
+        }
+    }
+    return result;
+}
+
+void sokol_clusters_bin(
+    sokol_light_clusters_t *c,
+    int32_t stage_id)
+{
+    sokol_cluster_stage_t *s = &c->stages[stage_id];
+    int32_t *slice_lights = ecs_vec_first(&s->slice_lights);
+    vec4 *slice_spheres = ecs_vec_first(&s->slice_spheres);
+    int32_t *row_lights = ecs_vec_first(&s->row_lights);
+    vec4 *row_spheres = ecs_vec_first(&s->row_spheres);
+    int32_t *tile_lights = ecs_vec_first(&s->tile_lights);
+    int32_t x, y, z, z_begin, z_end, i;
+    vec4 planes[6];
+
+    sokol_cluster_slices(stage_id, c->stage_count, &z_begin, &z_end);
+
+    // Lights are culled per slice, then per row of the slice, and then per
+    // tile of the row, so that each test only uses the lights of its parent.
+    for (z = z_begin; z < z_end; z ++) {
+        ecs_os_memcpy_n(planes, c->frustum, vec4, 4);
+        ecs_os_memcpy_n(&planes[4], c->z_planes[z], vec4, 2);
+        int32_t slice_count = sokol_cluster_cull(c->spheres, NULL,
+            c->light_count, planes, slice_spheres, slice_lights);
+
+        for (y = 0; y < SOKOL_CLUSTER_Y; y ++) {
+            int32_t row_count = 0;
+            if (slice_count) {
+                ecs_os_memcpy_n(&planes[2], c->y_planes[y], vec4, 2);
+                row_count = sokol_cluster_cull(slice_spheres, slice_lights,
+                    slice_count, planes, row_spheres, row_lights);
+            }
+
+            for (x = 0; x < SOKOL_CLUSTER_X; x ++) {
+                uint32_t *cluster = &c->cluster_data[
+                    ((z * SOKOL_CLUSTER_Y + y) * SOKOL_CLUSTER_X + x) * 2];
+                cluster[0] = (uint32_t)ecs_vec_count(&s->indices);
+                cluster[1] = 0;
+                if (!row_count) {
+                    continue;
+                }
+
+                vec4 tile_planes[6];
+                ecs_os_memcpy_n(tile_planes, c->x_planes[x], vec4, 2);
+                ecs_os_memcpy_n(&tile_planes[2], &planes[2], vec4, 4);
+                int32_t tile_count = sokol_cull_spheres(
+                    tile_lights, row_spheres, row_count, tile_planes);
+                if (!tile_count) {
+                    continue;
+                }
+
+                uint32_t *dst = ecs_vec_grow_t(
+                    NULL, &s->indices, uint32_t, tile_count);
+                for (i = 0; i < tile_count; i ++) {
+                    dst[i] = (uint32_t)row_lights[tile_lights[i]];
+                }
+                cluster[1] = (uint32_t)tile_count;
+            }
+        }
+    }
+}
+
+void sokol_clusters_upload(
+    sokol_light_clusters_t *c)
+{
+    int32_t s, z, i, base = 0, dropped = 0;
+
+    // Concatenate indices of stages, and offset clusters of stages
+    for (s = 0; s < c->stage_count; s ++) {
+        const sokol_cluster_stage_t *stage = &c->stages[s];
+        int32_t count = ecs_vec_count(&stage->indices);
+        int32_t copy = glm_imin(count, SOKOL_CLUSTER_MAX_INDICES - base);
+        if (copy) {
+            ecs_os_memcpy_n(&c->index_data[base],
+                ecs_vec_first(&stage->indices), uint32_t, copy);
+        }
+
+        int32_t z_begin, z_end;
+        sokol_cluster_slices(s, c->stage_count, &z_begin, &z_end);
+        for (z = z_begin; z < z_end; z ++) {
+            uint32_t *cluster = &c->cluster_data[
+                z * SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y * 2];
+            for (i = 0; i < SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y; i ++) {
+                // Drop lights of clusters that don't fit in the index texture
+                uint32_t max = SOKOL_CLUSTER_MAX_INDICES;
+                uint32_t offset = cluster[i * 2] + (uint32_t)base;
+                if (offset > max) {
+                    offset = max;
+                }
+                if (cluster[i * 2 + 1] > (max - offset)) {
+                    cluster[i * 2 + 1] = max - offset;
+                }
+                cluster[i * 2] = offset;
+            }
+        }
+
+        base += copy;
+        dropped += count - copy;
+    }
+
+    c->index_count = base;
+    c->indices_dropped = dropped;
+    if (dropped) {
+        ecs_dbg_3("sokol: %d clustered light indices dropped", dropped);
+    }
+
+    sg_update_image(c->lights, &(sg_image_data){
+        .subimage[0][0] = { c->light_data, sizeof(float) * 4 *
+            SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_LIGHT_ROWS }
+    });
+    sg_update_image(c->clusters, &(sg_image_data){
+        .subimage[0][0] = { c->cluster_data,
+            sizeof(uint32_t) * 2 * SOKOL_CLUSTER_COUNT }
+    });
+    sg_update_image(c->indices, &(sg_image_data){
+        .subimage[0][0] = { c->index_data, sizeof(uint32_t) *
+            SOKOL_CLUSTER_TEXTURE_WIDTH * SOKOL_CLUSTER_INDEX_ROWS }
+    });
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SOKOL_MODULES_RENDERER_CLUSTERS_H
+#define SOKOL_MODULES_RENDERER_CLUSTERS_H
+
+#include "../../types.h"
+
+#if SOKOL_CLUSTERED_LIGHTS
+
+/* Light indices binned by a stage. Each stage bins a range of depth slices
+ * into its own index list, which are concatenated before uploading. */
+typedef struct sokol_cluster_stage_t {
+    ecs_vec_t indices;          /* Light indices of clusters (vec<uint32_t>) */
+    ecs_vec_t slice_lights;     /* Lights that intersect slice (vec<int32_t>) */
+    ecs_vec_t slice_spheres;    /* Spheres of slice lights (vec<vec4>) */
+    ecs_vec_t row_lights;       /* Lights that intersect row (vec<int32_t>) */
+    ecs_vec_t row_spheres;      /* Spheres of row lights (vec<vec4>) */
+    ecs_vec_t tile_lights;      /* Lights that intersect tile (vec<int32_t>) */
+} sokol_cluster_stage_t;
+
+/* Point lights binned in clusters. Clusters are stored in textures that are
+ * read by the scene shader:
+ *  - lights: two RGBA32F texels per light, with the position relative to the
+ *    eye & distance, and the color.
+ *  - clusters: a RG32UI texel per cluster, with the offset & count of its
+ *    light indices. The texel of cluster (x, y, z) is (y * X + x, z).
+ *  - indices: a R32UI texel per light index.
+ * Cluster planes and light spheres are in world space. Depth slices are
+ * distributed exponentially between the near and far plane. */
+typedef struct sokol_light_clusters_t {
+    sg_image lights;
+    sg_image clusters;
+    sg_image indices;
+
+    float *light_data;          /* Texel data of images */
+    uint32_t *cluster_data;
+    uint32_t *index_data;
+
+    vec4 *spheres;              /* Center & range per light */
+    int32_t light_count;
+
+    vec4 frustum[4];            /* Left, right, bottom & top frustum planes */
+    vec4 x_planes[SOKOL_CLUSTER_X][2];
+    vec4 y_planes[SOKOL_CLUSTER_Y][2];
+    vec4 z_planes[SOKOL_CLUSTER_Z][2];
+
+    float depth_scale;          /* slice = log(depth) * scale + bias */
+    float depth_bias;
+
+    sokol_cluster_stage_t *stages;
+    int32_t stage_count;        /* Stages that bin lights in current frame */
+    int32_t stage_size;         /* Allocated stages */
+
+    int32_t index_count;        /* Light indices uploaded in last frame */
+    int32_t indices_dropped;    /* Light indices that didn't fit */
+} sokol_light_clusters_t;
+
+void sokol_clusters_init(
+    sokol_light_clusters_t *c);
+
+void sokol_clusters_fini(
+    sokol_light_clusters_t *c);
+
+/* Store lights & compute cluster planes for frame. Light positions are
+ * relative to the eye. Must be called on the main thread before binning. */
+void sokol_clusters_prepare(
+    sokol_light_clusters_t *c,
+    const ecs_vec_t *lights,
+    const vec3 eye_pos,
+    mat4 mat_vp,
+    mat4 mat_v,
+    float near_,
+    float far_,
+    int32_t stage_count);
+
+/* Bin lights into the depth slices assigned to a stage. Stages write to
+ * separate data, and can run in parallel. */
+void sokol_clusters_bin(
+    sokol_light_clusters_t *c,
+    int32_t stage_id);
+
+/* Merge light indices of stages and upload textures */
+void sokol_clusters_upload(
+    sokol_light_clusters_t *c);
+
+#endif
+
+#endif
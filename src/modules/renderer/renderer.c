@@ -1,17 +1,22 @@
 #include "../../private_api.h"
 #include "math.h"
+#include "../geometry/kernels.h"
 
 ECS_COMPONENT_DECLARE(SokolRenderer);
 
+/* Number of segments of procedural primitives, per level of detail */
+static const int32_t sokol_primitive_segments[SOKOL_MAX_LODS] = { 32, 16, 8 };
+
 /* Static geometry/texture resources */
 static
 sokol_resources_t sokol_init_resources(void) {
-    return (sokol_resources_t){
+    sokol_resources_t result = {
         .quad = sokol_buffer_quad(),
 
         .rect = sokol_buffer_rectangle(),
         .rect_indices = sokol_buffer_rectangle_indices(),
         .rect_normals = sokol_buffer_rectangle_normals(),
+        .rect_impostor_indices = sokol_buffer_rectangle_impostor_indices(),
 
         .box = sokol_buffer_box(),
         .box_indices = sokol_buffer_box_indices(),
@@ -19,6 +24,16 @@ sokol_resources_t sokol_init_resources(void) {
 
         .noise_texture = sokol_noise_texture(16, 16)
     };
+
+    int32_t i;
+    for (i = 0; i < SOKOL_MAX_LODS; i ++) {
+        int32_t segments = sokol_primitive_segments[i];
+        result.sphere[i] = sokol_mesh_sphere(segments);
+        result.cylinder[i] = sokol_mesh_cylinder(segments);
+        result.cone[i] = sokol_mesh_cone(segments);
+    }
+
+    return result;
 }
 
 static
@@ -222,8 +237,8 @@ void sokol_init_global_uniforms(
     u->ortho = false;
 
     /* If camera is set, get values */
-    if (state->camera) {
-        EcsCamera cam = *state->camera;
+    if (state->has_camera) {
+        EcsCamera cam = state->camera;
 
         if (cam.fov) {
             u->fov = cam.fov;
@@ -266,8 +281,8 @@ void sokol_init_global_uniforms(
     glm_mat4_inv(u->mat_v, u->inv_mat_v);
 
     /* Light parameters */
-    if (state->light) {
-        EcsDirectionalLight l = *state->light;
+    if (state->has_light) {
+        EcsDirectionalLight l = state->light;
         glm_vec3_copy(l.direction, u->sun_direction);
         glm_vec3_copy(l.color, u->sun_color);
         u->sun_intensity = l.intensity;
@@ -307,81 +322,186 @@ void sokol_init_global_uniforms(
     sokol_world_to_screen(lookat, u->eye_horizon, state);
 }
 
+/* Store point light with position relative to the eye */
+static
+void sokol_init_light(
+    sokol_light_t *light,
+    const EcsPointLight *l,
+    const EcsTransform3 *m,
+    const vec3 eye_pos)
+{
+    glm_vec3_copy((float*)l->color, light->color);
+
+    light->color[0] *= l->intensity;
+    light->color[1] *= l->intensity;
+    light->color[2] *= l->intensity;
+
+    light->position[0] = m->value[3][0] - eye_pos[0];
+    light->position[1] = m->value[3][1] - eye_pos[1];
+    light->position[2] = m->value[3][2] - eye_pos[2];
+
+    light->distance = l->distance;
+}
+
+/* Visible light, with an estimate of its contribution to the frame */
+typedef struct sokol_light_candidate_t {
+    sokol_light_t light;
+    ecs_entity_t entity;
+    float score;
+} sokol_light_candidate_t;
+
+/* Partially sort candidates so that the k candidates with the highest score
+ * come first, in no particular order. */
 static
-int sokol_qsort_light_compare(const void *ptr1, const void *ptr2) {
-    const sokol_light_t *l1 = ptr1;
-    const sokol_light_t *l2 = ptr2;
+void sokol_select_lights(
+    sokol_light_candidate_t *c,
+    int32_t count,
+    int32_t k)
+{
+    int32_t lo = 0, hi = count - 1, nth = k - 1;
+    while (lo < hi) {
+        float pivot = c[lo + (hi - lo) / 2].score;
+        int32_t i = lo, j = hi;
+        while (i <= j) {
+            while (c[i].score > pivot) i ++;
+            while (c[j].score < pivot) j --;
+            if (i <= j) {
+                sokol_light_candidate_t tmp = c[i];
+                c[i ++] = c[j];
+                c[j --] = tmp;
+            }
+        }
+
+        if (nth <= j) {
+            hi = j;
+        } else if (nth >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+}
+
+/* Select the max_count visible lights with the largest contribution */
+static
+void sokol_select_visible_lights(
+    SokolRenderer *r,
+    sokol_render_state_t *state,
+    const vec3 eye_pos,
+    int32_t max_count)
+{
+    sokol_light_candidate_t *candidates = ecs_vec_first(&r->light_candidates);
+    int32_t i, count = ecs_vec_count(&r->light_candidates);
+
+    /* Cull lights of which the range doesn't intersect with the frustum */
+    ecs_vec_set_count_t(NULL, &r->light_spheres, vec4, count);
+    ecs_vec_set_count_t(NULL, &r->light_visible, int32_t, count);
+    vec4 *spheres = ecs_vec_first(&r->light_spheres);
+    int32_t *visible = ecs_vec_first(&r->light_visible);
+    for (i = 0; i < count; i ++) {
+        const sokol_light_t *light = &candidates[i].light;
+        glm_vec3_add((float*)light->position, (float*)eye_pos, spheres[i]);
+        spheres[i][3] = light->distance * SOKOL_LIGHT_RANGE;
+    }
 
-    float d1 = pow(l1->position[0], 2.0) + 
-               pow(l1->position[2], 2.0);
-    float d2 = pow(l2->position[0], 2.0) + 
-               pow(l2->position[2], 2.0);
+    vec4 planes[6];
+    glm_frustum_planes(state->uniforms.mat_vp, planes);
+    count = sokol_cull_spheres(visible, (const vec4*)spheres, count,
+        (const vec4*)planes);
+
+    /* Rank lights by their brightest color channel, attenuated by the
+     * distance to the eye. Lights that were selected in the last frame get
+     * a higher score, so that lights with a similar score don't flicker. */
+    for (i = 0; i < count; i ++) {
+        sokol_light_candidate_t *c = &candidates[i];
+        *c = candidates[visible[i]];
+        const float *color = c->light.color;
+        float brightness = glm_max(color[0], glm_max(color[1], color[2]));
+        float d = glm_vec3_norm(c->light.position);
+        c->score = brightness * expf(-d / c->light.distance);
+        if (ecs_map_get(&r->lights_selected, c->entity)) {
+            c->score *= SOKOL_LIGHT_HYSTERESIS;
+        }
+    }
+
+    int32_t lights_count = glm_imin(count, max_count);
+    if (count > lights_count) {
+        sokol_select_lights(candidates, count, lights_count);
+    }
+
+    r->lights_dropped = count - lights_count;
+    if (r->lights_dropped) {
+        ecs_dbg_3("sokol: %d visible lights dropped", r->lights_dropped);
+    }
 
-    return (d1 > d2) - (d1 < d2);
+    ecs_vec_set_count_t(NULL, &r->lights, sokol_light_t, lights_count);
+    sokol_light_t *lights = ecs_vec_first(&r->lights);
+    ecs_map_clear(&r->lights_selected);
+    for (i = 0; i < lights_count; i ++) {
+        lights[i] = candidates[i].light;
+        ecs_map_insert(&r->lights_selected, candidates[i].entity, 0);
+    }
 }
 
 /* Collect lights */
 static
 void sokol_gather_lights(ecs_world_t *world, SokolRenderer *r, sokol_render_state_t *state) {
-    ecs_vec_clear(&r->lights);
+    /* Light positions are relative to the eye, so lights only need to be
+     * collected again if lights or the camera changed. */
+    bool changed = ecs_query_changed(r->lights_query);
+    changed |= !r->lights_valid;
+    changed |= ecs_os_memcmp(r->lights_mat_vp, state->uniforms.mat_vp,
+        ECS_SIZEOF(mat4)) != 0;
+    changed |= ecs_os_memcmp(r->lights_eye_pos, state->uniforms.eye_pos,
+        ECS_SIZEOF(vec3)) != 0;
+    if (!changed) {
+        state->lights = r->lights;
+        return;
+    }
 
     vec3 eye_pos;
     glm_vec3_copy(state->uniforms.eye_pos, eye_pos);
 
     eye_pos[0] *= -1;
 
+    ecs_vec_t *dst = &r->light_candidates;
+    ecs_vec_clear(dst);
+
     ecs_iter_t it = ecs_query_iter(world, r->lights_query);
     while (ecs_query_next(&it)) {
         EcsPointLight *l = ecs_field(&it, EcsPointLight, 0);
         EcsTransform3 *m = ecs_field(&it, EcsTransform3, 1);
 
         for (int i = 0; i < it.count; i ++) {
-            sokol_light_t *light = ecs_vec_append_t(
-                NULL, &r->lights, sokol_light_t);
-            glm_vec3_copy(l[i].color, light->color);
-
-            light->color[0] *= l[i].intensity;
-            light->color[1] *= l[i].intensity;
-            light->color[2] *= l[i].intensity;
-
-            vec3 pos = {
-                m[i].value[3][0],
-                m[i].value[3][1],
-                m[i].value[3][2]
-            };
-
-            light->position[0] = pos[0];
-            light->position[1] = pos[1];
-            light->position[2] = pos[2];
-
-            light->distance = l[i].distance;
-
-            glm_vec3_sub(light->position, eye_pos, light->position);
+            sokol_light_candidate_t *c = ecs_vec_append_t(
+                NULL, dst, sokol_light_candidate_t);
+            sokol_init_light(&c->light, &l[i], &m[i], eye_pos);
+            c->entity = it.entities[i];
         }
     }
 
-    sokol_light_t *lights = ecs_vec_first(&r->lights);
-    qsort(lights, ecs_vec_count(&r->lights), sizeof(sokol_light_t),
-        sokol_qsort_light_compare);
+#if SOKOL_CLUSTERED_LIGHTS
+    /* Lights are selected per cluster, so only drop lights that don't fit in
+     * the light texture, starting with the ones that contribute least. */
+    sokol_select_visible_lights(r, state, eye_pos, SOKOL_CLUSTER_MAX_LIGHTS);
+#else
+    sokol_select_visible_lights(r, state, eye_pos, SOKOL_MAX_LIGHTS);
+#endif
 
-    int32_t lights_count = ecs_vec_count(&r->lights);
-    if (lights_count > SOKOL_MAX_LIGHTS) {
-        lights_count = SOKOL_MAX_LIGHTS;
-    }
-
-    ecs_vec_set_count_t(NULL, &r->lights, sokol_light_t, lights_count);
+    glm_mat4_copy(state->uniforms.mat_vp, r->lights_mat_vp);
+    glm_vec3_copy(state->uniforms.eye_pos, r->lights_eye_pos);
+    r->lights_valid = true;
 
     state->lights = r->lights;
 }
 
-/* Render */
+/* Prepare frame: compute uniforms, cull instances and collect lights */
 static
-void SokolRender(ecs_iter_t *it) {
+void SokolPrepareRender(ecs_iter_t *it) {
     ecs_world_t *world = it->world;
     SokolRenderer *r = ecs_field(it, SokolRenderer, 0);
     SokolQuery *q_buffers = ecs_field(it, SokolQuery, 1);
     sokol_render_state_t state = {0};
-    sokol_fx_resources_t *fx = r->fx;
 
     if (it->count > 1) {
         ecs_err("sokol: multiple canvas instances unsupported");
@@ -417,11 +537,17 @@ void SokolRender(ecs_iter_t *it) {
     }
 
     /* Load active camera & light data from canvas */
+    const EcsCamera *camera = NULL;
     if (canvas->camera) {
-        state.camera = ecs_get(world, canvas->camera, EcsCamera);
+        camera = ecs_get(world, canvas->camera, EcsCamera);
         r->camera = canvas->camera;
+    }
+
+    if (camera) {
+        state.camera = *camera;
+        state.has_camera = true;
 
-        float camera_y_offset = state.camera->position[1] - state.uniforms.shadow_far / 2;
+        float camera_y_offset = state.camera.position[1] - state.uniforms.shadow_far / 2;
         if (camera_y_offset < 0) {
             camera_y_offset = 0;
         }
@@ -430,11 +556,15 @@ void SokolRender(ecs_iter_t *it) {
         state.uniforms.shadow_far = glm_max(
             state.uniforms.shadow_far, pow(camera_y_offset, 1.4));
         state.uniforms.shadow_far = glm_min(state.uniforms.shadow_far,
-            state.camera->far_);
+            state.camera.far_);
     }
 
     /* Get atmosphere settings */
-    state.atmosphere = ecs_get(world, r->canvas, EcsAtmosphere);
+    const EcsAtmosphere *atmosphere = ecs_get(world, r->canvas, EcsAtmosphere);
+    if (atmosphere) {
+        state.atmosphere = *atmosphere;
+        state.has_atmosphere = true;
+    }
 
     /* Get ambient light */
     state.ambient_light = canvas->ambient_light;
@@ -444,8 +574,12 @@ void SokolRender(ecs_iter_t *it) {
     state.ambient_light_ground_intensity = canvas->ambient_light_ground_intensity;
 
     if (canvas->directional_light) {
-        state.light = ecs_get(world, canvas->directional_light, 
-            EcsDirectionalLight);
+        const EcsDirectionalLight *light = ecs_get(world, 
+            canvas->directional_light, EcsDirectionalLight);
+        if (light) {
+            state.light = *light;
+            state.has_light = true;
+        }
     } else {
         /* Set default ambient light if nothing is configured */
         if (!state.ambient_light.r && !state.ambient_light.g && 
@@ -458,12 +592,81 @@ void SokolRender(ecs_iter_t *it) {
     /* Compute uniforms that are shared between passes */
     sokol_init_global_uniforms(&state);
 
+#if SOKOL_CULL_INSTANCES
+    /* Find instances that are visible to the camera */
+    sokol_cull_instances(world, state.q_scene, SOKOL_VIEW_CAMERA, 
+        state.uniforms.mat_vp, state.uniforms.mat_v, (float)state.height);
+#endif
+
     /* Collect lights for scene */
     sokol_gather_lights(world, r, &state);
 
-    /* Compute shadow parameters and run shadow pass */
+    /* Compute shadow parameters */
     if (canvas->directional_light) {
         sokol_init_light_mat_vp(&state);
+#if SOKOL_CULL_INSTANCES
+        sokol_cull_shadow_casters(world, state.q_scene, 
+            state.uniforms.light_mat_vp, state.uniforms.mat_vp, 
+            state.uniforms.sun_direction);
+#endif
+    }
+
+    /* Collect geometry to draw, shared by all passes */
+    sokol_build_draw_list(world, state.q_scene, &r->draw_list);
+    state.draw_list = r->draw_list;
+
+#if SOKOL_CLUSTERED_LIGHTS
+    /* Set up cluster planes for binning lights on worker threads */
+    vec3 eye_pos;
+    glm_vec3_copy(state.uniforms.eye_pos, eye_pos);
+    eye_pos[0] *= -1;
+    sokol_clusters_prepare(&r->clusters, &state.lights, eye_pos,
+        state.uniforms.mat_vp, state.uniforms.mat_v, state.uniforms.near_,
+        state.uniforms.far_, ecs_get_stage_count(world));
+    state.cluster_depth_scale = r->clusters.depth_scale;
+    state.cluster_depth_bias = r->clusters.depth_bias;
+#endif
+
+    r->state = state;
+}
+
+#if SOKOL_CLUSTERED_LIGHTS
+/* Bin lights into clusters. Runs on all worker threads, every worker bins a
+ * range of depth slices. */
+static
+void SokolClusterLights(ecs_iter_t *it) {
+    ecs_world_t *stage = it->world;
+    int32_t stage_id = ecs_stage_get_id(stage);
+
+    /* Work is not divided by entity, so don't use system iterator */
+    ecs_iter_fini(it);
+
+    /* Stages only write to their own bins, so this doesn't race */
+    SokolRenderer *r = ecs_get_mut(stage, SokolRendererInst, SokolRenderer);
+    if (r) {
+        sokol_clusters_bin(&r->clusters, stage_id);
+    }
+}
+#endif
+
+/* Render */
+static
+void SokolRender(ecs_iter_t *it) {
+    ecs_world_t *world = it->world;
+    SokolRenderer *r = ecs_field(it, SokolRenderer, 0);
+    sokol_render_state_t state = r->state;
+    sokol_fx_resources_t *fx = r->fx;
+    const EcsCanvas *canvas = ecs_get(world, r->canvas, EcsCanvas);
+
+#if SOKOL_CLUSTERED_LIGHTS
+    sokol_clusters_upload(&r->clusters);
+    state.light_data = r->clusters.lights;
+    state.light_clusters = r->clusters.clusters;
+    state.light_indices = r->clusters.indices;
+#endif
+
+    /* Run shadow pass */
+    if (canvas->directional_light) {
         sokol_run_shadow_pass(&r->shadow_pass, &state);
     }
 
@@ -471,7 +674,7 @@ void SokolRender(ecs_iter_t *it) {
     sokol_run_depth_pass(&r->depth_pass, &state);
 
     /* Render atmosphere */
-    if (state.atmosphere) {
+    if (state.has_atmosphere) {
         sokol_run_atmos_pass(&r->atmos_pass, &state);
         state.atmos = r->atmos_pass.color_target;
     } else {
@@ -482,6 +685,9 @@ void SokolRender(ecs_iter_t *it) {
     sokol_run_scene_pass(&r->scene_pass, &state);
     sg_image hdr = r->scene_pass.color_target;
 
+    /* Add depth of entities that are not in the depth prepass */
+    sokol_run_late_depth_pass(&r->depth_pass, &state);
+
     /* Ssao */
     sg_image ssao = sokol_fx_run(&fx->ssao, 2, (sg_image[]){ 
         hdr, r->depth_pass.color_target }, 
@@ -504,6 +710,7 @@ void SokolRender(ecs_iter_t *it) {
 
 static
 void SokolCommit(ecs_iter_t *it) {
+    sokol_submit_frame();
     sg_commit();
 }
 
@@ -543,12 +750,16 @@ void SokolInitRenderer(ecs_iter_t *it) {
     ecs_vec_t lights; 
     ecs_vec_init_t(NULL, &lights, sokol_light_t, 0);
 
+    ecs_vec_t draw_list;
+    ecs_vec_init_t(NULL, &draw_list, sokol_draw_batch_t, 0);
+
     ecs_query_t *lights_query = ecs_query(world, {
         .terms = {
             { ecs_id(EcsPointLight) },
             { ecs_id(EcsTransform3) }
         },
-        .cache_kind = EcsQueryCacheAuto
+        .cache_kind = EcsQueryCacheAuto,
+        .flags = EcsQueryDetectChanges
     });
 
     ecs_set(world, SokolRendererInst, SokolRenderer, {
@@ -561,9 +772,20 @@ void SokolInitRenderer(ecs_iter_t *it) {
         .screen_pass = sokol_init_screen_pass(),
         .fx = sokol_init_fx(w, h),
         .lights = lights,
-        .lights_query = lights_query
+        .lights_query = lights_query,
+        .draw_list = draw_list
     });
 
+    SokolRenderer *renderer = ecs_get_mut(world, SokolRendererInst, SokolRenderer);
+#if SOKOL_CLUSTERED_LIGHTS
+    sokol_clusters_init(&renderer->clusters);
+#endif
+    ecs_vec_init_t(NULL, &renderer->light_candidates, 
+        sokol_light_candidate_t, 0);
+    ecs_vec_init_t(NULL, &renderer->light_spheres, vec4, 0);
+    ecs_vec_init_t(NULL, &renderer->light_visible, int32_t, 0);
+    ecs_map_init(&renderer->lights_selected, NULL);
+
     ecs_trace("sokol: canvas initialized");
 
     ecs_set_pair(world, SokolRendererInst, SokolQuery, ecs_id(SokolGeometry), {
@@ -583,6 +805,17 @@ void SokolInitRenderer(ecs_iter_t *it) {
 static
 void SokolFiniRenderer(ecs_iter_t *it) {
     ecs_trace("sokol: shutting down");
+    SokolRenderer *r = ecs_field(it, SokolRenderer, 0);
+    for (int i = 0; i < it->count; i ++) {
+#if SOKOL_CLUSTERED_LIGHTS
+        sokol_clusters_fini(&r[i].clusters);
+#endif
+        ecs_vec_fini_t(NULL, &r[i].light_candidates, sokol_light_candidate_t);
+        ecs_vec_fini_t(NULL, &r[i].light_spheres, vec4);
+        ecs_vec_fini_t(NULL, &r[i].light_visible, int32_t);
+        ecs_map_fini(&r[i].lights_selected);
+    }
+    sokol_submit_fini();
     sg_shutdown();
 }
 
@@ -618,11 +851,30 @@ void FlecsSystemsSokolRendererImport(
     ECS_OBSERVER(world, SokolFiniRenderer, EcsOnRemove, 
         flecs.systems.sokol.Renderer);
 
-    /* System that orchestrates the render tasks */
-    ECS_SYSTEM(world, SokolRender, EcsOnStore, 
+    /* System that prepares the frame before rendering */
+    ECS_SYSTEM(world, SokolPrepareRender, EcsOnStore, 
         flecs.systems.sokol.Renderer,
         (sokol.Query, Geometry));
 
+#if SOKOL_CLUSTERED_LIGHTS
+    /* Binning lights into clusters is divided over worker threads */
+    ecs_system(world, {
+        .entity = ecs_entity(world, {
+            .name = "SokolClusterLights",
+            .add = ecs_ids( ecs_dependson(EcsOnStore) )
+        }),
+        .query.terms = {
+            { .id = ecs_id(SokolRenderer), .inout = EcsInOut }
+        },
+        .run = SokolClusterLights,
+        .multi_threaded = true
+    });
+#endif
+
+    /* System that orchestrates the render tasks */
+    ECS_SYSTEM(world, SokolRender, EcsOnStore, 
+        flecs.systems.sokol.Renderer);
+
     /* System that calls sg_commit */
     ECS_SYSTEM(world, SokolCommit, EcsOnStore, 0);
 }
@@ -5,6 +5,7 @@
 #define SOKOL_MODULES_RENDERER_H
 
 #include "../../types.h"
+#include "clusters.h"
 
 typedef struct SokolRenderer {
     sokol_resources_t resources;
@@ -22,6 +23,21 @@ typedef struct SokolRenderer {
 
     ecs_query_t *lights_query;
     ecs_vec_t lights;
+#if SOKOL_CLUSTERED_LIGHTS
+    sokol_light_clusters_t clusters;
+#endif
+    ecs_vec_t light_candidates; /* Lights before culling & selection */
+    ecs_vec_t light_spheres;    /* Range of candidates (vec<vec4>) */
+    ecs_vec_t light_visible;    /* Candidates that are in view (vec<int32_t>) */
+    ecs_map_t lights_selected;  /* Entities of lights in last selection */
+    int32_t lights_dropped;     /* Visible lights that didn't fit */
+    mat4 lights_mat_vp;         /* Camera of last light selection */
+    vec3 lights_eye_pos;
+    bool lights_valid;
+
+    ecs_vec_t draw_list;
+
+    sokol_render_state_t state; /* State of frame that is being rendered */
 } SokolRenderer;
 
 extern ECS_COMPONENT_DECLARE(SokolRenderer);
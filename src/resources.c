@@ -25,6 +25,16 @@ uint16_t rectangle_indices[] = {
     0, 2, 3
 };
 
+/* Front & back side of rectangle, so that impostors are visible regardless of
+ * how they are oriented */
+static
+uint16_t rectangle_impostor_indices[] = {
+    0, 1, 2,
+    0, 2, 3,
+    2, 1, 0,
+    3, 2, 0
+};
+
 static
 vec3 box_vertices[] = {
     {-0.5f,  0.5f, -0.5f},  
@@ -254,6 +264,20 @@ int32_t sokol_rectangle_index_count(void)
     return 6;
 }
 
+sg_buffer sokol_buffer_rectangle_impostor_indices(void)
+{
+    return sg_make_buffer(&(sg_buffer_desc){
+        .data = { rectangle_impostor_indices, sizeof(rectangle_impostor_indices) },
+        .type = SG_BUFFERTYPE_INDEXBUFFER,
+        .usage = SG_USAGE_IMMUTABLE
+    });
+}
+
+int32_t sokol_rectangle_impostor_index_count(void)
+{
+    return 12;
+}
+
 sg_buffer sokol_buffer_rectangle_normals(void)
 {
     vec3 normals[4];
@@ -266,6 +290,203 @@ sg_buffer sokol_buffer_rectangle_normals(void)
     });
 }
 
+// Same as compute_flat_normals, but accumulates the (area weighted) normals 
+// of the triangles that share a vertex. Degenerate triangles don't contribute.
+static
+void compute_smooth_normals(
+    vec3 *vertices,
+    int32_t vertex_count,
+    uint16_t *indices,
+    int32_t count,
+    vec3 *normals_out)
+{
+    int32_t v;
+    for (v = 0; v < vertex_count; v ++) {
+        glm_vec3_zero(normals_out[v]);
+    }
+
+    for (v = 0; v < count; v += 3) {
+        vec3 v1, v2, normal;
+        glm_vec3_sub(vertices[indices[v + 0]], vertices[indices[v + 1]], v1);
+        glm_vec3_sub(vertices[indices[v + 0]], vertices[indices[v + 2]], v2);
+        glm_vec3_cross(v2, v1, normal);
+
+        glm_vec3_add(normals_out[indices[v + 0]], normal, normals_out[indices[v + 0]]);
+        glm_vec3_add(normals_out[indices[v + 1]], normal, normals_out[indices[v + 1]]);
+        glm_vec3_add(normals_out[indices[v + 2]], normal, normals_out[indices[v + 2]]);
+    }
+
+    for (v = 0; v < vertex_count; v ++) {
+        glm_vec3_normalize(normals_out[v]);
+    }
+}
+
+/* Vertices and indices of a procedural mesh while it is generated */
+typedef struct mesh_builder_t {
+    ecs_vec_t vertices;         /* vec<vec3> */
+    ecs_vec_t indices;          /* vec<uint16_t> */
+} mesh_builder_t;
+
+static
+uint16_t mesh_vertex(
+    mesh_builder_t *b,
+    float x,
+    float y,
+    float z)
+{
+    int32_t index = ecs_vec_count(&b->vertices);
+    ecs_assert(index <= UINT16_MAX, ECS_OUT_OF_RANGE, NULL);
+    float *v = *ecs_vec_append_t(NULL, &b->vertices, vec3);
+    v[0] = x;
+    v[1] = y;
+    v[2] = z;
+    return (uint16_t)index;
+}
+
+static
+void mesh_triangle(
+    mesh_builder_t *b,
+    int32_t i0,
+    int32_t i1,
+    int32_t i2)
+{
+    uint16_t *t = ecs_vec_grow_t(NULL, &b->indices, uint16_t, 3);
+    t[0] = (uint16_t)i0;
+    t[1] = (uint16_t)i1;
+    t[2] = (uint16_t)i2;
+}
+
+// Flat disk at height y. The disk faces up if up is true.
+static
+void mesh_disk(
+    mesh_builder_t *b,
+    int32_t segments,
+    float y,
+    bool up)
+{
+    int32_t s, center = mesh_vertex(b, 0, y, 0);
+    for (s = 0; s <= segments; s ++) {
+        float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+        mesh_vertex(b, 0.5f * cosf(a), y, 0.5f * sinf(a));
+    }
+    for (s = 0; s < segments; s ++) {
+        if (up) {
+            mesh_triangle(b, center, center + s + 2, center + s + 1);
+        } else {
+            mesh_triangle(b, center, center + s + 1, center + s + 2);
+        }
+    }
+}
+
+// Upload mesh to sokol buffers, and free the builder
+static
+sokol_mesh_t mesh_make(
+    mesh_builder_t *b)
+{
+    int32_t vertex_count = ecs_vec_count(&b->vertices);
+    int32_t index_count = ecs_vec_count(&b->indices);
+    vec3 *vertices = ecs_vec_first_t(&b->vertices, vec3);
+    uint16_t *indices = ecs_vec_first_t(&b->indices, uint16_t);
+    vec3 *normals = ecs_os_malloc_n(vec3, vertex_count);
+    compute_smooth_normals(vertices, vertex_count, indices, index_count, normals);
+
+    sokol_mesh_t result = {
+        .vertices = sg_make_buffer(&(sg_buffer_desc){
+            .data = { vertices, vertex_count * sizeof(vec3) },
+            .usage = SG_USAGE_IMMUTABLE
+        }),
+        .normals = sg_make_buffer(&(sg_buffer_desc){
+            .data = { normals, vertex_count * sizeof(vec3) },
+            .usage = SG_USAGE_IMMUTABLE
+        }),
+        .indices = sg_make_buffer(&(sg_buffer_desc){
+            .data = { indices, index_count * sizeof(uint16_t) },
+            .type = SG_BUFFERTYPE_INDEXBUFFER,
+            .usage = SG_USAGE_IMMUTABLE
+        }),
+        .index_count = index_count
+    };
+
+    ecs_os_free(normals);
+    ecs_vec_fini_t(NULL, &b->vertices, vec3);
+    ecs_vec_fini_t(NULL, &b->indices, uint16_t);
+    return result;
+}
+
+sokol_mesh_t sokol_mesh_sphere(
+    int32_t segments)
+{
+    mesh_builder_t b = {0};
+    int32_t rings = glm_imax(segments / 2, 2), r, s;
+
+    for (r = 0; r <= rings; r ++) {
+        float t = (float)r / (float)rings * GLM_PIf;
+        for (s = 0; s <= segments; s ++) {
+            float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+            mesh_vertex(&b, 0.5f * sinf(t) * cosf(a), 0.5f * cosf(t), 
+                0.5f * sinf(t) * sinf(a));
+        }
+    }
+
+    for (r = 0; r < rings; r ++) {
+        for (s = 0; s < segments; s ++) {
+            int32_t i0 = r * (segments + 1) + s, i1 = i0 + segments + 1;
+            mesh_triangle(&b, i0, i0 + 1, i1);
+            mesh_triangle(&b, i0 + 1, i1 + 1, i1);
+        }
+    }
+
+    return mesh_make(&b);
+}
+
+sokol_mesh_t sokol_mesh_cylinder(
+    int32_t segments)
+{
+    mesh_builder_t b = {0};
+    int32_t s;
+
+    for (s = 0; s <= segments; s ++) {
+        float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+        mesh_vertex(&b, 0.5f * cosf(a),  0.5f, 0.5f * sinf(a));
+        mesh_vertex(&b, 0.5f * cosf(a), -0.5f, 0.5f * sinf(a));
+    }
+
+    for (s = 0; s < segments; s ++) {
+        int32_t i0 = s * 2, i1 = i0 + 1;
+        mesh_triangle(&b, i0, i0 + 2, i1);
+        mesh_triangle(&b, i0 + 2, i1 + 2, i1);
+    }
+
+    mesh_disk(&b, segments,  0.5f, true);
+    mesh_disk(&b, segments, -0.5f, false);
+
+    return mesh_make(&b);
+}
+
+sokol_mesh_t sokol_mesh_cone(
+    int32_t segments)
+{
+    mesh_builder_t b = {0};
+    int32_t s;
+
+    // Each side triangle has its own apex, so that normals at the apex aren't
+    // averaged to point straight up.
+    for (s = 0; s <= segments; s ++) {
+        float a = (float)s / (float)segments * 2.0f * GLM_PIf;
+        mesh_vertex(&b, 0, 0.5f, 0);
+        mesh_vertex(&b, 0.5f * cosf(a), -0.5f, 0.5f * sinf(a));
+    }
+
+    for (s = 0; s < segments; s ++) {
+        int32_t i0 = s * 2, i1 = i0 + 1;
+        mesh_triangle(&b, i0, i1 + 2, i1);
+    }
+
+    mesh_disk(&b, segments, -0.5f, false);
+
+    return mesh_make(&b);
+}
+
 sg_pass_action sokol_clear_action(
     ecs_rgb_t color,
     bool clear_color,
@@ -54,8 +54,24 @@ sg_buffer sokol_buffer_rectangle_indices(void);
 
 int32_t sokol_rectangle_index_count(void);
 
+sg_buffer sokol_buffer_rectangle_impostor_indices(void);
+
+int32_t sokol_rectangle_impostor_index_count(void);
+
 sg_buffer sokol_buffer_rectangle_normals(void);
 
+/* Procedural primitives with a diameter and height of 1, centered on the 
+ * origin. Cylinders and cones are aligned with the y axis, and the tip of a 
+ * cone points up. Segments is the number of subdivisions around the y axis. */
+sokol_mesh_t sokol_mesh_sphere(
+    int32_t segments);
+
+sokol_mesh_t sokol_mesh_cylinder(
+    int32_t segments);
+
+sokol_mesh_t sokol_mesh_cone(
+    int32_t segments);
+
 sg_pass_action sokol_clear_action(
     ecs_rgb_t color,
     bool clear_color,
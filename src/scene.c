@@ -1,65 +1,127 @@
 #include "private_api.h"
 
+/* Uniform structs have the std140 layout, so they can be copied as is to a
+ * uniform block. A vec3 is followed by a float member or padding. */
 typedef struct scene_vs_uniforms_t {
     mat4 mat_v;
     mat4 mat_vp;
     mat4 light_mat_vp;
     float near_;
     float far_;
+    float padding[2];
 } scene_vs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, mat_v, 0);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, mat_vp, 64);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, light_mat_vp, 128);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, near_, 192);
+SOKOL_UNIFORM_OFFSET(scene_vs_uniforms_t, far_, 196);
+SOKOL_UNIFORM_SIZE(scene_vs_uniforms_t, 208);
+
 typedef struct scene_fs_uniforms_t {
     vec3 light_ambient;
-    vec3 light_ambient_ground;
-    vec3 light_direction;
-    vec3 light_color;
-    vec3 eye_pos;
     float light_ambient_ground_falloff;
+    vec3 light_ambient_ground;
     float light_ambient_ground_offset;
+    vec3 light_direction;
     float light_ambient_ground_intensity;
+    vec3 light_color;
     float shadow_map_size;
+    vec3 eye_pos;
     float shadow_far;
     int light_count;
+    float cluster_depth_scale;
+    float cluster_tile_scale[2];
+    float cluster_depth_bias;
+    float padding[3];
 } scene_fs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient, 0);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground_falloff, 12);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground, 16);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground_offset, 28);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_direction, 32);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_ambient_ground_intensity, 44);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_color, 48);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, shadow_map_size, 60);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, eye_pos, 64);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, shadow_far, 76);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, light_count, 80);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, cluster_depth_scale, 84);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, cluster_tile_scale, 88);
+SOKOL_UNIFORM_OFFSET(scene_fs_uniforms_t, cluster_depth_bias, 96);
+SOKOL_UNIFORM_SIZE(scene_fs_uniforms_t, 112);
+
+/* std140 arrays have a 16 byte stride, so the light distance is stored in the
+ * w component of the position */
 typedef struct scene_fs_lights_t {
-    vec3 light_colors[SOKOL_MAX_LIGHTS];
-    vec3 light_positions[SOKOL_MAX_LIGHTS];
-    float light_distance[SOKOL_MAX_LIGHTS];
+    vec4 light_colors[SOKOL_MAX_LIGHTS];
+    vec4 light_positions[SOKOL_MAX_LIGHTS];
 } scene_fs_lights_t;
 
+SOKOL_UNIFORM_OFFSET(scene_fs_lights_t, light_colors, 0);
+SOKOL_UNIFORM_OFFSET(scene_fs_lights_t, light_positions, 16 * SOKOL_MAX_LIGHTS);
+SOKOL_UNIFORM_SIZE(scene_fs_lights_t, 32 * SOKOL_MAX_LIGHTS);
+
 typedef struct scene_fs_sun_atmos_uniforms_t {
     vec3 sun_screen_pos;
-    vec3 sun_color;
-    vec2 target_size;
     float aspect;
+    vec3 sun_color;
     float sun_intensity;
+    vec2 target_size;
+    float padding[2];
 } scene_fs_sun_atmos_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, sun_screen_pos, 0);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, aspect, 12);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, sun_color, 16);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, sun_intensity, 28);
+SOKOL_UNIFORM_OFFSET(scene_fs_sun_atmos_uniforms_t, target_size, 32);
+SOKOL_UNIFORM_SIZE(scene_fs_sun_atmos_uniforms_t, 48);
+
 #define POSITION_I 0
 #define NORMAL_I 1
 #define COLOR_I 2
 #define MATERIAL_I 3
 #define TRANSFORM_I 4
+#define SCALE_I 8
+#define INSTANCE_I 2
 #define LAYOUT_I_STR(i) #i
 #define LAYOUT(loc) "layout(location=" LAYOUT_I_STR(loc) ") "
 
-sg_pipeline init_scene_pipeline(int32_t sample_count) {
+#if SOKOL_CLUSTERED_LIGHTS
+#define SCENE_SHADER_DEFINES \
+    "#define CLUSTERED_LIGHTS\n" \
+    "#define CLUSTER_X " SOKOL_STR(SOKOL_CLUSTER_X) "\n" \
+    "#define CLUSTER_Y " SOKOL_STR(SOKOL_CLUSTER_Y) "\n" \
+    "#define CLUSTER_Z " SOKOL_STR(SOKOL_CLUSTER_Z) "\n" \
+    "#define CLUSTER_TEXTURE_WIDTH " SOKOL_STR(SOKOL_CLUSTER_TEXTURE_WIDTH) "\n" \
+    "#define LIGHT_RANGE " SOKOL_STR(SOKOL_LIGHT_RANGE) "\n"
+#else
+#define SCENE_SHADER_DEFINES ""
+#endif
+
+sg_pipeline init_scene_pipeline(int32_t sample_count, bool write_depth) {
     char *vs = sokol_shader_from_str(
         SOKOL_SHADER_HEADER
-        "uniform mat4 u_mat_vp;\n"
-        "uniform mat4 u_mat_v;\n"
-        "uniform mat4 u_light_vp;\n"
+        SCENE_SHADER_DEFINES
+        "SOKOL_UNIFORM_BLOCK(scene_vs_params)\n"
+        "SOKOL_UNIFORM mat4 u_mat_v;\n"
+        "SOKOL_UNIFORM mat4 u_mat_vp;\n"
+        "SOKOL_UNIFORM mat4 u_light_vp;\n"
+        "SOKOL_UNIFORM float u_near;\n"
+        "SOKOL_UNIFORM float u_far;\n"
+        "SOKOL_UNIFORM_BLOCK_END\n"
         LAYOUT(POSITION_I)  "in vec3 v_position;\n"
         LAYOUT(NORMAL_I)    "in vec3 v_normal;\n"
-        LAYOUT(COLOR_I)     "in vec3 i_color;\n"
-        LAYOUT(MATERIAL_I)  "in vec3 i_material;\n"
-        LAYOUT(TRANSFORM_I) "in mat4 i_mat_m;\n"
+        SOKOL_SHADER_INSTANCE_COLOR(COLOR_I, MATERIAL_I)
+        SOKOL_SHADER_INSTANCE_TRANSFORM(TRANSFORM_I, SCALE_I)
         "#include \"etc/sokol/shaders/scene_vert.glsl\"\n"
     );
 
     char *fs = sokol_shader_from_str(
         SOKOL_SHADER_HEADER
+        SCENE_SHADER_DEFINES
         "#include \"etc/sokol/shaders/scene_frag.glsl\"\n"
     );
 
@@ -68,13 +130,14 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
         .vs.uniform_blocks = {
             [0] = {
                 .size = sizeof(scene_vs_uniforms_t),
+                .layout = SG_UNIFORMLAYOUT_STD140,
+                .block_name = "scene_vs_params",
                 .uniforms = {
                     [0] = { .name="u_mat_v", .type=SG_UNIFORMTYPE_MAT4 },
                     [1] = { .name="u_mat_vp", .type=SG_UNIFORMTYPE_MAT4 },
                     [2] = { .name="u_light_vp", .type=SG_UNIFORMTYPE_MAT4 },
-                    [3] = { .name="padding", .type=SG_UNIFORMTYPE_FLOAT2 },
-                    [4] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
-                    [5] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT }
+                    [3] = { .name="u_near", .type=SG_UNIFORMTYPE_FLOAT },
+                    [4] = { .name="u_far", .type=SG_UNIFORMTYPE_FLOAT }
                 },
             }
         },
@@ -83,33 +146,57 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
                 [0] = {
                     .name = "shadow_map",
                     .image_type = SG_IMAGETYPE_2D
+                },
+#if SOKOL_CLUSTERED_LIGHTS
+                [1] = {
+                    .name = "u_light_data",
+                    .image_type = SG_IMAGETYPE_2D
+                },
+                [2] = {
+                    .name = "u_light_clusters",
+                    .image_type = SG_IMAGETYPE_2D,
+                    .sampler_type = SG_SAMPLERTYPE_UINT
+                },
+                [3] = {
+                    .name = "u_light_indices",
+                    .image_type = SG_IMAGETYPE_2D,
+                    .sampler_type = SG_SAMPLERTYPE_UINT
                 }
+#endif
             },
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(scene_fs_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "scene_fs_params",
                     .uniforms = {
                         [0] = { .name="u_light_ambient", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [1] = { .name="u_light_ambient_ground", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [2] = { .name="u_light_direction", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [3] = { .name="u_light_color", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [4] = { .name="u_eye_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [5] = { .name="u_light_ambient_ground_falloff", .type=SG_UNIFORMTYPE_FLOAT },
-                        [6] = { .name="u_light_ambient_ground_offset", .type=SG_UNIFORMTYPE_FLOAT },
-                        [7] = { .name="u_light_ambient_ground_intensity", .type=SG_UNIFORMTYPE_FLOAT },
-                        [8] = { .name="u_shadow_map_size", .type=SG_UNIFORMTYPE_FLOAT },
+                        [1] = { .name="u_light_ambient_ground_falloff", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_light_ambient_ground", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [3] = { .name="u_light_ambient_ground_offset", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="u_light_direction", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [5] = { .name="u_light_ambient_ground_intensity", .type=SG_UNIFORMTYPE_FLOAT },
+                        [6] = { .name="u_light_color", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [7] = { .name="u_shadow_map_size", .type=SG_UNIFORMTYPE_FLOAT },
+                        [8] = { .name="u_eye_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
                         [9] = { .name="u_shadow_far", .type=SG_UNIFORMTYPE_FLOAT },
-                        [10] = { .name="u_light_count", .type=SG_UNIFORMTYPE_INT }
+                        [10] = { .name="u_light_count", .type=SG_UNIFORMTYPE_INT },
+                        [11] = { .name="u_cluster_depth_scale", .type=SG_UNIFORMTYPE_FLOAT },
+                        [12] = { .name="u_cluster_tile_scale", .type=SG_UNIFORMTYPE_FLOAT2 },
+                        [13] = { .name="u_cluster_depth_bias", .type=SG_UNIFORMTYPE_FLOAT }
                     }
                 },
+#if !SOKOL_CLUSTERED_LIGHTS
                 [1] = {
                     .size = sizeof(scene_fs_lights_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "scene_fs_lights",
                     .uniforms = {
-                        [0] = { .name="u_point_light_color",    .type=SG_UNIFORMTYPE_FLOAT3, .array_count = SOKOL_MAX_LIGHTS },
-                        [1] = { .name="u_point_light_position", .type=SG_UNIFORMTYPE_FLOAT3, .array_count = SOKOL_MAX_LIGHTS  },
-                        [2] = { .name="u_point_light_distance", .type=SG_UNIFORMTYPE_FLOAT, .array_count = SOKOL_MAX_LIGHTS  },
+                        [0] = { .name="u_point_light_color",    .type=SG_UNIFORMTYPE_FLOAT4, .array_count = SOKOL_MAX_LIGHTS },
+                        [1] = { .name="u_point_light_position", .type=SG_UNIFORMTYPE_FLOAT4, .array_count = SOKOL_MAX_LIGHTS }
                     }
                 }
+#endif
             }
         },
 
@@ -120,39 +207,23 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
     ecs_os_free(vs);
     ecs_os_free(fs);
 
-    return sg_make_pipeline(&(sg_pipeline_desc){
+    sg_pipeline_desc desc = {
         .shader = shd,
         .index_type = SG_INDEXTYPE_UINT16,
         .layout = {
-            .buffers = {
-                [COLOR_I] =     { .stride = 0,  .step_func=SG_VERTEXSTEP_PER_INSTANCE },
-                [MATERIAL_I] =  { .stride = 12, .step_func=SG_VERTEXSTEP_PER_INSTANCE },
-                [TRANSFORM_I] = { .stride = 64, .step_func=SG_VERTEXSTEP_PER_INSTANCE } 
-            },
-
             .attrs = {
                 /* Static geometry */
                 [POSITION_I] =      { .buffer_index=POSITION_I, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-                [NORMAL_I] =        { .buffer_index=NORMAL_I,   .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Color buffer (per instance) */
-                [COLOR_I] =         { .buffer_index=COLOR_I,    .offset=0, .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Material buffer (per instance) */
-                [MATERIAL_I] =      { .buffer_index=MATERIAL_I, .offset=0, .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Matrix (per instance) */
-                [TRANSFORM_I] =     { .buffer_index=TRANSFORM_I, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT4 },
-                [TRANSFORM_I + 1] = { .buffer_index=TRANSFORM_I, .offset=16, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [TRANSFORM_I + 2] = { .buffer_index=TRANSFORM_I, .offset=32, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [TRANSFORM_I + 3] = { .buffer_index=TRANSFORM_I, .offset=48, .format=SG_VERTEXFORMAT_FLOAT4 }
+                [NORMAL_I] =        { .buffer_index=NORMAL_I,   .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 }
             }
         },
 
+        /* Instances that are not in the depth prepass write their own depth */
         .depth = {
             .pixel_format = SG_PIXELFORMAT_DEPTH,
-            .compare = SG_COMPAREFUNC_LESS_EQUAL,
-            .write_enabled = false
+            .compare = write_depth ? 
+                SG_COMPAREFUNC_LESS : SG_COMPAREFUNC_LESS_EQUAL,
+            .write_enabled = write_depth
         },
 
         .colors = {{
@@ -161,7 +232,13 @@ sg_pipeline init_scene_pipeline(int32_t sample_count) {
 
         .cull_mode = SG_CULLMODE_BACK,
         .sample_count = sample_count
-    });
+    };
+
+    /* Color, material & matrix (per instance) */
+    sokol_instance_pipeline_layout(&desc.layout, SOKOL_INSTANCE_ALL, 
+        INSTANCE_I, TRANSFORM_I, COLOR_I, MATERIAL_I);
+
+    return sg_make_pipeline(&desc);
 }
 
 sg_pipeline init_scene_atmos_sun_pipeline(int32_t sample_count) {
@@ -187,12 +264,14 @@ sg_pipeline init_scene_atmos_sun_pipeline(int32_t sample_count) {
             .uniform_blocks = {
                 [0] = {
                     .size = sizeof(scene_fs_sun_atmos_uniforms_t),
+                    .layout = SG_UNIFORMLAYOUT_STD140,
+                    .block_name = "scene_sun_params",
                     .uniforms = {
                         [0] = { .name="u_sun_screen_pos", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [1] = { .name="u_sun_color", .type=SG_UNIFORMTYPE_FLOAT3 },
-                        [2] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 },
-                        [3] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
-                        [4] = { .name="u_sun_intensity", .type=SG_UNIFORMTYPE_FLOAT }
+                        [1] = { .name="u_aspect", .type=SG_UNIFORMTYPE_FLOAT },
+                        [2] = { .name="u_sun_color", .type=SG_UNIFORMTYPE_FLOAT3 },
+                        [3] = { .name="u_sun_intensity", .type=SG_UNIFORMTYPE_FLOAT },
+                        [4] = { .name="u_target_size", .type=SG_UNIFORMTYPE_FLOAT2 }
                     }
                 }
             },
@@ -263,8 +342,9 @@ sokol_offscreen_pass_t sokol_init_scene_pass(
     pass.pass_action = sokol_clear_action(background_color, false, false);
 
     ecs_trace("sokol: initialize scene pipeline");
-    pass.pip = init_scene_pipeline(sample_count);
+    pass.pip = init_scene_pipeline(sample_count, false);
     pass.pip_2 = init_scene_atmos_sun_pipeline(sample_count);
+    pass.pip_3 = init_scene_pipeline(sample_count, true);
     pass.sample_count = sample_count;
 
     ecs_trace("sokol: initialized scene pass");
@@ -298,48 +378,53 @@ void scene_draw_atmos(
         .fs_images[0] = state->atmos
     };
 
-    sg_apply_bindings(&bind);
+    sokol_apply_bindings(&bind);
     sg_draw(0, 6, 1);
 }
 
 static
 void scene_draw_instances(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers,
-    sg_image shadow_map)
+    const sokol_draw_batch_t *batch,
+    const sokol_render_state_t *state,
+    bool no_prepass)
 {
-    if (!buffers->instance_count) {
-        return;
-    }
-
     sg_bindings bind = {
         .vertex_buffers = {
-            [POSITION_I] =  geometry->vertices,
-            [NORMAL_I] =    geometry->normals,
-            [COLOR_I] =     buffers->colors,
-            [MATERIAL_I] =  buffers->materials,
-            [TRANSFORM_I] = buffers->transforms
+            [POSITION_I] =  batch->mesh.vertices,
+            [NORMAL_I] =    batch->mesh.normals
         },
-        .index_buffer = geometry->indices,
-        .fs_images[0] = shadow_map
+        .index_buffer = batch->mesh.indices,
+        .fs_images[0] = state->shadow_map
     };
-
-    sg_apply_bindings(&bind);
-    sg_draw(0, geometry->index_count, buffers->instance_count);
+#if SOKOL_CLUSTERED_LIGHTS
+    bind.fs_images[1] = state->light_data;
+    bind.fs_images[2] = state->light_clusters;
+    bind.fs_images[3] = state->light_indices;
+#endif
+
+    if (no_prepass) {
+        sokol_draw_excluded_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, SOKOL_INSTANCE_ALL, 
+            INSTANCE_I);
+    } else {
+        sokol_draw_instances(batch->geometry, batch->buffers, 
+            SOKOL_VIEW_CAMERA, SOKOL_PASS_DEPTH, &bind, SOKOL_INSTANCE_ALL, 
+            INSTANCE_I);
+    }
 }
 
 void sokol_run_scene_pass(
     sokol_offscreen_pass_t *pass,
     sokol_render_state_t *state)
 {
-    scene_vs_uniforms_t vs_u;
+    scene_vs_uniforms_t vs_u = {0};
     glm_mat4_copy(state->uniforms.mat_v, vs_u.mat_v);
     glm_mat4_copy(state->uniforms.mat_vp, vs_u.mat_vp);
     glm_mat4_copy(state->uniforms.light_mat_vp, vs_u.light_mat_vp);
     vs_u.near_ = state->uniforms.near_;
     vs_u.far_ = state->uniforms.far_;
 
-    scene_fs_uniforms_t fs_u;
+    scene_fs_uniforms_t fs_u = {0};
     glm_vec3_copy(state->uniforms.light_ambient, fs_u.light_ambient);
     glm_vec3_copy(state->uniforms.light_ambient_ground, fs_u.light_ambient_ground);
     fs_u.light_ambient_ground_falloff = state->uniforms.light_ambient_ground_falloff;
@@ -354,7 +439,7 @@ void sokol_run_scene_pass(
     fs_u.shadow_far = state->uniforms.shadow_far;
     fs_u.eye_pos[0] *= -1;
 
-    scene_fs_sun_atmos_uniforms_t fs_sun_atmos_u;
+    scene_fs_sun_atmos_uniforms_t fs_sun_atmos_u = {0};
     glm_vec3_copy(state->uniforms.sun_screen_pos, fs_sun_atmos_u.sun_screen_pos);
     glm_vec3_copy(state->uniforms.sun_color, fs_sun_atmos_u.sun_color);
     fs_sun_atmos_u.target_size[0] = state->width;
@@ -362,42 +447,69 @@ void sokol_run_scene_pass(
     fs_sun_atmos_u.aspect = state->uniforms.aspect;
     fs_sun_atmos_u.sun_intensity = 1.0 + state->uniforms.sun_intensity * 6;
 
-    scene_fs_lights_t lights_u;
+#if SOKOL_CLUSTERED_LIGHTS
+    fs_u.cluster_depth_scale = state->cluster_depth_scale;
+    fs_u.cluster_depth_bias = state->cluster_depth_bias;
+    fs_u.cluster_tile_scale[0] = (float)SOKOL_CLUSTER_X / (float)state->width;
+    fs_u.cluster_tile_scale[1] = (float)SOKOL_CLUSTER_Y / (float)state->height;
+#else
+    scene_fs_lights_t lights_u = {0};
     sokol_light_t *lights = ecs_vec_first(&state->lights);
     for (int i = 0; i < ecs_vec_count(&state->lights); i ++) {
         glm_vec3_copy(lights[i].color, lights_u.light_colors[i]);
         glm_vec3_copy(lights[i].position, lights_u.light_positions[i]);
-        lights_u.light_distance[i] = lights[i].distance;
+        lights_u.light_positions[i][3] = lights[i].distance;
     }
+#endif
     fs_u.light_count = ecs_vec_count(&state->lights);
 
     /* Render to offscreen texture so screen-space effects can be applied */
     sg_begin_pass(pass->pass, &pass->pass_action);
 
     /* Step 2: render scene */
-    sg_apply_pipeline(pass->pip);
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(scene_vs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(scene_fs_uniforms_t)});
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&lights_u, sizeof(scene_fs_lights_t)});
-
-    /* Loop geometry, render scene */
-    ecs_iter_t qit = ecs_query_iter(state->world, state->q_scene);
-    while (ecs_query_next(&qit)) {
-        SokolGeometry *geometry = ecs_field(&qit, SokolGeometry, 0);
-
-        int b;
-        for (b = 0; b < qit.count; b ++) {
-            scene_draw_instances(&geometry[b], &geometry[b].solid, state->shadow_map);
-            scene_draw_instances(&geometry[b], &geometry[b].emissive, state->shadow_map);
+    sokol_apply_pipeline(pass->pip);
+    sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(scene_vs_uniforms_t)});
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(scene_fs_uniforms_t)});
+#if !SOKOL_CLUSTERED_LIGHTS
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&lights_u, sizeof(scene_fs_lights_t)});
+#endif
+
+    /* Loop draw list, render scene */
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    bool no_prepass = false;
+    for (b = 0; b < count; b ++) {
+        if (batches[b].passes & (1u << SOKOL_PASS_SCENE)) {
+            scene_draw_instances(&batches[b], state, false);
+            no_prepass |= (batches[b].exclude & (1u << SOKOL_PASS_DEPTH)) != 0;
+        }
+    }
+
+    /* Render instances that are not in the depth prepass, which have to write
+     * depth so they occlude each other and aren't covered by the background */
+    if (no_prepass) {
+        sokol_apply_pipeline(pass->pip_3);
+        sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){&vs_u, sizeof(scene_vs_uniforms_t)});
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_u, sizeof(scene_fs_uniforms_t)});
+#if !SOKOL_CLUSTERED_LIGHTS
+        sokol_apply_uniforms(SG_SHADERSTAGE_FS, 1, &(sg_range){&lights_u, sizeof(scene_fs_lights_t)});
+#endif
+        for (b = 0; b < count; b ++) {
+            if ((batches[b].passes & (1u << SOKOL_PASS_SCENE)) &&
+                (batches[b].exclude & (1u << SOKOL_PASS_DEPTH))) 
+            {
+                scene_draw_instances(&batches[b], state, true);
+            }
         }
     }
 
     /* Step 1: render atmosphere background */
-    sg_apply_pipeline(pass->pip_2);
-    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_sun_atmos_u, sizeof(scene_fs_sun_atmos_uniforms_t)});
+    sokol_apply_pipeline(pass->pip_2);
+    sokol_apply_uniforms(SG_SHADERSTAGE_FS, 0, &(sg_range){&fs_sun_atmos_u, sizeof(scene_fs_sun_atmos_uniforms_t)});
     scene_draw_atmos(state);
 
-    sg_end_pass();
+    sokol_end_pass();
 }
 
 #undef POSITION_I
@@ -405,4 +517,6 @@ void sokol_run_scene_pass(
 #undef COLOR_I
 #undef MATERIAL_I
 #undef TRANSFORM_I
+#undef SCALE_I
+#undef INSTANCE_I
 #undef LAYOUT
@@ -51,7 +51,7 @@ void sokol_run_screen_pass(
     sg_image img)
 {
     sg_begin_default_pass(&pass->pass_action, state->width, state->height);
-    sg_apply_pipeline(pass->pip);
+    sokol_apply_pipeline(pass->pip);
 
     sg_bindings bind = {
         .vertex_buffers = { 
@@ -60,8 +60,8 @@ void sokol_run_screen_pass(
         .fs_images[0] = img
     };
 
-    sg_apply_bindings(&bind);
+    sokol_apply_bindings(&bind);
 
     sg_draw(0, 6, 1);
-    sg_end_pass();
+    sokol_end_pass();
 }
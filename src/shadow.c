@@ -4,14 +4,17 @@ typedef struct shadow_vs_uniforms_t {
     mat4 mat_vp;
 } shadow_vs_uniforms_t;
 
+SOKOL_UNIFORM_OFFSET(shadow_vs_uniforms_t, mat_vp, 0);
+SOKOL_UNIFORM_SIZE(shadow_vs_uniforms_t, 64);
+
 static const char *shd_v = 
     SOKOL_SHADER_HEADER
     "uniform mat4 u_mat_vp;\n"
     "layout(location=0) in vec3 v_position;\n"
-    "layout(location=1) in mat4 i_mat_m;\n"
+    SOKOL_SHADER_INSTANCE_TRANSFORM(1, 5)
     "out vec2 proj_zw;\n"
     "void main() {\n"
-    "  gl_Position = u_mat_vp * i_mat_m * vec4(v_position, 1.0);\n"
+    "  gl_Position = u_mat_vp * instance_transform() * vec4(v_position, 1.0);\n"
     "  proj_zw = gl_Position.zw;\n"
     "}\n";
 
@@ -70,23 +73,13 @@ sokol_offscreen_pass_t sokol_init_shadow_pass(
 
     /* Create pipeline that mimics the normal pipeline, but without the material
      * normals and color, and with front culling instead of back culling */
-    result.pip = sg_make_pipeline(&(sg_pipeline_desc){
+    sg_pipeline_desc desc = {
         .shader = shd,
         .index_type = SG_INDEXTYPE_UINT16,
         .layout = {
-            .buffers = {
-                [1] = { .stride = 64, .step_func=SG_VERTEXSTEP_PER_INSTANCE }
-            },
-
             .attrs = {
                 /* Static geometry */
-                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 },
-
-                /* Matrix (per instance) */
-                [1] = { .buffer_index=1, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT4 },
-                [2] = { .buffer_index=1, .offset=16, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [3] = { .buffer_index=1, .offset=32, .format=SG_VERTEXFORMAT_FLOAT4 },
-                [4] = { .buffer_index=1, .offset=48, .format=SG_VERTEXFORMAT_FLOAT4 }
+                [0] = { .buffer_index=0, .offset=0,  .format=SG_VERTEXFORMAT_FLOAT3 }
             }
         },
         .depth = {
@@ -98,30 +91,30 @@ sokol_offscreen_pass_t sokol_init_shadow_pass(
             .pixel_format = SG_PIXELFORMAT_RGBA8
         }},
         .cull_mode = SG_CULLMODE_FRONT
-    });
+    };
+
+    /* Matrix (per instance) */
+    sokol_instance_pipeline_layout(&desc.layout, SOKOL_INSTANCE_TRANSFORM, 
+        1, 1, -1, -1);
+
+    result.pip = sg_make_pipeline(&desc);
 
     return result;
 }
 
 static
 void shadow_draw_instances(
-    SokolGeometry *geometry,
-    sokol_geometry_buffers_t *buffers)
+    const sokol_draw_batch_t *batch)
 {
-    if (!buffers->instance_count) {
-        return;
-    }
-
     sg_bindings bind = {
         .vertex_buffers = {
-            [0] = geometry->vertices,
-            [1] = buffers->transforms
+            [0] = batch->mesh.vertices
         },
-        .index_buffer = geometry->indices
+        .index_buffer = batch->mesh.indices
     };
 
-    sg_apply_bindings(&bind);
-    sg_draw(0, geometry->index_count, buffers->instance_count);
+    sokol_draw_instances(batch->geometry, batch->buffers, SOKOL_VIEW_SHADOW, 
+        SOKOL_PASS_SHADOW, &bind, SOKOL_INSTANCE_TRANSFORM, 1);
 }
 
 void sokol_run_shadow_pass(
@@ -130,24 +123,23 @@ void sokol_run_shadow_pass(
 {
     /* Render to offscreen texture so screen-space effects can be applied */
     sg_begin_pass(pass->pass, &pass->pass_action);
-    sg_apply_pipeline(pass->pip);
+    sokol_apply_pipeline(pass->pip);
 
     shadow_vs_uniforms_t vs_u;
     glm_mat4_copy(state->uniforms.light_mat_vp, vs_u.mat_vp);
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){ 
+    sokol_apply_uniforms(SG_SHADERSTAGE_VS, 0, &(sg_range){ 
         &vs_u, sizeof(shadow_vs_uniforms_t) 
     });
 
-    /* Loop buffers, render scene */
-    ecs_iter_t qit = ecs_query_iter(state->world, state->q_scene);
-    while (ecs_query_next(&qit)) {
-        SokolGeometry *geometry = ecs_field(&qit, SokolGeometry, 0);
-        
-        int b;
-        for (b = 0; b < qit.count; b ++) {
-            shadow_draw_instances(&geometry[b], &geometry[b].solid);
+    /* Loop draw list, render scene */
+    const sokol_draw_batch_t *batches = ecs_vec_first_t(
+        &state->draw_list, sokol_draw_batch_t);
+    int b, count = ecs_vec_count(&state->draw_list);
+    for (b = 0; b < count; b ++) {
+        if (batches[b].passes & (1u << SOKOL_PASS_SHADOW)) {
+            shadow_draw_instances(&batches[b]);
         }
     }
 
-    sg_end_pass();
+    sokol_end_pass();
 }
@@ -10,11 +10,11 @@
 #endif
 
 #ifndef __EMSCRIPTEN__
-#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION
+#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION SOKOL_SHADER_UNIFORMS
 #define SOKOL_SHADER_VERSION "#version 330\n"
 #define SOKOL_SHADER_PRECISION "precision highp float;\n"
 #else
-#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION
+#define SOKOL_SHADER_HEADER SOKOL_SHADER_VERSION SOKOL_SHADER_PRECISION SOKOL_SHADER_UNIFORMS
 #define SOKOL_SHADER_VERSION  "#version 300 es\n"
 #define SOKOL_SHADER_PRECISION "precision highp float;\n"
 #endif
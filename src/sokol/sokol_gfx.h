@@ -229,6 +229,18 @@
         operation only references the valid (updated) data in the
         buffer or image.
 
+    --- to overwrite a sub-range of a buffer resource at a byte offset, call:
+
+            sg_update_buffer_range(sg_buffer buf, int offset, const sg_range* data)
+
+        Unlike sg_update_buffer(), sg_update_buffer_range() does not cycle
+        to the next internal buffer slot, so data outside the updated range
+        is preserved across frames. It can be called multiple times per
+        frame on the same buffer (but not in the same frame as
+        sg_append_buffer()). This is intended for buffers that are
+        persistently mapped to application data of which only small parts
+        change each frame. Currently only implemented for the GL backends.
+
     --- to append a chunk of data to a buffer resource, call:
 
             int sg_append_buffer(sg_buffer buf, const sg_range* data)
@@ -497,6 +509,23 @@
     to use the sokol-shdc shader cross-compiler tool!
 
 
+    GL UNIFORM BUFFERS
+    ==================
+    On GL backends other than GLES2, a std140 uniform block can be declared
+    as a GLSL uniform block, and its name can be passed in
+    sg_shader_uniform_block_desc.block_name:
+
+        layout(std140) uniform vs_params { mat4 mvp; vec2 offset0; };
+
+    If the linked program contains a uniform block with that name, the data
+    passed to sg_apply_uniforms() is copied into a ring-allocated uniform
+    buffer with a single glBufferSubData() call and bound with
+    glBindBufferRange(), instead of being uploaded with a glUniformXXX() call
+    per member. Otherwise the block members are uploaded as regular uniforms.
+    The size of the ring buffer is SOKOL_GL_UNIFORM_BUFFER_SIZE (default: 1 MB),
+    and must be larger than the uniform data applied in a frame.
+
+
     BACKEND-SPECIFIC TOPICS:
     ========================
     --- The GL backends need to know about the internal structure of uniform
@@ -2223,6 +2252,7 @@ typedef struct sg_shader_uniform_desc {
 typedef struct sg_shader_uniform_block_desc {
     size_t size;
     sg_uniform_layout layout;
+    const char* block_name;     // GLSL uniform block name (optional, GL only)
     sg_shader_uniform_desc uniforms[SG_MAX_UB_MEMBERS];
 } sg_shader_uniform_block_desc;
 
@@ -2587,6 +2617,7 @@ typedef struct sg_pass_info {
     _SG_LOGITEM_XMACRO(GL_VERTEX_ATTRIBUTE_NOT_FOUND_IN_SHADER, "vertex attribute not found in shader (gl)") \
     _SG_LOGITEM_XMACRO(GL_FRAMEBUFFER_INCOMPLETE, "framebuffer completeness check failed (gl)") \
     _SG_LOGITEM_XMACRO(GL_MSAA_FRAMEBUFFER_INCOMPLETE, "completeness check failed for msaa resolve framebuffer (gl)") \
+    _SG_LOGITEM_XMACRO(UPDATEBUFRANGE_NOT_SUPPORTED, "sg_update_buffer_range: not supported by backend") \
     _SG_LOGITEM_XMACRO(D3D11_CREATE_BUFFER_FAILED, "CreateBuffer() failed (d3d11)") \
     _SG_LOGITEM_XMACRO(D3D11_CREATE_DEPTH_TEXTURE_UNSUPPORTED_PIXEL_FORMAT, "pixel format not supported for depth-stencil texture (d3d11)") \
     _SG_LOGITEM_XMACRO(D3D11_CREATE_DEPTH_TEXTURE_FAILED, "CreateTexture2D() failed for depth-stencil texture (d3d11)") \
@@ -2749,6 +2780,9 @@ typedef struct sg_pass_info {
     _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUF_SIZE, "sg_update_buffer: update size is bigger than buffer size") \
     _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUF_ONCE, "sg_update_buffer: only one update allowed per buffer and frame") \
     _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUF_APPEND, "sg_update_buffer: cannot call sg_update_buffer and sg_append_buffer in same frame") \
+    _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUFRANGE_USAGE, "sg_update_buffer_range: cannot update immutable buffer") \
+    _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUFRANGE_SIZE, "sg_update_buffer_range: offset plus update size is bigger than buffer size") \
+    _SG_LOGITEM_XMACRO(VALIDATE_UPDATEBUFRANGE_APPEND, "sg_update_buffer_range: cannot call sg_update_buffer_range and sg_append_buffer in same frame") \
     _SG_LOGITEM_XMACRO(VALIDATE_APPENDBUF_USAGE, "sg_append_buffer: cannot append to immutable buffer") \
     _SG_LOGITEM_XMACRO(VALIDATE_APPENDBUF_SIZE, "sg_append_buffer: overall appended size is bigger than buffer size") \
     _SG_LOGITEM_XMACRO(VALIDATE_APPENDBUF_UPDATE, "sg_append_buffer: cannot call sg_append_buffer and sg_update_buffer in same frame") \
@@ -3015,6 +3049,7 @@ SOKOL_GFX_API_DECL void sg_destroy_shader(sg_shader shd);
 SOKOL_GFX_API_DECL void sg_destroy_pipeline(sg_pipeline pip);
 SOKOL_GFX_API_DECL void sg_destroy_pass(sg_pass pass);
 SOKOL_GFX_API_DECL void sg_update_buffer(sg_buffer buf, const sg_range* data);
+SOKOL_GFX_API_DECL void sg_update_buffer_range(sg_buffer buf, int offset, const sg_range* data);
 SOKOL_GFX_API_DECL void sg_update_image(sg_image img, const sg_image_data* data);
 SOKOL_GFX_API_DECL int sg_append_buffer(sg_buffer buf, const sg_range* data);
 SOKOL_GFX_API_DECL bool sg_query_buffer_overflow(sg_buffer buf);
@@ -3145,6 +3180,7 @@ inline void sg_init_pipeline(sg_pipeline pip_id, const sg_pipeline_desc& desc) {
 inline void sg_init_pass(sg_pass pass_id, const sg_pass_desc& desc) { return sg_init_pass(pass_id, &desc); }
 
 inline void sg_update_buffer(sg_buffer buf_id, const sg_range& data) { return sg_update_buffer(buf_id, &data); }
+inline void sg_update_buffer_range(sg_buffer buf_id, int offset, const sg_range& data) { return sg_update_buffer_range(buf_id, offset, &data); }
 inline int sg_append_buffer(sg_buffer buf_id, const sg_range& data) { return sg_append_buffer(buf_id, &data); }
 #endif
 #endif // SOKOL_GFX_INCLUDED
@@ -3185,6 +3221,9 @@ inline int sg_append_buffer(sg_buffer buf_id, const sg_range& data) { return sg_
 #ifndef SOKOL_UNREACHABLE
     #define SOKOL_UNREACHABLE SOKOL_ASSERT(false)
 #endif
+#ifndef SOKOL_GL_UNIFORM_BUFFER_SIZE
+    #define SOKOL_GL_UNIFORM_BUFFER_SIZE (1024 * 1024)
+#endif
 
 #ifndef _SOKOL_PRIVATE
     #if defined(__GNUC__) || defined(__clang__)
@@ -3380,6 +3419,10 @@ inline int sg_append_buffer(sg_buffer buf_id, const sg_range& data) { return sg_
         #define GL_TEXTURE_CUBE_MAP 0x8513
         #define GL_FUNC_SUBTRACT 0x800A
         #define GL_FUNC_REVERSE_SUBTRACT 0x800B
+        #define GL_UNIFORM_BUFFER 0x8A11
+        #define GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 0x8A34
+        #define GL_UNIFORM_BLOCK_DATA_SIZE 0x8A40
+        #define GL_INVALID_INDEX 0xFFFFFFFFu
         #define GL_CONSTANT_COLOR 0x8001
         #define GL_DECR_WRAP 0x8508
         #define GL_R8 0x8229
@@ -4013,6 +4056,7 @@ typedef struct {
 typedef struct {
     int num_uniforms;
     _sg_gl_uniform_t uniforms[SG_MAX_UB_MEMBERS];
+    bool gl_buffer;     /* block is bound from the uniform buffer */
 } _sg_gl_uniform_block_t;
 
 typedef struct {
@@ -4145,6 +4189,9 @@ typedef struct {
     _sg_gl_state_cache_t cache;
     bool ext_anisotropic;
     GLint max_anisotropy;
+    GLuint ubo;             /* ring buffer for uniform blocks */
+    GLint ubo_align;
+    int ubo_offset;
     #if _SOKOL_USE_WIN32_GL_LOADER
     HINSTANCE opengl32_dll;
     #endif
@@ -5473,6 +5520,13 @@ _SOKOL_PRIVATE void _sg_dummy_update_buffer(_sg_buffer_t* buf, const sg_range* d
     }
 }
 
+_SOKOL_PRIVATE void _sg_dummy_update_buffer_range(_sg_buffer_t* buf, int offset, const sg_range* data) {
+    SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
+    _SOKOL_UNUSED(buf);
+    _SOKOL_UNUSED(offset);
+    _SOKOL_UNUSED(data);
+}
+
 _SOKOL_PRIVATE int _sg_dummy_append_buffer(_sg_buffer_t* buf, const sg_range* data, bool new_frame) {
     SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
     _SOKOL_UNUSED(data);
@@ -5544,6 +5598,10 @@ _SOKOL_PRIVATE void _sg_dummy_update_image(_sg_image_t* img, const sg_image_data
     _SG_XMACRO(glDrawBuffers,                     void, (GLsizei n, const GLenum * bufs)) \
     _SG_XMACRO(glVertexAttribDivisor,             void, (GLuint index, GLuint divisor)) \
     _SG_XMACRO(glBufferSubData,                   void, (GLenum target, GLintptr offset, GLsizeiptr size, const void * data)) \
+    _SG_XMACRO(glBindBufferRange,                 void, (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)) \
+    _SG_XMACRO(glGetUniformBlockIndex,            GLuint, (GLuint program, const GLchar * uniformBlockName)) \
+    _SG_XMACRO(glUniformBlockBinding,             void, (GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding)) \
+    _SG_XMACRO(glGetActiveUniformBlockiv,         void, (GLuint program, GLuint uniformBlockIndex, GLenum pname, GLint * params)) \
     _SG_XMACRO(glGenBuffers,                      void, (GLsizei n, GLuint * buffers)) \
     _SG_XMACRO(glCheckFramebufferStatus,          GLenum, (GLenum target)) \
     _SG_XMACRO(glFramebufferRenderbuffer,         void, (GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer)) \
@@ -6965,6 +7023,12 @@ _SOKOL_PRIVATE void _sg_gl_setup_backend(const sg_desc* desc) {
 
 _SOKOL_PRIVATE void _sg_gl_discard_backend(void) {
     SOKOL_ASSERT(_sg.gl.valid);
+    #if !defined(SOKOL_GLES2)
+    if (_sg.gl.ubo) {
+        glDeleteBuffers(1, &_sg.gl.ubo);
+        _sg.gl.ubo = 0;
+    }
+    #endif
     _sg.gl.valid = false;
     #if defined(_SOKOL_USE_WIN32_GL_LOADER)
     _sg_gl_unload_opengl();
@@ -7378,6 +7442,20 @@ _SOKOL_PRIVATE sg_resource_state _sg_gl_create_shader(_sg_shader_t* shd, const s
             }
             SOKOL_ASSERT(ub_desc->size == (size_t)cur_uniform_offset);
             _SOKOL_UNUSED(cur_uniform_offset);
+            #if !defined(SOKOL_GLES2)
+            /* bind uniform block to a binding point per stage & block slot */
+            if (ub_desc->block_name && !_sg.gl.gles2) {
+                GLuint gl_block = glGetUniformBlockIndex(gl_prog, ub_desc->block_name);
+                if (gl_block != GL_INVALID_INDEX) {
+                    GLint gl_block_size = 0;
+                    glGetActiveUniformBlockiv(gl_prog, gl_block, GL_UNIFORM_BLOCK_DATA_SIZE, &gl_block_size);
+                    SOKOL_ASSERT((size_t)gl_block_size <= (size_t)_sg_roundup((int)ub_desc->size, 16));
+                    _SOKOL_UNUSED(gl_block_size);
+                    glUniformBlockBinding(gl_prog, gl_block, (GLuint)(stage_index * SG_MAX_SHADERSTAGE_UBS + ub_index));
+                    ub->gl_buffer = true;
+                }
+            }
+            #endif
         }
     }
 
@@ -8205,6 +8283,38 @@ _SOKOL_PRIVATE void _sg_gl_apply_bindings(
     _SG_GL_CHECK_ERROR();
 }
 
+#if !defined(SOKOL_GLES2)
+/* copy uniform block into the ring buffer, and bind it to the binding point
+   of the block. Writing to a range that is still used by earlier draw calls
+   is synchronized by the GL driver.
+*/
+_SOKOL_PRIVATE void _sg_gl_apply_uniform_buffer(GLuint binding, const sg_range* data) {
+    const int size = _sg_roundup((int)data->size, 16);
+    SOKOL_ASSERT(size <= SOKOL_GL_UNIFORM_BUFFER_SIZE);
+    if (0 == _sg.gl.ubo) {
+        glGenBuffers(1, &_sg.gl.ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, _sg.gl.ubo);
+        glBufferData(GL_UNIFORM_BUFFER, SOKOL_GL_UNIFORM_BUFFER_SIZE, 0, GL_STREAM_DRAW);
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &_sg.gl.ubo_align);
+        if (_sg.gl.ubo_align < 16) {
+            _sg.gl.ubo_align = 16;
+        }
+    }
+    else {
+        glBindBuffer(GL_UNIFORM_BUFFER, _sg.gl.ubo);
+    }
+    /* offset alignment is not necessarily a power of two */
+    int offset = ((_sg.gl.ubo_offset + _sg.gl.ubo_align - 1) / _sg.gl.ubo_align) * _sg.gl.ubo_align;
+    if ((offset + size) > SOKOL_GL_UNIFORM_BUFFER_SIZE) {
+        offset = 0;
+    }
+    glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)offset, (GLsizeiptr)data->size, data->ptr);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, _sg.gl.ubo, (GLintptr)offset, (GLsizeiptr)size);
+    _sg.gl.ubo_offset = offset + size;
+    _SG_GL_CHECK_ERROR();
+}
+#endif
+
 _SOKOL_PRIVATE void _sg_gl_apply_uniforms(sg_shader_stage stage_index, int ub_index, const sg_range* data) {
     SOKOL_ASSERT(_sg.gl.cache.cur_pipeline);
     SOKOL_ASSERT(_sg.gl.cache.cur_pipeline->slot.id == _sg.gl.cache.cur_pipeline_id.id);
@@ -8213,6 +8323,12 @@ _SOKOL_PRIVATE void _sg_gl_apply_uniforms(sg_shader_stage stage_index, int ub_in
     SOKOL_ASSERT(_sg.gl.cache.cur_pipeline->shader->cmn.stage[stage_index].uniform_blocks[ub_index].size == data->size);
     const _sg_gl_shader_stage_t* gl_stage = &_sg.gl.cache.cur_pipeline->shader->gl.stage[stage_index];
     const _sg_gl_uniform_block_t* gl_ub = &gl_stage->uniform_blocks[ub_index];
+    #if !defined(SOKOL_GLES2)
+    if (gl_ub->gl_buffer) {
+        _sg_gl_apply_uniform_buffer((GLuint)(stage_index * SG_MAX_SHADERSTAGE_UBS + ub_index), data);
+        return;
+    }
+    #endif
     for (int u_index = 0; u_index < gl_ub->num_uniforms; u_index++) {
         const _sg_gl_uniform_t* u = &gl_ub->uniforms[u_index];
         SOKOL_ASSERT(u->type != SG_UNIFORMTYPE_INVALID);
@@ -8314,6 +8430,23 @@ _SOKOL_PRIVATE void _sg_gl_update_buffer(_sg_buffer_t* buf, const sg_range* data
     _SG_GL_CHECK_ERROR();
 }
 
+_SOKOL_PRIVATE void _sg_gl_update_buffer_range(_sg_buffer_t* buf, int offset, const sg_range* data) {
+    SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
+    SOKOL_ASSERT((offset >= 0) && ((offset + (int)data->size) <= buf->cmn.size));
+    /* range updates write to the current slot, so that the rest of the
+       buffer keeps the content of previous updates */
+    GLenum gl_tgt = _sg_gl_buffer_target(buf->cmn.type);
+    SOKOL_ASSERT(buf->cmn.active_slot < SG_NUM_INFLIGHT_FRAMES);
+    GLuint gl_buf = buf->gl.buf[buf->cmn.active_slot];
+    SOKOL_ASSERT(gl_buf);
+    _SG_GL_CHECK_ERROR();
+    _sg_gl_cache_store_buffer_binding(gl_tgt);
+    _sg_gl_cache_bind_buffer(gl_tgt, gl_buf);
+    glBufferSubData(gl_tgt, (GLintptr)offset, (GLsizeiptr)data->size, data->ptr);
+    _sg_gl_cache_restore_buffer_binding(gl_tgt);
+    _SG_GL_CHECK_ERROR();
+}
+
 _SOKOL_PRIVATE int _sg_gl_append_buffer(_sg_buffer_t* buf, const sg_range* data, bool new_frame) {
     SOKOL_ASSERT(buf && data && data->ptr && (data->size > 0));
     if (new_frame) {
@@ -14231,6 +14364,19 @@ static inline void _sg_update_buffer(_sg_buffer_t* buf, const sg_range* data) {
     #endif
 }
 
+static inline void _sg_update_buffer_range(_sg_buffer_t* buf, int offset, const sg_range* data) {
+    #if defined(_SOKOL_ANY_GL)
+    _sg_gl_update_buffer_range(buf, offset, data);
+    #elif defined(SOKOL_DUMMY_BACKEND)
+    _sg_dummy_update_buffer_range(buf, offset, data);
+    #else
+    _SOKOL_UNUSED(buf);
+    _SOKOL_UNUSED(offset);
+    _SOKOL_UNUSED(data);
+    _SG_ERROR(UPDATEBUFRANGE_NOT_SUPPORTED);
+    #endif
+}
+
 static inline int _sg_append_buffer(_sg_buffer_t* buf, const sg_range* data, bool new_frame) {
     #if defined(_SOKOL_ANY_GL)
     return _sg_gl_append_buffer(buf, data, new_frame);
@@ -15223,6 +15369,25 @@ _SOKOL_PRIVATE bool _sg_validate_update_buffer(const _sg_buffer_t* buf, const sg
     #endif
 }
 
+_SOKOL_PRIVATE bool _sg_validate_update_buffer_range(const _sg_buffer_t* buf, int offset, const sg_range* data) {
+    #if !defined(SOKOL_DEBUG)
+        _SOKOL_UNUSED(buf);
+        _SOKOL_UNUSED(offset);
+        _SOKOL_UNUSED(data);
+        return true;
+    #else
+        if (_sg.desc.disable_validation) {
+            return true;
+        }
+        SOKOL_ASSERT(buf && data && data->ptr);
+        _sg_validate_begin();
+        _SG_VALIDATE(buf->cmn.usage != SG_USAGE_IMMUTABLE, VALIDATE_UPDATEBUFRANGE_USAGE);
+        _SG_VALIDATE((offset >= 0) && (buf->cmn.size >= (offset + (int)data->size)), VALIDATE_UPDATEBUFRANGE_SIZE);
+        _SG_VALIDATE(buf->cmn.append_frame_index != _sg.frame_index, VALIDATE_UPDATEBUFRANGE_APPEND);
+        return _sg_validate_end();
+    #endif
+}
+
 _SOKOL_PRIVATE bool _sg_validate_append_buffer(const _sg_buffer_t* buf, const sg_range* data) {
     #if !defined(SOKOL_DEBUG)
         _SOKOL_UNUSED(buf);
@@ -16714,6 +16879,20 @@ SOKOL_API_IMPL void sg_update_buffer(sg_buffer buf_id, const sg_range* data) {
     _SG_TRACE_ARGS(update_buffer, buf_id, data);
 }
 
+SOKOL_API_IMPL void sg_update_buffer_range(sg_buffer buf_id, int offset, const sg_range* data) {
+    SOKOL_ASSERT(_sg.valid);
+    SOKOL_ASSERT(data && data->ptr && (data->size > 0));
+    _sg_buffer_t* buf = _sg_lookup_buffer(&_sg.pools, buf_id.id);
+    if ((data->size > 0) && buf && (buf->slot.state == SG_RESOURCESTATE_VALID)) {
+        if (_sg_validate_update_buffer_range(buf, offset, data)) {
+            SOKOL_ASSERT((offset + (int)data->size) <= buf->cmn.size);
+            /* update and append on same buffer in same frame not allowed */
+            SOKOL_ASSERT(buf->cmn.append_frame_index != _sg.frame_index);
+            _sg_update_buffer_range(buf, offset, data);
+        }
+    }
+}
+
 SOKOL_API_IMPL int sg_append_buffer(sg_buffer buf_id, const sg_range* data) {
     SOKOL_ASSERT(_sg.valid);
     SOKOL_ASSERT(data && data->ptr);
@@ -0,0 +1,133 @@
+#include "private_api.h"
+
+/* Last uniforms applied to a pipeline, per shader stage and uniform block */
+typedef struct sokol_submit_uniforms_t {
+    ecs_vec_t blocks[SG_NUM_SHADER_STAGES][SG_MAX_SHADERSTAGE_UBS];
+} sokol_submit_uniforms_t;
+
+static struct {
+    sg_pipeline pipeline;       /* Pipeline applied in current pass */
+    sg_bindings bindings;       /* Bindings applied to current pipeline */
+    bool bindings_valid;
+    ecs_map_t uniforms;         /* map<pipeline id, sokol_submit_uniforms_t*> */
+    bool uniforms_init;
+#if SOKOL_UNIFORM_BUFFERS
+    /* Pipeline that last applied uniforms to a uniform buffer binding point */
+    uint32_t bound[SG_NUM_SHADER_STAGES][SG_MAX_SHADERSTAGE_UBS];
+#endif
+    sokol_submit_stats_t frame; /* Counters of current frame */
+    sokol_submit_stats_t last;  /* Counters of last frame */
+} sokol_submit;
+
+void sokol_apply_pipeline(
+    sg_pipeline pip)
+{
+    if (pip.id == sokol_submit.pipeline.id) {
+        sokol_submit.frame.pipelines_elided ++;
+        return;
+    }
+
+    sg_apply_pipeline(pip);
+    sokol_submit.pipeline = pip;
+    sokol_submit.bindings_valid = false;
+    sokol_submit.frame.pipelines ++;
+}
+
+void sokol_apply_bindings(
+    const sg_bindings *bind)
+{
+    if (sokol_submit.bindings_valid &&
+        !ecs_os_memcmp(bind, &sokol_submit.bindings, ECS_SIZEOF(sg_bindings)))
+    {
+        sokol_submit.frame.bindings_elided ++;
+        return;
+    }
+
+    sg_apply_bindings(bind);
+    sokol_submit.bindings = *bind;
+    sokol_submit.bindings_valid = true;
+    sokol_submit.frame.bindings ++;
+}
+
+void sokol_apply_uniforms(
+    sg_shader_stage stage,
+    int ub_index,
+    const sg_range *data)
+{
+    ecs_assert(sokol_submit.pipeline.id != SG_INVALID_ID,
+        ECS_INVALID_OPERATION, "uniforms applied without pipeline");
+
+    if (!sokol_submit.uniforms_init) {
+        ecs_map_init(&sokol_submit.uniforms, NULL);
+        sokol_submit.uniforms_init = true;
+    }
+
+    sokol_submit_uniforms_t *u = ecs_map_ensure_alloc_t(&sokol_submit.uniforms,
+        sokol_submit_uniforms_t, sokol_submit.pipeline.id);
+    ecs_vec_t *block = &u->blocks[stage][ub_index];
+    ecs_size_t size = (ecs_size_t)data->size;
+
+    bool same = ecs_vec_count(block) == size &&
+        !ecs_os_memcmp(ecs_vec_first(block), data->ptr, size);
+
+#if SOKOL_UNIFORM_BUFFERS
+    /* Binding points are shared by all programs, so uniforms can only be
+     * skipped if no other pipeline has applied uniforms since. */
+    uint32_t *bound = &sokol_submit.bound[stage][ub_index];
+    same &= *bound == sokol_submit.pipeline.id;
+    *bound = sokol_submit.pipeline.id;
+#endif
+
+    if (same) {
+        sokol_submit.frame.uniforms_elided ++;
+        return;
+    }
+
+    sg_apply_uniforms(stage, ub_index, data);
+    ecs_vec_set_count_t(NULL, block, uint8_t, size);
+    ecs_os_memcpy(ecs_vec_first(block), data->ptr, size);
+    sokol_submit.frame.uniforms ++;
+}
+
+void sokol_end_pass(void) {
+    sg_end_pass();
+    sokol_submit.pipeline.id = SG_INVALID_ID;
+    sokol_submit.bindings_valid = false;
+}
+
+void sokol_submit_frame(void) {
+    sokol_submit.last = sokol_submit.frame;
+    ecs_os_zeromem(&sokol_submit.frame);
+#if SOKOL_UNIFORM_BUFFERS
+    /* The uniform buffer is a ring, so ranges of a previous frame may have
+     * been overwritten. */
+    ecs_os_zeromem(&sokol_submit.bound);
+#endif
+}
+
+void sokol_submit_fini(void) {
+    if (!sokol_submit.uniforms_init) {
+        return;
+    }
+
+    ecs_map_iter_t mit = ecs_map_iter(&sokol_submit.uniforms);
+    while (ecs_map_next(&mit)) {
+        sokol_submit_uniforms_t *u = ecs_map_ptr(&mit);
+        int32_t s, b;
+        for (s = 0; s < SG_NUM_SHADER_STAGES; s ++) {
+            for (b = 0; b < SG_MAX_SHADERSTAGE_UBS; b ++) {
+                ecs_vec_fini_t(NULL, &u->blocks[s][b], uint8_t);
+            }
+        }
+        ecs_os_free(u);
+    }
+
+    ecs_map_fini(&sokol_submit.uniforms);
+    sokol_submit.uniforms_init = false;
+}
+
+void sokol_submit_get_stats(
+    sokol_submit_stats_t *stats)
+{
+    *stats = sokol_submit.last;
+}
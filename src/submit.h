@@ -0,0 +1,33 @@
+#ifndef SOKOL_SUBMIT_H
+#define SOKOL_SUBMIT_H
+
+/* Submission layer between the passes and sokol_gfx. Calls that apply the
+ * same pipeline, bindings or uniforms as the previous call are skipped.
+ *
+ * The applied pipeline and bindings are reset at the end of a pass, so passes
+ * must be ended with sokol_end_pass. Uniforms are stored in the GL program of
+ * a pipeline, and are remembered per pipeline across passes. This requires
+ * that pipelines don't share shaders. With SOKOL_UNIFORM_BUFFERS, uniform
+ * blocks are bound to binding points that are shared by all pipelines, and
+ * are only skipped if no other pipeline has used the binding point since. */
+
+void sokol_apply_pipeline(
+    sg_pipeline pip);
+
+void sokol_apply_bindings(
+    const sg_bindings *bind);
+
+void sokol_apply_uniforms(
+    sg_shader_stage stage,
+    int ub_index,
+    const sg_range *data);
+
+void sokol_end_pass(void);
+
+/* Store statistics of the frame and reset counters. Called once per frame. */
+void sokol_submit_frame(void);
+
+/* Free submission state */
+void sokol_submit_fini(void);
+
+#endif
@@ -13,6 +13,292 @@
 #define SOKOL_DEFAULT_DEPTH_NEAR (2.0)
 #define SOKOL_DEFAULT_DEPTH_FAR (2500.0)
 #define SOKOL_MAX_LIGHTS (32)
+#define SOKOL_INSTANCE_RANGE_MERGE_GAP (64)
+#define SOKOL_INSTANCE_MIN_CAPACITY (64)
+#define SOKOL_INSTANCE_SHRINK_FRAMES (120)
+
+/* When enabled, instance transforms are sent to the GPU as a 3x4 affine
+ * matrix (48 bytes) instead of a mat4 (64 bytes). The bottom row of instance
+ * transforms is always (0, 0, 0, 1), and is restored by the vertex shader. */
+#ifndef SOKOL_COMPACT_TRANSFORMS
+#define SOKOL_COMPACT_TRANSFORMS (0)
+#endif
+
+/* When enabled, instance colors are sent to the GPU as RGBA8 and materials 
+ * as 8 bit specular power & shininess and 16 bit emissive, interleaved in a
+ * single 8 byte stream (vs. 24 bytes for float colors & materials). Colors
+ * are clamped to [0, 1], material values to the SOKOL_PACKED_*_MAX ranges. */
+#ifndef SOKOL_PACKED_INSTANCE_DATA
+#define SOKOL_PACKED_INSTANCE_DATA (0)
+#endif
+
+#define SOKOL_PACKED_SPECULAR_MAX 4.0
+#define SOKOL_PACKED_SHININESS_MAX 255.0
+#define SOKOL_PACKED_EMISSIVE_MAX 64.0
+
+/* When enabled, all instance data is interleaved in a single vertex buffer
+ * (one struct per instance). When disabled, transforms, colors and materials
+ * are stored in separate vertex buffers. */
+#ifndef SOKOL_INTERLEAVED_INSTANCES
+#define SOKOL_INTERLEAVED_INSTANCES (0)
+#endif
+
+/* When enabled, geometry-specific scaling (e.g. box dimensions) is passed as
+ * a separate per-instance attribute and applied by the vertex shader. This
+ * allows for uploading transforms of dynamic entities directly from the
+ * EcsTransform3 table columns, without copying them to a staging buffer.
+ * Requires the full mat4 transform in a separate stream. With culling, runs
+ * of at least SOKOL_INSTANCE_COLUMN_RUN visible instances that are stored
+ * consecutively in a table are uploaded directly from the table column. */
+#ifndef SOKOL_ZERO_COPY_TRANSFORMS
+#define SOKOL_ZERO_COPY_TRANSFORMS (0)
+#endif
+
+#define SOKOL_INSTANCE_COLUMN_RUN (32)
+
+#if SOKOL_ZERO_COPY_TRANSFORMS && SOKOL_COMPACT_TRANSFORMS
+#error "SOKOL_ZERO_COPY_TRANSFORMS is not supported with SOKOL_COMPACT_TRANSFORMS"
+#endif
+#if SOKOL_ZERO_COPY_TRANSFORMS && SOKOL_INTERLEAVED_INSTANCES
+#error "SOKOL_ZERO_COPY_TRANSFORMS is not supported with SOKOL_INTERLEAVED_INSTANCES"
+#endif
+
+/* When enabled, instance data of dynamic entities is appended each frame to
+ * a single stream buffer that is shared by all geometry kinds, instead of
+ * being kept in per-geometry buffers that are updated in place. Draws bind
+ * the offsets at which the data was appended. */
+#ifndef SOKOL_INSTANCE_RING
+#define SOKOL_INSTANCE_RING (0)
+#endif
+
+/* When enabled, instances are culled against the camera and light frusta 
+ * before rendering. Visible instances are copied to per-view buffers, which
+ * are the only instance buffers that are uploaded to the GPU. With the
+ * instance ring, visible instances are appended to the ring instead. */
+#ifndef SOKOL_CULL_INSTANCES
+#define SOKOL_CULL_INSTANCES (0)
+#endif
+
+
+/* When enabled, culled instances are stored in a loose grid that is updated
+ * when instances change. The grid is used for culling, and for the spatial
+ * queries in the public API. */
+#ifndef SOKOL_SPATIAL_INDEX
+#define SOKOL_SPATIAL_INDEX (0)
+#endif
+
+/* Size of a spatial index cell in world units */
+#ifndef SOKOL_SPATIAL_CELL_SIZE
+#define SOKOL_SPATIAL_CELL_SIZE (32.0f)
+#endif
+
+#if SOKOL_SPATIAL_INDEX && !SOKOL_CULL_INSTANCES
+#error "SOKOL_SPATIAL_INDEX requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* When enabled, static instances are grouped by their SokolCluster target and
+ * culled per cluster. Visible clusters are drawn directly from the static
+ * instance buffers. Each cluster has its own slot range, and only the ranges
+ * of clusters that changed are gathered & uploaded again. */
+#ifndef SOKOL_CLUSTER_INSTANCES
+#define SOKOL_CLUSTER_INSTANCES (0)
+#endif
+
+#if SOKOL_CLUSTER_INSTANCES && !SOKOL_CULL_INSTANCES
+#error "SOKOL_CLUSTER_INSTANCES requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* When enabled, large boxes are rasterized to a low resolution depth buffer on
+ * the CPU, and instances that are hidden behind them are not drawn. */
+#ifndef SOKOL_OCCLUSION_CULLING
+#define SOKOL_OCCLUSION_CULLING (0)
+#endif
+
+/* Resolution of the occlusion depth buffer, and its tile size in pixels */
+#ifndef SOKOL_OCCLUSION_WIDTH
+#define SOKOL_OCCLUSION_WIDTH (256)
+#endif
+#ifndef SOKOL_OCCLUSION_HEIGHT
+#define SOKOL_OCCLUSION_HEIGHT (128)
+#endif
+#define SOKOL_OCCLUSION_TILE_SIZE (8)
+
+#if SOKOL_OCCLUSION_CULLING && !SOKOL_CULL_INSTANCES
+#error "SOKOL_OCCLUSION_CULLING requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* When enabled, geometries with multiple levels of detail select a level per
+ * visible instance from the projected size of its bounding sphere. Instances
+ * that are smaller than SOKOL_LOD_MIN_SIZE pixels are not drawn. */
+#ifndef SOKOL_LOD
+#define SOKOL_LOD (0)
+#endif
+
+/* Projected diameter in pixels below which instances are culled */
+#ifndef SOKOL_LOD_MIN_SIZE
+#define SOKOL_LOD_MIN_SIZE (1.0f)
+#endif
+
+#if SOKOL_LOD && !SOKOL_CULL_INSTANCES
+#error "SOKOL_LOD requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* Maximum number of levels of detail per geometry */
+#define SOKOL_MAX_LODS (3)
+
+/* When enabled, instances that are further away from the camera than the
+ * impostor distance of their geometry (see sokol_geometry_impostor_distance)
+ * are drawn as camera facing quads that cover the extents of the instance. */
+#ifndef SOKOL_IMPOSTORS
+#define SOKOL_IMPOSTORS (0)
+#endif
+
+#if SOKOL_IMPOSTORS && !SOKOL_CULL_INSTANCES
+#error "SOKOL_IMPOSTORS requires SOKOL_CULL_INSTANCES"
+#endif
+
+/* Point lights contribute exp(-d / distance) to a surface at distance d. The
+ * range of a light is the multiple of its distance beyond which light is
+ * ignored, where its contribution is less than 5%. */
+#define SOKOL_LIGHT_RANGE (3.0f)
+
+/* Score multiplier of lights that were selected in the last frame, so that
+ * lights with a similar contribution don't swap from frame to frame. */
+#define SOKOL_LIGHT_HYSTERESIS (1.25f)
+
+/* When enabled, point lights are binned each frame into clusters that divide
+ * the camera frustum in screen tiles and depth slices. The scene shader only
+ * evaluates the lights of the cluster of a fragment, instead of the selected
+ * SOKOL_MAX_LIGHTS lights. Binning is divided over worker threads. */
+#ifndef SOKOL_CLUSTERED_LIGHTS
+#define SOKOL_CLUSTERED_LIGHTS (0)
+#endif
+
+/* Number of clusters along screen x, screen y and depth */
+#define SOKOL_CLUSTER_X (16)
+#define SOKOL_CLUSTER_Y (8)
+#define SOKOL_CLUSTER_Z (24)
+#define SOKOL_CLUSTER_COUNT (SOKOL_CLUSTER_X * SOKOL_CLUSTER_Y * SOKOL_CLUSTER_Z)
+
+/* Maximum number of clustered lights, and of light indices in all clusters */
+#ifndef SOKOL_CLUSTER_MAX_LIGHTS
+#define SOKOL_CLUSTER_MAX_LIGHTS (4096)
+#endif
+#ifndef SOKOL_CLUSTER_MAX_INDICES
+#define SOKOL_CLUSTER_MAX_INDICES (64 * 1024)
+#endif
+
+/* Width of light & light index textures. Must be even. */
+#define SOKOL_CLUSTER_TEXTURE_WIDTH (1024)
+
+/* When enabled, the uniforms of the scene, atmosphere and fx shaders are
+ * declared as std140 uniform blocks, which are uploaded with a single copy to
+ * a uniform buffer instead of a glUniform call per uniform. Uniform structs
+ * use the std140 layout either way. */
+#ifndef SOKOL_UNIFORM_BUFFERS
+#define SOKOL_UNIFORM_BUFFERS (0)
+#endif
+
+/* Shader macros for declaring uniforms that are part of a uniform block:
+ *   SOKOL_UNIFORM_BLOCK(name)
+ *   SOKOL_UNIFORM vec3 u_foo;
+ *   SOKOL_UNIFORM_BLOCK_END
+ * The block name must match the block_name of the uniform block desc. */
+#if SOKOL_UNIFORM_BUFFERS
+#define SOKOL_SHADER_UNIFORMS \
+    "#define SOKOL_UNIFORM_BLOCK(name) layout(std140) uniform name {\n" \
+    "#define SOKOL_UNIFORM\n" \
+    "#define SOKOL_UNIFORM_BLOCK_END };\n"
+#else
+#define SOKOL_SHADER_UNIFORMS \
+    "#define SOKOL_UNIFORM_BLOCK(name)\n" \
+    "#define SOKOL_UNIFORM uniform\n" \
+    "#define SOKOL_UNIFORM_BLOCK_END\n"
+#endif
+
+/* Compile time checks for uniform structs, which are copied as is to uniform
+ * blocks. Offsets must match the layout of the block (std140, or packed for
+ * blocks with the native layout), which is computed from the uniform descs in
+ * the order the uniforms are declared in the shader. */
+#define SOKOL_UNIFORM_OFFSET(T, member, offset)\
+    typedef char T##_##member##_offset_check[\
+        (offsetof(T, member) == (offset)) ? 1 : -1]
+
+#define SOKOL_UNIFORM_SIZE(T, size)\
+    typedef char T##_size_check[(sizeof(T) == (size)) ? 1 : -1]
+
+#define SOKOL_STR_(x) #x
+#define SOKOL_STR(x) SOKOL_STR_(x)
+
+/* Shader code that defines instance_transform(). The scale location is only
+ * used when SOKOL_ZERO_COPY_TRANSFORMS is enabled, and must be the location
+ * that follows the transform attributes. */
+#if SOKOL_COMPACT_TRANSFORMS
+/* Rows of a 3x4 affine matrix */
+typedef vec4 sokol_transform_t[3];
+
+/* Rows are passed as the columns of a mat3x4 vertex attribute */
+#define SOKOL_SHADER_INSTANCE_TRANSFORM(loc, scale_loc) \
+    "layout(location=" SOKOL_STR(loc) ") in mat3x4 i_mat_m;\n" \
+    "mat4 instance_transform() {\n" \
+    "  return transpose(mat4(i_mat_m[0], i_mat_m[1], i_mat_m[2], \n" \
+    "    vec4(0.0, 0.0, 0.0, 1.0)));\n" \
+    "}\n"
+#elif SOKOL_ZERO_COPY_TRANSFORMS
+typedef mat4 sokol_transform_t;
+
+/* Scales the x, y and z axes, which is the same as glm_scale */
+#define SOKOL_SHADER_INSTANCE_TRANSFORM(loc, scale_loc) \
+    "layout(location=" SOKOL_STR(loc) ") in mat4 i_mat_m;\n" \
+    "layout(location=" SOKOL_STR(scale_loc) ") in vec3 i_scale;\n" \
+    "mat4 instance_transform() {\n" \
+    "  return mat4(i_mat_m[0] * i_scale.x, i_mat_m[1] * i_scale.y, \n" \
+    "    i_mat_m[2] * i_scale.z, i_mat_m[3]);\n" \
+    "}\n"
+#else
+typedef mat4 sokol_transform_t;
+
+#define SOKOL_SHADER_INSTANCE_TRANSFORM(loc, scale_loc) \
+    "layout(location=" SOKOL_STR(loc) ") in mat4 i_mat_m;\n" \
+    "mat4 instance_transform() {\n" \
+    "  return i_mat_m;\n" \
+    "}\n"
+#endif
+
+#if SOKOL_PACKED_INSTANCE_DATA
+/* Color (r, g, b, unused) and material (specular power, shininess, emissive
+ * low byte, emissive high byte) */
+typedef struct sokol_instance_color_t {
+    uint8_t color[4];
+    uint8_t material[4];
+} sokol_instance_color_t;
+
+#define SOKOL_SHADER_INSTANCE_COLOR(color_loc, material_loc) \
+    "layout(location=" SOKOL_STR(color_loc) ") in vec4 i_color;\n" \
+    "layout(location=" SOKOL_STR(material_loc) ") in vec4 i_material;\n" \
+    "vec3 instance_color() {\n" \
+    "  return i_color.rgb;\n" \
+    "}\n" \
+    "vec3 instance_material() {\n" \
+    "  return vec3(\n" \
+    "    i_material.x * " SOKOL_STR(SOKOL_PACKED_SPECULAR_MAX) ",\n" \
+    "    i_material.y * " SOKOL_STR(SOKOL_PACKED_SHININESS_MAX) ",\n" \
+    "    dot(i_material.zw, vec2(255.0, 65280.0)) / 65535.0 * " \
+            SOKOL_STR(SOKOL_PACKED_EMISSIVE_MAX) ");\n" \
+    "}\n"
+#else
+typedef ecs_rgb_t sokol_instance_color_t;
+
+#define SOKOL_SHADER_INSTANCE_COLOR(color_loc, material_loc) \
+    "layout(location=" SOKOL_STR(color_loc) ") in vec3 i_color;\n" \
+    "layout(location=" SOKOL_STR(material_loc) ") in vec3 i_material;\n" \
+    "vec3 instance_color() {\n" \
+    "  return i_color;\n" \
+    "}\n" \
+    "vec3 instance_material() {\n" \
+    "  return i_material;\n" \
+    "}\n"
+#endif
 
 typedef struct SokolQuery {
     ecs_query_t *query;
@@ -20,6 +306,14 @@ typedef struct SokolQuery {
 
 extern ECS_COMPONENT_DECLARE(SokolQuery);
 
+/* Vertex, normal and index buffers of a mesh */
+typedef struct sokol_mesh_t {
+    sg_buffer vertices;
+    sg_buffer normals;
+    sg_buffer indices;
+    int32_t index_count;
+} sokol_mesh_t;
+
 /* Immutable resources used by different components to avoid duplication */
 typedef struct sokol_resources_t {
     sg_buffer quad;
@@ -27,11 +321,17 @@ typedef struct sokol_resources_t {
     sg_buffer rect;
     sg_buffer rect_indices;
     sg_buffer rect_normals;
+    sg_buffer rect_impostor_indices; /* Both sides of the rectangle */
 
     sg_buffer box;
     sg_buffer box_indices;
     sg_buffer box_normals;
 
+    /* Procedural primitives, from the highest to the lowest tessellation */
+    sokol_mesh_t sphere[SOKOL_MAX_LODS];
+    sokol_mesh_t cylinder[SOKOL_MAX_LODS];
+    sokol_mesh_t cone[SOKOL_MAX_LODS];
+
     sg_image noise_texture;
     sg_image bg_texture;
 } sokol_resources_t;
@@ -89,9 +389,14 @@ typedef struct sokol_render_state_t {
     ecs_world_t *world;
     ecs_query_t *q_scene;
     
-    const EcsDirectionalLight *light;
-    const EcsCamera *camera;
-    const EcsAtmosphere *atmosphere;
+    /* Component values are copied, as storage can move between preparing and
+     * rendering the frame */
+    EcsDirectionalLight light;
+    EcsCamera camera;
+    EcsAtmosphere atmosphere;
+    bool has_light;
+    bool has_camera;
+    bool has_atmosphere;
 
     ecs_rgb_t ambient_light;
     ecs_rgb_t ambient_light_ground;
@@ -107,6 +412,14 @@ typedef struct sokol_render_state_t {
     sg_image shadow_map;
 
     ecs_vec_t lights;
+#if SOKOL_CLUSTERED_LIGHTS
+    sg_image light_data;        /* Light, cluster & light index textures */
+    sg_image light_clusters;
+    sg_image light_indices;
+    float cluster_depth_scale;  /* Depth slice = log(depth) * scale + bias */
+    float cluster_depth_bias;
+#endif
+    ecs_vec_t draw_list; /* vec<sokol_draw_batch_t> */
 } sokol_render_state_t;
 
 typedef struct sokol_offscreen_pass_t {
@@ -114,12 +427,14 @@ typedef struct sokol_offscreen_pass_t {
     sg_pass pass;
     sg_pipeline pip;
     sg_pipeline pip_2;
+    sg_pipeline pip_3;
     sg_image depth_target;
     sg_image color_target;
     int32_t sample_count;
 } sokol_offscreen_pass_t;
 
 #include "resources.h"
+#include "submit.h"
 #include "effect.h"
 #include "fx/fx.h"
 
@@ -154,6 +469,12 @@ void sokol_run_depth_pass(
     sokol_offscreen_pass_t *pass,
     sokol_render_state_t *state);
 
+/* Draw instances that are not in the depth prepass to the depth pass targets.
+ * Must run after the scene pass, which writes their depth. */
+void sokol_run_late_depth_pass(
+    sokol_offscreen_pass_t *pass,
+    sokol_render_state_t *state);
+
 /* Scene pass */
 sokol_offscreen_pass_t sokol_init_scene_pass(
     ecs_rgb_t background_color,
@@ -0,0 +1,7 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+/* This generated file contains includes for project dependencies. */
+#include <geometry/bake_config.h>
+
+#endif
@@ -0,0 +1,506 @@
+#include <geometry.h>
+
+/* Kernels are internal to the module, so their source is compiled into the
+ * test. This gives tests access to the SIMD kernels, which must produce the
+ * same results as the scalar kernels. */
+#define SOKOL_PACKED_INSTANCE_DATA (1)
+#include "../../../src/modules/geometry/kernels.c"
+
+/* Instance counts that cover single instances and counts that are not a
+ * multiple of the number of instances processed per loop iteration. */
+static const int32_t counts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 63 };
+#define COUNT_MAX (64)
+#define COUNT_NUM ((int32_t)(sizeof(counts) / sizeof(counts[0])))
+
+/* Value that kernels never write, used to detect out of bounds writes */
+#define SENTINEL (-12345.0f)
+
+#define KERNEL_MAX (4)
+
+static uint32_t rand_state;
+
+void Kernels_setup(void) {
+    ecs_os_set_api_defaults();
+    sokol_init_kernels();
+    rand_state = 1;
+}
+
+static
+float rand_float(float min, float max) {
+    rand_state = rand_state * 1664525u + 1013904223u;
+    float v = (float)(rand_state >> 8) / (float)(1 << 24);
+    return min + v * (max - min);
+}
+
+static
+void rand_floats(float *dst, int32_t count, float min, float max) {
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        dst[i] = rand_float(min, max);
+    }
+}
+
+static
+void fill_floats(float *dst, int32_t count, float value) {
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        dst[i] = value;
+    }
+}
+
+/* Transform kernels that are supported by the CPU, followed by the kernel that
+ * is selected by sokol_init_kernels. */
+static
+int32_t copy_scale_kernels(
+    sokol_copy_scale_kernel_t *kernels,
+    bool compact)
+{
+    int32_t count = 0;
+#if defined(SOKOL_KERNELS_X86)
+    if (compact) {
+        kernels[count ++] = sokol_copy_scale_3x4_sse2;
+    } else {
+        kernels[count ++] = sokol_copy_scale_sse2;
+        if (sokol_cpu_has_avx2()) {
+            kernels[count ++] = sokol_copy_scale_avx2;
+        }
+    }
+#elif defined(SOKOL_KERNELS_NEON)
+    kernels[count ++] = compact
+        ? sokol_copy_scale_3x4_neon
+        : sokol_copy_scale_neon;
+#endif
+    kernels[count ++] = compact
+        ? sokol_copy_scale_transforms_3x4
+        : sokol_copy_scale_transforms;
+    return count;
+}
+
+/* Run transform kernels with dst_stride and scale_stride (in bytes) and compare
+ * the output, including the bytes between matrices, with the scalar kernel. */
+static
+void test_copy_scale(
+    bool compact,
+    int32_t dim,
+    ecs_size_t dst_stride,
+    ecs_size_t scale_stride)
+{
+    static mat4 src[COUNT_MAX];
+    static float scale[COUNT_MAX * 4];
+    static float expect[COUNT_MAX * 32];
+    static float actual[COUNT_MAX * 32];
+
+    rand_floats(src[0][0], COUNT_MAX * 16, -100, 100);
+    rand_floats(scale, COUNT_MAX * 4, -4, 4);
+
+    sokol_copy_scale_kernel_t kernels[KERNEL_MAX];
+    int32_t k, kernel_count = copy_scale_kernels(kernels, compact);
+    int32_t floats = dst_stride / ECS_SIZEOF(float) * COUNT_MAX;
+    test_assert(floats <= (COUNT_MAX * 32));
+
+    int32_t c;
+    for (c = 0; c < COUNT_NUM; c ++) {
+        int32_t count = counts[c];
+        fill_floats(expect, floats, SENTINEL);
+        if (compact) {
+            sokol_copy_scale_3x4_scalar(expect, dst_stride, src, count,
+                scale, scale_stride, dim);
+        } else {
+            sokol_copy_scale_scalar(expect, dst_stride, src, count,
+                scale, scale_stride, dim);
+        }
+
+        for (k = 0; k < kernel_count; k ++) {
+            fill_floats(actual, floats, SENTINEL);
+            kernels[k](actual, dst_stride, src, count,
+                scale, scale_stride, dim);
+            test_assert(!memcmp(expect, actual, floats * ECS_SIZEOF(float)));
+        }
+    }
+}
+
+void Kernels_copy_scale(void) {
+    test_copy_scale(false, 3, ECS_SIZEOF(mat4), ECS_SIZEOF(vec3));
+}
+
+void Kernels_copy_scale_2d(void) {
+    test_copy_scale(false, 2, ECS_SIZEOF(mat4), ECS_SIZEOF(vec2));
+}
+
+void Kernels_copy_scale_uniform(void) {
+    test_copy_scale(false, 3, ECS_SIZEOF(mat4), 0);
+    test_copy_scale(false, 2, ECS_SIZEOF(mat4), 0);
+}
+
+void Kernels_copy_scale_interleaved(void) {
+    test_copy_scale(false, 3, ECS_SIZEOF(mat4) + 24, ECS_SIZEOF(vec3));
+    test_copy_scale(false, 3, ECS_SIZEOF(mat4) + 8, ECS_SIZEOF(vec3) + 4);
+}
+
+void Kernels_copy_scale_3x4(void) {
+    test_copy_scale(true, 3, 48, ECS_SIZEOF(vec3));
+}
+
+void Kernels_copy_scale_3x4_2d(void) {
+    test_copy_scale(true, 2, 48, ECS_SIZEOF(vec2));
+}
+
+void Kernels_copy_scale_3x4_uniform(void) {
+    test_copy_scale(true, 3, 48, 0);
+    test_copy_scale(true, 2, 48, 0);
+}
+
+void Kernels_copy_scale_3x4_interleaved(void) {
+    test_copy_scale(true, 3, 48 + 24, ECS_SIZEOF(vec3));
+    test_copy_scale(true, 3, 48 + 8, ECS_SIZEOF(vec3) + 4);
+}
+
+void Kernels_scale_in_place(void) {
+    static mat4 src[COUNT_MAX];
+    static mat4 expect[COUNT_MAX];
+    static mat4 actual[COUNT_MAX];
+    static float scale[COUNT_MAX * 3];
+
+    rand_floats(src[0][0], COUNT_MAX * 16, -100, 100);
+    rand_floats(scale, COUNT_MAX * 3, -4, 4);
+
+    int32_t c;
+    for (c = 0; c < COUNT_NUM; c ++) {
+        int32_t count = counts[c];
+        fill_floats(expect[0][0], COUNT_MAX * 16, SENTINEL);
+        sokol_copy_scale_scalar(expect[0][0], ECS_SIZEOF(mat4), src, count,
+            scale, ECS_SIZEOF(vec3), 3);
+
+        memcpy(actual, src, sizeof(mat4) * count);
+        fill_floats(actual[count][0], (COUNT_MAX - count) * 16, SENTINEL);
+        sokol_scale_transforms(actual, count, scale, ECS_SIZEOF(vec3), 3);
+        test_assert(!memcmp(expect, actual, sizeof(actual)));
+    }
+}
+
+/* Color kernels that are supported by the CPU, followed by the kernel that is
+ * selected by sokol_init_kernels. */
+static
+int32_t pack_colors_kernels(
+    sokol_pack_colors_kernel_t *kernels)
+{
+    int32_t count = 0;
+#if defined(SOKOL_KERNELS_X86)
+    kernels[count ++] = sokol_pack_colors_sse2;
+#elif defined(SOKOL_KERNELS_NEON)
+    kernels[count ++] = sokol_pack_colors_neon;
+#endif
+    kernels[count ++] = sokol_pack_instance_colors;
+    return count;
+}
+
+/* Input for color kernels. Each instance has a color (3 floats), specular
+ * power & shininess (2 floats) and emissive (1 float), which are read with a
+ * stride of 0 when uniform is set. */
+typedef struct pack_input_t {
+    float color[COUNT_MAX * 3];
+    float specular[COUNT_MAX * 2];
+    float emissive[COUNT_MAX];
+    bool uniform;
+} pack_input_t;
+
+/* Run color kernels with dst_stride (in bytes) and compare the output,
+ * including the bytes between instances, with the scalar kernel. */
+static
+void test_pack_colors(
+    const pack_input_t *in,
+    ecs_size_t dst_stride)
+{
+    static uint8_t expect[COUNT_MAX * 80];
+    static uint8_t actual[COUNT_MAX * 80];
+    ecs_size_t color_stride = in->uniform ? 0 : 3 * ECS_SIZEOF(float);
+    ecs_size_t specular_stride = in->uniform ? 0 : 2 * ECS_SIZEOF(float);
+    ecs_size_t emissive_stride = in->uniform ? 0 : ECS_SIZEOF(float);
+
+    sokol_pack_colors_kernel_t kernels[KERNEL_MAX];
+    int32_t k, kernel_count = pack_colors_kernels(kernels);
+    ecs_size_t size = dst_stride * COUNT_MAX;
+    test_assert(size <= ECS_SIZEOF(expect));
+
+    int32_t c;
+    for (c = 0; c < COUNT_NUM; c ++) {
+        int32_t count = counts[c];
+        ecs_os_memset(expect, 0xA5, size);
+        sokol_pack_colors_scalar(expect, dst_stride, count,
+            in->color, color_stride, in->specular, specular_stride,
+            in->emissive, emissive_stride);
+
+        for (k = 0; k < kernel_count; k ++) {
+            ecs_os_memset(actual, 0xA5, size);
+            kernels[k](actual, dst_stride, count,
+                in->color, color_stride, in->specular, specular_stride,
+                in->emissive, emissive_stride);
+            test_assert(!memcmp(expect, actual, size));
+        }
+    }
+}
+
+static
+void rand_pack_input(
+    pack_input_t *in,
+    float min,
+    float max)
+{
+    rand_floats(in->color, COUNT_MAX * 3, min, max);
+
+    // Scale material values to the range of the packed format
+    int32_t i;
+    for (i = 0; i < COUNT_MAX; i ++) {
+        in->specular[i * 2] = rand_float(min, max) *
+            (float)SOKOL_PACKED_SPECULAR_MAX;
+        in->specular[i * 2 + 1] = rand_float(min, max) *
+            (float)SOKOL_PACKED_SHININESS_MAX;
+        in->emissive[i] = rand_float(min, max) *
+            (float)SOKOL_PACKED_EMISSIVE_MAX;
+    }
+    in->uniform = false;
+}
+
+void Kernels_pack_colors(void) {
+    static pack_input_t in;
+    rand_pack_input(&in, 0, 1);
+    test_pack_colors(&in, 8);
+}
+
+void Kernels_pack_colors_clamp(void) {
+    static pack_input_t in;
+    rand_pack_input(&in, -1, 2);
+
+    // Values that are not finite clamp to the bounds of the range
+    in.color[0] = INFINITY;
+    in.color[1] = -INFINITY;
+    in.color[2] = NAN;
+    in.specular[0] = INFINITY;
+    in.specular[1] = NAN;
+    in.emissive[0] = -INFINITY;
+    in.emissive[1] = NAN;
+    in.emissive[2] = INFINITY;
+    test_pack_colors(&in, 8);
+}
+
+void Kernels_pack_colors_bounds(void) {
+    static pack_input_t in;
+    rand_pack_input(&in, 0, 1);
+
+    // Values at the bounds of the range, and halfway between packed values
+    int32_t i;
+    for (i = 0; i < COUNT_MAX; i ++) {
+        float v = (float)(i % 4) / 3.0f;
+        float half = ((float)(i % 255) + 0.5f) / 255.0f;
+        in.color[i * 3] = v;
+        in.color[i * 3 + 1] = half;
+        in.color[i * 3 + 2] = 1.0f - v;
+        in.specular[i * 2] = v * (float)SOKOL_PACKED_SPECULAR_MAX;
+        in.specular[i * 2 + 1] = half * (float)SOKOL_PACKED_SHININESS_MAX;
+        in.emissive[i] = v * (float)SOKOL_PACKED_EMISSIVE_MAX;
+    }
+    test_pack_colors(&in, 8);
+}
+
+void Kernels_pack_colors_uniform(void) {
+    static pack_input_t in;
+    rand_pack_input(&in, 0, 1);
+    in.uniform = true;
+    test_pack_colors(&in, 8);
+}
+
+void Kernels_pack_colors_interleaved(void) {
+    static pack_input_t in;
+    rand_pack_input(&in, 0, 1);
+    test_pack_colors(&in, 8 + 64);
+    test_pack_colors(&in, 8 + 4);
+}
+
+/* Cull kernels that are supported by the CPU, followed by the kernel that is
+ * selected by sokol_init_kernels. */
+static
+int32_t cull_spheres_kernels(
+    sokol_cull_spheres_kernel_t *kernels)
+{
+    int32_t count = 0;
+#if defined(SOKOL_KERNELS_X86)
+    kernels[count ++] = sokol_cull_spheres_sse2;
+#elif defined(SOKOL_KERNELS_NEON)
+    kernels[count ++] = sokol_cull_spheres_neon;
+#endif
+    kernels[count ++] = sokol_cull_spheres;
+    return count;
+}
+
+/* Frustum of a camera at the origin that looks down -z, with normalized planes
+ * that point inwards. Near plane is at z = -1, far plane at z = -100. */
+static
+void frustum_planes(vec4 *planes) {
+    float s = 1.0f / sqrtf(2.0f);
+    vec4 p[6] = {
+        { s, 0, -s, 0 },        /* left */
+        { -s, 0, -s, 0 },       /* right */
+        { 0, s, -s, 0 },        /* bottom */
+        { 0, -s, -s, 0 },       /* top */
+        { 0, 0, -1, -1 },       /* near */
+        { 0, 0, 1, 100 }        /* far */
+    };
+    memcpy(planes, p, sizeof(p));
+}
+
+/* Spheres in and around the frustum. Spheres that are within a small distance
+ * of touching a plane are moved, as the order of operations of kernels may
+ * round differently. */
+static
+void rand_spheres(vec4 *spheres, int32_t count, const vec4 *planes) {
+    int32_t i, p;
+    for (i = 0; i < count; i ++) {
+        float *s = spheres[i];
+        bool edge;
+        do {
+            s[0] = rand_float(-120, 120);
+            s[1] = rand_float(-120, 120);
+            s[2] = rand_float(-120, 20);
+            s[3] = rand_float(0.1f, 20);
+
+            edge = false;
+            for (p = 0; p < 6; p ++) {
+                const float *pl = planes[p];
+                float d = pl[0] * s[0] + pl[1] * s[1] + pl[2] * s[2] + pl[3];
+                if (fabsf(d + s[3]) < 0.01f) {
+                    edge = true;
+                }
+            }
+        } while (edge);
+    }
+}
+
+/* Run cull kernels and compare visible spheres with the scalar kernel */
+static
+void test_cull_spheres(
+    const vec4 *spheres,
+    const vec4 *planes)
+{
+    static int32_t expect[COUNT_MAX];
+    static int32_t actual[COUNT_MAX];
+
+    sokol_cull_spheres_kernel_t kernels[KERNEL_MAX];
+    int32_t k, kernel_count = cull_spheres_kernels(kernels);
+
+    int32_t c;
+    for (c = 0; c < COUNT_NUM; c ++) {
+        int32_t count = counts[c];
+        int32_t expect_count = sokol_cull_spheres_scalar(
+            expect, spheres, count, planes);
+        test_assert(expect_count <= count);
+
+        for (k = 0; k < kernel_count; k ++) {
+            ecs_os_memset(actual, 0xFF, ECS_SIZEOF(actual));
+            int32_t actual_count = kernels[k](actual, spheres, count, planes);
+            test_int(actual_count, expect_count);
+            test_assert(!memcmp(expect, actual,
+                expect_count * ECS_SIZEOF(int32_t)));
+
+            // Kernels must not write beyond the visible spheres
+            test_int(actual[expect_count], -1);
+        }
+    }
+}
+
+void Kernels_cull_spheres(void) {
+    static vec4 spheres[COUNT_MAX];
+    vec4 planes[6];
+    frustum_planes(planes);
+    rand_spheres(spheres, COUNT_MAX, planes);
+    test_cull_spheres(spheres, planes);
+
+    // Spheres must be a mix of visible and culled spheres
+    int32_t visible[COUNT_MAX];
+    int32_t count = sokol_cull_spheres_scalar(
+        visible, spheres, COUNT_MAX, planes);
+    test_assert(count > 0);
+    test_assert(count < COUNT_MAX);
+}
+
+void Kernels_cull_spheres_per_plane(void) {
+    static vec4 spheres[COUNT_MAX];
+    vec4 planes[6];
+    frustum_planes(planes);
+
+    // Sphere i is outside of plane i % 7, where plane 6 keeps it visible. This
+    // tests each plane, including the planes that are in the padded lanes.
+    int32_t i;
+    for (i = 0; i < COUNT_MAX; i ++) {
+        float *s = spheres[i];
+        glm_vec4_copy((vec4){ 0, 0, -50, 1 }, s);
+        switch (i % 7) {
+        case 0: s[0] = -60; break;
+        case 1: s[0] = 60; break;
+        case 2: s[1] = -60; break;
+        case 3: s[1] = 60; break;
+        case 4: s[2] = 0.5f; s[3] = 0.25f; break;
+        case 5: s[2] = -110; break;
+        default: break;
+        }
+    }
+
+    int32_t visible[COUNT_MAX];
+    int32_t count = sokol_cull_spheres_scalar(
+        visible, spheres, COUNT_MAX, planes);
+    test_int(count, COUNT_MAX / 7);
+    test_cull_spheres(spheres, planes);
+}
+
+void Kernels_cull_spheres_empty(void) {
+    static vec4 spheres[COUNT_MAX];
+    vec4 planes[6];
+    frustum_planes(planes);
+    rand_spheres(spheres, COUNT_MAX, planes);
+
+    // Spheres with a radius of zero, a negative or a NaN radius are never
+    // visible, even when their center is inside the frustum.
+    int32_t i;
+    for (i = 0; i < COUNT_MAX; i += 2) {
+        spheres[i][0] = 0;
+        spheres[i][1] = 0;
+        spheres[i][2] = -50;
+        switch (i % 3) {
+        case 0: spheres[i][3] = 0; break;
+        case 1: spheres[i][3] = -1; break;
+        default: spheres[i][3] = NAN; break;
+        }
+    }
+
+    test_cull_spheres(spheres, planes);
+
+    int32_t visible[COUNT_MAX];
+    int32_t count = sokol_cull_spheres(visible, spheres, COUNT_MAX, planes);
+    for (i = 0; i < count; i ++) {
+        test_assert(visible[i] % 2);
+    }
+}
+
+void Kernels_dispatch(void) {
+    sokol_init_kernels();
+
+#if defined(SOKOL_KERNELS_X86)
+    if (sokol_cpu_has_avx2()) {
+        test_assert(sokol_copy_scale_kernel == sokol_copy_scale_avx2);
+    } else {
+        test_assert(sokol_copy_scale_kernel == sokol_copy_scale_sse2);
+    }
+    test_assert(sokol_copy_scale_3x4_kernel == sokol_copy_scale_3x4_sse2);
+    test_assert(sokol_pack_colors_kernel == sokol_pack_colors_sse2);
+    test_assert(sokol_cull_spheres_kernel == sokol_cull_spheres_sse2);
+#elif defined(SOKOL_KERNELS_NEON)
+    test_assert(sokol_copy_scale_kernel == sokol_copy_scale_neon);
+    test_assert(sokol_copy_scale_3x4_kernel == sokol_copy_scale_3x4_neon);
+    test_assert(sokol_pack_colors_kernel == sokol_pack_colors_neon);
+    test_assert(sokol_cull_spheres_kernel == sokol_cull_spheres_neon);
+#else
+    test_assert(sokol_copy_scale_kernel == sokol_copy_scale_scalar);
+    test_assert(sokol_copy_scale_3x4_kernel == sokol_copy_scale_3x4_scalar);
+    test_assert(sokol_pack_colors_kernel == sokol_pack_colors_scalar);
+    test_assert(sokol_cull_spheres_kernel == sokol_cull_spheres_scalar);
+#endif
+}
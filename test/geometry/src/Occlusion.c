@@ -0,0 +1,404 @@
+#include <geometry.h>
+
+/* The rasterizer is internal to the module, so its source is compiled into the
+ * test with the options that enable it. The test project does not link the
+ * module, which would define the same symbols. */
+#define SOKOL_CULL_INSTANCES (1)
+#define SOKOL_OCCLUSION_CULLING (1)
+#include "../../../src/modules/geometry/occlusion.c"
+
+/* Buffer is 256x128 pixels, with 32x16 tiles of 8x8 pixels. The orthographic
+ * projection maps one world unit to 8 pixels (one tile), so that:
+ *   pixel x = 8 * x + 128
+ *   pixel y = 8 * y + 64
+ *   depth   = -z / 10
+ */
+#define WIDTH (256)
+#define HEIGHT (128)
+#define TILE_COLS (WIDTH / SOKOL_OCCLUSION_TILE_SIZE)
+#define TILE_ROWS (HEIGHT / SOKOL_OCCLUSION_TILE_SIZE)
+#define EPSILON (0.0001f)
+
+static sokol_occlusion_buffer_t buf;
+
+void Occlusion_setup(void) {
+    ecs_os_set_api_defaults();
+}
+
+static
+void init_ortho(void) {
+    mat4 mat_vp;
+    glm_ortho(-16, 16, -8, 8, 0, 10, mat_vp);
+    sokol_occlusion_init(&buf, WIDTH, HEIGHT);
+    sokol_occlusion_clear(&buf, mat_vp);
+}
+
+static
+void init_perspective(void) {
+    mat4 mat_vp;
+    glm_perspective(glm_rad(90), 2, 1, 10, mat_vp);
+    sokol_occlusion_init(&buf, WIDTH, HEIGHT);
+    sokol_occlusion_clear(&buf, mat_vp);
+}
+
+static
+void draw_box(float x, float y, float z, float w, float h, float d) {
+    mat4 transform;
+    glm_translate_make(transform, (vec3){x, y, z});
+    glm_scale(transform, (vec3){w, h, d});
+    sokol_occlusion_draw_box(&buf, transform);
+}
+
+/* Box with front face at z = -4 (depth 0.4), covering pixels [112, 144) x
+ * [48, 80), which are tiles [14, 18) x [6, 10). */
+static
+void draw_occluder(void) {
+    draw_box(0, 0, -5, 4, 4, 2);
+}
+
+/* Box with front face at z = -4 that covers the entire screen */
+static
+void draw_screen_occluder(void) {
+    draw_box(0, 0, -5, 64, 64, 2);
+}
+
+static
+bool in_rect(int32_t x, int32_t y, int32_t x0, int32_t y0, int32_t x1, int32_t y1) {
+    return x >= x0 && x < x1 && y >= y0 && y < y1;
+}
+
+static
+void test_depth(float actual, float expected) {
+    test_assert(fabsf(actual - expected) < EPSILON);
+}
+
+static
+bool test_sphere(float x, float y, float z, float r) {
+    vec4 sphere = {x, y, z, r};
+    return sokol_occlusion_test_sphere(&buf, sphere);
+}
+
+static
+bool test_box(float x0, float y0, float z0, float x1, float y1, float z1) {
+    vec3 min = {x0, y0, z0}, max = {x1, y1, z1};
+    return sokol_occlusion_test_box(&buf, min, max);
+}
+
+void Occlusion_clear(void) {
+    init_ortho();
+    sokol_occlusion_finish(&buf);
+
+    test_int(buf.tile_cols, TILE_COLS);
+    test_int(buf.tile_rows, TILE_ROWS);
+
+    int32_t i;
+    for (i = 0; i < WIDTH * HEIGHT; i ++) {
+        test_flt(buf.depth[i], 1.0f);
+    }
+    for (i = 0; i < TILE_COLS * TILE_ROWS; i ++) {
+        test_flt(buf.tiles[i], 1.0f);
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_box_depth(void) {
+    init_ortho();
+    draw_occluder();
+
+    int32_t x, y;
+    for (y = 0; y < HEIGHT; y ++) {
+        for (x = 0; x < WIDTH; x ++) {
+            float expect = in_rect(x, y, 112, 48, 144, 80) ? 0.4f : 1.0f;
+            test_depth(buf.depth[y * WIDTH + x], expect);
+        }
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_box_tile_depth(void) {
+    init_ortho();
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    int32_t x, y;
+    for (y = 0; y < TILE_ROWS; y ++) {
+        for (x = 0; x < TILE_COLS; x ++) {
+            float expect = in_rect(x, y, 14, 6, 18, 10) ? 0.4f : 1.0f;
+            test_depth(buf.tiles[y * TILE_COLS + x], expect);
+        }
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_partial_tile(void) {
+    init_ortho();
+
+    /* Covers pixels [112, 148) x [48, 80), so tile column 18 is only half
+     * covered and keeps the depth of its uncovered pixels. */
+    draw_box(0.25f, 0, -5, 4.5f, 4, 2);
+    sokol_occlusion_finish(&buf);
+
+    int32_t x, y;
+    for (y = 0; y < HEIGHT; y ++) {
+        for (x = 0; x < WIDTH; x ++) {
+            float expect = in_rect(x, y, 112, 48, 148, 80) ? 0.4f : 1.0f;
+            test_depth(buf.depth[y * WIDTH + x], expect);
+        }
+    }
+
+    for (y = 0; y < TILE_ROWS; y ++) {
+        for (x = 0; x < TILE_COLS; x ++) {
+            float expect = in_rect(x, y, 14, 6, 18, 10) ? 0.4f : 1.0f;
+            test_depth(buf.tiles[y * TILE_COLS + x], expect);
+        }
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_nearest_depth(void) {
+    init_ortho();
+
+    /* Front face at z = -7 (depth 0.7), covering pixels [96, 160) x [32, 96).
+     * The occluder is drawn after it, and is nearer. */
+    draw_box(0, 0, -8, 8, 8, 2);
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    int32_t x, y;
+    for (y = 0; y < HEIGHT; y ++) {
+        for (x = 0; x < WIDTH; x ++) {
+            float expect = 1.0f;
+            if (in_rect(x, y, 112, 48, 144, 80)) {
+                expect = 0.4f;
+            } else if (in_rect(x, y, 96, 32, 160, 96)) {
+                expect = 0.7f;
+            }
+            test_depth(buf.depth[y * WIDTH + x], expect);
+        }
+    }
+
+    for (y = 0; y < TILE_ROWS; y ++) {
+        for (x = 0; x < TILE_COLS; x ++) {
+            float expect = 1.0f;
+            if (in_rect(x, y, 14, 6, 18, 10)) {
+                expect = 0.4f;
+            } else if (in_rect(x, y, 12, 4, 20, 12)) {
+                expect = 0.7f;
+            }
+            test_depth(buf.tiles[y * TILE_COLS + x], expect);
+        }
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_partial_pixel(void) {
+    init_ortho();
+
+    /* Triangle (112, 48), (144, 48), (144, 80) at depth 0.5. Its diagonal edge
+     * crosses pixels where x - y = 64, which are only half covered. */
+    vec4 v0 = {-0.125f, -0.25f, 0, 1};
+    vec4 v1 = { 0.125f, -0.25f, 0, 1};
+    vec4 v2 = { 0.125f,  0.25f, 0, 1};
+    sokol_occlusion_draw_triangle(&buf, v0, v1, v2);
+
+    int32_t x, y;
+    for (y = 0; y < HEIGHT; y ++) {
+        for (x = 0; x < WIDTH; x ++) {
+            float expect = 1.0f;
+            if (in_rect(x, y, 112, 48, 144, 80) && (x - y) >= 65) {
+                expect = 0.5f;
+            }
+            test_depth(buf.depth[y * WIDTH + x], expect);
+        }
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_rotated_box(void) {
+    init_ortho();
+
+    /* Two faces face the camera, so that the silhouette spans pixels
+     * [105.4, 150.6] x [47.6, 80.4]. The nearest edge is at z = -2.17, and
+     * the farthest vertices of the front faces are at z = -5 (depth 0.5).
+     * Pixels on the edges between faces are fully covered by the box, so
+     * they are drawn. */
+    mat4 transform;
+    glm_translate_make(transform, (vec3){0, 0, -5});
+    glm_rotate_y(transform, glm_rad(45), transform);
+    glm_scale(transform, (vec3){4, 4.1f, 4});
+    sokol_occlusion_draw_box(&buf, transform);
+    sokol_occlusion_finish(&buf);
+
+    int32_t x, y;
+    for (y = 0; y < HEIGHT; y ++) {
+        for (x = 0; x < WIDTH; x ++) {
+            float expect = in_rect(x, y, 106, 48, 150, 80) ? 0.5f : 1.0f;
+            test_depth(buf.depth[y * WIDTH + x], expect);
+        }
+    }
+
+    for (y = 0; y < TILE_ROWS; y ++) {
+        for (x = 0; x < TILE_COLS; x ++) {
+            float expect = in_rect(x, y, 14, 6, 18, 10) ? 0.5f : 1.0f;
+            test_depth(buf.tiles[y * TILE_COLS + x], expect);
+        }
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_mirrored_box(void) {
+    init_ortho();
+
+    /* Mirroring reverses the winding of faces on screen */
+    draw_box(0, 0, -5, -4, 4, 2);
+
+    int32_t x, y;
+    for (y = 0; y < HEIGHT; y ++) {
+        for (x = 0; x < WIDTH; x ++) {
+            float expect = in_rect(x, y, 112, 48, 144, 80) ? 0.4f : 1.0f;
+            test_depth(buf.depth[y * WIDTH + x], expect);
+        }
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_skip_near_plane_triangle(void) {
+    init_ortho();
+
+    vec4 v0 = {-0.5f, -0.5f, 0, 1};
+    vec4 v1 = { 0.5f, -0.5f, 0, 1};
+    vec4 v2 = { 0.0f,  0.5f, 0, -1};
+    sokol_occlusion_draw_triangle(&buf, v0, v1, v2);
+    sokol_occlusion_finish(&buf);
+
+    int32_t i;
+    for (i = 0; i < WIDTH * HEIGHT; i ++) {
+        test_flt(buf.depth[i], 1.0f);
+    }
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_sphere_occluded(void) {
+    init_ortho();
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Covers tiles [15, 17] x [7, 9], nearest depth 0.7 */
+    test_bool(test_sphere(0, 0, -8, 1), false);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_sphere_partially_visible(void) {
+    init_ortho();
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Covers tiles [17, 19] x [7, 9], where tiles 18 and 19 are empty */
+    test_bool(test_sphere(2, 0, -8, 1), true);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_sphere_in_front(void) {
+    init_ortho();
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Nearest depth is 0.1, in front of the occluder */
+    test_bool(test_sphere(0, 0, -2, 1), true);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_sphere_behind_near_plane(void) {
+    init_perspective();
+    draw_screen_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Occluder works with the perspective projection */
+    test_bool(test_sphere(0, 0, -8, 1), false);
+
+    /* Sphere around the camera crosses the near plane */
+    test_bool(test_sphere(0, 0, 0, 1), true);
+
+    /* Sphere behind the camera */
+    test_bool(test_sphere(0, 0, 8, 1), true);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_sphere_off_screen(void) {
+    init_ortho();
+    draw_screen_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Behind the occluder, but outside of the view. Clamping the sphere to the
+     * screen would test it against occluded tiles. */
+    test_bool(test_sphere(40, 0, -8, 1), true);
+    test_bool(test_sphere(-40, 0, -8, 1), true);
+    test_bool(test_sphere(0, 20, -8, 1), true);
+    test_bool(test_sphere(0, -20, -8, 1), true);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_sphere_partially_off_screen(void) {
+    init_ortho();
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Covers pixels [-8, 8] horizontally, which is clamped to tile columns 0
+     * and 1. Both are empty. */
+    test_bool(test_sphere(-16, 0, -8, 1), true);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_sphere_beyond_far_plane(void) {
+    init_ortho();
+    draw_screen_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Nearest depth is 1.1 */
+    test_bool(test_sphere(0, 0, -12, 1), true);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_box_occluded(void) {
+    init_ortho();
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Covers tiles [15, 17] x [7, 9], nearest depth 0.7 */
+    test_bool(test_box(-1, -1, -9, 1, 1, -7), false);
+
+    /* Nearest depth is 0.3, in front of the occluder */
+    test_bool(test_box(-1, -1, -9, 1, 1, -3), true);
+
+    sokol_occlusion_fini(&buf);
+}
+
+void Occlusion_box_partially_visible(void) {
+    init_ortho();
+    draw_occluder();
+    sokol_occlusion_finish(&buf);
+
+    /* Covers tiles [17, 19] x [7, 9], where tiles 18 and 19 are empty */
+    test_bool(test_box(1, -1, -9, 3, 1, -7), true);
+
+    /* Covers tiles [14, 18] x [5, 9], where row 5 is empty */
+    test_bool(test_box(-2, -3, -9, 2, 1, -7), true);
+
+    sokol_occlusion_fini(&buf);
+}
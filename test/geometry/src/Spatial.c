@@ -0,0 +1,568 @@
+#include <geometry.h>
+
+/* The spatial index is internal to the module, so its source is compiled into
+ * the test with the options that enable it. Culling uses the kernels that are
+ * compiled into the Kernels suite. */
+#define SOKOL_CULL_INSTANCES (1)
+#define SOKOL_SPATIAL_INDEX (1)
+#include "../../../src/modules/geometry/spatial.c"
+
+#define CELL (SOKOL_SPATIAL_CELL_SIZE)
+#define SLOT_MAX (1024)
+
+static sokol_spatial_index_t spatial;
+
+/* Spheres that were set for each slot, used to compute expected results */
+static vec4 spheres[SLOT_MAX];
+static int32_t slot_count;
+
+typedef struct result_t {
+    ecs_entity_t entities[SLOT_MAX];
+    int32_t count;
+    int32_t stop_at;
+} result_t;
+
+void Spatial_setup(void) {
+    ecs_os_set_api_defaults();
+    sokol_spatial_init(&spatial, NULL);
+    ecs_os_memset(spheres, 0, ECS_SIZEOF(spheres));
+    slot_count = 0;
+}
+
+void Spatial_teardown(void) {
+    sokol_spatial_fini(&spatial);
+}
+
+/* Entity of a slot, so that results can be mapped back to slots */
+static
+ecs_entity_t slot_entity(int32_t slot) {
+    return (ecs_entity_t)slot + 1000;
+}
+
+static
+void set(int32_t slot, float x, float y, float z, float r) {
+    if (slot >= slot_count) {
+        slot_count = slot + 1;
+        sokol_spatial_resize(&spatial, slot_count);
+    }
+    glm_vec4_copy((vec4){ x, y, z, r }, spheres[slot]);
+    sokol_spatial_set(&spatial, slot, slot_entity(slot), spheres[slot]);
+}
+
+static
+void remove_slots(int32_t slot, int32_t count) {
+    int32_t i;
+    for (i = 0; i < count; i ++) {
+        spheres[slot + i][3] = 0;
+    }
+    sokol_spatial_remove(&spatial, slot, count);
+}
+
+/* Verify that the location of each slot points to the cell entry of the slot,
+ * and that the instance count matches the stored slots. */
+static
+void check_index(void) {
+    int32_t slot, count = 0;
+    for (slot = 0; slot < slot_count; slot ++) {
+        sokol_spatial_loc_t *loc = ecs_vec_get_t(
+            &spatial.locations, sokol_spatial_loc_t, slot);
+        if (!(spheres[slot][3] > 0)) {
+            test_int(loc->index, -1);
+            continue;
+        }
+
+        int32_t coords[3];
+        test_assert(loc->cell == sokol_spatial_key(spheres[slot], coords));
+
+        sokol_spatial_cell_t *cell = ecs_map_get_deref(
+            &spatial.cells, sokol_spatial_cell_t, loc->cell);
+        test_assert(cell != NULL);
+        test_assert(loc->index < ecs_vec_count(&cell->slots));
+        test_int(*ecs_vec_get_t(&cell->slots, int32_t, loc->index), slot);
+        test_assert(*ecs_vec_get_t(&cell->entities, ecs_entity_t, loc->index)
+            == slot_entity(slot));
+        test_assert(!memcmp(ecs_vec_get_t(&cell->spheres, vec4, loc->index),
+            spheres[slot], ECS_SIZEOF(vec4)));
+        count ++;
+    }
+
+    test_int(spatial.count, count);
+}
+
+static
+bool collect(ecs_entity_t entity, const float *sphere, void *ctx) {
+    (void)sphere;
+    result_t *r = ctx;
+    r->entities[r->count ++] = entity;
+    return r->count != r->stop_at;
+}
+
+static
+bool has(const result_t *r, ecs_entity_t entity) {
+    int32_t i;
+    for (i = 0; i < r->count; i ++) {
+        if (r->entities[i] == entity) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static
+void query_sphere(result_t *r, float x, float y, float z, float radius) {
+    r->count = 0;
+    r->stop_at = -1;
+    test_assert(sokol_spatial_overlap_sphere(
+        &spatial, (vec3){ x, y, z }, radius, collect, r));
+}
+
+static
+void query_box(result_t *r, const vec3 min, const vec3 max) {
+    r->count = 0;
+    r->stop_at = -1;
+    test_assert(sokol_spatial_overlap_box(&spatial, min, max, collect, r));
+}
+
+/* Compare query results with a test of all slots */
+static
+void test_sphere_result(
+    const result_t *r, float x, float y, float z, float radius)
+{
+    int32_t slot, count = 0;
+    for (slot = 0; slot < slot_count; slot ++) {
+        if (!(spheres[slot][3] > 0)) {
+            continue;
+        }
+        float d = glm_vec3_distance(spheres[slot], (vec3){ x, y, z });
+        if (d <= (spheres[slot][3] + radius)) {
+            test_assert(has(r, slot_entity(slot)));
+            count ++;
+        }
+    }
+    test_int(r->count, count);
+}
+
+static
+void test_box_result(
+    const result_t *r, const vec3 min, const vec3 max)
+{
+    int32_t slot, count = 0;
+    for (slot = 0; slot < slot_count; slot ++) {
+        float radius = spheres[slot][3];
+        if (!(radius > 0)) {
+            continue;
+        }
+        if (sokol_box_distance2(spheres[slot], min, max) <= radius * radius) {
+            test_assert(has(r, slot_entity(slot)));
+            count ++;
+        }
+    }
+    test_int(r->count, count);
+}
+
+void Spatial_set(void) {
+    set(0, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(1, 0.6f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(2, 3.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 2);
+
+    result_t r;
+    query_sphere(&r, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 4);
+    test_int(r.count, 2);
+    test_assert(has(&r, slot_entity(0)));
+    test_assert(has(&r, slot_entity(1)));
+
+    query_sphere(&r, 3.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 1);
+    test_assert(has(&r, slot_entity(2)));
+}
+
+void Spatial_move_in_cell(void) {
+    set(0, 0.2f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(1, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(0, 0.8f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 1);
+
+    result_t r;
+    query_sphere(&r, 0.2f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 0);
+    query_sphere(&r, 0.8f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 1);
+    test_assert(has(&r, slot_entity(0)));
+}
+
+void Spatial_move_between_cells(void) {
+    set(0, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(1, 2.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(ecs_map_count(&spatial.cells), 2);
+
+    // Moving the only instance of a cell to an occupied cell removes the cell
+    set(0, 2.6f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 1);
+
+    result_t r;
+    query_sphere(&r, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 0);
+    query_sphere(&r, 2.5f * CELL, 0.5f * CELL, 0.5f * CELL, CELL * 0.2f);
+    test_int(r.count, 2);
+
+    // Moving to an empty cell creates the cell
+    set(1, -1.5f * CELL, -0.5f * CELL, 0.5f * CELL, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 2);
+    query_sphere(&r, -1.5f * CELL, -0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 1);
+    test_assert(has(&r, slot_entity(1)));
+}
+
+void Spatial_move_between_cells_not_last(void) {
+    set(0, 0.2f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(1, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(2, 0.8f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+
+    // Last instance of the cell is moved into the entry of the moved instance
+    set(0, 1.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 2);
+
+    set(2, 1.2f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    check_index();
+
+    result_t r;
+    query_sphere(&r, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL);
+    test_int(r.count, 1);
+    test_assert(has(&r, slot_entity(1)));
+    query_sphere(&r, 1.5f * CELL, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL);
+    test_int(r.count, 2);
+    test_assert(has(&r, slot_entity(0)));
+    test_assert(has(&r, slot_entity(2)));
+}
+
+void Spatial_remove_last_in_cell(void) {
+    set(0, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(1, 1.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(ecs_map_count(&spatial.cells), 2);
+
+    remove_slots(0, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 1);
+
+    result_t r;
+    query_sphere(&r, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 0);
+    query_sphere(&r, 1.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 1);
+
+    // Removing a slot that is not stored does nothing
+    remove_slots(0, 1);
+    check_index();
+
+    // Adding an instance to the cell again creates a new cell
+    set(0, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 2);
+    query_sphere(&r, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    test_int(r.count, 1);
+    test_assert(has(&r, slot_entity(0)));
+}
+
+void Spatial_remove_not_last_in_cell(void) {
+    set(0, 0.2f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(1, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(2, 0.8f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+
+    remove_slots(0, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 1);
+
+    // Slot 2 was moved into the entry of slot 0, and can be removed
+    remove_slots(2, 1);
+    check_index();
+
+    result_t r;
+    query_sphere(&r, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, CELL);
+    test_int(r.count, 1);
+    test_assert(has(&r, slot_entity(1)));
+
+    remove_slots(1, 1);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 0);
+    test_int(spatial.count, 0);
+}
+
+void Spatial_remove_range(void) {
+    int32_t i;
+    for (i = 0; i < 16; i ++) {
+        set(i, ((float)(i % 4) + 0.5f) * CELL, 0.5f * CELL,
+            ((float)(i / 4) + 0.5f) * CELL, 1);
+    }
+    test_int(ecs_map_count(&spatial.cells), 16);
+
+    remove_slots(4, 8);
+    check_index();
+    test_int(ecs_map_count(&spatial.cells), 8);
+    test_int(spatial.count, 8);
+
+    result_t r;
+    vec3 min = { 0, 0, 0 }, max = { 4 * CELL, CELL, 4 * CELL };
+    query_box(&r, min, max);
+    test_box_result(&r, min, max);
+    test_int(r.count, 8);
+}
+
+void Spatial_set_zero_radius(void) {
+    set(0, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+    set(1, 0.6f * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+
+    // A sphere without radius removes the slot
+    set(0, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 0);
+    check_index();
+    test_int(spatial.count, 1);
+
+    set(1, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, -1);
+    check_index();
+    test_int(spatial.count, 0);
+    test_int(ecs_map_count(&spatial.cells), 0);
+}
+
+/* Occupy a grid of 4 x 4 cells with one instance per cell */
+static
+void set_grid(void) {
+    int32_t x, z;
+    for (z = 0; z < 4; z ++) {
+        for (x = 0; x < 4; x ++) {
+            set(z * 4 + x, ((float)x + 0.5f) * CELL, 0.5f * CELL,
+                ((float)z + 0.5f) * CELL, 4);
+        }
+    }
+}
+
+/* Returns whether a query for the box iterates all cells of the index */
+static
+bool iter_all(const vec3 min, const vec3 max) {
+    sokol_spatial_iter_t it;
+    sokol_spatial_iter_init(&it, &spatial, min, max);
+    return it.all;
+}
+
+void Spatial_query_cell_range(void) {
+    set_grid();
+
+    // Box overlaps with 2 x 2 cells, which is less than the occupied cells
+    result_t r;
+    vec3 min = { 0.4f * CELL, 0.2f * CELL, 0.4f * CELL };
+    vec3 max = { 1.6f * CELL, 0.8f * CELL, 1.6f * CELL };
+    test_assert(!iter_all(min, max));
+    query_box(&r, min, max);
+    test_box_result(&r, min, max);
+    test_int(r.count, 4);
+
+    query_sphere(&r, CELL, 0.5f * CELL, CELL, 0.75f * CELL);
+    test_sphere_result(&r, CELL, 0.5f * CELL, CELL, 0.75f * CELL);
+    test_int(r.count, 4);
+}
+
+void Spatial_query_all_cells(void) {
+    set_grid();
+
+    // Box overlaps with as many cells as are occupied, which is the largest
+    // range that is still iterated with lookups.
+    result_t r;
+    vec3 min = { -CELL, -CELL, -CELL };
+    vec3 max = { 5 * CELL, 2 * CELL, 5 * CELL };
+    test_assert(!iter_all(min, max));
+    query_box(&r, min, max);
+    test_box_result(&r, min, max);
+    test_int(r.count, 16);
+
+    // With one cell less, the same box iterates all occupied cells
+    remove_slots(5, 1);
+    test_int(ecs_map_count(&spatial.cells), 15);
+    test_assert(iter_all(min, max));
+    query_box(&r, min, max);
+    test_box_result(&r, min, max);
+    test_int(r.count, 15);
+
+    // Queries that iterate all cells still only return overlapping instances
+    min[0] = 0.7f * CELL; max[0] = 4 * CELL;
+    min[2] = 0.2f * CELL; max[2] = 0.4f * CELL;
+    test_assert(!iter_all(min, max));
+    max[2] = 3.4f * CELL;
+    test_assert(iter_all(min, max));
+    query_box(&r, min, max);
+    test_box_result(&r, min, max);
+    test_int(r.count, 11);
+
+    query_sphere(&r, 2 * CELL, 0.5f * CELL, 2 * CELL, 2 * CELL);
+    test_sphere_result(&r, 2 * CELL, 0.5f * CELL, 2 * CELL, 2 * CELL);
+}
+
+void Spatial_query_max_radius(void) {
+    set_grid();
+
+    // Instance in cell (0, 0, 0) extends into the cells around it. Queries
+    // that don't overlap with the cell must still find it.
+    set(0, 0.5f * CELL, 0.5f * CELL, 0.5f * CELL, 1.5f * CELL);
+
+    result_t r;
+    vec3 min = { 1.9f * CELL, 0.4f * CELL, 0.4f * CELL };
+    vec3 max = { 1.95f * CELL, 0.6f * CELL, 0.6f * CELL };
+    test_assert(!iter_all(min, max));
+    query_box(&r, min, max);
+    test_box_result(&r, min, max);
+    test_assert(has(&r, slot_entity(0)));
+
+    query_sphere(&r, 0.5f * CELL, 0.5f * CELL, 2.1f * CELL, 0.2f * CELL);
+    test_sphere_result(&r, 0.5f * CELL, 0.5f * CELL, 2.1f * CELL, 0.2f * CELL);
+    test_assert(has(&r, slot_entity(0)));
+}
+
+void Spatial_query_stop(void) {
+    set_grid();
+
+    result_t r = { .stop_at = 3 };
+    vec3 min = { 0, 0, 0 }, max = { 4 * CELL, CELL, 4 * CELL };
+    test_assert(!sokol_spatial_overlap_box(&spatial, min, max, collect, &r));
+    test_int(r.count, 3);
+
+    r.count = 0;
+    test_assert(!sokol_spatial_overlap_sphere(&spatial,
+        (vec3){ 2 * CELL, 0.5f * CELL, 2 * CELL }, 4 * CELL, collect, &r));
+    test_int(r.count, 3);
+}
+
+void Spatial_query_empty(void) {
+    result_t r;
+    query_sphere(&r, 0, 0, 0, CELL);
+    test_int(r.count, 0);
+
+    float distance = 100 * CELL;
+    test_assert(!sokol_spatial_raycast(&spatial, (vec3){ 0, 0, 0 },
+        (vec3){ 1, 0, 0 }, &distance));
+}
+
+/* Fill cells that are far away from the rays of the raycast tests, so that
+ * stepping through the cells of a ray requires fewer lookups than testing all
+ * cells. */
+static
+void set_filler(void) {
+    int32_t x, y, z, slot = 100;
+    for (z = 10; z < 30; z ++) {
+        for (y = 0; y < 2; y ++) {
+            for (x = 0; x < 20; x ++) {
+                set(slot ++, ((float)x + 0.5f) * CELL,
+                    ((float)y + 0.5f) * CELL, ((float)z + 0.5f) * CELL, 1);
+            }
+        }
+    }
+}
+
+static
+ecs_entity_t raycast(float y, float *distance) {
+    *distance = 100 * CELL;
+    vec3 origin = { -2 * CELL, y, 0.5f * CELL };
+    vec3 direction = { 1, 0, 0 };
+    return sokol_spatial_raycast(&spatial, origin, direction, distance);
+}
+
+/* The ray at y = 0.95 only crosses cells with y = 0. The instance is stored in
+ * a cell with y = 1, and extends into the cells crossed by the ray. */
+static
+void test_raycast_neighbor(void) {
+    set(0, 3.5f * CELL, 1.2f * CELL, 0.5f * CELL, 0.5f * CELL);
+
+    float distance;
+    test_assert(raycast(0.95f * CELL, &distance) == slot_entity(0));
+
+    // Distance from origin to where the ray enters the sphere
+    float dy = 0.25f * CELL, r = 0.5f * CELL;
+    float expect = 5.5f * CELL - sqrtf(r * r - dy * dy);
+    test_assert(fabsf(distance - expect) < 0.001f);
+
+    // Ray passes below the sphere
+    test_assert(raycast(0.65f * CELL, &distance) == 0);
+}
+
+void Spatial_raycast_neighbor_cell(void) {
+    set_filler();
+    test_raycast_neighbor();
+}
+
+void Spatial_raycast_neighbor_cell_all_cells(void) {
+    // Without filler there are fewer cells than lookups along the ray
+    set(1, 10.5f * CELL, 0.5f * CELL, 20.5f * CELL, 1);
+    test_raycast_neighbor();
+}
+
+void Spatial_raycast_neighbor_cells_large_radius(void) {
+    set_filler();
+
+    // Instance is stored two cells away from the cells crossed by the ray
+    set(0, 6.5f * CELL, 2.2f * CELL, 0.5f * CELL, 1.5f * CELL);
+    test_int((int32_t)ceilf(spatial.max_radius / CELL), 2);
+
+    float distance;
+    test_assert(raycast(0.95f * CELL, &distance) == slot_entity(0));
+    test_assert(raycast(0.65f * CELL, &distance) == 0);
+}
+
+void Spatial_raycast_nearest(void) {
+    set_filler();
+    set(0, 8.5f * CELL, 0.5f * CELL, 0.5f * CELL, 2);
+    set(1, 4.5f * CELL, 0.9f * CELL, 0.5f * CELL, 0.5f * CELL);
+    set(2, 2.5f * CELL, 0.5f * CELL, 0.5f * CELL, 2);
+
+    float distance;
+    test_assert(raycast(0.5f * CELL, &distance) == slot_entity(2));
+    test_assert(fabsf(distance - (4.5f * CELL - 2)) < 0.001f);
+
+    remove_slots(2, 1);
+    test_assert(raycast(0.5f * CELL, &distance) == slot_entity(1));
+
+    remove_slots(1, 1);
+    test_assert(raycast(0.5f * CELL, &distance) == slot_entity(0));
+    test_assert(fabsf(distance - (10.5f * CELL - 2)) < 0.001f);
+}
+
+void Spatial_raycast_max_distance(void) {
+    set_filler();
+    set(0, 8.5f * CELL, 0.5f * CELL, 0.5f * CELL, 2);
+
+    vec3 origin = { -2 * CELL, 0.5f * CELL, 0.5f * CELL };
+    vec3 direction = { 1, 0, 0 };
+    float distance = 10 * CELL;
+    test_assert(!sokol_spatial_raycast(&spatial, origin, direction, &distance));
+
+    distance = 11 * CELL;
+    test_assert(sokol_spatial_raycast(&spatial, origin, direction, &distance) ==
+        slot_entity(0));
+}
+
+void Spatial_cull(void) {
+    set_grid();
+    set(16, 100 * CELL, 0.5f * CELL, 0.5f * CELL, 1);
+
+    // Planes enclose cells with x in [0, 2) and z in [0, 4)
+    vec4 planes[6] = {
+        { 1, 0, 0, 0 },
+        { -1, 0, 0, 2 * CELL },
+        { 0, 1, 0, CELL },
+        { 0, -1, 0, CELL },
+        { 0, 0, 1, 0 },
+        { 0, 0, -1, 4 * CELL }
+    };
+
+    int32_t visible[SLOT_MAX], culled_cells = 0;
+    int32_t i, count = sokol_spatial_cull(
+        &spatial, visible, planes, &culled_cells);
+    test_int(count, 8);
+    test_int(culled_cells, 9);
+
+    for (i = 0; i < count; i ++) {
+        test_assert(visible[i] >= 0 && visible[i] < 16);
+        test_assert((visible[i] % 4) < 2);
+    }
+}
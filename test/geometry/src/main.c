@@ -0,0 +1,331 @@
+
+/* A friendly warning from bake.test
+ * ----------------------------------------------------------------------------
+ * This file is generated. To add/remove testcases modify the 'project.json' of
+ * the test project. ANY CHANGE TO THIS FILE IS LOST AFTER (RE)BUILDING!
+ * ----------------------------------------------------------------------------
+ */
+
+#include <geometry.h>
+
+// Testsuite 'Occlusion'
+void Occlusion_setup(void);
+void Occlusion_clear(void);
+void Occlusion_box_depth(void);
+void Occlusion_box_tile_depth(void);
+void Occlusion_partial_tile(void);
+void Occlusion_nearest_depth(void);
+void Occlusion_partial_pixel(void);
+void Occlusion_rotated_box(void);
+void Occlusion_mirrored_box(void);
+void Occlusion_skip_near_plane_triangle(void);
+void Occlusion_sphere_occluded(void);
+void Occlusion_sphere_partially_visible(void);
+void Occlusion_sphere_in_front(void);
+void Occlusion_sphere_behind_near_plane(void);
+void Occlusion_sphere_off_screen(void);
+void Occlusion_sphere_partially_off_screen(void);
+void Occlusion_sphere_beyond_far_plane(void);
+void Occlusion_box_occluded(void);
+void Occlusion_box_partially_visible(void);
+
+// Testsuite 'Kernels'
+void Kernels_setup(void);
+void Kernels_copy_scale(void);
+void Kernels_copy_scale_2d(void);
+void Kernels_copy_scale_uniform(void);
+void Kernels_copy_scale_interleaved(void);
+void Kernels_copy_scale_3x4(void);
+void Kernels_copy_scale_3x4_2d(void);
+void Kernels_copy_scale_3x4_uniform(void);
+void Kernels_copy_scale_3x4_interleaved(void);
+void Kernels_scale_in_place(void);
+void Kernels_pack_colors(void);
+void Kernels_pack_colors_clamp(void);
+void Kernels_pack_colors_bounds(void);
+void Kernels_pack_colors_uniform(void);
+void Kernels_pack_colors_interleaved(void);
+void Kernels_cull_spheres(void);
+void Kernels_cull_spheres_per_plane(void);
+void Kernels_cull_spheres_empty(void);
+void Kernels_dispatch(void);
+
+// Testsuite 'Spatial'
+void Spatial_setup(void);
+void Spatial_teardown(void);
+void Spatial_set(void);
+void Spatial_move_in_cell(void);
+void Spatial_move_between_cells(void);
+void Spatial_move_between_cells_not_last(void);
+void Spatial_remove_last_in_cell(void);
+void Spatial_remove_not_last_in_cell(void);
+void Spatial_remove_range(void);
+void Spatial_set_zero_radius(void);
+void Spatial_query_cell_range(void);
+void Spatial_query_all_cells(void);
+void Spatial_query_max_radius(void);
+void Spatial_query_stop(void);
+void Spatial_query_empty(void);
+void Spatial_raycast_neighbor_cell(void);
+void Spatial_raycast_neighbor_cell_all_cells(void);
+void Spatial_raycast_neighbor_cells_large_radius(void);
+void Spatial_raycast_nearest(void);
+void Spatial_raycast_max_distance(void);
+void Spatial_cull(void);
+
+bake_test_case Occlusion_testcases[] = {
+    {
+        "clear",
+        Occlusion_clear
+    },
+    {
+        "box_depth",
+        Occlusion_box_depth
+    },
+    {
+        "box_tile_depth",
+        Occlusion_box_tile_depth
+    },
+    {
+        "partial_tile",
+        Occlusion_partial_tile
+    },
+    {
+        "nearest_depth",
+        Occlusion_nearest_depth
+    },
+    {
+        "partial_pixel",
+        Occlusion_partial_pixel
+    },
+    {
+        "rotated_box",
+        Occlusion_rotated_box
+    },
+    {
+        "mirrored_box",
+        Occlusion_mirrored_box
+    },
+    {
+        "skip_near_plane_triangle",
+        Occlusion_skip_near_plane_triangle
+    },
+    {
+        "sphere_occluded",
+        Occlusion_sphere_occluded
+    },
+    {
+        "sphere_partially_visible",
+        Occlusion_sphere_partially_visible
+    },
+    {
+        "sphere_in_front",
+        Occlusion_sphere_in_front
+    },
+    {
+        "sphere_behind_near_plane",
+        Occlusion_sphere_behind_near_plane
+    },
+    {
+        "sphere_off_screen",
+        Occlusion_sphere_off_screen
+    },
+    {
+        "sphere_partially_off_screen",
+        Occlusion_sphere_partially_off_screen
+    },
+    {
+        "sphere_beyond_far_plane",
+        Occlusion_sphere_beyond_far_plane
+    },
+    {
+        "box_occluded",
+        Occlusion_box_occluded
+    },
+    {
+        "box_partially_visible",
+        Occlusion_box_partially_visible
+    }
+};
+
+bake_test_case Kernels_testcases[] = {
+    {
+        "copy_scale",
+        Kernels_copy_scale
+    },
+    {
+        "copy_scale_2d",
+        Kernels_copy_scale_2d
+    },
+    {
+        "copy_scale_uniform",
+        Kernels_copy_scale_uniform
+    },
+    {
+        "copy_scale_interleaved",
+        Kernels_copy_scale_interleaved
+    },
+    {
+        "copy_scale_3x4",
+        Kernels_copy_scale_3x4
+    },
+    {
+        "copy_scale_3x4_2d",
+        Kernels_copy_scale_3x4_2d
+    },
+    {
+        "copy_scale_3x4_uniform",
+        Kernels_copy_scale_3x4_uniform
+    },
+    {
+        "copy_scale_3x4_interleaved",
+        Kernels_copy_scale_3x4_interleaved
+    },
+    {
+        "scale_in_place",
+        Kernels_scale_in_place
+    },
+    {
+        "pack_colors",
+        Kernels_pack_colors
+    },
+    {
+        "pack_colors_clamp",
+        Kernels_pack_colors_clamp
+    },
+    {
+        "pack_colors_bounds",
+        Kernels_pack_colors_bounds
+    },
+    {
+        "pack_colors_uniform",
+        Kernels_pack_colors_uniform
+    },
+    {
+        "pack_colors_interleaved",
+        Kernels_pack_colors_interleaved
+    },
+    {
+        "cull_spheres",
+        Kernels_cull_spheres
+    },
+    {
+        "cull_spheres_per_plane",
+        Kernels_cull_spheres_per_plane
+    },
+    {
+        "cull_spheres_empty",
+        Kernels_cull_spheres_empty
+    },
+    {
+        "dispatch",
+        Kernels_dispatch
+    }
+};
+
+bake_test_case Spatial_testcases[] = {
+    {
+        "set",
+        Spatial_set
+    },
+    {
+        "move_in_cell",
+        Spatial_move_in_cell
+    },
+    {
+        "move_between_cells",
+        Spatial_move_between_cells
+    },
+    {
+        "move_between_cells_not_last",
+        Spatial_move_between_cells_not_last
+    },
+    {
+        "remove_last_in_cell",
+        Spatial_remove_last_in_cell
+    },
+    {
+        "remove_not_last_in_cell",
+        Spatial_remove_not_last_in_cell
+    },
+    {
+        "remove_range",
+        Spatial_remove_range
+    },
+    {
+        "set_zero_radius",
+        Spatial_set_zero_radius
+    },
+    {
+        "query_cell_range",
+        Spatial_query_cell_range
+    },
+    {
+        "query_all_cells",
+        Spatial_query_all_cells
+    },
+    {
+        "query_max_radius",
+        Spatial_query_max_radius
+    },
+    {
+        "query_stop",
+        Spatial_query_stop
+    },
+    {
+        "query_empty",
+        Spatial_query_empty
+    },
+    {
+        "raycast_neighbor_cell",
+        Spatial_raycast_neighbor_cell
+    },
+    {
+        "raycast_neighbor_cell_all_cells",
+        Spatial_raycast_neighbor_cell_all_cells
+    },
+    {
+        "raycast_neighbor_cells_large_radius",
+        Spatial_raycast_neighbor_cells_large_radius
+    },
+    {
+        "raycast_nearest",
+        Spatial_raycast_nearest
+    },
+    {
+        "raycast_max_distance",
+        Spatial_raycast_max_distance
+    },
+    {
+        "cull",
+        Spatial_cull
+    }
+};
+
+static bake_test_suite suites[] = {
+    {
+        "Occlusion",
+        Occlusion_setup,
+        NULL,
+        18,
+        Occlusion_testcases
+    },
+    {
+        "Kernels",
+        Kernels_setup,
+        NULL,
+        18,
+        Kernels_testcases
+    },
+    {
+        "Spatial",
+        Spatial_setup,
+        Spatial_teardown,
+        19,
+        Spatial_testcases
+    }
+};
+
+int main(int argc, char *argv[]) {
+    return bake_test_run("geometry", argc, argv, suites, 3);
+}
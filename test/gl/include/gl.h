@@ -0,0 +1,8 @@
+#ifndef GL_H
+#define GL_H
+
+/* This generated file contains includes for project dependencies. */
+#include <gl/bake_config.h>
+
+#endif
+
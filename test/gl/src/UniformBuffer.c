@@ -0,0 +1,246 @@
+#include <gl.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdlib.h>
+
+/* Sokol is compiled into the test with a small uniform buffer, so that a few
+ * draws wrap around the ring. Tests run headless on an EGL pbuffer, which
+ * works with software drivers like llvmpipe. */
+#define SOKOL_GFX_IMPL
+#define SOKOL_GLCORE33
+#define SOKOL_GL_UNIFORM_BUFFER_SIZE (1024)
+#include "../../../src/sokol/sokol_gfx.h"
+
+/* Same layout rules as the uniform structs of the module: a vec3 is followed
+ * by a float in the same 16 byte slot, and vec2 is 8 byte aligned. */
+typedef struct fs_params_t {
+    float color[3];
+    float scale;
+    float offset[2];
+    float padding[2];
+} fs_params_t;
+
+static const char *vs =
+    "#version 330\n"
+    "layout(location=0) in vec2 v_position;\n"
+    "void main() {\n"
+    "  gl_Position = vec4(v_position, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *fs_block =
+    "#version 330\n"
+    "layout(std140) uniform fs_params {\n"
+    "  vec3 u_color;\n"
+    "  float u_scale;\n"
+    "  vec2 u_offset;\n"
+    "};\n"
+    "out vec4 frag_color;\n"
+    "void main() {\n"
+    "  frag_color = vec4(u_color * u_scale, u_offset.x + u_offset.y);\n"
+    "}\n";
+
+static const char *fs_native =
+    "#version 330\n"
+    "uniform vec3 u_color;\n"
+    "uniform float u_scale;\n"
+    "uniform vec2 u_offset;\n"
+    "out vec4 frag_color;\n"
+    "void main() {\n"
+    "  frag_color = vec4(u_color * u_scale, u_offset.x + u_offset.y);\n"
+    "}\n";
+
+static EGLDisplay display;
+static EGLContext context;
+static EGLSurface surface;
+static sg_image target;
+static sg_pass pass;
+static sg_buffer quad;
+
+/* Prefer the surfaceless platform, so tests don't need a display server */
+static
+EGLDisplay get_display(void) {
+    EGLDisplay result = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+        result = get_platform_display(
+            EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+#endif
+    if (result == EGL_NO_DISPLAY) {
+        result = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    return result;
+}
+
+void UniformBuffer_setup(void) {
+    display = get_display();
+    test_assert(display != EGL_NO_DISPLAY);
+    test_assert(eglInitialize(display, NULL, NULL));
+
+    EGLint config_attr[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint config_count = 0;
+    eglChooseConfig(display, config_attr, &config, 1, &config_count);
+    test_int(config_count, 1);
+
+    test_assert(eglBindAPI(EGL_OPENGL_API));
+    EGLint context_attr[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attr);
+    test_assert(context != EGL_NO_CONTEXT);
+
+    EGLint surface_attr[] = { EGL_WIDTH, 4, EGL_HEIGHT, 4, EGL_NONE };
+    surface = eglCreatePbufferSurface(display, config, surface_attr);
+    test_assert(surface != EGL_NO_SURFACE);
+    test_assert(eglMakeCurrent(display, surface, surface, context));
+
+    sg_setup(&(sg_desc){0});
+    test_assert(sg_isvalid());
+
+    target = sg_make_image(&(sg_image_desc){
+        .render_target = true,
+        .width = 4,
+        .height = 4,
+        .pixel_format = SG_PIXELFORMAT_RGBA8
+    });
+
+    pass = sg_make_pass(&(sg_pass_desc){
+        .color_attachments[0].image = target
+    });
+
+    float vertices[] = { -1, -1, 1, -1, 1, 1, -1, -1, 1, 1, -1, 1 };
+    quad = sg_make_buffer(&(sg_buffer_desc){
+        .data = SG_RANGE(vertices)
+    });
+}
+
+void UniformBuffer_teardown(void) {
+    sg_shutdown();
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(display, surface);
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+}
+
+static
+sg_pipeline make_pipeline(
+    const char *fs,
+    sg_uniform_layout layout)
+{
+    sg_shader shd = sg_make_shader(&(sg_shader_desc){
+        .vs.source = vs,
+        .fs = {
+            .source = fs,
+            .uniform_blocks[0] = {
+                .size = sizeof(fs_params_t),
+                .layout = layout,
+                .block_name = "fs_params",
+                .uniforms = {
+                    [0] = { .name="u_color", .type=SG_UNIFORMTYPE_FLOAT3 },
+                    [1] = { .name="u_scale", .type=SG_UNIFORMTYPE_FLOAT },
+                    [2] = { .name="u_offset", .type=SG_UNIFORMTYPE_FLOAT2 }
+                }
+            }
+        }
+    });
+    test_assert(sg_query_shader_state(shd) == SG_RESOURCESTATE_VALID);
+
+    sg_pipeline pip = sg_make_pipeline(&(sg_pipeline_desc){
+        .shader = shd,
+        .layout.attrs[0].format = SG_VERTEXFORMAT_FLOAT2,
+        .colors[0].pixel_format = SG_PIXELFORMAT_RGBA8,
+        .depth.pixel_format = SG_PIXELFORMAT_NONE
+    });
+    test_assert(sg_query_pipeline_state(pip) == SG_RESOURCESTATE_VALID);
+
+    return pip;
+}
+
+static
+bool uses_buffer(
+    sg_pipeline pip)
+{
+    _sg_pipeline_t *p = _sg_lookup_pipeline(&_sg.pools, pip.id);
+    return p->shader->gl.stage[SG_SHADERSTAGE_FS].uniform_blocks[0].gl_buffer;
+}
+
+/* Draw with uniforms and test that the color of the target matches */
+static
+void draw(
+    sg_pipeline pip,
+    float value)
+{
+    fs_params_t u = {
+        .color = {value, 0.5f, 1.0f},
+        .scale = 1.0f,
+        .offset = {0.25f, 0.5f}
+    };
+
+    sg_begin_pass(pass, &(sg_pass_action){0});
+    sg_apply_pipeline(pip);
+    sg_apply_bindings(&(sg_bindings){ .vertex_buffers[0] = quad });
+    sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &SG_RANGE(u));
+    sg_draw(0, 6, 1);
+    sg_end_pass();
+    sg_commit();
+
+    uint8_t px[4];
+    _sg_pass_t *p = _sg_lookup_pass(&_sg.pools, pass.id);
+    glBindFramebuffer(GL_FRAMEBUFFER, p->gl.fb);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, px);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    test_assert(abs(px[0] - (int)(value * 255 + 0.5f)) <= 1);
+    test_assert(abs(px[1] - 128) <= 1);
+    test_int(px[2], 255);
+    test_assert(abs(px[3] - 191) <= 1);
+}
+
+void UniformBuffer_std140_block(void) {
+    sg_pipeline pip = make_pipeline(fs_block, SG_UNIFORMLAYOUT_STD140);
+    test_bool(uses_buffer(pip), true);
+
+    draw(pip, 0.0f);
+    draw(pip, 0.5f);
+    draw(pip, 1.0f);
+}
+
+void UniformBuffer_native_uniforms(void) {
+    /* Shader doesn't declare the block, so uniforms are set one by one */
+    sg_pipeline pip = make_pipeline(fs_native, SG_UNIFORMLAYOUT_STD140);
+    test_bool(uses_buffer(pip), false);
+
+    draw(pip, 0.0f);
+    draw(pip, 0.5f);
+    draw(pip, 1.0f);
+}
+
+void UniformBuffer_ring_wrap(void) {
+    sg_pipeline pip_block = make_pipeline(fs_block, SG_UNIFORMLAYOUT_STD140);
+    sg_pipeline pip_native = make_pipeline(fs_native, SG_UNIFORMLAYOUT_STD140);
+
+    /* Each block upload takes at least 32 bytes of the 1KB ring, so this wraps
+     * around several times. Alternate pipelines so that uploads to the buffer
+     * are interleaved with plain uniform calls. */
+    int32_t i, wraps = 0, offset = _sg.gl.ubo_offset;
+    for (i = 0; i < 200; i ++) {
+        draw((i % 2) ? pip_native : pip_block, (float)(i % 10) / 10.0f);
+        if (_sg.gl.ubo_offset < offset) {
+            wraps ++;
+        }
+        offset = _sg.gl.ubo_offset;
+    }
+
+    test_assert(wraps > 1);
+}
@@ -0,0 +1,45 @@
+
+/* A friendly warning from bake.test
+ * ----------------------------------------------------------------------------
+ * This file is generated. To add/remove testcases modify the 'project.json' of
+ * the test project. ANY CHANGE TO THIS FILE IS LOST AFTER (RE)BUILDING!
+ * ----------------------------------------------------------------------------
+ */
+
+#include <gl.h>
+
+// Testsuite 'UniformBuffer'
+void UniformBuffer_setup(void);
+void UniformBuffer_teardown(void);
+void UniformBuffer_std140_block(void);
+void UniformBuffer_native_uniforms(void);
+void UniformBuffer_ring_wrap(void);
+
+bake_test_case UniformBuffer_testcases[] = {
+    {
+        "std140_block",
+        UniformBuffer_std140_block
+    },
+    {
+        "native_uniforms",
+        UniformBuffer_native_uniforms
+    },
+    {
+        "ring_wrap",
+        UniformBuffer_ring_wrap
+    }
+};
+
+static bake_test_suite suites[] = {
+    {
+        "UniformBuffer",
+        UniformBuffer_setup,
+        UniformBuffer_teardown,
+        3,
+        UniformBuffer_testcases
+    }
+};
+
+int main(int argc, char *argv[]) {
+    return bake_test_run("gl", argc, argv, suites, 1);
+}